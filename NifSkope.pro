@@ -138,8 +138,11 @@ include(NifSkope_targets.pri)
 ###############################
 
 HEADERS += \
+	src/assetscanner.h \
 	src/basemodel.h \
+	src/batchrunner.h \
 	src/config.h \
+	src/convertbatch.h \
 	src/gl/dds/BlockDXT.h \
 	src/gl/dds/Color.h \
 	src/gl/dds/ColorBlock.h \
@@ -150,6 +153,7 @@ HEADERS += \
 	src/gl/dds/PixelFormat.h \
 	src/gl/dds/Stream.h \
 	src/gl/controllers.h \
+	src/gl/glbvh.h \
 	src/gl/glcontroller.h \
 	src/gl/glmarker.h \
 	src/gl/glmesh.h \
@@ -164,20 +168,28 @@ HEADERS += \
 	src/gl/marker/constraints.h \
 	src/gl/marker/furniture.h \
 	src/gl/renderer.h \
+	src/functionrunnable.h \
 	src/glview.h \
 	src/importex/3ds.h \
 	src/kfmmodel.h \
+	src/loadbenchmark.h \
 	src/message.h \
+	src/nifdiff.h \
 	src/nifexpr.h \
 	src/nifitem.h \
 	src/nifmodel.h \
 	src/nifproxy.h \
+	src/nifsearch.h \
 	src/nifskope.h \
+	src/nifsnapshot.h \
 	src/niftypes.h \
 	src/nifvalue.h \
     src/nvtristripwrapper.h \
 	src/qhull.h \
 	src/settings.h \
+	src/settingssnapshot.h \
+	src/skeletoncompare.h \
+	src/spellbatch.h \
 	src/spellbook.h \
 	src/spells/blocks.h \
 	src/spells/mesh.h \
@@ -187,6 +199,7 @@ HEADERS += \
 	src/spells/tangentspace.h \
 	src/spells/texture.h \
 	src/spells/transform.h \
+	src/trace.h \
 	src/widgets/colorwheel.h \
 	src/widgets/fileselect.h \
 	src/widgets/floatedit.h \
@@ -197,6 +210,7 @@ HEADERS += \
 	src/widgets/nifeditors.h \
 	src/widgets/nifview.h \
 	src/widgets/refrbrowser.h \
+	src/widgets/thumbnails.h \
 	src/widgets/uvedit.h \
 	src/widgets/valueedit.h \
 	src/widgets/xmlcheck.h \
@@ -211,7 +225,10 @@ HEADERS += \
 	src/material.h
 
 SOURCES += \
+	src/assetscanner.cpp \
 	src/basemodel.cpp \
+	src/batchrunner.cpp \
+	src/convertbatch.cpp \
 	src/gl/dds/BlockDXT.cpp \
 	src/gl/dds/ColorBlock.cpp \
 	src/gl/dds/dds_api.cpp \
@@ -219,6 +236,7 @@ SOURCES += \
 	src/gl/dds/Image.cpp \
 	src/gl/dds/Stream.cpp \
 	src/gl/controllers.cpp \
+	src/gl/glbvh.cpp \
 	src/gl/glcontroller.cpp \
 	src/gl/glmarker.cpp \
 	src/gl/glmesh.cpp \
@@ -235,21 +253,30 @@ SOURCES += \
 	src/importex/importex.cpp \
 	src/importex/obj.cpp \
 	src/importex/col.cpp \
+	src/importex/gltf.cpp \
 	src/kfmmodel.cpp \
+	src/loadbenchmark.cpp \
 	src/kfmxml.cpp \
 	src/message.cpp \
 	src/nifdelegate.cpp \
+	src/nifdiff.cpp \
+	src/nifdocumentcache.cpp \
 	src/nifexpr.cpp \
 	src/nifmodel.cpp \
 	src/nifproxy.cpp \
+	src/nifsearch.cpp \
 	src/nifskope.cpp \
 	src/nifskope_ui.cpp \
+	src/nifsnapshot.cpp \
 	src/niftypes.cpp \
 	src/nifvalue.cpp \
 	src/nifxml.cpp \
     src/nvtristripwrapper.cpp \
 	src/qhull.cpp \
 	src/settings.cpp \
+	src/settingssnapshot.cpp \
+	src/skeletoncompare.cpp \
+	src/spellbatch.cpp \
 	src/spellbook.cpp \
 	src/spells/animation.cpp \
 	src/spells/blocks.cpp \
@@ -260,6 +287,7 @@ SOURCES += \
 	src/spells/havok.cpp \
 	src/spells/headerstring.cpp \
 	src/spells/light.cpp \
+	src/spells/lod.cpp \
 	src/spells/materialedit.cpp \
 	src/spells/mesh.cpp \
 	src/spells/misc.cpp \
@@ -274,6 +302,7 @@ SOURCES += \
 	src/spells/tangentspace.cpp \
 	src/spells/texture.cpp \
 	src/spells/transform.cpp \
+	src/trace.cpp \
 	src/widgets/colorwheel.cpp \
 	src/widgets/fileselect.cpp \
 	src/widgets/floatedit.cpp \
@@ -284,6 +313,7 @@ SOURCES += \
 	src/widgets/nifeditors.cpp \
 	src/widgets/nifview.cpp \
 	src/widgets/refrbrowser.cpp \
+	src/widgets/thumbnails.cpp \
 	src/widgets/uvedit.cpp \
 	src/widgets/valueedit.cpp \
 	src/widgets/xmlcheck.cpp \
@@ -316,10 +346,12 @@ fsengine {
 	INCLUDEPATH += lib/fsengine
 	HEADERS += \
 		lib/fsengine/bsa.h \
+		lib/fsengine/bsawriter.h \
 		lib/fsengine/fsengine.h \
 		lib/fsengine/fsmanager.h
 	SOURCES += \
 		lib/fsengine/bsa.cpp \
+		lib/fsengine/bsawriter.cpp \
 		lib/fsengine/fsengine.cpp \
 		lib/fsengine/fsmanager.cpp
 }
@@ -488,6 +520,8 @@ win32 {
 win32 {
     # GL libs for Qt 5.5+
     LIBS += -lopengl32 -lglu32
+    # Peak memory of the benchmark
+    LIBS += -lpsapi
 }
 
 unix:!macx {
@@ -160,11 +160,34 @@ doxygen.commands += doxygen $${doxyfile} $$nt
 doxygen.CONFIG += recursive
 
 
+###############################
+## Benchmark
+###############################
+# Times loading, saving and reading the NIFs of a corpus, per game version
+#
+# Usage:
+#    jom release-benchmark CORPUS=path/to/meshes
+#
+# "release-benchmark" is an alias for:
+#
+#    jom -f Makefile.Release benchmark CORPUS=path/to/meshes
+#
+# CORPUS may also list archives. Run NifSkope -no-gui --benchmark --repeat n
+# directly to keep the fastest of n loads and saves of each file.
+#______________________________
+
+benchmark.target = benchmark
+
+benchmark.commands += $$syspath($${DESTDIR}/$${TARGET}$${EXE}) -no-gui --benchmark --recursive $(CORPUS) $$nt
+
+benchmark.CONFIG += recursive
+
+
 ###############################
 ## ADD TARGETS
 ###############################
 
-QMAKE_EXTRA_TARGETS += docs doxygen
+QMAKE_EXTRA_TARGETS += docs doxygen benchmark
 
 
 
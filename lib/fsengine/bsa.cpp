@@ -34,14 +34,23 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "dds.h"
 #include "zlib/zlib.h"
 #include "lz4frame.h"
+#include "trace.h"
 
 #include <QByteArray>
+#include <QCryptographicHash>
+#include <QDataStream>
 #include <QDateTime>
 #include <QDebug>
 #include <QDir>
 #include <QFile>
 #include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
 #include <QStringBuilder>
+#include <QThreadStorage>
+
+#include <algorithm>
+#include <cstring>
 
 
 // see bsa.h
@@ -138,6 +147,93 @@ QByteArray gUncompress( const QByteArray & data, const int size )
 	return result;
 }
 
+//! Decompression state kept per thread and reused from file to file
+struct Decompressor
+{
+	~Decompressor()
+	{
+		discardLz4();
+		if ( zlibReady )
+			inflateEnd( &zlib );
+	}
+
+	//! The LZ4 frame context, created on first use
+	LZ4F_decompressionContext_t lz4Context()
+	{
+		if ( !lz4 && LZ4F_isError( LZ4F_createDecompressionContext( &lz4, LZ4F_VERSION ) ) )
+			lz4 = nullptr;
+
+		return lz4;
+	}
+
+	//! Drop the LZ4 context after an error or an incomplete frame, it cannot be reset
+	void discardLz4()
+	{
+		if ( lz4 )
+			LZ4F_freeDecompressionContext( lz4 );
+		lz4 = nullptr;
+	}
+
+	//! The zlib stream, reset for a new stream
+	z_stream * inflater()
+	{
+		if ( !zlibReady )
+			zlibReady = ( inflateInit2( &zlib, 15 + 32 ) == Z_OK ); // gzip decoding
+		else if ( inflateReset( &zlib ) != Z_OK )
+			return nullptr;
+
+		return zlibReady ? &zlib : nullptr;
+	}
+
+private:
+	LZ4F_decompressionContext_t lz4 = nullptr;
+	z_stream zlib = {};
+	bool zlibReady = false;
+};
+
+//! Gets the decompression state of the calling thread
+static Decompressor & decompressor()
+{
+	static QThreadStorage<Decompressor *> storage;
+	if ( !storage.hasLocalData() )
+		storage.setLocalData( new Decompressor );
+
+	return *storage.localData();
+}
+
+//! Inflate \a size bytes at \a data into the \a outSize bytes at \a out
+/*!
+ * \return The number of bytes written, or -1 if the stream is corrupt or does not fit
+ */
+static qint64 uncompressInto( const char * data, qint64 size, char * out, qint64 outSize )
+{
+	z_stream * strm = decompressor().inflater();
+	if ( !strm )
+		return -1;
+
+	strm->avail_in = size;
+	strm->next_in = (Bytef*)(data);
+	strm->avail_out = outSize;
+	strm->next_out = (Bytef*)(out);
+
+	int ret = inflate( strm, Z_FINISH );
+	qint64 written = outSize - strm->avail_out;
+
+	return ( ret == Z_STREAM_END ) ? written : -1;
+}
+
+//! Inflate into \a content, which is sized for the \a outSize bytes the archive says the file has
+static bool uncompressSized( const char * data, qint64 size, qint64 outSize, QByteArray & content )
+{
+	content.resize( outSize );
+	qint64 written = uncompressInto( data, size, content.data(), outSize );
+	if ( written < 0 )
+		return false;
+
+	content.resize( written );
+	return true;
+}
+
 // see bsa.h
 BSA::BSA( const QString & filename )
 	: FSArchiveFile(), bsa( filename ), bsaInfo( QFileInfo(filename) ), status( "initialized" )
@@ -190,16 +286,22 @@ bool BSA::open()
 {
 	QMutexLocker lock( & bsaMutex );
 	
+	bool cached = false;
+	
 	try
 	{
 		if ( ! bsa.open( QIODevice::ReadOnly ) )
 			throw QString( "file open" );
 		
-		quint32 magic;
+		quint32 magic = 0;
 		
-		bsa.read( (char*) &magic, sizeof( magic ) );
+		cached = loadCache();
+		if ( !cached )
+			bsa.read( (char*) &magic, sizeof( magic ) );
 
-		if ( magic == F4_BSAHEADER_FILEID ) {
+		if ( cached ) {
+			// The directory was restored without reading the archive headers
+		} else if ( magic == F4_BSAHEADER_FILEID ) {
 			bsa.read( (char*)&version, sizeof( version ) );
 
 			if ( version != F4_BSAHEADER_VERSION )
@@ -435,15 +537,166 @@ bool BSA::open()
 	}
 	
 	status = "loaded successful";
+
+	if ( !cached )
+		saveCache();
+
+	// Reads from a mapping need no lock and no shared file position
+	mapped = bsa.map( 0, bsa.size() );
+	mappedSize = mapped ? bsa.size() : 0;
 	
 	return true;
 }
 
+//! Identifies a directory cache file
+#define BSA_CACHE_MAGIC 0x42534143
+//! Bumped whenever the layout of the directory cache changes
+#define BSA_CACHE_VERSION 1
+
+// see bsa.h
+QString BSA::cacheName() const
+{
+	QString cacheDir = QStandardPaths::writableLocation( QStandardPaths::CacheLocation );
+	if ( cacheDir.isEmpty() )
+		return QString();
+
+	QByteArray key = QCryptographicHash::hash( bsaPath.toLower().toUtf8(), QCryptographicHash::Sha1 );
+
+	return QDir( cacheDir ).filePath( "archives/" % QString::fromLatin1( key.toHex() ) % ".cache" );
+}
+
+// see bsa.h
+bool BSA::loadCache()
+{
+	QString cachename = cacheName();
+	if ( cachename.isEmpty() )
+		return false;
+
+	QFile f( cachename );
+
+	if ( !f.open( QIODevice::ReadOnly ) )
+		return false;
+
+	QByteArray data = f.readAll();
+	QDataStream in( data );
+	in.setVersion( QDataStream::Qt_5_0 );
+
+	quint32 magic = 0, cacheVersion = 0;
+	QString cachePath;
+	qint64 cacheSize = 0;
+	QDateTime cacheTime;
+	in >> magic >> cacheVersion >> cachePath >> cacheSize >> cacheTime;
+
+	// Any change to the archive invalidates its directory
+	QFileInfo info( bsaPath );
+	if ( magic != BSA_CACHE_MAGIC || cacheVersion != BSA_CACHE_VERSION || cachePath != bsaPath
+		|| cacheSize != info.size() || cacheTime != info.lastModified() )
+		return false;
+
+	quint32 cacheArchiveVersion = 0, count = 0;
+	qint64 cacheNumFiles = 0;
+	bool cacheCompress = false, cachePrefix = false;
+	in >> cacheArchiveVersion >> cacheNumFiles >> cacheCompress >> cachePrefix >> count;
+
+	struct Entry
+	{
+		QString folder;
+		QString name;
+		BSAFile file;
+	};
+
+	QVector<Entry> entries;
+	entries.reserve( int( qMin<quint32>( count, 1 << 20 ) ) );
+
+	for ( quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++ ) {
+		Entry e;
+		quint32 chunks = 0;
+		in >> e.folder >> e.name >> e.file.sizeFlags >> e.file.packedLength >> e.file.unpackedLength >> e.file.offset >> chunks;
+
+		if ( chunks ) {
+			if ( chunks > 0xff || in.readRawData( (char *) &e.file.tex.header, sizeof( F4TexInfo ) ) != sizeof( F4TexInfo ) )
+				return false;
+
+			e.file.tex.chunks.resize( chunks );
+			int len = int( chunks * sizeof( F4TexChunk ) );
+			if ( in.readRawData( (char *) e.file.tex.chunks.data(), len ) != len )
+				return false;
+		}
+
+		entries.append( e );
+	}
+
+	if ( in.status() != QDataStream::Ok )
+		return false;
+
+	version = cacheArchiveVersion;
+	numFiles = cacheNumFiles;
+	compressToggle = cacheCompress;
+	namePrefix = cachePrefix;
+
+	for ( const Entry & e : entries ) {
+		BSAFile * file = insertFile( insertFolder( e.folder ), e.name, 0, 0 );
+		*file = e.file;
+	}
+
+	return true;
+}
+
+// see bsa.h
+void BSA::saveCache() const
+{
+	QString cachename = cacheName();
+	if ( cachename.isEmpty() )
+		return;
+
+	QDir().mkpath( QFileInfo( cachename ).absolutePath() );
+
+	QSaveFile f( cachename );
+
+	if ( !f.open( QIODevice::WriteOnly ) )
+		return;
+
+	QDataStream out( &f );
+	out.setVersion( QDataStream::Qt_5_0 );
+
+	QFileInfo info( bsaPath );
+	out << quint32( BSA_CACHE_MAGIC ) << quint32( BSA_CACHE_VERSION ) << bsaPath << info.size() << info.lastModified();
+	out << quint32( version ) << numFiles << compressToggle << namePrefix << quint32( files.count() );
+
+	QList<const BSAFolder *> pending{ root };
+	while ( !pending.isEmpty() ) {
+		const BSAFolder * folder = pending.takeFirst();
+
+		for ( auto it = folder->files.constBegin(); it != folder->files.constEnd(); ++it ) {
+			const BSAFile * file = it.value();
+			quint32 chunks = quint32( file->tex.chunks.count() );
+
+			out << folder->name << it.key() << file->sizeFlags << file->packedLength << file->unpackedLength << file->offset << chunks;
+
+			if ( chunks ) {
+				out.writeRawData( (const char *) &file->tex.header, sizeof( F4TexInfo ) );
+				out.writeRawData( (const char *) file->tex.chunks.constData(), int( chunks * sizeof( F4TexChunk ) ) );
+			}
+		}
+
+		for ( const BSAFolder * child : folder->children )
+			pending.append( child );
+	}
+
+	f.commit();
+}
+
 // see bsa.h
 void BSA::close()
 {
 	QMutexLocker lock( & bsaMutex );
 	
+	if ( mapped ) {
+		bsa.unmap( mapped );
+		mapped = nullptr;
+		mappedSize = 0;
+	}
+
 	bsa.close();
 	qDeleteAll( root->children );
 	qDeleteAll( root->files );
@@ -466,197 +719,328 @@ qint64 BSA::fileSize( const QString & fn ) const
 }
 
 // see bsa.h
-bool BSA::fileContents( const QString & fn, QByteArray & content )
+qint64 BSA::fileOffset( const QString & fn ) const
 {
-	//qDebug() << "entering fileContents for" << fn;
 	if ( const BSAFile * file = getFile( fn ) )
 	{
-		QMutexLocker lock( & bsaMutex );
-		if ( bsa.seek( file->offset ) )
-		{
-			qint64 filesz = file->size();
-			bool ok = true;
-			if (namePrefix) {
-				char len;
-				ok = bsa.read(&len, 1);
-				filesz -= len + 1;
-				if (ok) ok = bsa.seek( file->offset + 1 + len );
-			}
+		if ( file->tex.chunks.count() )
+			return file->tex.chunks.first().offset;
+		return file->offset;
+	}
+	return 0;
+}
 
-			quint32 filesize = filesz;
-			if ( version == SSE_BSAHEADER_VERSION && file->sizeFlags > 0 && (file->compressed() ^ compressToggle) ) {
-				ok = bsa.read( (char*)&filesize, 4 );
-				filesz -= 4;
-			}
+// see bsa.h
+bool BSA::fileContents( const QString & fn, QByteArray & content )
+{
+	TRACE_SPAN( "BSA::fileContents", fn );
 
-			content.resize( filesz );
-			if ( ok && bsa.read( content.data(), filesz ) == filesz ) {
-				if ( file->sizeFlags > 0 && (file->compressed() ^ compressToggle) ) {
-					// BSA
-					if ( version != SSE_BSAHEADER_VERSION ) {
-						content.remove( 0, 4 );
-						QByteArray tmp3( content );
-
-						content = gUncompress( tmp3, filesz - 4 );
-					} else {
-						QByteArray tmp;
-						tmp.resize( filesize );
-
-						LZ4F_decompressionContext_t dCtx = nullptr;
-						LZ4F_createDecompressionContext( &dCtx, LZ4F_VERSION );
-						size_t dstSize = filesize;
-						size_t srcSize = content.size();
-
-						LZ4F_decompressOptions_t options = {};
-
-						LZ4F_decompress( dCtx, tmp.data(), &dstSize, content.data(), &srcSize, &options );
-						LZ4F_errorCode_t error = LZ4F_freeDecompressionContext( dCtx );
-						if ( error ) {
-							// TODO: Message logger
-							qDebug() << fn << "Error Code: " << error;
-						}
+	//qDebug() << "entering fileContents for" << fn;
+	const BSAFile * file = getFile( fn );
+	if ( !file )
+		return false;
 
-						content = tmp;
-					}
-				} else if ( file->packedLength > 0 && !file->tex.chunks.count() ) {
-					// General BA2
-					QByteArray tmp( content );
-					content.resize( file->unpackedLength );
-					content = gUncompress( tmp, file->packedLength );
-				} else if ( file->tex.chunks.count() ) {
-					// Fill DDS Header
-					DDS_HEADER ddsHeader = {};
-					DDS_HEADER_DXT10 dx10Header = {};
-
-					bool dx10 = false;
-
-					ddsHeader.dwSize = sizeof( ddsHeader );
-					ddsHeader.dwHeaderFlags = DDS_HEADER_FLAGS_TEXTURE | DDS_HEADER_FLAGS_LINEARSIZE | DDS_HEADER_FLAGS_MIPMAP;
-					ddsHeader.dwHeight = file->tex.header.height;
-					ddsHeader.dwWidth = file->tex.header.width;
-					ddsHeader.dwMipMapCount = file->tex.header.numMips;
-					ddsHeader.ddspf.dwSize = sizeof( DDS_PIXELFORMAT );
-					ddsHeader.dwSurfaceFlags = DDS_SURFACE_FLAGS_TEXTURE | DDS_SURFACE_FLAGS_MIPMAP;
-
-					if ( file->tex.header.unk16 == 2049 )
-						ddsHeader.dwCubemapFlags = DDS_CUBEMAP_ALLFACES;
-
-					bool supported = true;
-
-					switch ( file->tex.header.format ) {
-					case DXGI_FORMAT_BC1_UNORM:
-						ddsHeader.ddspf.dwFlags = DDS_FOURCC;
-						ddsHeader.ddspf.dwFourCC = MAKEFOURCC( 'D', 'X', 'T', '1' );
-						ddsHeader.dwPitchOrLinearSize = file->tex.header.width * file->tex.header.height / 2;	// 4bpp
-						break;
-
-					case DXGI_FORMAT_BC2_UNORM:
-						ddsHeader.ddspf.dwFlags = DDS_FOURCC;
-						ddsHeader.ddspf.dwFourCC = MAKEFOURCC( 'D', 'X', 'T', '3' );
-						ddsHeader.dwPitchOrLinearSize = file->tex.header.width * file->tex.header.height;	// 8bpp
-						break;
-
-					case DXGI_FORMAT_BC3_UNORM:
-						ddsHeader.ddspf.dwFlags = DDS_FOURCC;
-						ddsHeader.ddspf.dwFourCC = MAKEFOURCC( 'D', 'X', 'T', '5' );
-						ddsHeader.dwPitchOrLinearSize = file->tex.header.width * file->tex.header.height;	// 8bpp
-						break;
-
-					case DXGI_FORMAT_BC5_UNORM:
-						ddsHeader.ddspf.dwFlags = DDS_FOURCC;
-						ddsHeader.ddspf.dwFourCC = MAKEFOURCC( 'A', 'T', 'I', '2' );
-						ddsHeader.dwPitchOrLinearSize = file->tex.header.width * file->tex.header.height;	// 8bpp
-						break;
-
-					case DXGI_FORMAT_BC7_UNORM:
-						ddsHeader.ddspf.dwFlags = DDS_FOURCC;
-						ddsHeader.ddspf.dwFourCC = MAKEFOURCC( 'D', 'X', '1', '0' );
-						ddsHeader.dwPitchOrLinearSize = file->tex.header.width * file->tex.header.height;	// 8bpp
-
-						dx10 = true;
-						dx10Header.dxgiFormat = DXGI_FORMAT_BC7_UNORM;
-						break;
-
-					case DXGI_FORMAT_B8G8R8A8_UNORM:
-						ddsHeader.ddspf.dwFlags = DDS_RGBA;
-						ddsHeader.ddspf.dwRGBBitCount = 32;
-						ddsHeader.ddspf.dwRBitMask = 0x00FF0000;
-						ddsHeader.ddspf.dwGBitMask = 0x0000FF00;
-						ddsHeader.ddspf.dwBBitMask = 0x000000FF;
-						ddsHeader.ddspf.dwABitMask = 0xFF000000;
-						ddsHeader.dwPitchOrLinearSize = file->tex.header.width * file->tex.header.height * 4;	// 32bpp
-						break;
-
-					case DXGI_FORMAT_R8_UNORM:
-						ddsHeader.ddspf.dwFlags = DDS_RGB;
-						ddsHeader.ddspf.dwRGBBitCount = 8;
-						ddsHeader.ddspf.dwRBitMask = 0xFF;
-						ddsHeader.dwPitchOrLinearSize = file->tex.header.width * file->tex.header.height;	// 8bpp
-						break;
-
-					default:
-						supported = false;
-						break;
-					}
+	if ( file->tex.chunks.count() )
+		return textureContents( file, content );
+
+	// Only the reads are serialised, the decompression below runs in parallel
+	qint64 offset = file->offset;
+	qint64 filesz = file->size();
+	bool ok = true;
+	if (namePrefix) {
+		char len;
+		ok = readAt( offset, &len, 1 );
+		filesz -= len + 1;
+		offset += 1 + len;
+	}
 
-					if ( !supported )
-						return false;
+	bool compressed = file->sizeFlags > 0 && (file->compressed() ^ compressToggle);
 
-					char dds[sizeof( ddsHeader )];
-					memcpy( dds, &ddsHeader, sizeof( ddsHeader ) );
+	quint32 filesize = filesz;
+	if ( version == SSE_BSAHEADER_VERSION && compressed ) {
+		ok = ok && readAt( offset, (char*)&filesize, 4 );
+		offset += 4;
+		filesz -= 4;
+	}
 
-					int texSize = 0; // = file->unpackedLength;
-					int hdrSize = sizeof( ddsHeader ) + 4;
+	if ( !ok || filesz < 0 )
+		return false;
 
-					content.clear();
-					content.append( QByteArray::fromStdString( "DDS " ) );
-					content.append( QByteArray::fromRawData( dds, sizeof( ddsHeader ) ) );
-					Q_ASSERT( content.size() == hdrSize );
+	// Use the stored data in place when the archive is mapped
+	QByteArray stored;
+	const char * src = view( offset, filesz );
+	if ( !src ) {
+		stored.resize( filesz );
+		if ( !readAt( offset, stored.data(), filesz ) )
+			return false;
 
-					if ( dx10 ) {
-						dx10Header.resourceDimension = DDS_DIMENSION_TEXTURE2D;
-						dx10Header.miscFlag = 0;
-						dx10Header.arraySize = 1;
-						dx10Header.miscFlags2 = 0;
+		src = stored.constData();
+	}
 
-						char dds2[sizeof( dx10Header )];
-						memcpy( dds2, &dx10Header, sizeof( dx10Header ) );
-						content.append( QByteArray::fromRawData( dds2, sizeof( dx10Header ) ) );
-					}
+	if ( compressed ) {
+		// BSA
+		if ( version != SSE_BSAHEADER_VERSION ) {
+			// The zlib stream follows the size of the uncompressed file
+			if ( filesz < 4 )
+				return false;
 
-					// Start at 1st chunk now
-					for ( int i = 0; i < file->tex.chunks.count(); i++ ) {
-						F4TexChunk chunk = file->tex.chunks[i];
-						if ( bsa.seek( chunk.offset ) ) {
-							QByteArray chunkData;
-
-							if ( chunk.packedSize > 0 ) {
-								chunkData.resize( chunk.packedSize );
-								if ( bsa.read( chunkData.data(), chunk.packedSize ) == chunk.packedSize ) {
-									chunkData = gUncompress( chunkData, chunk.packedSize );
-
-									if ( chunkData.size() != chunk.unpackedSize )
-										qCritical() << "Size does not match at " << chunk.offset;
-								}
-							} else if ( !(bsa.read( chunkData.data(), chunk.unpackedSize ) == chunk.unpackedSize) ) {
-								qCritical() << "Size does not match at " << chunk.offset;
-							}
-							texSize += chunk.unpackedSize;
-
-							content.append( chunkData );
-							//Q_ASSERT( content.size() - hdrSize == texSize );
-						} else {
-							qCritical() << "Seek error";
-						}
-					}
+			quint32 unpacked;
+			memcpy( &unpacked, src, 4 );
+
+			// A size past 1 GiB is treated as corrupt and the stream is grown as it inflates
+			if ( unpacked > 0x40000000 || !uncompressSized( src + 4, filesz - 4, unpacked, content ) )
+				content = gUncompress( QByteArray::fromRawData( src + 4, filesz - 4 ), filesz - 4 );
+		} else {
+			content.resize( filesize );
+
+			Decompressor & d = decompressor();
+			LZ4F_decompressionContext_t dCtx = d.lz4Context();
+			if ( !dCtx )
+				return false;
 
+			size_t dstSize = filesize;
+			size_t srcSize = filesz;
+
+			LZ4F_decompressOptions_t options = {};
+
+			// A finished frame leaves the context ready for the next file
+			size_t ret = LZ4F_decompress( dCtx, content.data(), &dstSize, src, &srcSize, &options );
+			if ( ret != 0 ) {
+				d.discardLz4();
+				if ( LZ4F_isError( ret ) ) {
+					// TODO: Message logger
+					qDebug() << fn << "Error Code: " << LZ4F_getErrorName( ret );
 				}
+			}
+		}
+	} else if ( file->packedLength > 0 ) {
+		// General BA2
+		if ( !uncompressSized( src, file->packedLength, file->unpackedLength, content ) )
+			content = gUncompress( QByteArray::fromRawData( src, filesz ), file->packedLength );
+	} else if ( stored.isEmpty() ) {
+		// Copied out of the mapping, the contents are kept past the archive being closed
+		content = QByteArray( src, int( filesz ) );
+	} else {
+		content = stored;
+	}
 
-				return true;
+	return true;
+}
+
+// see bsa.h
+bool BSA::textureContents( const BSAFile * file, QByteArray & content, int firstMip, int lastMip )
+{
+	const QVector<F4TexChunk> & allChunks = file->tex.chunks;
+	int numMips = qMax<int>( file->tex.header.numMips, 1 );
+
+	if ( lastMip < 0 || lastMip >= numMips )
+		lastMip = numMips - 1;
+	firstMip = qBound( 0, firstMip, lastMip );
+
+	// Chunks hold whole mip ranges, so the range grows to the chunks it touches.
+	// Cube maps store every face in each chunk and are always read in full.
+	int first = 0, last = allChunks.count() - 1;
+	if ( file->tex.header.unk16 != 2049 && ( firstMip > 0 || lastMip < numMips - 1 ) ) {
+		while ( first < last && allChunks.at( first ).endMip < firstMip )
+			first++;
+		while ( last > first && allChunks.at( last ).startMip > lastMip )
+			last--;
+
+		firstMip = allChunks.at( first ).startMip;
+		lastMip = qMin<int>( allChunks.at( last ).endMip, numMips - 1 );
+	} else {
+		firstMip = 0;
+		lastMip = numMips - 1;
+	}
+
+	quint32 width = qMax( 1, file->tex.header.width >> firstMip );
+	quint32 height = qMax( 1, file->tex.header.height >> firstMip );
+
+	// Fill DDS Header
+	DDS_HEADER ddsHeader = {};
+	DDS_HEADER_DXT10 dx10Header = {};
+
+	bool dx10 = false;
+
+	ddsHeader.dwSize = sizeof( ddsHeader );
+	ddsHeader.dwHeaderFlags = DDS_HEADER_FLAGS_TEXTURE | DDS_HEADER_FLAGS_LINEARSIZE | DDS_HEADER_FLAGS_MIPMAP;
+	ddsHeader.dwHeight = height;
+	ddsHeader.dwWidth = width;
+	ddsHeader.dwMipMapCount = lastMip - firstMip + 1;
+	ddsHeader.ddspf.dwSize = sizeof( DDS_PIXELFORMAT );
+	ddsHeader.dwSurfaceFlags = DDS_SURFACE_FLAGS_TEXTURE | DDS_SURFACE_FLAGS_MIPMAP;
+
+	if ( file->tex.header.unk16 == 2049 )
+		ddsHeader.dwCubemapFlags = DDS_CUBEMAP_ALLFACES;
+
+	bool supported = true;
+
+	switch ( file->tex.header.format ) {
+	case DXGI_FORMAT_BC1_UNORM:
+		ddsHeader.ddspf.dwFlags = DDS_FOURCC;
+		ddsHeader.ddspf.dwFourCC = MAKEFOURCC( 'D', 'X', 'T', '1' );
+		ddsHeader.dwPitchOrLinearSize = width * height / 2;	// 4bpp
+		break;
+
+	case DXGI_FORMAT_BC2_UNORM:
+		ddsHeader.ddspf.dwFlags = DDS_FOURCC;
+		ddsHeader.ddspf.dwFourCC = MAKEFOURCC( 'D', 'X', 'T', '3' );
+		ddsHeader.dwPitchOrLinearSize = width * height;	// 8bpp
+		break;
+
+	case DXGI_FORMAT_BC3_UNORM:
+		ddsHeader.ddspf.dwFlags = DDS_FOURCC;
+		ddsHeader.ddspf.dwFourCC = MAKEFOURCC( 'D', 'X', 'T', '5' );
+		ddsHeader.dwPitchOrLinearSize = width * height;	// 8bpp
+		break;
+
+	case DXGI_FORMAT_BC5_UNORM:
+		ddsHeader.ddspf.dwFlags = DDS_FOURCC;
+		ddsHeader.ddspf.dwFourCC = MAKEFOURCC( 'A', 'T', 'I', '2' );
+		ddsHeader.dwPitchOrLinearSize = width * height;	// 8bpp
+		break;
+
+	case DXGI_FORMAT_BC7_UNORM:
+		ddsHeader.ddspf.dwFlags = DDS_FOURCC;
+		ddsHeader.ddspf.dwFourCC = MAKEFOURCC( 'D', 'X', '1', '0' );
+		ddsHeader.dwPitchOrLinearSize = width * height;	// 8bpp
+
+		dx10 = true;
+		dx10Header.dxgiFormat = DXGI_FORMAT_BC7_UNORM;
+		break;
+
+	case DXGI_FORMAT_B8G8R8A8_UNORM:
+		ddsHeader.ddspf.dwFlags = DDS_RGBA;
+		ddsHeader.ddspf.dwRGBBitCount = 32;
+		ddsHeader.ddspf.dwRBitMask = 0x00FF0000;
+		ddsHeader.ddspf.dwGBitMask = 0x0000FF00;
+		ddsHeader.ddspf.dwBBitMask = 0x000000FF;
+		ddsHeader.ddspf.dwABitMask = 0xFF000000;
+		ddsHeader.dwPitchOrLinearSize = width * height * 4;	// 32bpp
+		break;
+
+	case DXGI_FORMAT_R8_UNORM:
+		ddsHeader.ddspf.dwFlags = DDS_RGB;
+		ddsHeader.ddspf.dwRGBBitCount = 8;
+		ddsHeader.ddspf.dwRBitMask = 0xFF;
+		ddsHeader.dwPitchOrLinearSize = width * height;	// 8bpp
+		break;
+
+	default:
+		supported = false;
+		break;
+	}
+
+	if ( !supported )
+		return false;
+
+	int hdrSize = sizeof( ddsHeader ) + 4;
+	if ( dx10 )
+		hdrSize += sizeof( dx10Header );
+
+	QVector<F4TexChunk> chunks = allChunks.mid( first, last - first + 1 );
+
+	qint64 texSize = 0;
+	for ( const F4TexChunk & chunk : chunks )
+		texSize += chunk.unpackedSize;
+
+	// Decompress each chunk straight into its place after the header
+	content.resize( hdrSize + texSize );
+	char * out = content.data();
+
+	memcpy( out, "DDS ", 4 );
+	memcpy( out + 4, &ddsHeader, sizeof( ddsHeader ) );
+
+	if ( dx10 ) {
+		dx10Header.resourceDimension = DDS_DIMENSION_TEXTURE2D;
+		dx10Header.miscFlag = 0;
+		dx10Header.arraySize = 1;
+		dx10Header.miscFlags2 = 0;
+
+		memcpy( out + 4 + sizeof( ddsHeader ), &dx10Header, sizeof( dx10Header ) );
+	}
+
+	out += hdrSize;
+
+	for ( const F4TexChunk & chunk : chunks ) {
+		if ( chunk.packedSize > 0 ) {
+			QByteArray stored;
+			const char * src = view( chunk.offset, chunk.packedSize );
+			if ( !src ) {
+				stored.resize( chunk.packedSize );
+				if ( readAt( chunk.offset, stored.data(), chunk.packedSize ) )
+					src = stored.constData();
 			}
+
+			if ( !src )
+				qCritical() << "Read error at " << chunk.offset;
+			else if ( uncompressInto( src, chunk.packedSize, out, chunk.unpackedSize ) != chunk.unpackedSize )
+				qCritical() << "Size does not match at " << chunk.offset;
+		} else if ( !readAt( chunk.offset, out, chunk.unpackedSize ) ) {
+			qCritical() << "Size does not match at " << chunk.offset;
 		}
+
+		out += chunk.unpackedSize;
 	}
-	return false;
+
+	return true;
+}
+
+// see bsa.h
+int BSA::mipCount( const QString & fn ) const
+{
+	const BSAFile * file = getFile( fn );
+	if ( !file || !file->tex.chunks.count() )
+		return 0;
+
+	return qMax<int>( file->tex.header.numMips, 1 );
+}
+
+// see bsa.h
+bool BSA::mipContents( const QString & fn, int firstMip, int lastMip, QByteArray & content )
+{
+	const BSAFile * file = getFile( fn );
+	if ( !file || !file->tex.chunks.count() )
+		return false;
+
+	return textureContents( file, content, firstMip, lastMip );
+}
+
+// see bsa.h
+bool BSA::smallestMipContents( const QString & fn, int count, QByteArray & content )
+{
+	int mips = mipCount( fn );
+	if ( !mips )
+		return false;
+
+	return mipContents( fn, mips - qMax( count, 1 ), mips - 1, content );
+}
+
+// see bsa.h
+const char * BSA::view( qint64 offset, qint64 size ) const
+{
+	if ( !mapped || offset < 0 || size < 0 || offset + size > mappedSize )
+		return nullptr;
+
+	return reinterpret_cast<const char *>( mapped + offset );
+}
+
+// see bsa.h
+bool BSA::readAt( qint64 offset, char * data, qint64 size )
+{
+	if ( offset < 0 || size < 0 )
+		return false;
+
+	if ( mapped ) {
+		if ( offset + size > mappedSize )
+			return false;
+
+		memcpy( data, mapped + offset, size );
+		return true;
+	}
+
+	QMutexLocker lock( & bsaMutex );
+	return bsa.seek( offset ) && bsa.read( data, size ) == size;
 }
 
 // see bsa.h
@@ -703,7 +1087,7 @@ BSA::BSAFile * BSA::insertFile( BSAFolder * folder, QString name, quint32 sizeFl
 	file->offset = offset;
 	folder->files.insert( name, file );
 
-	files.insert( QString( folder->name % "/" % name ).toLower(), file );
+	files.insert( fileKey( folder->name.constData(), folder->name.length(), name.constData(), name.length() ), file );
 	return file;
 }
 
@@ -716,7 +1100,7 @@ BSA::BSAFile * BSA::insertFile( BSAFolder * folder, QString name, quint32 packed
 	file->offset = offset;
 	folder->files.insert( name, file );
 
-	files.insert( QString( folder->name % "/" % name ).toLower(), file );
+	files.insert( fileKey( folder->name.constData(), folder->name.length(), name.constData(), name.length() ), file );
 	return file;
 }
 
@@ -730,9 +1114,143 @@ const BSA::BSAFolder * BSA::getFolder( QString fn ) const
 }
 
 // see bsa.h
-const BSA::BSAFile * BSA::getFile( QString fn ) const
+const BSA::BSAFile * BSA::getFile( const QString & fn ) const
 {
-	return files.value( fn.toLower() );
+	const QChar * s = fn.constData();
+	int len = fn.length();
+
+	int slash = len - 1;
+	while ( slash >= 0 && s[slash] != QLatin1Char( '/' ) && s[slash] != QLatin1Char( '\\' ) )
+		slash--;
+
+	return files.value( fileKey( s, qMax( slash, 0 ), s + slash + 1, len - slash - 1 ) );
+}
+
+//! A character of a name as the archive hashes are computed over it: lower case, with backslashes
+static inline quint8 hashChar( QChar c )
+{
+	ushort u = c.unicode();
+
+	if ( u >= 'A' && u <= 'Z' )
+		return quint8( u + ( 'a' - 'A' ) );
+	if ( u == '/' )
+		return '\\';
+	if ( u < 0x80 )
+		return quint8( u );
+
+	return quint8( c.toLower().toLatin1() );
+}
+
+// see bsa.h
+quint64 BSA::tes4Hash( const QChar * name, int len, bool isFolder )
+{
+	// The extension of a file is hashed apart from the rest of the name
+	int rootLen = len;
+	if ( !isFolder ) {
+		for ( int i = len - 1; i >= 0; i-- ) {
+			if ( name[i] == QLatin1Char( '.' ) ) {
+				rootLen = i;
+				break;
+			}
+		}
+	}
+
+	quint32 hash1 = 0;
+	if ( rootLen > 0 ) {
+		hash1 = quint32( hashChar( name[rootLen - 1] ) )
+		        | ( rootLen > 2 ? quint32( hashChar( name[rootLen - 2] ) ) << 8 : 0 )
+		        | quint32( rootLen ) << 16
+		        | quint32( hashChar( name[0] ) ) << 24;
+	}
+
+	auto isExt = [name, len, rootLen]( const char * ext ) {
+		int n = int( strlen( ext ) );
+		if ( len - rootLen != n )
+			return false;
+		for ( int i = 0; i < n; i++ ) {
+			if ( hashChar( name[rootLen + i] ) != quint8( ext[i] ) )
+				return false;
+		}
+		return true;
+	};
+
+	if ( isExt( ".kf" ) )
+		hash1 |= 0x80;
+	else if ( isExt( ".nif" ) )
+		hash1 |= 0x8000;
+	else if ( isExt( ".dds" ) )
+		hash1 |= 0x8080;
+	else if ( isExt( ".wav" ) )
+		hash1 |= 0x80000000;
+
+	quint32 hash2 = 0;
+	for ( int i = 1; i < rootLen - 2; i++ )
+		hash2 = hash2 * 0x1003f + hashChar( name[i] );
+
+	quint32 hash3 = 0;
+	for ( int i = rootLen; i < len; i++ )
+		hash3 = hash3 * 0x1003f + hashChar( name[i] );
+
+	return ( quint64( hash2 + hash3 ) << 32 ) | hash1;
+}
+
+// see bsa.h
+quint32 BSA::ba2Hash( const QChar * name, int len )
+{
+	static const QVector<quint32> table = []() {
+		QVector<quint32> t( 256 );
+		for ( quint32 i = 0; i < 256; i++ ) {
+			quint32 c = i;
+			for ( int k = 0; k < 8; k++ )
+				c = ( c & 1 ) ? ( 0xedb88320 ^ ( c >> 1 ) ) : ( c >> 1 );
+			t[i] = c;
+		}
+		return t;
+	}();
+
+	// Unlike zlib's crc32() the runtime starts at 0 and does not invert the result
+	quint32 crc = 0;
+	for ( int i = 0; i < len; i++ )
+		crc = ( crc >> 8 ) ^ table.at( ( crc ^ hashChar( name[i] ) ) & 0xff );
+
+	return crc;
+}
+
+// see bsa.h
+BSA::FileKey BSA::fileKey( const QChar * folder, int folderLen, const QChar * name, int nameLen ) const
+{
+	if ( version != F4_BSAHEADER_VERSION )
+		return FileKey( tes4Hash( folder, folderLen, true ), tes4Hash( name, nameLen, false ) );
+
+	// A BA2 stores the name without its extension, and up to 4 characters of the extension
+	int dot = nameLen - 1;
+	while ( dot >= 0 && name[dot] != QLatin1Char( '.' ) )
+		dot--;
+
+	quint32 ext = 0;
+	for ( int i = 0; dot >= 0 && i < 4 && dot + 1 + i < nameLen; i++ )
+		ext |= quint32( hashChar( name[dot + 1 + i] ) ) << ( 8 * i );
+
+	quint32 nameHash = ba2Hash( name, dot < 0 ? nameLen : dot );
+
+	return FileKey( ba2Hash( folder, folderLen ), ( quint64( nameHash ) << 32 ) | ext );
+}
+
+// see bsa.h
+QStringList BSA::fileNames() const
+{
+	QStringList names;
+	names.reserve( files.count() );
+
+	for ( auto it = root->files.constBegin(); it != root->files.constEnd(); ++it )
+		names.append( it.key().toLower() );
+
+	for ( const BSAFolder * folder : folders ) {
+		for ( auto it = folder->files.constBegin(); it != folder->files.constEnd(); ++it )
+			names.append( QString( folder->name % "/" % it.key() ).toLower() );
+	}
+
+	return names;
 }
 
 // see bsa.h
@@ -765,71 +1283,210 @@ QDateTime BSA::fileTime( const QString & ) const
 	return bsaInfo.created( );
 }
 
-bool BSA::scan( const BSA::BSAFolder * folder, QStandardItem * item, QString path )
+// see bsa.h
+bool BSA::fillModel( BSAModel * bsaModel, const QString & folder )
 {
-	if ( !folder || folder->children.count() == 0 )
+	const BSAFolder * f = getFolder( folder );
+	if ( !f || f->children.count() == 0 )
 		return false;
 
-	QHash<QString, BSAFolder *>::const_iterator i;
-	for ( i = folder->children.begin(); i != folder->children.end(); i++ ) {
+	bsaModel->setFolder( f );
+	return true;
+}
 
-		if ( !i.value()->files.count() && !i.value()->children.count() )
-			continue;
 
-		auto folderItem = new QStandardItem( i.key() );
-		auto pathDummy = new QStandardItem( "" );
-		auto sizeDummy = new QStandardItem( "" );
+BSAModel::BSAModel( QObject * parent )
+	: QAbstractItemModel( parent )
+{
 
-		item->appendRow( { folderItem, pathDummy, sizeDummy } );
+}
 
-		// Recurse through folders
-		if ( i.value()->children.count() ) {
-			QString fullpath = ((path.isEmpty()) ? path : path % "/") % i.key();
-			scan( i.value(), folderItem, fullpath );
-		}
+BSAModel::~BSAModel()
+{
+	delete rootNode;
+}
+
+QString BSAModel::Node::path() const
+{
+	if ( !file || !parent || !parent->folder )
+		return QString();
+
+	return parent->folder->name % "/" % name;
+}
 
-		// List files
-		if ( i.value()->files.count() ) {
-			QHash<QString, BSAFile *>::const_iterator f;
-			for ( f = i.value()->files.begin(); f != i.value()->files.end(); f++ ) {
-				QString fullpath = path % "/" % i.key() % "/" % f.key();
+void BSAModel::setFolder( const BSA::BSAFolder * folder )
+{
+	beginResetModel();
+	delete rootNode;
+	rootNode = new Node;
+	rootNode->folder = folder;
+	endResetModel();
+}
 
-				int bytes = f.value()->size();
-				QString filesize = (bytes > 1024) ? QString::number( bytes / 1024 ) + "KB" : QString::number( bytes ) + "B";
+void BSAModel::clear()
+{
+	beginResetModel();
+	delete rootNode;
+	rootNode = nullptr;
+	endResetModel();
+}
 
-				auto fileItem = new QStandardItem( f.key() );
-				auto pathItem = new QStandardItem( fullpath );
-				auto sizeItem = new QStandardItem( filesize );
+bool BSAModel::hasContents( const BSA::BSAFolder * folder )
+{
+	if ( folder->files.count() )
+		return true;
 
-				folderItem->appendRow( { fileItem, pathItem, sizeItem } );
-			}
-		}
+	for ( const BSA::BSAFolder * child : folder->children ) {
+		if ( hasContents( child ) )
+			return true;
 	}
 
-	return true;
+	return false;
 }
 
-bool BSA::fillModel( BSAModel * bsaModel, const QString & folder )
+void BSAModel::populate( Node * n ) const
 {
-	return scan( getFolder( folder ), bsaModel->invisibleRootItem(), folder );
+	if ( n->populated || !n->folder )
+		return;
+
+	n->populated = true;
+
+	QStringList folderNames = n->folder->children.keys();
+	std::sort( folderNames.begin(), folderNames.end() );
+
+	for ( const QString & name : folderNames ) {
+		const BSA::BSAFolder * child = n->folder->children.value( name );
+		if ( !child->files.count() && !child->children.count() )
+			continue;
+
+		Node * c = new Node;
+		c->folder = child;
+		c->name = name;
+		c->parent = n;
+		c->row = n->children.count();
+		n->children.append( c );
+	}
+
+	// Files directly in the model folder are not listed
+	if ( n == rootNode )
+		return;
+
+	QStringList fileNames = n->folder->files.keys();
+	std::sort( fileNames.begin(), fileNames.end() );
+
+	for ( const QString & name : fileNames ) {
+		Node * c = new Node;
+		c->file = n->folder->files.value( name );
+		c->name = name;
+		c->parent = n;
+		c->row = n->children.count();
+		n->children.append( c );
+	}
 }
 
+const BSAModel::Node * BSAModel::node( const QModelIndex & index ) const
+{
+	if ( index.isValid() )
+		return static_cast<const Node *>( index.internalPointer() );
 
-BSAModel::BSAModel( QObject * parent )
-	: QStandardItemModel( parent )
+	return rootNode;
+}
+
+QModelIndex BSAModel::index( int row, int column, const QModelIndex & parent ) const
 {
+	Node * p = const_cast<Node *>( node( parent ) );
+	if ( !p || column < 0 || column >= 3 || ( parent.isValid() && parent.column() != 0 ) )
+		return QModelIndex();
 
+	populate( p );
+	if ( row < 0 || row >= p->children.count() )
+		return QModelIndex();
+
+	return createIndex( row, column, p->children.at( row ) );
 }
 
-void BSAModel::init()
+QModelIndex BSAModel::parent( const QModelIndex & index ) const
 {
-	setColumnCount( 3 );
-	setHorizontalHeaderLabels( { "File", "Path", "Size" } );
+	const Node * n = node( index );
+	if ( !index.isValid() || !n || !n->parent || n->parent == rootNode )
+		return QModelIndex();
+
+	return createIndex( n->parent->row, 0, n->parent );
+}
+
+int BSAModel::rowCount( const QModelIndex & parent ) const
+{
+	if ( parent.isValid() && parent.column() != 0 )
+		return 0;
+
+	Node * p = const_cast<Node *>( node( parent ) );
+	if ( !p || !p->folder )
+		return 0;
+
+	populate( p );
+	return p->children.count();
+}
+
+int BSAModel::columnCount( const QModelIndex & ) const
+{
+	return 3;
+}
+
+bool BSAModel::hasChildren( const QModelIndex & parent ) const
+{
+	if ( parent.isValid() && parent.column() != 0 )
+		return false;
+
+	// Empty folders are never listed, so every folder row has children
+	const Node * p = node( parent );
+	return p && p->folder && ( p->populated ? p->children.count() > 0 : hasContents( p->folder ) );
+}
+
+QVariant BSAModel::data( const QModelIndex & index, int role ) const
+{
+	const Node * n = node( index );
+	if ( !index.isValid() || !n || ( role != Qt::DisplayRole && role != Qt::EditRole ) )
+		return QVariant();
+
+	switch ( index.column() ) {
+	case 0:
+		return n->name;
+	case 1:
+		return n->path();
+	case 2:
+		if ( n->file ) {
+			int bytes = n->file->size();
+			return (bytes > 1024) ? QString::number( bytes / 1024 ) + "KB" : QString::number( bytes ) + "B";
+		}
+		return QString();
+	}
+
+	return QVariant();
+}
+
+QVariant BSAModel::headerData( int section, Qt::Orientation orientation, int role ) const
+{
+	if ( orientation != Qt::Horizontal || role != Qt::DisplayRole )
+		return QVariant();
+
+	switch ( section ) {
+	case 0:
+		return "File";
+	case 1:
+		return "Path";
+	case 2:
+		return "Size";
+	}
+
+	return QVariant();
 }
 
 Qt::ItemFlags BSAModel::flags( const QModelIndex & index ) const
 {
-	return QStandardItemModel::flags( index ) ^ Qt::ItemIsEditable;
+	if ( !index.isValid() )
+		return Qt::NoItemFlags;
+
+	return Qt::ItemIsEnabled | Qt::ItemIsSelectable;
 }
 
 
@@ -842,11 +1499,13 @@ BSAProxyModel::BSAProxyModel( QObject * parent )
 void BSAProxyModel::setFiletypes( QStringList types )
 {
 	filetypes = types;
+	acceptedFolders.clear();
 }
 
 void BSAProxyModel::setFilterByNameOnly( bool nameOnly )
 {
 	filterByNameOnly = nameOnly;
+	acceptedFolders.clear();
 
 	setFilterRegExp( filterRegExp() );
 }
@@ -856,34 +1515,54 @@ void BSAProxyModel::resetFilter()
 	setFilterRegExp( QRegExp( "*", Qt::CaseInsensitive, QRegExp::Wildcard ) );
 }
 
+bool BSAProxyModel::fileAccepted( const QString & name, const QString & path ) const
+{
+	bool typeMatch = true;
+	if ( filetypes.count() ) {
+		typeMatch = false;
+		for ( auto f : filetypes ) {
+			typeMatch |= path.endsWith( f );
+		}
+	}
+
+	return typeMatch && ( filterByNameOnly ? name.contains( filterRegExp() ) : path.contains( filterRegExp() ) );
+}
+
+bool BSAProxyModel::folderAccepted( const BSA::BSAFolder * folder ) const
+{
+	auto it = acceptedFolders.constFind( folder );
+	if ( it != acceptedFolders.constEnd() )
+		return it.value();
+
+	bool accepted = false;
+	for ( auto f = folder->files.constBegin(); f != folder->files.constEnd() && !accepted; ++f )
+		accepted = fileAccepted( f.key(), folder->name % "/" % f.key() );
+
+	for ( auto c = folder->children.constBegin(); c != folder->children.constEnd() && !accepted; ++c )
+		accepted = folderAccepted( c.value() );
+
+	acceptedFolders.insert( folder, accepted );
+	return accepted;
+}
+
 bool BSAProxyModel::filterAcceptsRow( int sourceRow, const QModelIndex & sourceParent ) const
 {
 	if ( !filterRegExp().isEmpty() ) {
-		
-		QModelIndex sourceIndex0 = sourceModel()->index( sourceRow, 0, sourceParent );
-		QModelIndex sourceIndex1 = sourceModel()->index( sourceRow, 1, sourceParent );
-		if ( sourceIndex0.isValid() ) {
-			// If children match, parent matches
-			int c = sourceModel()->rowCount( sourceIndex0 );
-			for ( int i = 0; i < c; ++i ) {
-				if ( filterAcceptsRow( i, sourceIndex0 ) )
-					return true;
-			}
-
-			QString key0 = sourceModel()->data( sourceIndex0, filterRole() ).toString();
-			QString key1 = sourceModel()->data( sourceIndex1, filterRole() ).toString();
-			
-			bool typeMatch = true;
-			if ( filetypes.count() ) {
-				typeMatch = false;
-				for ( auto f : filetypes ) {
-					typeMatch |= key1.endsWith( f );
-				}
+		// Match against the archive tree so that filtering does not build rows
+		auto model = qobject_cast<BSAModel *>( sourceModel() );
+		QModelIndex sourceIndex = sourceModel()->index( sourceRow, 0, sourceParent );
+
+		if ( model && sourceIndex.isValid() ) {
+			if ( acceptedRegExp != filterRegExp() ) {
+				acceptedFolders.clear();
+				acceptedRegExp = filterRegExp();
 			}
 
-			bool stringMatch = (filterByNameOnly) ? key0.contains( filterRegExp() ) : key1.contains( filterRegExp() );
+			const BSAModel::Node * n = model->node( sourceIndex );
+			if ( n->folder )
+				return folderAccepted( n->folder );
 
-			return typeMatch && stringMatch;
+			return fileAccepted( n->name, n->path() );
 		}
 	}
 
@@ -895,13 +1574,14 @@ bool BSAProxyModel::lessThan( const QModelIndex & left, const QModelIndex & righ
 	QString leftString = sourceModel()->data( left ).toString();
 	QString rightString = sourceModel()->data( right ).toString();
 
-	QModelIndex leftChild = left.child( 0, 0 );
-	QModelIndex rightChild = right.child( 0, 0 );
+	// Folders sort before files
+	bool leftFolder = sourceModel()->hasChildren( left.sibling( left.row(), 0 ) );
+	bool rightFolder = sourceModel()->hasChildren( right.sibling( right.row(), 0 ) );
 
-	if ( !leftChild.isValid() && rightChild.isValid() )
+	if ( !leftFolder && rightFolder )
 		return false;
 
-	if ( leftChild.isValid() && !rightChild.isValid() )
+	if ( leftFolder && !rightFolder )
 		return true;
 
 	return leftString < rightString;
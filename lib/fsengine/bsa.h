@@ -44,6 +44,7 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QFileInfo>
 #include <QHash>
 #include <QMutex>
+#include <QPair>
 
 #include <memory>
 
@@ -258,6 +259,8 @@ public:
 	
 	//! Whether the specified file exists or not
 	bool hasFile( const QString & ) const override final;
+	//! Returns the paths of the files of the folders, in lower case
+	QStringList fileNames() const override final;
 	//! Returns the size of the file per BSAFile::size().
 	qint64 fileSize( const QString & ) const override final;
 	//! Returns the contents of the specified file
@@ -265,8 +268,29 @@ public:
 	* \param fn The filename to get the contents for
 	* \param content Reference to the byte array that holds the file contents
 	* \return True if successful
+	*
+	* Uncompressed files of a mapped archive are copied from the mapping in one go,
+	* \a content does not refer to the archive and outlives it.
 	*/
 	bool fileContents( const QString &, QByteArray & ) override final;
+
+	//! Returns the number of mip levels of a Fallout 4 texture, or 0 for other files
+	int mipCount( const QString & fn ) const;
+	//! Returns a Fallout 4 texture holding only some of its mip levels
+	/*!
+	 * The range is widened to the mip levels of the chunks it touches, and cube maps
+	 * are always returned in full. The DDS header describes the mip levels returned,
+	 * with the size of \a firstMip as the size of the texture.
+	 *
+	 * \param fn		The texture to read
+	 * \param firstMip	The largest mip level wanted, 0 being the full size
+	 * \param lastMip	The smallest mip level wanted, or -1 for the smallest there is
+	 * \param content	Receives the DDS file
+	 * \return			True if successful
+	 */
+	bool mipContents( const QString & fn, int firstMip, int lastMip, QByteArray & content );
+	//! Returns a Fallout 4 texture holding at least its \a count smallest mip levels, see mipContents()
+	bool smallestMipContents( const QString & fn, int count, QByteArray & content );
 	
 	//! See QFileInfo::ownerId().
 	uint ownerId( const QString & ) const override final;
@@ -276,6 +300,8 @@ public:
 	QDateTime fileTime( const QString & ) const override final;
 	//! See QFileInfo::absoluteFilePath().
 	QString getAbsoluteFilePath( const QString & ) const override final;
+	//! Returns the offset of the file data, or of the first texture chunk.
+	qint64 fileOffset( const QString & ) const override final;
 	
 	//! Whether the given file can be opened as a %BSA or not
 	static bool canOpen( const QString & );
@@ -283,6 +309,19 @@ public:
 	//! Returns BSA::status.
 	QString statusText() const { return status; }
 
+	//! The hash of a name in a %BSA, a file name or a folder path, as the runtime computes it
+	/*!
+	 * Upper case letters count as lower case and slashes as backslashes, so that
+	 * a path is hashed as it is given, without making a lower case copy.
+	 *
+	 * \param name		The characters of the name
+	 * \param len		The number of characters
+	 * \param isFolder	Whether the name is a folder, whose extension is not hashed apart
+	 */
+	static quint64 tes4Hash( const QChar * name, int len, bool isFolder );
+	//! The CRC-32 a BA2 stores of a file name without its extension or of a folder path, see tes4Hash()
+	static quint32 ba2Hash( const QChar * name, int len );
+
 	//! A file inside a BSA
 	struct BSAFile
 	{
@@ -328,9 +367,13 @@ public:
 	//! Gets the specified folder, or the root folder if not found
 	const BSAFolder * getFolder( QString fn ) const;
 	//! Gets the specified file, or null if not found
-	const BSAFile * getFile( QString fn ) const;
+	/*!
+	 * The file is found by the hashes of its folder and name, as the runtime
+	 * finds it, so the case of \a fn and its kind of slashes do not matter.
+	 */
+	const BSAFile * getFile( const QString & fn ) const;
 
-	bool scan( const BSA::BSAFolder *, QStandardItem *, QString );
+	//! Show the contents of \a folder in \a bsaModel; false if the folder has no subfolders
 	bool fillModel( BSAModel *, const QString & );
 
 protected:
@@ -340,10 +383,40 @@ protected:
 	//! File info for the %BSA
 	QFileInfo bsaInfo;
 
-	quint32 version;
+	quint32 version = 0;
 
-	//! Mutual exclusion handler
+	//! Mutual exclusion handler, serialising reads when the file is not mapped
 	QMutex bsaMutex;
+	//! Mapping of the whole file, or null if it could not be mapped
+	uchar * mapped = nullptr;
+	//! Size of the mapping
+	qint64 mappedSize = 0;
+
+	//! Read \a size bytes at \a offset, from the mapping if there is one
+	bool readAt( qint64 offset, char * data, qint64 size );
+	//! The \a size bytes at \a offset in the mapping, or null if the archive is not mapped
+	const char * view( qint64 offset, qint64 size ) const;
+	//! Assemble a Fallout 4 texture from the chunks holding mip levels \a firstMip to \a lastMip
+	bool textureContents( const BSAFile * file, QByteArray & content, int firstMip = 0, int lastMip = -1 );
+
+	//! The hashes a file is found by: its folder and name for a %BSA, its folder and name and extension for a BA2
+	typedef QPair<quint64, quint64> FileKey;
+
+	//! The key of the file \a name in the folder \a folder, see getFile()
+	FileKey fileKey( const QChar * folder, int folderLen, const QChar * name, int nameLen ) const;
+
+	//! Path of the directory cache for this archive, or empty if there is no cache location
+	QString cacheName() const;
+	//! Restore the folders and files from the directory cache
+	/*!
+	 * The cache is only used when it was written for the same path, size and
+	 * modification time, so a changed archive is always parsed again.
+	 *
+	 * \return True if the directory was restored
+	 */
+	bool loadCache();
+	//! Write the folders and files to the directory cache
+	void saveCache() const;
 	
 	//! The absolute name of the file, e.g. "d:/temp/test.bsa"
 	QString bsaPath;
@@ -357,8 +430,8 @@ protected:
 	//! The root folder
 	BSAFolder * root;
 
-	//! Map of files inside a %BSA
-	QHash<QString, BSAFile *> files;
+	//! Map of files inside a %BSA, by fileKey(); the names are only kept by the folders
+	QHash<FileKey, BSAFile *> files;
 	
 	//! Error string for exception handling
 	QString status;
@@ -373,16 +446,64 @@ protected:
 };
 
 
-class BSAModel : public QStandardItemModel
+//! Tree model over the folders of a %BSA
+/*!
+ * Rows are created from the BSA::BSAFolder tree the first time their parent is
+ * asked for them, so opening a large archive only builds the top level.
+ * The top level lists the subfolders of the model folder; every folder below it
+ * lists its subfolders followed by its files, each sorted by name.
+ */
+class BSAModel : public QAbstractItemModel
 {
 	Q_OBJECT
 
 public:
 	BSAModel( QObject * parent = nullptr );
+	~BSAModel();
 
-	void init();
+	//! One row of the model
+	struct Node
+	{
+		~Node() { qDeleteAll( children ); }
 
+		const BSA::BSAFolder * folder = nullptr; //!< The folder, for folder rows
+		const BSA::BSAFile * file = nullptr; //!< The file, for file rows
+		QString name;
+		Node * parent = nullptr;
+		int row = 0;
+		bool populated = false; //!< Whether children has been built yet
+		QVector<Node *> children;
+
+		//! The archive path of a file row, e.g. "meshes/clutter/bucket.nif"
+		QString path() const;
+	};
+
+	//! Show the contents of \a folder; the folder must outlive the model contents
+	void setFolder( const BSA::BSAFolder * folder );
+	//! Remove all rows
+	void clear();
+
+	//! The node of \a index, or the top level node if the index is invalid
+	const Node * node( const QModelIndex & index ) const;
+
+	QModelIndex index( int row, int column, const QModelIndex & parent = QModelIndex() ) const override;
+	QModelIndex parent( const QModelIndex & index ) const override;
+	int rowCount( const QModelIndex & parent = QModelIndex() ) const override;
+	int columnCount( const QModelIndex & parent = QModelIndex() ) const override;
+	bool hasChildren( const QModelIndex & parent = QModelIndex() ) const override;
+	QVariant data( const QModelIndex & index, int role = Qt::DisplayRole ) const override;
+	QVariant headerData( int section, Qt::Orientation orientation, int role = Qt::DisplayRole ) const override;
 	Qt::ItemFlags flags( const QModelIndex & index ) const override;
+
+	//! Whether \a folder holds any file, directly or in a subfolder
+	static bool hasContents( const BSA::BSAFolder * folder );
+
+protected:
+	//! Build the rows below \a n if that has not happened yet
+	void populate( Node * n ) const;
+
+	//! The top level node, whose children are the first level folders
+	Node * rootNode = nullptr;
 };
 
 
@@ -404,9 +525,19 @@ protected:
 	bool filterAcceptsRow( int sourceRow, const QModelIndex & sourceParent ) const;
 	bool lessThan( const QModelIndex & left, const QModelIndex & right ) const;
 
+	//! Whether a file passes the type and text filters
+	bool fileAccepted( const QString & name, const QString & path ) const;
+	//! Whether any file in \a folder or below passes the filters
+	bool folderAccepted( const BSA::BSAFolder * folder ) const;
+
 private:
 	QStringList filetypes;
 	bool filterByNameOnly = false;
+
+	//! Results of folderAccepted() for the filter in acceptedRegExp
+	mutable QHash<const BSA::BSAFolder *, bool> acceptedFolders;
+	//! The filter acceptedFolders was computed for
+	mutable QRegExp acceptedRegExp;
 };
 
 #endif
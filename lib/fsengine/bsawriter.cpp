@@ -0,0 +1,767 @@
+/***** BEGIN LICENSE BLOCK *****
+
+BSD License
+
+Copyright (c) 2005-2015, NIF File Format Library and Tools
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the NIF File Format Library and Tools project may not be
+   used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+***** END LICENCE BLOCK *****/
+
+#include "bsawriter.h"
+#include "functionrunnable.h"
+#include "dds.h"
+#include "zlib/zlib.h"
+#include "lz4frame.h"
+
+#include <QDataStream>
+#include <QDirIterator>
+#include <QMutex>
+#include <QSaveFile>
+#include <QThread>
+#include <QThreadPool>
+#include <QWaitCondition>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+
+//! \file bsawriter.cpp BSAWriter implementation
+
+//! Mip levels of at least this many bytes get a chunk of their own in a DX10 BA2
+#define BA2_CHUNK_SIZE 0x10000
+
+//! The size of a DDS header with the DX10 extension
+#define DDS_DX10_HEADER_SIZE 148
+
+//! The file flags of a %BSA header for a file name
+static quint32 bsaFileFlags( const QString & name )
+{
+	static const QHash<QString, quint32> flags = {
+		{ "nif", OB_BSAFILE_NIF },
+		{ "dds", OB_BSAFILE_DDS },
+		{ "xml", OB_BSAFILE_XML },
+		{ "wav", OB_BSAFILE_WAV },
+		{ "mp3", OB_BSAFILE_MP3 },
+		{ "txt", OB_BSAFILE_TXT }, { "html", OB_BSAFILE_HTML }, { "bat", OB_BSAFILE_BAT }, { "scc", OB_BSAFILE_SCC },
+		{ "spt", OB_BSAFILE_SPT },
+		{ "tex", OB_BSAFILE_TEX }, { "fnt", OB_BSAFILE_FNT },
+		{ "ctl", OB_BSAFILE_CTL }
+	};
+
+	return flags.value( name.mid( name.lastIndexOf( '.' ) + 1 ) );
+}
+
+//! The bytes of a mip level of a texture, or -1 for a format which cannot be stored
+static qint64 mipSize( int format, int width, int height )
+{
+	qint64 blocks = qint64( qMax( 1, ( width + 3 ) / 4 ) ) * qMax( 1, ( height + 3 ) / 4 );
+
+	switch ( format ) {
+	case DXGI_FORMAT_BC1_UNORM:
+	case DXGI_FORMAT_BC4_UNORM:
+		return blocks * 8;
+	case DXGI_FORMAT_BC2_UNORM:
+	case DXGI_FORMAT_BC3_UNORM:
+	case DXGI_FORMAT_BC5_UNORM:
+	case DXGI_FORMAT_BC7_UNORM:
+		return blocks * 16;
+	case DXGI_FORMAT_B8G8R8A8_UNORM:
+		return qint64( width ) * height * 4;
+	case DXGI_FORMAT_R8_UNORM:
+		return qint64( width ) * height;
+	default:
+		return -1;
+	}
+}
+
+// see bsawriter.h
+BSAWriter::BSAWriter( Format f ) : format( f ), numThreads( QThread::idealThreadCount() )
+{
+}
+
+// see bsawriter.h
+BSAWriter::~BSAWriter()
+{
+	qDeleteAll( folders );
+}
+
+// see bsawriter.h
+bool BSAWriter::formatByName( const QString & name, Format & f )
+{
+	static const QHash<QString, Format> names = {
+		{ "tes4", Oblivion }, { "fo3", Fallout3 }, { "sse", SkyrimSE }, { "fo4", Fallout4 }, { "fo4dds", Fallout4DDS }
+	};
+
+	auto it = names.constFind( name.toLower() );
+	if ( it == names.constEnd() )
+		return false;
+
+	f = it.value();
+	return true;
+}
+
+// see bsawriter.h
+QStringList BSAWriter::formatNames()
+{
+	return { "tes4", "fo3", "sse", "fo4", "fo4dds" };
+}
+
+// see bsawriter.h
+bool BSAWriter::addFile( const QString & path, const QString & source )
+{
+	Source s;
+	s.path = source;
+	return insert( path, s );
+}
+
+// see bsawriter.h
+int BSAWriter::addFolder( const QString & folder )
+{
+	QDir dir( folder );
+	int added = 0;
+
+	QDirIterator it( dir.absolutePath(), QDir::Files, QDirIterator::Subdirectories );
+	while ( it.hasNext() ) {
+		QString fn = it.next();
+
+		if ( addFile( dir.relativeFilePath( fn ), fn ) )
+			added++;
+	}
+
+	return added;
+}
+
+// see bsawriter.h
+int BSAWriter::addArchive( FSArchiveFile * archive )
+{
+	int added = 0;
+
+	for ( const QString & fn : archive->fileNames() ) {
+		Source s;
+		s.path = fn;
+		s.archive = archive;
+
+		if ( insert( fn, s ) )
+			added++;
+	}
+
+	return added;
+}
+
+// see bsawriter.h
+bool BSAWriter::insert( const QString & path, const Source & source )
+{
+	QString fn = QDir::fromNativeSeparators( path ).toLower();
+	while ( fn.startsWith( "/" ) )
+		fn.remove( 0, 1 );
+
+	int slash = fn.lastIndexOf( "/" );
+	if ( slash <= 0 || slash == fn.length() - 1 )
+		return false;
+
+	QString folderName = fn.left( slash ).replace( "/", "\\" );
+	QString name = fn.mid( slash + 1 );
+
+	// The names are stored as sized strings, or as the folder and name in the BA2 name table
+	if ( folderName.length() > 254 || name.length() > 254 )
+		return false;
+
+	if ( format == Fallout4DDS && !name.endsWith( ".dds" ) )
+		return false;
+
+	BSA::BSAFolder * folder = folders.value( folderName );
+	if ( !folder ) {
+		folder = new BSA::BSAFolder;
+		folder->name = folderName;
+		folders.insert( folderName, folder );
+	}
+
+	BSA::BSAFile * file = folder->files.value( name );
+	if ( !file ) {
+		file = new BSA::BSAFile;
+		folder->files.insert( name, file );
+	}
+
+	sources.insert( file, source );
+	return true;
+}
+
+// see bsawriter.h
+bool BSAWriter::readSource( const Source & source, QByteArray & data, qint64 maxSize ) const
+{
+	if ( source.archive )
+		return source.archive->fileContents( source.path, data );
+
+	QFile f( source.path );
+	if ( !f.open( QIODevice::ReadOnly ) )
+		return false;
+
+	data = ( maxSize < 0 ) ? f.readAll() : f.read( maxSize );
+
+	return f.error() == QFile::NoError;
+}
+
+// see bsawriter.h
+void BSAWriter::compress( const char * data, int size, QByteArray & out ) const
+{
+	out.clear();
+
+	if ( !compressed || size <= 0 )
+		return;
+
+	if ( format == SkyrimSE ) {
+		LZ4F_preferences_t prefs = {};
+		prefs.frameInfo.contentSize = size;
+
+		size_t bound = LZ4F_compressFrameBound( size, &prefs );
+		out.resize( int( bound ) );
+
+		size_t ret = LZ4F_compressFrame( out.data(), bound, data, size, &prefs );
+		if ( LZ4F_isError( ret ) || ret >= size_t( size ) ) {
+			out.clear();
+			return;
+		}
+
+		out.resize( int( ret ) );
+	} else {
+		uLongf len = compressBound( uLong( size ) );
+		out.resize( int( len ) );
+
+		if ( compress2( (Bytef *)out.data(), &len, (const Bytef *)data, uLong( size ), Z_DEFAULT_COMPRESSION ) != Z_OK
+		     || len >= uLongf( size ) ) {
+			out.clear();
+			return;
+		}
+
+		out.resize( int( len ) );
+	}
+}
+
+// see bsawriter.h
+bool BSAWriter::layoutTexture( const QByteArray & dds, F4Tex & tex, int & headerSize ) const
+{
+	// The structures of dds.h are not used, their DWORD is not 32 bits everywhere
+	auto u32 = [&dds]( int offset ) {
+		quint32 v;
+		memcpy( &v, dds.constData() + offset, 4 );
+		return v;
+	};
+
+	if ( dds.size() < 128 || u32( 0 ) != DDS_MAGIC )
+		return false;
+
+	quint32 height = u32( 12 ), width = u32( 16 ), mips = qMax<quint32>( 1, u32( 28 ) );
+	quint32 pfFlags = u32( 80 ), fourCC = u32( 84 ), bitCount = u32( 88 ), redMask = u32( 92 );
+	bool cube = u32( 112 ) & 0x200; // DDSCAPS2_CUBEMAP
+
+	int dxgi = DXGI_FORMAT_UNKNOWN;
+	headerSize = 128;
+
+	if ( pfFlags & DDS_FOURCC ) {
+		if ( fourCC == MAKEFOURCC( 'D', 'X', 'T', '1' ) )
+			dxgi = DXGI_FORMAT_BC1_UNORM;
+		else if ( fourCC == MAKEFOURCC( 'D', 'X', 'T', '3' ) )
+			dxgi = DXGI_FORMAT_BC2_UNORM;
+		else if ( fourCC == MAKEFOURCC( 'D', 'X', 'T', '5' ) )
+			dxgi = DXGI_FORMAT_BC3_UNORM;
+		else if ( fourCC == MAKEFOURCC( 'A', 'T', 'I', '1' ) || fourCC == MAKEFOURCC( 'B', 'C', '4', 'U' ) )
+			dxgi = DXGI_FORMAT_BC4_UNORM;
+		else if ( fourCC == MAKEFOURCC( 'A', 'T', 'I', '2' ) || fourCC == MAKEFOURCC( 'B', 'C', '5', 'U' ) )
+			dxgi = DXGI_FORMAT_BC5_UNORM;
+		else if ( fourCC == MAKEFOURCC( 'D', 'X', '1', '0' ) && dds.size() >= DDS_DX10_HEADER_SIZE ) {
+			headerSize = DDS_DX10_HEADER_SIZE;
+			dxgi = int( u32( 128 ) );
+			cube |= bool( u32( 136 ) & 0x4 ); // DDS_RESOURCE_MISC_TEXTURECUBE
+
+			// Arrays of textures have no flag to tell them apart from single ones
+			if ( u32( 140 ) > 1 )
+				return false;
+		}
+	} else if ( ( pfFlags & DDS_RGB ) && bitCount == 32 && redMask == 0x00ff0000 ) {
+		dxgi = DXGI_FORMAT_B8G8R8A8_UNORM;
+	} else if ( ( pfFlags & ( DDS_RGB | DDS_LUMINANCE ) ) && bitCount == 8 ) {
+		dxgi = DXGI_FORMAT_R8_UNORM;
+	}
+
+	if ( mipSize( dxgi, 1, 1 ) < 0 || width == 0 || height == 0 || width > 0xffff || height > 0xffff || mips > 16 )
+		return false;
+
+	tex.header.unk0C = 0;
+	tex.header.chunkHeaderSize = 24;
+	tex.header.height = quint16( height );
+	tex.header.width = quint16( width );
+	tex.header.numMips = quint8( mips );
+	tex.header.format = quint8( dxgi );
+	tex.header.unk16 = cube ? 2049 : 2048;
+
+	tex.chunks.clear();
+
+	for ( quint32 m = 0; m < mips; m++ ) {
+		quint32 size = quint32( mipSize( dxgi, qMax<quint32>( 1, width >> m ), qMax<quint32>( 1, height >> m ) ) );
+
+		// Cube maps store the faces one after the other, so their levels cannot be split
+		if ( tex.chunks.isEmpty() || ( !cube && tex.chunks.last().unpackedSize >= BA2_CHUNK_SIZE ) ) {
+			F4TexChunk chunk = {};
+			chunk.startMip = quint16( m );
+			chunk.unk14 = 0xBAADF00D;
+			tex.chunks.append( chunk );
+		}
+
+		F4TexChunk & chunk = tex.chunks.last();
+		chunk.endMip = quint16( m );
+		chunk.unpackedSize += cube ? size * 6 : size;
+	}
+
+	tex.header.numChunks = quint8( tex.chunks.count() );
+
+	return true;
+}
+
+// see bsawriter.h
+void BSAWriter::pack( Job & job ) const
+{
+	QByteArray data;
+	if ( !readSource( job.source, data ) ) {
+		job.error = "file read";
+		return;
+	}
+
+	BSA::BSAFile * file = job.file;
+
+	if ( format == Fallout4DDS ) {
+		// The records were sized for the chunks found in the header before
+		int numChunks = file->tex.chunks.count();
+		int headerSize = 0;
+
+		if ( !layoutTexture( data, file->tex, headerSize ) ) {
+			job.error = "texture format";
+			return;
+		}
+
+		if ( file->tex.chunks.count() != numChunks ) {
+			job.error = "texture changed";
+			return;
+		}
+
+		const char * src = data.constData() + headerSize;
+		qint64 available = data.size() - headerSize;
+
+		for ( F4TexChunk & chunk : file->tex.chunks ) {
+			if ( available < chunk.unpackedSize ) {
+				job.error = "texture size";
+				return;
+			}
+
+			QByteArray packed;
+			compress( src, int( chunk.unpackedSize ), packed );
+
+			// Relative to the blob until the blob is written
+			chunk.offset = quint64( job.blob.size() );
+			chunk.packedSize = quint32( packed.size() );
+
+			if ( packed.isEmpty() )
+				job.blob.append( src, int( chunk.unpackedSize ) );
+			else
+				job.blob.append( packed );
+
+			src += chunk.unpackedSize;
+			available -= chunk.unpackedSize;
+		}
+
+		return;
+	}
+
+	QByteArray packed;
+	compress( data.constData(), data.size(), packed );
+
+	if ( format == Fallout4 ) {
+		file->packedLength = quint32( packed.size() );
+		file->unpackedLength = quint32( data.size() );
+		job.blob = packed.isEmpty() ? data : packed;
+		return;
+	}
+
+	// A compressed file starts with its uncompressed size
+	if ( !packed.isEmpty() ) {
+		quint32 size = quint32( data.size() );
+		job.blob = QByteArray( (const char *)&size, 4 ) + packed;
+	} else {
+		job.blob = data;
+	}
+
+	if ( job.blob.size() > OB_BSAFILE_SIZEMASK ) {
+		job.error = "file size";
+		job.blob.clear();
+		return;
+	}
+
+	// Files stored unlike the archive default are flagged
+	file->sizeFlags = quint32( job.blob.size() );
+	if ( packed.isEmpty() == compressed )
+		file->sizeFlags |= 0x40000000;
+}
+
+// see bsawriter.h
+QVector<BSAWriter::Job> BSAWriter::sortedJobs() const
+{
+	bool ba2 = ( format == Fallout4 || format == Fallout4DDS );
+
+	QVector<Job> jobs;
+	jobs.reserve( sources.count() );
+
+	for ( const BSA::BSAFolder * folder : folders ) {
+		const QString & folderName = folder->name;
+		quint64 folderHash = ba2 ? BSA::ba2Hash( folderName.constData(), folderName.length() )
+		                         : BSA::tes4Hash( folderName.constData(), folderName.length(), true );
+
+		for ( auto it = folder->files.constBegin(); it != folder->files.constEnd(); ++it ) {
+			const QString & name = it.key();
+			int dot = name.lastIndexOf( '.' );
+
+			Job job;
+			job.folder = folderName;
+			job.name = name;
+			job.folderHash = folderHash;
+			job.nameHash = ba2 ? BSA::ba2Hash( name.constData(), ( dot < 0 ) ? name.length() : dot )
+			                   : BSA::tes4Hash( name.constData(), name.length(), false );
+			job.file = it.value();
+			job.source = sources.value( it.value() );
+
+			jobs.append( job );
+		}
+	}
+
+	// The names break ties, so that the files of a folder stay together
+	std::sort( jobs.begin(), jobs.end(), []( const Job & a, const Job & b ) {
+		if ( a.folderHash != b.folderHash )
+			return a.folderHash < b.folderHash;
+		if ( a.folder != b.folder )
+			return a.folder < b.folder;
+		if ( a.nameHash != b.nameHash )
+			return a.nameHash < b.nameHash;
+		return a.name < b.name;
+	} );
+
+	return jobs;
+}
+
+// see bsawriter.h
+void BSAWriter::writeData( QFileDevice & out, QVector<Job> & jobs )
+{
+	Job * data = jobs.data();
+	const int count = jobs.count();
+
+	// The workers pack at most this many files ahead of the one being written
+	const int window = numThreads * 4;
+
+	QMutex mutex;
+	QWaitCondition packed;
+	QWaitCondition written;
+	int next = 0;
+	int numWritten = 0;
+	bool stopped = false;
+
+	auto work = [&]() {
+		for ( ;; ) {
+			int i;
+			{
+				QMutexLocker lock( &mutex );
+				while ( !stopped && next < count && next >= numWritten + window )
+					written.wait( &mutex );
+
+				if ( stopped || next >= count )
+					return;
+
+				i = next++;
+			}
+
+			// Only this thread touches the job until it is done
+			pack( data[i] );
+
+			QMutexLocker lock( &mutex );
+			data[i].done = true;
+			packed.wakeAll();
+		}
+	};
+
+	QThreadPool pool;
+	pool.setMaxThreadCount( numThreads );
+	for ( int t = 0; t < numThreads; t++ )
+		pool.start( new FunctionRunnable( work ) );
+
+	const bool bsa = !( format == Fallout4 || format == Fallout4DDS );
+
+	QString error;
+
+	for ( int i = 0; i < count && error.isEmpty(); i++ ) {
+		{
+			QMutexLocker lock( &mutex );
+			while ( !data[i].done )
+				packed.wait( &mutex );
+		}
+
+		Job & job = data[i];
+		qint64 offset = out.pos();
+
+		if ( !job.error.isEmpty() ) {
+			error = job.error + ": " + job.folder + "\\" + job.name;
+		} else if ( bsa && offset + job.blob.size() > 0xffffffffLL ) {
+			error = "archive size";
+		} else if ( out.write( job.blob ) != job.blob.size() ) {
+			error = "file write";
+		} else {
+			job.file->offset = quint64( offset );
+			for ( F4TexChunk & chunk : job.file->tex.chunks )
+				chunk.offset += quint64( offset );
+		}
+
+		job.blob.clear();
+
+		QMutexLocker lock( &mutex );
+		numWritten = i + 1;
+		stopped = !error.isEmpty();
+		written.wakeAll();
+	}
+
+	pool.waitForDone();
+
+	if ( !error.isEmpty() )
+		throw error;
+}
+
+// see bsawriter.h
+void BSAWriter::writeBSA( QFileDevice & out, QVector<Job> & jobs )
+{
+	quint32 version = OB_BSAHEADER_VERSION;
+	if ( format == Fallout3 )
+		version = F3_BSAHEADER_VERSION;
+	else if ( format == SkyrimSE )
+		version = SSE_BSAHEADER_VERSION;
+
+	// The folders in the order of jobs, as the first job and the number of jobs in each
+	QVector<QPair<int, int>> folderJobs;
+	for ( int i = 0; i < jobs.count(); i++ ) {
+		if ( folderJobs.isEmpty() || jobs.at( i ).folder != jobs.at( i - 1 ).folder )
+			folderJobs.append( { i, 0 } );
+		folderJobs.last().second++;
+	}
+
+	OBBSAHeader header = {};
+	header.FolderRecordOffset = 36;
+	header.ArchiveFlags = OB_BSAARCHIVE_PATHNAMES | OB_BSAARCHIVE_FILENAMES | ( compressed ? OB_BSAARCHIVE_COMPRESSFILES : 0 );
+	header.FolderCount = quint32( folderJobs.count() );
+	header.FileCount = quint32( jobs.count() );
+
+	for ( const auto & f : folderJobs )
+		header.FolderNameLength += quint32( jobs.at( f.first ).folder.length() + 1 );
+
+	for ( const Job & job : jobs ) {
+		header.FileNameLength += quint32( job.name.length() + 1 );
+		header.FileFlags |= bsaFileFlags( job.name );
+	}
+
+	const quint32 folderSize = ( version == SSE_BSAHEADER_VERSION ) ? sizeof( SEBSAFolderInfo ) : sizeof( OBBSAFolderInfo );
+	const quint32 recordsOffset = header.FolderRecordOffset + header.FolderCount * folderSize;
+	const quint32 dataOffset = recordsOffset + header.FolderCount + header.FolderNameLength
+	                           + header.FileCount * sizeof( OBBSAFileInfo ) + header.FileNameLength;
+
+	// The directory is written once the sizes and offsets of the files are known
+	if ( out.write( QByteArray( int( dataOffset ), char( 0 ) ) ) != dataOffset )
+		throw QString( "file write" );
+
+	writeData( out, jobs );
+
+	QByteArray directory;
+	QDataStream ds( &directory, QIODevice::WriteOnly );
+	ds.setByteOrder( QDataStream::LittleEndian );
+
+	ds << quint32( OB_BSAHEADER_FILEID ) << version
+	   << header.FolderRecordOffset << header.ArchiveFlags << header.FolderCount << header.FileCount
+	   << header.FolderNameLength << header.FileNameLength << header.FileFlags;
+
+	// The offset of the records of a folder counts the file names as if they came before them
+	quint32 recordOffset = recordsOffset;
+	for ( const auto & f : folderJobs ) {
+		ds << jobs.at( f.first ).folderHash << quint32( f.second );
+
+		if ( version == SSE_BSAHEADER_VERSION )
+			ds << quint32( 0 ) << quint64( recordOffset + header.FileNameLength );
+		else
+			ds << quint32( recordOffset + header.FileNameLength );
+
+		recordOffset += 1 + jobs.at( f.first ).folder.length() + 1 + f.second * sizeof( OBBSAFileInfo );
+	}
+
+	for ( const auto & f : folderJobs ) {
+		QByteArray name = jobs.at( f.first ).folder.toLatin1();
+		ds << quint8( name.length() + 1 );
+		ds.writeRawData( name.constData(), name.length() + 1 );
+
+		for ( int i = f.first; i < f.first + f.second; i++ )
+			ds << jobs.at( i ).nameHash << jobs.at( i ).file->sizeFlags << quint32( jobs.at( i ).file->offset );
+	}
+
+	for ( const Job & job : jobs ) {
+		QByteArray name = job.name.toLatin1();
+		ds.writeRawData( name.constData(), name.length() + 1 );
+	}
+
+	if ( !out.seek( 0 ) || out.write( directory ) != directory.size() )
+		throw QString( "file write" );
+}
+
+// see bsawriter.h
+void BSAWriter::writeBA2( QFileDevice & out, QVector<Job> & jobs )
+{
+	bool textures = ( format == Fallout4DDS );
+
+	if ( textures ) {
+		// The records hold the chunks of the textures, so the headers are read before anything is written
+		std::atomic<int> next( 0 );
+		Job * data = jobs.data();
+		const int count = jobs.count();
+
+		auto work = [this, data, count, &next]() {
+			for ( int i = next++; i < count; i = next++ ) {
+				Job & job = data[i];
+
+				QByteArray dds;
+				int headerSize;
+				if ( !readSource( job.source, dds, DDS_DX10_HEADER_SIZE ) )
+					job.error = "file read";
+				else if ( !layoutTexture( dds, job.file->tex, headerSize ) )
+					job.error = "texture format";
+			}
+		};
+
+		QThreadPool pool;
+		pool.setMaxThreadCount( numThreads );
+		for ( int t = 0; t < numThreads; t++ )
+			pool.start( new FunctionRunnable( work ) );
+
+		pool.waitForDone();
+
+		for ( const Job & job : jobs ) {
+			if ( !job.error.isEmpty() )
+				throw QString( job.error + ": " + job.folder + "\\" + job.name );
+		}
+	}
+
+	qint64 recordsSize = 0;
+	for ( const Job & job : jobs )
+		recordsSize += textures ? 24 + 24 * job.file->tex.chunks.count() : 36;
+
+	const qint64 dataOffset = 24 + recordsSize;
+
+	if ( out.write( QByteArray( int( dataOffset ), char( 0 ) ) ) != dataOffset )
+		throw QString( "file write" );
+
+	writeData( out, jobs );
+
+	// The name table follows the data
+	quint64 nameTableOffset = quint64( out.pos() );
+
+	QByteArray names;
+	QDataStream ns( &names, QIODevice::WriteOnly );
+	ns.setByteOrder( QDataStream::LittleEndian );
+
+	for ( const Job & job : jobs ) {
+		QByteArray path = ( job.folder + "\\" + job.name ).toLatin1();
+		ns << quint16( path.length() );
+		ns.writeRawData( path.constData(), path.length() );
+	}
+
+	if ( out.write( names ) != names.size() )
+		throw QString( "file write" );
+
+	QByteArray directory;
+	QDataStream ds( &directory, QIODevice::WriteOnly );
+	ds.setByteOrder( QDataStream::LittleEndian );
+
+	ds << quint32( F4_BSAHEADER_FILEID ) << quint32( F4_BSAHEADER_VERSION );
+	ds.writeRawData( textures ? "DX10" : "GNRL", 4 );
+	ds << quint32( jobs.count() ) << nameTableOffset;
+
+	for ( const Job & job : jobs ) {
+		// The extension without the dot, padded to 4 bytes
+		QByteArray ext = job.name.mid( job.name.lastIndexOf( '.' ) + 1 ).toLatin1().left( 4 );
+		ext.append( QByteArray( 4 - ext.length(), char( 0 ) ) );
+
+		ds << quint32( job.nameHash );
+		ds.writeRawData( ext.constData(), 4 );
+		ds << quint32( job.folderHash );
+
+		const BSA::BSAFile * file = job.file;
+
+		if ( textures ) {
+			const F4TexInfo & h = file->tex.header;
+			ds << h.unk0C << h.numChunks << h.chunkHeaderSize << h.height << h.width << h.numMips << h.format << h.unk16;
+
+			for ( const F4TexChunk & c : file->tex.chunks )
+				ds << c.offset << c.packedSize << c.unpackedSize << c.startMip << c.endMip << c.unk14;
+		} else {
+			ds << quint32( 0x00100100 ) << file->offset << file->packedLength << file->unpackedLength << quint32( 0xBAADF00D );
+		}
+	}
+
+	if ( !out.seek( 0 ) || out.write( directory ) != directory.size() )
+		throw QString( "file write" );
+}
+
+// see bsawriter.h
+bool BSAWriter::write( const QString & filename )
+{
+	QSaveFile out( filename );
+
+	try
+	{
+		if ( sources.isEmpty() )
+			throw QString( "no files" );
+
+		if ( !out.open( QIODevice::WriteOnly ) )
+			throw QString( "file open" );
+
+		QVector<Job> jobs = sortedJobs();
+
+		if ( format == Fallout4 || format == Fallout4DDS )
+			writeBA2( out, jobs );
+		else
+			writeBSA( out, jobs );
+
+		if ( !out.commit() )
+			throw QString( "file commit" );
+	}
+	catch ( QString e )
+	{
+		out.cancelWriting();
+		status = e;
+		return false;
+	}
+
+	status = "written successfully";
+	return true;
+}
@@ -0,0 +1,175 @@
+/***** BEGIN LICENSE BLOCK *****
+
+BSD License
+
+Copyright (c) 2005-2015, NIF File Format Library and Tools
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the NIF File Format Library and Tools project may not be
+   used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+***** END LICENCE BLOCK *****/
+
+#ifndef BSAWRITER_H
+#define BSAWRITER_H
+
+#include "bsa.h"
+
+#include <QHash>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+
+//! \file bsawriter.h BSAWriter
+
+//! Writes the files of folders or archives into a new %BSA or BA2
+/*!
+ * The files are grouped with the BSA::BSAFolder and BSA::BSAFile structures
+ * %BSA uses to read archives, and ordered as the runtime expects: folders and
+ * the files in them sorted by their hashes for a %BSA, and by folder and name
+ * hash for a BA2, which keeps the files of a folder together.
+ *
+ * While the archive is written in that order, a pool of threads reads and
+ * compresses the files ahead of it, zlib for Oblivion, Fallout 3 and general
+ * BA2s and LZ4 frames for Skyrim SE. Only a few files more than there are
+ * threads are held in memory at a time. Files which do not get smaller are
+ * stored as they are.
+ *
+ * Textures of DX10 BA2s are split below their header into chunks of mip
+ * levels, a chunk for every level of at least 64 KiB and one for the rest,
+ * so that BSA::mipContents() can read the small levels alone.
+ */
+class BSAWriter final
+{
+public:
+	//! The kinds of archives which can be written
+	enum Format
+	{
+		Oblivion,		//!< %BSA version 0x67
+		Fallout3,		//!< %BSA version 0x68, also read by Skyrim
+		SkyrimSE,		//!< %BSA version 0x69
+		Fallout4,		//!< General BA2
+		Fallout4DDS		//!< Texture BA2, holding only DDS files
+	};
+
+	//! Constructor; the archive is compressed with one thread per core
+	BSAWriter( Format format );
+	//! Destructor
+	~BSAWriter();
+
+	//! The format of a name such as "sse" or "fo4dds", see formatNames(); false if there is none
+	static bool formatByName( const QString & name, Format & format );
+	//! The names formatByName() knows
+	static QStringList formatNames();
+
+	//! Whether to compress the files, the default
+	void setCompressed( bool enable ) { compressed = enable; }
+	//! Set the number of worker threads
+	void setThreads( int num ) { numThreads = qMax( 1, num ); }
+
+	//! Add a loose file as \a path in the archive, replacing a file added there before
+	bool addFile( const QString & path, const QString & source );
+	//! Add the files below a data folder, keeping their paths relative to it; returns the number added
+	int addFolder( const QString & folder );
+	//! Add the files of an open archive, which must stay open until write(); returns the number added
+	int addArchive( FSArchiveFile * archive );
+
+	//! The number of files added
+	int fileCount() const { return sources.count(); }
+
+	//! Write the archive
+	/*!
+	 * \param filename	The archive to write, only replaced once it has been written completely
+	 * \return			True if successful, otherwise see statusText()
+	 */
+	bool write( const QString & filename );
+
+	//! The reason the last write() failed
+	QString statusText() const { return status; }
+
+protected:
+	//! Where the contents of a file come from
+	struct Source
+	{
+		//! The loose file, or the path in the archive
+		QString path;
+		FSArchiveFile * archive = nullptr;
+	};
+
+	//! A file being packed
+	struct Job
+	{
+		QString folder;
+		QString name;
+		quint64 folderHash = 0;
+		quint64 nameHash = 0;
+		//! The record in folders, receiving the sizes and offsets
+		BSA::BSAFile * file = nullptr;
+		Source source;
+		//! The bytes written for the file
+		QByteArray blob;
+		QString error;
+		bool done = false;
+	};
+
+	//! Add a file as \a path in the archive; false if it has no folder or does not fit the format
+	bool insert( const QString & path, const Source & source );
+
+	//! Read a file, or at least its first \a maxSize bytes
+	bool readSource( const Source & source, QByteArray & data, qint64 maxSize = -1 ) const;
+	//! Read and compress the file of a job, filling its record and blob, or its error
+	void pack( Job & job ) const;
+	//! Compress \a size bytes with zlib or LZ4, leaving \a out empty if they do not get smaller
+	void compress( const char * data, int size, QByteArray & out ) const;
+	//! Fill the header and the uncompressed chunks of a DX10 BA2 texture from a DDS header
+	/*!
+	 * \param dds			The DDS file, or at least its header
+	 * \param tex			Receives the texture, leaving the hashes
+	 * \param headerSize	Receives the size of the DDS header, which is not stored
+	 * \return				False if the format of the texture cannot be stored
+	 */
+	bool layoutTexture( const QByteArray & dds, F4Tex & tex, int & headerSize ) const;
+
+	//! The files in the order they are written
+	QVector<Job> sortedJobs() const;
+
+	//! Write the archive to \a out, reading and compressing on the worker threads; throws the status on errors
+	void writeBSA( QFileDevice & out, QVector<Job> & jobs );
+	void writeBA2( QFileDevice & out, QVector<Job> & jobs );
+	//! Write the blobs of \a jobs from the current position, as the worker threads pack them, setting the offsets
+	void writeData( QFileDevice & out, QVector<Job> & jobs );
+
+	Format format;
+	bool compressed = true;
+	int numThreads;
+
+	//! The folders by their lower case name with backslashes, their files by lower case name
+	QHash<QString, BSA::BSAFolder *> folders;
+	//! The contents of the files of folders
+	QHash<const BSA::BSAFile *, Source> sources;
+
+	QString status;
+};
+
+#endif
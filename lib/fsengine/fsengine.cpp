@@ -31,13 +31,24 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 ***** END LICENCE BLOCK *****/
 
 #include "fsengine.h"
+#include "functionrunnable.h"
 #include "bsa.h"
 
 #include <QDateTime>
 #include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
 #include <QMap>
 #include <QMutex>
+#include <QPair>
+#include <QRegExp>
 #include <QStringList>
+#include <QThreadPool>
+#include <QVector>
+
+#include <algorithm>
+#include <atomic>
 
 
 //! \file fsengine.cpp File system engine implementations
@@ -71,3 +82,86 @@ FSArchiveHandler::~FSArchiveHandler()
 	if ( ! archive->ref.deref() )
 		delete archive;
 }
+
+// see fsengine.h
+QStringList FSArchiveFile::matchFiles( const QString & pattern ) const
+{
+	QRegExp re( QString( pattern ).replace( "\\", "/" ), Qt::CaseInsensitive, QRegExp::Wildcard );
+
+	QStringList matched;
+	for ( const QString & fn : fileNames() ) {
+		if ( re.exactMatch( fn ) )
+			matched.append( fn );
+	}
+
+	return matched;
+}
+
+// see fsengine.h
+int FSArchiveFile::extract( const QStringList & fns, const ExtractFunction & func )
+{
+	// Reading in storage order keeps the access to the archive sequential
+	QVector<QPair<qint64, QString>> order;
+	order.reserve( fns.count() );
+	for ( const QString & fn : fns ) {
+		if ( hasFile( fn ) )
+			order.append( { fileOffset( fn ), fn } );
+	}
+
+	std::sort( order.begin(), order.end() );
+
+	std::atomic<int> next( 0 );
+	std::atomic<int> extracted( 0 );
+	std::atomic<bool> stopped( false );
+
+	auto work = [this, &order, &next, &extracted, &stopped, &func]() {
+		for ( int i = next++; i < order.count() && !stopped; i = next++ ) {
+			QByteArray content;
+			if ( !fileContents( order.at( i ).second, content ) )
+				continue;
+
+			extracted++;
+			if ( !func( order.at( i ).second, content ) )
+				stopped = true;
+		}
+	};
+
+	QThreadPool pool;
+	for ( int t = 0; t < pool.maxThreadCount(); t++ )
+		pool.start( new FunctionRunnable( work ) );
+
+	pool.waitForDone();
+
+	return extracted;
+}
+
+// see fsengine.h
+int FSArchiveFile::extractTo( const QStringList & fns, const QString & directory, QStringList * errors )
+{
+	QDir dir( directory );
+	// Guards the creation of the directories and errors
+	QMutex dirMutex;
+
+	std::atomic<int> written( 0 );
+
+	extract( fns, [&dir, &dirMutex, &written, errors]( const QString & fn, const QByteArray & content ) {
+		QString target = dir.filePath( fn );
+
+		{
+			QMutexLocker lock( &dirMutex );
+			QDir().mkpath( QFileInfo( target ).absolutePath() );
+		}
+
+		QFile f( target );
+		if ( f.open( QIODevice::WriteOnly ) && f.write( content ) == content.size() ) {
+			written++;
+		} else if ( errors ) {
+			QMutexLocker lock( &dirMutex );
+			errors->append( QString( "%1: %2" ).arg( target, f.errorString() ) );
+		}
+
+		return true;
+	} );
+
+	return written;
+}
@@ -39,6 +39,7 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <QAtomicInt>
 
+#include <functional>
 #include <memory>
 
 //! Provides a way to register an FSArchiveEngine with the application.
@@ -84,6 +85,8 @@ public:
 	
 	virtual bool hasFolder( const QString & ) const = 0;
 	virtual bool hasFile( const QString & ) const = 0;
+	//! The lower case paths of every file in the archive
+	virtual QStringList fileNames() const = 0;
 	virtual qint64 fileSize( const QString & ) const = 0;
 	virtual bool fileContents( const QString &, QByteArray & ) = 0;
 	virtual QString getAbsoluteFilePath( const QString & ) const = 0;
@@ -92,6 +95,33 @@ public:
 	virtual QString owner( const QString & ) const = 0;
 	virtual QDateTime fileTime( const QString & ) const = 0;
 
+	//! Where a file is stored in the archive; extract() reads files in this order
+	virtual qint64 fileOffset( const QString & ) const { return 0; }
+
+	//! Receives each extracted file; returning false stops the extraction
+	typedef std::function<bool( const QString & fn, const QByteArray & content )> ExtractFunction;
+
+	//! The files whose paths match a wildcard \a pattern such as "meshes/*.nif"
+	QStringList matchFiles( const QString & pattern ) const;
+	//! Extract many files at once
+	/*!
+	 * The files are read in the order they are stored, by a pool of threads,
+	 * so \a func is called from worker threads and must be thread-safe.
+	 *
+	 * \param fns	The files to extract
+	 * \param func	Called with the contents of every file that could be read
+	 * \return		The number of files passed to \a func
+	 */
+	int extract( const QStringList & fns, const ExtractFunction & func );
+	//! Extract files below \a directory, recreating their paths in the archive
+	/*!
+	 * \param fns		The files to extract
+	 * \param directory	Where to write the files
+	 * \param errors	If not null, receives a message for every file that could not be written
+	 * \return			The number of files written
+	 */
+	int extractTo( const QStringList & fns, const QString & directory, QStringList * errors = nullptr );
+
 protected:
 	//! A reference counter for an implicitly shared class
 	QAtomicInt ref;
@@ -34,6 +34,7 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "fsmanager.h"
 #include "fsengine.h"
 #include "bsa.h"
+#include "functionrunnable.h"
 
 #include <QCheckBox>
 #include <QFileDialog>
@@ -41,11 +42,25 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QListView>
 #include <QPushButton>
 #include <QSettings>
+#include <QStringBuilder>
 #include <QStringListModel>
+#include <QThreadPool>
+#include <QVector>
+
+#include <algorithm>
+#include <atomic>
 
 
 //! Global BSA file manager
 static FSManager * theFSManager = nullptr;
+
+//! The budget of the decompressed file cache in KiB, from the settings in MiB
+static int cacheBudget()
+{
+	QSettings cfg;
+	return std::max( cfg.value( "Settings/Resources/Archive Cache Size", 256 ).toInt(), 0 ) * 1024;
+}
+
 // see fsmanager.h
 FSManager* FSManager::get() 
 {
@@ -65,13 +80,78 @@ void FSManager::del()
 // see fsmanager.h
 QList <FSArchiveFile *> FSManager::archiveList()
 {
+	FSManager * mgr = get();
+	QReadLocker lock( &mgr->indexLock );
+
 	QList<FSArchiveFile *> archives;
-	for ( std::shared_ptr<FSArchiveHandler> an : get()->archives.values() ) {
+	for ( std::shared_ptr<FSArchiveHandler> an : mgr->archives.values() ) {
 		archives.append( an->getArchive() );
 	}
 	return archives;
 }
 
+// see fsmanager.h
+std::shared_ptr<FSArchiveHandler> FSManager::findArchive( const QString & fn )
+{
+	FSManager * mgr = get();
+	QReadLocker lock( &mgr->indexLock );
+
+	auto it = mgr->fileIndex.constFind( fn );
+	if ( it == mgr->fileIndex.constEnd() )
+		return nullptr;
+
+	return mgr->indexed.at( it.value() );
+}
+
+// see fsmanager.h
+bool FSManager::fileContents( const std::shared_ptr<FSArchiveHandler> & handler, const QString & fn, QByteArray & content )
+{
+	FSArchiveFile * archive = handler ? handler->getArchive() : nullptr;
+	if ( !archive )
+		return false;
+
+	FSManager * mgr = get();
+	QString key = archive->path() % QLatin1Char( '|' ) % fn;
+
+	{
+		QMutexLocker lock( &mgr->contentsMutex );
+		if ( QByteArray * cached = mgr->contents.object( key ) ) {
+			mgr->hits++;
+			content = *cached;
+			return true;
+		}
+		mgr->misses++;
+	}
+
+	// Decompress outside the lock so other files can be read meanwhile
+	if ( !archive->fileContents( fn, content ) )
+		return false;
+
+	int cost = int( content.size() / 1024 ) + 1;
+
+	QMutexLocker lock( &mgr->contentsMutex );
+	if ( cost <= mgr->contents.maxCost() )
+		mgr->contents.insert( key, new QByteArray( content ), cost );
+
+	return true;
+}
+
+// see fsmanager.h
+FSManager::CacheStats FSManager::cacheStats()
+{
+	FSManager * mgr = get();
+	QMutexLocker lock( &mgr->contentsMutex );
+	return { mgr->hits, mgr->misses, mgr->contents.totalCost(), mgr->contents.maxCost() };
+}
+
+// see fsmanager.h
+void FSManager::updateCacheSize()
+{
+	FSManager * mgr = get();
+	QMutexLocker lock( &mgr->contentsMutex );
+	mgr->contents.setMaxCost( cacheBudget() );
+}
+
 // see fsmanager.h
 FSManager::FSManager( QObject * parent )
 	: QObject( parent ), automatic( false )
@@ -82,18 +162,92 @@ FSManager::FSManager( QObject * parent )
 // see fsmanager.h
 FSManager::~FSManager()
 {
+	QWriteLocker lock( &indexLock );
+	fileIndex.clear();
+	indexed.clear();
 	archives.clear();
 }
 
 void FSManager::initialize()
 {
 	QSettings cfg;
+	contents.setMaxCost( cacheBudget() );
+
 	QStringList list = cfg.value( "Settings/Resources/Archives", QStringList() ).toStringList();
 
-	for ( const QString an : list ) {
-		if ( auto a = FSArchiveHandler::openArchive( an ) )
-			archives.insert( an, a );
+	openArchives( list );
+}
+
+void FSManager::openArchives( const QStringList & paths )
+{
+	QStringList unique = paths;
+	unique.removeDuplicates();
+
+	// Archives which stay in the list are not read again
+	QVector<std::shared_ptr<FSArchiveHandler>> opened( unique.count() );
+	QVector<int> pending;
+
+	for ( int i = 0; i < unique.count(); i++ ) {
+		opened[i] = archives.value( unique.at( i ) );
+		if ( !opened[i] )
+			pending.append( i );
+	}
+
+	// Reading the directories of the archives is mostly waiting on the disk
+	std::atomic<int> next( 0 );
+
+	auto work = [&unique, &opened, &pending, &next]() {
+		for ( int i = next++; i < pending.count(); i = next++ )
+			opened[pending.at( i )] = FSArchiveHandler::openArchive( unique.at( pending.at( i ) ) );
+	};
+
+	QThreadPool pool;
+	for ( int t = 0; t < std::min( pool.maxThreadCount(), pending.count() ); t++ )
+		pool.start( new FunctionRunnable( work ) );
+
+	pool.waitForDone();
+
+	QMap<QString, std::shared_ptr<FSArchiveHandler> > list;
+	for ( int i = 0; i < unique.count(); i++ ) {
+		if ( opened.at( i ) )
+			list.insert( unique.at( i ), opened.at( i ) );
+	}
+
+	updateIndex( list );
+}
+
+void FSManager::updateIndex( const QMap<QString, std::shared_ptr<FSArchiveHandler> > & list )
+{
+	// Built before taking the lock, so that lookups on other threads only wait for the swap
+	QVector<std::shared_ptr<FSArchiveHandler> > newIndexed;
+	QHash<QString, int> newIndex;
+
+	// Earlier archives take precedence, as they did when each was searched in turn
+	for ( std::shared_ptr<FSArchiveHandler> an : list.values() ) {
+		FSArchiveFile * archive = an->getArchive();
+		if ( !archive )
+			continue;
+
+		int number = newIndexed.count();
+		newIndexed.append( an );
+
+		for ( const QString & fn : archive->fileNames() ) {
+			if ( !newIndex.contains( fn ) )
+				newIndex.insert( fn, number );
+		}
+	}
+
+	// The replaced archives are closed once the threads still reading them let go of them
+	{
+		QWriteLocker lock( &indexLock );
+		archives = list;
+		indexed.swap( newIndexed );
+		fileIndex.swap( newIndex );
 	}
+
+	// Cached files may belong to archives which are no longer open
+	QMutexLocker lock( &contentsMutex );
+	contents.clear();
 }
 
 // see fsmanager.h
@@ -131,20 +285,34 @@ QStringList FSManager::autodetectArchives( const QString & folder )
 #endif
 
 	if ( !folder.isEmpty() ) {
-		QStringList listCopy;
 		// Looking for a specific folder here
-		// Remove the BSAs that do not contain this folder
-		for ( auto f : list ) {
-			auto handler = FSArchiveHandler::openArchive( f );
-			if ( handler ) {
-				auto bsa = handler->getArchive<BSA *>();
-				if ( bsa ) {
-					auto rootFolder = bsa->getFolder( "" );
-					if ( rootFolder->children.contains( folder ) ) {
-						listCopy.append( f );
+		// Remove the BSAs that do not contain this folder, probing them in parallel
+		QVector<bool> contains( list.count(), false );
+		std::atomic<int> next( 0 );
+
+		auto probe = [&list, &contains, &next, &folder]() {
+			for ( int i = next++; i < list.count(); i = next++ ) {
+				auto handler = FSArchiveHandler::openArchive( list.at( i ) );
+				if ( handler ) {
+					auto bsa = handler->getArchive<BSA *>();
+					if ( bsa ) {
+						auto rootFolder = bsa->getFolder( "" );
+						contains[i] = rootFolder->children.contains( folder );
 					}
 				}
 			}
+		};
+
+		QThreadPool pool;
+		for ( int t = 0; t < std::min( pool.maxThreadCount(), list.count() ); t++ )
+			pool.start( new FunctionRunnable( probe ) );
+
+		pool.waitForDone();
+
+		QStringList listCopy;
+		for ( int i = 0; i < list.count(); i++ ) {
+			if ( contains.at( i ) )
+				listCopy.append( list.at( i ) );
 		}
 
 		list = listCopy;
@@ -37,7 +37,12 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <QDialog>
 #include <QObject>
+#include <QCache>
+#include <QHash>
 #include <QMap>
+#include <QMutex>
+#include <QReadWriteLock>
+#include <QVector>
 
 #include <memory>
 
@@ -57,6 +62,30 @@ public:
 
 	//! Gets the list of globally registered BSA files
 	static QList<FSArchiveFile *> archiveList();
+	//! Gets the first archive in archiveList() containing the lower case path \a fn, or null
+	/*!
+	 * Safe to call from any thread. The archive stays open while the returned
+	 * handler is held, even if the archives are changed in the settings meanwhile.
+	 */
+	static std::shared_ptr<FSArchiveHandler> findArchive( const QString & fn );
+	//! Gets the contents of \a fn from the archive of \a handler, keeping recently used files decompressed
+	static bool fileContents( const std::shared_ptr<FSArchiveHandler> & handler, const QString & fn, QByteArray & content );
+
+	//! Usage of the decompressed file cache
+	struct CacheStats
+	{
+		quint64 hits;
+		quint64 misses;
+		//! Size of the cached files in KiB
+		int size;
+		//! The budget in KiB
+		int budget;
+	};
+
+	//! Gets the usage of the decompressed file cache
+	static CacheStats cacheStats();
+	//! Sets the budget of the decompressed file cache from the settings
+	static void updateCacheSize();
 
 protected:
 	//! Constructor
@@ -66,6 +95,18 @@ protected:
 	
 protected:
 	QMap<QString, std::shared_ptr<FSArchiveHandler> > archives;
+	//! The archives of fileIndex, in the order of archives
+	QVector<std::shared_ptr<FSArchiveHandler> > indexed;
+	//! The number in indexed of the archive providing each file path, see findArchive()
+	QHash<QString, int> fileIndex;
+	//! Guards archives, indexed and fileIndex; files are looked up from several threads
+	mutable QReadWriteLock indexLock;
+	//! Recently used file contents by archive and file path, costed in KiB
+	QCache<QString, QByteArray> contents;
+	//! Guards contents and the counters, files are read from several threads
+	QMutex contentsMutex;
+	quint64 hits = 0;
+	quint64 misses = 0;
 	bool automatic;
 	
 	//! Builds a list of global BSAs on Windows platforms
@@ -73,7 +114,12 @@ protected:
 	//! Helper function to build a list of BSAs
 	static QStringList regPathBSAList( QString regKey, QString dataDir );
 
+	//! Open the archives of \a paths on a thread pool, keeping those already in archives
+	void openArchives( const QStringList & paths );
+
 	void initialize();
+	//! Replace archives by \a list and rebuild the index of their files
+	void updateIndex( const QMap<QString, std::shared_ptr<FSArchiveHandler> > & list );
 	
 	friend class NifSkope;
 	friend class SettingsResources;
@@ -43,6 +43,16 @@
 
 #include "half.h"
 
+#include <string.h>
+
+#if defined( __F16C__ ) || defined( __AVX2__ )
+#include <immintrin.h>
+#define HALF_F16C
+#elif defined( __aarch64__ ) || defined( _M_ARM64 )
+#include <arm_neon.h>
+#define HALF_NEON
+#endif
+
 // Load immediate
 static inline uint32_t _uint32_li( uint32_t a )
 {
@@ -717,3 +727,66 @@ half_mul( uint16_t x, uint16_t y )
 
   return (uint16_t)(c_result);
 }
+
+// Span conversions
+// ----------------
+//
+//  Four values per instruction with F16C (enabled by -mf16c or /arch:AVX2)
+//  or on AArch64, where NEON is always present. The remainder, and other
+//  targets, use the branch-free conversions above. The hardware rounds
+//  ties to even, half_from_float rounds them up, so the last bit of a tie
+//  can differ between targets.
+//
+
+void
+half_to_float_n( const uint16_t * h, float * f, size_t n )
+{
+  size_t i = 0;
+
+#if defined( HALF_F16C )
+  for ( ; i + 4 <= n; i += 4 )
+  {
+    const __m128i hv = _mm_loadl_epi64( (const __m128i *)( h + i ) );
+    _mm_storeu_ps( f + i, _mm_cvtph_ps( hv ) );
+  }
+#elif defined( HALF_NEON )
+  for ( ; i + 4 <= n; i += 4 )
+  {
+    const float16x4_t hv = vreinterpret_f16_u16( vld1_u16( h + i ) );
+    vst1q_f32( f + i, vcvt_f32_f16( hv ) );
+  }
+#endif
+
+  for ( ; i < n; i++ )
+  {
+    const uint32_t bits = half_to_float( h[i] );
+    memcpy( f + i, &bits, sizeof( bits ) );
+  }
+}
+
+void
+half_from_float_n( const float * f, uint16_t * h, size_t n )
+{
+  size_t i = 0;
+
+#if defined( HALF_F16C )
+  for ( ; i + 4 <= n; i += 4 )
+  {
+    const __m128i hv = _mm_cvtps_ph( _mm_loadu_ps( f + i ), _MM_FROUND_TO_NEAREST_INT );
+    _mm_storel_epi64( (__m128i *)( h + i ), hv );
+  }
+#elif defined( HALF_NEON )
+  for ( ; i + 4 <= n; i += 4 )
+  {
+    const float16x4_t hv = vcvt_f16_f32( vld1q_f32( f + i ) );
+    vst1_u16( h + i, vreinterpret_u16_f16( hv ) );
+  }
+#endif
+
+  for ( ; i < n; i++ )
+  {
+    uint32_t bits;
+    memcpy( &bits, f + i, sizeof( bits ) );
+    h[i] = half_from_float( bits );
+  }
+}
@@ -1,10 +1,15 @@
 #ifndef HALF_H
 #define HALF_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 uint32_t half_to_float( uint16_t h );
 uint16_t half_from_float( uint32_t f );
+
+// Convert n values at once, with F16C or NEON where the compiler targets them
+void half_to_float_n( const uint16_t * h, float * f, size_t n );
+void half_from_float_n( const float * f, uint16_t * h, size_t n );
 uint16_t half_add( uint16_t arg0, uint16_t arg1 );
 uint16_t half_mul( uint16_t arg0, uint16_t arg1 );
 
@@ -0,0 +1,9 @@
+#version 150 compatibility
+
+in vec4 LineColor;
+
+
+void main( void )
+{
+	gl_FragColor = LineColor;
+}
@@ -0,0 +1,13 @@
+#version 150 compatibility
+
+// The vector to draw is given as the normal, whichever it is
+out vec4 Direction;
+out vec4 Color;
+
+
+void main( void )
+{
+	gl_Position = gl_ModelViewMatrix * gl_Vertex;
+	Direction = gl_ModelViewMatrix * vec4( gl_Normal, 0.0 );
+	Color = gl_Color;
+}
@@ -0,0 +1,331 @@
+/***** BEGIN LICENSE BLOCK *****
+
+BSD License
+
+Copyright (c) 2005-2015, NIF File Format Library and Tools
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the NIF File Format Library and Tools project may not be
+   used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+***** END LICENCE BLOCK *****/
+
+#include "assetscanner.h"
+
+#include "nifmodel.h"
+#include "settingssnapshot.h"
+
+#include <fsengine/fsengine.h>
+#include <fsengine/fsmanager.h>
+
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QTextStream>
+
+#include <algorithm>
+
+
+//! \file assetscanner.cpp AssetScanner implementation
+
+//! A field of a block type holding the path of an asset
+struct AssetField
+{
+	const char * type;
+	const char * field;
+	//! The folder of the data folder the path is relative to
+	const char * folder;
+};
+
+//! The fields read by AssetScanner::scan(), for the block types and the types inheriting them
+static const AssetField assetFields[] = {
+	{ "NiSourceTexture", "File Name", "textures" },
+	{ "NiImage", "File Name", "textures" },
+	{ "BSShaderTextureSet", "Textures", "textures" },
+	{ "BSShaderNoLightingProperty", "File Name", "textures" },
+	{ "TallGrassShaderProperty", "File Name", "textures" },
+	{ "SkyShaderProperty", "File Name", "textures" },
+	{ "BSSkyShaderProperty", "Source Texture", "textures" },
+	{ "BSEffectShaderProperty", "Source Texture", "textures" },
+	{ "BSEffectShaderProperty", "Greyscale Texture", "textures" },
+	{ "BSEffectShaderProperty", "Env Map Texture", "textures" },
+	{ "BSEffectShaderProperty", "Normal Texture", "textures" },
+	{ "BSEffectShaderProperty", "Env Mask Texture", "textures" },
+	// The names of the shader properties are materials from Fallout 4 on, see BSLightingShaderProperty::update()
+	{ "BSLightingShaderProperty", "Name", "materials" },
+	{ "BSLightingShaderProperty", "Wet Material", "materials" },
+	{ "BSEffectShaderProperty", "Name", "materials" },
+};
+
+//! Whether a path is the file of a material rather than a name
+static bool isMaterial( const QString & path )
+{
+	return path.endsWith( ".bgsm", Qt::CaseInsensitive ) || path.endsWith( ".bgem", Qt::CaseInsensitive );
+}
+
+//! A path as the archives index it: lower case, with forward slashes and relative to the data folder
+/*!
+ * As TexCache::find(), an absolute path is cut at its \a folder, and a
+ * relative one gets \a folder prepended unless it is already below it, or
+ * below the shaders folder for textures.
+ */
+static QString assetPath( const QString & path, const QString & folder )
+{
+	QString asset = QDir::fromNativeSeparators( path.trimmed() ).toLower();
+	QString prefix = folder + QLatin1Char( '/' );
+
+	if ( asset.startsWith( prefix ) )
+		return asset;
+
+	int idx = asset.indexOf( QLatin1Char( '/' ) + prefix );
+	if ( idx >= 0 )
+		return asset.mid( idx + 1 );
+
+	while ( asset.startsWith( QLatin1Char( '/' ) ) )
+		asset.remove( 0, 1 );
+
+	if ( !( folder == "textures" && asset.startsWith( "shaders/" ) ) )
+		asset.prepend( prefix );
+
+	return asset;
+}
+
+AssetScanner::AssetScanner()
+{
+}
+
+AssetScanner::~AssetScanner()
+{
+}
+
+void AssetScanner::addDataFolder( const QString & folder )
+{
+	dataFolders.append( QFileInfo( folder ).absoluteFilePath() );
+}
+
+void AssetScanner::indexFolder( const QString & folder )
+{
+	QDir data( folder );
+
+	for ( const QString & sub : { "textures", "materials", "shaders" } ) {
+		if ( !data.exists( sub ) )
+			continue;
+
+		QDirIterator it( data.filePath( sub ), QDir::Files, QDirIterator::Subdirectories );
+		while ( it.hasNext() )
+			looseFiles.insert( data.relativeFilePath( it.next() ).toLower() );
+	}
+}
+
+bool AssetScanner::run( const QString & input, bool recursive )
+{
+	QStringList extensions{ "*.nif", "*.nifcache", "*.kf", "*.kfa" };
+
+	if ( !runner.open( input, extensions, recursive ) )
+		return false;
+
+	QStringList folders = dataFolders;
+
+	if ( !runner.getArchive() ) {
+		// The data folder holds the meshes folder the files are in, if they are in one
+		QDir data( runner.getRoot() );
+		for ( QDir dir = data; !dir.isRoot(); ) {
+			if ( dir.dirName().compare( "meshes", Qt::CaseInsensitive ) == 0 ) {
+				data = dir;
+				data.cdUp();
+				break;
+			}
+
+			if ( !dir.cdUp() )
+				break;
+		}
+
+		folders.append( data.absolutePath() );
+	}
+
+	// Folders relative to the folder of each NIF are left out, a data folder is searched instead
+	for ( const QString & folder : SettingsSnapshot::get()->resourceFolders ) {
+		if ( !( folder.startsWith( "./" ) || folder.startsWith( ".\\" ) ) )
+			folders.append( folder );
+	}
+
+	folders.removeDuplicates();
+
+	looseFiles.clear();
+	for ( const QString & folder : folders )
+		indexFolder( folder );
+
+	// Opens the archives of the settings, so that the threads only read the merged index
+	FSManager::get();
+
+	// Only the blocks holding paths are decoded, see NifModel::setLazyLoading()
+	runner.run( [this]( NifModel & nif, const QString & file ) {
+		Result result = scan( nif, file );
+
+		QMutexLocker lock( &resultMutex );
+		results.append( result );
+	}, []( NifModel & nif ) {
+		nif.setLazyLoading( true );
+	} );
+
+	runner.close();
+
+	return true;
+}
+
+AssetScanner::Location AssetScanner::locate( const QString & asset ) const
+{
+	if ( looseFiles.contains( asset ) )
+		return LooseFile;
+
+	const std::shared_ptr<FSArchiveHandler> & archive = runner.getArchive();
+
+	if ( ( archive && archive->getArchive()->hasFile( asset ) ) || FSManager::findArchive( asset ) )
+		return Archived;
+
+	return Missing;
+}
+
+AssetScanner::Result AssetScanner::scan( NifModel & nif, const QString & file ) const
+{
+	Result result;
+	result.file = runner.filePath( file );
+
+	if ( !runner.load( nif, file ) ) {
+		result.error = tr( "could not be loaded" );
+		return result;
+	}
+
+	for ( int b = 0; b < nif.getBlockCount(); b++ ) {
+		for ( const AssetField & f : assetFields ) {
+			// Matching the type does not decode a lazily loaded block, reading its fields does
+			QModelIndex iBlock = nif.getBlock( b, f.type );
+			if ( !iBlock.isValid() )
+				continue;
+
+			QModelIndex iField = nif.getIndex( iBlock, f.field );
+			if ( !iField.isValid() )
+				continue;
+
+			const QString folder = f.folder;
+
+			QVector<QString> paths;
+			if ( nif.isArray( iField ) )
+				paths = nif.getArray<QString>( iField );
+			else
+				paths << nif.get<QString>( iField );
+
+			for ( const QString & path : paths ) {
+				if ( path.trimmed().isEmpty() || ( folder == "materials" && !isMaterial( path ) ) )
+					continue;
+
+				Dependency dep;
+				dep.block = b;
+				dep.blockType = nif.getBlockName( iBlock );
+				dep.field = f.field;
+				dep.asset = assetPath( path, folder );
+				dep.location = locate( dep.asset );
+
+				result.dependencies.append( dep );
+			}
+		}
+	}
+
+	return result;
+}
+
+//! The results sorted by file
+template <typename T> static QVector<T> sortedByFile( const QVector<T> & results )
+{
+	QVector<T> sorted = results;
+	std::sort( sorted.begin(), sorted.end(), []( const T & a, const T & b ) {
+		return a.file < b.file;
+	} );
+
+	return sorted;
+}
+
+void AssetScanner::report( QTextStream & out ) const
+{
+	QMutexLocker lock( &resultMutex );
+
+	static const char * locations[] = { "missing", "loose", "archived" };
+
+	out << "File\tBlock\tType\tField\tAsset\tLocation\n";
+
+	for ( const Result & r : sortedByFile( results ) ) {
+		QString file = QDir::toNativeSeparators( r.file );
+
+		if ( !r.error.isEmpty() ) {
+			out << file << "\t\t\t\t\t" << r.error << '\n';
+			continue;
+		}
+
+		for ( const Dependency & d : r.dependencies ) {
+			out << file << '\t' << d.block << '\t' << d.blockType << '\t' << d.field << '\t'
+			    << QDir::toNativeSeparators( d.asset ) << '\t' << locations[d.location] << '\n';
+		}
+	}
+}
+
+void AssetScanner::reportMissing( QTextStream & out ) const
+{
+	QMutexLocker lock( &resultMutex );
+
+	out << "File\tMissing\tMissing Assets\n";
+
+	for ( const Result & r : sortedByFile( results ) ) {
+		QStringList assets;
+		for ( const Dependency & d : r.dependencies ) {
+			if ( d.location == Missing )
+				assets << QDir::toNativeSeparators( d.asset );
+		}
+
+		assets.removeDuplicates();
+
+		if ( !r.error.isEmpty() )
+			out << QDir::toNativeSeparators( r.file ) << "\t\t" << r.error << '\n';
+		else if ( !assets.isEmpty() )
+			out << QDir::toNativeSeparators( r.file ) << '\t' << assets.count() << '\t' << assets.join( ", " ) << '\n';
+	}
+}
+
+int AssetScanner::missing() const
+{
+	QMutexLocker lock( &resultMutex );
+
+	return std::count_if( results.constBegin(), results.constEnd(), []( const Result & r ) {
+		return std::any_of( r.dependencies.constBegin(), r.dependencies.constEnd(), []( const Dependency & d ) {
+			return d.location == Missing;
+		} );
+	} );
+}
+
+int AssetScanner::failed() const
+{
+	QMutexLocker lock( &resultMutex );
+
+	return std::count_if( results.constBegin(), results.constEnd(), []( const Result & r ) {
+		return !r.error.isEmpty();
+	} );
+}
@@ -0,0 +1,142 @@
+/***** BEGIN LICENSE BLOCK *****
+
+BSD License
+
+Copyright (c) 2005-2015, NIF File Format Library and Tools
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the NIF File Format Library and Tools project may not be
+   used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+***** END LICENCE BLOCK *****/
+
+#ifndef ASSETSCANNER_H
+#define ASSETSCANNER_H
+
+#include "batchrunner.h"
+
+#include <QCoreApplication>
+#include <QMutex>
+#include <QSet>
+#include <QStringList>
+#include <QVector>
+
+
+//! \file assetscanner.h AssetScanner
+
+class NifModel;
+class QTextStream;
+
+//! Lists the textures and materials every file of a folder or archive depends on, and which are missing
+/*!
+ * Before the files are scanned, the textures and materials folders of the
+ * data folders and of the resource folders in the settings are indexed once,
+ * next to the files of the archives FSManager has merged. Worker threads then
+ * load the files with lazy loading, so that of the files which store their
+ * block sizes only the blocks holding texture or material paths are decoded,
+ * and look every path up in the indices. Nothing is extracted or written.
+ *
+ * Used by <tt>NifSkope -no-gui --assets ...</tt>, see main().
+ */
+class AssetScanner final
+{
+	Q_DECLARE_TR_FUNCTIONS( AssetScanner )
+
+public:
+	AssetScanner();
+	~AssetScanner();
+
+	//! Also look for loose files below \a folder, the folder holding the textures and materials folders
+	void addDataFolder( const QString & folder );
+	//! Set the number of worker threads
+	void setThreads( int num ) { runner.setThreads( num ); }
+
+	//! Scan the NIFs below a directory, in an archive, or a single NIF
+	/*!
+	 * The data folder a directory or file belongs to, the parent of its meshes
+	 * folder or the folder itself, is searched for loose files, as are the
+	 * files of an archive.
+	 *
+	 * \param input		A directory, an archive or a file
+	 * \param recursive	Whether to include the sub directories of a directory
+	 * \return			False if the input could not be opened
+	 */
+	bool run( const QString & input, bool recursive );
+
+	//! Print a tab separated row per path of a block, sorted by file
+	void report( QTextStream & out ) const;
+	//! Print a tab separated row per file with missing assets, listing them
+	void reportMissing( QTextStream & out ) const;
+
+	//! The number of files referencing missing assets
+	int missing() const;
+	//! The number of files which could not be loaded
+	int failed() const;
+
+protected:
+	//! Where an asset was found
+	enum Location
+	{
+		Missing,
+		LooseFile,
+		Archived
+	};
+
+	//! A path stored in a block
+	struct Dependency
+	{
+		int block = -1;
+		QString blockType;
+		QString field;
+		//! Lower case, with forward slashes, relative to the data folder
+		QString asset;
+		Location location = Missing;
+	};
+
+	//! The dependencies of a file
+	struct Result
+	{
+		QString file;
+		QString error;
+		QVector<Dependency> dependencies;
+	};
+
+	//! Load a file and look up its dependencies
+	Result scan( NifModel & nif, const QString & file ) const;
+	//! Where an asset in the form of Dependency::asset is found
+	Location locate( const QString & asset ) const;
+	//! Add the textures and materials below a data folder to looseFiles
+	void indexFolder( const QString & folder );
+
+	QStringList dataFolders;
+	//! The assets of the data and resource folders, in the form of Dependency::asset
+	QSet<QString> looseFiles;
+
+	BatchRunner runner;
+
+	//! Serializes adding to results
+	mutable QMutex resultMutex;
+	QVector<Result> results;
+};
+
+#endif
@@ -35,15 +35,269 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "niftypes.h"
 
+#include <QBuffer>
 #include <QByteArray>
 #include <QColor>
+#include <QDataStream>
 #include <QFile>
 #include <QFileInfo>
+#include <QSaveFile>
 #include <QTime>
 
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstddef>
+#include <new>
+
 
 //! @file basemodel.cpp Abstract base class for NIF data models
 
+//! Bytes of previous values kept for one recorded edit before it is given up as not undoable
+#define UNDO_RECORDING_LIMIT ( 64 * 1024 * 1024 )
+
+/*
+ *  NifItem allocation
+ */
+
+//! Rounds up to the alignment of allocations
+#define ITEM_ALIGN( size ) ( ( ( size ) + alignof( std::max_align_t ) - 1 ) & ~( alignof( std::max_align_t ) - 1 ) )
+
+struct NifItemChunk;
+
+//! Precedes every item, so that it finds its chunk when it is deleted
+struct NifItemSlot
+{
+	NifItemChunk * chunk;
+	//! The next free slot, while the slot is on a free list
+	NifItemSlot * nextFree;
+};
+
+//! A block of NifItem slots, owned by the arena of the thread that allocated it
+/*!
+ * Deleted items push their slots on the free list of their chunk, from
+ * whichever thread deletes them. The owning thread takes the free lists
+ * back once its current chunk is full, and hands those slots out again
+ * before it allocates another chunk. Chunks left without items are freed
+ * at that point, and the chunks of an exited thread once their last item
+ * is deleted.
+ */
+struct NifItemChunk
+{
+	//! Items still allocated, plus one while the chunk is owned by its thread
+	std::atomic<int> live;
+	//! Slots deleted since the owning thread last took them back
+	std::atomic<NifItemSlot *> freed;
+	//! Slots handed out in order
+	int used;
+	//! The next chunk owned by the same thread
+	NifItemChunk * next;
+};
+
+static const size_t chunkHeaderSize = ITEM_ALIGN( sizeof( NifItemChunk ) );
+static const size_t slotHeaderSize = ITEM_ALIGN( sizeof( NifItemSlot ) );
+static const size_t slotSize = slotHeaderSize + ITEM_ALIGN( sizeof( NifItem ) );
+static const int chunkSlots = 4096;
+
+//! The chunks items of one thread are allocated from
+/*!
+ * Kept trivially destructible, so that items can be allocated at any time,
+ * even after NifItemArenaRetire let go of the chunks of an exiting thread.
+ */
+struct NifItemArena
+{
+	//! The chunk slots are handed out from in order
+	NifItemChunk * current;
+	//! Every chunk the thread owns, including current
+	NifItemChunk * chunks;
+	//! Free slots taken back from the chunks, only touched by the thread
+	NifItemSlot * reuse;
+	//! The thread is exiting, each item gets a chunk of its own
+	bool exited;
+	//! Items allocated by the thread, see NifItem::allocations()
+	quint64 allocated;
+};
+
+static thread_local NifItemArena itemArena = { nullptr, nullptr, nullptr, false, 0 };
+
+//! Drop a reference to a chunk, freeing it once it holds no items and no thread owns it
+static void releaseChunk( NifItemChunk * chunk )
+{
+	if ( --chunk->live == 0 ) {
+		chunk->~NifItemChunk();
+		::operator delete( chunk );
+	}
+}
+
+//! Lets go of the chunks of a thread when it exits
+struct NifItemArenaRetire final
+{
+	~NifItemArenaRetire()
+	{
+		// The free lists are dropped with the chunks, their slots are not handed out again
+		NifItemChunk * chunk = itemArena.chunks;
+		while ( chunk ) {
+			NifItemChunk * next = chunk->next;
+			releaseChunk( chunk );
+			chunk = next;
+		}
+
+		itemArena.current = nullptr;
+		itemArena.chunks = nullptr;
+		itemArena.reuse = nullptr;
+		itemArena.exited = true;
+	}
+
+	void touch() {}
+};
+
+//! Construct the retire of the thread once it holds a chunk, so that it is destroyed when the thread exits
+static void touchItemArenaRetire()
+{
+	static thread_local NifItemArenaRetire retire;
+	retire.touch();
+}
+
+//! A chunk of \a slots slots, owned by the calling thread
+static NifItemChunk * newChunk( int slots )
+{
+	void * memory = ::operator new( chunkHeaderSize + slotSize * slots );
+
+	NifItemChunk * chunk = new( memory ) NifItemChunk;
+	chunk->live = 1;
+	chunk->freed = nullptr;
+	chunk->used = 0;
+	chunk->next = nullptr;
+	return chunk;
+}
+
+//! The item of \a slot, once it counts as allocated from its chunk
+static void * useSlot( NifItemSlot * slot )
+{
+	slot->chunk->live++;
+	return reinterpret_cast<char *>( slot ) + slotHeaderSize;
+}
+
+//! Hand out the next slot of \a chunk
+static void * takeSlot( NifItemChunk * chunk )
+{
+	char * memory = reinterpret_cast<char *>( chunk ) + chunkHeaderSize + slotSize * chunk->used++;
+
+	NifItemSlot * slot = reinterpret_cast<NifItemSlot *>( memory );
+	slot->chunk = chunk;
+	slot->nextFree = nullptr;
+	return useSlot( slot );
+}
+
+//! Take the free lists of the chunks of the thread into reuse, and free the chunks without items
+static void collectFreeSlots()
+{
+	NifItemChunk ** link = &itemArena.chunks;
+
+	while ( NifItemChunk * chunk = *link ) {
+		// Slots are pushed before their items are uncounted, only the reference of the thread is left
+		if ( chunk != itemArena.current && chunk->live == 1 ) {
+			*link = chunk->next;
+			releaseChunk( chunk );
+			continue;
+		}
+
+		NifItemSlot * slot = chunk->freed.exchange( nullptr );
+		while ( slot ) {
+			NifItemSlot * next = slot->nextFree;
+			slot->nextFree = itemArena.reuse;
+			itemArena.reuse = slot;
+			slot = next;
+		}
+
+		link = &chunk->next;
+	}
+}
+
+static void * allocateItem()
+{
+	itemArena.allocated++;
+
+	if ( itemArena.exited ) {
+		NifItemChunk * chunk = newChunk( 1 );
+		void * item = takeSlot( chunk );
+		releaseChunk( chunk );
+		return item;
+	}
+
+	if ( !itemArena.reuse && ( !itemArena.current || itemArena.current->used == chunkSlots ) ) {
+		if ( itemArena.current )
+			collectFreeSlots();
+		else
+			touchItemArenaRetire();
+
+		if ( !itemArena.reuse ) {
+			itemArena.current = newChunk( chunkSlots );
+			itemArena.current->next = itemArena.chunks;
+			itemArena.chunks = itemArena.current;
+		}
+	}
+
+	if ( NifItemSlot * slot = itemArena.reuse ) {
+		itemArena.reuse = slot->nextFree;
+		return useSlot( slot );
+	}
+
+	return takeSlot( itemArena.current );
+}
+
+//! Items may be deleted by another thread than the one that allocated them
+static void releaseItem( void * ptr )
+{
+	NifItemSlot * slot = reinterpret_cast<NifItemSlot *>( static_cast<char *>( ptr ) - slotHeaderSize );
+	NifItemChunk * chunk = slot->chunk;
+
+	slot->nextFree = chunk->freed;
+	while ( !chunk->freed.compare_exchange_weak( slot->nextFree, slot ) ) {
+	}
+
+	releaseChunk( chunk );
+}
+
+void * NifItem::operator new( size_t size )
+{
+	if ( size != sizeof( NifItem ) )
+		return ::operator new( size );
+
+	return allocateItem();
+}
+
+void NifItem::operator delete( void * ptr, size_t size )
+{
+	if ( !ptr )
+		return;
+
+	if ( size != sizeof( NifItem ) ) {
+		::operator delete( ptr );
+		return;
+	}
+
+	releaseItem( ptr );
+}
+
+quint64 NifItem::allocations()
+{
+	return itemArena.allocated;
+}
+
+void NifItem::memoryUsage( qint64 & items, qint64 & values, int & count ) const
+{
+	count++;
+	items += slotSize;
+	items += qint64( childItems.capacity() ) * sizeof( NifItem * );
+	items += qint64( linkAncestorRows.capacity() + linkRows.capacity() ) * sizeof( int );
+	items += qint64( arrConds.capacity() ) * sizeof( bool );
+	values += itemData.value.heapSize();
+
+	for ( const NifItem * child : childItems )
+		child->memoryUsage( items, values, count );
+}
+
 /*
  *  BaseModel
  */
@@ -53,6 +307,45 @@ BaseModel::BaseModel( QObject * p ) : QAbstractItemModel( p )
 	root = new NifItem( 0 );
 	parentWindow = qobject_cast<QWidget *>(p);
 	msgMode = TstMessage;
+
+	// Buffered parents may be deleted, so the whole model is reported instead
+	auto dropRanges = [this]() {
+		if ( transactionDepth > 0 ) {
+			changedRanges.clear();
+			changedParents.clear();
+			changedAll = true;
+		}
+	};
+
+	connect( this, &BaseModel::rowsAboutToBeRemoved, this, dropRanges );
+	connect( this, &BaseModel::modelAboutToBeReset, this, dropRanges );
+
+	// Recorded items are addressed by their rows, so the steps are cut at each structural change
+	connect( this, &BaseModel::rowsAboutToBeInserted, this, [this]() {
+		if ( recording && !recordingFailed ) {
+			recordValuesStep();
+			recordInsertedRows();
+		}
+	} );
+	connect( this, &BaseModel::rowsInserted, this, [this]( const QModelIndex & parent, int first, int last ) {
+		if ( recording && !recordingFailed )
+			recordRowsStep( RecordedStep::InsertRows, parent, first, last );
+	} );
+	connect( this, &BaseModel::rowsAboutToBeRemoved, this, [this]( const QModelIndex & parent, int first, int last ) {
+		if ( recording && !recordingFailed ) {
+			recordValuesStep();
+			recordInsertedRows();
+			recordRowsStep( RecordedStep::RemoveRows, parent, first, last );
+		}
+	} );
+
+	auto dropRecording = [this]() {
+		if ( recording && !recordingFailed )
+			failRecording();
+	};
+
+	connect( this, &BaseModel::rowsAboutToBeMoved, this, dropRecording );
+	connect( this, &BaseModel::modelAboutToBeReset, this, dropRecording );
 }
 
 BaseModel::~BaseModel()
@@ -104,6 +397,383 @@ void BaseModel::endRemoveRows()
 	restoreState();
 }
 
+void BaseModel::beginTransaction()
+{
+	transactionDepth++;
+}
+
+void BaseModel::endTransaction()
+{
+	if ( transactionDepth <= 0 || --transactionDepth > 0 )
+		return;
+
+	if ( changedAll ) {
+		changedAll = false;
+
+		int rows = root->childCount();
+		if ( rows > 0 )
+			emit dataChanged( index( 0, 0 ), index( rows - 1, columnCount() - 1 ) );
+
+		return;
+	}
+
+	// Take the ranges first, receivers may start a new transaction
+	const auto ranges = changedRanges;
+	const auto parents = changedParents;
+	changedRanges.clear();
+	changedParents.clear();
+
+	for ( NifItem * parent : parents ) {
+		ChangedRange r = ranges.value( parent );
+
+		int last = std::min( r.lastRow, parent->childCount() - 1 );
+		if ( r.firstRow > last )
+			continue;
+
+		emit dataChanged( createIndex( r.firstRow, r.firstColumn, parent->child( r.firstRow ) ),
+		                  createIndex( last, r.lastColumn, parent->child( last ) ) );
+	}
+}
+
+void BaseModel::notifyChanged( const QModelIndex & topLeft, const QModelIndex & bottomRight )
+{
+	if ( transactionDepth == 0 ) {
+		emit dataChanged( topLeft, bottomRight );
+		return;
+	}
+
+	NifItem * item = static_cast<NifItem *>( topLeft.internalPointer() );
+	NifItem * parent = item ? item->parent() : nullptr;
+
+	if ( changedAll || !parent || topLeft.parent() != bottomRight.parent() ) {
+		changedAll = true;
+		return;
+	}
+
+	auto it = changedRanges.find( parent );
+	if ( it == changedRanges.end() ) {
+		changedRanges.insert( parent, { topLeft.row(), bottomRight.row(), topLeft.column(), bottomRight.column() } );
+		changedParents.append( parent );
+		return;
+	}
+
+	ChangedRange & r = it.value();
+	r.firstRow = std::min( r.firstRow, topLeft.row() );
+	r.lastRow = std::max( r.lastRow, bottomRight.row() );
+	r.firstColumn = std::min( r.firstColumn, topLeft.column() );
+	r.lastColumn = std::max( r.lastColumn, bottomRight.column() );
+}
+
+void BaseModel::beginRecording()
+{
+	recording = true;
+	recordingFailed = false;
+	recordedBytes = 0;
+	recordedSteps.clear();
+	insertedParent = nullptr;
+	recordedRows.clear();
+	recordedItems.clear();
+	recordedOld.clear();
+}
+
+void BaseModel::failRecording()
+{
+	recordingFailed = true;
+	recordedBytes = 0;
+	recordedSteps.clear();
+	insertedParent = nullptr;
+	recordedRows.clear();
+	recordedItems.clear();
+	recordedOld.clear();
+}
+
+bool BaseModel::addRecordedBytes( qint64 size )
+{
+	recordedBytes += size;
+	if ( recordedBytes > UNDO_RECORDING_LIMIT ) {
+		failRecording();
+		return false;
+	}
+
+	return true;
+}
+
+//! The approximate size of a value, to keep recordings below UNDO_RECORDING_LIMIT
+static qint64 recordedSize( const NifValue & v )
+{
+	qint64 size = sizeof( NifValue );
+	if ( v.isString() )
+		size += v.get<QString>().size() * sizeof( QChar );
+	else if ( v.isByteArray() ) {
+		auto bytes = v.get<QByteArray *>();
+		if ( bytes )
+			size += bytes->size();
+	}
+
+	return size;
+}
+
+//! The rows leading from \a root to \a item
+static QVector<int> recordedPath( NifItem * root, NifItem * item )
+{
+	QVector<int> path;
+	for ( NifItem * p = item; p && p != root; p = p->parent() )
+		path.prepend( p->row() );
+
+	return path;
+}
+
+//! The item at \a path below \a root, nullptr if there is none
+static NifItem * recordedItem( NifItem * root, const QVector<int> & path )
+{
+	NifItem * item = root;
+	for ( int row : path ) {
+		item = item->child( row );
+		if ( !item )
+			break;
+	}
+
+	return item;
+}
+
+void BaseModel::storeValue( NifItem * item )
+{
+	if ( recordingFailed || !item || recordedRows.contains( item ) )
+		return;
+
+	const NifValue & v = item->value();
+
+	// The old value, and the new one once it is packed
+	if ( !addRecordedBytes( recordedSize( v ) * 2 + sizeof( NifItem * ) * 2 + sizeof( int ) * 2 ) )
+		return;
+
+	recordedRows.insert( item, recordedItems.count() );
+	recordedItems.append( item );
+	recordedOld.append( v );
+}
+
+void BaseModel::recordValuesStep()
+{
+	if ( recordedItems.isEmpty() )
+		return;
+
+	// Group the edited items by parent so each path is stored once
+	QVector<NifItem *> parents;
+	QHash<NifItem *, QVector<int>> edited;
+
+	for ( int i = 0; i < recordedItems.count(); i++ ) {
+		NifItem * item = recordedItems.at( i );
+		if ( recordedOld.at( i ) == item->value() )
+			continue;
+
+		auto it = edited.find( item->parent() );
+		if ( it == edited.end() ) {
+			parents.append( item->parent() );
+			it = edited.insert( item->parent(), QVector<int>() );
+		}
+
+		it.value().append( i );
+	}
+
+	if ( !parents.isEmpty() ) {
+		RecordedStep step;
+		QDataStream out( &step.values, QIODevice::WriteOnly );
+
+		for ( NifItem * parent : parents ) {
+			const QVector<int> & items = edited[parent];
+
+			out << recordedPath( root, parent ) << quint32( items.count() );
+			for ( int i : items ) {
+				out << qint32( recordedItems.at( i )->row() );
+				recordedOld.at( i ).saveTo( out );
+				recordedItems.at( i )->value().saveTo( out );
+			}
+		}
+
+		recordedSteps.append( step );
+	}
+
+	recordedRows.clear();
+	recordedItems.clear();
+	recordedOld.clear();
+}
+
+void BaseModel::recordInsertedRows()
+{
+	if ( !insertedParent )
+		return;
+
+	RecordedStep & step = recordedSteps[insertedStep];
+	qint64 items = 0, values = 0;
+	int count = 0;
+
+	for ( int r = step.first; r < step.first + insertedCount; r++ ) {
+		if ( const NifItem * item = insertedParent->child( r ) ) {
+			item->memoryUsage( items, values, count );
+			step.items.append( std::shared_ptr<const NifItem>( item->clone( nullptr ) ) );
+		}
+	}
+
+	insertedParent = nullptr;
+	addRecordedBytes( items + values );
+}
+
+void BaseModel::recordRowsStep( RecordedStep::Kind kind, const QModelIndex & parent, int first, int last )
+{
+	NifItem * item = static_cast<NifItem *>( parent.internalPointer() );
+	if ( !( parent.isValid() && item && parent.model() == this ) )
+		item = root;
+
+	RecordedStep step;
+	step.kind = kind;
+	step.path = recordedPath( root, item );
+	step.first = first;
+
+	if ( kind == RecordedStep::RemoveRows ) {
+		qint64 items = 0, values = 0;
+		int count = 0;
+
+		for ( int r = first; r <= last; r++ ) {
+			if ( const NifItem * child = item->child( r ) ) {
+				child->memoryUsage( items, values, count );
+				step.items.append( std::shared_ptr<const NifItem>( child->clone( nullptr ) ) );
+			}
+		}
+
+		recordedSteps.append( step );
+		addRecordedBytes( items + values );
+		return;
+	}
+
+	// The inserted rows are usually filled in without signals, they are copied before the next step
+	insertedStep = recordedSteps.count();
+	recordedSteps.append( step );
+	insertedParent = item;
+	insertedCount = last - first + 1;
+}
+
+bool BaseModel::endRecording( QVector<RecordedStep> & steps )
+{
+	if ( recording && !recordingFailed ) {
+		recordValuesStep();
+		recordInsertedRows();
+	}
+
+	recording = false;
+	steps.clear();
+
+	if ( recordingFailed ) {
+		recordingFailed = false;
+		return false;
+	}
+
+	steps = recordedSteps;
+	recordedSteps.clear();
+	recordedBytes = 0;
+
+	return true;
+}
+
+QVector<NifItem *> BaseModel::restoreRecording( const QVector<RecordedStep> & steps, bool useOld )
+{
+	QVector<NifItem *> touched;
+	auto touch = [this, &touched]( NifItem * item ) {
+		while ( item && item->parent() && item->parent() != root )
+			item = item->parent();
+		if ( item && item != root && !touched.contains( item ) )
+			touched.append( item );
+	};
+
+	beginTransaction();
+
+	// Insert the copies of the rows, or remove the rows
+	auto insertRows = [this, &touch]( const RecordedStep & step ) {
+		NifItem * parent = recordedItem( root, step.path );
+		if ( !parent || step.items.isEmpty() )
+			return;
+
+		QModelIndex index = ( parent == root ) ? QModelIndex() : createIndex( parent->row(), 0, parent );
+
+		beginInsertRows( index, step.first, step.first + step.items.count() - 1 );
+		for ( int i = 0; i < step.items.count(); i++ )
+			parent->insertClone( step.items.at( i ).get(), step.first + i );
+		endInsertRows();
+
+		touch( parent );
+	};
+	auto removeRows = [this, &touch, &touched]( const RecordedStep & step ) {
+		NifItem * parent = recordedItem( root, step.path );
+		int count = step.items.count();
+		if ( !parent || count == 0 || step.first + count > parent->childCount() )
+			return;
+
+		QModelIndex index = ( parent == root ) ? QModelIndex() : createIndex( parent->row(), 0, parent );
+
+		if ( parent == root ) {
+			for ( int r = step.first; r < step.first + count; r++ )
+				touched.removeOne( root->child( r ) );
+		}
+
+		beginRemoveRows( index, step.first, step.first + count - 1 );
+		parent->removeChildren( step.first, count );
+		endRemoveRows();
+
+		touch( parent );
+	};
+	auto setValues = [this, &touch, useOld]( const RecordedStep & step ) {
+		QDataStream in( step.values );
+
+		while ( !in.atEnd() && in.status() == QDataStream::Ok ) {
+			QVector<int> path;
+			quint32 count = 0;
+			in >> path >> count;
+
+			NifItem * parent = recordedItem( root, path );
+
+			for ( quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++ ) {
+				qint32 row = 0;
+				NifValue oldValue, newValue;
+				in >> row;
+				oldValue.loadFrom( in );
+				newValue.loadFrom( in );
+
+				NifItem * item = parent ? parent->child( row ) : nullptr;
+				if ( item ) {
+					setItemValue( item, useOld ? oldValue : newValue );
+					touch( item );
+				}
+			}
+		}
+	};
+
+	// Each step is undone on the tree as it was left by that step
+	for ( int s = 0; s < steps.count(); s++ ) {
+		const RecordedStep & step = steps.at( useOld ? steps.count() - 1 - s : s );
+
+		switch ( step.kind ) {
+		case RecordedStep::Values:
+			setValues( step );
+			break;
+		case RecordedStep::InsertRows:
+			if ( useOld )
+				removeRows( step );
+			else
+				insertRows( step );
+			break;
+		case RecordedStep::RemoveRows:
+			if ( useOld )
+				insertRows( step );
+			else
+				removeRows( step );
+			break;
+		}
+	}
+
+	endTransaction();
+
+	return touched;
+}
+
 bool BaseModel::getProcessingResult()
 {
 	bool result = changedWhileProcessing;
@@ -512,6 +1182,7 @@ bool BaseModel::setData( const QModelIndex & index, const QVariant & value, int
 		item->setType( value.toString() );
 		break;
 	case BaseModel::ValueCol:
+		recordValue( item );
 		item->value().setFromVariant( value );
 		break;
 	case BaseModel::ArgCol:
@@ -540,7 +1211,7 @@ bool BaseModel::setData( const QModelIndex & index, const QVariant & value, int
 	}
 
 	if ( state == Default )
-		emit dataChanged( index, index );
+		notifyChanged( index, index );
 
 	return true;
 }
@@ -629,7 +1300,31 @@ bool BaseModel::loadFromFile( const QString & file )
 
 	setState( Loading );
 
-	if ( f.exists() && finfo.isFile() && f.open( QIODevice::ReadOnly ) && load( f ) ) {
+	bool loaded = false;
+
+	if ( f.exists() && finfo.isFile() && loadCached( finfo ) ) {
+		loaded = true;
+	} else if ( f.exists() && finfo.isFile() && f.open( QIODevice::ReadOnly ) ) {
+		// Read from a mapping of the file where possible so the streams can copy values directly
+		uchar * mapped = ( f.size() > 0 && f.size() < INT_MAX ) ? f.map( 0, f.size() ) : nullptr;
+
+		if ( mapped ) {
+			QByteArray data = QByteArray::fromRawData( reinterpret_cast<const char *>( mapped ), int( f.size() ) );
+			QBuffer buffer( &data );
+
+			loaded = buffer.open( QIODevice::ReadOnly ) && load( buffer );
+
+			buffer.close();
+			f.unmap( mapped );
+		} else {
+			loaded = load( f );
+		}
+
+		if ( loaded )
+			saveCached( finfo );
+	}
+
+	if ( loaded ) {
 		fileinfo = finfo;
 		filename = finfo.baseName();
 		folder = finfo.absolutePath();
@@ -643,8 +1338,9 @@ bool BaseModel::loadFromFile( const QString & file )
 
 bool BaseModel::saveToFile( const QString & filename ) const
 {
-	QFile f( filename );
-	return f.open( QIODevice::WriteOnly ) && save( f );
+	// Written next to the file, synced and renamed over it, so that a failed save keeps the old file
+	QSaveFile f( filename );
+	return f.open( QIODevice::WriteOnly ) && save( f ) && f.commit();
 }
 
 void BaseModel::refreshFileInfo( const QString & f )
@@ -764,7 +1460,7 @@ bool BaseModel::evalCondition( NifItem * item, bool chkParents ) const
 
 
 
-	QString cond = item->cond();
+	const QString & cond = item->cond();
 
 	if ( cond.isEmpty() )
 		return true;
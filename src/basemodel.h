@@ -39,12 +39,15 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <QAbstractItemModel> // Inherited
 #include <QFileInfo>
+#include <QHash>
 #include <QIODevice>
 #include <QStack>
 #include <QString>
 #include <QVariant>
 #include <QVector>
 
+#include <memory>
+
 
 //! @file basemodel.h BaseModel, BaseModelEval
 
@@ -101,9 +104,22 @@ public:
 	//! Write a QVector to a model index array by name.
 	template <typename T> void setArray( const QModelIndex & iArray, const QString & name, const QVector<T> & array );
 
+	//! Get the field at \a row of each compound of a model index array as a QVector.
+	template <typename T> QVector<T> getFieldArray( const QModelIndex & iArray, int row ) const;
+	/*! Write a QVector to the field at \a row of each compound of a model index array.
+	 *
+	 * Such as a channel of the vertices of a BSTriShape. One change is reported for
+	 * the compounds rather than one per field.
+	 */
+	template <typename T> void setFieldArray( const QModelIndex & iArray, int row, const QVector<T> & array );
+
 	//! Load from file.
 	bool loadFromFile( const QString & filename );
-	//! Save to file.
+	//! Restore the contents of \a file from a cache instead of reading it, see loadFromFile()
+	virtual bool loadCached( const QFileInfo & file ) { Q_UNUSED( file ); return false; }
+	//! Store the contents just read from \a file in the cache, see loadFromFile()
+	virtual void saveCached( const QFileInfo & file ) const { Q_UNUSED( file ); }
+	//! Save to file, replacing it only once it is written completely.
 	bool saveToFile( const QString & filename ) const;
 
 	/*! If the model was loaded from a file then getFolder returns the folder.
@@ -223,6 +239,42 @@ public:
 	//! Were there updates while batch processing (also clears the result)
 	bool getProcessingResult();
 
+	//! Buffer the change notifications until the matching endTransaction(); transactions may be nested
+	void beginTransaction();
+	//! Emit one merged dataChanged() per modified parent once the outermost transaction ends
+	void endTransaction();
+
+	//! One step of the edits recorded while a spell was cast
+	struct RecordedStep
+	{
+		enum Kind
+		{
+			Values,      //!< Items were edited
+			InsertRows,  //!< Rows were inserted
+			RemoveRows   //!< Rows were removed
+		};
+
+		Kind kind = Values;
+		//! Rows leading from the root to the parent of the inserted or removed rows
+		QVector<int> path;
+		//! The first inserted or removed row
+		int first = 0;
+		//! Copies of the inserted rows as they were filled in, or of the removed rows
+		QVector<std::shared_ptr<const NifItem>> items;
+		//! The edited items, packed as the path of each parent followed by the row, old and new value of its items
+		QByteArray values;
+	};
+
+	//! Start recording the edits made until endRecording()
+	void beginRecording();
+	//! Stop recording; returns false if the model was reset, rows were moved or the memory limit was hit
+	bool endRecording( QVector<RecordedStep> & steps );
+	//! Undo the recorded steps in reverse if \a useOld, otherwise redo them in order
+	/*!
+	 * \return	The root rows below which items were edited or rows inserted or removed
+	 */
+	QVector<NifItem *> restoreRecording( const QVector<RecordedStep> & steps, bool useOld );
+
 	//! Get Messages collected
 	QList<TestMessage> getMessages() const { QList<TestMessage> lst = messages; messages.clear(); return lst; }
 
@@ -380,6 +432,61 @@ protected:
 
 	//! Has any data changed while processing
 	bool changedWhileProcessing = false;
+
+	//! Emit dataChanged(), or merge it into the open transaction
+	void notifyChanged( const QModelIndex & topLeft, const QModelIndex & bottomRight );
+
+	//! The rows and columns modified below one parent during a transaction
+	struct ChangedRange
+	{
+		int firstRow;
+		int lastRow;
+		int firstColumn;
+		int lastColumn;
+	};
+
+	//! Number of open transactions
+	int transactionDepth = 0;
+	//! Modified ranges by parent item
+	QHash<NifItem *, ChangedRange> changedRanges;
+	//! Modified parent items in the order they were first modified
+	QVector<NifItem *> changedParents;
+	//! Whether the buffered ranges were lost and the whole model has to be reported
+	bool changedAll = false;
+
+	//! Remember the value of an item before it is first edited while recording
+	void recordValue( NifItem * item ) { if ( recording ) storeValue( item ); }
+	void storeValue( NifItem * item );
+	//! Add the bytes of a step to the recording, giving up on it past UNDO_RECORDING_LIMIT
+	bool addRecordedBytes( qint64 size );
+	//! Pack the values edited since the last step into a step of their own
+	void recordValuesStep();
+	//! Copy the rows of the last InsertRows step, which were filled in after they were inserted
+	void recordInsertedRows();
+	//! Record the structural change about to be made, see RecordedStep
+	void recordRowsStep( RecordedStep::Kind kind, const QModelIndex & parent, int first, int last );
+	//! Drop the recording, the edits since beginRecording() cannot be undone
+	void failRecording();
+
+	//! Whether edits are being recorded
+	bool recording = false;
+	//! Whether the recorded items are no longer valid
+	bool recordingFailed = false;
+	//! Approximate size of the recorded steps in bytes
+	qint64 recordedBytes = 0;
+	//! The steps recorded so far
+	QVector<RecordedStep> recordedSteps;
+	//! The parent of the rows of the last InsertRows step, until recordInsertedRows() copied them
+	NifItem * insertedParent = nullptr;
+	//! The last InsertRows step in recordedSteps, and the number of its rows
+	int insertedStep = 0;
+	int insertedCount = 0;
+	//! Row in recordedItems by edited item, for the values edited since the last step
+	QHash<NifItem *, int> recordedRows;
+	//! Items edited since the last step, in the order they were first edited
+	QVector<NifItem *> recordedItems;
+	//! Their values before they were first edited
+	QVector<NifValue> recordedOld;
 };
 
 
@@ -468,9 +575,11 @@ template <typename T> inline T BaseModel::get( const QModelIndex & index ) const
 
 template <typename T> inline bool BaseModel::set( NifItem * item, const T & d )
 {
+	recordValue( item );
+
 	if ( item->value().set( d ) ) {
 		if ( state != Processing )
-			emit dataChanged( createIndex( item->row(), ValueCol, item ), createIndex( item->row(), ValueCol, item ) );
+			notifyChanged( createIndex( item->row(), ValueCol, item ), createIndex( item->row(), ValueCol, item ) );
 		else
 			changedWhileProcessing = true;
 
@@ -510,11 +619,14 @@ template <typename T> inline void BaseModel::setArray( const QModelIndex & iArra
 	NifItem * item = static_cast<NifItem *>( iArray.internalPointer() );
 
 	if ( isArray( iArray ) && item && iArray.model() == this ) {
+		for ( int c = 0; recording && c < item->childCount(); c++ )
+			recordValue( item->child( c ) );
+
 		item->setArray<T>( array );
 		int x = item->childCount() - 1;
 
 		if ( x >= 0 )
-			emit dataChanged( createIndex( 0, ValueCol, item->child( 0 ) ), createIndex( x, ValueCol, item->child( x ) ) );
+			notifyChanged( createIndex( 0, ValueCol, item->child( 0 ) ), createIndex( x, ValueCol, item->child( x ) ) );
 	}
 }
 
@@ -523,11 +635,14 @@ template <typename T> inline void BaseModel::setArray( const QModelIndex & iArra
 	NifItem * item = static_cast<NifItem *>(iArray.internalPointer());
 
 	if ( isArray( iArray ) && item && iArray.model() == this ) {
+		for ( int c = 0; recording && c < item->childCount(); c++ )
+			recordValue( item->child( c ) );
+
 		item->setArray<T>( val );
 		int x = item->childCount() - 1;
 
 		if ( x >= 0 )
-			emit dataChanged( createIndex( 0, ValueCol, item->child( 0 ) ), createIndex( x, ValueCol, item->child( x ) ) );
+			notifyChanged( createIndex( 0, ValueCol, item->child( 0 ) ), createIndex( x, ValueCol, item->child( x ) ) );
 	}
 }
 
@@ -536,4 +651,32 @@ template <typename T> inline void BaseModel::setArray( const QModelIndex & iPare
 	setArray<T>( getIndex( iParent, name ), array );
 }
 
+template <typename T> inline QVector<T> BaseModel::getFieldArray( const QModelIndex & iArray, int row ) const
+{
+	NifItem * item = static_cast<NifItem *>( iArray.internalPointer() );
+
+	if ( isArray( iArray ) && item && iArray.model() == this && row >= 0 )
+		return item->getFieldArray<T>( row );
+
+	return QVector<T>();
+}
+
+template <typename T> inline void BaseModel::setFieldArray( const QModelIndex & iArray, int row, const QVector<T> & array )
+{
+	NifItem * item = static_cast<NifItem *>( iArray.internalPointer() );
+
+	if ( isArray( iArray ) && item && iArray.model() == this && row >= 0 ) {
+		for ( int c = 0; recording && c < item->childCount(); c++ ) {
+			if ( NifItem * field = item->child( c )->child( row ) )
+				recordValue( field );
+		}
+
+		item->setFieldArray<T>( row, array );
+		int x = item->childCount() - 1;
+
+		if ( x >= 0 )
+			notifyChanged( createIndex( 0, ValueCol, item->child( 0 ) ), createIndex( x, ValueCol, item->child( x ) ) );
+	}
+}
+
 #endif
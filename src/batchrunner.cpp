@@ -0,0 +1,283 @@
+/***** BEGIN LICENSE BLOCK *****
+
+BSD License
+
+Copyright (c) 2005-2015, NIF File Format Library and Tools
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the NIF File Format Library and Tools project may not be
+   used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+***** END LICENCE BLOCK *****/
+
+#include "batchrunner.h"
+
+#include "nifmodel.h"
+
+#include <fsengine/fsengine.h>
+
+#include <QBuffer>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QThread>
+
+
+//! \file batchrunner.cpp FileQueue and BatchRunner implementation
+
+/*
+ *  File Queue
+ */
+
+QQueue<QString> FileQueue::make( const QString & dname, const QStringList & extensions, bool recursive )
+{
+	QQueue<QString> queue;
+
+	QDir dir( dname );
+
+	if ( recursive ) {
+		dir.setFilter( QDir::Dirs );
+		for ( const QString& d : dir.entryList() ) {
+			if ( d != "." && d != ".." )
+				queue += make( dir.filePath( d ), extensions, true );
+		}
+	}
+
+	dir.setFilter( QDir::Files );
+	dir.setNameFilters( extensions );
+	for ( const QString& f : dir.entryList() ) {
+		queue.enqueue( dir.filePath( f ) );
+	}
+
+	return queue;
+}
+
+void FileQueue::init( const QString & dname, const QStringList & extensions, bool recursive )
+{
+	QQueue<QString> queue = make( dname, extensions, recursive );
+
+	mutex.lock();
+	this->queue = queue;
+	queued = queue.count();
+	streaming = false;
+	mutex.unlock();
+}
+
+void FileQueue::init( const QStringList & files )
+{
+	QMutexLocker lock( &mutex );
+	queue = QQueue<QString>();
+	queue.append( files );
+	queued = files.count();
+	streaming = false;
+}
+
+void FileQueue::begin()
+{
+	QMutexLocker lock( &mutex );
+	queue.clear();
+	queued = 0;
+	streaming = true;
+}
+
+void FileQueue::append( const QStringList & files )
+{
+	if ( files.isEmpty() )
+		return;
+
+	QMutexLocker lock( &mutex );
+
+	// Files found after clear() are dropped
+	if ( !streaming )
+		return;
+
+	queue.append( files );
+	queued += files.count();
+	added.wakeAll();
+}
+
+void FileQueue::end()
+{
+	QMutexLocker lock( &mutex );
+	streaming = false;
+	added.wakeAll();
+}
+
+QString FileQueue::dequeue()
+{
+	QMutexLocker lock( &mutex );
+
+	while ( queue.isEmpty() && streaming && !QThread::currentThread()->isInterruptionRequested() )
+		added.wait( &mutex );
+
+	if ( queue.isEmpty() )
+		return QString();
+
+	return queue.dequeue();
+}
+
+void FileQueue::wake()
+{
+	QMutexLocker lock( &mutex );
+	added.wakeAll();
+}
+
+int FileQueue::total()
+{
+	QMutexLocker lock( &mutex );
+	return queued;
+}
+
+int FileQueue::count()
+{
+	QMutexLocker lock( &mutex );
+	return queue.count();
+}
+
+void FileQueue::clear()
+{
+	QMutexLocker lock( &mutex );
+	queue.clear();
+	streaming = false;
+	added.wakeAll();
+}
+
+/*
+ *  Batch Runner
+ */
+
+//! Takes files from the queue until it is empty
+class BatchRunner::WorkerThread final : public QThread
+{
+public:
+	WorkerThread( FileQueue * q, const FileFunction & p, const SetupFunction & s )
+		: queue( q ), process( p ), setup( s ) {}
+
+protected:
+	void run() override final
+	{
+		NifModel nif;
+
+		if ( setup )
+			setup( nif );
+
+		for ( QString file = queue->dequeue(); !file.isEmpty(); file = queue->dequeue() )
+			process( nif, file );
+	}
+
+	FileQueue * queue;
+	const FileFunction & process;
+	const SetupFunction & setup;
+};
+
+BatchRunner::BatchRunner() : numThreads( QThread::idealThreadCount() )
+{
+}
+
+BatchRunner::~BatchRunner()
+{
+}
+
+bool BatchRunner::open( const QString & input, const QStringList & extensions, bool recursive )
+{
+	QFileInfo info( input );
+	archive.reset();
+
+	if ( info.isDir() ) {
+		root = info.absoluteFilePath();
+		queue.init( root, extensions, recursive );
+		return true;
+	}
+
+	if ( info.isFile() && QDir::match( extensions, info.fileName() ) ) {
+		root = info.absolutePath();
+		queue.init( QStringList{ info.absoluteFilePath() } );
+		return true;
+	}
+
+	root = info.absoluteFilePath();
+	archive = FSArchiveHandler::openArchive( root );
+
+	if ( !archive )
+		return false;
+
+	QStringList files;
+
+	for ( const QString & ext : extensions )
+		files += archive->getArchive()->matchFiles( ext );
+
+	queue.init( files );
+
+	return true;
+}
+
+void BatchRunner::close()
+{
+	queue.clear();
+	archive.reset();
+}
+
+QString BatchRunner::filePath( const QString & file ) const
+{
+	return archive ? QDir( root ).filePath( file ) : file;
+}
+
+bool BatchRunner::read( const QString & file, QByteArray & data ) const
+{
+	if ( archive )
+		return archive->getArchive()->fileContents( file, data );
+
+	QFile f( file );
+
+	if ( !f.open( QIODevice::ReadOnly ) )
+		return false;
+
+	data = f.readAll();
+	return true;
+}
+
+bool BatchRunner::load( NifModel & nif, const QString & file ) const
+{
+	if ( !archive )
+		return nif.loadFromFile( file );
+
+	QByteArray data;
+	QBuffer buffer( &data );
+
+	return read( file, data ) && buffer.open( QIODevice::ReadOnly ) && nif.load( buffer );
+}
+
+void BatchRunner::run( const FileFunction & process, const SetupFunction & setup )
+{
+	QList<WorkerThread *> threads;
+
+	for ( int t = 0; t < numThreads; t++ ) {
+		threads << new WorkerThread( &queue, process, setup );
+		threads.last()->start();
+	}
+
+	for ( WorkerThread * thread : threads ) {
+		thread->wait();
+		delete thread;
+	}
+}
@@ -0,0 +1,161 @@
+/***** BEGIN LICENSE BLOCK *****
+
+BSD License
+
+Copyright (c) 2005-2015, NIF File Format Library and Tools
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the NIF File Format Library and Tools project may not be
+   used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+***** END LICENCE BLOCK *****/
+
+#ifndef BATCHRUNNER_H
+#define BATCHRUNNER_H
+
+#include <QMutex>
+#include <QQueue>
+#include <QString>
+#include <QStringList>
+#include <QWaitCondition>
+
+#include <functional>
+#include <memory>
+
+
+//! \file batchrunner.h FileQueue, BatchRunner
+
+class FSArchiveHandler;
+class NifModel;
+class QByteArray;
+
+//! The files a batch of threads takes one at a time
+class FileQueue final
+{
+public:
+	FileQueue() {}
+
+	QString dequeue();
+
+	bool isEmpty() { return count() == 0; }
+	int count();
+
+	void init( const QString & directory, const QStringList & extensions, bool recursive );
+	//! Queue files that are not found in a directory, such as the files of an archive
+	void init( const QStringList & files );
+	//! Remove the files, and stop waiting for those still being found
+	void clear();
+
+	//! Start queueing files while they are found; until end(), dequeue() waits for more files
+	void begin();
+	//! Queue files found since begin()
+	void append( const QStringList & files );
+	//! All files have been found
+	void end();
+
+	//! Wake the threads waiting in dequeue(), so that those interrupted return
+	void wake();
+
+	//! The number of files queued since the last init() or begin()
+	int total();
+
+protected:
+	QQueue<QString> make( const QString & directory, const QStringList & extensions, bool recursive );
+
+	QMutex mutex;
+	QQueue<QString> queue;
+
+	//! Whether more files are still being found, see begin()
+	bool streaming = false;
+	QWaitCondition added;
+	int queued = 0;
+};
+
+//! Processes the files of a directory, an archive or a single file on worker threads
+/*!
+ * The command line tools share the queueing and the threads: open() queues
+ * the files, then run() starts the threads, each of which takes one file at a
+ * time from the queue and passes it to the function of the tool, together
+ * with a NifModel owned by the thread.
+ *
+ * \code
+ * BatchRunner runner;
+ * if ( runner.open( input, { "*.nif" }, true ) ) {
+ *     runner.run( [&runner]( NifModel & nif, const QString & file ) {
+ *         if ( runner.load( nif, file ) )
+ *             ...
+ *     } );
+ * }
+ * \endcode
+ */
+class BatchRunner final
+{
+public:
+	//! Called on a worker thread for each file it takes
+	typedef std::function<void( NifModel &, const QString & )> FileFunction;
+	//! Called on a worker thread once, before it takes the first file
+	typedef std::function<void( NifModel & )> SetupFunction;
+
+	BatchRunner();
+	~BatchRunner();
+
+	//! Set the number of worker threads, QThread::idealThreadCount() by default
+	void setThreads( int num ) { numThreads = qMax( 1, num ); }
+
+	//! Queue the files matching \a extensions below a directory, in an archive, or a single file
+	/*!
+	 * \param input		A directory, an archive or a file matching \a extensions
+	 * \param recursive	Whether to include the sub directories of a directory
+	 * \return			False if the input is none of them
+	 */
+	bool open( const QString & input, const QStringList & extensions, bool recursive );
+	//! Release the archive
+	void close();
+
+	//! The directory the files are below, the archive, or the folder of the single file
+	QString getRoot() const { return root; }
+	//! The opened archive, whose files are queued by their path in the archive
+	const std::shared_ptr<FSArchiveHandler> & getArchive() const { return archive; }
+	//! The path of a queued file, prefixed with the archive for the files of an archive
+	QString filePath( const QString & file ) const;
+
+	//! Read a queued file from the disk or the archive
+	bool read( const QString & file, QByteArray & data ) const;
+	//! Load a queued file from the disk or the archive
+	bool load( NifModel & nif, const QString & file ) const;
+
+	//! Pass every queued file to \a process, returning once all threads are done
+	void run( const FileFunction & process, const SetupFunction & setup = SetupFunction() );
+
+protected:
+	class WorkerThread;
+
+	int numThreads;
+
+	QString root;
+	std::shared_ptr<FSArchiveHandler> archive;
+
+	FileQueue queue;
+};
+
+#endif
@@ -0,0 +1,203 @@
+/***** BEGIN LICENSE BLOCK *****
+
+BSD License
+
+Copyright (c) 2005-2015, NIF File Format Library and Tools
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the NIF File Format Library and Tools project may not be
+   used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+***** END LICENCE BLOCK *****/
+
+#include "convertbatch.h"
+
+#include "nifmodel.h"
+
+#include <QBuffer>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+
+
+//! \file convertbatch.cpp ConvertBatch implementation
+
+// The exporters and importers of the Import and Export menus, see importex.cpp
+bool exportObj( const NifModel * nif, const QModelIndex & index, QString fname );
+bool exportCol( const NifModel * nif, QString fname );
+bool exportGltf( const NifModel * nif, const QModelIndex & index, QString fname );
+bool importObj( NifModel * nif, const QModelIndex & index, const QString & fname );
+bool import3ds( NifModel * nif, const QModelIndex & index, const QString & fname );
+
+const QStringList ConvertBatch::exportFormats{ "obj", "dae", "glb" };
+const QStringList ConvertBatch::importFormats{ "obj", "3ds" };
+
+ConvertBatch::ConvertBatch()
+{
+}
+
+ConvertBatch::~ConvertBatch()
+{
+}
+
+bool ConvertBatch::setExport( const QString & fmt )
+{
+	format = fmt.toLower();
+	importing = false;
+
+	return exportFormats.contains( format );
+}
+
+bool ConvertBatch::setImport( const QString & fmt )
+{
+	format = fmt.toLower();
+	importing = true;
+
+	return importFormats.contains( format );
+}
+
+bool ConvertBatch::setTemplate( const QString & file )
+{
+	QFile f( file );
+
+	if ( !f.open( QIODevice::ReadOnly ) )
+		return false;
+
+	templateData = f.readAll();
+
+	// Check once that it loads, instead of failing every file
+	NifModel nif;
+	QBuffer buffer( &templateData );
+
+	return buffer.open( QIODevice::ReadOnly ) && nif.load( buffer );
+}
+
+bool ConvertBatch::run( const QString & input, bool recursive )
+{
+	QStringList extensions;
+
+	if ( importing )
+		extensions << "*." + format;
+	else
+		extensions << "*.nif";
+
+	if ( !runner.open( input, extensions, recursive ) )
+		return false;
+
+	// The importers read files from the disk, and nothing can be written next to the files of an archive
+	if ( runner.getArchive() && ( importing || output.isEmpty() ) ) {
+		runner.close();
+		return false;
+	}
+
+	runner.run( [this]( NifModel & nif, const QString & file ) {
+		QString error = process( nif, file );
+
+		if ( error.isEmpty() ) {
+			numSaved.ref();
+		} else {
+			numFailed.ref();
+			qCWarning( ns ) << file << ":" << error;
+		}
+	} );
+
+	runner.close();
+
+	return true;
+}
+
+QString ConvertBatch::process( NifModel & nif, const QString & file )
+{
+	// Files are written next to the input, or below the output folder mirroring the input
+	QString base = runner.getRoot();
+	QString relative = runner.getArchive() ? file : QDir( base ).relativeFilePath( file );
+	QFileInfo info( QDir( output.isEmpty() ? base : output ).filePath( relative ) );
+	QString target = info.dir().filePath( info.completeBaseName() + "." + ( importing ? QString( "nif" ) : format ) );
+
+	if ( !output.isEmpty() ) {
+		QMutexLocker lock( &dirMutex );
+
+		if ( !QDir().mkpath( info.absolutePath() ) )
+			return tr( "could not create the folder of %1" ).arg( target );
+	}
+
+	if ( importing ) {
+		if ( !importFile( nif, file ) )
+			return tr( "could not be imported" );
+
+		// Write a temporary file and replace the target once it is complete
+		QSaveFile f( target );
+
+		if ( !f.open( QIODevice::WriteOnly ) || !nif.save( f ) || !f.commit() )
+			return tr( "could not be saved to %1: %2" ).arg( target, f.errorString() );
+	} else {
+		if ( !runner.load( nif, file ) )
+			return tr( "could not be loaded" );
+
+		if ( !exportFile( nif, target ) )
+			return tr( "could not be exported to %1" ).arg( target );
+	}
+
+	return QString();
+}
+
+bool ConvertBatch::exportFile( NifModel & nif, const QString & target )
+{
+	if ( format == "obj" )
+		return exportObj( &nif, QModelIndex(), target );
+	else if ( format == "dae" )
+		return exportCol( &nif, target );
+	else if ( format == "glb" )
+		return exportGltf( &nif, QModelIndex(), target );
+
+	return false;
+}
+
+bool ConvertBatch::importFile( NifModel & nif, const QString & file )
+{
+	if ( templateData.isEmpty() ) {
+		nif.clear();
+	} else {
+		// A shallow copy, so that the threads do not share one buffer
+		QByteArray data = templateData;
+		QBuffer buffer( &data );
+
+		if ( !buffer.open( QIODevice::ReadOnly ) || !nif.load( buffer ) )
+			return false;
+	}
+
+	// The meshes are attached to the root node of a template, else to a new one
+	QModelIndex iRoot;
+	QList<int> roots = nif.getRootLinks();
+
+	if ( !roots.isEmpty() && nif.isNiBlock( nif.getBlock( roots.first() ), "NiNode" ) )
+		iRoot = nif.getBlock( roots.first() );
+
+	if ( format == "obj" )
+		return importObj( &nif, iRoot, file );
+	else if ( format == "3ds" )
+		return import3ds( &nif, iRoot, file );
+
+	return false;
+}
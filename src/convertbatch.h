@@ -0,0 +1,122 @@
+/***** BEGIN LICENSE BLOCK *****
+
+BSD License
+
+Copyright (c) 2005-2015, NIF File Format Library and Tools
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the NIF File Format Library and Tools project may not be
+   used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+***** END LICENCE BLOCK *****/
+
+#ifndef CONVERTBATCH_H
+#define CONVERTBATCH_H
+
+#include "batchrunner.h"
+
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QCoreApplication>
+#include <QMutex>
+#include <QStringList>
+
+
+//! \file convertbatch.h ConvertBatch
+
+class NifModel;
+
+//! Exports every NIF of a folder to another format, or imports every mesh of a folder into NIFs
+/*!
+ * Every worker thread loads, converts and saves one file at a time with its
+ * own NifModel, using the same exporters and importers as the Import and
+ * Export menus. The whole scene of a NIF is exported; the meshes of an
+ * imported file are added to the root of a new NIF.
+ *
+ * Used by <tt>NifSkope -no-gui --export ...</tt> and <tt>NifSkope -no-gui --import ...</tt>, see main().
+ */
+class ConvertBatch final
+{
+	Q_DECLARE_TR_FUNCTIONS( ConvertBatch )
+
+public:
+	//! The formats which can be exported
+	static const QStringList exportFormats;
+	//! The formats which can be imported
+	static const QStringList importFormats;
+
+	ConvertBatch();
+	~ConvertBatch();
+
+	//! Export the NIFs to one of exportFormats, returning false if the format is unknown
+	bool setExport( const QString & format );
+	//! Import the files of one of importFormats into NIFs, returning false if the format is unknown
+	bool setImport( const QString & format );
+	//! Add the imported meshes to a copy of this NIF instead of a new file, returning false if it cannot be read
+	bool setTemplate( const QString & file );
+	//! Write below \a directory, mirroring the input tree, instead of next to the input files
+	void setOutput( const QString & directory ) { output = directory; }
+	//! Set the number of worker threads
+	void setThreads( int num ) { runner.setThreads( num ); }
+
+	//! Convert the files below a directory, or a single file
+	/*!
+	 * The NIFs of an archive can be exported too, when there is an output folder.
+	 *
+	 * \param input		A directory, a file or an archive
+	 * \param recursive	Whether to include the sub directories of a directory
+	 * \return			False if the input could not be opened
+	 */
+	bool run( const QString & input, bool recursive );
+
+	//! The number of files which were written
+	int saved() const { return numSaved.load(); }
+	//! The number of files which could not be loaded, converted or written
+	int failed() const { return numFailed.load(); }
+
+protected:
+	//! Convert a file, returning an error or an empty string
+	QString process( NifModel & nif, const QString & file );
+	//! Export a NIF which has been loaded
+	bool exportFile( NifModel & nif, const QString & target );
+	//! Import a file into a new NIF
+	bool importFile( NifModel & nif, const QString & file );
+
+	//! The format to export to or import from, in lower case
+	QString format;
+	bool importing = false;
+
+	//! The contents of the template NIF, empty for a new file
+	QByteArray templateData;
+
+	QString output;
+
+	BatchRunner runner;
+	//! Serializes creating the directories of the mirror tree
+	QMutex dirMutex;
+
+	QAtomicInt numSaved;
+	QAtomicInt numFailed;
+};
+
+#endif
@@ -33,6 +33,7 @@ void BSShape::clear()
 void BSShape::update( const NifModel * nif, const QModelIndex & index )
 {
 	Node::update( nif, index );
+	updateProgramCache( nif, index );
 
 	if ( !iBlock.isValid() || !index.isValid() )
 		return;
@@ -43,7 +44,6 @@ void BSShape::update( const NifModel * nif, const QModelIndex & index )
 	nifVersion = nif->getUserVersion2();
 
 	auto vertexFlags = nif->get<quint16>( iBlock, "VF" );
-	bool isDynamic = nif->inherits( iBlock, "BSDynamicTriShape" );
 
 	bool isDataOnSkin = false;
 	bool isSkinned = vertexFlags & 0x400;
@@ -111,73 +111,124 @@ void BSShape::update( const NifModel * nif, const QModelIndex & index )
 		bsphereRadius = nif->get<float>( bsphere, "Radius" );
 	}
 
+	// Update shaders from this mesh's shader property
+	updateShaderProperties( nif );
+
+	if ( bssp )
+		isVertexAlphaAnimation = bssp->hasSF2( ShaderFlags::SLSF2_Tree_Anim );
+
 	if ( iBlock == index && dataSize > 0 ) {
-		verts.clear();
-		norms.clear();
-		tangents.clear();
-		bitangents.clear();
-		triangles.clear();
-		coords.clear();
-		colors.clear();
-
-		// For compatibility with coords QList
-		QVector<Vector2> coordset;
-
-		for ( int i = 0; i < numVerts; i++ ) {
-			auto idx = nif->index( i, 0, iVertData );
-
-			if ( !isDynamic )
-				verts << nif->get<Vector3>( idx, "Vertex" );
-
-			coordset << nif->get<HalfVector2>( idx, "UV" );
-
-			// Bitangent X
-			auto bitX = nif->getValue( nif->getIndex( idx, "Bitangent X" ) ).toFloat();
-			// Bitangent Y/Z
-			auto bitYi = nif->getValue( nif->getIndex( idx, "Bitangent Y" ) ).toCount();
-			auto bitZi = nif->getValue( nif->getIndex( idx, "Bitangent Z" ) ).toCount();
-			auto bitY = (double( bitYi ) / 255.0) * 2.0 - 1.0;
-			auto bitZ = (double( bitZi ) / 255.0) * 2.0 - 1.0;
-
-			norms += nif->get<ByteVector3>( idx, "Normal" );
-			tangents += nif->get<ByteVector3>( idx, "Tangent" );
-			bitangents += Vector3( bitX, bitY, bitZ );
-
-			auto vcIdx = nif->getIndex( idx, "Vertex Colors" );
-			if ( vcIdx.isValid() ) {
-				colors += nif->get<ByteColor4>( vcIdx );
-			}
-		}
+		readGeometry( nif );
+	} else if ( isVertexAlphaAnimation ) {
+		for ( int i = 0; i < colors.count(); i++ )
+			colors[i].setRGBA( colors[i].red(), colors[i].green(), colors[i].blue(), 1.0 );
+	}
+}
 
-		if ( isDynamic ) {
-			auto dynVerts = nif->getArray<Vector4>( iBlock, "Vertices" );
-			for ( const auto & v : dynVerts )
-				verts << Vector3( v );
-		}
+void BSShape::readGeometry( const NifModel * nif )
+{
+	pagedOut = false;
 
-		// Add coords as first set of QList
-		coords.append( coordset );
+	bool isDynamic = nif->inherits( iBlock, "BSDynamicTriShape" );
+	// Only geometry whose vertex data is on the NiSkinPartition has no triangles of its own, see update()
+	bool isDataOnSkin = !iTriData.isValid();
 
-		if ( !isDataOnSkin ) {
-			triangles = nif->getArray<Triangle>( iTriData );
-			triangles = triangles.mid( 0, numTris );
-		} else {
-			auto partIdx = nif->getIndex( iSkinPart, "Partition" );
-			for ( int i = 0; i < nif->rowCount( partIdx ); i++ )
-				triangles << nif->getArray<Triangle>( nif->index( i, 0, partIdx ), "Triangles" );
+	verts.clear();
+	norms.clear();
+	tangents.clear();
+	bitangents.clear();
+	triangles.clear();
+	coords.clear();
+	colors.clear();
+
+	// For compatibility with coords QList
+	QVector<Vector2> coordset;
+
+	// Every vertex has the layout given by the vertex flags, so the rows of the fields
+	//	are looked up once on the first vertex and reused for the others
+	static const NifFieldId fVertex( "Vertex" );
+	static const NifFieldId fUV( "UV" );
+	static const NifFieldId fBitangentX( "Bitangent X" );
+	static const NifFieldId fBitangentY( "Bitangent Y" );
+	static const NifFieldId fBitangentZ( "Bitangent Z" );
+	static const NifFieldId fNormal( "Normal" );
+	static const NifFieldId fTangent( "Tangent" );
+	static const NifFieldId fVertexColors( "Vertex Colors" );
+
+	auto first = nif->index( 0, 0, iVertData );
+	auto rowOf = [nif, &first]( const NifFieldId & field ) {
+		return nif->getIndex( first, field ).row();
+	};
+
+	int rVertex = rowOf( fVertex );
+	int rUV = rowOf( fUV );
+	int rBitangentX = rowOf( fBitangentX );
+	int rBitangentY = rowOf( fBitangentY );
+	int rBitangentZ = rowOf( fBitangentZ );
+	int rNormal = rowOf( fNormal );
+	int rTangent = rowOf( fTangent );
+	int rVertexColors = rowOf( fVertexColors );
+
+	verts.reserve( numVerts );
+	coordset.reserve( numVerts );
+	norms.reserve( numVerts );
+	tangents.reserve( numVerts );
+	bitangents.reserve( numVerts );
+	if ( rVertexColors >= 0 )
+		colors.reserve( numVerts );
+
+	for ( int i = 0; i < numVerts; i++ ) {
+		auto idx = nif->index( i, 0, iVertData );
+		auto field = [nif, &idx]( int row ) {
+			return ( row >= 0 ) ? nif->index( row, 0, idx ) : QModelIndex();
+		};
+
+		if ( !isDynamic )
+			verts << nif->get<Vector3>( field( rVertex ) );
+
+		coordset << nif->get<HalfVector2>( field( rUV ) );
+
+		// Bitangent X
+		auto bitX = nif->getValue( field( rBitangentX ) ).toFloat();
+		// Bitangent Y/Z
+		auto bitYi = nif->getValue( field( rBitangentY ) ).toCount();
+		auto bitZi = nif->getValue( field( rBitangentZ ) ).toCount();
+		auto bitY = (double( bitYi ) / 255.0) * 2.0 - 1.0;
+		auto bitZ = (double( bitZi ) / 255.0) * 2.0 - 1.0;
+
+		norms += nif->get<ByteVector3>( field( rNormal ) );
+		tangents += nif->get<ByteVector3>( field( rTangent ) );
+		bitangents += Vector3( bitX, bitY, bitZ );
+
+		if ( rVertexColors >= 0 ) {
+			colors += nif->get<ByteColor4>( field( rVertexColors ) );
 		}
 	}
 
-	// Update shaders from this mesh's shader property
-	updateShaderProperties( nif );
+	if ( isDynamic ) {
+		auto dynVerts = nif->getArray<Vector4>( iBlock, "Vertices" );
+		for ( const auto & v : dynVerts )
+			verts << Vector3( v );
+	}
 
-	if ( bssp )
-		isVertexAlphaAnimation = bssp->hasSF2( ShaderFlags::SLSF2_Tree_Anim );
+	// Add coords as first set of QList
+	coords.append( coordset );
+
+	if ( !isDataOnSkin ) {
+		triangles = nif->getArray<Triangle>( iTriData );
+		triangles = triangles.mid( 0, numTris );
+	} else {
+		auto partIdx = nif->getIndex( iSkinPart, "Partition" );
+		for ( int i = 0; i < nif->rowCount( partIdx ); i++ )
+			triangles << nif->getArray<Triangle>( nif->index( i, 0, partIdx ), "Triangles" );
+	}
 
 	if ( isVertexAlphaAnimation ) {
 		for ( int i = 0; i < colors.count(); i++ )
 			colors[i].setRGBA( colors[i].red(), colors[i].green(), colors[i].blue(), 1.0 );
 	}
+
+	shareData();
 }
 
 QModelIndex BSShape::vertexAt( int idx ) const
@@ -245,6 +296,11 @@ void BSShape::transform()
 				}
 			}
 
+			// Read once here instead of in every frame of transformShapes()
+			auto b = nif->getIndex( iSkinData, "Bone List" );
+			for ( int i = 0; i < weights.count(); i++ )
+				weights[i].setTransform( nif, b.child( i, 0 ) );
+
 			doSkinning = weights.count();
 		}
 	}
@@ -254,6 +310,8 @@ void BSShape::transform()
 
 void BSShape::transformShapes()
 {
+	shapeBounds = BoundSphere();
+
 	if ( isHidden() )
 		return;
 
@@ -279,13 +337,10 @@ void BSShape::transformShapes()
 		transBitangents.resize( verts.count() );
 		transBitangents.fill( Vector3() );
 
-		auto b = nif->getIndex( iSkinData, "Bone List" );
-		for ( int i = 0; i < weights.count(); i++ )
-			weights[i].setTransform( nif, b.child( i, 0 ) );
-
-		Node * root = findParent( 0 );
-		for ( const BoneWeights & bw : weights ) {
-			Node * bone = root ? root->findChild( bw.bone ) : nullptr;
+		updateBoneNodes( 0 );
+		for ( int i = 0; i < weights.count(); i++ ) {
+			const BoneWeights & bw = weights[i];
+			Node * bone = findBone( i );
 			if ( bone ) {
 				Transform t = scene->view * bone->localTrans( 0 ) * bw.trans;
 				for ( const VertexWeight & w : bw.weights ) {
@@ -316,6 +371,9 @@ void BSShape::transformShapes()
 		transBitangents = bitangents;
 	}
 
+	// Update the bounds in object space, then add them in view space for culling
+	bounds();
+	shapeBounds |= viewTrans() * boundSphere;
 }
 
 void BSShape::drawShapes( NodeList * secondPass, bool presort )
@@ -329,6 +387,9 @@ void BSShape::drawShapes( NodeList * secondPass, bool presort )
 	if ( !(scene->options & Scene::ShowMarkers) && name.startsWith( "EditorMarker" ) )
 		return;
 
+	pageIn();
+	lastDrawn = scene->transformFrame;
+
 	if ( Node::SELECTING ) {
 		if ( scene->selMode & Scene::SelObject ) {
 			int s_nodeId = ID2COLORKEY( nodeId );
@@ -350,6 +411,11 @@ void BSShape::drawShapes( NodeList * secondPass, bool presort )
 		return;
 	}
 
+	if ( secondPass && scene->firstPass ) {
+		scene->firstPass->add( this );
+		return;
+	}
+
 	if ( transformRigid ) {
 		glPushMatrix();
 		glMultMatrix( viewTrans() );
@@ -361,40 +427,56 @@ void BSShape::drawShapes( NodeList * secondPass, bool presort )
 		glPolygonOffset( 1.0f, 2.0f );
 	}
 
+	// Geometry stays in buffer objects, it is only uploaded again after it changed
 	glEnableClientState( GL_VERTEX_ARRAY );
-	glVertexPointer( 3, GL_FLOAT, 0, transVerts.data() );
+	if ( transformRigid )
+		buffers->vertices.bind( transVerts );
+	else
+		buffers->vertices.bindDynamic( transVerts );
+	glVertexPointer( 3, GL_FLOAT, 0, nullptr );
 
 	if ( !Node::SELECTING ) {
 		glEnableClientState( GL_NORMAL_ARRAY );
-		glNormalPointer( GL_FLOAT, 0, transNorms.data() );
+		if ( transformRigid )
+			buffers->normals.bind( transNorms );
+		else
+			buffers->normals.bindDynamic( transNorms );
+		glNormalPointer( GL_FLOAT, 0, nullptr );
 
 		bool doVCs = (bssp && (bssp->getFlags2() & ShaderFlags::SLSF2_Vertex_Colors));
 
-
-		Color4 * c = nullptr;
 		if ( colors.count() && (scene->options & Scene::DoVertexColors) && doVCs ) {
-			c = colors.data();
-		}
-
-		if ( c ) {
 			glEnableClientState( GL_COLOR_ARRAY );
-			glColorPointer( 4, GL_FLOAT, 0, c );
+			buffers->colors.bind( colors );
+			glColorPointer( 4, GL_FLOAT, 0, nullptr );
 		} else {
 			glColor( Color3( 1.0f, 1.0f, 1.0f ) );
 		}
 	}
 
+	// The texture coordinate and tangent arrays set up by the renderer are client side
+	buffers->vertices.release();
 
 	if ( !Node::SELECTING )
 		shader = scene->renderer->setupProgram( this, shader );
+
+	buffers->triangles.bind( triangles );
 	
 	if ( isDoubleSided ) {
 		glCullFace( GL_FRONT );
-		glDrawElements( GL_TRIANGLES, triangles.count() * 3, GL_UNSIGNED_SHORT, triangles.data() );
+		glDrawElements( GL_TRIANGLES, triangles.count() * 3, GL_UNSIGNED_SHORT, nullptr );
 		glCullFace( GL_BACK );
+
+		scene->stats.drawCalls++;
+		scene->stats.triangles += triangles.count();
 	}
 
-	glDrawElements( GL_TRIANGLES, triangles.count() * 3, GL_UNSIGNED_SHORT, triangles.data() );
+	glDrawElements( GL_TRIANGLES, triangles.count() * 3, GL_UNSIGNED_SHORT, nullptr );
+
+	scene->stats.drawCalls++;
+	scene->stats.triangles += triangles.count();
+
+	buffers->triangles.release();
 
 	if ( !Node::SELECTING )
 		scene->renderer->stopProgram();
@@ -421,11 +503,8 @@ void BSShape::drawVerts() const
 
 	glBegin( GL_POINTS );
 
+	// Vertices are picked with Scene::pick(), no color keys are drawn for them
 	for ( int i = 0; i < numVerts; i++ ) {
-		if ( Node::SELECTING ) {
-			int id = ID2COLORKEY( ( shapeNumber << 16 ) + i );
-			glColor4ubv( (GLubyte *)&id );
-		}
 		glVertex( transVerts.value( i ) );
 	}
 
@@ -452,6 +531,20 @@ void BSShape::drawVerts() const
 	}
 
 	glEnd();
+
+	// The vertex under the cursor, drawn larger than the others
+	if ( !Node::SELECTING && scene->hover.shape == shapeNumber && scene->hover.vertex >= 0 ) {
+		GLfloat size;
+		glGetFloatv( GL_POINT_SIZE, &size );
+		glPointSize( size * 1.5f );
+
+		glHighlightColor();
+		glBegin( GL_POINTS );
+		glVertex( transVerts.value( scene->hover.vertex ) );
+		glEnd();
+
+		glPointSize( size );
+	}
 }
 
 void BSShape::drawSelection() const
@@ -459,7 +552,8 @@ void BSShape::drawSelection() const
 	if ( scene->options & Scene::ShowNodes )
 		Node::drawSelection();
 
-	if ( isHidden() || !(scene->selMode & Scene::SelObject) )
+	// A shape paged out was not drawn for a while, neither is its selection
+	if ( isHidden() || pagedOut || !(scene->selMode & Scene::SelObject) )
 		return;
 
 	auto idx = scene->currentIndex;
@@ -540,12 +634,7 @@ void BSShape::drawSelection() const
 	// Draw All Verts lambda
 	auto allv = [this]( float size ) {
 		glPointSize( size );
-		glBegin( GL_POINTS );
-
-		for ( int j = 0; j < transVerts.count(); j++ )
-			glVertex( transVerts.value( j ) );
-
-		glEnd();
+		drawPoints();
 	};
 
 	if ( n == "Bounding Sphere" && !extraData ) {
@@ -646,20 +735,12 @@ void BSShape::drawSelection() const
 	glPolygonMode( GL_FRONT_AND_BACK, GL_LINE );
 
 	// Draw Lines lambda
-	auto lines = [this, &normalScale, &allv, &lineWidth]( const QVector<Vector3> & v ) {
+	auto lines = [this, &normalScale, &allv, &lineWidth]( const QVector<Vector3> & v, GLBuffer<Vector3> & buffer ) {
 		allv( 7.0 );
 
 		int s = scene->currentIndex.parent().row();
-		glBegin( GL_LINES );
 
-		for ( int j = 0; j < transVerts.count() && j < v.count(); j++ ) {
-			glVertex( transVerts.value( j ) );
-			glVertex( transVerts.value( j ) + v.value( j ) * normalScale * 2 );
-			glVertex( transVerts.value( j ) );
-			glVertex( transVerts.value( j ) - v.value( j ) * normalScale / 2 );
-		}
-
-		glEnd();
+		drawVectors( v, buffer, normalScale * 2, normalScale / 2 );
 
 		if ( s >= 0 ) {
 			glDepthFunc( GL_ALWAYS );
@@ -677,12 +758,12 @@ void BSShape::drawSelection() const
 	
 	// Draw Normals
 	if ( n.contains( "Normal" ) ) {
-		lines( transNorms );
+		lines( transNorms, buffers->normals );
 	}
 
 	// Draw Tangents
 	if ( n.contains( "Tangent" ) ) {
-		lines( transTangents );
+		lines( transTangents, buffers->tangents );
 	}
 
 	// Draw Triangles
@@ -797,13 +878,7 @@ void BSShape::drawSelection() const
 	if ( blk == iBlock && idx != iVertData && p != "Vertex Data" && p != "Vertices" ) {
 		glLineWidth( 1.6f );
 		glNormalColor();
-		for ( const Triangle& tri : triangles ) {
-			glBegin( GL_TRIANGLES );
-			glVertex( transVerts.value( tri.v1() ) );
-			glVertex( transVerts.value( tri.v2() ) );
-			glVertex( transVerts.value( tri.v3() ) );
-			glEnd();
-		}
+		drawTriangles();
 	}
 
 	glDisable( GL_POLYGON_OFFSET_FILL );
@@ -40,6 +40,7 @@ public:
 	QModelIndex vertexAt( int ) const override;
 
 protected:
+	void readGeometry( const NifModel * nif ) override;
 
 	QPersistentModelIndex iVertData;
 	QPersistentModelIndex iTriData;
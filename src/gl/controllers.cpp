@@ -49,6 +49,9 @@ ControllerManager::ControllerManager( Node * node, const QModelIndex & index )
 
 bool ControllerManager::update( const NifModel * nif, const QModelIndex & index )
 {
+	// Any edit may rename, relink or delete the controlled blocks and their targets
+	sequences.clear();
+
 	if ( Controller::update( nif, index ) ) {
 		if ( target ) {
 			Scene * scene = target->scene;
@@ -83,116 +86,151 @@ bool ControllerManager::update( const NifModel * nif, const QModelIndex & index
 	return false;
 }
 
-void ControllerManager::setSequence( const QString & seqname )
+ControllerManager::Sequence ControllerManager::bindSequence( const NifModel * nif, const QString & seqname ) const
 {
-	const NifModel * nif = static_cast<const NifModel *>(iBlock.model());
+	Sequence seq;
 
-	if ( target && iBlock.isValid() && nif ) {
-		MultiTargetTransformController * multiTargetTransformer = 0;
-		for ( Controller * c : target->controllers ) {
-			if ( c->typeId() == "NiMultiTargetTransformController" ) {
-				multiTargetTransformer = static_cast<MultiTargetTransformController *>(c);
-				break;
-			}
+	MultiTargetTransformController * multiTargetTransformer = 0;
+	for ( Controller * c : target->controllers ) {
+		if ( c->typeId() == "NiMultiTargetTransformController" ) {
+			multiTargetTransformer = static_cast<MultiTargetTransformController *>(c);
+			break;
 		}
+	}
 
-		QVector<qint32> lSequences = nif->getLinkArray( iBlock, "Controller Sequences" );
-		for ( const auto l : lSequences ) {
-			QModelIndex iSeq = nif->getBlock( l, "NiControllerSequence" );
+	QVector<qint32> lSequences = nif->getLinkArray( iBlock, "Controller Sequences" );
+	for ( const auto l : lSequences ) {
+		QModelIndex iSeq = nif->getBlock( l, "NiControllerSequence" );
 
-			if ( iSeq.isValid() && nif->get<QString>( iSeq, "Name" ) == seqname ) {
-				start = nif->get<float>( iSeq, "Start Time" );
-				stop = nif->get<float>( iSeq, "Stop Time" );
-				phase = nif->get<float>( iSeq, "Phase" );
-				frequency = nif->get<float>( iSeq, "Frequency" );
+		if ( !iSeq.isValid() || nif->get<QString>( iSeq, "Name" ) != seqname )
+			continue;
 
-				QModelIndex iCtrlBlcks = nif->getIndex( iSeq, "Controlled Blocks" );
+		seq.start = nif->get<float>( iSeq, "Start Time" );
+		seq.stop = nif->get<float>( iSeq, "Stop Time" );
+		seq.phase = nif->get<float>( iSeq, "Phase" );
+		seq.frequency = nif->get<float>( iSeq, "Frequency" );
 
-				for ( int r = 0; r < nif->rowCount( iCtrlBlcks ); r++ ) {
-					QModelIndex iCB = iCtrlBlcks.child( r, 0 );
+		QModelIndex iCtrlBlcks = nif->getIndex( iSeq, "Controlled Blocks" );
 
-					QModelIndex iInterpolator = nif->getBlock( nif->getLink( iCB, "Interpolator" ), "NiInterpolator" );
+		for ( int r = 0; r < nif->rowCount( iCtrlBlcks ); r++ ) {
+			QModelIndex iCB = iCtrlBlcks.child( r, 0 );
 
-					QModelIndex iController = nif->getBlock( nif->getLink( iCB, "Controller" ), "NiTimeController" );
+			QModelIndex iInterpolator = nif->getBlock( nif->getLink( iCB, "Interpolator" ), "NiInterpolator" );
 
-					QString nodename = nif->get<QString>( iCB, "Node Name" );
+			QModelIndex iController = nif->getBlock( nif->getLink( iCB, "Controller" ), "NiTimeController" );
 
-					if ( nodename.isEmpty() ) {
-						QModelIndex idx = nif->getIndex( iCB, "Node Name Offset" );
-						nodename = idx.sibling( idx.row(), NifModel::ValueCol ).data( NifSkopeDisplayRole ).toString();
-					}
+			QString nodename = nif->get<QString>( iCB, "Node Name" );
 
-					QString proptype = nif->get<QString>( iCB, "Property Type" );
+			if ( nodename.isEmpty() ) {
+				QModelIndex idx = nif->getIndex( iCB, "Node Name Offset" );
+				nodename = idx.sibling( idx.row(), NifModel::ValueCol ).data( NifSkopeDisplayRole ).toString();
+			}
 
-					if ( proptype.isEmpty() ) {
-						QModelIndex idx = nif->getIndex( iCB, "Property Type Offset" );
-						proptype = idx.sibling( idx.row(), NifModel::ValueCol ).data( NifSkopeDisplayRole ).toString();
-					}
+			QString proptype = nif->get<QString>( iCB, "Property Type" );
 
-					QString ctrltype = nif->get<QString>( iCB, "Controller Type" );
+			if ( proptype.isEmpty() ) {
+				QModelIndex idx = nif->getIndex( iCB, "Property Type Offset" );
+				proptype = idx.sibling( idx.row(), NifModel::ValueCol ).data( NifSkopeDisplayRole ).toString();
+			}
 
-					if ( ctrltype.isEmpty() ) {
-						QModelIndex idx = nif->getIndex( iCB, "Controller Type Offset" );
-						ctrltype = idx.sibling( idx.row(), NifModel::ValueCol ).data( NifSkopeDisplayRole ).toString();
-					}
+			QString ctrltype = nif->get<QString>( iCB, "Controller Type" );
 
-					QString var1 = nif->get<QString>( iCB, "Variable 1" );
+			if ( ctrltype.isEmpty() ) {
+				QModelIndex idx = nif->getIndex( iCB, "Controller Type Offset" );
+				ctrltype = idx.sibling( idx.row(), NifModel::ValueCol ).data( NifSkopeDisplayRole ).toString();
+			}
 
-					if ( var1.isEmpty() ) {
-						QModelIndex idx = nif->getIndex( iCB, "Variable 1 Offset" );
-						var1 = idx.sibling( idx.row(), NifModel::ValueCol ).data( NifSkopeDisplayRole ).toString();
-					}
+			QString var1 = nif->get<QString>( iCB, "Variable 1" );
 
-					QString var2 = nif->get<QString>( iCB, "Variable 2" );
+			if ( var1.isEmpty() ) {
+				QModelIndex idx = nif->getIndex( iCB, "Variable 1 Offset" );
+				var1 = idx.sibling( idx.row(), NifModel::ValueCol ).data( NifSkopeDisplayRole ).toString();
+			}
 
-					if ( var2.isEmpty() ) {
-						QModelIndex idx = nif->getIndex( iCB, "Variable 2 Offset" );
-						var2 = idx.sibling( idx.row(), NifModel::ValueCol ).data( NifSkopeDisplayRole ).toString();
-					}
+			QString var2 = nif->get<QString>( iCB, "Variable 2" );
 
-					Node * node = target->findChild( nodename );
+			if ( var2.isEmpty() ) {
+				QModelIndex idx = nif->getIndex( iCB, "Variable 2 Offset" );
+				var2 = idx.sibling( idx.row(), NifModel::ValueCol ).data( NifSkopeDisplayRole ).toString();
+			}
 
-					if ( !node )
-						continue;
+			Node * node = target->findChild( nodename );
+
+			if ( !node )
+				continue;
+
+			Binding binding;
+			binding.node = node;
+			binding.ctrl = nullptr;
+			binding.iInterpolator = iInterpolator;
+
+			if ( ctrltype == "NiTransformController" && multiTargetTransformer
+				 && iInterpolator.isValid() && multiTargetTransformer->hasTarget( node ) )
+			{
+				binding.kind = Binding::MultiTarget;
+				binding.ctrl = multiTargetTransformer;
+			} else if ( ctrltype == "BSLightingShaderPropertyFloatController"
+				|| ctrltype == "BSLightingShaderPropertyColorController"
+				|| ctrltype == "BSEffectShaderPropertyFloatController"
+				|| ctrltype == "BSEffectShaderPropertyColorController"
+				|| ctrltype == "BSNiAlphaPropertyTestRefController" )
+			{
+				binding.kind = Binding::Interpolator;
+				binding.ctrl = node->findController( proptype, iController );
+			} else {
+				binding.kind = Binding::Timed;
+				binding.ctrl = node->findController( proptype, ctrltype, var1, var2 );
+			}
 
-					if ( ctrltype == "NiTransformController" && multiTargetTransformer ) {
-						if ( multiTargetTransformer->setInterpolator( node, iInterpolator ) ) {
-							multiTargetTransformer->start = start;
-							multiTargetTransformer->stop = stop;
-							multiTargetTransformer->phase = phase;
-							multiTargetTransformer->frequency = frequency;
-							continue;
-						}
-					}
+			if ( binding.ctrl )
+				seq.bindings.append( binding );
+		}
+	}
 
-					if ( ctrltype == "BSLightingShaderPropertyFloatController"
-						|| ctrltype == "BSLightingShaderPropertyColorController"
-						|| ctrltype == "BSEffectShaderPropertyFloatController"
-						|| ctrltype == "BSEffectShaderPropertyColorController"
-						|| ctrltype == "BSNiAlphaPropertyTestRefController" )
-					{
-						//qDebug() << node->name;
-
-						auto ctrl = node->findController( proptype, iController );
-						if ( ctrl ) {
-							ctrl->setInterpolator( iInterpolator );
-						}
-						continue;
-					}
+	return seq;
+}
 
-					Controller * ctrl = node->findController( proptype, ctrltype, var1, var2 );
+void ControllerManager::setSequence( const QString & seqname )
+{
+	const NifModel * nif = static_cast<const NifModel *>(iBlock.model());
 
-					if ( ctrl ) {
-						ctrl->start = start;
-						ctrl->stop = stop;
-						ctrl->phase = phase;
-						ctrl->frequency = frequency;
+	if ( !( target && iBlock.isValid() && nif ) )
+		return;
 
-						ctrl->setInterpolator( iInterpolator );
-					}
-				}
-			}
+	auto it = sequences.find( seqname );
+	if ( it == sequences.end() )
+		it = sequences.insert( seqname, bindSequence( nif, seqname ) );
+
+	const Sequence & seq = it.value();
+
+	start = seq.start;
+	stop = seq.stop;
+	phase = seq.phase;
+	frequency = seq.frequency;
+
+	for ( const Binding & binding : seq.bindings ) {
+		// The controllers are deleted with their node, and on edits which also drop the bindings
+		if ( !binding.node )
+			continue;
+
+		Controller * ctrl = binding.ctrl;
+
+		switch ( binding.kind ) {
+		case Binding::MultiTarget:
+			static_cast<MultiTargetTransformController *>(ctrl)->setInterpolator( binding.node, binding.iInterpolator );
+			break;
+		case Binding::Interpolator:
+			ctrl->setInterpolator( binding.iInterpolator );
+			continue;
+		case Binding::Timed:
+			ctrl->setInterpolator( binding.iInterpolator );
+			break;
 		}
+
+		ctrl->start = start;
+		ctrl->stop = stop;
+		ctrl->phase = phase;
+		ctrl->frequency = frequency;
 	}
 }
 
@@ -284,6 +322,11 @@ MultiTargetTransformController::MultiTargetTransformController( Node * node, con
 {
 }
 
+MultiTargetTransformController::~MultiTargetTransformController()
+{
+	qDeleteAll( interpolators );
+}
+
 void MultiTargetTransformController::updateTime( float time )
 {
 	if ( !(active && target) )
@@ -318,9 +361,9 @@ bool MultiTargetTransformController::update( const NifModel * nif, const QModelI
 		return true;
 	}
 
-	for ( const TransformTarget& tt : extraTargets ) {
-		// TODO: update the interpolators
-	}
+	TransformInterpolator * interpolator = interpolators.value( index );
+	if ( interpolator )
+		interpolator->update( nif, index );
 
 	return false;
 }
@@ -332,29 +375,37 @@ bool MultiTargetTransformController::setInterpolator( Node * node, const QModelI
 	if ( !nif || !iInterpolator.isValid() )
 		return false;
 
-	QMutableListIterator<TransformTarget> it( extraTargets );
-
-	while ( it.hasNext() ) {
-		it.next();
+	for ( TransformTarget & tt : extraTargets ) {
+		if ( tt.first != node )
+			continue;
 
-		if ( it.value().first == node ) {
-			if ( it.value().second ) {
-				delete it.value().second;
-				it.value().second = 0;
-			}
+		TransformInterpolator * interpolator = interpolators.value( iInterpolator );
 
+		if ( !interpolator ) {
 			if ( nif->isNiBlock( iInterpolator, "NiBSplineCompTransformInterpolator" ) ) {
-				it.value().second = new BSplineTransformInterpolator( this );
+				interpolator = new BSplineTransformInterpolator( this );
 			} else if ( nif->isNiBlock( iInterpolator, "NiTransformInterpolator" ) ) {
-				it.value().second = new TransformInterpolator( this );
+				interpolator = new TransformInterpolator( this );
 			}
 
-			if ( it.value().second ) {
-				it.value().second->update( nif, iInterpolator );
+			if ( interpolator ) {
+				interpolator->update( nif, iInterpolator );
+				interpolators.insert( iInterpolator, interpolator );
 			}
+		}
+
+		tt.second = interpolator;
+		return true;
+	}
+
+	return false;
+}
 
+bool MultiTargetTransformController::hasTarget( Node * node ) const
+{
+	for ( const TransformTarget & tt : extraTargets ) {
+		if ( tt.first == node )
 			return true;
-		}
 	}
 
 	return false;
@@ -411,10 +462,12 @@ void MorphController::updateTime( float time )
 
 	time = ctrlTime( time );
 
-	if ( target->verts.count() != morph[0]->verts.count() )
+	int count = morph[0]->verts.count();
+
+	if ( target->verts.count() != count )
 		return;
 
-	target->verts = morph[0]->verts;
+	QVector<float> w( morph.count() - 1, 0.0f );
 
 	float x;
 
@@ -427,13 +480,41 @@ void MorphController::updateTime( float time )
 			if ( x > 1 )
 				x = 1;
 
-			if ( x != 0 && target->verts.count() == key->verts.count() ) {
-				for ( int v = 0; v < target->verts.count(); v++ )
-					target->verts[v] += key->verts[v] * x;
-			}
+			w[i - 1] = x;
 		}
 	}
 
+	// Nothing to do if the weights are the same and the vertices were not reloaded since
+	if ( w == weights && target->verts.constData() == blended )
+		return;
+
+	weights = w;
+	target->verts = morph[0]->verts;
+
+	// Detach once, not on every write through operator[]
+	Vector3 * verts = target->verts.data();
+
+	for ( int i = 1; i < morph.count(); i++ ) {
+		MorphKey * key = morph[i];
+		x = weights[i - 1];
+
+		if ( x == 0 )
+			continue;
+
+		const Vector3 * vectors = key->verts.constData();
+
+		if ( !key->moved.isEmpty() ) {
+			const int * moved = key->moved.constData();
+
+			for ( int m = 0; m < key->moved.count(); m++ )
+				verts[moved[m]] += vectors[m] * x;
+		} else if ( key->verts.count() == count ) {
+			for ( int v = 0; v < count; v++ )
+				verts[v] += vectors[v] * x;
+		}
+	}
+
+	blended = target->verts.constData();
 	target->updateBounds = true;
 }
 
@@ -442,6 +523,7 @@ bool MorphController::update( const NifModel * nif, const QModelIndex & index )
 	if ( Controller::update( nif, index ) ) {
 		qDeleteAll( morph );
 		morph.clear();
+		blended = nullptr;
 
 		QModelIndex midx = nif->getIndex( iData, "Morphs" );
 
@@ -470,6 +552,26 @@ bool MorphController::update( const NifModel * nif, const QModelIndex & index )
 
 			key->verts = nif->getArray<Vector3>( nif->getIndex( iKey, "Vectors" ) );
 
+			// Keep only the vectors that move a vertex when most do not, as in facial morphs
+			if ( r > 0 && !morph.isEmpty() && key->verts.count() == morph[0]->verts.count() ) {
+				QVector<int> moved;
+				QVector<Vector3> vectors;
+
+				for ( int v = 0; v < key->verts.count(); v++ ) {
+					const Vector3 & d = key->verts[v];
+
+					if ( d[0] != 0 || d[1] != 0 || d[2] != 0 ) {
+						moved.append( v );
+						vectors.append( d );
+					}
+				}
+
+				if ( moved.count() * 2 < key->verts.count() ) {
+					key->moved = moved;
+					key->verts = vectors;
+				}
+			}
+
 			morph.append( key );
 		}
 
@@ -479,6 +581,16 @@ bool MorphController::update( const NifModel * nif, const QModelIndex & index )
 	return false;
 }
 
+void MorphController::sampleValues( QVector<float> & values, QStringList * names ) const
+{
+	for ( int i = 1; i < morph.count(); i++ ) {
+		values.append( weights.value( i - 1 ) );
+
+		if ( names )
+			names->append( QString( "morph%1" ).arg( i ) );
+	}
+}
+
 
 // `NiUVController` blocks
 
@@ -498,7 +610,9 @@ void UVController::updateTime( float time )
 
 	// U trans, V trans, U scale, V scale
 	// see NiUVData compound in nif.xml
-	float val[4] = { 0.0, 0.0, 1.0, 1.0 };
+	float * val = uv;
+	val[0] = val[1] = 0.0;
+	val[2] = val[3] = 1.0;
 
 	if ( uvGroups.isValid() ) {
 		for ( int i = 0; i < 4 && i < nif->rowCount( uvGroups ); i++ ) {
@@ -532,6 +646,15 @@ bool UVController::update( const NifModel * nif, const QModelIndex & index )
 	return false;
 }
 
+void UVController::sampleValues( QVector<float> & values, QStringList * names ) const
+{
+	for ( int i = 0; i < 4; i++ )
+		values.append( uv[i] );
+
+	if ( names )
+		*names << "uTrans" << "vTrans" << "uScale" << "vScale";
+}
+
 
 float random( float r )
 {
@@ -885,11 +1008,28 @@ void TexFlipController::updateTime( float time )
 	else if ( flipDelta > 0 )
 		r = ctrlTime( time ) / flipDelta;
 
-	// TexturingProperty
+	int frame = (int)r;
+
+	// All frames are bound once after update(), here where the context is current,
+	// so that they are read and uploaded before they are shown
 	if ( target ) {
-		target->textures[flipSlot & 7].iSource = nif->getBlock( nif->getLink( iSources.child( (int)r, 0 ) ), "NiSourceTexture" );
+		if ( !preloaded ) {
+			for ( const QPersistentModelIndex & f : frames )
+				target->scene->bindTexture( f );
+			preloaded = true;
+		}
+
+		target->textures[flipSlot & 7].iSource = frames.value( frame );
+		target->scene->bindTexture( frames.value( frame ) );
 	} else if ( oldTarget ) {
-		oldTarget->iImage = nif->getBlock( nif->getLink( iSources.child( (int)r, 0 ) ), "NiImage" );
+		if ( !preloaded ) {
+			for ( const QString & f : frameFiles )
+				oldTarget->scene->bindTexture( f );
+			preloaded = true;
+		}
+
+		oldTarget->iImage = frames.value( frame );
+		oldTarget->scene->bindTexture( frameFiles.value( frame ) );
 	}
 }
 
@@ -905,6 +1045,18 @@ bool TexFlipController::update( const NifModel * nif, const QModelIndex & index
 			iSources = nif->getIndex( iBlock, "Images" );
 		}
 
+		frames.clear();
+		frameFiles.clear();
+		for ( int f = 0; f < nif->rowCount( iSources ); f++ ) {
+			QModelIndex frame = nif->getBlock( nif->getLink( iSources.child( f, 0 ) ), target ? "NiSourceTexture" : "NiImage" );
+			frames << frame;
+
+			if ( oldTarget )
+				frameFiles << nif->get<QString>( frame, "File Name" );
+		}
+
+		preloaded = false;
+
 		return true;
 	}
 
@@ -35,6 +35,11 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "glcontroller.h" // Inherited
 
+#include <QHash>
+#include <QPointer>
+#include <QStringList>
+#include <QVector>
+
 
 //! @file controllers.h Controller subclasses
 
@@ -54,7 +59,38 @@ public:
 	void setSequence( const QString & seqname ) override final;
 
 protected:
+	//! A controlled block of a sequence, bound to the controller which plays it
+	struct Binding
+	{
+		enum Kind
+		{
+			//! An extra target of the NiMultiTargetTransformController
+			MultiTarget,
+			//! A shader property controller, which keeps its own times
+			Interpolator,
+			//! Any other controller, given the times of the sequence
+			Timed
+		} kind;
+
+		QPointer<Node> node;
+		Controller * ctrl;
+		QPersistentModelIndex iInterpolator;
+	};
+
+	//! The times of a sequence and its controlled blocks
+	struct Sequence
+	{
+		float start = 0, stop = 0, phase = 0, frequency = 1;
+		QVector<Binding> bindings;
+	};
+
+	//! Find the targets of the controlled blocks of a sequence by name
+	Sequence bindSequence( const NifModel * nif, const QString & seqname ) const;
+
 	QPointer<Node> target;
+
+	//! Sequences bound by setSequence(), dropped by update() as any edit may change them
+	QHash<QString, Sequence> sequences;
 };
 
 
@@ -100,6 +136,7 @@ class MultiTargetTransformController final : public Controller
 
 public:
 	MultiTargetTransformController( Node * node, const QModelIndex & index );
+	~MultiTargetTransformController();
 
 	void updateTime( float time ) override final;
 
@@ -107,9 +144,15 @@ public:
 
 	bool setInterpolator( Node * node, const QModelIndex & iInterpolator );
 
+	//! Whether the node is one of the extra targets
+	bool hasTarget( Node * node ) const;
+
 protected:
 	QPointer<Node> target;
 	QList<TransformTarget> extraTargets;
+
+	//! Interpolators by block, kept so switching sequences back does not read them again
+	QHash<QPersistentModelIndex, TransformInterpolator *> interpolators;
 };
 
 
@@ -138,6 +181,8 @@ class MorphController final : public Controller
 	{
 		QPersistentModelIndex iFrames;
 		QVector<Vector3> verts;
+		//! Vertices the morph moves, with verts holding only their vectors; empty if it moves most of them
+		QVector<int> moved;
 		int index;
 	};
 
@@ -149,9 +194,15 @@ public:
 
 	bool update( const NifModel * nif, const QModelIndex & index ) override final;
 
+	void sampleValues( QVector<float> & values, QStringList * names ) const override final;
+
 protected:
 	QPointer<Shape> target;
 	QVector<MorphKey *>  morph;
+	//! Weights of the morphs after the base, at the last updateTime()
+	QVector<float> weights;
+	//! The vertices of the target when they were last blended, to skip frames where no weight changed
+	const Vector3 * blended = nullptr;
 };
 
 
@@ -167,10 +218,15 @@ public:
 
 	bool update( const NifModel * nif, const QModelIndex & index ) override final;
 
+	void sampleValues( QVector<float> & values, QStringList * names ) const override final;
+
 protected:
 	QPointer<Shape> target;
 
 	int luv;
+
+	//! U trans, V trans, U scale, V scale at the last updateTime()
+	float uv[4] = { 0.0, 0.0, 1.0, 1.0 };
 };
 
 
@@ -232,6 +288,9 @@ public:
 
 	void updateTime( float time ) override final;
 
+	//! The particles move by the time since the last frame
+	bool dependsOnTimeOnly() const override final { return false; }
+
 	void startParticle( Particle & p );
 
 	void moveParticle( Particle & p, float deltaTime );
@@ -316,6 +375,12 @@ protected:
 	int flipLast;
 
 	QPersistentModelIndex iSources;
+	//! The NiSourceTexture or NiImage block of each frame, resolved by update()
+	QVector<QPersistentModelIndex> frames;
+	//! The file name of each NiImage frame, resolved by update()
+	QStringList frameFiles;
+	//! Whether all frames were bound since update() resolved them
+	bool preloaded = false;
 };
 
 
@@ -184,12 +184,10 @@ void BlockDXT1::decodeBlock( ColorBlock * block ) const
 	Color32 color_array[4];
 	evaluatePalette( color_array );
 
-	// Write color block.
-	for ( uint j = 0; j < 4; j++ ) {
-		for ( uint i = 0; i < 4; i++ ) {
-			uint idx = ( row[j] >> (2 * i) ) & 3;
-			block->color( i, j ) = color_array[idx];
-		}
+	// Write color block, the 2 bit indices are packed in pixel order.
+	uint idx = indices;
+	for ( uint i = 0; i < 16; i++, idx >>= 2 ) {
+		block->color( i ) = color_array[idx & 3];
 	}
 }
 
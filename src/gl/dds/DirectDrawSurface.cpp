@@ -66,6 +66,11 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <stdio.h> // printf
 #include <math.h>  // sqrt
+#include <string.h> // memcpy
+
+#include <algorithm>
+#include <thread>
+#include <vector>
 
 /*** declarations ***/
 
@@ -768,18 +773,45 @@ void DirectDrawSurface::readBlockImage( Image * img )
 		img->setFormat( Image::Format_ARGB );
 	}
 
-	for ( uint by = 0; by < bh; by++ ) {
+	// Block rows are independent, large images are decoded in bands on several threads
+	const uint minBand = 32;
+	uint bands = std::min( std::max( std::thread::hardware_concurrency(), 1U ), std::max( bh / minBand, 1U ) );
+
+	if ( bands <= 1 ) {
+		readBlockRows( img, stream, 0, bh );
+	} else {
+		std::vector<std::thread> threads;
+		for ( uint b = 0; b < bands; b++ ) {
+			Stream s = stream;
+			s.seek( std::min( stream.size, stream.pos + bh * b / bands * bw * blockSize() ) );
+			threads.emplace_back( &DirectDrawSurface::readBlockRows, this, img, s, bh * b / bands, bh * ( b + 1 ) / bands );
+		}
+
+		for ( std::thread & t : threads )
+			t.join();
+	}
+
+	stream.seek( std::min( stream.size, stream.pos + bh * bw * blockSize() ) );
+}
+
+void DirectDrawSurface::readBlockRows( Image * img, Stream s, uint first, uint last )
+{
+	const uint w = img->width();
+	const uint h = img->height();
+
+	const uint bw = (w + 3) / 4;
+
+	for ( uint by = first; by < last; by++ ) {
 		for ( uint bx = 0; bx < bw; bx++ ) {
 			ColorBlock block;
 
 			// Read color block.
-			readBlock( &block );
+			readBlock( &block, s );
 
 			// Write color block.
+			const uint cw = std::min( 4U, w - 4 * bx );
 			for ( uint y = 0; y < std::min( 4U, h - 4 * by ); y++ ) {
-				for ( uint x = 0; x < std::min( 4U, w - 4 * bx ); x++ ) {
-					img->pixel( 4 * bx + x, 4 * by + y ) = block.color( x, y );
-				}
+				memcpy( img->scanline( 4 * by + y ) + 4 * bx, &block.color( 0, y ), cw * sizeof( Color32 ) );
 			}
 		}
 	}
@@ -801,6 +833,11 @@ static Color32 buildNormal( uint8 x, uint8 y )
 
 
 void DirectDrawSurface::readBlock( ColorBlock * rgba )
+{
+	readBlock( rgba, stream );
+}
+
+void DirectDrawSurface::readBlock( ColorBlock * rgba, Stream & stream )
 {
 	if ( header.pf.fourcc == FOURCC_DXT1 ) {
 		BlockDXT1 block;
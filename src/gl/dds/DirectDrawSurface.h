@@ -173,7 +173,9 @@ private:
 
 	void readLinearImage( Image * img );
 	void readBlockImage( Image * img );
+	void readBlockRows( Image * img, Stream s, uint first, uint last );
 	void readBlock( ColorBlock * rgba );
+	void readBlock( ColorBlock * rgba, Stream & s );
 
 private:
 	Stream stream; // memory where DDS file resides
@@ -0,0 +1,283 @@
+/***** BEGIN LICENSE BLOCK *****
+
+BSD License
+
+Copyright (c) 2005-2015, NIF File Format Library and Tools
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the NIF File Format Library and Tools project may not be
+   used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+***** END LICENCE BLOCK *****/
+
+#include "glbvh.h"
+
+#include <algorithm>
+
+
+//! @file glbvh.cpp BVH implementation
+
+//! The most triangles a leaf holds
+static const int leafSize = 4;
+
+void BVH::clear()
+{
+	nodes.clear();
+	order.clear();
+	verts.clear();
+	source.clear();
+}
+
+void BVH::build( const QVector<Vector3> & vertices, const QVector<Triangle> & triangles )
+{
+	clear();
+
+	verts = vertices;
+	source = triangles;
+
+	const int numVerts = verts.count();
+
+	QVector<Vector3> centers( source.count() );
+	order.reserve( source.count() );
+
+	for ( int t = 0; t < source.count(); t++ ) {
+		const Triangle & tri = source.at( t );
+		if ( tri.v1() >= numVerts || tri.v2() >= numVerts || tri.v3() >= numVerts )
+			continue;
+
+		centers[t] = ( verts.at( tri.v1() ) + verts.at( tri.v2() ) + verts.at( tri.v3() ) ) / 3.0;
+		order.append( t );
+	}
+
+	if ( order.isEmpty() )
+		return;
+
+	nodes.reserve( 2 * ( order.count() / leafSize ) + 1 );
+
+	Node root;
+	root.count = order.count();
+	nodes.append( root );
+
+	split( 0, centers );
+}
+
+void BVH::split( int node, const QVector<Vector3> & centers )
+{
+	fitLeaf( nodes[node] );
+
+	const int first = nodes.at( node ).first;
+	const int count = nodes.at( node ).count;
+
+	if ( count <= leafSize )
+		return;
+
+	// Split along the axis the centers spread the most on
+	Vector3 cmin = centers.at( order.at( first ) );
+	Vector3 cmax = cmin;
+	for ( int i = first + 1; i < first + count; i++ ) {
+		cmin.boundMin( centers.at( order.at( i ) ) );
+		cmax.boundMax( centers.at( order.at( i ) ) );
+	}
+
+	Vector3 extent = cmax - cmin;
+
+	int axis = 0;
+	if ( extent[1] > extent[axis] )
+		axis = 1;
+	if ( extent[2] > extent[axis] )
+		axis = 2;
+
+	// Triangles with the same center cannot be told apart, they stay in one leaf
+	if ( extent[axis] <= 0 )
+		return;
+
+	const int mid = first + count / 2;
+
+	int * o = order.data();
+	std::nth_element( o + first, o + mid, o + first + count, [&centers, axis]( int a, int b ) {
+		return centers.at( a )[axis] < centers.at( b )[axis];
+	} );
+
+	Node left, right;
+	left.first = first;
+	left.count = mid - first;
+	right.first = mid;
+	right.count = first + count - mid;
+
+	// The children follow their parent, which refit() relies on
+	const int child = nodes.count();
+	nodes.append( left );
+	nodes.append( right );
+
+	nodes[node].first = child;
+	nodes[node].count = 0;
+
+	split( child, centers );
+	split( child + 1, centers );
+}
+
+void BVH::fitLeaf( Node & node ) const
+{
+	const Triangle & t = source.at( order.at( node.first ) );
+	node.min = node.max = verts.at( t.v1() );
+
+	for ( int i = node.first; i < node.first + node.count; i++ ) {
+		const Triangle & tri = source.at( order.at( i ) );
+
+		for ( int c = 0; c < 3; c++ ) {
+			node.min.boundMin( verts.at( tri[c] ) );
+			node.max.boundMax( verts.at( tri[c] ) );
+		}
+	}
+}
+
+void BVH::refit( const QVector<Vector3> & vertices )
+{
+	Q_ASSERT( vertices.count() == verts.count() );
+
+	verts = vertices;
+
+	// Children come after their parents, so walking back fits them first
+	for ( int n = nodes.count() - 1; n >= 0; n-- ) {
+		Node & node = nodes[n];
+
+		if ( node.count ) {
+			fitLeaf( node );
+		} else {
+			const Node & left = nodes.at( node.first );
+			const Node & right = nodes.at( node.first + 1 );
+
+			node.min = left.min;
+			node.max = left.max;
+			node.min.boundMin( right.min );
+			node.max.boundMax( right.max );
+		}
+	}
+}
+
+//! The distance a ray enters a box at, if it does before \a maxDistance
+static bool enterBox( const Vector3 & min, const Vector3 & max, const Vector3 & origin, const Vector3 & invDir,
+	float maxDistance, float & entry )
+{
+	float tmin = 0, tmax = maxDistance;
+
+	for ( int a = 0; a < 3; a++ ) {
+		float t1 = ( min[a] - origin[a] ) * invDir[a];
+		float t2 = ( max[a] - origin[a] ) * invDir[a];
+
+		if ( t1 > t2 )
+			std::swap( t1, t2 );
+
+		tmin = std::max( tmin, t1 );
+		tmax = std::min( tmax, t2 );
+
+		if ( tmin > tmax )
+			return false;
+	}
+
+	entry = tmin;
+	return true;
+}
+
+bool BVH::intersect( const Vector3 & origin, const Vector3 & direction, Hit & hit ) const
+{
+	if ( nodes.isEmpty() )
+		return false;
+
+	// A component of 0 never leaves its slab, which the largest float stands in for
+	Vector3 invDir;
+	for ( int a = 0; a < 3; a++ )
+		invDir[a] = ( direction[a] != 0 ) ? 1.0f / direction[a] : FLT_MAX;
+
+	float entry;
+	if ( !enterBox( nodes.at( 0 ).min, nodes.at( 0 ).max, origin, invDir, hit.distance, entry ) )
+		return false;
+
+	// Splitting at the median keeps the depth at the logarithm of the triangle count
+	int stack[64];
+	int top = 0;
+	stack[top++] = 0;
+
+	bool found = false;
+
+	while ( top > 0 ) {
+		const Node & node = nodes.at( stack[--top] );
+
+		if ( node.count ) {
+			for ( int i = node.first; i < node.first + node.count; i++ ) {
+				const Triangle & tri = source.at( order.at( i ) );
+				const Vector3 & v0 = verts.at( tri.v1() );
+
+				// Moller-Trumbore, without culling either side
+				Vector3 e1 = verts.at( tri.v2() ) - v0;
+				Vector3 e2 = verts.at( tri.v3() ) - v0;
+
+				Vector3 p = Vector3::crossproduct( direction, e2 );
+				float det = Vector3::dotproduct( e1, p );
+				if ( det == 0 )
+					continue;
+
+				float invDet = 1.0f / det;
+
+				Vector3 s = origin - v0;
+				float u = Vector3::dotproduct( s, p ) * invDet;
+				if ( u < 0 || u > 1 )
+					continue;
+
+				Vector3 q = Vector3::crossproduct( s, e1 );
+				float v = Vector3::dotproduct( direction, q ) * invDet;
+				if ( v < 0 || u + v > 1 )
+					continue;
+
+				float t = Vector3::dotproduct( e2, q ) * invDet;
+				if ( t < 0 || t >= hit.distance )
+					continue;
+
+				hit.triangle = order.at( i );
+				hit.distance = t;
+				hit.u = u;
+				hit.v = v;
+				found = true;
+			}
+
+			continue;
+		}
+
+		// The nearer child is popped first, so that the farther one is mostly skipped
+		float enterLeft, enterRight;
+		bool left = enterBox( nodes.at( node.first ).min, nodes.at( node.first ).max, origin, invDir, hit.distance, enterLeft );
+		bool right = enterBox( nodes.at( node.first + 1 ).min, nodes.at( node.first + 1 ).max, origin, invDir, hit.distance, enterRight );
+
+		if ( left && right ) {
+			bool leftFirst = enterLeft <= enterRight;
+			stack[top++] = leftFirst ? node.first + 1 : node.first;
+			stack[top++] = leftFirst ? node.first : node.first + 1;
+		} else if ( left ) {
+			stack[top++] = node.first;
+		} else if ( right ) {
+			stack[top++] = node.first + 1;
+		}
+	}
+
+	return found;
+}
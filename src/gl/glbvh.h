@@ -0,0 +1,112 @@
+/***** BEGIN LICENSE BLOCK *****
+
+BSD License
+
+Copyright (c) 2005-2015, NIF File Format Library and Tools
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the NIF File Format Library and Tools project may not be
+   used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+***** END LICENCE BLOCK *****/
+
+#ifndef GLBVH_H
+#define GLBVH_H
+
+#include "niftypes.h"
+
+#include <QVector>
+
+#include <cfloat>
+
+
+//! @file glbvh.h BVH
+
+//! A bounding volume hierarchy over the triangles of a shape, to pick them with rays instead of rendering
+/*!
+ * The tree is built once for the triangles of a shape by splitting them at
+ * the median of their centers along the longest axis, a few triangles to a
+ * leaf. When only the vertices move, as when a mesh is skinned or morphed,
+ * refit() grows the boxes around them again without reordering anything.
+ */
+class BVH final
+{
+public:
+	//! The nearest triangle hit by a ray
+	struct Hit
+	{
+		//! The index of the triangle in the array the tree was built from, -1 if none was hit
+		int triangle = -1;
+		//! The distance of the hit from the origin of the ray, in lengths of its direction
+		float distance = FLT_MAX;
+		//! The weights of the second and third vertex of the triangle at the hit
+		float u = 0, v = 0;
+	};
+
+	//! Build the tree, leaving out triangles with vertices not in \a vertices
+	void build( const QVector<Vector3> & vertices, const QVector<Triangle> & triangles );
+	//! Fit the boxes to vertices which moved, there being as many as the tree was built with
+	void refit( const QVector<Vector3> & vertices );
+	//! Empty the tree
+	void clear();
+
+	//! Find the nearest triangle the ray hits closer than \a hit does already
+	/*!
+	 * Both sides of the triangles are hit. The ray is in the space of the vertices.
+	 *
+	 * \return	Whether a nearer triangle than \a hit was found
+	 */
+	bool intersect( const Vector3 & origin, const Vector3 & direction, Hit & hit ) const;
+
+	bool isEmpty() const { return nodes.isEmpty(); }
+
+	//! The vertices the tree was last fitted to, shared with the array passed in
+	const QVector<Vector3> & vertices() const { return verts; }
+	//! The triangles the tree was built from, shared with the array passed in
+	const QVector<Triangle> & triangles() const { return source; }
+
+private:
+	//! A box holding the triangles of a leaf, or the boxes of two children
+	struct Node
+	{
+		Vector3 min, max;
+		//! The first triangle in order of a leaf, or the left child of an inner node, the right one following it
+		int first = 0;
+		//! The number of triangles of a leaf, 0 for an inner node
+		int count = 0;
+	};
+
+	//! Split a node into two children until it holds few enough triangles
+	void split( int node, const QVector<Vector3> & centers );
+	//! Fit a leaf to the vertices of its triangles
+	void fitLeaf( Node & node ) const;
+
+	QVector<Node> nodes;
+	//! The indices of the triangles in source, ordered so that each leaf holds a range
+	QVector<int> order;
+
+	QVector<Vector3> verts;
+	QVector<Triangle> source;
+};
+
+#endif
@@ -35,6 +35,8 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "glscene.h"
 
+#include <atomic>
+
 
 //! @file glcontroller.cpp Controllable management, Interpolation management
 
@@ -56,6 +58,28 @@ QString IControllable::getName() const
 	return name;
 }
 
+void IControllable::sampleValues( QVector<float> & values, QStringList * names ) const
+{
+	QString prefix;
+
+	if ( names ) {
+		prefix = name;
+
+		if ( prefix.isEmpty() ) {
+			const NifModel * nif = static_cast<const NifModel *>( iBlock.model() );
+			prefix = QString( "[%1]" ).arg( nif ? nif->getBlockNumber( iBlock ) : -1 );
+		}
+	}
+
+	for ( Controller * ctrl : controllers ) {
+		QStringList ctrlNames;
+		ctrl->sampleValues( values, names ? &ctrlNames : nullptr );
+
+		for ( const QString & n : ctrlNames )
+			names->append( prefix + "." + n );
+	}
+}
+
 void IControllable::clear()
 {
 	name = QString();
@@ -144,7 +168,9 @@ void IControllable::transform()
 {
 	if ( scene->animate ) {
 		for ( Controller * controller : controllers ) {
-			controller->updateTime( scene->time );
+			// Controllers with constant output keep what they set on the last frame
+			if ( controller->needsUpdate( scene->time ) )
+				controller->updateTime( scene->time );
 		}
 	}
 }
@@ -194,6 +220,11 @@ void Controller::setSequence( const QString & seqname )
 	Q_UNUSED( seqname );
 }
 
+void Controller::sampleValues( QVector<float> & values, QStringList * names ) const
+{
+	Q_UNUSED( values ); Q_UNUSED( names );
+}
+
 void Controller::setInterpolator( const QModelIndex & index )
 {
 	iInterpolator = index;
@@ -286,78 +317,170 @@ float Controller::ctrlTime( float time ) const
 	}
 }
 
-bool Controller::timeIndex( float time, const NifModel * nif, const QModelIndex & array, int & i, int & j, float & x )
+/*! Find the keys around \a time for both timeIndex() overloads, \a keyTime giving the time of a key
+ *
+ * The previous key \a i is tried first, and then the one after it, so that playing forward
+ * costs a compare or two; anything else, such as looping or scrubbing, is a binary search.
+ */
+template <typename F> static bool findTimeIndex( float time, int count, F keyTime, int & i, int & j, float & x )
 {
-	int count;
+	if ( count <= 0 )
+		return false;
 
-	if ( array.isValid() && ( count = nif->rowCount( array ) ) > 0 ) {
-		if ( time <= nif->get<float>( array.child( 0, 0 ), "Time" ) ) {
-			i = j = 0;
-			x = 0.0;
+	if ( time <= keyTime( 0 ) ) {
+		i = j = 0;
+		x = 0.0;
 
-			return true;
-		}
+		return true;
+	}
 
-		if ( time >= nif->get<float>( array.child( count - 1, 0 ), "Time" ) ) {
-			i = j = count - 1;
-			x = 0.0;
+	if ( time >= keyTime( count - 1 ) ) {
+		i = j = count - 1;
+		x = 0.0;
 
-			return true;
-		}
+		return true;
+	}
 
-		if ( i < 0 || i >= count )
-			i = 0;
+	// The last key at or before the time, with one after it
+	auto spans = [&]( int k ) {
+		return k >= 0 && k < count - 1 && keyTime( k ) <= time && time < keyTime( k + 1 );
+	};
 
-		float tI = nif->get<float>( array.child( i, 0 ), "Time" );
+	if ( !spans( i ) ) {
+		if ( spans( i + 1 ) ) {
+			i++;
+		} else {
+			int lo = 0, hi = count - 1;
 
-		if ( time > tI ) {
-			j = i + 1;
-			float tJ;
+			while ( hi - lo > 1 ) {
+				int mid = lo + ( hi - lo ) / 2;
 
-			while ( time >= ( tJ = nif->get<float>( array.child( j, 0 ), "Time" ) ) ) {
-				i  = j++;
-				tI = tJ;
+				if ( keyTime( mid ) <= time )
+					lo = mid;
+				else
+					hi = mid;
 			}
 
-			x = ( time - tI ) / ( tJ - tI );
+			i = lo;
+		}
+	}
 
-			return true;
-		} else if ( time < tI ) {
-			j = i - 1;
-			float tJ;
+	float tI = keyTime( i );
 
-			while ( time <= ( tJ = nif->get<float>( array.child( j, 0 ), "Time" ) ) ) {
-				i  = j--;
-				tI = tJ;
-			}
+	if ( time == tI ) {
+		j = i;
+		x = 0.0;
 
-			x = ( time - tI ) / ( tJ - tI );
+		return true;
+	}
 
-			// Quadratic Bug Fix
+	j = i + 1;
+	x = ( time - tI ) / ( keyTime( j ) - tI );
 
-			// Invert x
-			//	Previously, this branch was causing x to decrement from 1.0.
-			//	(This works fine for linear interpolation apparently)
-			x = 1.0 - x;
-			
-			// Swap I and J
-			//	With x inverted, we must swap I and J or the animation will reverse.
-			auto tmpI = i;
-			i = j;
-			j = tmpI;
+	return true;
+}
 
-			// End Bug Fix
+bool Controller::timeIndex( float time, const NifModel * nif, const QModelIndex & array, int & i, int & j, float & x )
+{
+	if ( !array.isValid() )
+		return false;
 
-			return true;
-		}
+	return findTimeIndex( time, nif->rowCount( array ), [nif, &array]( int k ) {
+		return nif->get<float>( array.child( k, 0 ), "Time" );
+	}, i, j, x );
+}
 
-		j = i;
-		x = 0.0;
+bool Controller::timeIndex( float time, const QVector<float> & times, int & i, int & j, float & x )
+{
+	return findTimeIndex( time, times.count(), [&times]( int k ) { return times[k]; }, i, j, x );
+}
+
+//! Incremented by Controller::invalidateKeys(), each cache of key tracks being cleared once it sees the change
+static std::atomic<int> keyGeneration( 0 );
 
+//! Incremented by Controller::invalidateUpdates(), see Controller::needsUpdate()
+static std::atomic<int> updateGeneration( 0 );
+
+void Controller::invalidateKeys()
+{
+	keyGeneration++;
+	invalidateUpdates();
+}
+
+void Controller::invalidateUpdates()
+{
+	updateGeneration++;
+}
+
+bool Controller::needsUpdate( float time )
+{
+	if ( !dependsOnTimeOnly() )
 		return true;
+
+	float t = ctrlTime( time );
+
+	if ( updatedGeneration == updateGeneration && updatedTime == t )
+		return false;
+
+	updatedGeneration = updateGeneration;
+	updatedTime = t;
+
+	return true;
+}
+
+//! The keys of a key group decoded from the model, see keyTrack()
+template <typename T> struct KeyTrack
+{
+	//! The "Interpolation" of the group
+	int interpolation = 0;
+	QVector<float> times;
+	QVector<T> values;
+	//! The tangents of quadratic keys, empty for other interpolations
+	QVector<float> forward, backward;
+};
+
+/*! The keys in the array \a keys of the key group \a array
+ *
+ * Decoded on first use and kept until Controller::invalidateKeys(), so that
+ * evaluating the keys does not read the model. Each thread keeps its own
+ * tracks, since exports interpolate the keys of their models in parallel.
+ */
+template <typename T> static const KeyTrack<T> & keyTrack( const NifModel * nif, const QModelIndex & array, const QString & keys )
+{
+	static thread_local QHash<QPersistentModelIndex, KeyTrack<T>> tracks;
+	static thread_local int generation = -1;
+
+	if ( generation != keyGeneration ) {
+		tracks.clear();
+		generation = keyGeneration;
 	}
 
-	return false;
+	auto it = tracks.find( array );
+	if ( it != tracks.end() )
+		return it.value();
+
+	KeyTrack<T> track;
+	track.interpolation = nif->get<int>( array, "Interpolation" );
+
+	QModelIndex frames = nif->getIndex( array, keys );
+	int count = frames.isValid() ? nif->rowCount( frames ) : 0;
+
+	track.times.reserve( count );
+	track.values.reserve( count );
+
+	for ( int k = 0; k < count; k++ ) {
+		QModelIndex key = frames.child( k, 0 );
+
+		track.times << nif->get<float>( key, "Time" );
+		track.values << nif->get<T>( key, "Value" );
+
+		if ( track.interpolation == 2 ) {
+			track.forward << nif->get<float>( key, "Forward" );
+			track.backward << nif->get<float>( key, "Backward" );
+		}
+	}
+
+	return tracks.insert( array, track ).value();
 }
 
 template <typename T> bool interpolate( T & value, const QModelIndex & array, float time, int & last )
@@ -365,15 +488,15 @@ template <typename T> bool interpolate( T & value, const QModelIndex & array, fl
 	const NifModel * nif = static_cast<const NifModel *>( array.model() );
 
 	if ( nif && array.isValid() ) {
-		QModelIndex frames = nif->getIndex( array, "Keys" );
+		const KeyTrack<T> & track = keyTrack<T>( nif, array, "Keys" );
 		int next;
 		float x;
 
-		if ( Controller::timeIndex( time, nif, frames, last, next, x ) ) {
-			T v1 = nif->get<T>( frames.child( last, 0 ), "Value" );
-			T v2 = nif->get<T>( frames.child( next, 0 ), "Value" );
+		if ( Controller::timeIndex( time, track.times, last, next, x ) ) {
+			const T & v1 = track.values[last];
+			const T & v2 = track.values[next];
 
-			switch ( nif->get<int>( array, "Interpolation" ) ) {
+			switch ( track.interpolation ) {
 			
 			case 2:
 			{
@@ -385,9 +508,9 @@ template <typename T> bool interpolate( T & value, const QModelIndex & array, fl
 				*/
 
 				// Tangent 1
-				float t1 = nif->get<float>( frames.child( last, 0 ), "Backward" );
+				float t1 = track.backward[last];
 				// Tangent 2
-				float t2 = nif->get<float>( frames.child( next, 0 ), "Forward" );
+				float t2 = track.forward[next];
 
 				float x2 = x * x;
 				float x3 = x2 * x;
@@ -444,10 +567,10 @@ template <> bool Controller::interpolate( bool & value, const QModelIndex & arra
 	const NifModel * nif = static_cast<const NifModel *>( array.model() );
 
 	if ( nif && array.isValid() ) {
-		QModelIndex frames = nif->getIndex( array, "Keys" );
+		const KeyTrack<int> & track = keyTrack<int>( nif, array, "Keys" );
 
-		if ( timeIndex( time, nif, frames, last, next, x ) ) {
-			value = nif->get<int>( frames.child( last, 0 ), "Value" );
+		if ( timeIndex( time, track.times, last, next, x ) ) {
+			value = track.values[last];
 
 			return true;
 		}
@@ -484,11 +607,11 @@ template <> bool Controller::interpolate( Matrix & value, const QModelIndex & ar
 			break;
 		default:
 			{
-				QModelIndex frames = nif->getIndex( array, "Quaternion Keys" );
+				const KeyTrack<Quat> & track = keyTrack<Quat>( nif, array, "Quaternion Keys" );
 
-				if ( timeIndex( time, nif, frames, last, next, x ) ) {
-					Quat v1 = nif->get<Quat>( frames.child( last, 0 ), "Value" );
-					Quat v2 = nif->get<Quat>( frames.child( next, 0 ), "Value" );
+				if ( timeIndex( time, track.times, last, next, x ) ) {
+					Quat v1 = track.values[last];
+					Quat v2 = track.values[next];
 
 					if ( Quat::dotproduct( v1, v2 ) < 0 )
 						v1.negate(); // don't take the long path
@@ -528,26 +651,24 @@ Modified by: Theo
 - removed point structure in favor of arbitrary sized float array
 **********************************************************************/
 
-/*! Used to enable static arrays to be members of vectors */
+/*! A view of the control points from an offset, zero past the end like missing rows of the model */
 template <typename T>
 struct qarray
 {
-	qarray( const QModelIndex & array, uint off = 0 )
+	qarray( const QVector<T> & array, uint off = 0 )
 		: array_( array ), off_( off )
 	{
-		nif_ = static_cast<const NifModel *>( array_.model() );
 	}
 	qarray( const qarray & other, uint off = 0 )
-		: nif_( other.nif_ ), array_( other.array_ ), off_( other.off_ + off )
+		: array_( other.array_ ), off_( other.off_ + off )
 	{
 	}
 
 	T operator[]( uint index ) const
 	{
-		return nif_->get<T>( array_.child( index + off_, 0 ) );
+		return array_.value( index + off_ );
 	}
-	const NifModel * nif_;
-	const QModelIndex & array_;
+	const QVector<T> & array_;
 	uint off_;
 };
 
@@ -647,29 +768,50 @@ static void compute_intervals( int * u, int n, int t )
 	}
 }
 
+/*! The blending values at v of the control points which have any weight
+ *
+ * Only the t control points from \a first on are non zero, so the basis is
+ * found once for all the channels of an interpolator.
+ */
+static void compute_basis( const QVector<int> & u, int n, int t, float v, QVector<float> & basis, int & first )
+{
+	basis.clear();
+	first = 0;
+
+	for ( int k = 0; k <= n; k++ ) {
+		if ( !( u[k] <= v && v < u[k + t] ) )
+			continue;
+
+		if ( basis.isEmpty() )
+			first = k;
+
+		basis.append( blend( k, t, const_cast<int *>( u.constData() ), v ) );
+	}
+}
+
 template <typename T>
-static void compute_point( int * u, int n, int t, float v, qarray<short> & control, T & output, float mult, float bias )
+static void compute_point( const QVector<float> & basis, int first, qarray<short> & control, T & output, float mult, float bias )
 {
 	// initialize the variables that will hold our output
 	int l = SplineTraits<T>::CountOf();
 	SplineTraits<T>::Init( output );
 
-	for ( int k = 0; k <= n; k++ ) {
-		qarray<short> qa( control, k * l );
-		SplineTraits<T>::Compute( output, qa, blend( k, t, u, v ) );
+	for ( int b = 0; b < basis.count(); b++ ) {
+		qarray<short> qa( control, ( first + b ) * l );
+		SplineTraits<T>::Compute( output, qa, basis[b] );
 	}
 
 	SplineTraits<T>::Adjust( output, mult, bias );
 }
 
 template <typename T>
-bool bsplineinterpolate( T & value, int degree, float interval, uint nctrl, const QModelIndex & array, uint off, float mult, float bias )
+bool bsplineinterpolate( T & value, int degree, float interval, uint nctrl, const QVector<short> & control, uint off,
+						 const QVector<float> & basis, int first, float mult, float bias )
 {
 	if ( off == USHRT_MAX )
 		return false;
 
-	qarray<short> subArray( array, off );
-	int t = degree + 1;
+	qarray<short> subArray( control, off );
 	int n = nctrl - 1;
 	int l = SplineTraits<T>::CountOf();
 
@@ -679,10 +821,7 @@ bool bsplineinterpolate( T & value, int degree, float interval, uint nctrl, cons
 		SplineTraits<T>::Compute( value, sa, 1.0f );
 		SplineTraits<T>::Adjust( value, mult, bias );
 	} else {
-		int * u = new int[ n + t + 1 ];
-		compute_intervals( u, n, t );
-		compute_point( u, n, t, interval, subArray, value, mult, bias );
-		delete [] u;
+		compute_point( basis, first, subArray, value, mult, bias );
 	}
 
 	return true;
@@ -755,6 +894,9 @@ bool BSplineTransformInterpolator::update( const NifModel * nif, const QModelInd
 		if ( iBasis.isValid() )
 			nCtrl = nif->get<uint>( iBasis, "Num Control Points" );
 
+		// Decoded on the next updateTransform()
+		controlGeneration = -1;
+
 		lTrans  = nif->getIndex( index, "Translation" );
 		lRotate = nif->getIndex( index, "Rotation" );
 		lScale  = nif->getIndex( index, "Scale" );
@@ -777,14 +919,28 @@ bool BSplineTransformInterpolator::update( const NifModel * nif, const QModelInd
 
 bool BSplineTransformInterpolator::updateTransform( Transform & transform, float time )
 {
+	// The quantized control points and the knots, read again after the model changed
+	if ( controlGeneration != keyGeneration ) {
+		const NifModel * nif = static_cast<const NifModel *>( iControl.model() );
+
+		control = ( nif && iControl.isValid() ) ? nif->getArray<short>( iControl ) : QVector<short>();
+		knots.resize( nCtrl + degree + 1 );
+		compute_intervals( knots.data(), nCtrl - 1, degree + 1 );
+		controlGeneration = keyGeneration;
+	}
+
 	float interval = ( ( time - start ) / ( stop - start ) ) * float(nCtrl - degree);
+
+	if ( nCtrl > 0 )
+		compute_basis( knots, nCtrl - 1, degree + 1, interval, basis, basisFirst );
+
 	Quat q = transform.rotation.toQuat();
 
-	if ( ::bsplineinterpolate<Quat>( q, degree, interval, nCtrl, iControl, lRotateOff, lRotateMult, lRotateBias ) )
+	if ( ::bsplineinterpolate<Quat>( q, degree, interval, nCtrl, control, lRotateOff, basis, basisFirst, lRotateMult, lRotateBias ) )
 		transform.rotation.fromQuat( q );
 
-	::bsplineinterpolate<Vector3>( transform.translation, degree, interval, nCtrl, iControl, lTransOff, lTransMult, lTransBias );
-	::bsplineinterpolate<float>( transform.scale, degree, interval, nCtrl, iControl, lScaleOff, lScaleMult, lScaleBias );
+	::bsplineinterpolate<Vector3>( transform.translation, degree, interval, nCtrl, control, lTransOff, basis, basisFirst, lTransMult, lTransBias );
+	::bsplineinterpolate<float>( transform.scale, degree, interval, nCtrl, control, lScaleOff, basis, basisFirst, lScaleMult, lScaleBias );
 
 	return true;
 }
@@ -38,6 +38,8 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QObject> // Inherited
 #include <QPersistentModelIndex>
 #include <QString>
+#include <QStringList>
+#include <QVector>
 
 
 //! @file glcontroller.h Controller, Interpolator, TransformInterpolator, BSplineTransformInterpolator
@@ -82,9 +84,22 @@ public:
 	//! Update for specified time
 	virtual void updateTime( float time ) = 0;
 
+	//! Append the values the last updateTime() animated, besides node transforms; see IControllable::sampleValues()
+	virtual void sampleValues( QVector<float> & values, QStringList * names ) const;
+
 	//! Determine the controller time based on the specified time
 	float ctrlTime( float time ) const;
 
+	//! Whether the result of updateTime() is the same for the same controller time
+	virtual bool dependsOnTimeOnly() const { return true; }
+
+	/*! Whether updateTime() could give another result than at the last scene time it was called for
+	 *
+	 * False when the controller time is the same, as while paused or clamped
+	 * outside [start, stop], and nothing was invalidated since.
+	 */
+	bool needsUpdate( float time );
+
 	/*! Interpolate given the index of an array
 	 *
 	 * @param[out] value		The value being interpolated
@@ -114,12 +129,23 @@ public:
 	 * @param[out] fraction		The current distance between the prev and next frame, as a fraction
 	 */
 	static bool timeIndex( float inTime, const NifModel * nif, const QModelIndex & keysArray, int & prevFrame, int & nextFrame, float & fraction );
+	//! As above, with the times of the keys already read from the model
+	static bool timeIndex( float inTime, const QVector<float> & times, int & prevFrame, int & nextFrame, float & fraction );
+
+	//! Read the keys that interpolate() decoded from the model again, after the model changed
+	static void invalidateKeys();
+	//! Update all controllers on the next frame, after their targets or times changed
+	static void invalidateUpdates();
 
 protected:
 
 	QPersistentModelIndex iBlock;
 	QPersistentModelIndex iInterpolator;
 	QPersistentModelIndex iData;
+
+	//! The controller time and Controller::invalidateUpdates() generation of the last updateTime()
+	float updatedTime = 0;
+	int updatedGeneration = -1;
 };
 
 template <typename T> bool Controller::interpolate( T & value, const QModelIndex & data, const QString & arrayid, float time, int & lastindex )
@@ -176,6 +202,15 @@ protected:
 	float lTransBias, lRotateBias, lScaleBias;
 	uint nCtrl;
 	int degree;
+
+	//! The "Short Control Points" of the spline data and the knots for nCtrl
+	QVector<short> control;
+	QVector<int> knots;
+	//! The Controller::invalidateKeys() generation control and knots were decoded for
+	int controlGeneration = -1;
+	//! The weights of the control points from basisFirst on at the last time
+	QVector<float> basis;
+	int basisFirst = 0;
 };
 
 
@@ -32,15 +32,20 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "glmarker.h"
 
-#include <QOpenGLContext>
+#include "gltools.h"
 
 void drawMarker( const GLMarker * marker )
 {
-	glEnableClientState( GL_VERTEX_ARRAY );
-
-	glVertexPointer( 3, GL_FLOAT, 0, marker->verts );
-
-	glDrawElements( GL_TRIANGLES, marker->nf * 3, GL_UNSIGNED_SHORT, marker->faces );
-
-	glDisableClientState( GL_VERTEX_ARRAY );
+	// Uploaded by the first window drawing the marker, then drawn from the buffer objects by all
+	StaticGeometry & geometry = staticGeometry( marker, 0, [marker]( StaticGeometry & g ) {
+		g.vertices.reserve( marker->nv );
+		for ( int v = 0; v < marker->nv; v++ )
+			g.vertices << Vector3( marker->verts[v * 3], marker->verts[v * 3 + 1], marker->verts[v * 3 + 2] );
+
+		g.triangles.reserve( marker->nf );
+		for ( int f = 0; f < marker->nf; f++ )
+			g.triangles << Triangle( marker->faces[f * 3], marker->faces[f * 3 + 1], marker->faces[f * 3 + 2] );
+	} );
+
+	geometry.draw();
 }
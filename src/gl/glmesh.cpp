@@ -33,17 +33,23 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "glmesh.h"
 #include "config.h"
 #include "settings.h"
+#include "functionrunnable.h"
 
 #include "controllers.h"
 #include "glscene.h"
 #include "gltools.h"
+#include "half.h"
+#include "nvtristripwrapper.h"
 
-#include <QBuffer>
 #include <QDebug>
 #include <QSettings>
+#include <QtEndian>
 
 #include <QOpenGLFunctions>
 
+#include <algorithm>
+#include <numeric>
+
 
 //! @file glmesh.cpp Scene management for visible meshes such as NiTriShapes.
 
@@ -51,6 +57,62 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 Shape::Shape( Scene * s, const QModelIndex & b ) : Node( s, b )
 {
 	shapeNumber = s->shapes.count();
+	buffers = QSharedPointer<Buffers>::create();
+	// Not drawn yet, but not undrawn for a while either
+	lastDrawn = s->transformFrame;
+}
+
+void Shape::shareData()
+{
+	buffers = QSharedPointer<Buffers>::create();
+
+	if ( verts.isEmpty() )
+		return;
+
+	for ( Shape * shape : scene->shapes ) {
+		if ( shape == this || shape->verts.count() != verts.count() || shape->triangles.count() != triangles.count() )
+			continue;
+
+		bool sameData = iData.isValid() && shape->iData == iData;
+
+		if ( !sameData && !( shape->verts == verts && shape->triangles == triangles ) )
+			continue;
+
+		// The arrays are implicitly shared, so that the buffer objects see the same data
+		if ( shape->verts == verts )
+			verts = shape->verts;
+		if ( shape->norms == norms )
+			norms = shape->norms;
+		if ( shape->colors == colors )
+			colors = shape->colors;
+		if ( shape->triangles == triangles )
+			triangles = shape->triangles;
+
+		// The other arrays are only drawn from memory, sharing them saves their copies
+		if ( shape->tangents == tangents )
+			tangents = shape->tangents;
+		if ( shape->bitangents == bitangents )
+			bitangents = shape->bitangents;
+		if ( shape->indices == indices )
+			indices = shape->indices;
+		for ( int c = 0; c < coords.count() && c < shape->coords.count(); c++ ) {
+			if ( shape->coords.at( c ) == coords.at( c ) )
+				coords[c] = shape->coords.at( c );
+		}
+		for ( int s = 0; s < tristrips.count() && s < shape->tristrips.count(); s++ ) {
+			if ( shape->tristrips.at( s ) == tristrips.at( s ) )
+				tristrips[s] = shape->tristrips.at( s );
+		}
+
+		// Skinned shapes upload their vertices every frame and keep their own buffers
+		bool same = verts.constData() == shape->verts.constData() && norms.constData() == shape->norms.constData()
+			&& colors.constData() == shape->colors.constData() && triangles.constData() == shape->triangles.constData();
+
+		if ( same && !iSkin.isValid() && !shape->iSkin.isValid() )
+			buffers = shape->buffers;
+
+		break;
+	}
 }
 
 Mesh::Mesh( Scene * s, const QModelIndex & b ) : Shape( s, b )
@@ -78,7 +140,6 @@ void Mesh::clear()
 	tristrips.clear();
 	weights.clear();
 	partitions.clear();
-	sortedTriangles.clear();
 	indices.clear();
 	transVerts.clear();
 	transNorms.clear();
@@ -106,6 +167,293 @@ void Shape::setController( const NifModel * nif, const QModelIndex & iController
 	}
 }
 
+void Shape::updateBoneNodes( int root )
+{
+	if ( boneNodesFor.revision == scene->hierarchyRevision && boneNodesFor.root == root && boneNodesFor.bones == bones )
+		return;
+
+	boneNodesFor.bones = bones;
+	boneNodesFor.root = root;
+	boneNodesFor.revision = scene->hierarchyRevision;
+
+	skeletonNode = findParent( root );
+
+	boneNodes.fill( QPointer<Node>(), bones.count() );
+
+	if ( skeletonNode ) {
+		for ( int b = 0; b < bones.count(); b++ )
+			boneNodes[b] = skeletonNode->findChild( bones[b] );
+	}
+}
+
+Property * Shape::textureProperty() const
+{
+	if ( bssp )
+		return bssp;
+
+	return findProperty<TexturingProperty>();
+}
+
+//! Bytes of an array not counted yet, adding it to \a counted
+template <typename T> static qint64 arrayBytes( const QVector<T> & array, QSet<const void *> & counted )
+{
+	if ( array.capacity() == 0 || counted.contains( array.constData() ) )
+		return 0;
+
+	counted.insert( array.constData() );
+	return qint64( array.capacity() ) * sizeof( T );
+}
+
+void Shape::memoryUsage( GeometryUsage & usage, QSet<const void *> & counted ) const
+{
+	usage.shapes++;
+	if ( pagedOut )
+		usage.paged++;
+
+	usage.geometry += arrayBytes( verts, counted ) + arrayBytes( norms, counted ) + arrayBytes( colors, counted )
+		+ arrayBytes( tangents, counted ) + arrayBytes( bitangents, counted ) + arrayBytes( triangles, counted )
+		+ arrayBytes( indices, counted );
+	for ( const QVector<Vector2> & uv : coords )
+		usage.geometry += arrayBytes( uv, counted );
+	for ( const QVector<quint16> & strip : tristrips )
+		usage.geometry += arrayBytes( strip, counted );
+
+	usage.transformed += arrayBytes( transVerts, counted ) + arrayBytes( transNorms, counted )
+		+ arrayBytes( transColors, counted ) + arrayBytes( transColorsNoAlpha, counted )
+		+ arrayBytes( transTangents, counted ) + arrayBytes( transBitangents, counted );
+
+	usage.skin += arrayBytes( bones, counted ) + arrayBytes( weights, counted ) + arrayBytes( partitions, counted );
+	for ( const BoneWeights & bw : weights )
+		usage.skin += arrayBytes( bw.weights, counted );
+	for ( const SkinPartition & part : partitions ) {
+		usage.skin += arrayBytes( part.boneMap, counted ) + arrayBytes( part.vertexMap, counted )
+			+ arrayBytes( part.weights, counted ) + arrayBytes( part.triangles, counted );
+		for ( const QVector<quint16> & strip : part.tristrips )
+			usage.skin += arrayBytes( strip, counted );
+	}
+
+	if ( buffers && !counted.contains( buffers.data() ) ) {
+		counted.insert( buffers.data() );
+		usage.buffers += buffers->vertices.size() + buffers->normals.size() + buffers->tangents.size()
+			+ buffers->bitangents.size() + buffers->colors.size() + buffers->triangles.size();
+	}
+}
+
+//! Bytes of an array, whether or not it is shared
+template <typename T> static qint64 bytes( const QVector<T> & array )
+{
+	return qint64( array.capacity() ) * sizeof( T );
+}
+
+qint64 Shape::geometryBytes() const
+{
+	qint64 total = bytes( verts ) + bytes( norms ) + bytes( colors ) + bytes( tangents ) + bytes( bitangents )
+		+ bytes( triangles ) + bytes( indices ) + bytes( transColorsNoAlpha );
+	for ( const QVector<Vector2> & uv : coords )
+		total += bytes( uv );
+	for ( const QVector<quint16> & strip : tristrips )
+		total += bytes( strip );
+
+	return total;
+}
+
+bool Shape::isPageable() const
+{
+	// Controllers such as morphs and UV animation write to the arrays, skinning reads them every frame
+	return !pagedOut && !verts.isEmpty() && !iSkin.isValid() && controllers.isEmpty();
+}
+
+void Shape::pageOut()
+{
+	verts = QVector<Vector3>();
+	norms = QVector<Vector3>();
+	colors = QVector<Color4>();
+	tangents = QVector<Vector3>();
+	bitangents = QVector<Vector3>();
+	coords.clear();
+	triangles = QVector<Triangle>();
+	tristrips.clear();
+	indices = QVector<quint16>();
+
+	transVerts = QVector<Vector3>();
+	transNorms = QVector<Vector3>();
+	transColors = QVector<Color4>();
+	transColorsNoAlpha = QVector<Color4>();
+	transTangents = QVector<Vector3>();
+	transBitangents = QVector<Vector3>();
+
+	pickTree.clear();
+	pickTriangles = QVector<Triangle>();
+	pickStrips.clear();
+
+	// Deletes the buffer objects unless another shape still draws from them
+	buffers = QSharedPointer<Buffers>::create();
+
+	pagedOut = true;
+}
+
+void Shape::pageIn()
+{
+	const NifModel * nif = static_cast<const NifModel *>( iBlock.model() );
+	if ( !pagedOut || !nif )
+		return;
+
+	readGeometry( nif );
+	transformShapes();
+}
+
+void Shape::updatePickTree() const
+{
+	bool rebuild = pickTriangles.constData() != triangles.constData() || pickTriangles.count() != triangles.count()
+		|| pickStrips.count() != tristrips.count() || pickTree.vertices().count() != transVerts.count();
+
+	for ( int s = 0; s < tristrips.count() && !rebuild; s++ )
+		rebuild = pickStrips.at( s ).constData() != tristrips.at( s ).constData();
+
+	if ( rebuild ) {
+		pickTriangles = triangles;
+		pickStrips = tristrips;
+		pickTree.build( transVerts, tristrips.isEmpty() ? triangles : triangles + triangulate( tristrips ) );
+	} else if ( pickTree.vertices().constData() != transVerts.constData() ) {
+		// The tree shares the vertices it was fitted to, so skinning or morphing them detaches a new array
+		pickTree.refit( transVerts );
+	}
+}
+
+bool Shape::pick( const Vector3 & origin, const Vector3 & direction, BVH::Hit & hit ) const
+{
+	if ( isHidden() || transVerts.isEmpty() )
+		return false;
+
+	// Rigid shapes are drawn with their view transform, skinned ones are skinned into view space
+	Vector3 o = origin, d = direction;
+
+	if ( transformRigid ) {
+		const Transform & t = viewTrans();
+		Matrix inv = t.rotation.inverted();
+
+		// The distance along the ray stays the same, as both are transformed alike
+		o = inv * ( origin - t.translation ) / t.scale;
+		d = inv * direction / t.scale;
+	}
+
+	updatePickTree();
+
+	return pickTree.intersect( o, d, hit );
+}
+
+int Shape::nearestVertex( const BVH::Hit & hit ) const
+{
+	if ( hit.triangle < 0 || hit.triangle >= pickTree.triangles().count() )
+		return -1;
+
+	const Triangle & tri = pickTree.triangles().at( hit.triangle );
+	const QVector<Vector3> & v = pickTree.vertices();
+
+	Vector3 point = v.at( tri.v1() ) * ( 1 - hit.u - hit.v ) + v.at( tri.v2() ) * hit.u + v.at( tri.v3() ) * hit.v;
+
+	int nearest = tri.v1();
+	for ( int c = 1; c < 3; c++ ) {
+		if ( ( v.at( tri[c] ) - point ).squaredLength() < ( v.at( nearest ) - point ).squaredLength() )
+			nearest = tri[c];
+	}
+
+	return nearest;
+}
+
+void Shape::bindBuffer( GLBuffer<Vector3> & buffer, const QVector<Vector3> & data ) const
+{
+	if ( transformRigid )
+		buffer.bind( data );
+	else
+		buffer.bindDynamic( data );
+}
+
+void Shape::drawPoints() const
+{
+	if ( transVerts.isEmpty() )
+		return;
+
+	glEnableClientState( GL_VERTEX_ARRAY );
+	bindBuffer( buffers->vertices, transVerts );
+	glVertexPointer( 3, GL_FLOAT, 0, nullptr );
+
+	glDrawArrays( GL_POINTS, 0, transVerts.count() );
+
+	buffers->vertices.release();
+	glDisableClientState( GL_VERTEX_ARRAY );
+}
+
+void Shape::drawTriangles() const
+{
+	if ( transVerts.isEmpty() || triangles.isEmpty() )
+		return;
+
+	glEnableClientState( GL_VERTEX_ARRAY );
+	bindBuffer( buffers->vertices, transVerts );
+	glVertexPointer( 3, GL_FLOAT, 0, nullptr );
+
+	buffers->triangles.bind( triangles );
+	glDrawElements( GL_TRIANGLES, triangles.count() * 3, GL_UNSIGNED_SHORT, nullptr );
+
+	buffers->triangles.release();
+	buffers->vertices.release();
+	glDisableClientState( GL_VERTEX_ARRAY );
+}
+
+void Shape::drawVectors( const QVector<Vector3> & vectors, GLBuffer<Vector3> & buffer, float forward, float backward ) const
+{
+	const int count = qMin( transVerts.count(), vectors.count() );
+	if ( count == 0 )
+		return;
+
+	if ( !(scene->options & Scene::DisableShaders) && scene->renderer->useOverlay( "selection_vectors.prog" ) ) {
+		scene->renderer->setOverlayUniform( "forward", forward );
+		scene->renderer->setOverlayUniform( "backward", backward );
+
+		// Each point is expanded to its lines by the geometry shader
+		glEnableClientState( GL_VERTEX_ARRAY );
+		bindBuffer( buffers->vertices, transVerts );
+		glVertexPointer( 3, GL_FLOAT, 0, nullptr );
+
+		glEnableClientState( GL_NORMAL_ARRAY );
+		bindBuffer( buffer, vectors );
+		glNormalPointer( GL_FLOAT, 0, nullptr );
+
+		glDrawArrays( GL_POINTS, 0, count );
+
+		buffer.release();
+		glDisableClientState( GL_NORMAL_ARRAY );
+		glDisableClientState( GL_VERTEX_ARRAY );
+
+		scene->renderer->stopProgram();
+		return;
+	}
+
+	VertexBatch lines;
+
+	for ( int v = 0; v < count; v++ ) {
+		const Vector3 & p = transVerts.at( v );
+		const Vector3 & d = vectors.at( v );
+
+		lines.add( p );
+		lines.add( p + d * forward );
+
+		if ( backward > 0 ) {
+			lines.add( p );
+			lines.add( p - d * backward );
+		}
+	}
+
+	lines.draw();
+}
+
+void Shape::updateProgramCache( const NifModel * nif, const QModelIndex & index )
+{
+	if ( !index.isValid() || index == nif->getHeader() || programCache.blocks.contains( index ) )
+		programCache.revision++;
+}
+
 void Shape::updateShaderProperties( const NifModel * nif )
 {
 	QVector<qint32> props = nif->getLinkArray( iBlock, "BS Properties" );
@@ -179,6 +527,7 @@ void Shape::boneSphere( const NifModel * nif, const QModelIndex & index ) const
 void Mesh::update( const NifModel * nif, const QModelIndex & index )
 {
 	Node::update( nif, index );
+	updateProgramCache( nif, index );
 
 	if ( !iBlock.isValid() || !index.isValid() )
 		return;
@@ -193,6 +542,7 @@ void Mesh::update( const NifModel * nif, const QModelIndex & index )
 	}
 
 	updateData |= ( iData == index ) || ( iTangentData == index );
+	updateData |= nif->isNiBlock( index, "NiDataStream" ) && nif->getChildLinks( id() ).contains( nif->getBlockNumber( index ) );
 	updateSkin |= ( iSkin == index );
 	updateSkin |= ( iSkinData == index );
 	updateSkin |= ( iSkinPart == index );
@@ -205,26 +555,14 @@ void Mesh::update( const NifModel * nif, const QModelIndex & index )
 		updateShaderProperties( nif );
 
 	if ( iBlock == index ) {
-		// NiMesh presents a problem because we are almost guaranteed to have multiple "data" blocks
-		// for eg. vertices, indices, normals, texture data etc.
-#ifndef QT_NO_DEBUG
-
+		// NiMesh references a data stream per vertex attribute or index buffer, see readMeshStreams()
 		if ( nif->checkVersion( 0x14050000, 0 ) && nif->inherits( iBlock, "NiMesh" ) ) {
-			qDebug() << nif->get<ushort>( iBlock, "Num Submeshes" ) << " submeshes";
 			iData = nif->getIndex( iBlock, "Datas" );
-
-			if ( iData.isValid() ) {
-				qDebug() << "Got " << nif->rowCount( iData ) << " rows of data";
-				updateData = true;
-			} else {
-				qDebug() << "Did not find data in NiMesh ???";
-			}
-
+			updateData = true;
+			updateBounds = true;
 			return;
 		}
 
-#endif
-
 		for ( const auto link : nif->getChildLinks( id() ) ) {
 			QModelIndex iChild = nif->getBlock( link );
 			if ( !iChild.isValid() )
@@ -278,313 +616,507 @@ bool Mesh::isHidden() const
 	);
 }
 
-bool compareTriangles( const QPair<int, float> & tri1, const QPair<int, float> & tri2 )
+//! A component of the elements of a NiDataStream, as named by the "Component Semantics" of a NiMesh
+struct StreamComponent
 {
-	return ( tri1.second < tri2.second );
+	//! The ComponentFormat, the number of values << 16 | their size << 8 | the type
+	quint32 format = 0;
+	//! Byte offset within the element
+	int offset = 0;
+	QString semantic;
+	int index = 0;
+
+	int values() const { return int( ( format >> 16 ) & 0xFF ); }
+	int size() const { return int( ( format >> 8 ) & 0xFF ); }
+	//! The type in groups of four formats from F_INT8_1: int8, uint8, normint8, normuint8, ... float16, float32
+	int type() const { return ( ( format & 0xFF ) >= 1 && ( format & 0xFF ) <= 0x38 ) ? int( ( format & 0xFF ) - 1 ) / 4 : -1; }
+	//! F_NORMUINT8_4_BGRA
+	bool isBGRA() const { return ( format & 0xFF ) == 0x3C; }
+};
+
+//! A NiDataStream referenced by a NiMesh, with its components and the element of each submesh
+struct MeshStream
+{
+	QByteArray data;
+	int usage = -1;
+	int stride = 0;
+	int count = 0;
+	QVector<StreamComponent> components;
+	//! The first element and number of elements of each submesh
+	QVector<QPair<quint32, quint32>> submeshes;
+};
+
+//! Convert \a num values of a stream component starting at \a p to floats
+static void readComponentValues( const char * p, const StreamComponent & c, int num, float * out )
+{
+	if ( c.isBGRA() ) {
+		const quint8 * b = reinterpret_cast<const quint8 *>( p );
+		const float bgra[4] = { b[2] / 255.0f, b[1] / 255.0f, b[0] / 255.0f, b[3] / 255.0f };
+		std::copy( bgra, bgra + std::min( num, 4 ), out );
+		return;
+	}
+
+	switch ( c.type() ) {
+	case 0:
+		for ( int v = 0; v < num; v++ )
+			out[v] = qint8( p[v] );
+		break;
+	case 1:
+		for ( int v = 0; v < num; v++ )
+			out[v] = quint8( p[v] );
+		break;
+	case 2:
+		for ( int v = 0; v < num; v++ )
+			out[v] = std::max( qint8( p[v] ) / 127.0f, -1.0f );
+		break;
+	case 3:
+		for ( int v = 0; v < num; v++ )
+			out[v] = quint8( p[v] ) / 255.0f;
+		break;
+	case 4:
+		for ( int v = 0; v < num; v++ )
+			out[v] = qFromLittleEndian<qint16>( p + v * 2 );
+		break;
+	case 5:
+		for ( int v = 0; v < num; v++ )
+			out[v] = qFromLittleEndian<quint16>( p + v * 2 );
+		break;
+	case 6:
+		for ( int v = 0; v < num; v++ )
+			out[v] = std::max( qFromLittleEndian<qint16>( p + v * 2 ) / 32767.0f, -1.0f );
+		break;
+	case 7:
+		for ( int v = 0; v < num; v++ )
+			out[v] = qFromLittleEndian<quint16>( p + v * 2 ) / 65535.0f;
+		break;
+	case 8:
+		for ( int v = 0; v < num; v++ )
+			out[v] = float( qFromLittleEndian<qint32>( p + v * 4 ) );
+		break;
+	case 9:
+		for ( int v = 0; v < num; v++ )
+			out[v] = float( qFromLittleEndian<quint32>( p + v * 4 ) );
+		break;
+	case 10:
+		for ( int v = 0; v < num; v++ )
+			out[v] = std::max( float( qFromLittleEndian<qint32>( p + v * 4 ) / 2147483647.0 ), -1.0f );
+		break;
+	case 11:
+		for ( int v = 0; v < num; v++ )
+			out[v] = float( qFromLittleEndian<quint32>( p + v * 4 ) / 4294967295.0 );
+		break;
+	case 12:
+		{
+			uint16_t h[4];
+			memcpy( h, p, std::min( num, 4 ) * sizeof( uint16_t ) );
+			half_to_float_n( h, out, size_t( std::min( num, 4 ) ) );
+		}
+		break;
+	case 13:
+		memcpy( out, p, num * sizeof( float ) );
+		break;
+	default:
+		std::fill( out, out + num, 0.0f );
+		break;
+	}
 }
 
-void Mesh::transform()
+//! Read a component of every element of a stream into an array of vectors or colors
+/*!
+ * Tightly packed 32 bit floats of the width of T are copied in one go, as
+ * the streams hold the vertex data in the layout of the GPU. Missing values
+ * are set to \a fill.
+ */
+template <typename T> static QVector<T> readStreamComponent( const MeshStream & stream, const StreamComponent & c, float fill )
 {
-	const NifModel * nif = static_cast<const NifModel *>( iBlock.model() );
+	const int width = int( sizeof( T ) / sizeof( float ) );
+	const int num = std::min( c.values(), width );
+	const char * src = stream.data.constData() + c.offset;
 
-	if ( !nif || !iBlock.isValid() ) {
-		clear();
-		return;
+	QVector<T> out( stream.count );
+	float * dst = reinterpret_cast<float *>( out.data() );
+
+	if ( c.type() == 13 && num == width && stream.stride == int( sizeof( T ) ) ) {
+		memcpy( dst, src, size_t( stream.count ) * sizeof( T ) );
+		return out;
 	}
 
-	if ( updateData ) {
-		updateData = false;
+	for ( int e = 0; e < stream.count; e++, src += stream.stride, dst += width ) {
+		readComponentValues( src, c, num, dst );
+		std::fill( dst + num, dst + width, fill );
+	}
 
-		// update for NiMesh
-		if ( nif->checkVersion( 0x14050000, 0 ) && nif->inherits( iBlock, "NiMesh" ) ) {
-#ifndef QT_NO_DEBUG
-			// do stuff
-			qDebug() << "Entering NiMesh decoding...";
-			// mesh primitive type
-			QString meshPrimitiveType = NifValue::enumOptionName( "MeshPrimitiveType", nif->get<uint>( iData, "Primitive Type" ) );
-			qDebug() << "Mesh uses" << meshPrimitiveType;
-
-			for ( int i = 0; i < nif->rowCount( iData ); i++ ) {
-				// each data reference is to a single data stream
-				quint32 stream = nif->getLink( iData.child( i, 0 ), "Stream" );
-				qDebug() << "Data stream: " << stream;
-				// can have multiple submeshes, unsure of exact meaning
-				ushort numSubmeshes = nif->get<ushort>( iData.child( i, 0 ), "Num Submeshes" );
-				qDebug() << "Submeshes: " << numSubmeshes;
-				QPersistentModelIndex submeshMap = nif->getIndex( iData.child( i, 0 ), "Submesh To Region Map" );
-
-				for ( int j = 0; j < numSubmeshes; j++ ) {
-					qDebug() << "Submesh" << j << "maps to region" << nif->get<ushort>( submeshMap.child( j, 0 ) );
-				}
+	return out;
+}
 
-				// each stream can have multiple components, and each has a starting index
-				QMap<uint, QString> componentIndexMap;
-				int numComponents = nif->get<int>( iData.child( i, 0 ), "Num Components" );
-				qDebug() << "Components: " << numComponents;
-				// semantics determine the usage
-				QPersistentModelIndex componentSemantics = nif->getIndex( iData.child( i, 0 ), "Component Semantics" );
-
-				for ( int j = 0; j < numComponents; j++ ) {
-					QString name = nif->get<QString>( componentSemantics.child( j, 0 ), "Name" );
-					uint index = nif->get<uint>( componentSemantics.child( j, 0 ), "Index" );
-					qDebug() << "Component" << name << "at position" << index << "of component" << j << "in stream" << stream;
-					componentIndexMap.insert( j, QString( "%1 %2" ).arg( name ).arg( index ) );
-				}
+//! Read the indices of an index stream, as 16 or 32 bit unsigned integers
+static QVector<quint32> readStreamIndices( const MeshStream & stream, const StreamComponent & c )
+{
+	QVector<quint32> out( stream.count );
+	const char * src = stream.data.constData() + c.offset;
+
+	for ( int e = 0; e < stream.count; e++, src += stream.stride ) {
+		if ( c.size() == 4 )
+			out[e] = qFromLittleEndian<quint32>( src );
+		else if ( c.size() == 2 )
+			out[e] = qFromLittleEndian<quint16>( src );
+		else
+			out[e] = quint8( *src );
+	}
 
-				// now the data stream itself...
-				QPersistentModelIndex dataStream = nif->getBlock( stream );
-				QByteArray streamData = nif->get<QByteArray>( nif->getIndex( dataStream, "Data" ).child( 0, 0 ) );
-				QBuffer streamBuffer( &streamData );
-				streamBuffer.open( QIODevice::ReadOnly );
-				// probably won't use this
-				QDataStream streamReader( &streamData, QIODevice::ReadOnly );
-				// we should probably check the header here, but we expect things to be little endian
-				streamReader.setByteOrder( QDataStream::LittleEndian );
-				// each region exists within the data stream at the specified index
-				quint32 numRegions = nif->get<quint32>( dataStream, "Num Regions" );
-				QPersistentModelIndex regions = nif->getIndex( dataStream, "Regions" );
-				quint32 totalIndices = 0;
-
-				if ( regions.isValid() ) {
-					qDebug() << numRegions << " regions in this stream";
-
-					for ( quint32 j = 0; j < numRegions; j++ ) {
-						qDebug() << "Start index: " << nif->get<quint32>( regions.child( j, 0 ), "Start Index" );
-						qDebug() << "Num indices: " << nif->get<quint32>( regions.child( j, 0 ), "Num Indices" );
-						totalIndices += nif->get<quint32>( regions.child( j, 0 ), "Num Indices" );
-					}
+	return out;
+}
 
-					qDebug() << totalIndices << "total indices in" << numRegions << "regions";
-				}
+void Mesh::readMeshStreams( const NifModel * nif )
+{
+	verts.clear();
+	norms.clear();
+	colors.clear();
+	tangents.clear();
+	bitangents.clear();
+	coords.clear();
+	triangles.clear();
+	tristrips.clear();
+	indices.clear();
 
-				uint numStreamComponents = nif->get<uint>( dataStream, "Num Components" );
-				qDebug() << "Stream has" << numStreamComponents << "components";
-				QPersistentModelIndex streamComponents = nif->getIndex( dataStream, "Component Formats" );
-				// stream components are interleaved, so we need to know their type before we read them
-				QList<uint> typeList;
-
-				for ( uint j = 0; j < numStreamComponents; j++ ) {
-					uint compFormat  = nif->get<uint>( streamComponents.child( j, 0 ) );
-					QString compName = NifValue::enumOptionName( "ComponentFormat", compFormat );
-					qDebug() << "Component format is" << compName;
-					qDebug() << "Stored as a" << compName.split( "_" )[1];
-					typeList.append( compFormat - 1 );
-
-					// this can probably wait until we're reading the stream values
-					QString compNameIndex = componentIndexMap.value( j );
-					QString compType = compNameIndex.split( " " )[0];
-					uint startIndex  = compNameIndex.split( " " )[1].toUInt();
-					qDebug() << "Component" << j << "contains" << compType << "starting at index" << startIndex;
-
-					// try and sort out texcoords here...
-					if ( compType == "TEXCOORD" ) {
-						QVector<Vector2> tempCoords;
-						coords.append( tempCoords );
-						qDebug() << "Assigning coordinate set" << startIndex;
-					}
-				}
+	const int numSubmeshes = nif->get<int>( iBlock, "Num Submeshes" );
+	const quint32 primitive = nif->get<quint32>( iBlock, "Primitive Type" );
 
-				// for each component
-				// get the length
-				// get the underlying type (will probably need OpenEXR to deal with float16 types)
-				// read that type in, k times, where k is the length of the vector
-				// start index will not be 0 if eg. multiple UV maps, but hopefully we don't have multiple components
-
-				for ( uint j = 0; j < totalIndices; j++ ) {
-					for ( uint k = 0; k < numStreamComponents; k++ ) {
-						int typeLength = ( ( typeList[k] & 0x000F0000 ) >> 0x10 );
-						int typeSize = ( ( typeList[k] & 0x00000F00 ) >> 0x08 );
-						qDebug() << "Reading" << typeLength << "values" << typeSize << "bytes";
-
-						NifIStream tempInput( new NifModel, &streamBuffer );
-						QList<NifValue> values;
-						NifValue tempValue;
-
-						// if we had the right types, we could read in Vector etc. and not have the mess below
-						switch ( ( typeList[k] & 0x00000FF0 ) >> 0x04 ) {
-						case 0x10:
-							tempValue.changeType( NifValue::tByte );
-							break;
-						case 0x21:
-							tempValue.changeType( NifValue::tShort );
-							break;
-						case 0x42:
-							tempValue.changeType( NifValue::tInt );
-							break;
-						case 0x43:
-							tempValue.changeType( NifValue::tFloat );
-							break;
-						}
-
-						for ( int l = 0; l < typeLength; l++ ) {
-							tempInput.read( tempValue );
-							values.append( tempValue );
-							qDebug() << tempValue.toString();
-						}
-
-						QString compType = componentIndexMap.value( k ).split( " " )[0];
-						qDebug() << "Will store this value in" << compType;
-
-						// the mess begins...
-						if ( NifValue::enumOptionName( "ComponentFormat", (typeList[k] + 1 ) ) == "F_FLOAT32_3" ) {
-							Vector3 tempVect3( values[0].toFloat(), values[1].toFloat(), values[2].toFloat() );
-
-							if ( compType == "POSITION" ) {
-								verts.append( tempVect3 );
-							} else if ( compType == "NORMAL" ) {
-								norms.append( tempVect3 );
-							}
-						} else if ( compType == "INDEX" ) {
-							indices.append( values[0].toCount() );
-						} else if ( compType == "TEXCOORD" ) {
-							Vector2 tempVect2( values[0].toFloat(), values[1].toFloat() );
-							quint32 coordSet = componentIndexMap.value( k ).split( " " )[1].toUInt();
-							qDebug() << "Need to append" << tempVect2 << "to texcoords" << coordSet;
-							QVector<Vector2> currentSet = coords[coordSet];
-							currentSet.append( tempVect2 );
-							coords[coordSet] = currentSet;
-						}
-					}
-				}
+	QVector<MeshStream> streams;
 
-				// build triangles, strips etc.
-				if ( meshPrimitiveType == "MESH_PRIMITIVE_TRIANGLES" ) {
-					for ( int k = 0; k < indices.size(); ) {
-						Triangle tempTri( indices[k], indices[k + 1], indices[k + 2] );
-						qDebug() << "Inserting triangle" << tempTri;
-						triangles.append( tempTri );
-						k = k + 3;
-					}
+	for ( int d = 0; d < nif->rowCount( iData ); d++ ) {
+		QModelIndex iMeshData = iData.child( d, 0 );
+		QModelIndex iStream = nif->getBlock( nif->getLink( iMeshData, "Stream" ), "NiDataStream" );
+		if ( !iStream.isValid() )
+			continue;
+
+		MeshStream stream;
+		stream.usage = nif->get<int>( iStream, "Usage" );
+
+		// The payload is held as one blob, which shares its bytes with the model
+		QModelIndex iBytes = nif->getIndex( iStream, "Data" );
+		if ( iBytes.isValid() && nif->rowCount( iBytes ) > 0 )
+			stream.data = nif->get<QByteArray>( iBytes.child( 0, 0 ) );
+
+		// The components are interleaved in the order of their formats
+		QVector<quint32> formats = nif->getArray<quint32>( iStream, "Component Formats" );
+		QModelIndex iSemantics = nif->getIndex( iMeshData, "Component Semantics" );
+
+		for ( int c = 0; c < formats.count(); c++ ) {
+			StreamComponent component;
+			component.format = formats.at( c );
+			component.offset = stream.stride;
+			if ( c < nif->rowCount( iSemantics ) ) {
+				component.semantic = nif->get<QString>( iSemantics.child( c, 0 ), "Name" );
+				component.index = nif->get<int>( iSemantics.child( c, 0 ), "Index" );
+			}
+
+			stream.stride += component.values() * component.size();
+			stream.components.append( component );
+		}
+
+		if ( stream.stride <= 0 )
+			continue;
+
+		stream.count = stream.data.size() / stream.stride;
+
+		QVector<QPair<quint32, quint32>> regions;
+		QModelIndex iRegions = nif->getIndex( iStream, "Regions" );
+		for ( int r = 0; r < nif->rowCount( iRegions ); r++ ) {
+			QModelIndex iRegion = iRegions.child( r, 0 );
+			regions.append( { nif->get<quint32>( iRegion, "Start Index" ), nif->get<quint32>( iRegion, "Num Indices" ) } );
+		}
+
+		// Without regions the whole stream belongs to each submesh
+		QVector<quint16> regionMap = nif->getArray<quint16>( iMeshData, "Submesh To Region Map" );
+		for ( int s = 0; s < numSubmeshes; s++ ) {
+			QPair<quint32, quint32> region( 0, quint32( stream.count ) );
+			if ( s < regionMap.count() && regionMap.at( s ) < regions.count() )
+				region = regions.at( regionMap.at( s ) );
+
+			region.first = std::min( region.first, quint32( stream.count ) );
+			region.second = std::min( region.second, quint32( stream.count ) - region.first );
+			stream.submeshes.append( region );
+		}
+
+		streams.append( stream );
+	}
+
+	// Skinned meshes may only hold the bind pose, named with a _BP suffix
+	auto find = [&streams]( const QString & semantic, int index ) -> QPair<const MeshStream *, const StreamComponent *> {
+		for ( const QString & name : QStringList{ semantic, semantic + "_BP" } ) {
+			for ( const MeshStream & stream : streams ) {
+				for ( const StreamComponent & c : stream.components ) {
+					if ( c.semantic == name && c.index == index )
+						return { &stream, &c };
 				}
 			}
+		}
+		return { nullptr, nullptr };
+	};
+
+	auto position = find( "POSITION", 0 );
+	if ( !position.first ) {
+		Message::append( tr( "Warnings were generated while rendering mesh." ),
+			tr( "Block %1: NiMesh has no POSITION stream" ).arg( id() )
+		);
+		return;
+	}
 
-#endif
-		} else {
+	verts = readStreamComponent<Vector3>( *position.first, *position.second, 0.0f );
+
+	// The other vertex streams run parallel to the positions
+	auto vertexArray = [&find, this]( const QString & semantic, int index, QVector<Vector3> & out ) {
+		auto f = find( semantic, index );
+		if ( f.first && f.first->count == verts.count() )
+			out = readStreamComponent<Vector3>( *f.first, *f.second, 0.0f );
+	};
 
-			verts  = nif->getArray<Vector3>( iData, "Vertices" );
-			norms  = nif->getArray<Vector3>( iData, "Normals" );
-			colors = nif->getArray<Color4>( iData, "Vertex Colors" );
+	vertexArray( "NORMAL", 0, norms );
+	vertexArray( "TANGENT", 0, tangents );
+	vertexArray( "BINORMAL", 0, bitangents );
 
-			// Detect if "Has Vertex Colors" is set to Yes in NiTriShape
-			//	Used to compare against SLSF2_Vertex_Colors
-			hasVertexColors = true;
-			if ( colors.length() == 0 ) {
-				hasVertexColors = false;
+	auto color = find( "COLOR", 0 );
+	if ( color.first && color.first->count == verts.count() )
+		colors = readStreamComponent<Color4>( *color.first, *color.second, 1.0f );
+
+	hasVertexColors = !colors.isEmpty();
+
+	for ( int set = 0; ; set++ ) {
+		auto uv = find( "TEXCOORD", set );
+		if ( !uv.first || uv.first->count != verts.count() )
+			break;
+
+		coords.append( readStreamComponent<Vector2>( *uv.first, *uv.second, 0.0f ) );
+	}
+
+	// Index streams name their component INDEX, and are indexed relative to the vertices of the submesh
+	const MeshStream * indexStream = nullptr;
+	const StreamComponent * indexComponent = nullptr;
+
+	for ( const MeshStream & stream : streams ) {
+		if ( stream.usage == 0 && !stream.components.isEmpty() ) {
+			indexStream = &stream;
+			indexComponent = &stream.components.first();
+			break;
+		}
+	}
+
+	QVector<quint32> streamIndices;
+	if ( indexStream )
+		streamIndices = readStreamIndices( *indexStream, *indexComponent );
+
+	int invalid = 0;
+
+	auto addTriangle = [this, &invalid]( quint32 a, quint32 b, quint32 c ) {
+		// Triangles hold 16 bit indices
+		quint32 last = std::max( { a, b, c } );
+		if ( last >= quint32( verts.count() ) || last > 0xFFFF ) {
+			invalid++;
+			return;
+		}
+		if ( a != b && b != c && a != c )
+			triangles.append( Triangle( quint16( a ), quint16( b ), quint16( c ) ) );
+	};
+
+	for ( int s = 0; s < numSubmeshes; s++ ) {
+		const QPair<quint32, quint32> vertexRegion = position.first->submeshes.value( s );
+
+		QVector<quint32> submesh;
+		quint32 base = vertexRegion.first;
+
+		if ( indexStream ) {
+			const QPair<quint32, quint32> indexRegion = indexStream->submeshes.value( s );
+			submesh = streamIndices.mid( int( indexRegion.first ), int( indexRegion.second ) );
+
+			// Indices beyond the region of the submesh are taken to be absolute
+			for ( quint32 i : submesh ) {
+				if ( i >= vertexRegion.second ) {
+					base = 0;
+					break;
+				}
 			}
+		} else {
+			submesh.resize( int( vertexRegion.second ) );
+			std::iota( submesh.begin(), submesh.end(), 0u );
+		}
 
-			if ( isVertexAlphaAnimation ) {
-				for ( int i = 0; i < colors.count(); i++ )
-					colors[i].setRGBA( colors[i].red(), colors[i].green(), colors[i].blue(), 1 );
+		// MESH_PRIMITIVE_TRIANGLES and MESH_PRIMITIVE_TRISTRIPS, the others are not drawn
+		if ( primitive == 0 ) {
+			for ( int i = 0; i + 2 < submesh.count(); i += 3 )
+				addTriangle( base + submesh.at( i ), base + submesh.at( i + 1 ), base + submesh.at( i + 2 ) );
+		} else if ( primitive == 1 ) {
+			for ( int i = 0; i + 2 < submesh.count(); i++ ) {
+				if ( i & 1 )
+					addTriangle( base + submesh.at( i + 1 ), base + submesh.at( i ), base + submesh.at( i + 2 ) );
+				else
+					addTriangle( base + submesh.at( i ), base + submesh.at( i + 1 ), base + submesh.at( i + 2 ) );
 			}
+		}
+	}
+
+	if ( invalid > 0 ) {
+		Message::append( tr( "Warnings were generated while rendering mesh." ),
+			tr( "Block %1: %2 invalid triangles in NiMesh" ).arg( id() ).arg( invalid )
+		);
+	}
+}
+
+bool compareTriangles( const QPair<int, float> & tri1, const QPair<int, float> & tri2 )
+{
+	return ( tri1.second < tri2.second );
+}
 
-			tangents   = nif->getArray<Vector3>( iData, "Tangents" );
-			bitangents = nif->getArray<Vector3>( iData, "Bitangents" );
+void Mesh::readGeometry( const NifModel * nif )
+{
+	pagedOut = false;
+
+	if ( nif->checkVersion( 0x14050000, 0 ) && nif->inherits( iBlock, "NiMesh" ) ) {
+		readMeshStreams( nif );
+	} else {
 
-			if ( norms.count() < verts.count() )
-				norms.clear();
+		verts  = nif->getArray<Vector3>( iData, "Vertices" );
+		norms  = nif->getArray<Vector3>( iData, "Normals" );
+		colors = nif->getArray<Color4>( iData, "Vertex Colors" );
 
-			if ( colors.count() < verts.count() )
-				colors.clear();
+		// Detect if "Has Vertex Colors" is set to Yes in NiTriShape
+		//	Used to compare against SLSF2_Vertex_Colors
+		hasVertexColors = true;
+		if ( colors.length() == 0 ) {
+			hasVertexColors = false;
+		}
 
-			coords.clear();
-			QModelIndex uvcoord = nif->getIndex( iData, "UV Sets" );
+		if ( isVertexAlphaAnimation ) {
+			for ( int i = 0; i < colors.count(); i++ )
+				colors[i].setRGBA( colors[i].red(), colors[i].green(), colors[i].blue(), 1 );
+		}
 
-			if ( !uvcoord.isValid() )
-				uvcoord = nif->getIndex( iData, "UV Sets 2" );
+		tangents   = nif->getArray<Vector3>( iData, "Tangents" );
+		bitangents = nif->getArray<Vector3>( iData, "Bitangents" );
 
-			if ( uvcoord.isValid() ) {
-				for ( int r = 0; r < nif->rowCount( uvcoord ); r++ ) {
-					QVector<Vector2> tc = nif->getArray<Vector2>( uvcoord.child( r, 0 ) );
+		if ( norms.count() < verts.count() )
+			norms.clear();
 
-					if ( tc.count() < verts.count() )
-						tc.clear();
+		if ( colors.count() < verts.count() )
+			colors.clear();
 
-					coords.append( tc );
-				}
+		coords.clear();
+		QModelIndex uvcoord = nif->getIndex( iData, "UV Sets" );
+
+		if ( !uvcoord.isValid() )
+			uvcoord = nif->getIndex( iData, "UV Sets 2" );
+
+		if ( uvcoord.isValid() ) {
+			for ( int r = 0; r < nif->rowCount( uvcoord ); r++ ) {
+				QVector<Vector2> tc = nif->getArray<Vector2>( uvcoord.child( r, 0 ) );
+
+				if ( tc.count() < verts.count() )
+					tc.clear();
+
+				coords.append( tc );
 			}
+		}
 
-			if ( nif->itemName( iData ) == "NiTriShapeData" ) {
-				// check indexes
-				// TODO: check other indexes as well
-				QVector<Triangle> ftriangles = nif->getArray<Triangle>( iData, "Triangles" );
-				triangles.clear();
-				int inv_idx = 0;
-				int inv_cnt = 0;
-
-				for ( int i = 0; i < ftriangles.count(); i++ ) {
-					Triangle t = ftriangles[i];
-					inv_idx = 0;
-
-					for ( int j = 0; j < 3; j++ ) {
-						if ( t[j] >= verts.count() ) {
-							inv_idx = 1;
-							break;
-						}
+		if ( nif->itemName( iData ) == "NiTriShapeData" ) {
+			// check indexes
+			// TODO: check other indexes as well
+			QVector<Triangle> ftriangles = nif->getArray<Triangle>( iData, "Triangles" );
+			triangles.clear();
+			int inv_idx = 0;
+			int inv_cnt = 0;
+
+			for ( int i = 0; i < ftriangles.count(); i++ ) {
+				Triangle t = ftriangles[i];
+				inv_idx = 0;
+
+				for ( int j = 0; j < 3; j++ ) {
+					if ( t[j] >= verts.count() ) {
+						inv_idx = 1;
+						break;
 					}
-
-					if ( !inv_idx )
-						triangles.append( t );
 				}
 
-				inv_cnt = ftriangles.count() - triangles.count();
-				ftriangles.clear();
+				if ( !inv_idx )
+					triangles.append( t );
+			}
 
-				if ( inv_cnt > 0 ) {
-					int block_idx = nif->getBlockNumber( nif->getIndex( iData, "Triangles" ) );
-					Message::append( tr( "Warnings were generated while rendering mesh." ),
-						tr( "Block %1: %2 invalid indices in NiTriShapeData.Triangles" ).arg( block_idx ).arg( inv_cnt )
-					);
-				}
+			inv_cnt = ftriangles.count() - triangles.count();
+			ftriangles.clear();
 
-				tristrips.clear();
-			} else if ( nif->itemName( iData ) == "NiTriStripsData" ) {
-				tristrips.clear();
-				QModelIndex points = nif->getIndex( iData, "Points" );
-
-				if ( points.isValid() ) {
-					for ( int r = 0; r < nif->rowCount( points ); r++ )
-						tristrips.append( nif->getArray<quint16>( points.child( r, 0 ) ) );
-				} else {
-					Message::append( tr( "Warnings were generated while rendering mesh." ),
-						tr( "Block %1: Invalid 'Points' array in %2" )
-						.arg( nif->getBlockNumber( iData ) )
-						.arg( nif->itemName( iData ) )
-					);
-				}
+			if ( inv_cnt > 0 ) {
+				int block_idx = nif->getBlockNumber( nif->getIndex( iData, "Triangles" ) );
+				Message::append( tr( "Warnings were generated while rendering mesh." ),
+					tr( "Block %1: %2 invalid indices in NiTriShapeData.Triangles" ).arg( block_idx ).arg( inv_cnt )
+				);
+			}
+
+			tristrips.clear();
+		} else if ( nif->itemName( iData ) == "NiTriStripsData" ) {
+			tristrips.clear();
+			QModelIndex points = nif->getIndex( iData, "Points" );
 
-				triangles.clear();
+			if ( points.isValid() ) {
+				for ( int r = 0; r < nif->rowCount( points ); r++ )
+					tristrips.append( nif->getArray<quint16>( points.child( r, 0 ) ) );
 			} else {
-				triangles.clear();
-				tristrips.clear();
+				Message::append( tr( "Warnings were generated while rendering mesh." ),
+					tr( "Block %1: Invalid 'Points' array in %2" )
+					.arg( nif->getBlockNumber( iData ) )
+					.arg( nif->itemName( iData ) )
+				);
 			}
 
-			QModelIndex iExtraData = nif->getIndex( iBlock, "Extra Data List" );
+			triangles.clear();
+		} else {
+			triangles.clear();
+			tristrips.clear();
+		}
+
+		QModelIndex iExtraData = nif->getIndex( iBlock, "Extra Data List" );
 
-			if ( iExtraData.isValid() ) {
-				for ( int e = 0; e < nif->rowCount( iExtraData ); e++ ) {
-					QModelIndex iExtra = nif->getBlock( nif->getLink( iExtraData.child( e, 0 ) ), "NiBinaryExtraData" );
+		if ( iExtraData.isValid() ) {
+			for ( int e = 0; e < nif->rowCount( iExtraData ); e++ ) {
+				QModelIndex iExtra = nif->getBlock( nif->getLink( iExtraData.child( e, 0 ) ), "NiBinaryExtraData" );
 
-					if ( nif->get<QString>( iExtra, "Name" ) == "Tangent space (binormal & tangent vectors)" ) {
-						iTangentData = iExtra;
-						QByteArray data = nif->get<QByteArray>( iExtra, "Binary Data" );
+				if ( nif->get<QString>( iExtra, "Name" ) == "Tangent space (binormal & tangent vectors)" ) {
+					iTangentData = iExtra;
+					QByteArray data = nif->get<QByteArray>( iExtra, "Binary Data" );
 
-						if ( data.count() == verts.count() * 4 * 3 * 2 ) {
-							tangents.resize( verts.count() );
-							bitangents.resize( verts.count() );
-							Vector3 * t = (Vector3 *)data.data();
+					if ( data.count() == verts.count() * 4 * 3 * 2 ) {
+						tangents.resize( verts.count() );
+						bitangents.resize( verts.count() );
+						Vector3 * t = (Vector3 *)data.data();
 
-							for ( int c = 0; c < verts.count(); c++ )
-								tangents[c] = *t++;
+						for ( int c = 0; c < verts.count(); c++ )
+							tangents[c] = *t++;
 
-							for ( int c = 0; c < verts.count(); c++ )
-								bitangents[c] = *t++;
-						}
+						for ( int c = 0; c < verts.count(); c++ )
+							bitangents[c] = *t++;
 					}
 				}
 			}
 		}
 	}
 
+	shareData();
+}
+
+void Mesh::transform()
+{
+	const NifModel * nif = static_cast<const NifModel *>( iBlock.model() );
+
+	if ( !nif || !iBlock.isValid() ) {
+		clear();
+		return;
+	}
+
+	bool updateInfluence = updateData || updateSkin;
+
+	if ( updateData ) {
+		updateData = false;
+		readGeometry( nif );
+	}
+
 	if ( updateSkin ) {
 		updateSkin = false;
 		weights.clear();
@@ -622,111 +1154,188 @@ void Mesh::transform()
 		}
 	}
 
+	if ( updateInfluence )
+		updateInfluences();
+
 	Node::transform();
 }
 
-void Mesh::transformShapes()
+void Mesh::memoryUsage( GeometryUsage & usage, QSet<const void *> & counted ) const
 {
-	if ( isHidden() )
+	Shape::memoryUsage( usage, counted );
+
+	usage.skin += arrayBytes( influenceStart, counted ) + arrayBytes( influences, counted );
+}
+
+void Mesh::updateInfluences()
+{
+	influenceStart.fill( 0, verts.count() + 1 );
+	influences.clear();
+
+	if ( weights.isEmpty() )
 		return;
 
-	Node::transformShapes();
+	// The bones skinning each vertex, gathered before they are packed by vertex
+	QVector<QVector<QPair<int, float>>> vertexBones( verts.count() );
 
-	transformRigid = true;
+	if ( partitions.count() ) {
+		// A vertex in several partitions is skinned by the first one
+		QVector<bool> skinned( verts.count(), false );
 
-	if ( weights.count() && (scene->options & Scene::DoSkinning) ) {
-		transformRigid = false;
+		for ( const SkinPartition & part : partitions ) {
+			for ( int v = 0; v < part.vertexMap.count(); v++ ) {
+				int vindex = part.vertexMap[ v ];
 
-		transVerts.resize( verts.count() );
-		transVerts.fill( Vector3() );
-		transNorms.resize( norms.count() );
-		transNorms.fill( Vector3() );
-		transTangents.resize( tangents.count() );
-		transTangents.fill( Vector3() );
-		transBitangents.resize( bitangents.count() );
-		transBitangents.fill( Vector3() );
+				if ( vindex < 0 || vindex >= verts.count() )
+					break;
 
-		Node * root = findParent( skeletonRoot );
+				if ( skinned[vindex] )
+					continue;
 
-		if ( partitions.count() ) {
-			foreach ( const SkinPartition part, partitions ) {
-				QVector<Transform> boneTrans( part.boneMap.count() );
+				skinned[vindex] = true;
 
-				for ( int t = 0; t < boneTrans.count(); t++ ) {
-					Node * bone = root ? root->findChild( bones.value( part.boneMap[t] ) ) : 0;
-					boneTrans[ t ] = scene->view;
+				for ( int w = 0; w < part.numWeightsPerVertex; w++ ) {
+					QPair<int, float> weight = part.weights.value( v * part.numWeightsPerVertex + w );
 
-					if ( bone )
-						boneTrans[ t ] = boneTrans[ t ] * bone->localTrans( skeletonRoot ) * weights.value( part.boneMap[t] ).trans;
+					if ( weight.first < 0 || weight.first >= part.boneMap.count() )
+						continue;
 
-					//if ( bone ) boneTrans[ t ] = bone->viewTrans() * weights.value( part.boneMap[t] ).trans;
+					int bone = part.boneMap[ weight.first ];
+
+					if ( bone >= 0 && bone < bones.count() )
+						vertexBones[vindex].append( { bone, weight.second } );
 				}
+			}
+		}
+	} else {
+		for ( int b = 0; b < weights.count(); b++ ) {
+			for ( const VertexWeight & vw : weights[b].weights ) {
+				if ( vw.vertex >= 0 && vw.vertex < verts.count() )
+					vertexBones[vw.vertex].append( { b, vw.weight } );
+			}
+		}
+	}
 
-				for ( int v = 0; v < part.vertexMap.count(); v++ ) {
-					int vindex = part.vertexMap[ v ];
+	for ( int v = 0; v < verts.count(); v++ ) {
+		influenceStart[v] = influences.count();
+		influences += vertexBones[v];
+	}
 
-					if ( vindex < 0 || vindex > transVerts.count() )
-						break;
+	influenceStart[verts.count()] = influences.count();
+}
 
-					if ( transVerts[vindex] == Vector3() ) {
-						for ( int w = 0; w < part.numWeightsPerVertex; w++ ) {
-							QPair<int, float> weight = part.weights[ v * part.numWeightsPerVertex + w ];
-							Transform trans = boneTrans.value( weight.first );
+void Mesh::skinVertices( const QVector<Transform> & boneTrans )
+{
+	int count = verts.count();
 
-							if ( verts.count() > vindex )
-								transVerts[vindex] += trans * verts[ vindex ] * weight.second;
+	if ( influenceStart.count() != count + 1 )
+		updateInfluences();
 
-							if ( norms.count() > vindex )
-								transNorms[vindex] += trans.rotation * norms[ vindex ] * weight.second;
+	transVerts.resize( count );
+	transNorms.resize( norms.count() );
+	transTangents.resize( tangents.count() );
+	transBitangents.resize( bitangents.count() );
 
-							if ( tangents.count() > vindex )
-								transTangents[vindex] += trans.rotation * tangents[ vindex ] * weight.second;
+	// Taken here, so that the threads never detach the arrays
+	Vector3 * tVerts = transVerts.data();
+	Vector3 * tNorms = transNorms.data();
+	Vector3 * tTangents = transTangents.data();
+	Vector3 * tBitangents = transBitangents.data();
 
-							if ( bitangents.count() > vindex )
-								transBitangents[vindex] += trans.rotation * bitangents[ vindex ] * weight.second;
-						}
-					}
-				}
+	// Each vertex is written by one thread only, summing the transforms of its own bones
+	auto skin = [&]( int first, int last ) {
+		for ( int v = first; v < last; v++ ) {
+			Vector3 vert, norm, tangent, bitangent;
+
+			for ( int i = influenceStart[v]; i < influenceStart[v + 1]; i++ ) {
+				const Transform & trans = boneTrans[ influences[i].first ];
+				float weight = influences[i].second;
+
+				vert += trans * verts[v] * weight;
+
+				if ( v < norms.count() )
+					norm += trans.rotation * norms[v] * weight;
+
+				if ( v < tangents.count() )
+					tangent += trans.rotation * tangents[v] * weight;
+
+				if ( v < bitangents.count() )
+					bitangent += trans.rotation * bitangents[v] * weight;
 			}
-		} else {
-			int x = 0;
-			foreach ( const BoneWeights bw, weights ) {
-				Transform trans = viewTrans() * skeletonTrans;
-				Node * bone = root ? root->findChild( bw.bone ) : 0;
 
-				if ( bone )
-					trans = trans * bone->localTrans( skeletonRoot ) * bw.trans;
+			tVerts[v] = vert;
 
-				if ( bone )
-					weights[x++].tcenter = bone->viewTrans() * bw.center;
-				else
-					x++;
+			if ( v < norms.count() )
+				tNorms[v] = norm.normalize();
 
-				Matrix natrix = trans.rotation;
-				for ( const VertexWeight& vw : bw.weights ) {
-					if ( transVerts.count() > vw.vertex )
-						transVerts[ vw.vertex ] += trans * verts[ vw.vertex ] * vw.weight;
+			if ( v < tangents.count() )
+				tTangents[v] = tangent.normalize();
 
-					if ( transNorms.count() > vw.vertex )
-						transNorms[ vw.vertex ] += natrix * norms[ vw.vertex ] * vw.weight;
+			if ( v < bitangents.count() )
+				tBitangents[v] = bitangent.normalize();
+		}
+	};
+
+	// Below this many vertices per thread, starting the threads costs more than it saves
+	const int rangeSize = 4096;
+
+	int ranges = qMin( ( count + rangeSize - 1 ) / rangeSize, scene->skinPool.maxThreadCount() + 1 );
+
+	if ( ranges <= 1 ) {
+		skin( 0, count );
+		return;
+	}
 
-					if ( transTangents.count() > vw.vertex )
-						transTangents[ vw.vertex ] += natrix * tangents[ vw.vertex ] * vw.weight;
+	int step = ( count + ranges - 1 ) / ranges;
 
-					if ( transBitangents.count() > vw.vertex )
-						transBitangents[ vw.vertex ] += natrix * bitangents[ vw.vertex ] * vw.weight;
+	for ( int r = 1; r < ranges; r++ ) {
+		int first = r * step;
+		int last = qMin( first + step, count );
+		scene->skinPool.start( new FunctionRunnable( [&skin, first, last]() { skin( first, last ); } ) );
+	}
+
+	skin( 0, qMin( step, count ) );
+	scene->skinPool.waitForDone();
+}
+
+void Mesh::transformShapes()
+{
+	shapeBounds = BoundSphere();
+
+	if ( isHidden() )
+		return;
+
+	Node::transformShapes();
+
+	transformRigid = true;
+
+	if ( weights.count() && (scene->options & Scene::DoSkinning) ) {
+		transformRigid = false;
+
+		updateBoneNodes( skeletonRoot );
+
+		// One transform per bone, summed by each vertex over the bones skinning it
+		QVector<Transform> boneTrans( bones.count() );
+
+		for ( int b = 0; b < boneTrans.count(); b++ ) {
+			Node * bone = findBone( b );
+
+			if ( partitions.count() ) {
+				boneTrans[b] = scene->view;
+
+				if ( bone )
+					boneTrans[b] = boneTrans[b] * bone->localTrans( skeletonRoot ) * weights.value( b ).trans;
+			} else {
+				boneTrans[b] = viewTrans() * skeletonTrans;
+
+				if ( bone && b < weights.count() ) {
+					boneTrans[b] = boneTrans[b] * bone->localTrans( skeletonRoot ) * weights[b].trans;
+					weights[b].tcenter = bone->viewTrans() * weights[b].center;
 				}
 			}
 		}
 
-		for ( int n = 0; n < transNorms.count(); n++ )
-			transNorms[n].normalize();
-
-		for ( int t = 0; t < transTangents.count(); t++ )
-			transTangents[t].normalize();
-
-		for ( int t = 0; t < transBitangents.count(); t++ )
-			transBitangents[t].normalize();
+		skinVertices( boneTrans );
 
 		boundSphere = BoundSphere( transVerts );
 		boundSphere.applyInv( viewTrans() );
@@ -780,11 +1389,7 @@ void Mesh::transformShapes()
 	    for ( int t = 0; t < triangles.count(); t++ )
 	        sortedTriangles[t] = triangles[ triOrder[t].first ];
 	}
-	else
-	{
 	*/
-	sortedTriangles = triangles;
-	//}
 
 	MaterialProperty * matprop = findProperty<MaterialProperty>();
 	if ( matprop && matprop->alphaValue() != 1.0 ) {
@@ -823,6 +1428,10 @@ void Mesh::transformShapes()
 	//		transColorsNoAlpha.clear();
 	//	}
 	//}
+
+	// Update the bounds in object space, then add them in view space for culling
+	bounds();
+	shapeBounds |= viewTrans() * boundSphere;
 }
 
 BoundSphere Mesh::bounds() const
@@ -844,6 +1453,9 @@ void Mesh::drawShapes( NodeList * secondPass, bool presort )
 	if ( !(scene->options & Scene::ShowMarkers) && name.startsWith( "EditorMarker" ) )
 		return;
 
+	pageIn();
+	lastDrawn = scene->transformFrame;
+
 	auto nif = static_cast<const NifModel *>(iBlock.model());
 	
 	if ( Node::SELECTING ) {
@@ -869,6 +1481,11 @@ void Mesh::drawShapes( NodeList * secondPass, bool presort )
 		return;
 	}
 
+	if ( secondPass && scene->firstPass ) {
+		scene->firstPass->add( this );
+		return;
+	}
+
 	// TODO: Option to hide Refraction and other post effects
 
 	// rigid mesh? then pass the transformation on to the gl layer
@@ -892,13 +1509,22 @@ void Mesh::drawShapes( NodeList * secondPass, bool presort )
 	glEnable( GL_POLYGON_OFFSET_FILL );
 	glPolygonOffset( 1.0f, 2.0f );
 
+	// Geometry stays in buffer objects, it is only uploaded again after it changed
 	glEnableClientState( GL_VERTEX_ARRAY );
-	glVertexPointer( 3, GL_FLOAT, 0, transVerts.data() );
+	if ( transformRigid )
+		buffers->vertices.bind( transVerts );
+	else
+		buffers->vertices.bindDynamic( transVerts );
+	glVertexPointer( 3, GL_FLOAT, 0, nullptr );
 
 	if ( !Node::SELECTING ) {
 		if ( transNorms.count() ) {
 			glEnableClientState( GL_NORMAL_ARRAY );
-			glNormalPointer( GL_FLOAT, 0, transNorms.data() );
+			if ( transformRigid )
+				buffers->normals.bind( transNorms );
+			else
+				buffers->normals.bindDynamic( transNorms );
+			glNormalPointer( GL_FLOAT, 0, nullptr );
 		}
 
 		// Do VCs if legacy or if either bslsp or bsesp is set
@@ -909,7 +1535,8 @@ void Mesh::drawShapes( NodeList * secondPass, bool presort )
 			&& doVCs )
 		{
 			glEnableClientState( GL_COLOR_ARRAY );
-			glColorPointer( 4, GL_FLOAT, 0, (transColorsNoAlpha.count()) ? transColorsNoAlpha.data() : transColors.data() );
+			buffers->colors.bind( (transColorsNoAlpha.count()) ? transColorsNoAlpha : transColors );
+			glColorPointer( 4, GL_FLOAT, 0, nullptr );
 		} else {
 			if ( !hasVertexColors && (bslsp && bslsp->hasVertexColors) ) {
 				// Correctly blacken the mesh if SLSF2_Vertex_Colors is still on
@@ -921,6 +1548,9 @@ void Mesh::drawShapes( NodeList * secondPass, bool presort )
 		}
 	}
 
+	// The texture coordinate and tangent arrays set up by the renderer are client side
+	buffers->vertices.release();
+
 	// TODO: Hotspot.  See about optimizing this.
 	if ( !Node::SELECTING )
 		shader = scene->renderer->setupProgram( this, shader );
@@ -929,43 +1559,67 @@ void Mesh::drawShapes( NodeList * secondPass, bool presort )
 		glDisable( GL_CULL_FACE );
 	}
 
+	// The triangles are drawn in the order of the array, as by the games
+	if ( triangles.count() )
+		buffers->triangles.bind( triangles );
+
 	auto bsLOD = nif->getBlock( iBlock, "BSLODTriShape" );
 	if ( !bsLOD.isValid() ) {
 
 		// render the triangles
-		if ( sortedTriangles.count() )
-			glDrawElements( GL_TRIANGLES, sortedTriangles.count() * 3, GL_UNSIGNED_SHORT, sortedTriangles.data() );
+		if ( triangles.count() ) {
+			glDrawElements( GL_TRIANGLES, triangles.count() * 3, GL_UNSIGNED_SHORT, nullptr );
+
+			scene->stats.drawCalls++;
+			scene->stats.triangles += triangles.count();
+		}
 
 	} else {
-		auto lod0 = nif->get<uint>( bsLOD, "Level 0 Size" );
-		auto lod1 = nif->get<uint>( bsLOD, "Level 1 Size" );
-		auto lod2 = nif->get<uint>( bsLOD, "Level 2 Size" );
+		// The levels are consecutive ranges of the triangles
+		int lod0 = qMin<int>( nif->get<uint>( bsLOD, "Level 0 Size" ), triangles.count() );
+		int lod1 = qMin<int>( nif->get<uint>( bsLOD, "Level 1 Size" ), triangles.count() - lod0 );
+		int lod2 = qMin<int>( nif->get<uint>( bsLOD, "Level 2 Size" ), triangles.count() - lod0 - lod1 );
 
-		auto lod0tris = sortedTriangles.mid( 0, lod0 );
-		auto lod1tris = sortedTriangles.mid( lod0, lod1 );
-		auto lod2tris = sortedTriangles.mid( lod0 + lod1, lod2 );
+		// Offsets into the triangle buffer
+		const GLvoid * lod0tris = nullptr;
+		const GLvoid * lod1tris = (const GLvoid *)( lod0 * sizeof( Triangle ) );
+		const GLvoid * lod2tris = (const GLvoid *)( ( lod0 + lod1 ) * sizeof( Triangle ) );
 
 		// If Level2, render all
 		// If Level1, also render Level0
 		switch ( scene->lodLevel ) {
 		case Scene::Level2:
-			if ( lod2tris.count() )
-				glDrawElements( GL_TRIANGLES, lod2tris.count() * 3, GL_UNSIGNED_SHORT, lod2tris.data() );
+			if ( lod2 > 0 )
+				glDrawElements( GL_TRIANGLES, lod2 * 3, GL_UNSIGNED_SHORT, lod2tris );
 		case Scene::Level1:
-			if ( lod1tris.count() )
-				glDrawElements( GL_TRIANGLES, lod1tris.count() * 3, GL_UNSIGNED_SHORT, lod1tris.data() );
+			if ( lod1 > 0 )
+				glDrawElements( GL_TRIANGLES, lod1 * 3, GL_UNSIGNED_SHORT, lod1tris );
 		case Scene::Level0:
 		default:
-			if ( lod0tris.count() )
-				glDrawElements( GL_TRIANGLES, lod0tris.count() * 3, GL_UNSIGNED_SHORT, lod0tris.data() );
+			if ( lod0 > 0 )
+				glDrawElements( GL_TRIANGLES, lod0 * 3, GL_UNSIGNED_SHORT, lod0tris );
 			break;
 		}
+
+		int drawn[3] = { lod0, ( scene->lodLevel >= Scene::Level1 ) ? lod1 : 0, ( scene->lodLevel >= Scene::Level2 ) ? lod2 : 0 };
+		for ( int count : drawn ) {
+			if ( count > 0 ) {
+				scene->stats.drawCalls++;
+				scene->stats.triangles += count;
+			}
+		}
 	}
 
+	buffers->triangles.release();
+
 	// render the tristrips
-	for ( int s = 0; s < tristrips.count(); s++ )
+	for ( int s = 0; s < tristrips.count(); s++ ) {
 		glDrawElements( GL_TRIANGLE_STRIP, tristrips[s].count(), GL_UNSIGNED_SHORT, tristrips[s].data() );
 
+		scene->stats.drawCalls++;
+		scene->stats.triangles += qMax( tristrips[s].count() - 2, 0 );
+	}
+
 	if ( isDoubleSided ) {
 		glEnable( GL_CULL_FACE );
 	}
@@ -995,11 +1649,8 @@ void Mesh::drawVerts() const
 
 	glBegin( GL_POINTS );
 
+	// Vertices are picked with Scene::pick(), no color keys are drawn for them
 	for ( int i = 0; i < transVerts.count(); i++ ) {
-		if ( Node::SELECTING ) {
-			int id = ID2COLORKEY( (shapeNumber << 16) + i );
-			glColor4ubv( (GLubyte *)&id );
-		}
 		glVertex( transVerts.value( i ) );
 	}
 
@@ -1013,6 +1664,20 @@ void Mesh::drawVerts() const
 	}
 
 	glEnd();
+
+	// The vertex under the cursor, drawn larger than the others
+	if ( !Node::SELECTING && scene->hover.shape == shapeNumber && scene->hover.vertex >= 0 ) {
+		GLfloat size;
+		glGetFloatv( GL_POINT_SIZE, &size );
+		glPointSize( size * 1.5f );
+
+		glHighlightColor();
+		glBegin( GL_POINTS );
+		glVertex( transVerts.value( scene->hover.vertex ) );
+		glEnd();
+
+		glPointSize( size );
+	}
 }
 
 void Mesh::drawSelection() const
@@ -1020,7 +1685,8 @@ void Mesh::drawSelection() const
 	if ( scene->options & Scene::ShowNodes )
 		Node::drawSelection();
 
-	if ( isHidden() || !(scene->selMode & Scene::SelObject) )
+	// A shape paged out was not drawn for a while, neither is its selection
+	if ( isHidden() || pagedOut || !(scene->selMode & Scene::SelObject) )
 		return;
 
 	auto idx = scene->currentIndex;
@@ -1083,12 +1749,7 @@ void Mesh::drawSelection() const
 	if ( n == "Vertices" || n == "Normals" || n == "Vertex Colors"
 	     || n == "UV Sets" || n == "Tangents" || n == "Bitangents" )
 	{
-		glBegin( GL_POINTS );
-
-		for ( int j = 0; j < transVerts.count(); j++ )
-			glVertex( transVerts.value( j ) );
-
-		glEnd();
+		drawPoints();
 
 		if ( i >= 0 ) {
 			glDepthFunc( GL_ALWAYS );
@@ -1147,24 +1808,13 @@ void Mesh::drawSelection() const
 		if ( normalScale < 0.1f )
 			normalScale = 0.1f;
 
-		glBegin( GL_LINES );
-
-		for ( int j = 0; j < transVerts.count() && j < transNorms.count(); j++ ) {
-			glVertex( transVerts.value( j ) );
-			glVertex( transVerts.value( j ) + transNorms.value( j ) * normalScale );
-		}
+		drawVectors( transNorms, buffers->normals, normalScale, 0 );
 
 		if ( n == "TSpace" ) {
-			for ( int j = 0; j < transVerts.count() && j < transTangents.count() && j < transBitangents.count(); j++ ) {
-				glVertex( transVerts.value( j ) );
-				glVertex( transVerts.value( j ) + transTangents.value( j ) * normalScale );
-				glVertex( transVerts.value( j ) );
-				glVertex( transVerts.value( j ) + transBitangents.value( j ) * normalScale );
-			}
+			drawVectors( transTangents, buffers->tangents, normalScale, 0 );
+			drawVectors( transBitangents, buffers->bitangents, normalScale, 0 );
 		}
 
-		glEnd();
-
 		if ( i >= 0 ) {
 			glDepthFunc( GL_ALWAYS );
 			glHighlightColor();
@@ -1182,16 +1832,7 @@ void Mesh::drawSelection() const
 		if ( normalScale < 0.1f )
 			normalScale = 0.1f;
 
-		glBegin( GL_LINES );
-
-		for ( int j = 0; j < transVerts.count() && j < transTangents.count(); j++ ) {
-			glVertex( transVerts.value( j ) );
-			glVertex( transVerts.value( j ) + transTangents.value( j ) * normalScale * 2 );
-			glVertex( transVerts.value( j ) );
-			glVertex( transVerts.value( j ) - transTangents.value( j ) * normalScale / 2 );
-		}
-
-		glEnd();
+		drawVectors( transTangents, buffers->tangents, normalScale * 2, normalScale / 2 );
 
 		if ( i >= 0 ) {
 			glDepthFunc( GL_ALWAYS );
@@ -1212,16 +1853,7 @@ void Mesh::drawSelection() const
 		if ( normalScale < 0.1f )
 			normalScale = 0.1f;
 
-		glBegin( GL_LINES );
-
-		for ( int j = 0; j < transVerts.count() && j < transBitangents.count(); j++ ) {
-			glVertex( transVerts.value( j ) );
-			glVertex( transVerts.value( j ) + transBitangents.value( j ) * normalScale * 2 );
-			glVertex( transVerts.value( j ) );
-			glVertex( transVerts.value( j ) - transBitangents.value( j ) * normalScale / 2 );
-		}
-
-		glEnd();
+		drawVectors( transBitangents, buffers->bitangents, normalScale * 2, normalScale / 2 );
 
 		if ( i >= 0 ) {
 			glDepthFunc( GL_ALWAYS );
@@ -1238,14 +1870,7 @@ void Mesh::drawSelection() const
 	if ( n == "Faces" || n == "Triangles" ) {
 		glLineWidth( 1.5f );
 
-		for ( const Triangle& tri : triangles ) {
-			glBegin( GL_TRIANGLES );
-			glVertex( transVerts.value( tri.v1() ) );
-			glVertex( transVerts.value( tri.v2() ) );
-			glVertex( transVerts.value( tri.v3() ) );
-			//glVertex( transVerts.value( tri.v1() ) );
-			glEnd();
-		}
+		drawTriangles();
 
 		if ( i >= 0 ) {
 			glPolygonMode( GL_FRONT_AND_BACK, GL_FILL );
@@ -34,11 +34,16 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define GLMESH_H
 
 #include "glnode.h" // Inherited
+#include "glbvh.h"
 #include "gltools.h"
 
+#include <QPair>
 #include <QPersistentModelIndex>
+#include <QSet>
+#include <QSharedPointer>
 #include <QVector>
 #include <QString>
+#include <QStringList>
 
 
 //! @file glmesh.h Mesh
@@ -56,14 +61,63 @@ public:
 	virtual void drawVerts() const {};
 	virtual QModelIndex vertexAt( int ) const { return QModelIndex(); };
 
+	//! Find the nearest triangle of the shape a ray in view space hits, closer than \a hit does already
+	/*!
+	 * The triangles are searched in pickTree, which is built on the first pick
+	 * and refitted once the vertices were skinned or morphed since, so that
+	 * picking neither renders nor depends on the number of vertices.
+	 *
+	 * \return	Whether the shape was hit closer than \a hit
+	 */
+	bool pick( const Vector3 & origin, const Vector3 & direction, BVH::Hit & hit ) const;
+	//! The vertex of the triangle hit by pick() closest to where it was hit
+	int nearestVertex( const BVH::Hit & hit ) const;
+
 	int shapeNumber;
 
+	//! Name of the shader program the shape was last drawn with, empty if none matched
+	QString programName() const { return programCache.matches.value( 0 ); }
+	//! The property holding the textures of the shape, nullptr if it has none
+	Property * textureProperty() const;
+	//! Identifies the buffer objects of the shape, the same for shapes sharing their geometry
+	const void * geometry() const { return buffers.data(); }
+
+	//! Add the arrays and buffer objects of the shape to \a usage
+	/*!
+	 * Arrays and buffers already in \a counted, being shared with another shape
+	 * or between the data and its transformed copy, are only counted once.
+	 */
+	virtual void memoryUsage( GeometryUsage & usage, QSet<const void *> & counted ) const;
+
+	//! Scene::transformFrame the shape was last drawn in, see Scene::pageGeometry()
+	quint32 lastDrawn = 0;
+
+	//! Bytes of the arrays pageOut() releases, counting arrays shared with other shapes for each
+	qint64 geometryBytes() const;
+	//! Whether pageOut() may release the arrays, which skinned and animated shapes read every frame
+	bool isPageable() const;
+
+	//! Release the arrays read from the data, their transformed copies and the buffer objects
+	/*!
+	 * The buffer objects keep the arrays they uploaded, so they are released
+	 * too. The bounds are kept for culling. The shape reads its arrays from
+	 * the model again once it is drawn, see pageIn().
+	 */
+	void pageOut();
+
 protected:
 	//! Sets the Controller
 	void setController( const NifModel * nif, const QModelIndex & controller ) override;
 
 	void updateShaderProperties( const NifModel * nif );
 
+	//! Read the vertices, triangles and the other arrays from the data blocks
+	virtual void readGeometry( const NifModel * nif ) { Q_UNUSED( nif ); }
+	//! Whether pageOut() released the arrays, which readGeometry() reads again
+	bool pagedOut = false;
+	//! Read the arrays released by pageOut() again and transform them, called before the shape is drawn
+	void pageIn();
+
 	void boneSphere( const NifModel * nif, const QModelIndex & index ) const;
 
 	int nifVersion = 0;
@@ -96,8 +150,6 @@ protected:
 	QVector<Triangle> triangles;
 	//! Strip points
 	QList<QVector<quint16>> tristrips;
-	//! Sorted triangles
-	QVector<Triangle> sortedTriangles;
 	//! Triangle indices
 	QVector<quint16> indices;
 
@@ -116,6 +168,57 @@ protected:
 	//! Transformed bitangents
 	QVector<Vector3> transBitangents;
 
+	//! The buffer objects the shape is drawn from
+	struct Buffers
+	{
+		//! Transformed vertices
+		GLBuffer<Vector3> vertices;
+		//! Transformed normals
+		GLBuffer<Vector3> normals;
+		//! Transformed tangents and bitangents, only uploaded to show them, see drawVectors()
+		GLBuffer<Vector3> tangents;
+		GLBuffer<Vector3> bitangents;
+		//! Vertex colors
+		GLBuffer<Color4> colors;
+		//! Triangles
+		GLBuffer<Triangle> triangles{ GL_ELEMENT_ARRAY_BUFFER };
+	};
+
+	//! Buffer objects, shared with the other shapes drawing the same geometry, see shareData()
+	QSharedPointer<Buffers> buffers;
+
+	//! Share the arrays and buffer objects of another shape with the same geometry
+	/*!
+	 * Called once the data is read. Shapes referencing the same data block, or
+	 * holding identical vertices and triangles, then upload their geometry once.
+	 */
+	void shareData();
+
+	//! The triangles and strips of the shape over transVerts, see pick()
+	mutable BVH pickTree;
+	//! The triangles and strips pickTree was built from, to notice when they are replaced
+	mutable QVector<Triangle> pickTriangles;
+	mutable QList<QVector<quint16>> pickStrips;
+
+	//! Build pickTree again if the triangles changed, or refit it if the vertices did
+	void updatePickTree() const;
+
+	//! Bind a buffer object of the shape, uploading a transformed array the way drawShapes() does
+	void bindBuffer( GLBuffer<Vector3> & buffer, const QVector<Vector3> & data ) const;
+	//! Draw all vertices as points from the vertex buffer
+	void drawPoints() const;
+	//! Draw the triangles from the buffer objects, outlined if the polygon mode is GL_LINE
+	void drawTriangles() const;
+	//! Draw a line \a forward along and one \a backward against a vector of every vertex
+	/*!
+	 * Where the overlay program selection_vectors.prog is available, the
+	 * lines are emitted by its geometry shader from the vertex buffer and
+	 * \a buffer holding \a vectors, so that the selection is drawn without
+	 * computing anything per vertex. Otherwise the lines are batched and
+	 * drawn in one call.
+	 */
+	void drawVectors( const QVector<Vector3> & vectors, GLBuffer<Vector3> & buffer, float forward, float backward ) const;
+
 	//! Does the skin data need updating?
 	bool updateSkin = false;
 	//! Toggle for skinning
@@ -127,6 +230,27 @@ protected:
 	QVector<BoneWeights> weights;
 	QVector<SkinPartition> partitions;
 
+	//! The skeleton root, found by updateBoneNodes()
+	QPointer<Node> skeletonNode;
+	//! The nodes of the bones by their index in bones, found by updateBoneNodes()
+	QVector<QPointer<Node>> boneNodes;
+	//! The bones, skeleton root and Scene::hierarchyRevision the nodes were found for
+	struct
+	{
+		QVector<int> bones;
+		int root = -1;
+		int revision = -1;
+	} boneNodesFor;
+
+	//! Find the skeleton root above the shape and the bones below it
+	/*!
+	 * The nodes are only searched again once the bones or the node hierarchy
+	 * changed, so that skinning does not search the hierarchy in every frame.
+	 */
+	void updateBoneNodes( int root );
+	//! The node of a bone by its index in bones, nullptr if it was not found
+	Node * findBone( int index ) const { return boneNodes.value( index ); }
+
 	//! Holds the name of the shader, or "fixed function pipeline" if no shader
 	QString shader;
 
@@ -150,6 +274,24 @@ protected:
 
 	mutable BoundSphere boundSphere;
 	mutable bool updateBounds;
+
+	//! The shader programs whose conditions matched the shape, cached by Renderer::setupProgram()
+	struct ProgramCache
+	{
+		//! Incremented when one of the blocks the conditions were evaluated on changes
+		int revision = 0;
+		//! The revision the conditions were evaluated at, -1 if they never were
+		int evaluated = -1;
+		//! Renderer::programsRevision the conditions were evaluated for
+		int programs = -1;
+		//! The blocks the conditions were evaluated on
+		QList<QModelIndex> blocks;
+		//! The names of the programs whose conditions matched
+		QStringList matches;
+	} programCache;
+
+	//! Invalidate the cached shader programs if index is one of the blocks they were chosen by
+	void updateProgramCache( const NifModel * nif, const QModelIndex & index );
 };
 
 //! A mesh
@@ -186,12 +328,34 @@ public:
 
 	void drawVerts() const override;
 	QModelIndex vertexAt( int ) const override;
+	void memoryUsage( GeometryUsage & usage, QSet<const void *> & counted ) const override;
 
 protected:
 
+	void readGeometry( const NifModel * nif ) override;
+
 	//! Tangent data
 	QPersistentModelIndex iTangentData;
 
+	//! Offsets into influences of the bones skinning each vertex, one more than there are vertices
+	QVector<int> influenceStart;
+	//! The bones skinning the vertices, as indices into bones with their weights
+	QVector<QPair<int, float>> influences;
+
+	//! Gather the bones skinning each vertex from the bone weights or the skin partitions
+	void updateInfluences();
+	//! Skin the vertices with one transform per bone, split across threads for large meshes
+	void skinVertices( const QVector<Transform> & boneTrans );
+
+	//! Read the vertices and triangles of a NiMesh from its data streams
+	/*!
+	 * The components of each NiDataStream are mapped to the arrays of the
+	 * shape by the "Component Semantics" of the mesh, and converted straight
+	 * from the bytes of the stream, without reading each element through the
+	 * model. The submeshes are joined into one list of triangles.
+	 */
+	void readMeshStreams( const NifModel * nif );
+
 	static bool isBSLODPresent;
 };
 
@@ -35,6 +35,7 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "controllers.h"
 #include "glmarker.h"
+#include "glmesh.h"
 #include "glscene.h"
 
 #include "marker/furniture.h"
@@ -175,6 +176,53 @@ bool compareNodesAlpha( const Node * node1, const Node * node2 )
 	return a2;
 }
 
+bool compareNodesState( const Node * node1, const Node * node2 )
+{
+	// Presorted meshes keep the order they were collected in, after the others
+
+	bool p1 = node1->isPresorted();
+	bool p2 = node2->isPresorted();
+
+	if ( p1 || p2 )
+		return !p1 && p2;
+
+	auto shape1 = dynamic_cast<const Shape *>( node1 );
+	auto shape2 = dynamic_cast<const Shape *>( node2 );
+
+	if ( !shape1 || !shape2 )
+		return shape1 && !shape2;
+
+	// Most expensive state change first
+
+	QString prog1 = shape1->programName();
+	QString prog2 = shape2->programName();
+
+	if ( prog1 != prog2 )
+		return prog1 < prog2;
+
+	Property * tex1 = shape1->textureProperty();
+	Property * tex2 = shape2->textureProperty();
+
+	if ( tex1 != tex2 )
+		return tex1 < tex2;
+
+	AlphaProperty * alpha1 = node1->findProperty<AlphaProperty>();
+	AlphaProperty * alpha2 = node2->findProperty<AlphaProperty>();
+
+	if ( alpha1 != alpha2 )
+		return alpha1 < alpha2;
+
+	// Repeated geometry one after the other
+	const void * geom1 = shape1->geometry();
+	const void * geom2 = shape2->geometry();
+
+	if ( geom1 != geom2 )
+		return geom1 < geom2;
+
+	// Front to back, so that hidden fragments fail the depth test
+	return node1->viewDepth() > node2->viewDepth();
+}
+
 void NodeList::sort()
 {
 	std::stable_sort( nodes.begin(), nodes.end(), compareNodes );
@@ -185,6 +233,11 @@ void NodeList::alphaSort()
 	std::stable_sort( nodes.begin(), nodes.end(), compareNodesAlpha );
 }
 
+void NodeList::stateSort()
+{
+	std::stable_sort( nodes.begin(), nodes.end(), compareNodesState );
+}
+
 /*
  *	Node
  */
@@ -310,6 +363,9 @@ void Node::update( const NifModel * nif, const QModelIndex & index )
 		}
 		properties = newProps;
 
+		if ( children.list().count() )
+			scene->hierarchyRevision++;
+
 		children.clear();
 		QModelIndex iChildren = nif->getIndex( iBlock, "Children" );
 		QList<qint32> lChildren = nif->getChildLinks( nif->getBlockNumber( iBlock ) );
@@ -333,6 +389,9 @@ void Node::update( const NifModel * nif, const QModelIndex & index )
 
 void Node::makeParent( Node * newParent )
 {
+	if ( newParent != parent )
+		scene->hierarchyRevision++;
+
 	if ( parent )
 		parent->children.del( this );
 
@@ -342,6 +401,20 @@ void Node::makeParent( Node * newParent )
 		parent->children.add( this );
 }
 
+void Node::flatten( QVector<Node *> & order, QVector<QVector<Node *> > & levels, int depth )
+{
+	order.append( this );
+
+	if ( levels.count() <= depth )
+		levels.resize( depth + 1 );
+
+	levels[depth].append( this );
+
+	for ( Node * node : children.list() ) {
+		node->flatten( order, levels, depth + 1 );
+	}
+}
+
 void Node::setController( const NifModel * nif, const QModelIndex & iController )
 {
 	QString cname = nif->itemName( iController );
@@ -379,32 +452,30 @@ void Node::activeProperties( PropertyList & list ) const
 
 const Transform & Node::viewTrans() const
 {
-	if ( scene->viewTrans.contains( nodeId ) )
-		return scene->viewTrans[ nodeId ];
-
-	Transform t;
+	if ( viewFrame == scene->transformFrame )
+		return viewCache;
 
 	if ( parent )
-		t = parent->viewTrans() * local;
+		viewCache = parent->viewTrans() * local;
 	else
-		t = scene->view * worldTrans();
+		viewCache = scene->view * worldTrans();
 
-	scene->viewTrans.insert( nodeId, t );
-	return scene->viewTrans[ nodeId ];
+	viewFrame = scene->transformFrame;
+	return viewCache;
 }
 
 const Transform & Node::worldTrans() const
 {
-	if ( scene->worldTrans.contains( nodeId ) )
-		return scene->worldTrans[ nodeId ];
-
-	Transform t = local;
+	if ( worldFrame == scene->transformFrame )
+		return worldCache;
 
 	if ( parent )
-		t = parent->worldTrans() * t;
+		worldCache = parent->worldTrans() * local;
+	else
+		worldCache = local;
 
-	scene->worldTrans.insert( nodeId, t );
-	return scene->worldTrans[ nodeId ];
+	worldFrame = scene->transformFrame;
+	return worldCache;
 }
 
 Transform Node::localTrans( int root ) const
@@ -519,10 +590,31 @@ void Node::transform()
 	}
 }
 
+void Node::sampleValues( QVector<float> & values, QStringList * names ) const
+{
+	Quat q = local.rotation.toQuat();
+
+	values << local.translation[0] << local.translation[1] << local.translation[2]
+	       << q[0] << q[1] << q[2] << q[3] << local.scale;
+
+	if ( names ) {
+		QStringList own;
+		own << "tx" << "ty" << "tz" << "qw" << "qx" << "qy" << "qz" << "scale";
+
+		for ( const QString & n : own )
+			names->append( ( name.isEmpty() ? QString( "[%1]" ).arg( nodeId ) : name ) + "." + n );
+	}
+
+	IControllable::sampleValues( values, names );
+}
+
 void Node::transformShapes()
 {
+	shapeBounds = BoundSphere();
+
 	for ( Node * node : children.list() ) {
 		node->transformShapes();
+		shapeBounds |= node->viewBounds();
 	}
 }
 
@@ -892,18 +984,23 @@ void drawHvkShape( const NifModel * nif, const QModelIndex & iShape, QStack<QMod
 			QVector<Vector3> verts = nif->getArray<Vector3>( iData, "Vertices" );
 			QModelIndex iTris = nif->getIndex( iData, "Triangles" );
 
-			for ( int t = 0; t < nif->rowCount( iTris ); t++ ) {
-				Triangle tri = nif->get<Triangle>( iTris.child( t, 0 ), "Triangle" );
+			// The edges of the triangles, decoded once until the model changes
+			VertexBatch edges( GL_LINES, collisionGeometry( iShape, [nif, &verts, &iTris]() {
+				QVector<Vector3> lines;
+
+				for ( int t = 0; t < nif->rowCount( iTris ); t++ ) {
+					Triangle tri = nif->get<Triangle>( iTris.child( t, 0 ), "Triangle" );
 
-				if ( tri[0] != tri[1] || tri[1] != tri[2] || tri[2] != tri[0] ) {
-					glBegin( GL_LINE_STRIP );
-					glVertex( verts.value( tri[0] ) );
-					glVertex( verts.value( tri[1] ) );
-					glVertex( verts.value( tri[2] ) );
-					glVertex( verts.value( tri[0] ) );
-					glEnd();
+					if ( tri[0] != tri[1] || tri[1] != tri[2] || tri[2] != tri[0] ) {
+						lines << verts.value( tri[0] ) << verts.value( tri[1] );
+						lines << verts.value( tri[1] ) << verts.value( tri[2] );
+						lines << verts.value( tri[2] ) << verts.value( tri[0] );
+					}
 				}
-			}
+
+				return lines;
+			} ) );
+			edges.draw();
 
 			// Handle Selection of hkPackedNiTriStripsData
 			if ( scene->currentBlock == iData ) {
@@ -1812,7 +1909,8 @@ void Node::drawShapes( NodeList * secondPass, bool presort )
 		children.sort();
 
 	for ( Node * node : children.list() ) {
-		node->drawShapes( secondPass, presort );
+		if ( scene->inFrustum( node->viewBounds() ) )
+			node->drawShapes( secondPass, presort );
 	}
 }
 
@@ -1955,18 +2053,16 @@ BillboardNode::BillboardNode( Scene * scene, const QModelIndex & iBlock )
 
 const Transform & BillboardNode::viewTrans() const
 {
-	if ( scene->viewTrans.contains( nodeId ) )
-		return scene->viewTrans[ nodeId ];
-
-	Transform t;
+	if ( viewFrame == scene->transformFrame )
+		return viewCache;
 
 	if ( parent )
-		t = parent->viewTrans() * local;
+		viewCache = parent->viewTrans() * local;
 	else
-		t = scene->view * worldTrans();
+		viewCache = scene->view * worldTrans();
 
-	t.rotation = Matrix();
+	viewCache.rotation = Matrix();
 
-	scene->viewTrans.insert( nodeId, t );
-	return scene->viewTrans[ nodeId ];
+	viewFrame = scene->transformFrame;
+	return viewCache;
 }
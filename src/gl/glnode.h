@@ -35,6 +35,7 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "icontrollable.h" // Inherited
 #include "glproperty.h"
+#include "gltools.h"
 
 #include <QList>
 #include <QPersistentModelIndex>
@@ -67,6 +68,8 @@ public:
 
 	void sort();
 	void alphaSort();
+	//! Sort shapes so that those drawn with the same program, textures and blending follow each other
+	void stateSort();
 
 protected:
 	QList<Node *> nodes;
@@ -104,6 +107,7 @@ public:
 	void clear() override;
 	void update( const NifModel * nif, const QModelIndex & block ) override;
 	void transform() override;
+	void sampleValues( QVector<float> & values, QStringList * names ) const override;
 
 	// end IControllable
 
@@ -128,6 +132,9 @@ public:
 
 	bool isVisible() const { return !isHidden(); }
 	bool isPresorted() const { return presorted; }
+
+	//! Bounds of the shapes at and below the node in view space, updated by transformShapes()
+	const BoundSphere & viewBounds() const { return shapeBounds; }
 	
 	Node * findChild( int id ) const;
 	Node * findChild( const QString & name ) const;
@@ -135,6 +142,8 @@ public:
 	Node * findParent( int id ) const;
 	Node * parentNode() const { return parent; }
 	void makeParent( Node * parent );
+	//! Append the node and the nodes below it to \a order, each after its parent, and to their depth in \a levels
+	void flatten( QVector<Node *> & order, QVector<QVector<Node *> > & levels, int depth = 0 );
 
 	template <typename T> T * findProperty() const;
 	void activeProperties( PropertyList & list ) const;
@@ -172,6 +181,13 @@ protected:
 
 	bool presorted = false;
 
+	//! See viewBounds()
+	BoundSphere shapeBounds;
+
+	//! The world and view transforms, computed once in each Scene::transformFrame
+	mutable Transform worldCache, viewCache;
+	mutable quint32 worldFrame = 0, viewFrame = 0;
+
 	int nodeId;
 	int ref;
 };
@@ -123,6 +123,10 @@ void Particles::transformShapes()
 
 	for ( int v = 0; v < verts.count(); v++ )
 		transVerts[v] = vtrans * verts[v];
+
+	BoundSphere sphere( verts );
+	sphere.radius += size;
+	shapeBounds |= vtrans * sphere;
 }
 
 BoundSphere Particles::bounds() const
@@ -146,6 +150,11 @@ void Particles::drawShapes( NodeList * secondPass, bool presort )
 		return;
 	}
 
+	if ( secondPass && scene->firstPass ) {
+		scene->firstPass->add( this );
+		return;
+	}
+
 	// Disable texturing,  texturing properties will reenable if applicable
 	glDisable( GL_TEXTURE_2D );
 
@@ -201,33 +210,57 @@ void Particles::drawShapes( NodeList * secondPass, bool presort )
 	 *
 	 */
 
+	// One quad per particle, drawn from client arrays in a single call
 	static const Vector2 tex[4] = {
-		Vector2( 1.0, 1.0 ), Vector2( 0.0, 1.0 ), Vector2( 1.0, 0.0 ), Vector2( 0.0, 0.0 )
+		Vector2( 1.0, 1.0 ), Vector2( 0.0, 1.0 ), Vector2( 0.0, 0.0 ), Vector2( 1.0, 0.0 )
 	};
+	static const float corner[4][2] = {
+		{ +1.0, +1.0 }, { -1.0, +1.0 }, { -1.0, -1.0 }, { +1.0, -1.0 }
+	};
+
+	int count = qMin( active, transVerts.count() );
+	if ( count <= 0 )
+		return;
+
+	bool colored = colors.count() >= count;
+	float scale = worldTrans().scale;
 
-	int p = 0;
-	for ( Vector3 v : transVerts ) {
-		if ( p >= active )
-			break;
+	quadVerts.resize( count * 4 );
+	quadCoords.resize( count * 4 );
+	if ( colored )
+		quadColors.resize( count * 4 );
+
+	for ( int p = 0; p < count; p++ ) {
+		const Vector3 & v = transVerts[p];
 
 		GLfloat s2 = ( sizes.count() > p ? sizes[ p ] * size : size );
-		s2 *= worldTrans().scale;
+		s2 *= scale;
 
-		glBegin( GL_TRIANGLE_STRIP );
+		for ( int c = 0; c < 4; c++ ) {
+			quadVerts[p * 4 + c] = v + Vector3( corner[c][0] * s2, corner[c][1] * s2, 0 );
+			quadCoords[p * 4 + c] = tex[c];
 
-		if ( p < colors.count() )
-			glColor( colors[ p ] );
+			if ( colored )
+				quadColors[p * 4 + c] = colors[p];
+		}
+	}
 
-		glTexCoord( tex[0] );
-		glVertex( v + Vector3( +s2, +s2, 0 ) );
-		glTexCoord( tex[1] );
-		glVertex( v + Vector3( -s2, +s2, 0 ) );
-		glTexCoord( tex[2] );
-		glVertex( v + Vector3( +s2, -s2, 0 ) );
-		glTexCoord( tex[3] );
-		glVertex( v + Vector3( -s2, -s2, 0 ) );
-		glEnd();
+	glEnableClientState( GL_VERTEX_ARRAY );
+	glVertexPointer( 3, GL_FLOAT, 0, quadVerts.constData() );
+	glEnableClientState( GL_TEXTURE_COORD_ARRAY );
+	glTexCoordPointer( 2, GL_FLOAT, 0, quadCoords.constData() );
 
-		p++;
+	if ( colored ) {
+		glEnableClientState( GL_COLOR_ARRAY );
+		glColorPointer( 4, GL_FLOAT, 0, quadColors.constData() );
 	}
+
+	glDrawArrays( GL_QUADS, 0, count * 4 );
+
+	scene->stats.drawCalls++;
+	scene->stats.triangles += count * 2;
+
+	glDisableClientState( GL_VERTEX_ARRAY );
+	glDisableClientState( GL_TEXTURE_COORD_ARRAY );
+	glDisableClientState( GL_COLOR_ARRAY );
 }
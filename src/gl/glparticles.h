@@ -69,6 +69,11 @@ protected:
 	QVector<float> sizes;
 	QVector<Vector3> transVerts;
 
+	//! The corners of the particle quads, kept between frames to reuse their memory
+	QVector<Vector3> quadVerts;
+	QVector<Vector2> quadCoords;
+	QVector<Color4> quadColors;
+
 	int active;
 	float size;
 };
@@ -922,7 +922,7 @@ QString BSShaderLightingProperty::fileName( int id ) const
 	nif = qobject_cast<const NifModel *>(iWetMaterial.model());
 	if ( nif ) {
 		// BSLSP
-		auto m = static_cast<ShaderMaterial *>(material);
+		auto m = static_cast<ShaderMaterial *>(material.get());
 		if ( m && m->isValid() ) {
 			auto tex = m->textures();
 			if ( tex.count() == 9 ) {
@@ -969,7 +969,7 @@ QString BSShaderLightingProperty::fileName( int id ) const
 			return nif->get<QString>( iTextures.child( id, 0 ) );
 	} else {
 		// handle niobject name="BSEffectShaderProperty...
-		auto m = static_cast<EffectMaterial *>(material);
+		auto m = static_cast<EffectMaterial *>(material.get());
 
 		nif = qobject_cast<const NifModel *>(iSourceTexture.model());
 		if ( !m && nif && iSourceTexture.isValid() ) {
@@ -1035,6 +1035,24 @@ void BSShaderLightingProperty::setFlags2( unsigned int val )
 	flags2 = ShaderFlags::SF2( val );
 }
 
+void BSShaderLightingProperty::sampleValues( QVector<float> & values, QStringList * names ) const
+{
+	values << uvOffset.x << uvOffset.y << uvScale.x << uvScale.y;
+
+	if ( names ) {
+		QStringList own;
+		own << "uvOffsetX" << "uvOffsetY" << "uvScaleX" << "uvScaleY";
+
+		const NifModel * nif = static_cast<const NifModel *>( iBlock.model() );
+		QString prefix = QString( "[%1]" ).arg( nif ? nif->getBlockNumber( iBlock ) : -1 );
+
+		for ( const QString & n : own )
+			names->append( prefix + "." + n );
+	}
+
+	Property::sampleValues( values, names );
+}
+
 UVScale BSShaderLightingProperty::getUvScale() const
 {
 	return uvScale;
@@ -1069,7 +1087,7 @@ void BSShaderLightingProperty::setClampMode( uint mode )
 
 Material * BSShaderLightingProperty::mat() const
 {
-	return material;
+	return material.get();
 }
 
 /*
@@ -1080,16 +1098,14 @@ void BSLightingShaderProperty::update( const NifModel * nif, const QModelIndex &
 {
 	BSShaderLightingProperty::update( nif, property );
 
+	// Null until the file has been read, the scene is updated again then
 	if ( name.endsWith( ".bgsm", Qt::CaseInsensitive ) )
-		material = new ShaderMaterial( name );
+		material = MaterialCache::instance()->get( name );
+	else
+		material.reset();
 
 	if ( material && !material->isValid() )
-		material = nullptr;
-
-	if ( material && name.isEmpty() ) {
-		delete material;
-		material = nullptr;
-	}
+		material.reset();
 
 }
 
@@ -1403,16 +1419,14 @@ void BSEffectShaderProperty::update( const NifModel * nif, const QModelIndex & p
 {
 	BSShaderLightingProperty::update( nif, property );
 
+	// Null until the file has been read, the scene is updated again then
 	if ( name.endsWith( ".bgem", Qt::CaseInsensitive ) )
-		material = new EffectMaterial( name );
+		material = MaterialCache::instance()->get( name );
+	else
+		material.reset();
 
 	if ( material && !material->isValid() )
-		material = nullptr;
-
-	if ( material && name.isEmpty() ) {
-		delete material;
-		material = nullptr;
-	}
+		material.reset();
 }
 
 void BSEffectShaderProperty::updateParams( const NifModel * nif, const QModelIndex & prop )
@@ -39,6 +39,8 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QPersistentModelIndex>
 #include <QString>
 
+#include <memory>
+
 
 //! @file glproperty.h Property, PropertyList
 
@@ -521,6 +523,7 @@ public:
 	QString typeId() const override { return "BSShaderLightingProperty"; }
 
 	void update( const NifModel * nif, const QModelIndex & block ) override;
+	void sampleValues( QVector<float> & values, QStringList * names ) const override;
 
 	friend void glProperty( BSShaderLightingProperty * );
 
@@ -572,7 +575,8 @@ protected:
 	QPersistentModelIndex iSourceTexture;
 	QPersistentModelIndex iWetMaterial;
 
-	Material * material = nullptr;
+	//! Shared with the other properties using the same file, see MaterialCache
+	std::shared_ptr<Material> material;
 
 	UVScale uvScale;
 	UVOffset uvOffset;
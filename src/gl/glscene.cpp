@@ -32,6 +32,8 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "glscene.h"
 #include "settings.h"
+#include "functionrunnable.h"
+#include "trace.h"
 
 #include "glcontroller.h"
 #include "glmesh.h"
@@ -41,9 +43,15 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "gltex.h"
 
 #include <QAction>
+#include <QElapsedTimer>
+#include <QFile>
 #include <QOpenGLContext>
 #include <QOpenGLFunctions>
+#include <QSet>
 #include <QSettings>
+#include <QTextStream>
+
+#include <algorithm>
 
 
 //! \file glscene.cpp %Scene management
@@ -106,6 +114,16 @@ void Scene::clear( bool flushTextures )
 	properties.clear();
 	roots.clear();
 	shapes.clear();
+	hover.shape = hover.vertex = -1;
+	dependents.clear();
+	globalDependents.clear();
+
+	firstOrder = DrawOrder();
+	secondOrder = DrawOrder();
+	drawRevision++;
+	hierarchyRevision++;
+	clearCollisionCache();
+	Controller::invalidateKeys();
 
 	animGroups.clear();
 	animTags.clear();
@@ -118,21 +136,30 @@ void Scene::clear( bool flushTextures )
 
 void Scene::update( const NifModel * nif, const QModelIndex & index )
 {
+	TRACE_SPAN( "Scene::update" );
+
 	if ( !nif )
 		return;
 
+	drawRevision++;
+
+	// Any edit may change the collision shapes and the animation keys
+	clearCollisionCache();
+	Controller::invalidateKeys();
+
 	if ( index.isValid() ) {
 		QModelIndex block = nif->getBlock( index );
 
 		if ( !block.isValid() )
 			return;
 
-		for ( Property * prop : properties.list() ) {
-			prop->update( nif, block );
+		// Only the objects reading the block, properties before nodes as in a full update
+		for ( IControllable * obj : dependents.value( nif->getBlockNumber( block ) ) ) {
+			obj->update( nif, block );
 		}
 
-		for ( Node * node : nodes.list() ) {
-			node->update( nif, block );
+		for ( IControllable * obj : globalDependents ) {
+			obj->update( nif, block );
 		}
 	} else {
 		properties.validate();
@@ -146,6 +173,9 @@ void Scene::update( const NifModel * nif, const QModelIndex & index )
 			p->update( nif, QModelIndex() );
 		}
 
+		// Nodes may have been deleted or become roots
+		hierarchyRevision++;
+
 		roots.clear();
 		for ( const auto link : nif->getRootLinks() ) {
 			QModelIndex iBlock = nif->getBlock( link );
@@ -159,11 +189,69 @@ void Scene::update( const NifModel * nif, const QModelIndex & index )
 				}
 			}
 		}
+
+		indexDependents( nif );
 	}
 
 	timeBoundsValid = false;
 }
 
+void Scene::indexDependents( const NifModel * nif )
+{
+	dependents.clear();
+	globalDependents.clear();
+
+	QVector<int> blocks;
+	QVector<int> stack;
+	QSet<int> seen;
+
+	auto add = [&]( IControllable * obj ) {
+		int first = nif->getBlockNumber( obj->index() );
+		if ( first < 0 )
+			return;
+
+		blocks.clear();
+		stack = { first };
+		seen = { first };
+		bool global = false;
+
+		// The block of the object and the blocks below it, up to the next nodes which are objects of their own
+		while ( !stack.isEmpty() ) {
+			int b = stack.takeLast();
+			blocks.append( b );
+
+			QModelIndex iBlock = nif->getBlock( b );
+			global |= nif->inherits( iBlock, "NiControllerManager" ) || nif->inherits( iBlock, "NiMultiTargetTransformController" );
+
+			for ( const auto l : nif->getChildLinks( b ) ) {
+				if ( seen.contains( l ) )
+					continue;
+
+				seen.insert( l );
+
+				if ( !nif->inherits( nif->getBlock( l ), "NiAVObject" ) )
+					stack.append( l );
+			}
+		}
+
+		if ( global ) {
+			globalDependents.append( obj );
+			return;
+		}
+
+		for ( const int b : blocks )
+			dependents[b].append( obj );
+	};
+
+	for ( Property * prop : properties.list() ) {
+		add( prop );
+	}
+
+	for ( Node * node : nodes.list() ) {
+		add( node );
+	}
+}
+
 void Scene::updateSceneOptions( bool checked )
 {
 	Q_UNUSED( checked );
@@ -200,8 +288,13 @@ void Scene::updateLodLevel( int level )
 
 void Scene::make( NifModel * nif, bool flushTextures )
 {
+	TRACE_SPAN( "Scene::make" );
+
 	clear( flushTextures );
 
+	QSettings settings;
+	geometryBudget = qint64( settings.value( "Settings/Render/General/Geometry Budget", 1024 ).toInt() ) * 1024 * 1024;
+
 	if ( !nif )
 		return;
 
@@ -244,6 +337,7 @@ Node * Scene::getNode( const NifModel * nif, const QModelIndex & iNode )
 				&& nif->itemName( iNode ) == "NiMesh" )
 	{
 		node = new Mesh( this, iNode );
+		shapes += static_cast<Shape *>(node);
 	}
 	//else if ( nif->inherits( iNode, "AParticleNode" ) || nif->inherits( iNode, "AParticleSystem" ) )
 	else if ( nif->inherits( iNode, "NiParticles" ) ) {
@@ -284,6 +378,9 @@ void Scene::setSequence( const QString & seqname )
 {
 	animGroup = seqname;
 
+	// The sequence rebinds the controllers and their times
+	Controller::invalidateUpdates();
+
 	for ( Node * node : nodes.list() ) {
 		node->setSequence( seqname );
 	}
@@ -296,64 +393,211 @@ void Scene::setSequence( const QString & seqname )
 
 void Scene::transform( const Transform & trans, float time )
 {
+	TRACE_SPAN( "Scene::transform" );
+
+	if ( time != this->time || trans.scale != view.scale
+		|| !( trans.translation == view.translation ) || !( trans.rotation == view.rotation ) )
+		drawRevision++;
+
 	view = trans;
 	this->time = time;
 
-	worldTrans.clear();
-	viewTrans.clear();
+	transformFrame++;
 	bhkBodyTrans.clear();
 
+	QElapsedTimer timer;
+	timer.start();
+
 	for ( Property * prop : properties.list() ) {
 		prop->transform();
 	}
 	for ( Node * node : roots.list() ) {
 		node->transform();
 	}
+
+	// Computed parent first in one pass, no node has to recurse up the hierarchy for its transforms
+	if ( flatRevision != hierarchyRevision ) {
+		flatNodes.clear();
+		flatLevels.clear();
+		for ( Node * node : roots.list() ) {
+			node->flatten( flatNodes, flatLevels );
+		}
+		flatRevision = hierarchyRevision;
+	}
+
+	// The nodes of a level only read the transforms of the level above, which is complete
+	for ( const QVector<Node *> & level : flatLevels ) {
+		transformLevel( level );
+	}
+
+	qint64 shapesStart = timer.nsecsElapsed();
+
 	for ( Node * node : roots.list() ) {
 		node->transformShapes();
 	}
 
+	stats.transformShapes = ( timer.nsecsElapsed() - shapesStart ) / 1e6f;
+	stats.transform = timer.nsecsElapsed() / 1e6f;
+
 	sceneBoundsValid = false;
 
 	// TODO: purge unused textures
 }
 
+void Scene::transformLevel( const QVector<Node *> & level )
+{
+	auto compute = [&level]( int first, int last ) {
+		for ( int n = first; n < last; n++ ) {
+			level.at( n )->worldTrans();
+			level.at( n )->viewTrans();
+		}
+	};
+
+	int count = level.count();
+
+	// Below this many nodes per thread, starting the threads costs more than it saves
+	const int rangeSize = 2048;
+
+	int ranges = qMin( ( count + rangeSize - 1 ) / rangeSize, transformPool.maxThreadCount() + 1 );
+
+	if ( ranges <= 1 ) {
+		compute( 0, count );
+		return;
+	}
+
+	int step = ( count + ranges - 1 ) / ranges;
+
+	for ( int r = 1; r < ranges; r++ ) {
+		int first = r * step;
+		int last = qMin( first + step, count );
+		transformPool.start( new FunctionRunnable( [&compute, first, last]() { compute( first, last ); } ) );
+	}
+
+	compute( 0, qMin( step, count ) );
+	transformPool.waitForDone();
+}
+
 void Scene::draw()
 {
+	QElapsedTimer timer;
+
 	drawShapes();
 
+	timer.start();
 	if ( options & ShowNodes )
 		drawNodes();
+	stats.nodes = timer.nsecsElapsed() / 1e6f;
+
+	timer.restart();
 	if ( options & ShowCollision )
 		drawHavok();
+	stats.havok = timer.nsecsElapsed() / 1e6f;
+
 	if ( options & ShowMarkers )
 		drawFurn();
 
+	timer.restart();
 	drawSelection();
+	stats.selection = timer.nsecsElapsed() / 1e6f;
 }
 
 void Scene::drawShapes()
 {
+	QElapsedTimer timer;
+	timer.start();
+
+	updateFrustum();
+
 	if ( options & DoBlending ) {
-		NodeList secondPass;
+		// Collect the shapes first so that each pass can be drawn in its own order
+		NodeList opaquePass, secondPass;
 
+		firstPass = &opaquePass;
 		for ( Node * node : roots.list() ) {
-			node->drawShapes( &secondPass );
+			if ( inFrustum( node->viewBounds() ) )
+				node->drawShapes( &secondPass );
+		}
+		firstPass = nullptr;
+
+		for ( Node * node : sortPass( firstOrder, opaquePass, &NodeList::stateSort ) ) {
+			node->drawShapes();
 		}
 
+		stats.firstPass = timer.nsecsElapsed() / 1e6f;
+		timer.restart();
+
 		if ( secondPass.list().count() > 0 )
 			drawSelection(); // for transparency pass
 
-		secondPass.alphaSort();
-
-		for ( Node * node : secondPass.list() ) {
+		for ( Node * node : sortPass( secondOrder, secondPass, &NodeList::alphaSort ) ) {
 			node->drawShapes();
 		}
+
+		stats.secondPass = timer.nsecsElapsed() / 1e6f;
 	} else {
 		for ( Node * node : roots.list() ) {
-			node->drawShapes();
+			if ( inFrustum( node->viewBounds() ) )
+				node->drawShapes();
 		}
+
+		stats.firstPass = timer.nsecsElapsed() / 1e6f;
+	}
+
+	culling = false;
+}
+
+void Scene::updateFrustum()
+{
+	// The shapes are drawn with the modelview at identity, so the planes of
+	// the projection are those of the frustum in view space
+	GLfloat m[16];
+	glGetFloatv( GL_PROJECTION_MATRIX, m );
+
+	Vector4 w( m[3], m[7], m[11], m[15] );
+
+	for ( int i = 0; i < 3; i++ ) {
+		Vector4 row( m[i], m[4 + i], m[8 + i], m[12 + i] );
+
+		frustum[i * 2] = w + row;
+		frustum[i * 2 + 1] = w - row;
+	}
+
+	for ( Vector4 & plane : frustum ) {
+		float length = Vector3( plane ).length();
+
+		if ( length > 0 )
+			plane /= length;
 	}
+
+	culling = true;
+}
+
+bool Scene::inFrustum( const BoundSphere & bounds ) const
+{
+	if ( !culling || bounds.radius < 0 )
+		return true;
+
+	for ( const Vector4 & plane : frustum ) {
+		const Vector3 & c = bounds.center;
+
+		if ( plane[0] * c[0] + plane[1] * c[1] + plane[2] * c[2] + plane[3] < -bounds.radius )
+			return false;
+	}
+
+	return true;
+}
+
+const QList<Node *> & Scene::sortPass( DrawOrder & order, NodeList & pass, void ( NodeList::*sort )() )
+{
+	if ( order.revision == drawRevision && order.collected == pass.list() )
+		return order.sorted;
+
+	order.collected = pass.list();
+	( pass.*sort )();
+	order.sorted = pass.list();
+	order.revision = drawRevision;
+
+	return order.sorted;
 }
 
 void Scene::drawNodes()
@@ -387,6 +631,51 @@ void Scene::drawSelection() const
 	}
 }
 
+GeometryUsage Scene::memoryUsage() const
+{
+	GeometryUsage usage;
+	QSet<const void *> counted;
+
+	for ( const Shape * shape : shapes )
+		shape->memoryUsage( usage, counted );
+
+	return usage;
+}
+
+//! Frames a shape has to go undrawn before pageGeometry() may release its arrays
+static const quint32 PageOutDelay = 300;
+
+void Scene::pageGeometry()
+{
+	if ( geometryBudget <= 0 )
+		return;
+
+	qint64 used = 0;
+	QVector<Shape *> unused;
+
+	for ( Shape * shape : shapes ) {
+		used += shape->geometryBytes();
+
+		if ( shape->isPageable() && transformFrame - shape->lastDrawn > PageOutDelay )
+			unused.append( shape );
+	}
+
+	if ( used <= geometryBudget )
+		return;
+
+	std::sort( unused.begin(), unused.end(), []( const Shape * a, const Shape * b ) {
+		return a->lastDrawn < b->lastDrawn;
+	} );
+
+	for ( Shape * shape : unused ) {
+		if ( used <= geometryBudget )
+			break;
+
+		used -= shape->geometryBytes();
+		shape->pageOut();
+	}
+}
+
 BoundSphere Scene::bounds() const
 {
 	if ( !sceneBoundsValid ) {
@@ -401,6 +690,21 @@ BoundSphere Scene::bounds() const
 	return bndSphere;
 }
 
+Scene::Pick Scene::pick( const Vector3 & origin, const Vector3 & direction ) const
+{
+	Pick result;
+
+	for ( const Shape * shape : shapes ) {
+		if ( shape->pick( origin, direction, result.hit ) )
+			result.shape = shape;
+	}
+
+	if ( result.shape )
+		result.vertex = result.shape->nearestVertex( result.hit );
+
+	return result;
+}
+
 void Scene::updateTimeBounds() const
 {
 	if ( !nodes.list().isEmpty() ) {
@@ -415,33 +719,113 @@ void Scene::updateTimeBounds() const
 		tMin = tMax = 0;
 	}
 
+	if ( tMin > tMax )
+		tMin = tMax = 0;
+
+	// The start and end text keys of the sequence override the controllers
+	auto tags = animTags.constFind( animGroup );
+
+	if ( tags != animTags.constEnd() ) {
+		auto start = tags->constFind( "start" );
+		if ( start != tags->constEnd() )
+			tMin = start.value();
+
+		auto end = tags->constFind( "end" );
+		if ( end != tags->constEnd() )
+			tMax = end.value();
+	}
+
 	timeBoundsValid = true;
 }
 
 float Scene::timeMin() const
 {
-	if ( animTags.contains( animGroup ) ) {
-		if ( animTags[ animGroup ].contains( "start" ) )
-			return animTags[ animGroup ][ "start" ];
-	}
-
 	if ( !timeBoundsValid )
 		updateTimeBounds();
 
-	return ( tMin > tMax ? 0 : tMin );
+	return tMin;
 }
 
 float Scene::timeMax() const
 {
-	if ( animTags.contains( animGroup ) ) {
-		if ( animTags[ animGroup ].contains( "end" ) )
-			return animTags[ animGroup ][ "end" ];
-	}
-
 	if ( !timeBoundsValid )
 		updateTimeBounds();
 
-	return ( tMin > tMax ? 0 : tMax );
+	return tMax;
+}
+
+Scene::AnimationBake Scene::bake( float rate )
+{
+	AnimationBake result;
+
+	if ( rate <= 0 )
+		return result;
+
+	result.rate = rate;
+	result.start = timeMin();
+	result.frames = int( ( timeMax() - result.start ) * rate ) + 1;
+
+	float current = time;
+	bool animated = animate;
+	animate = true;
+
+	// Build the flattened node order
+	transform( view, result.start );
+
+	for ( int f = 0; f < result.frames; f++ ) {
+		time = result.start + f / rate;
+
+		// Only the controllers, the shapes are not drawn
+		for ( Property * prop : properties.list() ) {
+			prop->transform();
+		}
+		for ( Node * node : roots.list() ) {
+			node->transform();
+		}
+
+		QStringList * names = ( f == 0 ) ? &result.channels : nullptr;
+
+		for ( Node * node : flatNodes ) {
+			node->sampleValues( result.values, names );
+		}
+		for ( Property * prop : properties.list() ) {
+			prop->sampleValues( result.values, names );
+		}
+	}
+
+	animate = animated;
+	transform( view, current );
+
+	return result;
+}
+
+bool Scene::AnimationBake::save( const QString & filename ) const
+{
+	QFile file( filename );
+
+	if ( !file.open( QIODevice::WriteOnly | QIODevice::Text ) )
+		return false;
+
+	QTextStream out( &file );
+	out << "time";
+
+	for ( const QString & c : channels )
+		out << "\t" << c;
+
+	out << "\n";
+
+	int count = channels.count();
+
+	for ( int f = 0; f < frames; f++ ) {
+		out << QString::number( start + f / rate, 'f', 4 );
+
+		for ( int c = 0; c < count; c++ )
+			out << "\t" << QString::number( values.value( f * count + c ), 'g', 6 );
+
+		out << "\n";
+	}
+
+	return out.status() == QTextStream::Ok;
 }
 
 QString Scene::textStats()
@@ -459,6 +843,8 @@ int Scene::bindTexture( const QString & fname )
 	if ( !(options & DoTexturing) || fname.isEmpty() )
 		return 0;
 
+	stats.textureBinds++;
+
 	return textures->bind( fname );
 }
 
@@ -467,6 +853,8 @@ int Scene::bindTexture( const QModelIndex & iSource )
 	if ( !(options & DoTexturing) || !iSource.isValid() )
 		return 0;
 
+	stats.textureBinds++;
+
 	return textures->bind( iSource );
 }
 
@@ -475,6 +863,8 @@ int Scene::bindTextureCube( const QString & fname )
 	if ( !(options & DoTexturing) || fname.isEmpty() )
 		return 0;
 
+	stats.textureBinds++;
+
 	return textures->bindCube( fname );
 }
 
@@ -35,6 +35,7 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "nifmodel.h"
 
+#include "glbvh.h"
 #include "glnode.h"
 #include "glproperty.h"
 #include "gltex.h"
@@ -47,6 +48,8 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QPersistentModelIndex>
 #include <QStack>
 #include <QStringList>
+#include <QThreadPool>
+#include <QVector>
 
 
 //! @file glscene.h Scene
@@ -110,7 +113,8 @@ public:
 		DoCubeMapping = 0x4000,
 		DisableShaders = 0x8000,
 		ShowHidden = 0x10000,
-		DoSkinning = 0x20000
+		DoSkinning = 0x20000,
+		ShowStats = 0x40000
 	};
 	Q_DECLARE_FLAGS( SceneOptions, SceneOption );
 
@@ -156,8 +160,14 @@ public:
 
 	NodeList roots;
 
-	mutable QHash<int, Transform> worldTrans;
-	mutable QHash<int, Transform> viewTrans;
+	//! Incremented by transform(), the world and view transforms cached on the nodes being for this frame
+	quint32 transformFrame = 1;
+	//! The nodes of the hierarchy with each parent before its children, for hierarchyRevision
+	QVector<Node *> flatNodes;
+	//! The nodes of flatNodes by their depth in the hierarchy
+	QVector<QVector<Node *> > flatLevels;
+	int flatRevision = -1;
+
 	mutable QHash<int, Transform> bhkBodyTrans;
 
 	Transform view;
@@ -177,10 +187,97 @@ public:
 
 	QVector<Shape *> shapes;
 
+	//! The vertex under the cursor in vertex selection mode, highlighted by Shape::drawVerts()
+	struct
+	{
+		int shape = -1;
+		int vertex = -1;
+	} hover;
+
+	//! Collects the opaque shapes while drawShapes() walks the nodes, nullptr otherwise
+	NodeList * firstPass = nullptr;
+
+	//! Threads skinning the vertices of large meshes
+	QThreadPool skinPool;
+	//! Threads computing the transforms of the wide levels of flatLevels
+	QThreadPool transformPool;
+
+	//! Incremented when nodes are added to, removed from or moved in the hierarchy
+	int hierarchyRevision = 0;
+
+	//! Where the time of a frame went, reset by GLView::paintGL() and shown with ShowStats
+	struct FrameStats
+	{
+		//! CPU milliseconds of transform() and of the transformShapes() calls within it
+		float transform = 0, transformShapes = 0;
+		//! CPU milliseconds of the opaque pass, the second pass, drawNodes(), drawHavok() and drawSelection()
+		float firstPass = 0, secondPass = 0, nodes = 0, havok = 0, selection = 0;
+		//! GPU milliseconds of an earlier frame, -1 if timer queries are not available
+		float gpu = -1;
+		//! Draw calls of the shapes, their triangles, and the shader programs and textures bound for them
+		int drawCalls = 0, triangles = 0, programBinds = 0, textureBinds = 0;
+	};
+	FrameStats stats;
+
+	//! Whether a sphere in view space is at least partly inside the view frustum
+	/*!
+	 * Always true outside of drawShapes() and for empty spheres, node bounds
+	 * being empty until transformShapes() runs.
+	 */
+	bool inFrustum( const BoundSphere & bounds ) const;
+
 	BoundSphere bounds() const;
 
+	//! The nearest shape a ray hits, see Shape::pick()
+	struct Pick
+	{
+		const Shape * shape = nullptr;
+		BVH::Hit hit;
+		//! The vertex of the shape nearest to the hit, -1 if nothing was hit
+		int vertex = -1;
+	};
+
+	//! Find the nearest shape a ray in view space hits, and the vertex a click there snaps to
+	Pick pick( const Vector3 & origin, const Vector3 & direction ) const;
+
+	//! Measure the arrays and buffer objects of the shapes
+	GeometryUsage memoryUsage() const;
+
+	/*! Release the arrays of shapes not drawn for a while
+	 *
+	 * Called once per frame. While the arrays of the shapes exceed the budget,
+	 * those of the shapes drawn least recently are released first, see
+	 * Shape::pageOut(). Shapes hidden or culled for fewer than the frames of
+	 * PageOutDelay are kept, so that turning the view does not read them again.
+	 */
+	void pageGeometry();
+	//! Bytes the arrays of the shapes may use before pageGeometry() releases them, 0 if unlimited
+	qint64 geometryBudget = 0;
+
 	float timeMin() const;
 	float timeMax() const;
+
+	//! The animated values of the scene sampled at a fixed rate, see bake()
+	struct AnimationBake
+	{
+		//! Names of the sampled values
+		QStringList channels;
+		float start = 0;
+		float rate = 30;
+		int frames = 0;
+		//! channels.count() values per frame, one frame after the other
+		QVector<float> values;
+
+		//! Save as tab separated text with one line per frame, to be compared with another bake
+		bool save( const QString & filename ) const;
+	};
+
+	/*! Sample the current sequence from timeMin() to timeMax()
+	 *
+	 * Records the local transforms of all nodes, the morph weights and the
+	 * UV transforms, then transforms the scene back to the current time.
+	 */
+	AnimationBake bake( float rate );
 signals:
 	void sceneUpdated();
 
@@ -193,9 +290,59 @@ public slots:
 protected:
 	mutable bool sceneBoundsValid, timeBoundsValid;
 	mutable BoundSphere bndSphere;
+	//! The bounds timeMin() and timeMax() return, text keys applied
 	mutable float tMin, tMax;
 
+	//! Cache the time bounds; invalidated by update(), clear() and setSequence()
 	void updateTimeBounds() const;
+
+	//! The order a pass of drawShapes() draws its shapes in
+	struct DrawOrder
+	{
+		//! The shapes in the order they were collected
+		QList<Node *> collected;
+		//! The shapes in the order they are drawn
+		QList<Node *> sorted;
+		//! The revision the shapes were sorted at, -1 if they never were
+		int revision = -1;
+	};
+
+	//! Opaque shapes, sorted by shader program, textures and blending to change state less often
+	DrawOrder firstOrder;
+	//! Translucent shapes, sorted from back to front
+	DrawOrder secondOrder;
+	//! Incremented when the view, the time or the scene changes, so that the passes are sorted again
+	int drawRevision = 0;
+
+	//! Planes of the view frustum in view space, pointing inward, set by drawShapes()
+	Vector4 frustum[6];
+	//! Whether drawShapes() culls the nodes outside of the frustum
+	bool culling = false;
+	//! Read the view frustum from the projection matrix
+	void updateFrustum();
+
+	//! Compute the world and view transforms of one level of flatLevels, on transformPool if it is wide
+	void transformLevel( const QVector<Node *> & level );
+
+	//! Sort the shapes of a pass unless they and the view are the same as when they were last sorted
+	const QList<Node *> & sortPass( DrawOrder & order, NodeList & pass, void ( NodeList::*sort )() );
+
+	//! The objects to update when a block changes, by block number, see indexDependents()
+	QHash<int, QVector<IControllable *>> dependents;
+	/*! The objects to update whenever any block changes
+	 *
+	 * Controller managers and multi target controllers, which find the nodes
+	 * they animate by name and by links to nodes elsewhere in the scene.
+	 */
+	QVector<IControllable *> globalDependents;
+
+	/*! Index the blocks each property and node reads, once a full update created them
+	 *
+	 * An object depends on its block and the blocks linked below it, stopping
+	 * at other nodes. Changing a link makes GLView compile the scene again,
+	 * so the index stays valid until the next full update.
+	 */
+	void indexDependents( const NifModel * nif );
 };
 
 Q_DECLARE_OPERATORS_FOR_FLAGS( Scene::SceneOptions )
@@ -31,7 +31,10 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 ***** END LICENCE BLOCK *****/
 
 #include "gltex.h"
+#include "functionrunnable.h"
 #include "settings.h"
+#include "settingssnapshot.h"
+#include "trace.h"
 
 #include "glscene.h"
 #include "gltexloaders.h"
@@ -43,9 +46,11 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QDir>
 #include <QFileSystemWatcher>
 #include <QListView>
+#include <QMutex>
 #include <QOpenGLContext>
 #include <QOpenGLFunctions>
 #include <QSettings>
+#include <QVector>
 
 #include <algorithm>
 
@@ -65,8 +70,7 @@ float max_anisotropy = 1.0f;
 //! Accessor function for glProperty etc.
 float get_max_anisotropy()
 {
-	QSettings settings;
-	float af = settings.value( "Settings/Render/General/Anisotropic Filtering", 4.0 ).toFloat();
+	float af = SettingsSnapshot::get()->anisotropicFiltering;
 
 	return std::min( float(pow( 2.0f, af )), max_anisotropy );
 }
@@ -133,36 +137,84 @@ void resetTextureUnits( int numTex )
  *  TexCache
  */
 
+//! A texture loaded from a file, see TexCache::acquireShared()
+struct SharedTexture
+{
+	GLuint id;
+	GLuint width;
+	GLuint height;
+	GLuint mipmaps;
+	QString format;
+	//! Number of texture caches using the id
+	int users;
+};
+
+//! Textures loaded from files, by file path
+//!	The GL contexts of all windows share their objects, so one upload serves every window.
+static QHash<QString, SharedTexture> & sharedTextures()
+{
+	static QHash<QString, SharedTexture> textures;
+	return textures;
+}
+
 TexCache::TexCache( QObject * parent ) : QObject( parent )
 {
 	watcher = new QFileSystemWatcher( this );
 	connect( watcher, &QFileSystemWatcher::fileChanged, this, &TexCache::fileChanged );
+
+	updateBudget();
 }
 
 TexCache::~TexCache()
 {
+	// Reads report back to this object
+	readPool.waitForDone();
 	//flush();
 }
 
 QString TexCache::find( const QString & file, const QString & nifdir )
 {
-	return find( file, nifdir, *(new QByteArray()) );
+	QByteArray data;
+	return find( file, nifdir, data );
 }
 
-QString TexCache::find( const QString & file, const QString & nifdir, QByteArray & data )
+//! Where TexCache::find() located a texture
+struct FoundTexture
 {
-	if ( file.isEmpty() )
-		return QString();
+	enum Location
+	{
+		Missing,
+		LooseFile,
+		Archived
+	};
+
+	QString filepath;
+	Location location;
+};
+
+//! Results of TexCache::find(), by file name and NIF folder
+static QHash<QString, FoundTexture> & foundTextures()
+{
+	static QHash<QString, FoundTexture> found;
+	return found;
+}
+
+//! Guards foundTextures(), find() also runs on the threads reading texture files
+static QMutex foundMutex;
 
+//! Search the folders and archives for a texture, see TexCache::find()
+static QString findTexture( const QString & file, const QString & nifdir, QByteArray & data )
+{
 	if ( QFile( file ).exists() )
 		return file;
 
-	QSettings settings;
+	auto settings = SettingsSnapshot::get();
 
 	QString filename = QDir::toNativeSeparators( file );
 
 	if ( !filename.startsWith( "textures" ) ) {
-		QRegularExpression re( "textures[\\\\/]", QRegularExpression::CaseInsensitiveOption );
+		static const QRegularExpression re( "textures[\\\\/]", QRegularExpression::CaseInsensitiveOption );
+
 		int texIdx = filename.indexOf( re );
 		if ( texIdx > 0 ) {
 			filename.remove( 0, texIdx );
@@ -179,7 +231,7 @@ QString TexCache::find( const QString & file, const QString & nifdir, QByteArray
 	extensions << ".dds";
 	bool replaceExt = false;
 
-	bool textureAlternatives = settings.value( "Settings/Resources/Alternate Extensions", false ).toBool();
+	bool textureAlternatives = settings->alternateExtensions;
 	if ( textureAlternatives ) {
 		extensions << ".tga" << ".bmp" << ".nif" << ".texcache";
 		for ( const QString ext : QStringList{ extensions } )
@@ -215,10 +267,8 @@ QString TexCache::find( const QString & file, const QString & nifdir, QByteArray
 			return dir.filePath( filename );
 		}
 
-		
-		QStringList folders = settings.value( "Settings/Resources/Folders", QStringList() ).toStringList();
 
-		for ( QString folder : folders ) {
+		for ( QString folder : settings->resourceFolders ) {
 			// TODO: Always search nifdir without requiring a relative entry
 			// in folders?  Not too intuitive to require ".\" in your texture folder list
 			// even if it is added by default.
@@ -236,19 +286,15 @@ QString TexCache::find( const QString & file, const QString & nifdir, QByteArray
 		}
 
 		// Search through archives last, and load any requested textures into memory.
-		for ( FSArchiveFile * archive : FSManager::archiveList() ) {
-			if ( archive ) {
-				filename = QDir::fromNativeSeparators( filename.toLower() );
-				if ( archive->hasFile( filename ) ) {
-					QByteArray outData;
-					archive->fileContents( filename, outData );
-
-					if ( !outData.isEmpty() ) {
-						data = outData;
-						filename = QDir::toNativeSeparators( filename );
-						return filename;
-					}
-				}
+		filename = QDir::fromNativeSeparators( filename.toLower() );
+		if ( auto archive = FSManager::findArchive( filename ) ) {
+			QByteArray outData;
+			FSManager::fileContents( archive, filename, outData );
+
+			if ( !outData.isEmpty() ) {
+				data = outData;
+				filename = QDir::toNativeSeparators( filename );
+				return filename;
 			}
 		}
 
@@ -268,6 +314,57 @@ QString TexCache::find( const QString & file, const QString & nifdir, QByteArray
 	return filename;
 }
 
+QString TexCache::find( const QString & file, const QString & nifdir, QByteArray & data )
+{
+	TRACE_SPAN( "TexCache::find", file );
+
+	if ( file.isEmpty() )
+		return QString();
+
+	QString key = file.toLower() + QChar( '\n' ) + nifdir;
+
+	{
+		QMutexLocker lock( &foundMutex );
+		auto it = foundTextures().constFind( key );
+
+		if ( it != foundTextures().constEnd() ) {
+			FoundTexture found = it.value();
+			lock.unlock();
+
+			if ( found.location != FoundTexture::Archived )
+				return found.filepath;
+
+			// Only the location is kept, the contents live in the archive cache
+			QString filename = QDir::fromNativeSeparators( found.filepath );
+			if ( auto archive = FSManager::findArchive( filename ) ) {
+				FSManager::fileContents( archive, filename, data );
+				if ( !data.isEmpty() )
+					return found.filepath;
+			}
+		}
+	}
+
+	data.clear();
+	QString filepath = findTexture( file, nifdir, data );
+
+	FoundTexture found = { filepath, FoundTexture::Missing };
+	if ( !data.isEmpty() )
+		found.location = FoundTexture::Archived;
+	else if ( QFile::exists( filepath ) )
+		found.location = FoundTexture::LooseFile;
+
+	QMutexLocker lock( &foundMutex );
+	foundTextures().insert( key, found );
+
+	return filepath;
+}
+
+void TexCache::clearFound()
+{
+	QMutexLocker lock( &foundMutex );
+	foundTextures().clear();
+}
+
 /*!
  * Note: all original morrowind nifs use name.ext only for addressing the
  * textures, but most mods use something like textures/[subdir/]name.ext.
@@ -280,10 +377,7 @@ QString TexCache::stripPath( const QString & filepath, const QString & nifFolder
 	file = file.replace( "/", "\\" ).toLower();
 	QDir basePath;
 
-	QSettings settings;
-	QStringList folders = settings.value( "Settings/Resources/Folders", QStringList() ).toStringList();
-
-	for ( QString base : folders ) {
+	for ( QString base : SettingsSnapshot::get()->resourceFolders ) {
 		if ( base.startsWith( "./" ) || base.startsWith( ".\\" ) ) {
 			base = nifFolder + "/" + base;
 		}
@@ -313,6 +407,62 @@ bool TexCache::canLoad( const QString & filePath )
 	return texCanLoad( filePath );
 }
 
+bool TexCache::acquireShared( Tex * tx, const QString & key )
+{
+	auto it = sharedTextures().find( key );
+	if ( it == sharedTextures().end() )
+		return false;
+
+	releaseShared( tx );
+
+	SharedTexture & shared = it.value();
+	shared.users++;
+
+	tx->id = shared.id;
+	tx->width = shared.width;
+	tx->height = shared.height;
+	tx->mipmaps = shared.mipmaps;
+	tx->format = shared.format;
+	tx->status = QString();
+	tx->reload = false;
+	tx->shared = key;
+
+	return true;
+}
+
+void TexCache::publishShared( Tex * tx, const QString & key )
+{
+	// Textures which failed to load are retried by each window
+	if ( !tx->id || !tx->status.isEmpty() || !tx->shared.isEmpty() || sharedTextures().contains( key ) )
+		return;
+
+	sharedTextures().insert( key, { tx->id, tx->width, tx->height, tx->mipmaps, tx->format, 1 } );
+	tx->shared = key;
+}
+
+void TexCache::releaseShared( Tex * tx )
+{
+	if ( !tx->id )
+		return;
+
+	if ( !tx->shared.isEmpty() ) {
+		auto it = sharedTextures().find( tx->shared );
+		tx->shared = QString();
+
+		if ( it != sharedTextures().end() && it.value().id == tx->id ) {
+			if ( --it.value().users > 0 ) {
+				tx->id = 0;
+				return;
+			}
+
+			sharedTextures().erase( it );
+		}
+	}
+
+	glDeleteTextures( 1, &tx->id );
+	tx->id = 0;
+}
+
 void TexCache::fileChanged( const QString & filepath )
 {
 	QMutableHashIterator<QString, Tex *> it( textures );
@@ -325,14 +475,17 @@ void TexCache::fileChanged( const QString & filepath )
 		if ( tx && tx->filepath == filepath ) {
 			// Remove from watcher now to prevent multiple signals
 			watcher->removePath( tx->filepath );
+			clearFound();
 			if ( QFile::exists( tx->filepath ) ) {
 				tx->reload = true;
+				// A texture still being streamed is read again rather than finished from the old file
+				tx->read = false;
+				tx->streamed = 0;
 				emit sigRefresh();
 			} else {
 				it.remove();
 
-				if ( tx->id )
-					glDeleteTextures( 1, &tx->id );
+				releaseShared( tx );
 
 				delete tx;
 			}
@@ -340,8 +493,66 @@ void TexCache::fileChanged( const QString & filepath )
 	}
 }
 
+void TexCache::readFile( Tex * tx, const QString & key )
+{
+	tx->pending = true;
+
+	QString fname = tx->filename;
+	QString folder = nifFolder;
+	int gen = generation;
+
+	readPool.start( new FunctionRunnable( [this, key, fname, folder, gen]() {
+		QByteArray data;
+		QString filepath = find( fname, folder, data );
+
+		// Loose files are read here too, only decoding and upload are left to the GL thread
+		if ( data.isEmpty() ) {
+			QFile f( filepath );
+			if ( f.open( QIODevice::ReadOnly ) )
+				data = f.readAll();
+		}
+
+		QMetaObject::invokeMethod( this, "fileRead", Qt::QueuedConnection,
+			Q_ARG( QString, key ), Q_ARG( QString, filepath ), Q_ARG( QByteArray, data ), Q_ARG( int, gen ) );
+	} ) );
+}
+
+void TexCache::fileRead( const QString & key, const QString & filepath, const QByteArray & data, int gen )
+{
+	Tex * tx = textures.value( key );
+	if ( gen != generation || !tx || !tx->pending )
+		return;
+
+	tx->pending = false;
+	tx->read = true;
+	tx->filepath = filepath;
+	tx->data = data;
+
+	emit sigRefresh();
+}
+
+void TexCache::bindPlaceholder()
+{
+	// The GL contexts of all windows share their objects, see sharedTextures()
+	static GLuint placeholder = 0;
+
+	if ( !placeholder ) {
+		const quint8 grey[4] = { 128, 128, 128, 255 };
+
+		glGenTextures( 1, &placeholder );
+		glBindTexture( GL_TEXTURE_2D, placeholder );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+		glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey );
+	}
+
+	glBindTexture( GL_TEXTURE_2D, placeholder );
+}
+
 int TexCache::bind( const QString & fname )
 {
+	TRACE_SPAN( "TexCache::bind", fname );
+
 	Tex * tx = textures.value( fname );
 
 	if ( !tx ) {
@@ -351,26 +562,62 @@ int TexCache::bind( const QString & fname )
 		tx->data = QByteArray();
 		tx->mipmaps = 0;
 		tx->reload  = false;
+		tx->pending = false;
+		tx->read = false;
+		tx->streamed = 0;
 
 		textures.insert( tx->filename, tx );
 	}
 
-	QByteArray outData;
+	// Streamed textures upload one more mipmap in each frame they are drawn
+	bool firstInFrame = ( tx->lastBound != frame );
+	tx->lastBound = frame;
 
-	if ( tx->filepath.isEmpty() || tx->reload )
-		tx->filepath = find( tx->filename, nifFolder, outData );
+	// Finding and reading the file would stall painting, the texture is uploaded once it has been read
+	if ( !tx->pending && !tx->read && ( tx->filepath.isEmpty() || tx->reload ) )
+		readFile( tx, tx->filename );
 
-	if ( !outData.isEmpty() || tx->reload ) {
-		tx->data = outData;
+	if ( tx->pending ) {
+		// A changed file keeps showing its previous contents until it has been read again
+		if ( !tx->id ) {
+			bindPlaceholder();
+			return 1;
+		}
+
+		glBindTexture( GL_TEXTURE_2D, tx->id );
+		return tx->mipmaps;
 	}
 
 	if ( !tx->id || tx->reload ) {
 		if ( QFile::exists( tx->filepath ) && QFileInfo( tx->filepath ).isWritable() && ( !watcher->files().contains( tx->filepath ) ) )
 			watcher->addPath( tx->filepath );
 
-		tx->load();
+		// A changed file is uploaded again instead of reusing the stale shared texture
+		if ( tx->reload )
+			releaseShared( tx );
+
+		if ( tx->reload || !acquireShared( tx, tx->filepath ) ) {
+			if ( !tx->loadSmallest() ) {
+				tx->load();
+				publishShared( tx, tx->filepath );
+			}
+		}
+	} else if ( tx->streamed > 0 && firstInFrame ) {
+		tx->loadNext();
+
+		if ( tx->streamed == 0 )
+			publishShared( tx, tx->filepath );
+	}
+
+	// The file is kept until every mipmap has been uploaded
+	if ( tx->read && tx->streamed == 0 ) {
+		tx->read = false;
+		tx->data = QByteArray();
 	}
 
+	if ( tx->streamed > 0 )
+		emit sigRefresh();
+
 	glBindTexture( GL_TEXTURE_2D, tx->id );
 	glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, get_max_anisotropy() );
 
@@ -379,6 +626,8 @@ int TexCache::bind( const QString & fname )
 
 int TexCache::bind( const QModelIndex & iSource )
 {
+	TRACE_SPAN( "TexCache::bind" );
+
 	const NifModel * nif = qobject_cast<const NifModel *>( iSource.model() );
 
 	if ( nif && iSource.isValid() ) {
@@ -392,6 +641,9 @@ int TexCache::bind( const QModelIndex & iSource )
 					tx = new Tex();
 					tx->id = 0;
 					tx->reload = false;
+					tx->pending = false;
+					tx->read = false;
+					tx->streamed = 0;
 					try
 					{
 						glGenTextures( 1, &tx->id );
@@ -419,7 +671,9 @@ int TexCache::bind( const QModelIndex & iSource )
 
 int TexCache::bindCube( const QString & fname )
 {
-	Tex * tx = textures.value( fname );
+	// Cube maps are kept apart from 2D textures of the same file
+	QString key = QStringLiteral( "cube:" ) + fname;
+	Tex * tx = textures.value( key );
 
 	if ( !tx ) {
 		tx = new Tex;
@@ -428,24 +682,38 @@ int TexCache::bindCube( const QString & fname )
 		tx->data = QByteArray();
 		tx->mipmaps = 0;
 		tx->reload = false;
+		tx->pending = false;
+		tx->read = false;
+		tx->streamed = 0;
 
-		textures.insert( tx->filename, tx );
+		textures.insert( key, tx );
 	}
 
-	QByteArray outData;
+	tx->lastBound = frame;
 
-	if ( tx->filepath.isEmpty() || tx->reload )
-		tx->filepath = find( tx->filename, nifFolder, outData );
+	// Environment maps are read like any other texture, the shapes using one draw without it meanwhile
+	if ( !tx->pending && !tx->read && ( tx->filepath.isEmpty() || tx->reload ) )
+		readFile( tx, key );
 
-	if ( !outData.isEmpty() ) {
-		tx->data = outData;
-	}
+	if ( tx->pending && !tx->id )
+		return 0;
 
-	if ( !tx->id || tx->reload ) {
+	if ( !tx->pending && ( !tx->id || tx->reload ) ) {
 		if ( QFile::exists( tx->filepath ) && QFileInfo( tx->filepath ).isWritable() && (!watcher->files().contains( tx->filepath )) )
 			watcher->addPath( tx->filepath );
 
-		tx->loadCube();
+		if ( tx->reload )
+			releaseShared( tx );
+
+		// Every shape and window using the same file gets the same cube map
+		QString shared = QStringLiteral( "cube:" ) + tx->filepath;
+		if ( tx->reload || !acquireShared( tx, shared ) ) {
+			tx->loadCube();
+			publishShared( tx, shared );
+		}
+
+		tx->read = false;
+		tx->data = QByteArray();
 	}
 
 	glBindTexture( GL_TEXTURE_CUBE_MAP, tx->id );
@@ -456,9 +724,11 @@ int TexCache::bindCube( const QString & fname )
 
 void TexCache::flush()
 {
+	generation++;
+	updateBudget();
+
 	for ( Tex * tx : textures ) {
-		if ( tx->id )
-			glDeleteTextures( 1, &tx->id );
+		releaseShared( tx );
 	}
 	qDeleteAll( textures );
 	textures.clear();
@@ -475,6 +745,56 @@ void TexCache::flush()
 	}
 }
 
+void TexCache::updateBudget()
+{
+	QSettings settings;
+	budget = qint64( settings.value( "Settings/Render/General/Texture Budget", 2048 ).toInt() ) * 1024 * 1024;
+}
+
+void TexCache::evict()
+{
+	quint64 current = frame++;
+
+	if ( budget <= 0 )
+		return;
+
+	qint64 used = 0;
+	QVector<QString> unused;
+
+	for ( auto it = textures.cbegin(); it != textures.cend(); ++it ) {
+		const Tex * tx = it.value();
+		if ( !tx->id )
+			continue;
+
+		used += tx->size();
+
+		// Textures still shown or about to be replaced by a file being read are kept
+		if ( tx->lastBound != current && !tx->pending )
+			unused.append( it.key() );
+	}
+
+	if ( used <= budget )
+		return;
+
+	std::sort( unused.begin(), unused.end(), [this]( const QString & a, const QString & b ) {
+		return textures.value( a )->lastBound < textures.value( b )->lastBound;
+	} );
+
+	for ( const QString & key : unused ) {
+		if ( used <= budget )
+			break;
+
+		Tex * tx = textures.take( key );
+		used -= tx->size();
+
+		if ( !tx->filepath.isEmpty() && watcher->files().contains( tx->filepath ) )
+			watcher->removePath( tx->filepath );
+
+		releaseShared( tx );
+		delete tx;
+	}
+}
+
 void TexCache::setNifFolder( const QString & folder )
 {
 	nifFolder = folder;
@@ -482,6 +802,33 @@ void TexCache::setNifFolder( const QString & folder )
 	emit sigRefresh();
 }
 
+TexCache::MemoryUsage TexCache::memoryUsage() const
+{
+	MemoryUsage usage;
+	usage.budget = budget;
+
+	auto add = [&usage]( const Tex * tx ) {
+		usage.cpu += tx->data.capacity();
+
+		if ( !tx->id )
+			return;
+
+		usage.textures++;
+
+		if ( tx->shared.isEmpty() )
+			usage.gpu += tx->size();
+		else
+			usage.shared += tx->size();
+	};
+
+	for ( const Tex * tx : textures )
+		add( tx );
+	for ( const Tex * tx : embedTextures )
+		add( tx );
+
+	return usage;
+}
+
 QString TexCache::info( const QModelIndex & iSource )
 {
 	QString temp;
@@ -549,6 +896,31 @@ bool TexCache::importFile( NifModel * nif, const QModelIndex & iSource, QModelIn
 *  TexCache::Tex
 */
 
+qint64 TexCache::Tex::size() const
+{
+	// Block compressed formats store 4x4 pixel blocks of 8 or 16 bytes
+	int blockBytes = 0;
+	if ( format.contains( "DXT1" ) || format.contains( "BC4" ) )
+		blockBytes = 8;
+	else if ( format.contains( "DXT3" ) || format.contains( "DXT5" ) || format.contains( "BC6H" ) || format.contains( "BC7" ) )
+		blockBytes = 16;
+
+	qint64 bytes = 0;
+	GLuint w = width, h = height;
+
+	for ( GLuint m = 0; m < std::max( mipmaps, GLuint( 1 ) ); m++ ) {
+		if ( blockBytes )
+			bytes += qint64( ( w + 3 ) / 4 ) * ( ( h + 3 ) / 4 ) * blockBytes;
+		else
+			bytes += qint64( w ) * h * 4;
+
+		w = std::max( w / 2, GLuint( 1 ) );
+		h = std::max( h / 2, GLuint( 1 ) );
+	}
+
+	return bytes;
+}
+
 void TexCache::Tex::load()
 {
 	if ( !id )
@@ -570,6 +942,69 @@ void TexCache::Tex::load()
 	}
 }
 
+bool TexCache::Tex::loadSmallest()
+{
+	streamed = 0;
+
+	QString fmt;
+	GLuint w, h, m;
+
+	// Textures up to this size are uploaded at once
+	const GLuint streamSize = 1024;
+	// The mipmaps uploaded when streaming starts
+	const GLuint smallestSize = 256;
+
+	if ( data.isEmpty() || !texCanLoadMips( filepath, data, fmt, w, h, m ) || std::max( w, h ) <= streamSize )
+		return false;
+
+	GLuint first = 0;
+	while ( first + 1 < m && std::max( w >> first, h >> first ) > smallestSize )
+		first++;
+
+	if ( !id )
+		glGenTextures( 1, &id );
+
+	reload = false;
+	status = QString();
+
+	glBindTexture( GL_TEXTURE_2D, id );
+
+	try
+	{
+		texLoadMips( data, first, m - 1 );
+	}
+	catch ( QString e )
+	{
+		status = e;
+		return false;
+	}
+
+	format = fmt;
+	width = w;
+	height = h;
+	mipmaps = m;
+	streamed = first;
+
+	return true;
+}
+
+void TexCache::Tex::loadNext()
+{
+	glBindTexture( GL_TEXTURE_2D, id );
+
+	try
+	{
+		texLoadMips( data, streamed - 1, streamed - 1 );
+		streamed--;
+	}
+	catch ( QString e )
+	{
+		// Keep drawing the mipmaps already uploaded
+		status = e;
+		streamed = 0;
+	}
+}
+
 void TexCache::Tex::loadCube()
 {
 	if ( !id )
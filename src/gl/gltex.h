@@ -40,6 +40,7 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QHash>
 #include <QPersistentModelIndex>
 #include <QString>
+#include <QThreadPool>
 
 
 //! @file gltex.h TexCache etc. header
@@ -79,10 +80,23 @@ class TexCache final : public QObject
 		GLuint mipmaps;
 		//! Determine whether the texture needs reloading
 		bool reload;
+		//! Whether the file is still being found and read on a worker thread
+		bool pending;
+		//! Whether the file has been read for the next upload
+		bool read;
+		//! Largest mipmap uploaded while the mipmaps are streamed from the smallest up, 0 once all are
+		GLuint streamed;
 		//! Format of the texture
 		QString format;
 		//! Status messages
 		QString status;
+		//! Key of the shared texture the id belongs to, empty if this cache owns the id
+		QString shared;
+		//! Frame in which the texture was last bound, see TexCache::evict()
+		quint64 lastBound;
+
+		//! Estimate the video memory used by the texture from its size, format and mipmaps
+		qint64 size() const;
 
 		//! Load the texture
 		void load();
@@ -90,6 +104,11 @@ class TexCache final : public QObject
 		//! Load the texture
 		void loadCube();
 
+		//! Start streaming a large texture by uploading its smallest mipmaps
+		bool loadSmallest();
+		//! Upload the next larger mipmap of a streamed texture
+		void loadNext();
+
 		//! Save the texture as a file
 		bool saveAsFile( const QModelIndex & index, QString & savepath );
 		//! Save the texture as pixel data
@@ -117,13 +136,44 @@ public:
 	bool importFile( NifModel * nif, const QModelIndex & iSource, QModelIndex & iData );
 
 	//! Find a texture based on its filename
+	/*!
+	 * Results, including textures which could not be found, are remembered per
+	 * file name and NIF folder until clearFound() is called.
+	 */
 	static QString find( const QString & file, const QString & nifFolder );
 	static QString find( const QString & file, const QString & nifFolder, QByteArray & data );
+	//! Forget where find() located textures, after the folders, archives or files changed
+	static void clearFound();
 	//! Remove the path from a filename
 	static QString stripPath( const QString & file, const QString & nifFolder );
 	//! Checks whether the given file can be loaded
 	static bool canLoad( const QString & file );
 
+	/*! Release textures which were not bound since the last call
+	 *
+	 * Called once per frame. While the textures exceed the budget, those least
+	 * recently bound are deleted first; a texture drawn in the frame stays resident.
+	 */
+	void evict();
+
+	//! The memory held by the textures, see memoryUsage()
+	struct MemoryUsage
+	{
+		//! Textures with an id
+		int textures = 0;
+		//! Bytes of file data kept for textures not uploaded yet
+		qint64 cpu = 0;
+		//! Estimated bytes of video memory of the textures this cache owns
+		qint64 gpu = 0;
+		//! Estimated bytes of video memory of the textures shared with other windows
+		qint64 shared = 0;
+		//! The budget of evict(), 0 if unlimited
+		qint64 budget = 0;
+	};
+
+	//! Measure the file data and the estimated video memory of the textures
+	MemoryUsage memoryUsage() const;
+
 signals:
 	void sigRefresh();
 
@@ -139,6 +189,21 @@ public slots:
 
 protected slots:
 	void fileChanged( const QString & filepath );
+	//! Receives the file found and read for a texture by readFile()
+	void fileRead( const QString & key, const QString & filepath, const QByteArray & data, int generation );
+
+protected:
+	//! Use the texture another window already loaded from the same file
+	static bool acquireShared( Tex * tx, const QString & key );
+	//! Offer a texture loaded from a file to the other windows
+	static void publishShared( Tex * tx, const QString & key );
+	//! Drop the texture id, deleting it once no window uses it
+	static void releaseShared( Tex * tx );
+
+	//! Find and read the file of a texture on a worker thread, reported back for the texture at key
+	void readFile( Tex * tx, const QString & key );
+	//! Bind the texture drawn while the file of a texture is read
+	static void bindPlaceholder();
 
 protected:
 	QHash<QString, Tex *> textures;
@@ -146,6 +211,18 @@ protected:
 	QFileSystemWatcher * watcher;
 
 	QString nifFolder;
+
+	//! Threads finding and reading texture files
+	QThreadPool readPool;
+	//! Incremented by flush() so that reads started before it are ignored
+	int generation = 0;
+
+	//! Incremented by evict() once per frame
+	quint64 frame = 0;
+	//! Video memory in bytes that textures may use before evict() releases them, 0 if unlimited
+	qint64 budget = 0;
+	//! Read the budget from the settings
+	void updateBudget();
 };
 
 float get_max_anisotropy();
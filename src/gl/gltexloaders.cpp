@@ -37,15 +37,32 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "dds/DirectDrawSurface.h" // unused? check if upstream has cleaner or documented API yet
 #include "SOIL.h"
 
+#include <dxgiformat.h>
+
 #include <QBuffer>
+#include <QCryptographicHash>
+#include <QDataStream>
 #include <QDebug>
+#include <QDir>
 #include <QFile>
 #include <QFileInfo>
 #include <QModelIndex>
 #include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QSaveFile>
+#include <QSettings>
+#include <QStandardPaths>
 #include <QString>
 #include <QtEndian>
 
+#include <algorithm>
+#include <cstring>
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#include <emmintrin.h>
+#define GLTEX_SSE2
+#endif
+
 
 /*! @file gltexloaders.cpp
  * @brief Texture loading functions.
@@ -69,6 +86,23 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define GL_COMPRESSED_LUMINANCE_ALPHA_3DC_ATI 0x8837
 #define FOURCC_ATI2 0x32495441
 #define FOURCC_BC5U 0x55354342
+#define FOURCC_DX10 0x30315844
+
+#ifndef GL_COMPRESSED_RED_RGTC1
+#define GL_COMPRESSED_RED_RGTC1 0x8DBB
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#endif
+#ifndef GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT
+#define GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT 0x8E8E
+#endif
+#ifndef GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT
+#define GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT 0x8E8F
+#endif
+
+//! nVidia flag for DXT5 normal maps, which are decoded on the CPU
+#define DDPF_NORMAL 0x80000000U
 
 //! Shift amounts for RGBA conversion
 static const int rgbashift[4] = {
@@ -117,7 +151,127 @@ bool isPowerOfTwo( unsigned int x )
 	return ( x == 1 );
 }
 
+//! Halves an RGBA8 image in each direction that is larger than one pixel, averaging each 2x2 block.
+static void halveImage( const quint8 * src, int w, int h, quint8 * dst )
+{
+	int dw = ( w > 1 ) ? w / 2 : 1;
+	int dh = ( h > 1 ) ? h / 2 : 1;
+
+	int xo = ( w > 1 ) ? 4 : 0;
+
+	for ( int y = 0; y < dh; y++ ) {
+		const quint8 * r0 = src + ( h > 1 ? 2 * y : y ) * w * 4;
+		const quint8 * r1 = ( h > 1 ) ? r0 + w * 4 : r0;
+		int x = 0;
+
+#ifdef GLTEX_SSE2
+		if ( w > 1 ) {
+			const __m128i zero = _mm_setzero_si128();
+
+			// 8 source pixels of each row give 4 destination pixels
+			for ( ; x + 4 <= dw; x += 4 ) {
+				__m128i a = _mm_loadu_si128( (const __m128i *)( r0 + x * 8 ) );
+				__m128i b = _mm_loadu_si128( (const __m128i *)( r0 + x * 8 + 16 ) );
+				__m128i c = _mm_loadu_si128( (const __m128i *)( r1 + x * 8 ) );
+				__m128i d = _mm_loadu_si128( (const __m128i *)( r1 + x * 8 + 16 ) );
+
+				// Vertical sums, two pixels of 16 bit channels per register
+				__m128i v0 = _mm_add_epi16( _mm_unpacklo_epi8( a, zero ), _mm_unpacklo_epi8( c, zero ) );
+				__m128i v1 = _mm_add_epi16( _mm_unpackhi_epi8( a, zero ), _mm_unpackhi_epi8( c, zero ) );
+				__m128i v2 = _mm_add_epi16( _mm_unpacklo_epi8( b, zero ), _mm_unpacklo_epi8( d, zero ) );
+				__m128i v3 = _mm_add_epi16( _mm_unpackhi_epi8( b, zero ), _mm_unpackhi_epi8( d, zero ) );
+
+				// Horizontal sums of neighbouring pixels
+				__m128i s0 = _mm_add_epi16( _mm_unpacklo_epi64( v0, v1 ), _mm_unpackhi_epi64( v0, v1 ) );
+				__m128i s1 = _mm_add_epi16( _mm_unpacklo_epi64( v2, v3 ), _mm_unpackhi_epi64( v2, v3 ) );
+
+				__m128i out = _mm_packus_epi16( _mm_srli_epi16( s0, 2 ), _mm_srli_epi16( s1, 2 ) );
+				_mm_storeu_si128( (__m128i *)( dst + x * 4 ), out );
+			}
+		}
+#endif
+
+		for ( ; x < dw; x++ ) {
+			const quint8 * p0 = r0 + ( w > 1 ? 2 * x : x ) * 4;
+			const quint8 * p1 = r1 + ( w > 1 ? 2 * x : x ) * 4;
+			quint8 * q = dst + x * 4;
+
+			for ( int b = 0; b < 4; b++ )
+				q[b] = ( p0[b] + p0[b + xo] + p1[b] + p1[b + xo] ) / 4;
+		}
+
+		dst += dw * 4;
+	}
+}
+
+//! Generates the levels after \a m - 1 of the current texture on the GPU, if the driver can
+static bool generateMipMapsGL( int m, int w, int h, int & total )
+{
+	QOpenGLContext * context = QOpenGLContext::currentContext();
+	if ( !context )
+		return false;
+
+	static int supported = -1;
+	if ( supported < 0 ) {
+		supported = context->format().majorVersion() >= 3
+			|| context->hasExtension( "GL_ARB_framebuffer_object" )
+			|| context->hasExtension( "GL_EXT_framebuffer_object" );
+	}
+
+	if ( !supported )
+		return false;
+
+	// Only the levels above the base level are written
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, m - 1 );
+	context->functions()->glGenerateMipmap( GL_TEXTURE_2D );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0 );
+
+	total = m;
+	while ( w > 1 || h > 1 ) {
+		w = std::max( w / 2, 1 );
+		h = std::max( h / 2, 1 );
+		total++;
+	}
+
+	return true;
+}
+
+//! Uploads the levels after \a m - 1, downsampling \a data of \a w by \a h RGBA8 pixels
+static int uploadMipMaps( int m, const quint8 * data, int w, int h )
+{
+	if ( !data )
+		return m;
+
+	quint8 * buffer = (quint8 *)malloc( std::max( w / 2, 1 ) * std::max( h / 2, 1 ) * 4 * 2 );
+	if ( !buffer )
+		return m;
+
+	// Alternate between the two halves of the buffer
+	quint8 * levels[2] = { buffer, buffer + std::max( w / 2, 1 ) * std::max( h / 2, 1 ) * 4 };
+	const quint8 * src = data;
+	int i = 0;
+
+	while ( w > 1 || h > 1 ) {
+		quint8 * dst = levels[i];
+		halveImage( src, w, h, dst );
+
+		w = std::max( w / 2, 1 );
+		h = std::max( h / 2, 1 );
+
+		glTexImage2D( GL_TEXTURE_2D, m++, 4, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, dst );
+
+		src = dst;
+		i ^= 1;
+	}
+
+	free( buffer );
+
+	return m;
+}
+
 /*! Completes mipmap sequence of the current active OpenGL texture.
+ *
+ * Uses glGenerateMipmap when available, otherwise reads back the last level.
  *
  * @param m Number of mipmaps that are already in the texture.
  * @return	Total number of mipmaps.
@@ -130,55 +284,42 @@ int generateMipMaps( int m )
 	glGetTexLevelParameteriv( GL_TEXTURE_2D, m - 1, GL_TEXTURE_WIDTH, &w );
 	glGetTexLevelParameteriv( GL_TEXTURE_2D, m - 1, GL_TEXTURE_HEIGHT, &h );
 
-	//qDebug() << m-1 << w << h;
+	int total = m;
+	if ( generateMipMapsGL( m, w, h, total ) )
+		return total;
 
 	quint8 * data = (quint8 *)malloc( w * h * 4 );
-	glGetTexImage( GL_TEXTURE_2D, m - 1, GL_RGBA, GL_UNSIGNED_BYTE, data );
-
-	// now generate the mipmaps until width is one or height is one.
-	while ( w > 1 || h > 1 ) {
-		// Shut up Code Analysis C6011
-		if ( !data )
-			break;
-		// the buffer overwrites itself to save memory
-		const quint8 * src = data;
-		quint8 * dst = data;
-
-		quint32 xo = ( w > 1 ? 1 * 4 : 0 );
-		quint32 yo = ( h > 1 ? w * 4 : 0 );
-
-		w /= 2;
-		h /= 2;
-
-		if ( w == 0 )
-			w = 1;
-
-		if ( h == 0 )
-			h = 1;
-
-		//qDebug() << m << w << h;
-
-		for ( int y = 0; y < h; y++ ) {
-			for ( int x = 0; x < w; x++ ) {
-				for ( int b = 0; b < 4; b++ ) {
-					*dst++ = ( *(src + xo) + *(src + yo) + *(src + xo + yo) + *src) / 4;
-					src++;
-				}
+	if ( !data )
+		return m;
 
-				src += xo;
-			}
-
-			src += yo;
-		}
+	glGetTexImage( GL_TEXTURE_2D, m - 1, GL_RGBA, GL_UNSIGNED_BYTE, data );
 
-		glTexImage2D( GL_TEXTURE_2D, m++, 4, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, data );
-	}
+	m = uploadMipMaps( m, data, w, h );
 
 	free( data );
 
 	return m;
 }
 
+/*! Completes mipmap sequence of the current active OpenGL texture from the pixels of its last level.
+ *
+ * Avoids reading the texture back when glGenerateMipmap is not available.
+ *
+ * @param m		Number of mipmaps that are already in the texture.
+ * @param data	The RGBA8 pixels of level \a m - 1.
+ * @param w		Width of level \a m - 1.
+ * @param h		Height of level \a m - 1.
+ * @return		Total number of mipmaps.
+ */
+int generateMipMaps( int m, const quint8 * data, int w, int h )
+{
+	int total = m;
+	if ( generateMipMapsGL( m, w, h, total ) )
+		return total;
+
+	return uploadMipMaps( m, data, w, h );
+}
+
 /*! Converts RLE-encoded data into pixel data.
  *
  * TGA in particular uses the PackBits format described at
@@ -188,42 +329,162 @@ bool uncompressRLE( QIODevice & f, int w, int h, int bytespp, quint8 * pixel )
 {
 	QByteArray data = f.readAll();
 
+	const quint8 * src = (const quint8 *)data.constData();
+	const int size = data.count();
+
 	int c = 0; // total pixel count
 	int o = 0; // data offset
 
-	quint8 rl; // runlength - 1
-
 	while ( c < w * h ) {
-		rl = data[o++];
-
-		if ( rl & 0x80 ) {
-			// if RLE packet
-			quint8 px[8] = {}; // pixel data in this packet (assume bytespp < 8)
+		if ( o >= size )
+			return false;
 
-			for ( int b = 0; b < bytespp; b++ )
-				px[b] = data[o++];
+		quint8 rl = src[o++]; // runlength - 1
+		int count = std::min( ( rl & 0x7f ) + 1, w * h - c );
 
-			rl &= 0x7f; // strip RLE bit
+		if ( rl & 0x80 ) {
+			// if RLE packet, expand the pixel data count times
+			if ( o + bytespp > size )
+				return false;
 
-			do {
-				for ( int b = 0; b < bytespp; b++ )
-					*pixel++ = px[b]; // expand pixel data (rl+1) times
-			} while ( ++c < w * h && rl-- > 0 );
+			const quint8 * px = src + o;
+			o += bytespp;
+
+			if ( bytespp == 4 ) {
+				quint32 v;
+				memcpy( &v, px, 4 );
+				for ( int i = 0; i < count; i++, pixel += 4 )
+					memcpy( pixel, &v, 4 );
+			} else if ( bytespp == 1 ) {
+				memset( pixel, *px, count );
+				pixel += count;
+			} else {
+				for ( int i = 0; i < count; i++, pixel += bytespp )
+					memcpy( pixel, px, bytespp );
+			}
 		} else {
-			do {
-				for ( int b = 0; b < bytespp; b++ )
-					*pixel++ = data[o++]; // write (rl+1) raw pixels
-			} while ( ++c < w * h && rl-- > 0 );
+			// write count raw pixels
+			int bytes = count * bytespp;
+			if ( o + bytes > size )
+				return false;
+
+			memcpy( pixel, src + o, bytes );
+			pixel += bytes;
+			o += bytes;
 		}
 
-		if ( o >= data.count() )
+		c += count;
+
+		if ( o >= size )
 			return false;
 	}
 
 	return true;
 }
 
+//! Converts one row of pixels of a known layout to RGBA
+typedef void ( *ConvertRow )( const quint8 * src, quint32 * dst, int w );
+
+//! RGBA in memory order, as in #RGBA_INV_MASK
+static void convertRowRGBA( const quint8 * src, quint32 * dst, int w )
+{
+	memcpy( dst, src, w * 4 );
+}
+
+//! BGRA in memory order, as in #TGA_RGBA_MASK; alpha is forced opaque if \a opaque
+template <bool opaque> static void convertRowBGRA( const quint8 * src, quint32 * dst, int w )
+{
+	int x = 0;
+
+#ifdef GLTEX_SSE2
+	const __m128i ag = _mm_set1_epi32( opaque ? 0x0000ff00 : 0xff00ff00 );
+	const __m128i rb = _mm_set1_epi32( 0x000000ff );
+	const __m128i a = _mm_set1_epi32( opaque ? 0xff000000 : 0 );
+
+	for ( ; x + 4 <= w; x += 4 ) {
+		__m128i p = _mm_loadu_si128( (const __m128i *)( src + x * 4 ) );
+		__m128i r = _mm_and_si128( _mm_srli_epi32( p, 16 ), rb );
+		__m128i b = _mm_slli_epi32( _mm_and_si128( p, rb ), 16 );
+		__m128i q = _mm_or_si128( _mm_or_si128( _mm_and_si128( p, ag ), a ), _mm_or_si128( r, b ) );
+		_mm_storeu_si128( (__m128i *)( dst + x ), q );
+	}
+#endif
+
+	for ( ; x < w; x++ ) {
+		quint32 p;
+		memcpy( &p, src + x * 4, 4 );
+		quint32 q = ( p & ( opaque ? 0x0000ff00 : 0xff00ff00 ) ) | ( ( p >> 16 ) & 0xff ) | ( ( p & 0xff ) << 16 );
+		dst[x] = opaque ? ( q | 0xff000000 ) : q;
+	}
+}
+
+//! BGR in memory order, as in #TGA_RGB_MASK with 3 bytes per pixel
+static void convertRowBGR( const quint8 * src, quint32 * dst, int w )
+{
+	for ( int x = 0; x < w; x++, src += 3 )
+		dst[x] = 0xff000000 | ( quint32( src[0] ) << 16 ) | ( quint32( src[1] ) << 8 ) | src[2];
+}
+
+//! Greyscale, as in #TGA_L_MASK
+static void convertRowL( const quint8 * src, quint32 * dst, int w )
+{
+	for ( int x = 0; x < w; x++ )
+		dst[x] = 0xff000000 | ( quint32( src[x] ) * 0x010101 );
+}
+
+//! Greyscale with alpha, as in #TGA_LA_MASK
+static void convertRowLA( const quint8 * src, quint32 * dst, int w )
+{
+	for ( int x = 0; x < w; x++, src += 2 )
+		dst[x] = ( quint32( src[1] ) << 24 ) | ( quint32( src[0] ) * 0x010101 );
+}
+
+//! Alpha only
+static void convertRowA( const quint8 * src, quint32 * dst, int w )
+{
+	for ( int x = 0; x < w; x++ )
+		dst[x] = quint32( src[x] ) << 24;
+}
+
+//! Picks a row converter for the common layouts, or null if the generic conversion is needed
+static ConvertRow rowConverter( int bytespp, const quint32 mask[] )
+{
+	auto is = [mask]( quint32 r, quint32 g, quint32 b, quint32 a ) {
+		return mask[0] == r && mask[1] == g && mask[2] == b && mask[3] == a;
+	};
+
+	switch ( bytespp ) {
+	case 4:
+		if ( is( 0x000000ff, 0x0000ff00, 0x00ff0000, 0xff000000 ) )
+			return convertRowRGBA;
+		if ( is( 0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000 ) )
+			return convertRowBGRA<false>;
+		if ( is( 0x00ff0000, 0x0000ff00, 0x000000ff, 0x00000000 ) )
+			return convertRowBGRA<true>;
+		break;
+	case 3:
+		if ( is( 0x00ff0000, 0x0000ff00, 0x000000ff, 0x00000000 ) )
+			return convertRowBGR;
+		break;
+	case 2:
+		if ( is( 0x00ff, 0x00ff, 0x00ff, 0xff00 ) )
+			return convertRowLA;
+		break;
+	case 1:
+		if ( is( 0xff, 0xff, 0xff, 0x00 ) )
+			return convertRowL;
+		if ( is( 0x00, 0x00, 0x00, 0xff ) )
+			return convertRowA;
+		break;
+	}
+
+	return nullptr;
+}
+
 /*! Convert pixels to RGBA
+ *
+ * Common layouts are converted a row at a time by specialised functions,
+ * other masks go through a single pass extracting every channel.
  *
  * @param data		Pixels to convert
  * @param w			Width of the image
@@ -236,51 +497,62 @@ bool uncompressRLE( QIODevice & f, int w, int h, int bytespp, quint8 * pixel )
  */
 void convertToRGBA( const quint8 * data, int w, int h, int bytespp, const quint32 mask[], bool flipV, bool flipH, quint8 * pixl )
 {
-	memset( pixl, 0, w * h * 4 );
+	ConvertRow convert = flipH ? nullptr : rowConverter( bytespp, mask );
+
+	if ( convert ) {
+		for ( int y = 0; y < h; y++ )
+			convert( data + y * w * bytespp, (quint32 *)( pixl + 4 * w * ( flipV ? h - y - 1 : y ) ), w );
+
+		return;
+	}
+
+	quint32 msks[4];
+	int rshifts[4], lshifts[4];
+	quint32 fill = 0;
 
 	for ( int a = 0; a < 4; a++ ) {
-		if ( mask[a] ) {
-			quint32 msk = mask[ a ];
-			int rshift  = 0;
+		quint32 msk = mask[ a ];
+		int rshift  = 0;
 
-			while ( msk != 0 && ( msk & 0xffffff00 ) ) {
-				msk = msk >> 1; rshift++;
-			}
+		while ( msk != 0 && ( msk & 0xffffff00 ) ) {
+			msk = msk >> 1; rshift++;
+		}
 
-			int lshift = rgbashift[ a ];
+		int lshift = rgbashift[ a ];
 
-			while ( msk != 0 && ( ( msk & 0x80 ) == 0 ) ) {
-				msk = msk << 1; lshift++;
-			}
+		while ( msk != 0 && ( ( msk & 0x80 ) == 0 ) ) {
+			msk = msk << 1; lshift++;
+		}
 
-			msk = mask[ a ];
+		msks[a] = mask[ a ];
+		rshifts[a] = rshift;
+		lshifts[a] = lshift;
+	}
 
-			const quint8 * src = data;
-			const quint32 inc  = ( flipH ? -1 : 1 );
+	// Missing alpha is opaque
+	if ( !mask[3] )
+		fill = 0xff << rgbashift[ 3 ];
 
-			for ( int y = 0; y < h; y++ ) {
-				quint32 * dst = (quint32 *)( pixl + 4 * ( w * ( flipV ? h - y - 1 : y ) + ( flipH ? w - 1 : 0 ) ) );
+	const quint8 * src = data;
+	const int inc = ( flipH ? -1 : 1 );
 
-				if ( rshift == lshift ) {
-					for ( int x = 0; x < w; x++ ) {
-						*dst |= *( (const quint32 *)src ) & msk;
-						dst  += inc;
-						src  += bytespp;
-					}
-				} else {
-					for ( int x = 0; x < w; x++ ) {
-						*dst |= ( *( (const quint32 *)src ) & msk ) >> rshift << lshift;
-						dst  += inc;
-						src  += bytespp;
-					}
-				}
+	for ( int y = 0; y < h; y++ ) {
+		quint32 * dst = (quint32 *)( pixl + 4 * ( w * ( flipV ? h - y - 1 : y ) + ( flipH ? w - 1 : 0 ) ) );
+
+		for ( int x = 0; x < w; x++ ) {
+			// Reads up to 3 bytes past the last pixel, the buffers hold 4 bytes per pixel
+			quint32 p;
+			memcpy( &p, src, 4 );
+
+			quint32 q = fill;
+			for ( int a = 0; a < 4; a++ ) {
+				if ( msks[a] )
+					q |= ( p & msks[a] ) >> rshifts[a] << lshifts[a];
 			}
-		} else if ( a == 3 ) {
-			quint32 * dst = (quint32 *)pixl;
-			quint32 x = 0xff << rgbashift[ a ];
 
-			for ( int c = w * h; c > 0; c-- )
-				*dst++ |= x;
+			*dst = q;
+			dst += inc;
+			src += bytespp;
 		}
 	}
 }
@@ -331,12 +603,12 @@ int texLoadRaw( QIODevice & f, int width, int height, int num_mipmaps, int bpp,
 			break;
 	}
 
+	if ( w > 1 || h > 1 )
+		m = generateMipMaps( m, data2, w, h );
+
 	free( data2 );
 	free( data1 );
 
-	if ( w > 1 || h > 1 )
-		m = generateMipMaps( m );
-
 	return m;
 }
 
@@ -394,12 +666,12 @@ int texLoadPal( QIODevice & f, int width, int height, int num_mipmaps, int bpp,
 			break;
 	}
 
+	if ( w > 1 || h > 1 )
+		m = generateMipMaps( m, pixl, w, h );
+
 	free( pixl );
 	free( data );
 
-	if ( w > 1 || h > 1 )
-		m = generateMipMaps( m );
-
 	return m;
 }
 
@@ -684,6 +956,194 @@ GLuint texLoadDXT( QIODevice & f, GLenum glFormat, int /*blockSize*/, quint32 /*
 */
 }
 
+//! Whether the current context can upload textures compressed with \a extension, or which is part of OpenGL \a major
+static bool hasCompression( const char * extension, int major = 0 )
+{
+	QOpenGLContext * context = QOpenGLContext::currentContext();
+	return context && ( context->hasExtension( extension ) || ( major && context->format().majorVersion() >= major ) );
+}
+
+/*! Upload block compressed mipmaps exactly as they are stored
+ *
+ * @param f			The file, positioned at the first mipmap
+ * @param glFormat	The compressed format
+ * @param blockSize	The size of one 4x4 block
+ * @param width		The width of the first mipmap
+ * @param height	The height of the first mipmap
+ * @param mipmaps	The number of mipmaps in the file
+ * @param target	The texture or cube map face to upload to
+ * @return			The number of mipmaps uploaded
+ */
+static GLuint texLoadCompressed( QIODevice & f, GLenum glFormat, int blockSize, quint32 width, quint32 height, quint32 mipmaps, GLenum target = GL_TEXTURE_2D )
+{
+	QOpenGLFunctions * fn = QOpenGLContext::currentContext()->functions();
+
+	// The levels of a file in memory, such as one read from an archive, are uploaded without a copy
+	QBuffer * buffer = qobject_cast<QBuffer *>( &f );
+
+	GLuint m = 0;
+	bool complete = false;
+
+	while ( m < mipmaps ) {
+		quint32 w = std::max( width >> m, 1U );
+		quint32 h = std::max( height >> m, 1U );
+		qint64 size = qint64( ( w + 3 ) / 4 ) * ( ( h + 3 ) / 4 ) * blockSize;
+
+		QByteArray level;
+		const char * pixels = nullptr;
+
+		if ( buffer && buffer->pos() + size <= buffer->size() ) {
+			pixels = buffer->data().constData() + buffer->pos();
+			buffer->seek( buffer->pos() + size );
+		} else {
+			level = f.read( size );
+			if ( level.size() == size )
+				pixels = level.constData();
+		}
+
+		if ( !pixels ) {
+			if ( m == 0 )
+				throw QString( "unexpected EOF" );
+			break;
+		}
+
+		// DDS rows are stored top down, which is also the orientation the texture coordinates expect
+		fn->glCompressedTexImage2D( target, m++, glFormat, w, h, 0, size, pixels );
+
+		if ( w == 1 && h == 1 ) {
+			complete = true;
+			break;
+		}
+	}
+
+	// Sampling a shorter chain than the full one would leave the texture incomplete
+	bool face = target >= GL_TEXTURE_CUBE_MAP_POSITIVE_X && target <= GL_TEXTURE_CUBE_MAP_NEGATIVE_Z;
+	glTexParameteri( face ? GL_TEXTURE_CUBE_MAP : target, GL_TEXTURE_MAX_LEVEL, complete ? 1000 : m - 1 );
+
+	return m;
+}
+
+/*! The GL format of the S3TC compression of a DDS FourCC
+ *
+ * @param fourcc	The FourCC of the pixel format
+ * @param glFormat	Contains the GL internal format on success
+ * @param blockSize	Contains the bytes of a 4x4 block on success
+ * @param name		If not null, contains the name of the compression on success
+ * @return			False if \a fourcc is not DXT1, DXT3 or DXT5
+ */
+static bool s3tcFormat( quint32 fourcc, GLenum & glFormat, int & blockSize, QString * name = nullptr )
+{
+	switch ( fourcc ) {
+	case FOURCC_DXT1:
+		glFormat = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+		blockSize = 8;
+		break;
+	case FOURCC_DXT3:
+		glFormat = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT;
+		blockSize = 16;
+		break;
+	case FOURCC_DXT5:
+		glFormat = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+		blockSize = 16;
+		break;
+	default:
+		return false;
+	}
+
+	if ( name )
+		*name = QString::fromLatin1( reinterpret_cast<const char *>( &fourcc ), 4 );
+
+	return true;
+}
+
+GLuint texLoadDDS( QIODevice & f, QString & texformat );
+
+//! Load a DDS texture with a DX10 header, positioned after the DDS header
+static GLuint texLoadDX10( QIODevice & f, const DDSFormat & ddsHeader, QString & texformat )
+{
+	quint32 dx10[5];
+	if ( f.read( (char *)dx10, sizeof( dx10 ) ) != sizeof( dx10 ) )
+		throw QString( "unexpected EOF" );
+
+	quint32 legacy = 0;
+	GLenum glFormat = 0;
+	int blockSize = 16;
+
+	switch ( dx10[0] ) {
+	case DXGI_FORMAT_BC1_UNORM:
+	case DXGI_FORMAT_BC1_UNORM_SRGB:
+		legacy = FOURCC_DXT1;
+		break;
+	case DXGI_FORMAT_BC2_UNORM:
+	case DXGI_FORMAT_BC2_UNORM_SRGB:
+		legacy = FOURCC_DXT3;
+		break;
+	case DXGI_FORMAT_BC3_UNORM:
+	case DXGI_FORMAT_BC3_UNORM_SRGB:
+		legacy = FOURCC_DXT5;
+		break;
+	case DXGI_FORMAT_BC5_UNORM:
+		legacy = FOURCC_ATI2;
+		break;
+	case DXGI_FORMAT_BC4_UNORM:
+		if ( !hasCompression( "GL_ARB_texture_compression_rgtc", 3 ) )
+			throw QString( "BC4 textures are not supported by the graphics driver" );
+		glFormat = GL_COMPRESSED_RED_RGTC1;
+		blockSize = 8;
+		texformat += " (BC4)";
+		break;
+	case DXGI_FORMAT_BC6H_UF16:
+	case DXGI_FORMAT_BC6H_SF16:
+		if ( !hasCompression( "GL_ARB_texture_compression_bptc", 5 ) )
+			throw QString( "BC6H textures are not supported by the graphics driver" );
+		glFormat = ( dx10[0] == DXGI_FORMAT_BC6H_UF16 ) ? GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT : GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT;
+		texformat += " (BC6H)";
+		break;
+	case DXGI_FORMAT_BC7_UNORM:
+	case DXGI_FORMAT_BC7_UNORM_SRGB:
+		if ( !hasCompression( "GL_ARB_texture_compression_bptc", 5 ) )
+			throw QString( "BC7 textures are not supported by the graphics driver" );
+		glFormat = GL_COMPRESSED_RGBA_BPTC_UNORM;
+		texformat += " (BC7)";
+		break;
+	case DXGI_FORMAT_B8G8R8A8_UNORM:
+	case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
+		texformat += " (BGRA)";
+		return texLoadRaw( f, ddsHeader.dwWidth, ddsHeader.dwHeight, ddsHeader.dwMipMapCount, 32, 4, TGA_RGBA_MASK );
+	case DXGI_FORMAT_B8G8R8X8_UNORM:
+	case DXGI_FORMAT_B8G8R8X8_UNORM_SRGB:
+		texformat += " (BGRX)";
+		return texLoadRaw( f, ddsHeader.dwWidth, ddsHeader.dwHeight, ddsHeader.dwMipMapCount, 32, 4, TGA_RGB_MASK );
+	case DXGI_FORMAT_R8G8B8A8_UNORM:
+	case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
+		texformat += " (RGBA)";
+		return texLoadRaw( f, ddsHeader.dwWidth, ddsHeader.dwHeight, ddsHeader.dwMipMapCount, 32, 4, RGBA_INV_MASK );
+	case DXGI_FORMAT_R8_UNORM:
+		texformat += " (R8)";
+		return texLoadRaw( f, ddsHeader.dwWidth, ddsHeader.dwHeight, ddsHeader.dwMipMapCount, 8, 1, TGA_L_MASK );
+	default:
+		throw QString( "unsupported DXGI format %1" ).arg( dx10[0] );
+	}
+
+	if ( glFormat )
+		return texLoadCompressed( f, glFormat, blockSize, ddsHeader.dwWidth, ddsHeader.dwHeight, ddsHeader.dwMipMapCount );
+
+	// Formats with a FourCC of their own are loaded as if the file had no DX10 header
+	qint64 dataStart = f.pos();
+	f.seek( 0 );
+	QByteArray data = f.read( ddsHeader.dwSize + 4 );
+	data.append( f.readAll() );
+	if ( data.size() < 4 + 84 || dataStart != ddsHeader.dwSize + 4 + qint64( sizeof( dx10 ) ) )
+		throw QString( "unexpected EOF" );
+
+	memcpy( data.data() + 4 + 80, &legacy, sizeof( legacy ) );
+
+	QBuffer buffer( &data );
+	buffer.open( QIODevice::ReadOnly );
+
+	return texLoadDDS( buffer, texformat );
+}
+
 //! Load a (possibly compressed) dds texture.
 GLuint texLoadDDS( QIODevice & f, QString & texformat )
 {
@@ -704,36 +1164,30 @@ GLuint texLoadDDS( QIODevice & f, QString & texformat )
 
 	f.seek( ddsHeader.dwSize + 4 );
 
-	if ( ddsHeader.ddsPixelFormat.dwFlags & DDPF_FOURCC ) {
+	if ( ( ddsHeader.ddsPixelFormat.dwFlags & DDPF_FOURCC ) && ddsHeader.ddsPixelFormat.dwFourCC == FOURCC_DX10 ) {
+		return texLoadDX10( f, ddsHeader, texformat );
+	} else if ( ddsHeader.ddsPixelFormat.dwFlags & DDPF_FOURCC ) {
 		int blockSize = 8;
 		GLenum glFormat = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+		QString compression;
 
-		switch ( ddsHeader.ddsPixelFormat.dwFourCC ) {
-		case FOURCC_DXT1:
-			glFormat   = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
-			blockSize  = 8;
-			texformat += " (DXT1)";
-			break;
-		case FOURCC_DXT3:
-			glFormat   = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT;
-			blockSize  = 16;
-			texformat += " (DXT3)";
-			break;
-		case FOURCC_DXT5:
-			glFormat   = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
-			blockSize  = 16;
-			texformat += " (DXT5)";
-			break;
-		case FOURCC_ATI2:
-		case FOURCC_BC5U:
+		if ( s3tcFormat( ddsHeader.ddsPixelFormat.dwFourCC, glFormat, blockSize, &compression ) ) {
+			texformat += " (" + compression + ")";
+		} else if ( ddsHeader.ddsPixelFormat.dwFourCC == FOURCC_ATI2 || ddsHeader.ddsPixelFormat.dwFourCC == FOURCC_BC5U ) {
 			glFormat = GL_COMPRESSED_LUMINANCE_ALPHA_3DC_ATI;
 			blockSize = 16;
 			texformat += " (ATI2)";
-			break;
-		default:
+		} else {
 			throw QString( "unknown texture compression" );
 		}
 
+		// S3TC data goes to the driver as it is, 3DC and nVidia normal maps are converted while decoding
+		if ( glFormat != GL_COMPRESSED_LUMINANCE_ALPHA_3DC_ATI && !( ddsHeader.ddsPixelFormat.dwFlags & DDPF_NORMAL )
+			&& hasCompression( "GL_EXT_texture_compression_s3tc" ) )
+		{
+			return texLoadCompressed( f, glFormat, blockSize, ddsHeader.dwWidth, ddsHeader.dwHeight, ddsHeader.dwMipMapCount );
+		}
+
 		return texLoadDXT( f, glFormat, blockSize, ddsHeader.dwWidth, ddsHeader.dwHeight, ddsHeader.dwMipMapCount );
 	} else if ( ddsHeader.ddsPixelFormat.dwFlags & 0x20 ) {
 		// DDPF_PALETTEINDEXED8
@@ -1015,32 +1469,237 @@ GLuint texLoadBMP( QIODevice & f, QString & texformat )
 	return 0;
 }
 
-// (public function, documented in gltexloaders.h)
-bool texLoad( const QModelIndex & iData, QString & texformat, GLuint & width, GLuint & height, GLuint & mipmaps )
+//! Identifies a decoded texture cache file
+#define TEX_CACHE_MAGIC 0x58455443
+//! Bumped whenever the layout of the decoded texture cache changes
+#define TEX_CACHE_VERSION 1
+
+/*! The file keeping a decoded texture, empty if there is none
+ *
+ * Textures which have to be converted on the CPU are kept on disk once uploaded,
+ * by the hash of the data they were converted from, when the setting is on.
+ */
+static QString texCacheName( const QByteArray & data, const QByteArray & layout = QByteArray() )
 {
-	bool ok = false;
-	const NifModel * nif = qobject_cast<const NifModel *>( iData.model() );
+	QSettings settings;
+	if ( !settings.value( "Settings/Render/General/Cache Decoded Textures", false ).toBool() )
+		return QString();
 
-	if ( nif && iData.isValid() ) {
-		mipmaps = nif->get<uint>( iData, "Num Mipmaps" );
-		QModelIndex iMipmaps = nif->getIndex( iData, "Mipmaps" );
+	QString cacheDir = QStandardPaths::writableLocation( QStandardPaths::CacheLocation );
+	if ( cacheDir.isEmpty() )
+		return QString();
 
-		if ( mipmaps > 0 && iMipmaps.isValid() ) {
-			QModelIndex iMipmap = iMipmaps.child( 0, 0 );
-			width  = nif->get<uint>( iMipmap, "Width" );
-			height = nif->get<uint>( iMipmap, "Height" );
-		}
+	QCryptographicHash hash( QCryptographicHash::Sha1 );
+	hash.addData( data );
+	hash.addData( layout );
 
-		int bpp = nif->get<uint>( iData, "Bits Per Pixel" );
-		int bytespp = nif->get<uint>( iData, "Bytes Per Pixel" );
-		uint format = nif->get<uint>( iData, "Pixel Format" );
-		bool flipV  = false;
-		bool flipH  = false;
-		bool rle = false;
+	return QDir( cacheDir ).filePath( "textures/" + QString::fromLatin1( hash.result().toHex() ) + ".cache" );
+}
 
-		QBuffer buf;
+/*! Upload the mipmaps of a decoded texture written by texSaveCache()
+ *
+ * @param cachename	The cache file
+ * @param texformat	Contains the format of the source texture on success
+ * @return			The number of mipmaps uploaded, 0 if the texture was not cached
+ */
+static GLuint texLoadCache( const QString & cachename, QString & texformat )
+{
+	QFile f( cachename );
 
-		QModelIndex iPixelData = nif->getIndex( iData, "Pixel Data" );
+	if ( !f.open( QIODevice::ReadOnly ) )
+		return 0;
+
+	QByteArray data = f.readAll();
+	QDataStream in( data );
+	in.setVersion( QDataStream::Qt_5_0 );
+
+	quint32 magic = 0, cacheVersion = 0, count = 0;
+	QString format;
+	in >> magic >> cacheVersion >> format >> count;
+
+	if ( magic != TEX_CACHE_MAGIC || cacheVersion != TEX_CACHE_VERSION || count == 0 || count > 32 )
+		return 0;
+
+	struct Level
+	{
+		quint32 internalFormat, width, height;
+		bool compressed;
+		QByteArray pixels;
+	};
+
+	QVector<Level> levels( count );
+
+	for ( Level & l : levels )
+		in >> l.internalFormat >> l.width >> l.height >> l.compressed >> l.pixels;
+
+	if ( in.status() != QDataStream::Ok )
+		return 0;
+
+	QOpenGLFunctions * fn = QOpenGLContext::currentContext()->functions();
+
+	GLuint m = 0;
+
+	for ( const Level & l : levels ) {
+		if ( l.compressed ) {
+			fn->glCompressedTexImage2D( GL_TEXTURE_2D, m++, l.internalFormat, l.width, l.height, 0, l.pixels.size(), l.pixels.constData() );
+		} else {
+			if ( l.pixels.size() != qint64( l.width ) * l.height * 4 )
+				break;
+
+			glTexImage2D( GL_TEXTURE_2D, m++, l.internalFormat, l.width, l.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, l.pixels.constData() );
+		}
+	}
+
+	if ( m == 0 )
+		return 0;
+
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, m - 1 );
+
+	texformat = format;
+	return m;
+}
+
+/*! Delete the oldest decoded textures in \a dir until the rest fit in the setting
+ *
+ * The budget is read in MiB, 0 keeping every file. Files are kept by the time
+ * they were written, so that the textures converted last stay.
+ */
+static void texTrimCache( const QDir & dir )
+{
+	QSettings settings;
+	qint64 budget = qint64( std::max( settings.value( "Settings/Render/General/Texture Cache Size", 1024 ).toInt(), 0 ) ) * 1024 * 1024;
+	if ( budget == 0 )
+		return;
+
+	qint64 used = 0;
+
+	for ( const QFileInfo & info : dir.entryInfoList( { "*.cache" }, QDir::Files, QDir::Time ) ) {
+		used += info.size();
+
+		if ( used > budget )
+			QFile::remove( info.absoluteFilePath() );
+	}
+}
+
+/*! Write the mipmaps of the bound texture for texLoadCache()
+ *
+ * Levels the driver keeps block compressed are written as they are, others as RGBA.
+ *
+ * @param cachename	The cache file
+ * @param texformat	The format of the source texture
+ */
+static void texSaveCache( const QString & cachename, const QString & texformat )
+{
+	auto glGetCompressedTexImage = (PFNGLGETCOMPRESSEDTEXIMAGEPROC)QOpenGLContext::currentContext()->getProcAddress( "glGetCompressedTexImage" );
+
+	QByteArray data;
+	QDataStream out( &data, QIODevice::WriteOnly );
+	out.setVersion( QDataStream::Qt_5_0 );
+
+	// The loaders may have generated more mipmaps than the source has, the chain ends at the first empty level
+	QVector<GLint> widths, heights;
+	for ( GLint m = 0; m < 32; m++ ) {
+		GLint w = 0, h = 0;
+		glGetTexLevelParameteriv( GL_TEXTURE_2D, m, GL_TEXTURE_WIDTH, &w );
+		glGetTexLevelParameteriv( GL_TEXTURE_2D, m, GL_TEXTURE_HEIGHT, &h );
+
+		if ( w <= 0 || h <= 0 )
+			break;
+
+		widths.append( w );
+		heights.append( h );
+	}
+
+	if ( widths.isEmpty() )
+		return;
+
+	out << quint32( TEX_CACHE_MAGIC ) << quint32( TEX_CACHE_VERSION ) << texformat << quint32( widths.count() );
+
+	for ( int m = 0; m < widths.count(); m++ ) {
+		GLint w = widths[m], h = heights[m], internalFormat = 0, compressed = 0, size = 0;
+		glGetTexLevelParameteriv( GL_TEXTURE_2D, m, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat );
+		glGetTexLevelParameteriv( GL_TEXTURE_2D, m, GL_TEXTURE_COMPRESSED, &compressed );
+
+		QByteArray pixels;
+
+		if ( compressed ) {
+			glGetTexLevelParameteriv( GL_TEXTURE_2D, m, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size );
+			if ( !glGetCompressedTexImage || size <= 0 )
+				return;
+
+			pixels.resize( size );
+			glGetCompressedTexImage( GL_TEXTURE_2D, m, pixels.data() );
+		} else {
+			pixels.resize( w * h * 4 );
+			glGetTexImage( GL_TEXTURE_2D, m, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data() );
+		}
+
+		out << quint32( internalFormat ) << quint32( w ) << quint32( h ) << bool( compressed ) << pixels;
+	}
+
+	QDir().mkpath( QFileInfo( cachename ).absolutePath() );
+
+	QSaveFile f( cachename );
+
+	if ( !f.open( QIODevice::WriteOnly ) )
+		return;
+
+	f.write( data );
+
+	if ( f.commit() )
+		texTrimCache( QFileInfo( cachename ).absoluteDir() );
+}
+
+//! Whether a DDS file is uploaded as it is stored, which leaves nothing to cache
+static bool texLoadsAsStored( const QByteArray & data )
+{
+	if ( data.size() < 4 + int( sizeof( DDSFormat ) ) )
+		return false;
+
+	DDSFormat ddsHeader;
+	memcpy( &ddsHeader, data.constData() + 4, sizeof( DDSFormat ) );
+
+	if ( !( ddsHeader.ddsPixelFormat.dwFlags & DDPF_FOURCC ) )
+		return false;
+
+	switch ( ddsHeader.ddsPixelFormat.dwFourCC ) {
+	case FOURCC_DX10:
+		return true;
+	case FOURCC_DXT1:
+	case FOURCC_DXT3:
+	case FOURCC_DXT5:
+		return !( ddsHeader.ddsPixelFormat.dwFlags & DDPF_NORMAL ) && hasCompression( "GL_EXT_texture_compression_s3tc" );
+	}
+
+	return false;
+}
+
+// (public function, documented in gltexloaders.h)
+bool texLoad( const QModelIndex & iData, QString & texformat, GLuint & width, GLuint & height, GLuint & mipmaps )
+{
+	bool ok = false;
+	const NifModel * nif = qobject_cast<const NifModel *>( iData.model() );
+
+	if ( nif && iData.isValid() ) {
+		mipmaps = nif->get<uint>( iData, "Num Mipmaps" );
+		QModelIndex iMipmaps = nif->getIndex( iData, "Mipmaps" );
+
+		if ( mipmaps > 0 && iMipmaps.isValid() ) {
+			QModelIndex iMipmap = iMipmaps.child( 0, 0 );
+			width  = nif->get<uint>( iMipmap, "Width" );
+			height = nif->get<uint>( iMipmap, "Height" );
+		}
+
+		int bpp = nif->get<uint>( iData, "Bits Per Pixel" );
+		int bytespp = nif->get<uint>( iData, "Bytes Per Pixel" );
+		uint format = nif->get<uint>( iData, "Pixel Format" );
+		bool flipV  = false;
+		bool flipH  = false;
+		bool rle = false;
+
+		QBuffer buf;
+
+		QModelIndex iPixelData = nif->getIndex( iData, "Pixel Data" );
 
 		if ( iPixelData.isValid() ) {
 			QModelIndex iFaceData = iPixelData.child( 0, 0 );
@@ -1112,57 +1771,72 @@ bool texLoad( const QModelIndex & iData, QString & texformat, GLuint & width, GL
 
 		texformat = "NIF";
 
-		switch ( format ) {
-		case 0: // PX_FMT_RGB8
-			texformat += " (RGB8)";
-			ok = ( 0 != texLoadRaw( buf, width, height, mipmaps, bpp, bytespp, mask, flipV, flipH, rle ) );
-			break;
-		case 1: // PX_FMT_RGBA8
-			texformat += " (RGBA8)";
-			ok = ( 0 != texLoadRaw( buf, width, height, mipmaps, bpp, bytespp, mask, flipV, flipH, rle ) );
-			break;
-		case 2: // PX_FMT_PAL8
-			{
-				texformat += " (PAL8)";
-				// Read the NiPalette entries; change this if we change NiPalette in nif.xml
-				QModelIndex iPalette = nif->getBlock( nif->getLink( iData, "Palette" ) );
-
-				if ( iPalette.isValid() ) {
-					QVector<quint32> map;
-					uint nmap = nif->get<uint>( iPalette, "Num Entries" );
-					map.resize( nmap );
-					QModelIndex iPaletteArray = nif->getIndex( iPalette, "Palette" );
-
-					if ( nmap > 0 && iPaletteArray.isValid() ) {
-						for ( uint i = 0; i < nmap; ++i ) {
-							QModelIndex iRGBElem = iPaletteArray.child( i, 0 );
-							quint8 r = nif->get<quint8>( iRGBElem, "r" );
-							quint8 g = nif->get<quint8>( iRGBElem, "g" );
-							quint8 b = nif->get<quint8>( iRGBElem, "b" );
-							quint8 a = nif->get<quint8>( iRGBElem, "a" );
-							map[i] = ( (quint32)( ( r | ( (quint16)g << 8 ) ) | ( ( (quint32)b ) << 16 ) | ( ( (quint32)a ) << 24 ) ) );
+		// The decoded pixels depend on the layout as well as the data; PAL8 also depends on its palette and is not kept
+		QString cachename;
+		if ( format != 2 ) {
+			QByteArray layout( (const char *)&hdr, sizeof( DDSFormat ) );
+			layout.append( char( format ) ).append( char( bytespp ) );
+			cachename = texCacheName( buf.data(), layout );
+		}
+
+		if ( !cachename.isEmpty() && texLoadCache( cachename, texformat ) ) {
+			ok = true;
+		} else {
+			switch ( format ) {
+			case 0: // PX_FMT_RGB8
+				texformat += " (RGB8)";
+				ok = ( 0 != texLoadRaw( buf, width, height, mipmaps, bpp, bytespp, mask, flipV, flipH, rle ) );
+				break;
+			case 1: // PX_FMT_RGBA8
+				texformat += " (RGBA8)";
+				ok = ( 0 != texLoadRaw( buf, width, height, mipmaps, bpp, bytespp, mask, flipV, flipH, rle ) );
+				break;
+			case 2: // PX_FMT_PAL8
+				{
+					texformat += " (PAL8)";
+					// Read the NiPalette entries; change this if we change NiPalette in nif.xml
+					QModelIndex iPalette = nif->getBlock( nif->getLink( iData, "Palette" ) );
+
+					if ( iPalette.isValid() ) {
+						QVector<quint32> map;
+						uint nmap = nif->get<uint>( iPalette, "Num Entries" );
+						map.resize( nmap );
+						QModelIndex iPaletteArray = nif->getIndex( iPalette, "Palette" );
+
+						if ( nmap > 0 && iPaletteArray.isValid() ) {
+							for ( uint i = 0; i < nmap; ++i ) {
+								QModelIndex iRGBElem = iPaletteArray.child( i, 0 );
+								quint8 r = nif->get<quint8>( iRGBElem, "r" );
+								quint8 g = nif->get<quint8>( iRGBElem, "g" );
+								quint8 b = nif->get<quint8>( iRGBElem, "b" );
+								quint8 a = nif->get<quint8>( iRGBElem, "a" );
+								map[i] = ( (quint32)( ( r | ( (quint16)g << 8 ) ) | ( ( (quint32)b ) << 16 ) | ( ( (quint32)a ) << 24 ) ) );
+							}
 						}
-					}
 
-					ok = ( 0 != texLoadPal( buf, width, height, mipmaps, bpp, bytespp, map.data(), flipV, flipH, rle ) );
+						ok = ( 0 != texLoadPal( buf, width, height, mipmaps, bpp, bytespp, map.data(), flipV, flipH, rle ) );
+					}
 				}
+				break;
+			case 4: //PX_FMT_DXT1
+				texformat += " (DXT1)";
+				hdr.ddsPixelFormat.dwFourCC = FOURCC_DXT1;
+				ok = ( 0 != texLoadDXT( hdr, (const unsigned char *)buf.data().data(), buf.size() ) );
+				break;
+			case 5: //PX_FMT_DXT5
+				texformat += " (DXT5)";
+				hdr.ddsPixelFormat.dwFourCC = FOURCC_DXT5;
+				ok = ( 0 != texLoadDXT( hdr, (const unsigned char *)buf.data().data(), buf.size() ) );
+				break;
+			case 6: //PX_FMT_DXT5_ALT
+				texformat += " (DXT5ALT)";
+				hdr.ddsPixelFormat.dwFourCC = FOURCC_DXT5;
+				ok = ( 0 != texLoadDXT( hdr, (const unsigned char *)buf.data().data(), buf.size() ) );
+				break;
 			}
-			break;
-		case 4: //PX_FMT_DXT1
-			texformat += " (DXT1)";
-			hdr.ddsPixelFormat.dwFourCC = FOURCC_DXT1;
-			ok = ( 0 != texLoadDXT( hdr, (const unsigned char *)buf.data().data(), buf.size() ) );
-			break;
-		case 5: //PX_FMT_DXT5
-			texformat += " (DXT5)";
-			hdr.ddsPixelFormat.dwFourCC = FOURCC_DXT5;
-			ok = ( 0 != texLoadDXT( hdr, (const unsigned char *)buf.data().data(), buf.size() ) );
-			break;
-		case 6: //PX_FMT_DXT5_ALT
-			texformat += " (DXT5ALT)";
-			hdr.ddsPixelFormat.dwFourCC = FOURCC_DXT5;
-			ok = ( 0 != texLoadDXT( hdr, (const unsigned char *)buf.data().data(), buf.size() ) );
-			break;
+
+			if ( ok && !cachename.isEmpty() )
+				texSaveCache( cachename, texformat );
 		}
 
 		if ( ok ) {
@@ -1228,16 +1902,32 @@ bool texLoad( const QString & filepath, QString & format, GLuint & width, GLuint
 	if ( !f.open( QIODevice::ReadOnly ) )
 		throw QString( "could not open buffer" );
 
-	if ( filepath.endsWith( ".dds", Qt::CaseInsensitive ) )
-		mipmaps = texLoadDDS( f, format );
-	else if ( filepath.endsWith( ".tga", Qt::CaseInsensitive ) )
-		mipmaps = texLoadTGA( f, format );
-	else if ( filepath.endsWith( ".bmp", Qt::CaseInsensitive ) )
-		mipmaps = texLoadBMP( f, format );
-	else if ( filepath.endsWith( ".nif", Qt::CaseInsensitive ) || filepath.endsWith( ".texcache", Qt::CaseInsensitive ) )
-		mipmaps = texLoadNIF( f, format );
-	else
-		throw QString( "unknown texture format" );
+	// Only textures converted while loading are worth keeping decoded, NIF pixel data is kept by texLoad()
+	QString cachename;
+	if ( filepath.endsWith( ".tga", Qt::CaseInsensitive ) || filepath.endsWith( ".bmp", Qt::CaseInsensitive )
+		|| ( filepath.endsWith( ".dds", Qt::CaseInsensitive ) && !texLoadsAsStored( data ) ) )
+	{
+		cachename = texCacheName( data );
+	}
+
+	if ( !cachename.isEmpty() )
+		mipmaps = texLoadCache( cachename, format );
+
+	if ( mipmaps == 0 ) {
+		if ( filepath.endsWith( ".dds", Qt::CaseInsensitive ) )
+			mipmaps = texLoadDDS( f, format );
+		else if ( filepath.endsWith( ".tga", Qt::CaseInsensitive ) )
+			mipmaps = texLoadTGA( f, format );
+		else if ( filepath.endsWith( ".bmp", Qt::CaseInsensitive ) )
+			mipmaps = texLoadBMP( f, format );
+		else if ( filepath.endsWith( ".nif", Qt::CaseInsensitive ) || filepath.endsWith( ".texcache", Qt::CaseInsensitive ) )
+			mipmaps = texLoadNIF( f, format );
+		else
+			throw QString( "unknown texture format" );
+
+		if ( mipmaps > 0 && !cachename.isEmpty() )
+			texSaveCache( cachename, format );
+	}
 
 	f.close();
 	data.clear();
@@ -1249,6 +1939,63 @@ bool texLoad( const QString & filepath, QString & format, GLuint & width, GLuint
 }
 
 
+/*! Upload the six faces of an S3TC cube map exactly as they are stored
+ *
+ * The faces follow each other in the file in the order of the GL cube map targets,
+ * they are uploaded straight from the buffer the file was read into.
+ *
+ * @param f			The file
+ * @param mipmaps	Contains the number of mipmaps of each face on success
+ * @return			False if the file is not a cube map stored this way, leaving it to SOIL
+ */
+static bool texLoadCubeFaces( QBuffer & f, GLuint & mipmaps )
+{
+	// Cube map flags in the caps of a DDS header, all faces must be present
+	const quint32 DDSCAPS2_CUBEMAP_ALL_FACES = 0x0000FE00;
+
+	const QByteArray & data = f.data();
+
+	if ( data.size() < 128 || strncmp( data.constData(), "DDS ", 4 ) != 0 )
+		return false;
+
+	DDSFormat ddsHeader;
+	memcpy( &ddsHeader, data.constData() + 4, sizeof( DDSFormat ) );
+
+	quint32 caps2 = qFromLittleEndian<quint32>( (const uchar *)data.constData() + 4 + 108 );
+	if ( ( caps2 & DDSCAPS2_CUBEMAP_ALL_FACES ) != DDSCAPS2_CUBEMAP_ALL_FACES )
+		return false;
+
+	if ( !( ddsHeader.ddsPixelFormat.dwFlags & DDPF_FOURCC ) || ( ddsHeader.ddsPixelFormat.dwFlags & DDPF_NORMAL )
+		|| !hasCompression( "GL_EXT_texture_compression_s3tc" ) )
+	{
+		return false;
+	}
+
+	GLenum glFormat;
+	int blockSize;
+
+	if ( !s3tcFormat( ddsHeader.ddsPixelFormat.dwFourCC, glFormat, blockSize ) )
+		return false;
+
+	if ( !( ddsHeader.dwFlags & DDSD_MIPMAPCOUNT ) || ddsHeader.dwMipMapCount == 0 )
+		ddsHeader.dwMipMapCount = 1;
+
+	f.seek( ddsHeader.dwSize + 4 );
+
+	for ( int face = 0; face < 6; face++ ) {
+		GLuint m = texLoadCompressed( f, glFormat, blockSize, ddsHeader.dwWidth, ddsHeader.dwHeight, ddsHeader.dwMipMapCount,
+			GL_TEXTURE_CUBE_MAP_POSITIVE_X + face );
+
+		// Every face must have the mipmaps of the first, or the next face would start in the wrong place
+		if ( face == 0 )
+			mipmaps = m;
+		else if ( m != mipmaps )
+			throw QString( "unexpected EOF" );
+	}
+
+	return true;
+}
+
 bool texLoadCube( const QString & filepath, QString & format, GLuint & width, GLuint & height, GLuint & mipmaps, QByteArray & data, GLuint id )
 {
 	Q_UNUSED( format );
@@ -1277,7 +2024,9 @@ bool texLoadCube( const QString & filepath, QString & format, GLuint & width, GL
 	if ( !f.open( QIODevice::ReadOnly ) )
 		throw QString( "could not open buffer" );
 	
-	if ( filepath.endsWith( ".dds", Qt::CaseInsensitive ) ) {
+	if ( filepath.endsWith( ".dds", Qt::CaseInsensitive ) && texLoadCubeFaces( f, mipmaps ) ) {
+		success = true;
+	} else if ( filepath.endsWith( ".dds", Qt::CaseInsensitive ) ) {
 
 		result = SOIL_load_OGL_single_cubemap_from_memory(
 			(const unsigned char *)f.data().constData(),
@@ -1309,6 +2058,97 @@ bool texLoadCube( const QString & filepath, QString & format, GLuint & width, GL
 }
 
 
+//! Read the layout of a DDS file whose mipmaps are uploaded as they are stored
+static bool texMipLayout( const QByteArray & data, DDSFormat & ddsHeader, GLenum & glFormat, int & blockSize )
+{
+	if ( data.size() < 128 || strncmp( data.constData(), "DDS ", 4 ) != 0 )
+		return false;
+
+	memcpy( &ddsHeader, data.constData() + 4, sizeof( DDSFormat ) );
+
+	if ( !( ddsHeader.ddsPixelFormat.dwFlags & DDPF_FOURCC ) || ( ddsHeader.ddsPixelFormat.dwFlags & DDPF_NORMAL )
+		|| !hasCompression( "GL_EXT_texture_compression_s3tc" ) )
+	{
+		return false;
+	}
+
+	if ( !s3tcFormat( ddsHeader.ddsPixelFormat.dwFourCC, glFormat, blockSize ) )
+		return false;
+
+	if ( !( ddsHeader.dwFlags & DDSD_MIPMAPCOUNT ) || ddsHeader.dwMipMapCount == 0 )
+		ddsHeader.dwMipMapCount = 1;
+
+	if ( !isPowerOfTwo( ddsHeader.dwWidth ) || !isPowerOfTwo( ddsHeader.dwHeight ) )
+		return false;
+
+	// Mipmaps past 1x1 would not be valid levels
+	GLuint chain = 1;
+	while ( ( std::max( ddsHeader.dwWidth, ddsHeader.dwHeight ) >> chain ) > 0 )
+		chain++;
+
+	ddsHeader.dwMipMapCount = std::min<GLuint>( ddsHeader.dwMipMapCount, chain );
+
+	return true;
+}
+
+// (public function, documented in gltexloaders.h)
+bool texCanLoadMips( const QString & filepath, const QByteArray & data, QString & format, GLuint & width, GLuint & height, GLuint & mipmaps )
+{
+	DDSFormat ddsHeader;
+	GLenum glFormat;
+	int blockSize;
+	QString compression;
+
+	if ( !filepath.endsWith( ".dds", Qt::CaseInsensitive ) || !texMipLayout( data, ddsHeader, glFormat, blockSize )
+		|| !s3tcFormat( ddsHeader.ddsPixelFormat.dwFourCC, glFormat, blockSize, &compression ) )
+	{
+		return false;
+	}
+
+	format = "DDS (" + compression + ")";
+
+	width = ddsHeader.dwWidth;
+	height = ddsHeader.dwHeight;
+	mipmaps = ddsHeader.dwMipMapCount;
+
+	return true;
+}
+
+// (public function, documented in gltexloaders.h)
+void texLoadMips( const QByteArray & data, GLuint first, GLuint last )
+{
+	DDSFormat ddsHeader;
+	GLenum glFormat;
+	int blockSize;
+
+	if ( !texMipLayout( data, ddsHeader, glFormat, blockSize ) )
+		throw QString( "not a block compressed DDS file" );
+
+	QOpenGLFunctions * fn = QOpenGLContext::currentContext()->functions();
+
+	GLuint mipmaps = ddsHeader.dwMipMapCount;
+	qint64 offset = ddsHeader.dwSize + 4;
+
+	for ( GLuint m = 0; m <= last && m < mipmaps; m++ ) {
+		quint32 w = std::max( ddsHeader.dwWidth >> m, 1U );
+		quint32 h = std::max( ddsHeader.dwHeight >> m, 1U );
+		qint64 size = qint64( ( w + 3 ) / 4 ) * ( ( h + 3 ) / 4 ) * blockSize;
+
+		if ( m >= first ) {
+			if ( offset + size > data.size() )
+				throw QString( "unexpected EOF" );
+
+			fn->glCompressedTexImage2D( GL_TEXTURE_2D, m, glFormat, w, h, 0, size, data.constData() + offset );
+		}
+
+		offset += size;
+	}
+
+	// Sampling starts at the largest mipmap uploaded so far
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, first );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, mipmaps - 1 );
+}
+
 bool texCanLoad( const QString & filepath )
 {
 	QFileInfo i( filepath );
@@ -1322,56 +2162,86 @@ bool texCanLoad( const QString & filepath )
 }
 
 
-bool texSaveDDS( const QModelIndex & index, const QString & filepath, GLuint & width, GLuint & height, GLuint & mipmaps )
+bool texReadPixelData( const QModelIndex & index, TexPixelData & pixelData )
 {
 	const NifModel * nif = qobject_cast<const NifModel *>( index.model() );
-	quint32 format = nif->get<quint32>( index, "Pixel Format" );
+
+	if ( !nif )
+		return false;
+
+	pixelData.format = nif->get<quint32>( index, "Pixel Format" );
 
 	// can't dump palettised textures yet
-	if ( format == 2 ) {
+	if ( pixelData.format == 2 ) {
 		qCCritical( nsIo ) << QObject::tr( "Texture format not supported" );
 		return false;
 	}
 
 	// copy directly from mipmaps into texture
-
-	QBuffer buf;
-
 	QModelIndex iPixelData = nif->getIndex( index, "Pixel Data" );
 
 	if ( iPixelData.isValid() ) {
 		QModelIndex iFaceData = iPixelData.child( 0, 0 );
 
 		if ( iFaceData.isValid() ) {
-			if ( QByteArray * pdata = nif->get<QByteArray *>( iFaceData.child( 0, 0 ) ) ) {
-				buf.setData( *pdata );
-				buf.open( QIODevice::ReadOnly );
-				buf.seek( 0 );
-			}
+			if ( QByteArray * pdata = nif->get<QByteArray *>( iFaceData.child( 0, 0 ) ) )
+				pixelData.pixels = *pdata;
 		}
 	}
 
-	if ( buf.size() == 0 )
+	if ( pixelData.pixels.isEmpty() )
 		return false;
 
-	QString filename = filepath;
+	QModelIndex iMipmaps = nif->getIndex( index, "Mipmaps" );
+	pixelData.mipmaps = nif->get<quint32>( index, "Num Mipmaps" );
 
-	if ( !filename.toLower().endsWith( ".dds" ) )
-		filename.append( ".dds" );
+	if ( iMipmaps.isValid() && nif->rowCount( iMipmaps ) > 0 ) {
+		pixelData.width  = nif->get<quint32>( iMipmaps.child( 0, 0 ), "Width" );
+		pixelData.height = nif->get<quint32>( iMipmaps.child( 0, 0 ), "Height" );
+	}
 
-	QFile f( filename );
+	if ( nif->getVersionNumber() < 0x14000004 ) {
+		pixelData.mask[0] = nif->get<quint32>( index, "Red Mask" );
+		pixelData.mask[1] = nif->get<quint32>( index, "Green Mask" );
+		pixelData.mask[2] = nif->get<quint32>( index, "Blue Mask" );
+		pixelData.mask[3] = nif->get<quint32>( index, "Alpha Mask" );
+	} else {
+		QModelIndex iChannels = nif->getIndex( index, "Channels" );
 
-	if ( !f.open( QIODevice::WriteOnly ) ) {
-		qCCritical( nsIo ) << QObject::tr( "texSaveDDS: could not open %1" ).arg( filename );
-		return false;
+		if ( iChannels.isValid() ) {
+			for ( int i = 0; i < 4; i++ ) {
+				QModelIndex iChannel = iChannels.child( i, 0 );
+				uint type = nif->get<uint>( iChannel, "Type" );
+				uint bpc  = nif->get<uint>( iChannel, "Bits Per Channel" );
+				int m = (1 << bpc) - 1;
+
+				switch ( type ) {
+				case 0:
+					pixelData.mask[i] = m << (bpc * 0);
+					break;         // Green
+				case 1:
+					pixelData.mask[i] = m << (bpc * 1);
+					break;         // Blue
+				case 2:
+					pixelData.mask[i] = m << (bpc * 2);
+					break;         // Red
+				case 3:
+					pixelData.mask[i] = m << (bpc * 3);
+					break;         // Red
+				}
+			}
+		}
 	}
 
-	qint64 writeBytes = f.write( (char *)"DDS ", 4 );
+	return true;
+}
 
-	if ( writeBytes != 4 ) {
-		qCCritical( nsIo ) << QObject::tr( "texSaveDDS: could not open %1" ).arg( filename );
-		return false;
-	}
+QByteArray texEncodeDDS( const TexPixelData & pixelData )
+{
+	const quint32 format = pixelData.format;
+	const quint32 width  = pixelData.width;
+	const quint32 height = pixelData.height;
+	const quint32 mipmaps = pixelData.mipmaps;
 
 	quint8 header[124]; // could probably use a bytearray or something here
 
@@ -1394,8 +2264,6 @@ bool texSaveDDS( const QModelIndex & index, const QString & filepath, GLuint & w
 
 	header[pos++] = ( 1 << 4 );                      // 4 bits reserved, pixelformat = 1, 3 bits reserved
 
-	//quint32 mipmaps = nif->get<quint32>( index, "Num Mipmaps" );
-
 	bool hasMipMaps = ( mipmaps > 1 );
 
 	header[pos++] = ( (hasMipMaps ? 1 : 0) << 1 )    // 1 bit reserved, mipmapcount
@@ -1507,44 +2375,6 @@ bool texSaveDDS( const QModelIndex & index, const QString & filepath, GLuint & w
 	qToLittleEndian( bitcount, header + pos );
 	pos += 4;
 
-	// masks
-	quint32 mask[4] = {
-		0x000000ff, 0x0000ff00, 0x00ff0000, 0x00000000
-	};
-
-	if ( nif->getVersionNumber() < 0x14000004 ) {
-		mask[0] = nif->get<quint32>( index, "Red Mask" );
-		mask[1] = nif->get<quint32>( index, "Green Mask" );
-		mask[2] = nif->get<quint32>( index, "Blue Mask" );
-		mask[3] = nif->get<quint32>( index, "Alpha Mask" );
-	} else {
-		QModelIndex iChannels = nif->getIndex( index, "Channels" );
-
-		if ( iChannels.isValid() ) {
-			for ( int i = 0; i < 4; i++ ) {
-				QModelIndex iChannel = iChannels.child( i, 0 );
-				uint type = nif->get<uint>( iChannel, "Type" );
-				uint bpc  = nif->get<uint>( iChannel, "Bits Per Channel" );
-				int m = (1 << bpc) - 1;
-
-				switch ( type ) {
-				case 0:
-					mask[i] = m << (bpc * 0);
-					break;         // Green
-				case 1:
-					mask[i] = m << (bpc * 1);
-					break;         // Blue
-				case 2:
-					mask[i] = m << (bpc * 2);
-					break;         // Red
-				case 3:
-					mask[i] = m << (bpc * 3);
-					break;         // Red
-				}
-			}
-		}
-	}
-
 	/*
 	if ( alphapixels )
 	{
@@ -1552,16 +2382,16 @@ bool texSaveDDS( const QModelIndex & index, const QString & filepath, GLuint & w
 	}*/
 
 	// red mask
-	qToLittleEndian( mask[0], header + pos );
+	qToLittleEndian( pixelData.mask[0], header + pos );
 	pos += 4;
 	// green mask
-	qToLittleEndian( mask[1], header + pos );
+	qToLittleEndian( pixelData.mask[1], header + pos );
 	pos += 4;
 	// blue mask
-	qToLittleEndian( mask[2], header + pos );
+	qToLittleEndian( pixelData.mask[2], header + pos );
 	pos += 4;
 	// alpha mask
-	qToLittleEndian( mask[3], header + pos );
+	qToLittleEndian( pixelData.mask[3], header + pos );
 	pos += 4;
 
 	// caps1
@@ -1569,18 +2399,40 @@ bool texSaveDDS( const QModelIndex & index, const QString & filepath, GLuint & w
 	header[pos++] = ( 1 << 4 );                    // texture
 	header[pos++] = ( (hasMipMaps ? 1 : 0) << 6 ); // mipmaps
 
-	// write header
-	writeBytes = f.write( (char *)header, 124 );
+	QByteArray dds( "DDS ", 4 );
+	dds.reserve( 4 + 124 + pixelData.pixels.size() );
+	dds.append( (const char *)header, 124 );
+	dds.append( pixelData.pixels );
 
-	if ( writeBytes != 124 ) {
+	return dds;
+}
+
+bool texSaveDDS( const QModelIndex & index, const QString & filepath, GLuint & width, GLuint & height, GLuint & mipmaps )
+{
+	TexPixelData pixelData;
+
+	if ( !texReadPixelData( index, pixelData ) )
+		return false;
+
+	pixelData.width = width;
+	pixelData.height = height;
+	pixelData.mipmaps = mipmaps;
+
+	QString filename = filepath;
+
+	if ( !filename.toLower().endsWith( ".dds" ) )
+		filename.append( ".dds" );
+
+	QFile f( filename );
+
+	if ( !f.open( QIODevice::WriteOnly ) ) {
 		qCCritical( nsIo ) << QObject::tr( "texSaveDDS: could not open %1" ).arg( filename );
 		return false;
 	}
 
-	// write pixel data
-	writeBytes = f.write( buf.data().constData(), buf.size() );
+	QByteArray dds = texEncodeDDS( pixelData );
 
-	if ( writeBytes != buf.size() ) {
+	if ( f.write( dds ) != dds.size() ) {
 		qCCritical( nsIo ) << QObject::tr( "texSaveDDS: could not open %1" ).arg( filename );
 		return false;
 	}
@@ -1702,12 +2554,23 @@ bool texSaveTGA( const QModelIndex & index, const QString & filepath, GLuint & w
 
 
 bool texSaveNIF( NifModel * nif, const QString & filepath, QModelIndex & iData )
+{
+	QFile file( filepath );
+
+	if ( !file.open( QIODevice::ReadOnly ) )
+		throw QString( "could not open file" );
+
+	return texSaveNIF( nif, filepath, file.readAll(), iData );
+}
+
+bool texSaveNIF( NifModel * nif, const QString & filepath, const QByteArray & data, QModelIndex & iData )
 {
 	// Work out the extension and format
 	// If DDS raw, DXT1 or DXT5, copy directly from texture
 	//qDebug() << "texSaveNIF: saving" << filepath << "to" << iData;
 
-	QFile f( filepath );
+	QBuffer f;
+	f.setData( data );
 
 	if ( !f.open( QIODevice::ReadOnly ) )
 		throw QString( "could not open file" );
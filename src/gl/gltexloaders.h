@@ -78,6 +78,32 @@ extern bool texLoadCube( const QString & filepath, QString & format, GLuint & wi
  */
 extern bool texLoad( const QModelIndex & iData, QString & format, GLuint & width, GLuint & height, GLuint & mipmaps );
 
+/*! A function which checks whether a texture can be uploaded one range of mipmaps at a time.
+ *
+ * This is the case for block compressed DDS files, which are uploaded as they are stored.
+ *
+ * @param filepath	The full path to the texture.
+ * @param data		The contents of the file.
+ * @param format	Contains the format on success.
+ * @param width		Contains the width of the largest mipmap on success.
+ * @param height	Contains the height of the largest mipmap on success.
+ * @param mipmaps	Contains the number of mipmaps on success.
+ * @return			True if texLoadMips() can upload the texture.
+ */
+extern bool texCanLoadMips( const QString & filepath, const QByteArray & data, QString & format, GLuint & width, GLuint & height, GLuint & mipmaps );
+
+/*! A function for uploading some of the mipmaps of a texture.
+ *
+ * Uploads the mipmaps first to last of a texture accepted by texCanLoadMips() to the bound
+ * texture, and samples it from the first one; mipmaps after last must already be uploaded.
+ * Throws a QString on failure.
+ *
+ * @param data		The contents of the file.
+ * @param first		The largest mipmap to upload.
+ * @param last		The smallest mipmap to upload.
+ */
+extern void texLoadMips( const QByteArray & data, GLuint first, GLuint last );
+
 /*! A function which checks whether the given file can be loaded.
  *
  * The function checks whether the file exists, is readable, and whether its extension
@@ -87,6 +113,41 @@ extern bool texLoad( const QModelIndex & iData, QString & format, GLuint & width
  */
 extern bool texCanLoad( const QString & filepath );
 
+//! Pixel data of a NiPixelData block, copied out of the model
+struct TexPixelData
+{
+	//! The Pixel Format of the block
+	quint32 format = 0;
+	//! The red, green, blue and alpha masks
+	quint32 mask[4] = { 0x000000ff, 0x0000ff00, 0x00ff0000, 0x00000000 };
+	//! The size of the largest mipmap
+	GLuint width = 0;
+	GLuint height = 0;
+	//! The number of mipmaps present
+	GLuint mipmaps = 0;
+	//! The mipmaps of the first face, shared with the model until either changes
+	QByteArray pixels;
+};
+
+/*! Read the pixel data of a NiPixelData block
+ *
+ * The result can be encoded by texEncodeDDS() on any thread, without the model or a GL context.
+ *
+ * @param index		Reference to pixel data
+ * @param pixelData	Contains the pixel data on success
+ * @return			False if the block has no pixel data or a palettised format
+ */
+bool texReadPixelData( const QModelIndex & index, TexPixelData & pixelData );
+
+/*! Encode pixel data as the contents of a DDS file
+ *
+ * The mipmaps are stored as they are, so the file keeps the format of the block.
+ *
+ * @param pixelData	The pixel data read by texReadPixelData()
+ * @return			The DDS file
+ */
+QByteArray texEncodeDDS( const TexPixelData & pixelData );
+
 /*! Save pixel data to a DDS file
  *
  * @param index		Reference to pixel data
@@ -115,4 +176,15 @@ bool texSaveTGA( const QModelIndex & index, const QString & filepath, GLuint & w
  */
 bool texSaveNIF( class NifModel * nif, const QString & filepath, QModelIndex & iData );
 
+/*! Save the contents of a file to pixel data
+ *
+ * DDS and NIF files are copied without a GL context; TGA and BMP files are loaded
+ * from filepath and read back from GL.
+ *
+ * @param filepath	The source texture to convert
+ * @param data		The contents of the source texture
+ * @param iData		The pixel data to write
+ */
+bool texSaveNIF( class NifModel * nif, const QString & filepath, const QByteArray & data, QModelIndex & iData );
+
 #endif
@@ -37,7 +37,9 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <algorithm>
 #include <functional>
 
+#include <QHash>
 #include <QMap>
+#include <QPersistentModelIndex>
 #include <QStack>
 #include <QVector>
 
@@ -237,6 +239,67 @@ BoundSphere operator*( const Transform & t, const BoundSphere & sphere )
  * draw primitives
  */
 
+void VertexBatch::draw()
+{
+	if ( vertices.isEmpty() )
+		return;
+
+	// Drawn from client memory, not from the buffer objects of the shapes
+	QOpenGLContext::currentContext()->functions()->glBindBuffer( GL_ARRAY_BUFFER, 0 );
+
+	glPushClientAttrib( GL_CLIENT_VERTEX_ARRAY_BIT );
+	glDisableClientState( GL_NORMAL_ARRAY );
+	glDisableClientState( GL_COLOR_ARRAY );
+	glDisableClientState( GL_TEXTURE_COORD_ARRAY );
+	glEnableClientState( GL_VERTEX_ARRAY );
+	glVertexPointer( 3, GL_FLOAT, 0, vertices.constData() );
+	glDrawArrays( mode, 0, vertices.count() );
+	glPopClientAttrib();
+
+	vertices.clear();
+}
+
+void StaticGeometry::draw()
+{
+	if ( vertices.isEmpty() )
+		return;
+
+	glPushClientAttrib( GL_CLIENT_VERTEX_ARRAY_BIT );
+	glDisableClientState( GL_NORMAL_ARRAY );
+	glDisableClientState( GL_COLOR_ARRAY );
+	glDisableClientState( GL_TEXTURE_COORD_ARRAY );
+	glEnableClientState( GL_VERTEX_ARRAY );
+
+	// Uploaded on the first draw only, the buffers keep the arrays they were uploaded from
+	vertexBuffer.bind( vertices );
+	glVertexPointer( 3, GL_FLOAT, 0, nullptr );
+
+	if ( triangles.isEmpty() ) {
+		glDrawArrays( mode, 0, vertices.count() );
+	} else {
+		triangleBuffer.bind( triangles );
+		glDrawElements( GL_TRIANGLES, triangles.count() * 3, GL_UNSIGNED_SHORT, nullptr );
+		triangleBuffer.release();
+	}
+
+	vertexBuffer.release();
+	glPopClientAttrib();
+}
+
+StaticGeometry & staticGeometry( const void * key, int detail, const std::function<void( StaticGeometry & )> & build )
+{
+	// Drawn on the GUI thread only, by every window
+	static QHash<QPair<const void *, int>, StaticGeometry *> geometry;
+
+	StaticGeometry *& g = geometry[qMakePair( key, detail )];
+	if ( !g ) {
+		g = new StaticGeometry;
+		build( *g );
+	}
+
+	return *g;
+}
+
 void drawAxes( Vector3 c, float axis )
 {
 	glPushMatrix();
@@ -370,30 +433,25 @@ void drawAxesOverlay( Vector3 c, float axis, QVector<int> axesOrder )
 
 void drawBox( Vector3 a, Vector3 b )
 {
-	glBegin( GL_LINE_STRIP );
-	glVertex3f( a[0], a[1], a[2] );
-	glVertex3f( a[0], b[1], a[2] );
-	glVertex3f( a[0], b[1], b[2] );
-	glVertex3f( a[0], a[1], b[2] );
-	glVertex3f( a[0], a[1], a[2] );
-	glEnd();
-	glBegin( GL_LINE_STRIP );
-	glVertex3f( b[0], a[1], a[2] );
-	glVertex3f( b[0], b[1], a[2] );
-	glVertex3f( b[0], b[1], b[2] );
-	glVertex3f( b[0], a[1], b[2] );
-	glVertex3f( b[0], a[1], a[2] );
-	glEnd();
-	glBegin( GL_LINES );
-	glVertex3f( a[0], a[1], a[2] );
-	glVertex3f( b[0], a[1], a[2] );
-	glVertex3f( a[0], b[1], a[2] );
-	glVertex3f( b[0], b[1], a[2] );
-	glVertex3f( a[0], b[1], b[2] );
-	glVertex3f( b[0], b[1], b[2] );
-	glVertex3f( a[0], a[1], b[2] );
-	glVertex3f( b[0], a[1], b[2] );
-	glEnd();
+	VertexBatch lines;
+
+	for ( float x : { a[0], b[0] } ) {
+		lines.moveTo( Vector3( x, a[1], a[2] ) );
+		lines.lineTo( Vector3( x, b[1], a[2] ) );
+		lines.lineTo( Vector3( x, b[1], b[2] ) );
+		lines.lineTo( Vector3( x, a[1], b[2] ) );
+		lines.lineTo( Vector3( x, a[1], a[2] ) );
+	}
+
+	lines.add( Vector3( a[0], a[1], a[2] ) );
+	lines.add( Vector3( b[0], a[1], a[2] ) );
+	lines.add( Vector3( a[0], b[1], a[2] ) );
+	lines.add( Vector3( b[0], b[1], a[2] ) );
+	lines.add( Vector3( a[0], b[1], b[2] ) );
+	lines.add( Vector3( b[0], b[1], b[2] ) );
+	lines.add( Vector3( a[0], a[1], b[2] ) );
+	lines.add( Vector3( b[0], a[1], b[2] ) );
+	lines.draw();
 }
 
 void drawGrid( int s /* grid size */, int line /* line spacing */, int sub /* # subdivisions */ )
@@ -403,25 +461,24 @@ void drawGrid( int s /* grid size */, int line /* line spacing */, int sub /* #
 	glLineWidth( 1.0f );
 	glColor4f( 1.0f, 1.0f, 1.0f, 0.2f );
 
-	glBegin( GL_LINES );
+	VertexBatch lines;
 	for ( int i = -s; i <= s; i += line ) {
-		glVertex3f( i, -s, 0.0f );
-		glVertex3f( i, s, 0.0f );
-		glVertex3f( -s, i, 0.0f );
-		glVertex3f( s, i, 0.0f );
+		lines.add( Vector3( i, -s, 0.0f ) );
+		lines.add( Vector3( i, s, 0.0f ) );
+		lines.add( Vector3( -s, i, 0.0f ) );
+		lines.add( Vector3( s, i, 0.0f ) );
 	}
-	glEnd();
+	lines.draw();
 
 	glColor4f( 1.0f, 1.0f, 1.0f, 0.1f );
 	glLineWidth( 0.25f );
-	glBegin( GL_LINES );
 	for ( int i = -s; i <= s; i += line/sub ) {
-		glVertex3f( i, -s, 0.0f );
-		glVertex3f( i, s, 0.0f );
-		glVertex3f( -s, i, 0.0f );
-		glVertex3f( s, i, 0.0f );
+		lines.add( Vector3( i, -s, 0.0f ) );
+		lines.add( Vector3( i, s, 0.0f ) );
+		lines.add( Vector3( -s, i, 0.0f ) );
+		lines.add( Vector3( s, i, 0.0f ) );
 	}
-	glEnd();
+	lines.draw();
 	glDisable( GL_BLEND );
 }
 
@@ -434,15 +491,15 @@ void drawCircle( Vector3 c, Vector3 n, float r, int sd )
 
 void drawArc( Vector3 c, Vector3 x, Vector3 y, float an, float ax, int sd )
 {
-	glBegin( GL_LINE_STRIP );
+	VertexBatch strip( GL_LINE_STRIP );
 
 	for ( int j = 0; j <= sd; j++ ) {
 		float f = ( ax - an ) * float(j) / float(sd) + an;
 
-		glVertex( c + x * sin( f ) + y * cos( f ) );
+		strip.add( c + x * sin( f ) + y * cos( f ) );
 	}
 
-	glEnd();
+	strip.draw();
 }
 
 void drawCone( Vector3 c, Vector3 n, float a, int sd )
@@ -585,26 +642,24 @@ void drawRail( const Vector3 & a, const Vector3 & b )
 	glVertex( b );
 	glEnd();
 
+	VertexBatch lines;
+
 	/* draw the rail */
-	glBegin( GL_LINES );
-	glVertex( a + x );
-	glVertex( b + x );
-	glVertex( a - x );
-	glVertex( b - x );
-	glEnd();
+	lines.add( a + x );
+	lines.add( b + x );
+	lines.add( a - x );
+	lines.add( b - x );
 
 	int len = int( off.length() );
 
 	/* draw the logs */
-	glBegin( GL_LINES );
-
 	for ( int i = 0; i <= len; i++ ) {
 		float rel_off = ( 1.0f * i ) / len;
-		glVertex( a + off * rel_off + x * 1.3f );
-		glVertex( a + off * rel_off - x * 1.3f );
+		lines.add( a + off * rel_off + x * 1.3f );
+		lines.add( a + off * rel_off - x * 1.3f );
 	}
 
-	glEnd();
+	lines.draw();
 }
 
 void drawSolidArc( Vector3 c, Vector3 n, Vector3 x, Vector3 y, float an, float ax, float r, int sd )
@@ -626,53 +681,69 @@ void drawSolidArc( Vector3 c, Vector3 n, Vector3 x, Vector3 y, float an, float a
 		glEnable( GL_CULL_FACE );
 }
 
-void drawSphereSimple( Vector3 c, float r, int sd )
+//! Draw geometry built around the origin at \a c, scaled by \a r
+static void drawScaled( StaticGeometry & geometry, const Vector3 & c, float r )
 {
-	drawCircle( c, Vector3( 0, 0, 1 ), r, sd );
-	drawCircle( c, Vector3( 0, 1, 0 ), r, sd );
-	drawCircle( c, Vector3( 1, 0, 0 ), r, sd );
+	glPushMatrix();
+	glTranslate( c );
+	glScalef( r, r, r );
+	geometry.draw();
+	glPopMatrix();
 }
 
-void drawSphere( Vector3 c, float r, int sd )
+void drawSphereSimple( Vector3 c, float r, int sd )
 {
-	for ( int j = -sd; j <= sd; j++ ) {
-		float f = PI * float(j) / float(sd);
-		Vector3 cj = c + Vector3( 0, 0, r * cos( f ) );
-		float rj = r * sin( f );
+	// Three circles of a unit sphere as drawCircle() draws them, built once per subdivision
+	static const char unitCircles = 0;
 
-		glBegin( GL_LINE_STRIP );
+	StaticGeometry & circles = staticGeometry( &unitCircles, sd, [sd]( StaticGeometry & g ) {
+		g.mode = GL_LINES;
 
-		for ( int i = 0; i <= sd * 2; i++ )
-			glVertex( Vector3( sin( PI / sd * i ), cos( PI / sd * i ), 0 ) * rj + cj );
+		for ( const Vector3 & n : { Vector3( 0, 0, 1 ), Vector3( 0, 1, 0 ), Vector3( 1, 0, 0 ) } ) {
+			Vector3 x = Vector3::crossproduct( n, Vector3( n[1], n[2], n[0] ) );
+			Vector3 y = Vector3::crossproduct( n, x );
 
-		glEnd();
-	}
+			for ( int j = 0; j < sd; j++ ) {
+				float f1 = 2 * PI * float(j) / float(sd) - PI;
+				float f2 = 2 * PI * float(j + 1) / float(sd) - PI;
 
-	for ( int j = -sd; j <= sd; j++ ) {
-		float f = PI * float(j) / float(sd);
-		Vector3 cj = c + Vector3( 0, r * cos( f ), 0 );
-		float rj = r * sin( f );
+				g.vertices << x * sin( f1 ) + y * cos( f1 ) << x * sin( f2 ) + y * cos( f2 );
+			}
+		}
+	} );
 
-		glBegin( GL_LINE_STRIP );
+	drawScaled( circles, c, r );
+}
 
-		for ( int i = 0; i <= sd * 2; i++ )
-			glVertex( Vector3( sin( PI / sd * i ), 0, cos( PI / sd * i ) ) * rj + cj );
+void drawSphere( Vector3 c, float r, int sd )
+{
+	// The lines of a unit sphere, built once per subdivision
+	static const char unitSphere = 0;
 
-		glEnd();
-	}
+	StaticGeometry & sphere = staticGeometry( &unitSphere, sd, [sd]( StaticGeometry & g ) {
+		g.mode = GL_LINES;
 
-	for ( int j = -sd; j <= sd; j++ ) {
-		float f = PI * float(j) / float(sd);
-		Vector3 cj = c + Vector3( r * cos( f ), 0, 0 );
-		float rj = r * sin( f );
+		// One ring per latitude around each axis
+		auto ring = [sd, &g]( const Vector3 & cj, float rj, const Vector3 & start, const std::function<Vector3( float )> & dir ) {
+			Vector3 last = start * rj + cj;
 
-		glBegin( GL_LINE_STRIP );
+			for ( int i = 1; i <= sd * 2; i++ ) {
+				Vector3 v = dir( PI / sd * i ) * rj + cj;
+				g.vertices << last << v;
+				last = v;
+			}
+		};
 
-		for ( int i = 0; i <= sd * 2; i++ )
-			glVertex( Vector3( 0, sin( PI / sd * i ), cos( PI / sd * i ) ) * rj + cj );
+		for ( int j = -sd; j <= sd; j++ ) {
+			float f = PI * float(j) / float(sd);
 
-		glEnd();
-	}
+			ring( Vector3( 0, 0, cos( f ) ), sin( f ), Vector3( 0, 1, 0 ), []( float a ) { return Vector3( sin( a ), cos( a ), 0 ); } );
+			ring( Vector3( 0, cos( f ), 0 ), sin( f ), Vector3( 0, 0, 1 ), []( float a ) { return Vector3( sin( a ), 0, cos( a ) ); } );
+			ring( Vector3( cos( f ), 0, 0 ), sin( f ), Vector3( 0, 0, 1 ), []( float a ) { return Vector3( 0, sin( a ), cos( a ) ); } );
+		}
+	} );
+
+	drawScaled( sphere, c, r );
 }
 
 void drawCapsule( Vector3 a, Vector3 b, float r, int sd )
@@ -694,51 +765,47 @@ void drawCapsule( Vector3 a, Vector3 b, float r, int sd )
 	x *= r;
 	y *= r;
 
-	glBegin( GL_LINE_STRIP );
+	VertexBatch lines;
 
-	for ( int i = 0; i <= sd * 2; i++ )
-		glVertex( a + d / 2 + x * sin( PI / sd * i ) + y * cos( PI / sd * i ) );
+	lines.moveTo( a + d / 2 + y );
 
-	glEnd();
-	glBegin( GL_LINES );
+	for ( int i = 1; i <= sd * 2; i++ )
+		lines.lineTo( a + d / 2 + x * sin( PI / sd * i ) + y * cos( PI / sd * i ) );
 
 	for ( int i = 0; i <= sd * 2; i++ ) {
-		glVertex( a + x * sin( PI / sd * i ) + y * cos( PI / sd * i ) );
-		glVertex( b + x * sin( PI / sd * i ) + y * cos( PI / sd * i ) );
+		lines.add( a + x * sin( PI / sd * i ) + y * cos( PI / sd * i ) );
+		lines.add( b + x * sin( PI / sd * i ) + y * cos( PI / sd * i ) );
 	}
 
-	glEnd();
-
 	for ( int j = 0; j <= sd; j++ ) {
 		float f = PI * float(j) / float(sd * 2);
 		Vector3 dj = n * r * cos( f );
 		float rj = sin( f );
 
-		glBegin( GL_LINE_STRIP );
+		lines.moveTo( a - dj + y * rj );
 
-		for ( int i = 0; i <= sd * 2; i++ )
-			glVertex( a - dj + x * sin( PI / sd * i ) * rj + y * cos( PI / sd * i ) * rj );
+		for ( int i = 1; i <= sd * 2; i++ )
+			lines.lineTo( a - dj + x * sin( PI / sd * i ) * rj + y * cos( PI / sd * i ) * rj );
 
-		glEnd();
-		glBegin( GL_LINE_STRIP );
+		lines.moveTo( b + dj + y * rj );
 
-		for ( int i = 0; i <= sd * 2; i++ )
-			glVertex( b + dj + x * sin( PI / sd * i ) * rj + y * cos( PI / sd * i ) * rj );
-
-		glEnd();
+		for ( int i = 1; i <= sd * 2; i++ )
+			lines.lineTo( b + dj + x * sin( PI / sd * i ) * rj + y * cos( PI / sd * i ) * rj );
 	}
+
+	lines.draw();
 }
 
 void drawDashLine( Vector3 a, Vector3 b, int sd )
 {
 	Vector3 d = ( b - a ) / float(sd);
-	glBegin( GL_LINES );
+	VertexBatch lines;
 
 	for ( int c = 0; c <= sd; c++ ) {
-		glVertex( a + d * c );
+		lines.add( a + d * c );
 	}
 
-	glEnd();
+	lines.draw();
 }
 
 //! Find the dot product of two vectors
@@ -819,45 +886,56 @@ static QVector<Vector3> generateTris( const NifModel * nif, const QModelIndex &
 	return tris;
 }
 
-void drawConvexHull( const NifModel * nif, const QModelIndex & iShape, float scale, bool solid )
+//! Vertices of the collision shapes decoded by collisionGeometry(), by shape block
+static QHash<QPersistentModelIndex, QVector<Vector3>> collisionShapes;
+
+QVector<Vector3> collisionGeometry( const QModelIndex & iShape, const std::function<QVector<Vector3>()> & decode )
 {
-	static QMap<QModelIndex, QVector<Vector3>> shapes;
-	QVector<Vector3> shape;
+	auto it = collisionShapes.find( iShape );
+	if ( it != collisionShapes.end() )
+		return it.value();
 
-	shape = shapes[iShape];
+	return collisionShapes.insert( iShape, decode() ).value();
+}
 
-	if ( shape.empty() ) {
-		shape = generateTris( nif, iShape, scale );
-		shapes[iShape] = shape;
-	}
+void clearCollisionCache()
+{
+	collisionShapes.clear();
+}
 
+//! Draw the triangles of a collision shape with the polygon mode for solid or wireframe
+static void drawCollisionTris( const QVector<Vector3> & tris, bool solid )
+{
 	glPolygonMode( GL_FRONT_AND_BACK, solid ? GL_FILL : GL_LINE );
 	glDisable( GL_CULL_FACE );
-	glBegin( GL_TRIANGLES );
 
-	for ( int i = 0; i < shape.count(); i += 3 ) {
-		// DRAW ABC
-		glVertex( shape[i] );
-		glVertex( shape[i+1] );
-		glVertex( shape[i+2] );
-	}
+	VertexBatch triangles( GL_TRIANGLES, tris );
+	triangles.draw();
 
-	glEnd();
 	glPolygonMode( GL_FRONT_AND_BACK, solid ? GL_LINE : GL_FILL );
 	glEnable( GL_CULL_FACE );
 }
 
+void drawConvexHull( const NifModel * nif, const QModelIndex & iShape, float scale, bool solid )
+{
+	// The hull is a list of triangles
+	drawCollisionTris( collisionGeometry( iShape, [nif, &iShape, scale]() {
+		return generateTris( nif, iShape, scale );
+	} ), solid );
+}
+
 void drawNiTSS( const NifModel * nif, const QModelIndex & iShape, bool solid )
 {
-	QModelIndex iStrips = nif->getIndex( iShape, "Strips Data" );
-	for ( int r = 0; r < nif->rowCount( iStrips ); r++ ) {
-		QModelIndex iStripData = nif->getBlock( nif->getLink( iStrips.child( r, 0 ) ), "NiTriStripsData" );
-		if ( iStripData.isValid() ) {
-			QVector<Vector3> verts = nif->getArray<Vector3>( iStripData, "Vertices" );
+	drawCollisionTris( collisionGeometry( iShape, [nif, &iShape]() {
+		QVector<Vector3> tris;
 
-			glPolygonMode( GL_FRONT_AND_BACK, solid ? GL_FILL : GL_LINE );
-			glDisable( GL_CULL_FACE );
-			glBegin( GL_TRIANGLES );
+		QModelIndex iStrips = nif->getIndex( iShape, "Strips Data" );
+		for ( int r = 0; r < nif->rowCount( iStrips ); r++ ) {
+			QModelIndex iStripData = nif->getBlock( nif->getLink( iStrips.child( r, 0 ) ), "NiTriStripsData" );
+			if ( !iStripData.isValid() )
+				continue;
+
+			QVector<Vector3> verts = nif->getArray<Vector3>( iStripData, "Vertices" );
 
 			QModelIndex iPoints = nif->getIndex( iStripData, "Points" );
 			for ( int r = 0; r < nif->rowCount( iPoints ); r++ ) {	// draw the strips like they appear in the tescs
@@ -869,58 +947,47 @@ void drawNiTSS( const NifModel * nif, const QModelIndex & iShape, bool solid )
 
 					for ( int x = 2; x < strip.size(); x++ ) {
 						quint16 c = strip[x];
-						glVertex( verts.value( a ) );
-						glVertex( verts.value( b ) );
-						glVertex( verts.value( c ) );
+						tris << verts.value( a ) << verts.value( b ) << verts.value( c );
 						a = b;
 						b = c;
 					}
 				}
 			}
-
-			glEnd();
-			glEnable( GL_CULL_FACE );
-			glPolygonMode( GL_FRONT_AND_BACK, solid ? GL_LINE : GL_FILL );
 		}
-	}
+
+		return tris;
+	} ), solid );
 }
 
 void drawCMS( const NifModel * nif, const QModelIndex & iShape, bool solid )
 {
-	// Scale up for Skyrim
-	float havokScale = (nif->checkVersion( 0x14020007, 0x14020007 ) && nif->getUserVersion() >= 12) ? 10.0f : 1.0f;
+	drawCollisionTris( collisionGeometry( iShape, [nif, &iShape]() {
+		QVector<Vector3> tris;
 
-	//QModelIndex iParent = nif->getBlock( nif->getParent( nif->getBlockNumber( iShape ) ) );
-	//Vector4 origin = Vector4( nif->get<Vector3>( iParent, "Origin" ), 0 );
+		// Scale up for Skyrim
+		float havokScale = (nif->checkVersion( 0x14020007, 0x14020007 ) && nif->getUserVersion() >= 12) ? 10.0f : 1.0f;
+
+		//QModelIndex iParent = nif->getBlock( nif->getParent( nif->getBlockNumber( iShape ) ) );
+		//Vector4 origin = Vector4( nif->get<Vector3>( iParent, "Origin" ), 0 );
+
+		QModelIndex iData = nif->getBlock( nif->getLink( iShape, "Data" ) );
+		if ( !iData.isValid() )
+			return tris;
 
-	QModelIndex iData = nif->getBlock( nif->getLink( iShape, "Data" ) );
-	if ( iData.isValid() ) {
 		QModelIndex iBigVerts = nif->getIndex( iData, "Big Verts" );
 		QModelIndex iBigTris = nif->getIndex( iData, "Big Tris" );
 		QModelIndex iChunkTrans = nif->getIndex( iData, "Chunk Transforms" );
 
 		QVector<Vector4> verts = nif->getArray<Vector4>( iBigVerts );
 
-		glPolygonMode( GL_FRONT_AND_BACK, solid ? GL_FILL : GL_LINE );
-		glDisable( GL_CULL_FACE );
-
 		for ( int r = 0; r < nif->rowCount( iBigTris ); r++ ) {
 			quint16 a = nif->get<quint16>( iBigTris.child( r, 0 ), "Triangle 1" );
 			quint16 b = nif->get<quint16>( iBigTris.child( r, 0 ), "Triangle 2" );
 			quint16 c = nif->get<quint16>( iBigTris.child( r, 0 ), "Triangle 3" );
 
-			glBegin( GL_TRIANGLES );
-
-			glVertex( verts[a] * havokScale );
-			glVertex( verts[b] * havokScale );
-			glVertex( verts[c] * havokScale );
-
-			glEnd();
+			tris << Vector3( verts[a] * havokScale ) << Vector3( verts[b] * havokScale ) << Vector3( verts[c] * havokScale );
 		}
 
-		glPolygonMode( GL_FRONT_AND_BACK, solid ? GL_LINE : GL_FILL );
-		glEnable( GL_CULL_FACE );
-
 		QModelIndex iChunks = nif->getIndex( iData, "Chunks" );
 		for ( int r = 0; r < nif->rowCount( iChunks ); r++ ) {
 			Vector4 chunkOrigin = nif->get<Vector4>( iChunks.child( r, 0 ), "Translation" );
@@ -939,21 +1006,13 @@ void drawCMS( const NifModel * nif, const QModelIndex & iShape, bool solid )
 
 			QVector<Vector4> vertices( numOffsets / 3 );
 
-			int numStripVerts = 0;
 			int offset = 0;
 
-			for ( int v = 0; v < (int)numStrips; v++ ) {
-				numStripVerts += strips[v];
-			}
-
 			for ( int n = 0; n < ((int)numOffsets / 3); n++ ) {
 				vertices[n] = chunkOrigin + chunkTranslation + Vector4( offsets[3 * n], offsets[3 * n + 1], offsets[3 * n + 2], 0 ) / 1000.0f;
 				vertices[n] *= havokScale;
 			}
 
-			glPolygonMode( GL_FRONT_AND_BACK, solid ? GL_FILL : GL_LINE );
-			glDisable( GL_CULL_FACE );
-
 			Transform trans;
 			trans.rotation.fromQuat( chunkRotation );
 
@@ -962,13 +1021,9 @@ void drawCMS( const NifModel * nif, const QModelIndex & iShape, bool solid )
 
 				for ( int idx = 0; idx < strips[s] - 2; idx++ ) {
 
-					glBegin( GL_TRIANGLES );
-
-					glVertex( trans.rotation * Vector3( vertices[indices[offset + idx]] ) );
-					glVertex( trans.rotation * Vector3( vertices[indices[offset + idx + 1]] ) );
-					glVertex( trans.rotation * Vector3( vertices[indices[offset + idx + 2]] ) );
-
-					glEnd();
+					tris << trans.rotation * Vector3( vertices[indices[offset + idx]] )
+						<< trans.rotation * Vector3( vertices[indices[offset + idx + 1]] )
+						<< trans.rotation * Vector3( vertices[indices[offset + idx + 2]] );
 
 				}
 
@@ -978,21 +1033,14 @@ void drawCMS( const NifModel * nif, const QModelIndex & iShape, bool solid )
 
 			// Non-stripped tris
 			for ( int f = 0; f < (int)(numIndices - offset); f += 3 ) {
-				glBegin( GL_TRIANGLES );
-
-				glVertex( trans.rotation * Vector3( vertices[indices[offset + f]] ) );
-				glVertex( trans.rotation * Vector3( vertices[indices[offset + f + 1]] ) );
-				glVertex( trans.rotation * Vector3( vertices[indices[offset + f + 2]] ) );
-
-				glEnd();
-
+				tris << trans.rotation * Vector3( vertices[indices[offset + f]] )
+					<< trans.rotation * Vector3( vertices[indices[offset + f + 1]] )
+					<< trans.rotation * Vector3( vertices[indices[offset + f + 2]] );
 			}
-
-			glPolygonMode( GL_FRONT_AND_BACK, solid ? GL_LINE : GL_FILL );
-			glEnable( GL_CULL_FACE );
-
 		}
-	}
+
+		return tris;
+	} ), solid );
 }
 
 // Renders text using the font initialized in the primary view class
@@ -36,6 +36,9 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "niftypes.h"
 
 #include <QOpenGLContext>
+#include <QOpenGLFunctions>
+
+#include <functional>
 
 
 //! @file gltools.h BoundSphere, VertexWeight, BoneWeights, SkinPartition
@@ -110,6 +113,184 @@ public:
 	QList<QVector<quint16> > tristrips;
 };
 
+//! Bytes held by the arrays of the shapes of a scene, see Scene::memoryUsage()
+struct GeometryUsage
+{
+	//! Shapes measured
+	int shapes = 0;
+	//! Shapes whose arrays were released, see Shape::pageOut()
+	int paged = 0;
+	//! Vertices, normals, colors, tangents, UV coordinates and triangles as read from the data
+	qint64 geometry = 0;
+	//! The transformed, skinned and blended copies drawn each frame
+	qint64 transformed = 0;
+	//! Bones, weights, partitions and influences
+	qint64 skin = 0;
+	//! Buffer objects in video memory
+	qint64 buffers = 0;
+};
+
+/*! An array kept in a GL buffer object, such as the vertices of a Shape
+ *
+ * The array is uploaded again only when it no longer shares its data with the copy
+ * uploaded last. QVector is implicitly shared, so this is the case after any change.
+ */
+template <typename T> class GLBuffer final
+{
+public:
+	explicit GLBuffer( GLenum t = GL_ARRAY_BUFFER ) : target( t ) {}
+	~GLBuffer()
+	{
+		if ( id && QOpenGLContext::currentContext() )
+			QOpenGLContext::currentContext()->functions()->glDeleteBuffers( 1, &id );
+	}
+
+	GLBuffer( const GLBuffer & ) = delete;
+	GLBuffer & operator=( const GLBuffer & ) = delete;
+
+	//! Bind the buffer, uploading the array first if it changed
+	void bind( const QVector<T> & data )
+	{
+		QOpenGLFunctions * fn = QOpenGLContext::currentContext()->functions();
+
+		if ( !id )
+			fn->glGenBuffers( 1, &id );
+
+		fn->glBindBuffer( target, id );
+
+		if ( data.constData() != uploaded.constData() || data.count() != uploaded.count() ) {
+			// Arrays changing after their first upload, such as skinned vertices, are likely to change every frame
+			fn->glBufferData( target, data.count() * sizeof( T ), data.constData(), uploaded.isEmpty() ? GL_STATIC_DRAW : GL_DYNAMIC_DRAW );
+			uploaded = data;
+			count = data.count();
+		}
+	}
+
+	//! Bind the buffer, uploading an array which is rewritten in place every frame, such as skinned vertices
+	/*!
+	 * Unlike bind(), no reference to the array is kept, which would make the
+	 * next write to it copy the whole array first.
+	 */
+	void bindDynamic( const QVector<T> & data )
+	{
+		QOpenGLFunctions * fn = QOpenGLContext::currentContext()->functions();
+
+		if ( !id )
+			fn->glGenBuffers( 1, &id );
+
+		fn->glBindBuffer( target, id );
+
+		if ( data.count() == count && uploaded.isEmpty() )
+			fn->glBufferSubData( target, 0, data.count() * sizeof( T ), data.constData() );
+		else
+			fn->glBufferData( target, data.count() * sizeof( T ), data.constData(), GL_DYNAMIC_DRAW );
+
+		uploaded = QVector<T>();
+		count = data.count();
+	}
+
+	//! Bind the buffer, uploading only the items at \a changed
+	/*!
+	 * The caller guarantees that no other item differs from the last upload.
+	 * The whole array is uploaded if its size changed or most of it did.
+	 */
+	void bind( const QVector<T> & data, const QVector<int> & changed )
+	{
+		if ( !id || data.count() != uploaded.count() || changed.count() > data.count() / 4 ) {
+			bind( data );
+			return;
+		}
+
+		QOpenGLFunctions * fn = QOpenGLContext::currentContext()->functions();
+		fn->glBindBuffer( target, id );
+
+		for ( const int i : changed )
+			fn->glBufferSubData( target, i * sizeof( T ), sizeof( T ), data.constData() + i );
+
+		uploaded = data;
+		count = data.count();
+	}
+
+	//! Bind no buffer to the target, so that client side arrays can be used again
+	void release() const
+	{
+		QOpenGLContext::currentContext()->functions()->glBindBuffer( target, 0 );
+	}
+
+	//! Bytes of video memory held by the buffer object
+	qint64 size() const { return id ? qint64( count ) * sizeof( T ) : 0; }
+
+private:
+	GLenum target;
+	GLuint id = 0;
+	//! The array uploaded last by bind(), empty after bindDynamic()
+	QVector<T> uploaded;
+	//! Items in the buffer object
+	int count = 0;
+};
+
+/*! Points, lines or triangles drawn with a single call, replacing glBegin() and glVertex()
+ *
+ * The vertices are drawn from a client side array with the current color, polygon mode
+ * and matrices. Line strips are added as separate lines, so that several fit in one draw.
+ */
+class VertexBatch final
+{
+public:
+	explicit VertexBatch( GLenum m = GL_LINES ) : mode( m ) {}
+	//! Start with vertices already listed in the order they are drawn
+	VertexBatch( GLenum m, const QVector<Vector3> & v ) : mode( m ), vertices( v ) {}
+
+	//! Add a vertex
+	void add( const Vector3 & v ) { vertices.append( v ); }
+	//! Add a triangle
+	void add( const Vector3 & a, const Vector3 & b, const Vector3 & c ) { vertices << a << b << c; }
+
+	//! Start a line strip at v
+	void moveTo( const Vector3 & v ) { last = v; }
+	//! Continue the line strip to v
+	void lineTo( const Vector3 & v ) { vertices << last << v; last = v; }
+
+	//! Draw the vertices added so far and clear them
+	void draw();
+
+private:
+	GLenum mode;
+	QVector<Vector3> vertices;
+	Vector3 last;
+};
+
+/*! Geometry which never changes, such as markers and unit helpers, kept in buffer objects
+ *
+ * The GL contexts of all windows share their objects, so the buffers are
+ * uploaded by the first window drawing the geometry and serve every window
+ * after that. Instances are meant to be created once and kept until the
+ * program exits, see staticGeometry().
+ */
+class StaticGeometry final
+{
+public:
+	//! How the vertices are drawn if there are no triangles
+	GLenum mode = GL_TRIANGLES;
+	QVector<Vector3> vertices;
+	//! If empty, the vertices are drawn in order
+	QVector<Triangle> triangles;
+
+	//! Draw with the current color, polygon mode and matrices
+	void draw();
+
+private:
+	GLBuffer<Vector3> vertexBuffer;
+	GLBuffer<Triangle> triangleBuffer{ GL_ELEMENT_ARRAY_BUFFER };
+};
+
+/*! The geometry built for a key by \a build on the first call, see StaticGeometry
+ *
+ * \param key		Identifies the geometry, such as the address of the arrays it is built from
+ * \param detail	Distinguishes geometry of the same key, such as the subdivisions of a sphere
+ */
+StaticGeometry & staticGeometry( const void * key, int detail, const std::function<void( StaticGeometry & )> & build );
+
 QVector<int> sortAxes( QVector<float> axesDots );
 
 void drawAxes( Vector3 c, float axis );
@@ -125,6 +306,10 @@ void drawSphereSimple( Vector3 c, float r, int sd = 36 );
 void drawSphere( Vector3 c, float r, int sd = 8 );
 void drawCapsule( Vector3 a, Vector3 b, float r, int sd = 5 );
 void drawDashLine( Vector3 a, Vector3 b, int sd = 15 );
+//! Vertices of a collision shape, decoded by \a decode on first use and kept until clearCollisionCache()
+QVector<Vector3> collisionGeometry( const QModelIndex & iShape, const std::function<QVector<Vector3>()> & decode );
+//! Forget the decoded collision shapes, after the model changed
+void clearCollisionCache();
 void drawConvexHull( const NifModel * nif, const QModelIndex & iShape, float scale, bool solid = false );
 void drawNiTSS( const NifModel * nif, const QModelIndex & iShape, bool solid = false );
 void drawCMS( const NifModel * nif, const QModelIndex & iShape, bool solid = false );
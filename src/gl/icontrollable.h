@@ -39,6 +39,8 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QList>
 #include <QPersistentModelIndex>
 #include <QString>
+#include <QStringList>
+#include <QVector>
 
 
 //! @file icontrollable.h IControllable interface
@@ -75,6 +77,13 @@ public:
 
 	QString getName() const;
 
+	/*! Append the animated values of the last transform(), see Scene::bake()
+	 *
+	 * @param[out] values	The values, the same number and order for every call
+	 * @param[out] names	If not null, the names of the values appended
+	 */
+	virtual void sampleValues( QVector<float> & values, QStringList * names ) const;
+
 protected:
 	//! Sets the Controller
 	virtual void setController( const NifModel * nif, const QModelIndex & iController ) { Q_UNUSED( nif ); Q_UNUSED( iController ); }
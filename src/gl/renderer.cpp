@@ -32,6 +32,7 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "renderer.h"
 #include "settings.h"
+#include "trace.h"
 
 #include "glmesh.h"
 #include "glproperty.h"
@@ -40,12 +41,18 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "material.h"
 
 #include <QApplication>
+#include <QCryptographicHash>
+#include <QDataStream>
 #include <QDebug>
 #include <QDir>
 #include <QFile>
+#include <QFileInfo>
 #include <QOpenGLContext>
 #include <QOpenGLFunctions>
+#include <QOpenGLShader>
+#include <QSaveFile>
 #include <QSettings>
+#include <QStandardPaths>
 #include <QTextStream>
 
 
@@ -54,6 +61,101 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 bool shader_initialized = false;
 bool shader_ready = true;
 
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+//! Identifies a program binary cache file
+#define PROGRAM_CACHE_MAGIC 0x42505347
+//! Bumped whenever the layout of the program binary cache changes
+#define PROGRAM_CACHE_VERSION 1
+
+//! The entry points of OpenGL 4.1 / GL_ARB_get_program_binary and GL_KHR_parallel_shader_compile, resolved by updateShaders()
+static struct
+{
+	void ( QOPENGLF_APIENTRYP getProgramBinary )( GLuint, GLsizei, GLsizei *, GLenum *, void * ) = nullptr;
+	void ( QOPENGLF_APIENTRYP programBinary )( GLuint, GLenum, const void *, GLsizei ) = nullptr;
+	void ( QOPENGLF_APIENTRYP programParameteri )( GLuint, GLenum, GLint ) = nullptr;
+	//! Whether the driver compiles and links in the background
+	bool parallel = false;
+	//! Identifies the driver the binaries were made by
+	QByteArray driver;
+} programExt;
+
+//! Resolve the entry points of program binaries and parallel compilation for the current context
+static void resolveProgramExtensions( QOpenGLContext * context, QOpenGLFunctions * f )
+{
+	programExt = {};
+
+	const bool binaries = context->hasExtension( "GL_ARB_get_program_binary" ) || context->hasExtension( "GL_OES_get_program_binary" )
+		|| context->format().version() >= qMakePair( 4, 1 );
+
+	if ( binaries ) {
+		const char * suffix = context->hasExtension( "GL_OES_get_program_binary" ) && !context->hasExtension( "GL_ARB_get_program_binary" ) ? "OES" : "";
+
+		programExt.getProgramBinary = reinterpret_cast<decltype( programExt.getProgramBinary )>(
+			context->getProcAddress( QByteArray( "glGetProgramBinary" ) + suffix ) );
+		programExt.programBinary = reinterpret_cast<decltype( programExt.programBinary )>(
+			context->getProcAddress( QByteArray( "glProgramBinary" ) + suffix ) );
+		programExt.programParameteri = reinterpret_cast<decltype( programExt.programParameteri )>(
+			context->getProcAddress( "glProgramParameteri" ) );
+
+		// Drivers may support the entry points without any binary format
+		GLint formats = 0;
+		f->glGetIntegerv( GL_NUM_PROGRAM_BINARY_FORMATS, &formats );
+		if ( formats <= 0 )
+			programExt.getProgramBinary = nullptr;
+	}
+
+	if ( context->hasExtension( "GL_KHR_parallel_shader_compile" ) || context->hasExtension( "GL_ARB_parallel_shader_compile" ) ) {
+		auto maxThreads = reinterpret_cast<void ( QOPENGLF_APIENTRYP )( GLuint )>( context->getProcAddress( "glMaxShaderCompilerThreadsKHR" ) );
+		if ( !maxThreads )
+			maxThreads = reinterpret_cast<void ( QOPENGLF_APIENTRYP )( GLuint )>( context->getProcAddress( "glMaxShaderCompilerThreadsARB" ) );
+
+		if ( maxThreads ) {
+			// As many threads as the driver sees fit
+			maxThreads( 0xFFFFFFFF );
+			programExt.parallel = true;
+		}
+	}
+
+	programExt.driver = QByteArray( reinterpret_cast<const char *>( f->glGetString( GL_VENDOR ) ) ) + '\n'
+		+ reinterpret_cast<const char *>( f->glGetString( GL_RENDERER ) ) + '\n'
+		+ reinterpret_cast<const char *>( f->glGetString( GL_VERSION ) );
+}
+
+/*! The file keeping the binary of a linked program, empty if the driver cannot provide one
+ *
+ * Programs are kept by the hash of their sources and the driver, so that editing
+ * a shader or updating the driver links them again.
+ */
+static QString programCacheName( const QByteArray & program, const QList<QByteArray> & sources )
+{
+	if ( !programExt.getProgramBinary || !programExt.programBinary )
+		return QString();
+
+	QString cacheDir = QStandardPaths::writableLocation( QStandardPaths::CacheLocation );
+	if ( cacheDir.isEmpty() )
+		return QString();
+
+	QCryptographicHash hash( QCryptographicHash::Sha1 );
+	hash.addData( programExt.driver );
+	hash.addData( program );
+	for ( const QByteArray & source : sources )
+		hash.addData( source );
+
+	return QDir( cacheDir ).filePath( "shaders/" + QString::fromLatin1( hash.result().toHex() ) + ".bin" );
+}
+
 bool Renderer::initialize()
 {
 	if ( !shader_initialized ) {
@@ -204,41 +306,55 @@ Renderer::Shader::~Shader()
 
 bool Renderer::Shader::load( const QString & filepath )
 {
-	try
-	{
-		QFile file( filepath );
+	QFile file( filepath );
 
-		if ( !file.open( QIODevice::ReadOnly ) )
-			throw QString( "couldn't open %1 for read access" ).arg( filepath );
+	if ( !file.open( QIODevice::ReadOnly ) ) {
+		status = false;
+		Message::append( QObject::tr( "There were errors during shader compilation" ),
+			QString( "%1:\r\n\r\n%2" ).arg( name ).arg( QString( "couldn't open %1 for read access" ).arg( filepath ) ) );
+		return false;
+	}
 
-		QByteArray data = file.readAll();
+	source = file.readAll();
+	status = true;
+	return true;
+}
 
-		const char * src = data.constData();
+void Renderer::Shader::compile()
+{
+	if ( compiled )
+		return;
 
-		f->glShaderSource( id, 1, &src, 0 );
-		f->glCompileShader( id );
+	const char * src = source.constData();
 
-		GLint result;
-		f->glGetShaderiv( id, GL_COMPILE_STATUS, &result );
+	f->glShaderSource( id, 1, &src, 0 );
+	f->glCompileShader( id );
+	compiled = true;
+}
+
+bool Renderer::Shader::check()
+{
+	if ( checked || !compiled )
+		return status;
+
+	checked = true;
+
+	GLint result;
+	f->glGetShaderiv( id, GL_COMPILE_STATUS, &result );
+
+	if ( result != GL_TRUE ) {
+		GLint logLen;
+		f->glGetShaderiv( id, GL_INFO_LOG_LENGTH, &logLen );
+		char * log = new char[ logLen ];
+		f->glGetShaderInfoLog( id, logLen, 0, log );
+		QString errlog( log );
+		delete[] log;
 
-		if ( result != GL_TRUE ) {
-			GLint logLen;
-			f->glGetShaderiv( id, GL_INFO_LOG_LENGTH, &logLen );
-			char * log = new char[ logLen ];
-			f->glGetShaderInfoLog( id, logLen, 0, log );
-			QString errlog( log );
-			delete[] log;
-			throw errlog;
-		}
-	}
-	catch ( QString err )
-	{
 		status = false;
-		Message::append( QObject::tr( "There were errors during shader compilation" ), QString( "%1:\r\n\r\n%2" ).arg( name ).arg( err ) );
-		return false;
+		Message::append( QObject::tr( "There were errors during shader compilation" ), QString( "%1:\r\n\r\n%2" ).arg( name ).arg( errlog ) );
 	}
-	status = true;
-	return true;
+
+	return status;
 }
 
 
@@ -251,7 +367,7 @@ Renderer::Program::Program( const QString & n, QOpenGLFunctions * fn )
 Renderer::Program::~Program()
 {
 	if ( id )
-		f->glDeleteShader( id );
+		f->glDeleteProgram( id );
 }
 
 bool Renderer::Program::load( const QString & filepath, Renderer * renderer )
@@ -263,7 +379,8 @@ bool Renderer::Program::load( const QString & filepath, Renderer * renderer )
 		if ( !file.open( QIODevice::ReadOnly ) )
 			throw QString( "couldn't open %1 for read access" ).arg( filepath );
 
-		QTextStream stream( &file );
+		QByteArray text = file.readAll();
+		QTextStream stream( text );
 
 		QStack<ConditionGroup *> chkgrps;
 		chkgrps.push( &conditions );
@@ -279,9 +396,13 @@ bool Renderer::Program::load( const QString & filepath, Renderer * renderer )
 
 					if ( shader ) {
 						if ( shader->status )
-							f->glAttachShader( id, shader->id );
+							attached << shader;
 						else
 							throw QString( "depends on shader %1 which was not compiled successful" ).arg( list[ i ] );
+					} else if ( overlay ) {
+						// Overlays are drawn without them, geometry shaders not being loaded where unsupported
+						status = false;
+						return false;
 					} else {
 						throw QString( "shader %1 not found" ).arg( list[ i ] );
 					}
@@ -329,26 +450,156 @@ bool Renderer::Program::load( const QString & filepath, Renderer * renderer )
 					throw QString( "texture unit %1 is assigned twiced" ).arg( unit );
 
 				texcoords.insert( unit, id );
+			} else if ( line == "overlay" ) {
+				overlay = true;
 			}
 		}
 
+		QList<QByteArray> sources;
+		for ( Shader * shader : attached )
+			sources << shader->name.toUtf8() << shader->source;
+
+		cachename = programCacheName( text, sources );
+
+		// A cached binary skips compiling the shaders as well as linking
+		QFile cache( cachename );
+
+		if ( !cachename.isEmpty() && cache.open( QIODevice::ReadOnly ) ) {
+			QByteArray data = cache.readAll();
+			QDataStream in( data );
+			in.setVersion( QDataStream::Qt_5_0 );
+
+			quint32 magic = 0, cacheVersion = 0, format = 0;
+			QByteArray binary;
+			in >> magic >> cacheVersion >> format >> binary;
+
+			if ( in.status() == QDataStream::Ok && magic == PROGRAM_CACHE_MAGIC && cacheVersion == PROGRAM_CACHE_VERSION ) {
+				programExt.programBinary( id, format, binary.constData(), binary.size() );
+
+				GLint result = GL_FALSE;
+				f->glGetProgramiv( id, GL_LINK_STATUS, &result );
+
+				if ( result == GL_TRUE ) {
+					// There is nothing to save again
+					cachename.clear();
+					pending = true;
+					return finish();
+				}
+			}
+		}
+
+		// The driver rejects binaries of another version, the program is then linked from its sources
+		for ( Shader * shader : attached ) {
+			shader->compile();
+			f->glAttachShader( id, shader->id );
+		}
+
+		if ( !cachename.isEmpty() && programExt.programParameteri )
+			programExt.programParameteri( id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE );
+
 		f->glLinkProgram( id );
+		pending = true;
+	}
+	catch ( QString x )
+	{
+		status = false;
+		Message::append( QObject::tr( "There were errors during shader compilation" ), QString( "%1:\r\n\r\n%2" ).arg( name ).arg( x ) );
+		return false;
+	}
+	status = true;
+	return true;
+}
+
+bool Renderer::Program::ready()
+{
+	if ( !pending )
+		return status;
 
+	if ( programExt.parallel ) {
+		GLint done = GL_TRUE;
+		f->glGetProgramiv( id, GL_COMPLETION_STATUS_KHR, &done );
+		if ( done != GL_TRUE )
+			return false;
+	}
+
+	return finish();
+}
+
+bool Renderer::Program::finish()
+{
+	pending = false;
+
+	try
+	{
 		GLint result;
 
 		f->glGetProgramiv( id, GL_LINK_STATUS, &result );
 
 		if ( result != GL_TRUE ) {
+			// Errors of the shaders are reported with the shaders
+			for ( Shader * shader : attached ) {
+				if ( !shader->check() )
+					throw QString( "depends on shader %1 which was not compiled successful" ).arg( shader->name );
+			}
+
 			GLint logLen = 0;
 			f->glGetProgramiv( id, GL_INFO_LOG_LENGTH, &logLen );
 
+			QString errlog;
 			if ( logLen != 0 ) {
 				char * log = new char[ logLen ];
 				f->glGetProgramInfoLog( id, logLen, 0, log );
-				QString errlog( log );
+				errlog = QString( log );
 				delete[] log;
-				id = 0;
-				throw errlog;
+			}
+
+			throw errlog;
+		}
+
+		// Uniforms are looked up here once instead of for every shape drawn
+		GLint count = 0, maxLength = 0;
+		f->glGetProgramiv( id, GL_ACTIVE_UNIFORMS, &count );
+		f->glGetProgramiv( id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength );
+
+		QByteArray buffer( maxLength + 1, 0 );
+
+		for ( GLint i = 0; i < count; i++ ) {
+			GLsizei length = 0;
+			GLint size = 0;
+			GLenum type = 0;
+			f->glGetActiveUniform( id, i, buffer.size(), &length, &size, &type, buffer.data() );
+
+			QByteArray uniform( buffer.constData(), length );
+
+			// Arrays are listed by their first element
+			if ( uniform.endsWith( "[0]" ) )
+				uniform.chop( 3 );
+
+			uniforms.insert( uniform, f->glGetUniformLocation( id, uniform.constData() ) );
+		}
+
+		if ( !cachename.isEmpty() ) {
+			GLint length = 0;
+			f->glGetProgramiv( id, GL_PROGRAM_BINARY_LENGTH, &length );
+
+			if ( length > 0 ) {
+				QByteArray binary( length, 0 );
+				GLenum format = 0;
+				programExt.getProgramBinary( id, length, &length, &format, binary.data() );
+				binary.resize( length );
+
+				QByteArray data;
+				QDataStream out( &data, QIODevice::WriteOnly );
+				out.setVersion( QDataStream::Qt_5_0 );
+				out << quint32( PROGRAM_CACHE_MAGIC ) << quint32( PROGRAM_CACHE_VERSION ) << quint32( format ) << binary;
+
+				QDir().mkpath( QFileInfo( cachename ).absolutePath() );
+
+				QSaveFile cache( cachename );
+				if ( cache.open( QIODevice::WriteOnly ) ) {
+					cache.write( data );
+					cache.commit();
+				}
 			}
 		}
 	}
@@ -362,6 +613,21 @@ bool Renderer::Program::load( const QString & filepath, Renderer * renderer )
 	return true;
 }
 
+GLint Renderer::Program::uniformLocation( const char * name ) const
+{
+	return uniforms.value( QByteArray::fromRawData( name, int( strlen( name ) ) ), -1 );
+}
+
+bool Renderer::Program::setsValue( GLint location, const Vector4 & value )
+{
+	auto it = values.find( location );
+	if ( it != values.end() && it.value() == value )
+		return false;
+
+	values.insert( location, value );
+	return true;
+}
+
 Renderer::Renderer( QOpenGLContext * c, QOpenGLFunctions * f )
 	: cx( c ), fn( f )
 {
@@ -397,6 +663,7 @@ void Renderer::updateShaders()
 		return;
 
 	releaseShaders();
+	resolveProgramExtensions( cx, fn );
 
 	QDir dir( QApplication::applicationDirPath() );
 
@@ -424,13 +691,47 @@ void Renderer::updateShaders()
 		shaders.insert( name, shader );
 	}
 
+	// Programs depending on them report the missing shaders
+	if ( QOpenGLShader::hasOpenGLShaders( QOpenGLShader::Geometry, cx ) ) {
+		dir.setNameFilters( { "*.geom" } );
+		for ( const QString& name : dir.entryList() ) {
+			Shader * shader = new Shader( name, GL_GEOMETRY_SHADER, fn );
+			shader->load( dir.filePath( name ) );
+			shaders.insert( name, shader );
+		}
+	}
+
 	dir.setNameFilters( { "*.prog" } );
 	for ( const QString& name : dir.entryList() ) {
 		Program * program = new Program( name, fn );
 		program->load( dir.filePath( name ), this );
-		programs.insert( name, program );
+
+		if ( program->overlay )
+			overlays.insert( name, program );
+		else
+			programs.insert( name, program );
 	}
 #endif
+
+	// Without parallel compilation waiting for one program at a time is no slower
+	if ( !programExt.parallel ) {
+		for ( Program * program : programs )
+			program->ready();
+		for ( Program * program : overlays )
+			program->ready();
+	}
+
+	programsRevision++;
+}
+
+bool Renderer::isCompiling() const
+{
+	for ( Program * program : programs ) {
+		if ( program->pending )
+			return true;
+	}
+
+	return false;
 }
 
 void Renderer::releaseShaders()
@@ -440,12 +741,17 @@ void Renderer::releaseShaders()
 
 	qDeleteAll( programs );
 	programs.clear();
+	qDeleteAll( overlays );
+	overlays.clear();
+	overlay = nullptr;
 	qDeleteAll( shaders );
 	shaders.clear();
 }
 
 QString Renderer::setupProgram( Shape * mesh, const QString & hint )
 {
+	TRACE_SPAN( "Renderer::setupProgram" );
+
 	PropertyList props;
 	mesh->activeProperties( props );
 
@@ -461,16 +767,36 @@ QString Renderer::setupProgram( Shape * mesh, const QString & hint )
 		iBlocks.append( p->index() );
 	}
 
-	if ( !hint.isEmpty() ) {
+	// The conditions are only evaluated again once the blocks, their contents or the programs changed
+	Shape::ProgramCache & cache = mesh->programCache;
+
+	if ( cache.blocks != iBlocks || cache.evaluated != cache.revision || cache.programs != programsRevision ) {
+		const NifModel * nif = qobject_cast<const NifModel *>( mesh->index().model() );
+
+		cache.matches.clear();
+
+		for ( Program * program : programs ) {
+			if ( program->status && nif && program->conditions.eval( nif, iBlocks ) )
+				cache.matches.append( program->name );
+		}
+
+		cache.blocks = iBlocks;
+		cache.evaluated = cache.revision;
+		cache.programs = programsRevision;
+	}
+
+	if ( !hint.isEmpty() && cache.matches.contains( hint ) ) {
 		Program * program = programs.value( hint );
 
-		if ( program && program->status && setupProgram( program, mesh, props, iBlocks ) )
+		if ( program && setupProgram( program, mesh, props, iBlocks ) )
 			return hint;
 	}
 
-	for ( Program * program : programs ) {
-		if ( program->status && setupProgram( program, mesh, props, iBlocks ) )
-			return program->name;
+	for ( const QString & name : cache.matches ) {
+		Program * program = programs.value( name );
+
+		if ( program && name != hint && setupProgram( program, mesh, props, iBlocks ) )
+			return name;
 	}
 
 	stopProgram();
@@ -484,9 +810,33 @@ void Renderer::stopProgram()
 		fn->glUseProgram( 0 );
 	}
 
+	overlay = nullptr;
 	resetTextureUnits();
 }
 
+bool Renderer::useOverlay( const QString & name )
+{
+	Program * program = shader_ready ? overlays.value( name ) : nullptr;
+
+	if ( !program || !program->ready() )
+		return false;
+
+	fn->glUseProgram( program->id );
+	overlay = program;
+	return true;
+}
+
+void Renderer::setOverlayUniform( const char * name, float value )
+{
+	if ( !overlay )
+		return;
+
+	GLint location = overlay->uniformLocation( name );
+
+	if ( location >= 0 && overlay->setsValue( location, Vector4( value, 0, 0, 0 ) ) )
+		fn->glUniform1f( location, value );
+}
+
 bool Renderer::setupProgram( Program * prog, Shape * mesh, const PropertyList & props, const QList<QModelIndex> & iBlocks )
 {
 	const NifModel * nif = qobject_cast<const NifModel *>( mesh->index().model() );
@@ -494,10 +844,17 @@ bool Renderer::setupProgram( Program * prog, Shape * mesh, const PropertyList &
 	if ( !mesh->index().isValid() || !nif )
 		return false;
 
-	if ( !prog->conditions.eval( nif, iBlocks ) )
+	// Programs still compiling are skipped, those which failed are no longer matched
+	if ( prog->pending && !prog->ready() ) {
 		return false;
+	} else if ( !prog->status ) {
+		programsRevision++;
+		return false;
+	}
 
+	// The conditions of prog were evaluated by setupProgram( Shape *, const QString & )
 	fn->glUseProgram( prog->id );
+	mesh->scene->stats.programBinds++;
 
 	auto opts = mesh->scene->options;
 	auto vis = mesh->scene->visMode;
@@ -531,7 +888,7 @@ bool Renderer::setupProgram( Program * prog, Shape * mesh, const PropertyList &
 
 	//GLint baseWidth, baseHeight;
 
-	GLint uniBaseMap = fn->glGetUniformLocation( prog->id, "BaseMap" );
+	GLint uniBaseMap = prog->uniformLocation( "BaseMap" );
 
 	if ( uniBaseMap >= 0 ) {
 		if ( !texprop && !bsprop )
@@ -549,7 +906,7 @@ bool Renderer::setupProgram( Program * prog, Shape * mesh, const PropertyList &
 		fn->glUniform1i( uniBaseMap, texunit++ );
 	}
 
-	GLint uniNormalMap = fn->glGetUniformLocation( prog->id, "NormalMap" );
+	GLint uniNormalMap = prog->uniformLocation( "NormalMap" );
 
 	if ( uniNormalMap >= 0 ) {
 		if ( texprop ) {
@@ -580,7 +937,7 @@ bool Renderer::setupProgram( Program * prog, Shape * mesh, const PropertyList &
 		fn->glUniform1i( uniNormalMap, texunit++ );
 	}
 
-	GLint uniGlowMap = fn->glGetUniformLocation( prog->id, "GlowMap" );
+	GLint uniGlowMap = prog->uniformLocation( "GlowMap" );
 
 	if ( uniGlowMap >= 0 ) {
 		if ( texprop ) {
@@ -610,43 +967,44 @@ bool Renderer::setupProgram( Program * prog, Shape * mesh, const PropertyList &
 
 
 	// Sets a float
+	// Uniforms keep their values, so only those which differ from the last shape drawn are set
 	auto uni1f = [this, prog, mesh]( const char * var, float x ) {
-		GLint uni = fn->glGetUniformLocation( prog->id, var );
-		if ( uni >= 0 )
+		GLint uni = prog->uniformLocation( var );
+		if ( uni >= 0 && prog->setsValue( uni, Vector4( x, 0, 0, 0 ) ) )
 			fn->glUniform1f( uni, x );
 	};
 
 	// Sets a vec2 (two floats)
 	auto uni2f = [this, prog, mesh]( const char * var, float x, float y ) {
-		GLint uni = fn->glGetUniformLocation( prog->id, var );
-		if ( uni >= 0 )
+		GLint uni = prog->uniformLocation( var );
+		if ( uni >= 0 && prog->setsValue( uni, Vector4( x, y, 0, 0 ) ) )
 			fn->glUniform2f( uni, x, y );
 	};
 
 	// Sets a vec3 (three floats)
 	auto uni3f = [this, prog, mesh]( const char * var, float x, float y, float z ) {
-		GLint uni = fn->glGetUniformLocation( prog->id, var );
-		if ( uni >= 0 )
+		GLint uni = prog->uniformLocation( var );
+		if ( uni >= 0 && prog->setsValue( uni, Vector4( x, y, z, 0 ) ) )
 			fn->glUniform3f( uni, x, y, z );
 	};
 
 	// Sets a vec4 (four floats)
 	auto uni4f = [this, prog, mesh]( const char * var, float x, float y, float z, float w ) {
-		GLint uni = fn->glGetUniformLocation( prog->id, var );
-		if ( uni >= 0 )
+		GLint uni = prog->uniformLocation( var );
+		if ( uni >= 0 && prog->setsValue( uni, Vector4( x, y, z, w ) ) )
 			fn->glUniform4f( uni, x, y, z, w );
 	};
 
 	// Sets an integer or boolean
 	auto uni1i = [this, prog, mesh]( const char * var, int val ) {
-		GLint uni = fn->glGetUniformLocation( prog->id, var );
-		if ( uni >= 0 )
+		GLint uni = prog->uniformLocation( var );
+		if ( uni >= 0 && prog->setsValue( uni, Vector4( float( val ), 0, 0, 0 ) ) )
 			fn->glUniform1i( uni, val );
 	};
 
 	// Sets a mat3 (3x3 matrix)
 	auto uni3m = [this, prog, mesh]( const char * var, Matrix val ) {
-		GLint uni = fn->glGetUniformLocation( prog->id, var );
+		GLint uni = prog->uniformLocation( var );
 		if ( uni >= 0 ) {
 			fn->glUniformMatrix3fv( uni, 1, 0, val.data() );
 		}
@@ -654,7 +1012,7 @@ bool Renderer::setupProgram( Program * prog, Shape * mesh, const PropertyList &
 
 	// Sets a mat4 (4x4 matrix)
 	auto uni4m = [this, prog, mesh]( const char * var, Matrix4 val ) {
-		GLint uni = fn->glGetUniformLocation( prog->id, var );
+		GLint uni = prog->uniformLocation( var );
 		if ( uni >= 0 ) {
 			fn->glUniformMatrix4fv( uni, 1, 0, val.data() );
 		}
@@ -662,7 +1020,7 @@ bool Renderer::setupProgram( Program * prog, Shape * mesh, const PropertyList &
 
 	// Sets a sampler2D (texture sampler)
 	auto uniSampler = [this, prog, bsprop, &texunit]( const char * var, int textureSlot, QString alternate, TexClampMode clamp ) {
-		GLint uniSamp = fn->glGetUniformLocation( prog->id, var );
+		GLint uniSamp = prog->uniformLocation( var );
 		if ( uniSamp >= 0 ) {
 
 			QString fname = bsprop->fileName( textureSlot );
@@ -823,7 +1181,7 @@ bool Renderer::setupProgram( Program * prog, Shape * mesh, const PropertyList &
 			if ( !uniSampler( "EnvironmentMap", 5, white, clamp ) )
 				return false;
 
-			GLint uniCubeMap = fn->glGetUniformLocation( prog->id, "CubeMap" );
+			GLint uniCubeMap = prog->uniformLocation( "CubeMap" );
 			if ( uniCubeMap >= 0 ) {
 
 				QString fname = bsprop->fileName( 4 );
@@ -919,7 +1277,7 @@ bool Renderer::setupProgram( Program * prog, Shape * mesh, const PropertyList &
 				if ( mesh->bsesp->hasEnvMask && !uniSampler( "SpecularMap", 4, white, clamp ) )
 					return false;
 
-				GLint uniCubeMap = fn->glGetUniformLocation( prog->id, "CubeMap" );
+				GLint uniCubeMap = prog->uniformLocation( "CubeMap" );
 				if ( uniCubeMap >= 0 ) {
 
 					QString fname = bsprop->fileName( 2 );
@@ -46,6 +46,7 @@ class QOpenGLContext;
 class QOpenGLFunctions;
 
 typedef unsigned int GLenum;
+typedef int GLint;
 typedef unsigned int GLuint;
 
 //! Manages rendering and shaders
@@ -68,6 +69,8 @@ public:
 	void updateShaders();
 	//! Releases shaders
 	void releaseShaders();
+	//! Whether programs are still being compiled in the background, see Program::ready()
+	bool isCompiling() const;
 
 	//! Context
 	QOpenGLContext * cx;
@@ -79,6 +82,17 @@ public:
 	//! Stop shader program
 	void stopProgram();
 
+	//! Use an overlay program by the name of its .prog file, false unless it is linked
+	/*!
+	 * Overlay programs, such as selection_vectors.prog, are marked by an
+	 * overlay line in their .prog file. They are never matched against the
+	 * shapes, but used by name to draw over them, see Shape::drawVectors().
+	 * Stopped by stopProgram() as any other program.
+	 */
+	bool useOverlay( const QString & name );
+	//! Set a float uniform of the overlay program in use
+	void setOverlayUniform( const char * name, float value );
+
 public slots:
 	void updateSettings();
 
@@ -134,22 +148,35 @@ protected:
 		bool _or;
 	};
 
-	//! Parsing and loading of .frag or .vert files
+	//! Parsing and loading of .frag, .geom or .vert files
+	/*!
+	 * The source is only compiled once a program which is not in the program
+	 * binary cache needs it, see Program::load().
+	 */
 	class Shader
 	{
 public:
 		Shader( const QString & name, GLenum type, QOpenGLFunctions * fn );
 		~Shader();
 
+		//! Read the source
 		bool load( const QString & filepath );
+		//! Start compiling the source, unless it already was
+		void compile();
+		//! Whether the source compiled, reporting the errors the first time it did not
+		bool check();
 
 		QOpenGLFunctions * f;
 		QString name;
 		GLuint id;
+		//! False once the source could not be read or compiled
 		bool status;
+		QByteArray source;
 
 protected:
 		GLenum type;
+		bool compiled = false;
+		bool checked = false;
 	};
 
 	//! Parsing and loading of .prog files
@@ -159,7 +186,20 @@ public:
 		Program( const QString & name, QOpenGLFunctions * fn );
 		~Program();
 
+		//! Parse a .prog file, and load the program from the binary cache or start linking it
 		bool load( const QString & filepath, Renderer * );
+		//! Whether the program is linked, finishing it if the driver is done with it
+		/*!
+		 * Where GL_KHR_parallel_shader_compile is supported the driver compiles
+		 * and links in the background, and this returns false until it is done,
+		 * so that shapes are drawn without the program meanwhile.
+		 */
+		bool ready();
+
+		//! Location of a uniform, -1 if the program does not use it
+		GLint uniformLocation( const char * name ) const;
+		//! Remember the value given to a uniform, false if the uniform already has it
+		bool setsValue( GLint location, const Vector4 & value );
 
 		QOpenGLFunctions * f;
 		QString name;
@@ -168,10 +208,41 @@ public:
 
 		ConditionGroup conditions;
 		QMap<int, QString> texcoords;
+		//! Whether the program is an overlay, see useOverlay()
+		bool overlay = false;
+
+		//! Locations of the active uniforms by name, looked up once the program is linked
+		QHash<QByteArray, GLint> uniforms;
+		//! Values last given to the uniforms by location, which the program keeps between uses
+		/*!
+		 * Stands in for a uniform block per material: most shaders in
+		 * res/shaders are GLSL 1.20 or 1.30, which have no uniform blocks, and
+		 * a shape only sets the values which differ from the last shape drawn
+		 * with the program.
+		 */
+		QHash<GLint, Vector4> values;
+
+		//! Whether the program was linked but its status not yet read
+		bool pending = false;
+
+protected:
+		//! Check the link status, look up the uniforms and save the binary
+		bool finish();
+
+		//! The shaders linked into the program
+		QList<Shader *> attached;
+		//! The file of the program binary cache, empty if binaries are not supported
+		QString cachename;
 	};
 
 	QMap<QString, Shader *> shaders;
 	QMap<QString, Program *> programs;
+	//! The overlay programs by name, which setupProgram() never matches
+	QMap<QString, Program *> overlays;
+	//! The overlay program in use, nullptr if none is
+	Program * overlay = nullptr;
+	//! Incremented whenever the programs are loaded again, invalidating the programs cached by shapes
+	int programsRevision = 0;
 
 	bool setupProgram( Program *, Shape *, const PropertyList &, const QList<QModelIndex> & iBlocks );
 	void setupFixedFunction( Shape *, const PropertyList & );
@@ -37,6 +37,7 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "ui_nifskope.h"
 #include "nifskope.h"
 #include "nifmodel.h"
+#include "material.h"
 #include "gl/glmesh.h"
 #include "gl/glscene.h"
 #include "gl/gltex.h"
@@ -50,23 +51,30 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QDebug>
 #include <QDialog>
 #include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileDialog>
 #include <QGroupBox>
 #include <QImageWriter>
+#include <QInputDialog>
 #include <QLabel>
 #include <QKeyEvent>
 #include <QMenu>
 #include <QMimeData>
 #include <QMouseEvent>
+#include <QPainter>
 #include <QPushButton>
 #include <QRadioButton>
 #include <QSettings>
 #include <QSpinBox>
+#include <QTextStream>
 #include <QTimer>
 #include <QToolBar>
 
 #include <QOpenGLContext>
 #include <QOpenGLFunctions>
 #include <QOpenGLFramebufferObject>
+#include <QOpenGLTimerQuery>
 #include <QGLFormat>
 
 // TODO: Determine the necessity of this
@@ -78,6 +86,9 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 	#include <GL/glu.h>
 #endif
 
+#include <algorithm> // std::sort
+#include <cmath>
+
 
 // NOTE: The FPS define is a frame limiter,
 //	NOT the guaranteed FPS in the viewport.
@@ -201,11 +212,12 @@ GLView::GLView( const QGLFormat & format, QWidget * p, const QGLWidget * shareWi
 
 	scene = new Scene( textures, glContext, glFuncs );
 	connect( textures, &TexCache::sigRefresh, this, static_cast<void (GLView::*)()>(&GLView::update) );
+	connect( MaterialCache::instance(), &MaterialCache::sigChanged, this, &GLView::updateScene );
 	connect( scene, &Scene::sceneUpdated, this, static_cast<void (GLView::*)()>(&GLView::update) );
 
+	// Started by updateTimer() only while there is something to advance
 	timer = new QTimer( this );
 	timer->setInterval( 1000 / FPS );
-	timer->start();
 	connect( timer, &QTimer::timeout, this, &GLView::advanceGears );
 
 	lightVisTimeout = 1500;
@@ -225,6 +237,11 @@ GLView::~GLView()
 {
 	flush();
 
+	makeCurrent();
+	delete pickBuffer;
+	delete frameQueries[0];
+	delete frameQueries[1];
+
 	delete textures;
 	delete scene;
 }
@@ -279,6 +296,7 @@ void GLView::updateAnimationState( bool checked )
 		lastTime = QTime::currentTime();
 
 		update();
+		updateTimer();
 	}
 }
 
@@ -307,6 +325,15 @@ void GLView::initializeGL()
 	if ( scene->renderer->initialize() )
 		updateShaders();
 
+	// GPU timing for the frame statistics, where timer queries are supported
+	for ( auto & query : frameQueries ) {
+		query = new QOpenGLTimerQuery;
+		if ( !query->create() ) {
+			delete query;
+			query = nullptr;
+		}
+	}
+
 	// Initial viewport values
 	//	Made viewport and aspect member variables.
 	//	They were being updated every single frame instead of only when resizing.
@@ -365,12 +392,14 @@ void GLView::glProjection( int x, int y )
 
 		GLdouble h2 = tan( ( cfg.fov / Zoom ) / 360 * M_PI ) * nr;
 		GLdouble w2 = h2 * aspect;
-		glFrustum( -w2, +w2, -h2, +h2, nr, fr );
+		glFrustum( -w2 + 2 * w2 * viewTile.left(), -w2 + 2 * w2 * viewTile.right(),
+			-h2 + 2 * h2 * viewTile.top(), -h2 + 2 * h2 * viewTile.bottom(), nr, fr );
 	} else {
 		// Orthographic View
 		GLdouble h2 = Dist / Zoom;
 		GLdouble w2 = h2 * aspect;
-		glOrtho( -w2, +w2, -h2, +h2, nr, fr );
+		glOrtho( -w2 + 2 * w2 * viewTile.left(), -w2 + 2 * w2 * viewTile.right(),
+			-h2 + 2 * h2 * viewTile.top(), -h2 + 2 * h2 * viewTile.bottom(), nr, fr );
 	}
 
 	glMatrixMode( GL_MODELVIEW );
@@ -391,6 +420,19 @@ void GLView::paintGL()
 {
 #endif
 	
+	// Start the statistics of this frame, the GPU time being that of an earlier frame
+	float gpu = -1;
+	QOpenGLTimerQuery * query = ( scene->options & Scene::ShowStats ) ? frameQueries[frameQuery] : nullptr;
+	if ( query ) {
+		gpu = scene->stats.gpu;
+		if ( frameQueried[frameQuery] && query->isResultAvailable() )
+			gpu = query->waitForResult() / 1e6f;
+
+		query->begin();
+	}
+
+	scene->stats = Scene::FrameStats();
+	scene->stats.gpu = gpu;
 
 	// Save GL state
 	glPushAttrib( GL_ALL_ATTRIB_BITS );
@@ -624,7 +666,7 @@ void GLView::paintGL()
 	// Draw the model
 	scene->draw();
 
-	if ( scene->options & Scene::ShowAxes ) {
+	if ( ( scene->options & Scene::ShowAxes ) && !offscreen ) {
 		// Resize viewport to small corner of screen
 		int axesSize = std::min( width() / 10, 125 );
 		glViewport( 0, 0, axesSize, axesSize );
@@ -684,10 +726,32 @@ void GLView::paintGL()
 	while ( ( err = glGetError() ) != GL_NO_ERROR )
 		qDebug() << tr( "glview.cpp - GL ERROR (paint): " ) << (const char *)gluErrorString( err );
 
+	if ( query ) {
+		query->end();
+		frameQueried[frameQuery] = true;
+		frameQuery ^= 1;
+	}
+
 	emit paintUpdate();
 
+	// Release textures not drawn in this frame once they exceed the budget
+	textures->evict();
+	// Release the arrays of shapes not drawn for a while once they exceed theirs
+	scene->pageGeometry();
+
 	// Manually handle the buffer swap
-	swapBuffers();
+	if ( !offscreen )
+		swapBuffers();
+
+	// Whatever was painted may have moved, picking has to rasterize the keys again
+	pickValid = false;
+
+	// The model or the visibility may have changed what there is to animate
+	updateTimer();
+
+	// Shapes are drawn without their programs until the driver finished compiling them
+	if ( scene->renderer->isCompiling() )
+		update();
 
 #ifdef USE_GL_QPAINTER
 	painter.end();
@@ -769,29 +833,17 @@ void GLView::setVisMode( Scene::VisMode mode, bool checked )
 
 typedef void (Scene::* DrawFunc)( void );
 
-int indexAt( /*GLuint *buffer,*/ NifModel * model, Scene * scene, QList<DrawFunc> drawFunc, int cycle, const QPoint & pos, int & furn )
+//! Rasterize the color keys of the scene into the bound frame buffer
+void drawColorKeys( Scene * scene, const QList<DrawFunc> & drawFunc )
 {
-	Q_UNUSED( model ); Q_UNUSED( cycle );
 	// Color Key O(1) selection
 	//	Open GL 3.0 says glRenderMode is deprecated
 	//	ATI OpenGL API implementation of GL_SELECT corrupts NifSkope memory
 	//
-	// Create FBO for sharp edges and no shading.
+	// Render into an FBO for sharp edges and no shading.
 	// Texturing, blending, dithering, lighting and smooth shading should be disabled.
 	// The FBO can be used for the drawing operations to keep the drawing operations invisible to the user.
 
-	GLint viewport[4];
-	glGetIntegerv( GL_VIEWPORT, viewport );
-
-	// Create new FBO with multisampling disabled
-	QOpenGLFramebufferObjectFormat fboFmt;
-	fboFmt.setTextureTarget( GL_TEXTURE_2D );
-	fboFmt.setInternalTextureFormat( GL_RGB32F_ARB );
-	fboFmt.setAttachment( QOpenGLFramebufferObject::Attachment::CombinedDepthStencil );
-
-	QOpenGLFramebufferObject fbo( viewport[2], viewport[3], fboFmt );
-	fbo.bind();
-
 	glEnable( GL_LIGHTING );
 	glDisable( GL_MULTISAMPLE );
 	glDisable( GL_MULTISAMPLE_ARB );
@@ -817,21 +869,24 @@ int indexAt( /*GLuint *buffer,*/ NifModel * model, Scene * scene, QList<DrawFunc
 		(scene->*df)();
 	}
 	Node::SELECTING = 0;
+}
 
-	fbo.release();
-
-	QImage img( fbo.toImage() );
-	QColor pixel = img.pixel( pos );
+//! Read the color key under pos from the bound frame buffer
+int colorKeyAt( NifModel * model, const QSize & size, const QPoint & pos, int & furn )
+{
+	if ( !QRect( QPoint(), size ).contains( pos ) )
+		return -1;
 
-#ifndef QT_NO_DEBUG
-	img.save( "fbo.png" );
-#endif
+	// Only the pixel under the cursor is read back, with the rows counted from the bottom
+	GLubyte pixel[4] = { 0, 0, 0, 0 };
+	glPixelStorei( GL_PACK_ALIGNMENT, 1 );
+	glReadPixels( pos.x(), size.height() - 1 - pos.y(), 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixel );
 
 	// Encode RGB to Int
 	int a = 0;
-	a |= pixel.red()   << 0;
-	a |= pixel.green() << 8;
-	a |= pixel.blue()  << 16;
+	a |= pixel[0] << 0;
+	a |= pixel[1] << 8;
+	a |= pixel[2] << 16;
 
 	// Decode:
 	// R = (id & 0x000000FF) >> 0
@@ -850,59 +905,107 @@ int indexAt( /*GLuint *buffer,*/ NifModel * model, Scene * scene, QList<DrawFunc
 		}
 	}
 
-	//qDebug() << "Key:" << a << " R" << pixel.red() << " G" << pixel.green() << " B" << pixel.blue();
+	//qDebug() << "Key:" << a << " R" << pixel[0] << " G" << pixel[1] << " B" << pixel[2];
 	return choose;
 }
 
+void GLView::pickRay( const QPoint & pos, Vector3 & origin, Vector3 & direction ) const
+{
+	// The point on the near plane, from -1 to 1 across the view, as projected by glProjection()
+	float x = 2.0f * ( pos.x() + 0.5f ) / width() - 1.0f;
+	float y = 1.0f - 2.0f * ( pos.y() + 0.5f ) / height();
+
+	if ( perspectiveMode || (view == ViewWalk) ) {
+		GLdouble h = tan( ( cfg.fov / Zoom ) / 360 * M_PI );
+
+		origin = Vector3();
+		direction = Vector3( x * h * aspect, y * h, -1 );
+	} else {
+		GLdouble h2 = Dist / Zoom;
+
+		origin = Vector3( x * h2 * aspect, y * h2, 0 );
+		direction = Vector3( 0, 0, -1 );
+	}
+}
+
 QModelIndex GLView::indexAt( const QPoint & pos, int cycle )
 {
 	if ( !(model && isVisible() && height()) )
 		return QModelIndex();
 
+	Q_UNUSED( cycle );
+
+	// Vertices are picked on the CPU, without rendering and for any number of vertices per shape
+	if ( scene->selMode & Scene::SelVertex ) {
+		Vector3 origin, direction;
+		pickRay( pos, origin, direction );
+
+		Scene::Pick p = scene->pick( origin, direction );
+
+		return p.shape ? p.shape->vertexAt( p.vertex ) : QModelIndex();
+	}
+
 	makeCurrent();
 
-	glPushAttrib( GL_ALL_ATTRIB_BITS );
-	glMatrixMode( GL_PROJECTION );
-	glPushMatrix();
-	glMatrixMode( GL_MODELVIEW );
-	glPushMatrix();
+	// The key buffer is kept between picks, and only rasterized again once a frame was painted since
+	QSize size( width(), height() );
+	if ( !pickBuffer || pickBuffer->size() != size ) {
+		delete pickBuffer;
 
-	glViewport( 0, 0, width(), height() );
-	glProjection( pos.x(), pos.y() );
+		// Multisampling disabled, and 8 bits per channel to hold the keys exactly
+		QOpenGLFramebufferObjectFormat fboFmt;
+		fboFmt.setTextureTarget( GL_TEXTURE_2D );
+		fboFmt.setInternalTextureFormat( GL_RGBA8 );
+		fboFmt.setAttachment( QOpenGLFramebufferObject::Attachment::CombinedDepthStencil );
 
-	QList<DrawFunc> df;
+		pickBuffer = new QOpenGLFramebufferObject( size, fboFmt );
+		pickValid = false;
+	}
 
-	if ( scene->options & Scene::ShowCollision )
-		df << &Scene::drawHavok;
+	pickBuffer->bind();
 
-	if ( scene->options & Scene::ShowNodes )
-		df << &Scene::drawNodes;
+	if ( !pickValid ) {
+		glPushAttrib( GL_ALL_ATTRIB_BITS );
+		glMatrixMode( GL_PROJECTION );
+		glPushMatrix();
+		glMatrixMode( GL_MODELVIEW );
+		glPushMatrix();
+
+		glViewport( 0, 0, width(), height() );
+		glProjection( pos.x(), pos.y() );
+
+		QList<DrawFunc> df;
+
+		if ( scene->options & Scene::ShowCollision )
+			df << &Scene::drawHavok;
+
+		if ( scene->options & Scene::ShowNodes )
+			df << &Scene::drawNodes;
 
-	if ( scene->options & Scene::ShowMarkers )
-		df << &Scene::drawFurn;
+		if ( scene->options & Scene::ShowMarkers )
+			df << &Scene::drawFurn;
 
-	df << &Scene::drawShapes;
+		df << &Scene::drawShapes;
+
+		drawColorKeys( scene, df );
+
+		glPopAttrib();
+		glMatrixMode( GL_MODELVIEW );
+		glPopMatrix();
+		glMatrixMode( GL_PROJECTION );
+		glPopMatrix();
+
+		pickValid = true;
+	}
 
 	int choose = -1, furn = -1;
-	choose = ::indexAt( model, scene, df, cycle, pos, /*out*/ furn );
+	choose = colorKeyAt( model, size, pos, /*out*/ furn );
 
-	glPopAttrib();
-	glMatrixMode( GL_MODELVIEW );
-	glPopMatrix();
-	glMatrixMode( GL_PROJECTION );
-	glPopMatrix();
+	pickBuffer->release();
 
 	QModelIndex chooseIndex;
 
-	if ( scene->selMode & Scene::SelVertex ) {
-		// Vertex
-		int block = choose >> 16;
-		int vert = choose - (block << 16);
-
-		auto shape = scene->shapes.value( block );
-		if ( shape )
-			chooseIndex = shape->vertexAt( vert );
-	} else if ( choose != -1 ) {
+	if ( choose != -1 ) {
 		// Block Index
 		chooseIndex = model->getBlock( choose );
 
@@ -915,6 +1018,86 @@ QModelIndex GLView::indexAt( const QPoint & pos, int cycle )
 	return chooseIndex;
 }
 
+QImage GLView::renderImage( int w, int h, int samples )
+{
+	QImage image( w, h, QImage::Format_RGB32 );
+	if ( w <= 0 || h <= 0 )
+		return image;
+
+	makeCurrent();
+
+	// Tiles as large as the viewport and the render buffers allow
+	GLint dims[2], renderbuffer;
+	glGetIntegerv( GL_MAX_VIEWPORT_DIMS, dims );
+	glGetIntegerv( GL_MAX_RENDERBUFFER_SIZE, &renderbuffer );
+	int tile = qMin( qMin( dims[0], dims[1] ), qMin( int( renderbuffer ), 4096 ) );
+	int tw = qMin( w, tile );
+	int th = qMin( h, tile );
+
+	QOpenGLFramebufferObjectFormat fboFmt;
+	fboFmt.setTextureTarget( GL_TEXTURE_2D );
+	fboFmt.setInternalTextureFormat( GL_RGB );
+	fboFmt.setMipmap( false );
+	fboFmt.setAttachment( QOpenGLFramebufferObject::Attachment::Depth );
+	fboFmt.setSamples( samples );
+
+	QOpenGLFramebufferObject fbo( tw, th, fboFmt );
+
+	GLdouble viewAspect = aspect;
+	aspect = GLdouble( w ) / GLdouble( h );
+	offscreen = true;
+
+	QPainter painter( &image );
+
+	for ( int y = 0; y < h; y += th ) {
+		for ( int x = 0; x < w; x += tw ) {
+			int cw = qMin( tw, w - x );
+			int ch = qMin( th, h - y );
+
+			// The image rows count from the top, the projection from the bottom
+			viewTile = QRectF( double( x ) / w, double( h - y - ch ) / h, double( cw ) / w, double( ch ) / h );
+
+			fbo.bind();
+			glViewport( 0, 0, cw, ch );
+			updateGL();
+			fbo.release();
+
+			// The tile is drawn in the bottom left of the frame buffer
+			painter.drawImage( x, y, fbo.toImage().copy( 0, th - ch, cw, ch ) );
+		}
+	}
+
+	painter.end();
+
+	offscreen = false;
+	viewTile = QRectF( 0, 0, 1, 1 );
+	aspect = viewAspect;
+	glViewport( 0, 0, width(), height() );
+
+	update();
+
+	return image;
+}
+
+QString GLView::frameStats() const
+{
+	if ( !( scene->options & Scene::ShowStats ) )
+		return QString();
+
+	const Scene::FrameStats & st = scene->stats;
+
+	QString text;
+	text += tr( "Transform: %1 ms (shapes %2 ms)\n" ).arg( st.transform, 0, 'f', 2 ).arg( st.transformShapes, 0, 'f', 2 );
+	text += tr( "Draw: %1 ms opaque, %2 ms second pass\n" ).arg( st.firstPass, 0, 'f', 2 ).arg( st.secondPass, 0, 'f', 2 );
+	text += tr( "Nodes: %1 ms, Havok: %2 ms, Selection: %3 ms\n" )
+		.arg( st.nodes, 0, 'f', 2 ).arg( st.havok, 0, 'f', 2 ).arg( st.selection, 0, 'f', 2 );
+	text += ( st.gpu < 0 ) ? tr( "GPU: n/a\n" ) : tr( "GPU: %1 ms\n" ).arg( st.gpu, 0, 'f', 2 );
+	text += tr( "Draw calls: %1, Triangles: %2\n" ).arg( st.drawCalls ).arg( st.triangles );
+	text += tr( "Programs bound: %1, Textures bound: %2" ).arg( st.programBinds ).arg( st.textureBinds );
+
+	return text;
+}
+
 void GLView::center()
 {
 	doCenter = true;
@@ -1274,8 +1457,11 @@ void GLView::advanceGears()
 
 	lastTime = t;
 
-	if ( !isVisible() )
+	if ( !isVisible() ) {
+		// Started again by the next paint
+		timer->stop();
 		return;
+	}
 
 	if ( ( animState & AnimEnabled ) && ( animState & AnimPlay )
 		&& scene->timeMin() != scene->timeMax() )
@@ -1342,8 +1528,234 @@ void GLView::advanceGears()
 		rotate( mouseRot[0], mouseRot[1], mouseRot[2] );
 		mouseRot = Vector3();
 	}
+
+	updateTimer();
+}
+
+void GLView::updateTimer()
+{
+	bool playing = ( animState & AnimEnabled ) && ( animState & AnimPlay ) && scene->timeMin() != scene->timeMax();
+
+	bool moving = !( mouseMov == Vector3() ) || !( mouseRot == Vector3() );
+	for ( bool pressed : kbd ) {
+		moving |= pressed;
+	}
+
+	if ( playing || moving ) {
+		if ( !timer->isActive() ) {
+			// Advance from now, not from when the timer stopped
+			lastTime = QTime::currentTime();
+			timer->start();
+		}
+	} else {
+		timer->stop();
+	}
+}
+
+
+void GLView::saveAnimation()
+{
+	if ( !scene || !model )
+		return;
+
+	bool ok = false;
+	double rate = QInputDialog::getDouble( qApp->activeWindow(), tr( "Bake Animation" ), tr( "Frames per second" ),
+										   30.0, 1.0, 1000.0, 2, &ok );
+	if ( !ok )
+		return;
+
+	QString name = model->getFilename();
+	if ( !scene->animGroup.isEmpty() )
+		name += "_" + scene->animGroup;
+
+	QString folder = model->getFolder();
+	QString filename = QFileDialog::getSaveFileName( qApp->activeWindow(), tr( "Bake Animation" ),
+													 folder + ( !folder.isEmpty() ? "/" : "" ) + name + ".tsv",
+													 tr( "Tab Separated Values (*.tsv)" ) );
+	if ( filename.isEmpty() )
+		return;
+
+	makeCurrent();
+	Scene::AnimationBake bake = scene->bake( rate );
+	update();
+
+	if ( !bake.save( filename ) )
+		Message::critical( this, tr( "Could not save %1" ).arg( filename ) );
+}
+
+float GLView::RenderBenchmark::percentile( float p ) const
+{
+	if ( frames.isEmpty() )
+		return 0;
+
+	QVector<float> times;
+	times.reserve( frames.count() );
+	for ( const Frame & f : frames )
+		times << f.time;
+
+	std::sort( times.begin(), times.end() );
+
+	int i = qBound( 0, int( std::ceil( p / 100.0f * times.count() ) ) - 1, times.count() - 1 );
+	return times.at( i );
+}
+
+QString GLView::RenderBenchmark::summary() const
+{
+	if ( frames.isEmpty() )
+		return QString();
+
+	double total = 0, drawCalls = 0, triangles = 0, programBinds = 0, textureBinds = 0;
+	for ( const Frame & f : frames ) {
+		total += f.time;
+		drawCalls += f.drawCalls;
+		triangles += f.triangles;
+		programBinds += f.programBinds;
+		textureBinds += f.textureBinds;
+	}
+
+	int count = frames.count();
+
+	QString text;
+	text += tr( "%1 frames in %2 s, %3 frames per second\n" )
+		.arg( count ).arg( total / 1000.0, 0, 'f', 2 ).arg( total > 0 ? count * 1000.0 / total : 0.0, 0, 'f', 1 );
+	text += tr( "Frame time: median %1 ms, 90% %2 ms, 99% %3 ms, max %4 ms\n" )
+		.arg( percentile( 50 ), 0, 'f', 2 ).arg( percentile( 90 ), 0, 'f', 2 )
+		.arg( percentile( 99 ), 0, 'f', 2 ).arg( percentile( 100 ), 0, 'f', 2 );
+	text += tr( "Per frame: %1 draw calls, %2 triangles, %3 programs bound, %4 textures bound" )
+		.arg( drawCalls / count, 0, 'f', 1 ).arg( triangles / count, 0, 'f', 0 )
+		.arg( programBinds / count, 0, 'f', 1 ).arg( textureBinds / count, 0, 'f', 1 );
+
+	return text;
+}
+
+bool GLView::RenderBenchmark::save( const QString & filename ) const
+{
+	QFile file( filename );
+
+	if ( !file.open( QIODevice::WriteOnly | QIODevice::Text ) )
+		return false;
+
+	QTextStream out( &file );
+	out << "frame\ttime\tgpu\tdraw calls\ttriangles\tprogram binds\ttexture binds\n";
+
+	for ( int i = 0; i < frames.count(); i++ ) {
+		const Frame & f = frames.at( i );
+		out << i << "\t" << QString::number( f.time, 'f', 3 ) << "\t" << QString::number( f.gpu, 'f', 3 )
+		    << "\t" << f.drawCalls << "\t" << f.triangles << "\t" << f.programBinds << "\t" << f.textureBinds << "\n";
+	}
+
+	return out.status() == QTextStream::Ok;
+}
+
+GLView::RenderBenchmark GLView::benchmark( int frames, RenderBenchmark::Path path )
+{
+	RenderBenchmark result;
+
+	if ( !scene || !model || frames <= 0 )
+		return result;
+
+	// Compile the scene and start from the default view of all of it
+	ViewState oldView = view;
+	Vector3 oldPos = Pos, oldRot = Rot;
+	float oldDist = Dist, oldTime = time;
+	GLdouble oldZoom = Zoom;
+	QPersistentModelIndex oldBlock = scene->currentBlock;
+
+	makeCurrent();
+	updateGL();
+
+	view = ViewWalk;
+	setOrientation( ViewDefault, false );
+	scene->currentBlock = QModelIndex();
+	setCenter();
+
+	Vector3 startRot = Rot;
+	float startDist = Dist;
+
+	bool animate = ( animState & AnimEnabled ) && scene->timeMin() != scene->timeMax();
+	float duration = scene->timeMax() - scene->timeMin();
+
+	result.frames.reserve( frames );
+	QElapsedTimer timer;
+
+	for ( int f = 0; f < frames; f++ ) {
+		float a = float( f ) / frames;
+
+		if ( path == RenderBenchmark::PathOrbit ) {
+			Rot = startRot + Vector3( 0, 0, 360.0f * a );
+		} else {
+			// Down to a tenth of the distance at the middle of the path
+			Dist = startDist * ( 1.0f - 0.9f * std::sin( PI * a ) );
+			Rot = startRot + Vector3( 0, 0, 90.0f * a );
+		}
+
+		if ( animate )
+			time = scene->timeMin() + std::fmod( f / 60.0f, duration );
+
+		timer.start();
+		updateGL();
+		glFinish();
+
+		RenderBenchmark::Frame frame;
+		frame.time = timer.nsecsElapsed() / 1e6f;
+		frame.gpu = scene->stats.gpu;
+		frame.drawCalls = scene->stats.drawCalls;
+		frame.triangles = scene->stats.triangles;
+		frame.programBinds = scene->stats.programBinds;
+		frame.textureBinds = scene->stats.textureBinds;
+		result.frames << frame;
+	}
+
+	view = oldView;
+	Pos = oldPos;
+	Rot = oldRot;
+	Dist = oldDist;
+	Zoom = oldZoom;
+	time = oldTime;
+	scene->currentBlock = oldBlock;
+	update();
+
+	return result;
 }
 
+void GLView::benchmarkRender()
+{
+	if ( !scene || !model )
+		return;
+
+	bool ok = false;
+	int frames = QInputDialog::getInt( qApp->activeWindow(), tr( "Benchmark Rendering" ), tr( "Frames" ),
+									   600, 1, 100000, 100, &ok );
+	if ( !ok )
+		return;
+
+	QStringList paths{ tr( "Orbit" ), tr( "Fly Through" ) };
+	QString path = QInputDialog::getItem( qApp->activeWindow(), tr( "Benchmark Rendering" ), tr( "Camera path" ),
+										  paths, 0, false, &ok );
+	if ( !ok )
+		return;
+
+	QString name = model->getFilename();
+	if ( !name.isEmpty() )
+		name += "_";
+
+	QString folder = model->getFolder();
+	QString filename = QFileDialog::getSaveFileName( qApp->activeWindow(), tr( "Benchmark Rendering" ),
+													 folder + ( !folder.isEmpty() ? "/" : "" ) + name + "benchmark.tsv",
+													 tr( "Tab Separated Values (*.tsv)" ) );
+	if ( filename.isEmpty() )
+		return;
+
+	RenderBenchmark result = benchmark( frames, paths.indexOf( path ) == 1 ? RenderBenchmark::PathFlyThrough
+	                                                                      : RenderBenchmark::PathOrbit );
+
+	if ( !result.save( filename ) ) {
+		Message::critical( this, tr( "Could not save %1" ).arg( filename ) );
+		return;
+	}
+
+	Message::info( this, tr( "Benchmark Rendering" ), result.summary() );
+}
 
 // TODO: Separate widget
 void GLView::saveImage()
@@ -1418,21 +1830,13 @@ void GLView::saveImage()
 		return btn;
 	};
 
-	// Get max viewport size for platform
-	GLint dims;
-	glGetIntegerv( GL_MAX_VIEWPORT_DIMS, &dims );
-	int maxSize = dims;
-
 	// Default size
 	auto btnOneX = btnSize( "1x" );
 	btnOneX->setChecked( true );
-	// Disable any of these that would exceed the max viewport size of the platform
+	// Sizes beyond the GL limits are rendered in tiles
 	auto btnTwoX = btnSize( "2x" );
-	btnTwoX->setDisabled( (width() * 2) > maxSize || (height() * 2) > maxSize );
 	auto btnFourX = btnSize( "4x" );
-	btnFourX->setDisabled( (width() * 4) > maxSize || (height() * 4) > maxSize );
 	auto btnEightX = btnSize( "8x" );
-	btnEightX->setDisabled( (width() * 8) > maxSize || (height() * 8) > maxSize );
 
 
 	auto grpBox = new QGroupBox( tr( "Image Size" ), dlg );
@@ -1494,39 +1898,7 @@ void GLView::saveImage()
 			// Supersampling
 			int ss = grpSize->checkedId();
 
-			int w, h;
-
-			w = width();
-			h = height();
-
-			// Resize viewport for supersampling
-			if ( ss > 1 ) {
-				w *= ss;
-				h *= ss;
-
-				resizeGL( w, h );
-			}
-			
-			QOpenGLFramebufferObjectFormat fboFmt;
-			fboFmt.setTextureTarget( GL_TEXTURE_2D );
-			fboFmt.setInternalTextureFormat( GL_RGB );
-			fboFmt.setMipmap( false );
-			fboFmt.setAttachment( QOpenGLFramebufferObject::Attachment::Depth );
-			fboFmt.setSamples( 16 / ss );
-
-			QOpenGLFramebufferObject fbo( w, h, fboFmt );
-			fbo.bind();
-
-			update();
-			updateGL();
-
-			fbo.release();
-
-			QImage * img = new QImage(fbo.toImage());
-
-			// Return viewport to original size
-			if ( ss > 1 )
-				resizeGL( width(), height() );
+			QImage img = renderImage( width() * ss, height() * ss, 16 / ss );
 
 
 			QImageWriter writer( file->file() );
@@ -1544,14 +1916,11 @@ void GLView::saveImage()
 				writer.setQuality( 75 + pixQuality->value() / 4 );
 			}
 
-			if ( writer.write( *img ) ) {
+			if ( writer.write( img ) ) {
 				dlg->accept();
 			} else {
 				Message::critical( this, tr( "Could not save %1" ).arg( file->file() ) );
 			}
-
-			delete img;
-			img = nullptr;
 		}
 	);
 	connect( btnCancel, &QPushButton::clicked, dlg, &QDialog::reject );
@@ -1660,6 +2029,7 @@ void GLView::keyPressEvent( QKeyEvent * event )
 	case Qt::Key_Q:
 	case Qt::Key_E:
 		kbd[event->key()] = true;
+		updateTimer();
 		break;
 	case Qt::Key_Escape:
 		doCompile = true;
@@ -1722,9 +2092,23 @@ void GLView::mouseMoveEvent( QMouseEvent * event )
 		mouseMov += Vector3( dx * d, -dy * d, 0 );
 	} else if ( event->buttons() & Qt::RightButton ) {
 		setDistance( Dist - (dx + dy) * (axis / (qMax( width(), height() ) + 1)) );
+	} else if ( model && height() && (scene->selMode & Scene::SelVertex) ) {
+		// Highlight the vertex a click would select, which is cheap enough to find on every move
+		Vector3 origin, direction;
+		pickRay( event->pos(), origin, direction );
+
+		Scene::Pick p = scene->pick( origin, direction );
+		int shape = p.shape ? p.shape->shapeNumber : -1;
+
+		if ( shape != scene->hover.shape || p.vertex != scene->hover.vertex ) {
+			scene->hover.shape = shape;
+			scene->hover.vertex = p.vertex;
+			update();
+		}
 	}
 
 	lastPos = event->pos();
+	updateTimer();
 }
 
 void GLView::mousePressEvent( QMouseEvent * event )
@@ -1801,6 +2185,8 @@ void GLView::wheelEvent( QWheelEvent * event )
 		mouseMov += Vector3( 0, 0, event->delta() );
 	else
 		setDistance( Dist * (event->delta() < 0 ? 1.0 / 0.8 : 0.8) );
+
+	updateTimer();
 }
 
 
@@ -1837,6 +2223,21 @@ bool GLGraphicsView::eventFilter( QObject * o, QEvent * e )
 void GLGraphicsView::drawForeground( QPainter * painter, const QRectF & rect )
 {
 	QGraphicsView::drawForeground( painter, rect );
+
+	GLView * glWidget = qobject_cast<GLView *>(viewport());
+	if ( !glWidget )
+		return;
+
+	QString stats = glWidget->frameStats();
+	if ( stats.isEmpty() )
+		return;
+
+	// Drawn in viewport coordinates over the top left of the view
+	painter->save();
+	painter->setWorldMatrixEnabled( false );
+	painter->setPen( Qt::white );
+	painter->drawText( viewport()->rect().adjusted( 8, 8, -8, -8 ), Qt::AlignLeft | Qt::AlignTop, stats );
+	painter->restore();
 }
 
 void GLGraphicsView::drawBackground( QPainter * painter, const QRectF & rect )
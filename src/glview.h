@@ -59,6 +59,7 @@ class QGLFormat;
 class QMenu;
 class QOpenGLContext;
 class QOpenGLFunctions;
+class QOpenGLTimerQuery;
 class QSettings;
 class QToolBar;
 class QTimer;
@@ -158,6 +159,58 @@ public:
 
 
 	QModelIndex indexAt( const QPoint & p, int cycle = 0 );
+	//! The ray through a point of the widget in view space, from the eye or, orthographic, the plane at 0
+	void pickRay( const QPoint & pos, Vector3 & origin, Vector3 & direction ) const;
+
+	//! The statistics of the last frame as text, empty unless Scene::ShowStats is set
+	QString frameStats() const;
+
+	/*! Render the view into an image of any size
+	 *
+	 * The image is rendered off screen in tiles no larger than the GL limits,
+	 * each tile multisampled with \a samples samples.
+	 */
+	QImage renderImage( int w, int h, int samples = 0 );
+
+	//! The frames drawn by benchmark()
+	struct RenderBenchmark
+	{
+		//! The camera paths benchmark() can follow
+		enum Path
+		{
+			//! One turn around the scene, looking at its center
+			PathOrbit,
+			//! Into the bounds of the scene and back out, turning a quarter
+			PathFlyThrough
+		};
+
+		struct Frame
+		{
+			//! Milliseconds from the start of the frame until the GPU finished it
+			float time = 0;
+			//! GPU milliseconds of an earlier frame, -1 unless Scene::ShowStats is set
+			float gpu = -1;
+			int drawCalls = 0, triangles = 0, programBinds = 0, textureBinds = 0;
+		};
+
+		QVector<Frame> frames;
+
+		//! The frame time which \a p percent of the frames do not exceed
+		float percentile( float p ) const;
+		//! The percentiles of the frame times and the average counts, as text
+		QString summary() const;
+		//! Save as tab separated text with one line per frame
+		bool save( const QString & filename ) const;
+	};
+
+	/*! Draw \a frames frames as fast as possible along a camera path
+	 *
+	 * The path and the scene time depend only on the frame number, so that runs
+	 * on different builds and drivers draw the same frames. The current sequence
+	 * is played at 60 frames per second if animations are enabled. The view is
+	 * restored afterwards.
+	 */
+	RenderBenchmark benchmark( int frames, RenderBenchmark::Path path );
 
 	// UI
 
@@ -222,6 +275,10 @@ protected:
 
 protected slots:
 	void saveImage();
+	//! Sample the current sequence with Scene::bake() and save it
+	void saveAnimation();
+	//! Ask for a number of frames and a camera path, run benchmark() and save the frames
+	void benchmarkRender();
 
 private:
 	NifModel * model;
@@ -233,6 +290,22 @@ private:
 
 	class TexCache * textures;
 
+	//! Color keys of the scene rasterized by indexAt(), reused until the next frame is painted
+	class QOpenGLFramebufferObject * pickBuffer = nullptr;
+	//! Whether pickBuffer holds the keys of the last painted frame
+	bool pickValid = false;
+
+	//! Part of the view projected by glProjection(), as fractions from the bottom left; all of it unless in renderImage()
+	QRectF viewTile = QRectF( 0, 0, 1, 1 );
+	//! Whether paintGL() draws into an off screen buffer for renderImage(), without swapping or overlays
+	bool offscreen = false;
+
+	//! GPU timers of alternate frames, read a frame later so that paintGL() does not wait on them
+	QOpenGLTimerQuery * frameQueries[2] = { nullptr, nullptr };
+	//! Whether each of frameQueries was started, and the one used by the next frame
+	bool frameQueried[2] = { false, false };
+	int frameQuery = 0;
+
 	float time;
 	QTime lastTime;
 	QTimer * timer;
@@ -275,6 +348,8 @@ private:
 
 private slots:
 	void advanceGears();
+	//! Run the timer of advanceGears() while an animation plays or the view moves, stop it when idle
+	void updateTimer();
 
 	void dataChanged( const QModelIndex &, const QModelIndex & );
 	void modelChanged();
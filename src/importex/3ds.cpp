@@ -16,11 +16,16 @@
 #include <QFile>
 #include <QFileDialog>
 #include <QMessageBox>
+#include <QScopedPointer>
 #include <QSettings>
 #include <QString>
 
 #define tr( x ) QApplication::tr( "3dsImport", x )
 
+// Chunk::readArray() copies the points, texture coordinates and faces as they are laid out in the file
+static_assert( sizeof( Vector2 ) == 8 && sizeof( Vector3 ) == 12 && sizeof( Chunk::ChunkTypeFaceArray ) == 8,
+	"3ds arrays are read into these types directly" );
+
 
 struct objPoint
 {
@@ -53,7 +58,7 @@ struct objMaterial
 struct objMatFace
 {
 	QString matName;
-	QVector<short> subFaces;
+	QVector<unsigned short> subFaces;
 };
 
 // The 3ds file can be made up of several objects
@@ -164,9 +169,10 @@ static float GetPercentageFromChunk( Chunk * cnk )
 }
 
 
-void import3ds( NifModel * nif, const QModelIndex & index )
+//! Import a 3ds file over the selected node or shape without asking, returning false if it failed
+bool import3ds( NifModel * nif, const QModelIndex & index, const QString & fname )
 {
-	//--Determine how the file will import, and be sure the user wants to continue--//
+	//--Determine where the meshes are imported to--//
 
 	// If no existing node is selected, create a group node.  Otherwise use selected node
 	QPersistentModelIndex iRoot, iNode, iShape, iMaterial, iData, iTexProp, iTexSource;
@@ -174,8 +180,8 @@ void import3ds( NifModel * nif, const QModelIndex & index )
 
 	//Be sure the user hasn't clicked on a NiTriStrips object
 	if ( iBlock.isValid() && nif->itemName( iBlock ) == "NiTriStrips" ) {
-		int result = QMessageBox::information( 0, tr( "Import OBJ" ), tr( "You cannot import an OBJ file over a NiTriStrips object.  Please convert it to a NiTriShape object first by right-clicking and choosing Mesh > Triangulate" ) );
-		return;
+		qCCritical( nsIo ) << tr( "You cannot import a 3ds file over a NiTriStrips object." );
+		return false;
 	}
 
 	if ( iBlock.isValid() && nif->itemName( index ) == "NiNode" ) {
@@ -220,25 +226,6 @@ void import3ds( NifModel * nif, const QModelIndex & index )
 		}
 	}
 
-	QString question;
-
-	if ( iNode.isValid() == true ) {
-		if ( iShape.isValid() == true ) {
-			question = tr( "NiTriShape selected.  The first imported mesh will replace the selected one." );
-		} else {
-			question = tr( "NiNode selected.  Meshes will be attached to the selected node." );
-		}
-	} else {
-		question = tr( "No NiNode or NiTriShape selected.  Meshes will be imported to the root of the file." );
-	}
-
-	int result = QMessageBox::question( 0, tr( "Import 3DS" ), question, QMessageBox::Ok, QMessageBox::Cancel );
-
-	if ( result == QMessageBox::Cancel ) {
-		return;
-	}
-
-
 	//--Read the file--//
 
 	float ObjScale;
@@ -246,42 +233,34 @@ void import3ds( NifModel * nif, const QModelIndex & index )
 	QMap<QString, objMaterial> ObjMaterials;
 	QMap<QString, objKfSequence> ObjKeyframes;
 
-	QSettings settings;
-	settings.beginGroup( "Import-Export" );
-	settings.beginGroup( "3DS" );
-
-	QString fname = QFileDialog::getOpenFileName( qApp->activeWindow(), tr( "Choose a .3ds file to import" ), settings.value( tr( "File Name" ) ).toString(), "3DS (*.3ds)" );
-
-	if ( fname.isEmpty() ) {
-		return;
-	}
-
 	QFile fobj( fname );
 
 	if ( !fobj.open( QIODevice::ReadOnly ) ) {
 		qCCritical( nsIo ) << tr( "Failed to read %1" ).arg( fobj.fileName() );
-		return;
+		return false;
 	}
 
-	Chunk * FileChunk = Chunk::LoadFile( &fobj );
+	QScopedPointer<Chunk> FileChunk( Chunk::LoadFile( &fobj ) );
+
+	fobj.close();
 
 	if ( !FileChunk ) {
 		qCCritical( nsIo ) << tr( "Could not get 3ds data" );
-		return;
+		return false;
 	}
 
 	Chunk * Model = FileChunk->getChild( M3DMAGIC );
 
 	if ( !Model ) {
 		qCCritical( nsIo ) << tr( "Could not get 3ds model" );
-		return;
+		return false;
 	}
 
 	Chunk * ModelData = Model->getChild( MDATA );
 
 	if ( !ModelData ) {
 		qCCritical( nsIo ) << tr( "Could not get 3ds model data" );
-		return;
+		return false;
 	}
 
 	Chunk * MasterScale = ModelData->getChild( MASTER_SCALE );
@@ -356,15 +335,10 @@ void import3ds( NifModel * nif, const QModelIndex & index )
 			if ( PointArray ) {
 				unsigned short nPoints = PointArray->read<unsigned short>();
 
-				for ( unsigned short i = 0; i < nPoints; i++ ) {
-					float x, y, z;
-					x = PointArray->read<float>();
-					y = PointArray->read<float>();
-					z = PointArray->read<float>();
+				QVector<Vector3> points = PointArray->readArray<Vector3>( nPoints );
 
-					newMesh.vertices.append( { x, y, z } );
-					newMesh.normals.append( { 0.0f, 0.0f, 1.0f } );
-				}
+				newMesh.vertices += points;
+				newMesh.normals += QVector<Vector3>( points.count(), Vector3( 0.0f, 0.0f, 1.0f ) );
 			}
 
 			Chunk * FaceArray = TriObj->getChild( FACE_ARRAY );
@@ -372,14 +346,12 @@ void import3ds( NifModel * nif, const QModelIndex & index )
 			if ( FaceArray ) {
 				unsigned short nFaces = FaceArray->read<unsigned short>();
 
-				for ( unsigned short i = 0; i < nFaces; i++ ) {
-					Chunk::ChunkTypeFaceArray f;
+				QVector<Chunk::ChunkTypeFaceArray> faces = FaceArray->readArray<Chunk::ChunkTypeFaceArray>( nFaces );
 
-					f.vertex1 = FaceArray->read<unsigned short>();
-					f.vertex2 = FaceArray->read<unsigned short>();
-					f.vertex3 = FaceArray->read<unsigned short>();
-					f.flags = FaceArray->read<unsigned short>();
+				int nVerts = newMesh.vertices.count();
+				newMesh.faces.reserve( newMesh.faces.count() + faces.count() );
 
+				for ( const Chunk::ChunkTypeFaceArray & f : faces ) {
 					objFace newFace;
 
 					newFace.v1 = f.vertex1;
@@ -388,6 +360,12 @@ void import3ds( NifModel * nif, const QModelIndex & index )
 
 					newFace.dblside = !(f.flags & FACE_FLAG_ONESIDE);
 
+					newMesh.faces.append( newFace );
+
+					if ( newFace.v1 >= nVerts || newFace.v2 >= nVerts || newFace.v3 >= nVerts ) {
+						continue;
+					}
+
 					Vector3 n1 = newMesh.vertices[newFace.v2] - newMesh.vertices[newFace.v1];
 					Vector3 n2 = newMesh.vertices[newFace.v3] - newMesh.vertices[newFace.v1];
 					Vector3 FaceNormal = Vector3::crossproduct( n1, n2 );
@@ -395,26 +373,18 @@ void import3ds( NifModel * nif, const QModelIndex & index )
 					newMesh.normals[newFace.v1] += FaceNormal;
 					newMesh.normals[newFace.v2] += FaceNormal;
 					newMesh.normals[newFace.v3] += FaceNormal;
-
-					newMesh.faces.append( newFace );
 				}
 
-				objMatFace newMatFace;
-
 				for ( Chunk * MatFaces : FaceArray->getChildren( MSH_MAT_GROUP ) ) {
-					//Chunk * MatFaces = FaceArray->getChild( MSH_MAT_GROUP );
-					if ( MatFaces ) {
-						newMatFace.matName = MatFaces->readString();
+					objMatFace newMatFace;
 
-						unsigned short nFaces = MatFaces->read<unsigned short>();
+					newMatFace.matName = MatFaces->readString();
 
-						for ( unsigned short i = 0; i < nFaces; i++ ) {
-							unsigned short FaceNum = MatFaces->read<unsigned short>();
-							newMatFace.subFaces.append( FaceNum );
-						}
+					unsigned short nFaces = MatFaces->read<unsigned short>();
 
-						newMesh.matfaces.append( newMatFace );
-					}
+					newMatFace.subFaces = MatFaces->readArray<unsigned short>( nFaces );
+
+					newMesh.matfaces.append( newMatFace );
 				}
 			}
 
@@ -423,13 +393,13 @@ void import3ds( NifModel * nif, const QModelIndex & index )
 			if ( TexVerts ) {
 				unsigned short nVerts = TexVerts->read<unsigned short>();
 
-				for ( unsigned short i = 0; i < nVerts; i++ ) {
-					float x, y;
-					x = TexVerts->read<float>();
-					y = TexVerts->read<float>();
+				QVector<Vector2> uvs = TexVerts->readArray<Vector2>( nVerts );
 
-					newMesh.texcoords.append( Vector2( x, -y ) );
+				for ( Vector2 & uv : uvs ) {
+					uv[1] = -uv[1];
 				}
+
+				newMesh.texcoords += uvs;
 			}
 		}
 
@@ -502,7 +472,7 @@ void import3ds( NifModel * nif, const QModelIndex & index )
 
 				for ( int key = 0; key < keys; key++ ) {
 					unsigned short kfNum = PosTrack->read<unsigned short>();
-					unsigned long kfUnknown = PosTrack->read<unsigned long>();
+					quint32 kfUnknown = PosTrack->read<quint32>();
 					float kfPosX = PosTrack->read<float>();
 					float kfPosY = PosTrack->read<float>();
 					float kfPosZ = PosTrack->read<float>();
@@ -525,7 +495,7 @@ void import3ds( NifModel * nif, const QModelIndex & index )
 
 				for ( unsigned short key = 0; key < keys; key++ ) {
 					unsigned short kfNum = RotTrack->read<unsigned short>();
-					unsigned long kfUnknown = RotTrack->read<unsigned long>();
+					quint32 kfUnknown = RotTrack->read<quint32>();
 					float kfRotAngle = RotTrack->read<float>();
 					float kfAxisX = RotTrack->read<float>();
 					float kfAxisY = RotTrack->read<float>();
@@ -550,7 +520,7 @@ void import3ds( NifModel * nif, const QModelIndex & index )
 
 				for ( unsigned short key = 0; key < keys; key++ ) {
 					unsigned short kfNum = SclTrack->read<unsigned short>();
-					unsigned long kfUnknown = SclTrack->read<unsigned long>();
+					quint32 kfUnknown = SclTrack->read<quint32>();
 					float kfSclX = SclTrack->read<float>();
 					float kfSclY = SclTrack->read<float>();
 					float kfSclZ = SclTrack->read<float>();
@@ -563,8 +533,6 @@ void import3ds( NifModel * nif, const QModelIndex & index )
 		}
 	}
 
-	fobj.close();
-
 	//--Translate file structures into NIF ones--//
 
 	if ( iNode.isValid() == false ) {
@@ -575,6 +543,8 @@ void import3ds( NifModel * nif, const QModelIndex & index )
 	//Record root object
 	iRoot = iNode;
 
+	bool old = nif->holdUpdates( true );
+
 	// create a NiTriShape foreach material in the object
 	for ( int objIndex = 0; objIndex < ObjMeshes.size(); objIndex++ ) {
 		objMesh * mesh = &ObjMeshes[objIndex];
@@ -689,16 +659,16 @@ void import3ds( NifModel * nif, const QModelIndex & index )
 			nif->setLink( iShape, "Data", nif->getBlockNumber( iData ) );
 
 			QVector<Triangle> triangles;
-			QVector<objPoint> points;
+			triangles.reserve( mesh->matfaces[i].subFaces.count() );
 
 			for ( const auto faceIndex : mesh->matfaces[i].subFaces ) {
-				objFace face = mesh->faces[faceIndex];
-
-				Triangle tri;
+				if ( faceIndex >= mesh->faces.count() ) {
+					continue;
+				}
 
-				tri.set( face.v1, face.v2, face.v3 );
+				const objFace & face = mesh->faces[faceIndex];
 
-				triangles.append( tri );
+				triangles.append( Triangle( face.v1, face.v2, face.v3 ) );
 			}
 
 			nif->set<int>( iData, "Num Vertices", mesh->vertices.count() );
@@ -751,13 +721,55 @@ void import3ds( NifModel * nif, const QModelIndex & index )
 		// set up a controller for animated objects
 	}
 
+	if ( !old )
+		nif->holdUpdates( false );
+
+	nif->reset();
+
+	return true;
+}
+
+void import3ds( NifModel * nif, const QModelIndex & index )
+{
+	//--Be sure the user wants to continue--//
+
+	QModelIndex iBlock = nif->getBlock( index );
+
+	//Be sure the user hasn't clicked on a NiTriStrips object
+	if ( iBlock.isValid() && nif->itemName( iBlock ) == "NiTriStrips" ) {
+		QMessageBox::information( 0, tr( "Import 3DS" ), tr( "You cannot import a 3DS file over a NiTriStrips object.  Please convert it to a NiTriShape object first by right-clicking and choosing Mesh > Triangulate" ) );
+		return;
+	}
+
+	QString question;
+
+	if ( iBlock.isValid() && nif->itemName( iBlock ) == "NiNode" ) {
+		question = tr( "NiNode selected.  Meshes will be attached to the selected node." );
+	} else if ( iBlock.isValid() && nif->itemName( iBlock ) == "NiTriShape" && nif->getParent( nif->getBlockNumber( iBlock ) ) != -1 ) {
+		question = tr( "NiTriShape selected.  The first imported mesh will replace the selected one." );
+	} else {
+		question = tr( "No NiNode or NiTriShape selected.  Meshes will be imported to the root of the file." );
+	}
+
+	int result = QMessageBox::question( 0, tr( "Import 3DS" ), question, QMessageBox::Ok, QMessageBox::Cancel );
+
+	if ( result == QMessageBox::Cancel ) {
+		return;
+	}
+
+	QSettings settings;
+	settings.beginGroup( "Import-Export" );
+	settings.beginGroup( "3DS" );
+
+	QString fname = QFileDialog::getOpenFileName( qApp->activeWindow(), tr( "Choose a .3ds file to import" ), settings.value( tr( "File Name" ) ).toString(), "3DS (*.3ds)" );
+
+	if ( fname.isEmpty() || !import3ds( nif, index, fname ) )
+		return;
+
 	settings.setValue( "File Name", fname );
 
 	settings.endGroup(); // 3DS
 	settings.endGroup(); // Import-Export
-
-	nif->reset();
-	return;
 }
 
 #ifdef __GNUC__
@@ -1,11 +1,15 @@
 #ifndef IMPORT_3DS_H
 #define IMPORT_3DS_H
 
+#include <QByteArray>
 #include <QFile>
 #include <QList>
 #include <QMap>
 #include <QMapIterator>
 #include <QString>
+#include <QVector>
+
+#include <cstring>
 
 // Chunk Type definitions
 #define NULL_CHUNK          0x0000
@@ -103,8 +107,7 @@ public:
 	// general chunk properties
 
 	typedef unsigned short ChunkType;
-	typedef unsigned int ChunkPos;
-	typedef unsigned long ChunkLength;
+	typedef quint32 ChunkLength;
 	typedef bool ChunkDataFlag;
 	typedef unsigned int ChunkDataPos;
 	typedef unsigned int ChunkDataLength;
@@ -135,7 +138,7 @@ public:
 		unsigned char x, y, z;
 	};
 
-	typedef long ChunkTypeLong;
+	typedef qint32 ChunkTypeLong;
 
 	typedef short ChunkTypeShort;
 
@@ -146,8 +149,8 @@ public:
 
 	struct ChunkTypeFaceArray
 	{
-		ChunkTypeShort vertex1, vertex2, vertex3;
-		ChunkTypeShort flags;
+		unsigned short vertex1, vertex2, vertex3;
+		unsigned short flags;
 	};
 
 	struct ChunkTypeMeshMatrix
@@ -179,8 +182,9 @@ public:
 
 	// class members
 
-	Chunk( QFile * _f, ChunkHeader _h, ChunkPos _p )
-		: f( _f ), h( _h ), p( _p ), df( false ), dp( 0 ), dl( 0 ), dc( 0 )
+	//! Parse the chunk whose payload starts at \a _d, \a _h.l being clipped to the enclosing chunk
+	Chunk( const char * _d, ChunkHeader _h )
+		: d( _d ), h( _h ), df( false ), dp( 0 ), dl( 0 ), dc( 0 )
 	{
 		if ( h.t == FILE_DUMMY ) {
 			this->addchildren();
@@ -194,15 +198,23 @@ public:
 		qDeleteAll( c );
 	}
 
+	//! Read the whole file once and parse its chunks from memory
 	static Chunk * LoadFile( QFile * file )
 	{
 		file->seek( 0 );
 
+		QByteArray data = file->readAll();
+
+		if ( data.isEmpty() ) {
+			return nullptr;
+		}
+
 		ChunkHeader hdr;
 		hdr.t = FILE_DUMMY;
-		hdr.l = file->size();
+		hdr.l = data.size() + CHUNKHEADERSIZE;
 
-		Chunk * cnk = new Chunk( file, hdr, ( -CHUNKHEADERSIZE ) );
+		Chunk * cnk = new Chunk( data.constData(), hdr );
+		cnk->buffer = data;
 
 		return cnk;
 	}
@@ -223,7 +235,7 @@ public:
 
 	Chunk * getChild( ChunkType ct )
 	{
-		return c[ct];
+		return c.value( ct );
 	}
 
 	void reset()
@@ -236,40 +248,59 @@ public:
 	{
 		T r = T();
 
-		if ( !df || dp > ( h.l - CHUNKHEADERSIZE ) ) {
+		if ( !df || dp + sizeof( r ) > length() ) {
 			return r;
 		}
 
-		f->seek( p + CHUNKHEADERSIZE + dp );
-		dp += f->read( (char *)&r, sizeof( r ) );
+		memcpy( &r, d + dp, sizeof( r ) );
+		dp += sizeof( r );
 
 		return r;
 	}
 
-	QString readString()
+	//! Read \a count consecutive items at once, fewer if the chunk ends before them
+	/*!
+	 * T must have the layout of the items in the file, e.g. Vector3 for a point
+	 * or ChunkTypeFaceArray for a face.
+	 */
+	template <class T>
+	QVector<T> readArray( int count )
 	{
-		QString s;
-		char n;
+		QVector<T> r;
 
-		f->seek( p + CHUNKHEADERSIZE + dp );
+		if ( !df || count <= 0 || dp > length() ) {
+			return r;
+		}
 
-		while ( true ) {
-			dp += f->read( &n, sizeof( char ) );
+		count = qMin<ChunkDataLength>( count, ( length() - dp ) / sizeof( T ) );
 
-			if ( n == 0 ) {
-				break;
-			}
+		r.resize( count );
+		memcpy( r.data(), d + dp, count * sizeof( T ) );
+		dp += count * sizeof( T );
 
-			s.append( n );
+		return r;
+	}
+
+	QString readString()
+	{
+		if ( dp >= length() ) {
+			return QString();
 		}
 
-		return s;
+		const char * s = d + dp;
+		ChunkDataLength n = qstrnlen( s, length() - dp );
+
+		dp += qMin( n + 1, length() - dp );
+
+		return QString::fromLatin1( s, n );
 	}
 
 private:
-	QFile * f;
+	//! The file contents, held by the chunk returned from LoadFile()
+	QByteArray buffer;
+	//! The payload of the chunk
+	const char * d;
 	ChunkHeader h;
-	ChunkPos p;
 	ChunkDataFlag df;
 	ChunkDataPos dp;
 	ChunkDataLength dl;
@@ -277,6 +308,12 @@ private:
 
 	QMap<ChunkType, Chunk *> c;
 
+	//! The length of the payload
+	ChunkDataLength length() const
+	{
+		return h.l - CHUNKHEADERSIZE;
+	}
+
 	void subproc()
 	{
 		switch ( h.t & 0xf000 ) {
@@ -474,22 +511,27 @@ private:
 
 	void addchildren()
 	{
-		f->seek( p + CHUNKHEADERSIZE + dl );
-
 		QMap<ChunkType, Chunk *> temp;
 
-		while ( f->pos() < ( p + h.l ) ) {
-			ChunkPos q = f->pos();
+		ChunkDataPos q = dl;
 
+		while ( q + CHUNKHEADERSIZE <= length() ) {
 			ChunkHeader k;
-			f->read( (char *)( &k.t ), sizeof( k.t ) );
-			f->read( (char *)( &k.l ), sizeof( k.l ) );
+			memcpy( &k.t, d + q, sizeof( k.t ) );
+			memcpy( &k.l, d + q + sizeof( k.t ), sizeof( k.l ) );
 
-			Chunk * z = new Chunk( f, k, q );
+			// A chunk shorter than its header would never advance
+			if ( k.l < CHUNKHEADERSIZE ) {
+				break;
+			}
+
+			k.l = qMin<ChunkLength>( k.l, length() - q );
+
+			Chunk * z = new Chunk( d + q + CHUNKHEADERSIZE, k );
 
 			temp.insertMulti( k.t, z );
 
-			f->seek( q + k.l );
+			q += k.l;
 		}
 
 		QMapIterator<ChunkType, Chunk *> tempIter( temp );
@@ -498,35 +540,26 @@ private:
 			tempIter.next();
 			c.insertMulti( tempIter.key(), tempIter.value() );
 		}
-
-		f->seek( p + h.l );
 	}
 
 	void addname()
 	{
-		f->seek( p + CHUNKHEADERSIZE + dl );
-
-		char n = 0x01;
-		int nl = 0;
-
-		while ( n != 0 ) {
-			if ( !f->getChar( &n ) ) {
-				break;
-			}
-
-			nl++;
+		if ( dl >= length() ) {
+			return;
 		}
 
-		dl += nl;
+		ChunkDataLength nl = qstrnlen( d + dl, length() - dl );
+
+		dl += qMin( nl + 1, length() - dl );
 	}
 
 	void addcount( ChunkDataLength _dl )
 	{
-		f->seek( p + CHUNKHEADERSIZE + dl );
-
-		int n = sizeof( dc );
+		dc = 0;
 
-		f->read( (char *)( &dc ), sizeof( dc ) );
+		if ( dl + sizeof( dc ) <= length() ) {
+			memcpy( &dc, d + dl, sizeof( dc ) );
+		}
 
 		dl += ( sizeof( ChunkDataCount ) + ( dc * _dl ) );
 	}
@@ -537,12 +570,10 @@ private:
 		dl += _dl;
 
 		if ( dl == 0 ) {
-			dl = ( h.l - CHUNKHEADERSIZE );
+			dl = length();
 		}
 
 		df = true;
-
-		f->seek( p + CHUNKHEADERSIZE + dl );
 	}
 };
 
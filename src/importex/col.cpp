@@ -34,6 +34,7 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "nifmodel.h"
 #include "nvtristripwrapper.h"
+#include "spellbook.h"
 #include "gl/gltex.h"
 
 #include <QApplication>
@@ -43,9 +44,13 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QFile>
 #include <QFileDialog>
 #include <QMessageBox>
+#include <QMutex>
 #include <QRegularExpression>
 #include <QSettings>
-#include <QTextStream>
+#include <QThread>
+#include <QXmlStreamWriter>
+
+#include <cmath>
 
 #define tr( x ) QApplication::tr( x )
 
@@ -182,208 +187,6 @@ QDomElement matrixElement( Vector3 trans, Matrix rot, float scale )
 	return element;
 }
 
-/**
- * create color map array with (nif)index
- * @param colors array of polygon colors
- * @param idx nif index
- * @return QDomElement
- */
-QDomElement colorMapElement( QVector<Color4> colors, int idx )
-{
-	QDomElement source = doc.createElement( "source" );
-	source.setAttribute( "id", QString( "nifid_%1-lib_colors" ).arg( idx ) );
-
-	QDomElement float_array = doc.createElement( "float_array" );
-	float_array.setAttribute( "id", QString( "nifid_%1-lib_colors-array" ).arg( idx ) );
-	float_array.setAttribute( "count", (colors.size() * 4) );
-	source.appendChild( float_array );
-
-	QString text( "" );
-	foreach ( Color4 v, colors ) {
-		text.append( QString( "%1 %2 %3 %4 " ).arg( v[0] ).arg( v[1] ).arg( v[2] ).arg( v[3] ) );
-	}
-	float_array.appendChild( doc.createTextNode( text ) );
-
-	QDomElement technique_common = doc.createElement( "technique_common" );
-	source.appendChild( technique_common );
-
-	QDomElement accessor = doc.createElement( "accessor" );
-	accessor.setAttribute( "source", QString( "#nifid_%1-lib_colors-array" ).arg( idx ) );
-	accessor.setAttribute( "count", colors.size() );
-	accessor.setAttribute( "stride", "4" );
-	technique_common.appendChild( accessor );
-	QDomElement param;
-
-	param = doc.createElement( "param" );
-	param.setAttribute( "name", "R" );
-	param.setAttribute( "type", "float" );
-	accessor.appendChild( param );
-
-	param = doc.createElement( "param" );
-	param.setAttribute( "name", "G" );
-	param.setAttribute( "type", "float" );
-	accessor.appendChild( param );
-
-	param = doc.createElement( "param" );
-	param.setAttribute( "name", "B" );
-	param.setAttribute( "type", "float" );
-	accessor.appendChild( param );
-
-	param = doc.createElement( "param" );
-	param.setAttribute( "name", "A" );
-	param.setAttribute( "type", "float" );
-	accessor.appendChild( param );
-	return source;
-}
-
-/**
- * create UV map array with (nif)index and row (multiple UV for one mesh)
- * @param verts array of polygon positions (X;Y;Z)
- * @param idx nif index
- * @param row UV row number
- * @return QDomElement
- */
-QDomElement uvMapElement( QVector<Vector2> uvMap, int idx, int row )
-{
-	QDomElement source = doc.createElement( "source" );
-	source.setAttribute( "id", QString( "nifid_%1-lib-UV%2" ).arg( idx ).arg( row ) );
-
-	QDomElement float_array = doc.createElement( "float_array" );
-	float_array.setAttribute( "id", QString( "nifid_%1-lib-UV%2-array" ).arg( idx ).arg( row ) );
-	float_array.setAttribute( "count", (uvMap.size() * 2) );
-	source.appendChild( float_array );
-
-	QString uvText( "" );
-	// we have to flip the second UV coordinate because nif uses
-	// different convention from collada
-	foreach ( Vector2 v, uvMap ) {
-		uvText.append( QString( "%1 %2 " ).arg( v[0] ).arg( 1.0 - v[1] ) );
-	}
-	float_array.appendChild( doc.createTextNode( uvText ) );
-
-	QDomElement technique_common = doc.createElement( "technique_common" );
-	source.appendChild( technique_common );
-
-	QDomElement accessor = doc.createElement( "accessor" );
-	accessor.setAttribute( "source", QString( "#nifid_%1-lib-UV%2-array" ).arg( idx ).arg( row ) );
-	accessor.setAttribute( "count", uvMap.size() );
-	accessor.setAttribute( "stride", "2" );
-	technique_common.appendChild( accessor );
-	QDomElement param;
-
-	param = doc.createElement( "param" );
-	param.setAttribute( "name", "S" );
-	param.setAttribute( "type", "float" );
-	accessor.appendChild( param );
-
-	param = doc.createElement( "param" );
-	param.setAttribute( "name", "T" );
-	param.setAttribute( "type", "float" );
-	accessor.appendChild( param );
-	return source;
-}
-
-/**
- * create positions array with (nif)index
- * @param verts array of polygon positions (X;Y;Z)
- * @param idx nif index
- * @return QDomElement
- */
-QDomElement positionsElement( QVector<Vector3> verts, int idx )
-{
-	QDomElement source = doc.createElement( "source" );
-	source.setAttribute( "id", QString( "nifid_%1-lib-Position" ).arg( idx ) );
-
-	QDomElement float_array = doc.createElement( "float_array" );
-	float_array.setAttribute( "id", QString( "nifid_%1-lib-Position-array" ).arg( idx ) );
-	float_array.setAttribute( "count", (verts.size() * 3) );
-	source.appendChild( float_array );
-
-	QString posText( "" );
-	foreach ( Vector3 v, verts ) {
-		posText.append( QString( "%1 %2 %3 " ).arg( v[0], 0, 'f', 6 ).arg( v[1], 0, 'f', 6 ).arg( v[2], 0, 'f', 6 ) );
-	}
-	float_array.appendChild( doc.createTextNode( posText ) );
-
-	QDomElement technique_common = doc.createElement( "technique_common" );
-	source.appendChild( technique_common );
-
-	QDomElement accessor = doc.createElement( "accessor" );
-	accessor.setAttribute( "source", QString( "#nifid_%1-lib-Position-array" ).arg( idx ) );
-	accessor.setAttribute( "count", verts.size() );
-	accessor.setAttribute( "stride", "3" );
-	technique_common.appendChild( accessor );
-	QDomElement param;
-
-	param = doc.createElement( "param" );
-	param.setAttribute( "name", "X" );
-	param.setAttribute( "type", "float" );
-	accessor.appendChild( param );
-
-	param = doc.createElement( "param" );
-	param.setAttribute( "name", "Y" );
-	param.setAttribute( "type", "float" );
-	accessor.appendChild( param );
-
-	param = doc.createElement( "param" );
-	param.setAttribute( "name", "Z" );
-	param.setAttribute( "type", "float" );
-	accessor.appendChild( param );
-	return source;
-}
-
-/**
- * create normals array with (nif)index
- * @param normals array of normals
- * @param idx nif index
- * @return QDomElement
- */
-QDomElement normalsElement( QVector<Vector3> normals, int idx )
-{
-	QDomElement source;
-
-	if ( normals.size() > 0 ) {
-		source = doc.createElement( "source" );
-		source.setAttribute( "id", QString( "nifid_%1-lib-Normal0" ).arg( idx ) );
-
-		QDomElement float_array = doc.createElement( "float_array" );
-		float_array.setAttribute( "id", QString( "nifid_%1-lib-Normal0-array" ).arg( idx ) );
-		float_array.setAttribute( "count", (normals.size() * 3) );
-		source.appendChild( float_array );
-
-		QString norText( "" );
-		foreach ( Vector3 v, normals ) {
-			norText.append( QString( "%1 %2 %3 " ).arg( v[0], 0, 'f', 6 ).arg( v[1], 0, 'f', 6 ).arg( v[2], 0, 'f', 6 ) );
-		}
-		float_array.appendChild( doc.createTextNode( norText ) );
-		QDomElement technique_common = doc.createElement( "technique_common" );
-		source.appendChild( technique_common );
-
-		QDomElement accessor = doc.createElement( "accessor" );
-		accessor.setAttribute( "source", QString( "#nifid_%1-lib-Normal0-array" ).arg( idx ) );
-		accessor.setAttribute( "count", normals.size() );
-		accessor.setAttribute( "stride", "3" );
-		technique_common.appendChild( accessor );
-
-		QDomElement param = doc.createElement( "param" );
-		param.setAttribute( "name", "X" );
-		param.setAttribute( "type", "float" );
-		accessor.appendChild( param );
-
-		param = doc.createElement( "param" );
-		param.setAttribute( "name", "Y" );
-		param.setAttribute( "type", "float" );
-		accessor.appendChild( param );
-
-		param = doc.createElement( "param" );
-		param.setAttribute( "name", "Z" );
-		param.setAttribute( "type", "float" );
-		accessor.appendChild( param );
-	}
-
-	return source;
-}
-
 /**
  * create color element from color type and Color3
  * @param name sid name
@@ -574,6 +377,350 @@ QDomElement textureElement( const NifModel * nif, QDomElement effect, QModelInde
 	return ret;
 }
 
+/**
+ * A geometry of library_geometries
+ *
+ * The geometries are the bulk of an export, so attachNiShape() only records
+ * them. exportCol() reads, formats and writes them a batch at a time while
+ * it streams the document, see readGeometry() and formatGeometry().
+ */
+struct ColGeometry
+{
+	//! Block number of the shape
+	int idx = 0;
+	//! The NiTriBasedGeomData block
+	QPersistentModelIndex iData;
+	QString name;
+	bool haveVertex = false;
+	bool haveNormal = false;
+	bool haveColors = false;
+	bool haveMaterial = false;
+	//! Number of UV sets written as sources
+	int uvCount = 0;
+	//! Number of UV sets which are not empty, referenced by the triangles
+	int haveUV = 0;
+	int numTriangles = 0;
+
+	// Read from the model by readGeometry()
+	QVector<Vector3> verts;
+	QVector<Vector3> normals;
+	QVector<QVector<Vector2> > uvSets;
+	QVector<Color4> colors;
+	QList<QVector<quint16> > strips;
+	QVector<Triangle> tris;
+
+	// Formatted by formatGeometry()
+	QByteArray positionText;
+	QByteArray normalText;
+	QVector<QByteArray> uvText;
+	QByteArray colorText;
+	QByteArray triangleText;
+};
+
+QVector<ColGeometry> geometries;
+
+//! Append a float with 6 decimals, as QString::arg( v, 0, 'f', 6 ) would
+static void appendFixed( QByteArray & out, float value )
+{
+	double v = value;
+
+	// Large values and NaN are left to Qt
+	if ( !( std::fabs( v ) < 1e12 ) ) {
+		out += QByteArray::number( v, 'f', 6 );
+		return;
+	}
+
+	quint64 m = quint64( std::fabs( v ) * 1e6 + 0.5 );
+
+	char buf[24];
+	int n = 0;
+
+	do {
+		buf[n++] = char( '0' + m % 10 );
+		m /= 10;
+
+		if ( n == 6 )
+			buf[n++] = '.';
+	} while ( m > 0 || n < 8 );
+
+	if ( v < 0 )
+		out += '-';
+
+	while ( n > 0 )
+		out += buf[--n];
+}
+
+//! Append a non-negative integer
+static void appendIndex( QByteArray & out, int value )
+{
+	char buf[12];
+	int n = 0;
+
+	do {
+		buf[n++] = char( '0' + value % 10 );
+		value /= 10;
+	} while ( value > 0 );
+
+	while ( n > 0 )
+		out += buf[--n];
+}
+
+//! Read the arrays of a geometry from the model
+static void readGeometry( const NifModel * nif, ColGeometry & g )
+{
+	if ( g.haveVertex )
+		g.verts = nif->getArray<Vector3>( g.iData, "Vertices" );
+
+	if ( g.haveNormal )
+		g.normals = nif->getArray<Vector3>( g.iData, "Normals" );
+
+	QModelIndex iUV = nif->getIndex( g.iData, "UV Sets" );
+
+	for ( int row = 0; row < g.uvCount; row++ )
+		g.uvSets << nif->getArray<Vector2>( iUV.child( row, 0 ) );
+
+	if ( g.haveColors )
+		g.colors = nif->getArray<Color4>( g.iData, "Vertex Colors" );
+
+	QModelIndex iPoints = nif->getIndex( g.iData, "Points" );
+
+	if ( iPoints.isValid() ) {
+		for ( int r = 0; r < nif->rowCount( iPoints ); r++ )
+			g.strips.append( nif->getArray<quint16>( iPoints.child( r, 0 ) ) );
+	} else {
+		g.tris = nif->getArray<Triangle>( g.iData, "Triangles" );
+	}
+}
+
+//! Format the arrays of a geometry; only touches the geometry, so it may run on any thread
+static void formatGeometry( ColGeometry & g )
+{
+	g.positionText.reserve( g.verts.count() * 36 );
+
+	for ( const Vector3 & v : g.verts ) {
+		appendFixed( g.positionText, v[0] );
+		g.positionText += ' ';
+		appendFixed( g.positionText, v[1] );
+		g.positionText += ' ';
+		appendFixed( g.positionText, v[2] );
+		g.positionText += ' ';
+	}
+
+	g.normalText.reserve( g.normals.count() * 30 );
+
+	for ( const Vector3 & v : g.normals ) {
+		appendFixed( g.normalText, v[0] );
+		g.normalText += ' ';
+		appendFixed( g.normalText, v[1] );
+		g.normalText += ' ';
+		appendFixed( g.normalText, v[2] );
+		g.normalText += ' ';
+	}
+
+	// we have to flip the second UV coordinate because nif uses
+	// different convention from collada
+	for ( const QVector<Vector2> & uvMap : g.uvSets ) {
+		QByteArray uvText;
+		uvText.reserve( uvMap.count() * 20 );
+
+		for ( const Vector2 & v : uvMap ) {
+			uvText += QByteArray::number( v[0] );
+			uvText += ' ';
+			uvText += QByteArray::number( 1.0 - v[1] );
+			uvText += ' ';
+		}
+
+		g.uvText << uvText;
+	}
+
+	g.colorText.reserve( g.colors.count() * 40 );
+
+	for ( const Color4 & c : g.colors ) {
+		for ( int i = 0; i < 4; i++ ) {
+			g.colorText += QByteArray::number( c[i] );
+			g.colorText += ' ';
+		}
+	}
+
+	if ( !g.strips.isEmpty() )
+		g.tris = triangulate( g.strips );
+
+	// Every input of a corner uses the index of its vertex
+	int inputs = int( g.haveVertex ) + int( g.haveNormal ) + g.haveUV + int( g.haveColors );
+	g.triangleText.reserve( g.tris.count() * 3 * inputs * 6 );
+
+	for ( const Triangle & t : g.tris ) {
+		for ( int c = 0; c < 3; c++ ) {
+			for ( int i = 0; i < inputs; i++ ) {
+				appendIndex( g.triangleText, t[c] );
+				g.triangleText += ' ';
+			}
+		}
+	}
+
+}
+
+/**
+ * write a source with its float array and accessor
+ * @param w writer
+ * @param id source id
+ * @param text formatted float array
+ * @param count number of elements
+ * @param params names of the values of an element
+ */
+static void writeSource( QXmlStreamWriter & w, const QString & id, const QByteArray & text, int count, const QStringList & params )
+{
+	w.writeStartElement( "source" );
+	w.writeAttribute( "id", id );
+
+	w.writeStartElement( "float_array" );
+	w.writeAttribute( "id", id + "-array" );
+	w.writeAttribute( "count", QString::number( count * params.count() ) );
+	w.writeCharacters( QString::fromLatin1( text ) );
+	w.writeEndElement();
+
+	w.writeStartElement( "technique_common" );
+	w.writeStartElement( "accessor" );
+	w.writeAttribute( "source", "#" + id + "-array" );
+	w.writeAttribute( "count", QString::number( count ) );
+	w.writeAttribute( "stride", QString::number( params.count() ) );
+
+	for ( const QString & name : params ) {
+		w.writeEmptyElement( "param" );
+		w.writeAttribute( "name", name );
+		w.writeAttribute( "type", "float" );
+	}
+
+	w.writeEndElement(); // accessor
+	w.writeEndElement(); // technique_common
+	w.writeEndElement(); // source
+}
+
+static void writeInput( QXmlStreamWriter & w, const QString & semantic, int offset, const QString & source )
+{
+	w.writeEmptyElement( "input" );
+	w.writeAttribute( "semantic", semantic );
+
+	if ( offset >= 0 )
+		w.writeAttribute( "offset", QString::number( offset ) );
+
+	w.writeAttribute( "source", source );
+}
+
+/**
+ * write a formatted geometry
+ * FIXME: handle multiple UV maps in <polygons> .. find example!
+ */
+static void writeGeometry( QXmlStreamWriter & w, const ColGeometry & g )
+{
+	int idx = g.idx;
+
+	w.writeStartElement( "geometry" );
+	w.writeAttribute( "id", QString( "nifid_%1-lib" ).arg( idx ) );
+	w.writeAttribute( "name", QString( "%1-lib" ).arg( g.name ) );
+	w.writeStartElement( "mesh" );
+
+	// Position
+	if ( g.haveVertex )
+		writeSource( w, QString( "nifid_%1-lib-Position" ).arg( idx ), g.positionText, g.verts.count(), { "X", "Y", "Z" } );
+
+	// Normals
+	if ( g.haveNormal && !g.normals.isEmpty() )
+		writeSource( w, QString( "nifid_%1-lib-Normal0" ).arg( idx ), g.normalText, g.normals.count(), { "X", "Y", "Z" } );
+
+	// UV maps
+	for ( int row = 0; row < g.uvText.count(); row++ )
+		writeSource( w, QString( "nifid_%1-lib-UV%2" ).arg( idx ).arg( row ), g.uvText[row], g.uvSets[row].count(), { "S", "T" } );
+
+	// vertex color
+	if ( g.haveColors )
+		writeSource( w, QString( "nifid_%1-lib_colors" ).arg( idx ), g.colorText, g.colors.count(), { "R", "G", "B", "A" } );
+
+	// vertices
+	w.writeStartElement( "vertices" );
+	w.writeAttribute( "id", QString( "nifid_%1-lib-Vertex" ).arg( idx ) );
+	writeInput( w, "POSITION", -1, QString( "#nifid_%1-lib-Position" ).arg( idx ) );
+	w.writeEndElement();
+
+	// polygons (mapping)
+	w.writeStartElement( "triangles" );
+
+	if ( g.haveMaterial )
+		w.writeAttribute( "material", QString( "material_nifid_%1" ).arg( idx ) );
+
+	w.writeAttribute( "count", QString::number( g.numTriangles ) );
+	int x = 0;
+
+	if ( g.haveVertex )
+		writeInput( w, "VERTEX", x++, QString( "#nifid_%1-lib-Vertex" ).arg( idx ) );
+
+	if ( g.haveNormal )
+		writeInput( w, "NORMAL", x++, QString( "#nifid_%1-lib-Normal0" ).arg( idx ) );
+
+	for ( int i = 0; i < g.haveUV; i++ ) {
+		// TODO: add multiple UV
+		writeInput( w, "TEXCOORD", x++, QString( "#nifid_%1-lib-UV%2" ).arg( idx ).arg( i ) );
+		w.writeAttribute( "set", QString::number( i ) );
+	}
+
+	if ( g.haveColors )
+		writeInput( w, "COLOR", x++, QString( "#nifid_%1-lib_colors" ).arg( idx ) );
+
+	// Polygon structure array
+	w.writeTextElement( "p", QString::fromLatin1( g.triangleText ) );
+
+	w.writeEndElement(); // triangles
+	w.writeEndElement(); // mesh
+	w.writeEndElement(); // geometry
+}
+
+//! Write the geometries, reading and formatting a batch of them at a time
+static void writeGeometries( const NifModel * nif, QXmlStreamWriter & w )
+{
+	int batch = qMax( 1, QThread::idealThreadCount() ) * 2;
+
+	for ( int first = 0; first < geometries.count(); first += batch ) {
+		int count = qMin( batch, geometries.count() - first );
+
+		for ( int i = first; i < first + count; i++ )
+			readGeometry( nif, geometries[i] );
+
+		Spell::parallelFor( count, [first]( int i ) {
+			formatGeometry( geometries[first + i] );
+		} );
+
+		for ( int i = first; i < first + count; i++ ) {
+			writeGeometry( w, geometries[i] );
+			geometries[i] = ColGeometry();
+		}
+	}
+}
+
+//! Write a DOM element, writing the geometries in place of the empty library_geometries element
+static void writeDomElement( const NifModel * nif, QXmlStreamWriter & w, const QDomElement & element )
+{
+	w.writeStartElement( element.tagName() );
+
+	QDomNamedNodeMap attributes = element.attributes();
+
+	for ( int i = 0; i < attributes.count(); i++ ) {
+		QDomAttr attr = attributes.item( i ).toAttr();
+		w.writeAttribute( attr.name(), attr.value() );
+	}
+
+	if ( element == libraryGeometries )
+		writeGeometries( nif, w );
+
+	for ( QDomNode n = element.firstChild(); !n.isNull(); n = n.nextSibling() ) {
+		if ( n.isElement() )
+			writeDomElement( nif, w, n.toElement() );
+		else if ( n.isText() )
+			w.writeCharacters( n.nodeValue() );
+	}
+
+	w.writeEndElement();
+}
+
 /**
  * extract shape to dom structures
  * TODO: WIP and do major cleanup and re-structuring .. tons of crap "definitions" and boilerplate
@@ -582,9 +729,6 @@ QDomElement textureElement( const NifModel * nif, QDomElement effect, QModelInde
  */
 void attachNiShape ( const NifModel * nif, QDomElement parentNode, int idx )
 {
-	bool haveVertex = false;
-	bool haveNormal = false;
-	bool haveColors = false;
 	bool haveMaterial = false;
 	int haveUV = 0;
 	QModelIndex iBlock = nif->getBlock( idx );
@@ -592,7 +736,6 @@ void attachNiShape ( const NifModel * nif, QDomElement parentNode, int idx )
 	QDomElement textureBaseTexture;
 	QDomElement textureDarkTexture;
 	QDomElement textureGlowTexture;
-	QDomElement input;
 	// effect
 	QDomElement effect;
 	// profile
@@ -746,140 +889,36 @@ void attachNiShape ( const NifModel * nif, QDomElement parentNode, int idx )
 			if ( extra.isElement() )
 				profile.appendChild( extra );
 		} else if ( nif->inherits( iProp, "NiTriBasedGeomData" ) ) {
-			QDomElement geometry = doc.createElement( "geometry" );
-			geometry.setAttribute( "id", QString( "nifid_%1-lib" ).arg( idx ) );
-			geometry.setAttribute( "name", QString( "%1-lib" ).arg( nif->get<QString>( iBlock, "Name" ).replace( QRegularExpression( "\\W" ), "_" ) ) );
-			libraryGeometries.appendChild( geometry );
-			QDomElement mesh = doc.createElement( "mesh" );
-			geometry.appendChild( mesh );
+			// The arrays are read and written by exportCol(), see writeGeometries()
+			ColGeometry g;
+			g.idx = idx;
+			g.iData = iProp;
+			g.name = nif->get<QString>( iBlock, "Name" ).replace( QRegularExpression( "\\W" ), "_" );
+			g.haveMaterial = haveMaterial;
 
 			// Position
-			if ( nif->get<bool>( iProp, "Has Vertices" ) == true ) {
-				haveVertex = true;
-				mesh.appendChild( positionsElement( nif->getArray<Vector3>( iProp, "Vertices" ), idx ) );
-			}
+			g.haveVertex = nif->get<bool>( iProp, "Has Vertices" );
 
 			// Normals
-			if ( nif->get<bool>( iProp, "Has Normals" ) == true ) {
-				haveNormal = true;
-				mesh.appendChild( normalsElement( nif->getArray<Vector3>( iProp, "Normals" ), idx ) );
-			}
+			g.haveNormal = nif->get<bool>( iProp, "Has Normals" );
 
 			// UV maps
 			int uvCount = (nif->get<int>( iProp, "Num UV Sets" ) & 63) | (nif->get<int>( iProp, "BS Num UV Sets" ) & 1);
 			QModelIndex iUV = nif->getIndex( iProp, "UV Sets" );
 
 			for ( int row = 0; row < uvCount; row++ ) {
-				QVector<Vector2> uvMap = nif->getArray<Vector2>( iUV.child( row, 0 ) );
-				mesh.appendChild( uvMapElement( uvMap, idx, row ) );
-
-				if ( uvMap.size() > 0 )
+				if ( nif->rowCount( iUV.child( row, 0 ) ) > 0 )
 					haveUV++;
 			}
 
-			// vertex color
-			if ( nif->get<bool>( iProp, "Has Vertex Colors" ) == true ) {
-				mesh.appendChild( colorMapElement( nif->getArray<Color4>( iProp, "Vertex Colors" ), idx ) );
-				haveColors = true;
-			}
-
-			// vertices
-			QDomElement vertices = doc.createElement( "vertices" );
-			vertices.setAttribute( "id", QString( "nifid_%1-lib-Vertex" ).arg( idx ) );
-			mesh.appendChild( vertices );
-			input = doc.createElement( "input" );
-			input.setAttribute( "semantic", "POSITION" );
-			input.setAttribute( "source", QString( "#nifid_%1-lib-Position" ).arg( idx ) );
-			vertices.appendChild( input );
-
-			// polygons (mapping)
-			QDomElement triangles = doc.createElement( "triangles" );
-
-			if ( haveMaterial )
-				triangles.setAttribute( "material", QString( "material_nifid_%1" ).arg( idx ) );
-
-			triangles.setAttribute( "count", nif->get<ushort>( iProp, "Num Triangles" ) );
-			mesh.appendChild( triangles );
-			int x = 0;
-
-			if ( haveVertex == true ) {
-				input = doc.createElement( "input" );
-				input.setAttribute( "semantic", "VERTEX" );
-				input.setAttribute( "offset", x++ );
-				input.setAttribute( "source", QString( "#nifid_%1-lib-Vertex" ).arg( idx ) );
-				triangles.appendChild( input );
-			}
-
-			if ( haveNormal == true ) {
-				input = doc.createElement( "input" );
-				input.setAttribute( "semantic", "NORMAL" );
-				input.setAttribute( "offset", x++ );
-				input.setAttribute( "source", QString( "#nifid_%1-lib-Normal0" ).arg( idx ) );
-				triangles.appendChild( input );
-			}
-
-			for ( int i = 0; i < haveUV; i++ ) {
-//			if ( haveUV > 0 ) {
-				// TODO: add multiple UV
-				input = doc.createElement( "input" );
-				input.setAttribute( "semantic", "TEXCOORD" );
-				input.setAttribute( "offset", x++ );
-				input.setAttribute( "source", QString( "#nifid_%1-lib-UV%2" ).arg( idx ).arg( i ) );
-				input.setAttribute( "set", QString( "%1" ).arg( i ) );
-				triangles.appendChild( input );
-			}
-
-			if ( haveColors == true ) {
-				input = doc.createElement( "input" );
-				input.setAttribute( "semantic", "COLOR" );
-				input.setAttribute( "offset", x++ );
-				input.setAttribute( "source", QString( "#nifid_%1-lib_colors" ).arg( idx ) );
-				triangles.appendChild( input );
-			}
-
-			// Polygon structure array
-			QVector<Triangle> tri;
-			QModelIndex iPoints = nif->getIndex( iProp, "Points" );
-
-			if ( iPoints.isValid() ) {
-				QList<QVector<quint16> > strips;
-
-				for ( int r = 0; r < nif->rowCount( iPoints ); r++ )
-					strips.append( nif->getArray<quint16>( iPoints.child( r, 0 ) ) );
-
-				tri = triangulate( strips );
-			} else {
-				tri = nif->getArray<Triangle>( iProp, "Triangles" );
-			}
-
-			QDomElement p = doc.createElement( "p" );
-			QString triText;
-			foreach ( Triangle v, tri ) {
-				// TODO: add multiple UV
-				if ( haveVertex == true ) triText.append( QString( "%1 " ).arg( v[0] ) );
-				if ( haveNormal == true ) triText.append( QString( "%1 " ).arg( v[0] ) );
-
-				for ( int i = 0; i < haveUV; i++ )
-					triText.append( QString( "%1 " ).arg( v[0] ) );
-
-				if ( haveColors == true ) triText.append( QString( "%1 " ).arg( v[0] ) );
-				if ( haveVertex == true ) triText.append( QString( "%1 " ).arg( v[1] ) );
-				if ( haveNormal == true ) triText.append( QString( "%1 " ).arg( v[1] ) );
-
-				for ( int i = 0; i < haveUV; i++ )
-					triText.append( QString( "%1 " ).arg( v[1] ) );
+			g.uvCount = uvCount;
+			g.haveUV = haveUV;
 
-				if ( haveColors == true ) triText.append( QString( "%1 " ).arg( v[1] ) );
-				if ( haveVertex == true ) triText.append( QString( "%1 " ).arg( v[2] ) );
-				if ( haveNormal == true ) triText.append( QString( "%1 " ).arg( v[2] ) );
-
-				for ( int i = 0; i < haveUV; i++ )
-					triText.append( QString( "%1 " ).arg( v[2] ) );
+			// vertex color
+			g.haveColors = nif->get<bool>( iProp, "Has Vertex Colors" );
 
-				if ( haveColors == true ) triText.append( QString( "%1 " ).arg( v[2] ) );
-			}
-			p.appendChild( doc.createTextNode( triText ) );
-			triangles.appendChild( p );
+			g.numTriangles = nif->get<ushort>( iProp, "Num Triangles" );
+			geometries.append( g );
 
 			// extra node for model matrix move
 			QDomElement node = doc.createElement( "node" );
@@ -960,21 +999,18 @@ void attachNiNode ( const NifModel * nif, QDomElement parentNode, int idx )
 	}
 }
 
-void exportCol( const NifModel * nif, QFileInfo fileInfo )
+//! Serializes the exports, which build the document in the globals above
+static QMutex exportMutex;
+
+//! Export the whole scene to a COLLADA file without asking
+bool exportCol( const NifModel * nif, QString fname )
 {
 	//culling = Options::get()->exportCullEnabled();
 	//cullRegExp = Options::get()->cullExpression();
 
-	QList<int> roots = nif->getRootLinks();
-	QString question;
-	QSettings settings;
-	settings.beginGroup( "Import-Export" );
-	settings.beginGroup( "COLLADA" );
-
-	QString fname = QFileDialog::getSaveFileName( qApp->activeWindow(), tr( "Choose a .DAE file for export" ), QString( "%1%2.dae" ).arg( settings.value( "Path" ).toString() ).arg( fileInfo.baseName() ), "COLLADA (*.dae)" );
+	QMutexLocker lock( &exportMutex );
 
-	if ( fname.isEmpty() )
-		return;
+	QList<int> roots = nif->getRootLinks();
 
 	while ( fname.endsWith( ".dae", Qt::CaseInsensitive ) )
 		fname = fname.left( fname.length() - 4 );
@@ -983,7 +1019,7 @@ void exportCol( const NifModel * nif, QFileInfo fileInfo )
 
 	if ( !fobj.open( QIODevice::WriteOnly ) ) {
 		qCCritical( nsIo ) << tr( "Failed to write %1" ).arg( fobj.fileName() );
-		return;
+		return false;
 	}
 
 	// clear texture ID list
@@ -995,7 +1031,9 @@ void exportCol( const NifModel * nif, QFileInfo fileInfo )
 	libraryImages = doc.createElement( "library_images" );
 	libraryMaterials = doc.createElement( "library_materials" );
 	libraryEffects = doc.createElement( "library_effects" );
+	// only a placeholder, the geometries are streamed in its place
 	libraryGeometries = doc.createElement( "library_geometries" );
+	geometries.clear();
 	// root
 	QDomElement root = doc.createElement( "COLLADA" );
 	root.setAttribute( "xmlns", "http://www.collada.org/2005/11/COLLADASchema" );
@@ -1043,11 +1081,41 @@ void exportCol( const NifModel * nif, QFileInfo fileInfo )
 	QDomElement ivl = doc.createElement( "instance_visual_scene" );
 	ivl.setAttribute( "url", "#NifRootScene" );
 	scene.appendChild( ivl );
-	fobj.write( doc.toString().toLatin1() );
-	settings.setValue( "Path", QString( "%1/" ).arg( QFileInfo( fobj.fileName() ).path() ) );
-	QTextStream sobj( &fobj ); // let's save xml
+
+	// let's save xml
+	QXmlStreamWriter w( &fobj );
+	w.setAutoFormatting( true );
+	w.setAutoFormattingIndent( 1 );
+	w.writeStartDocument();
+	writeDomElement( nif, w, root );
+	w.writeEndDocument();
+
 	fobj.close();
 
+	geometries.clear();
+	doc.clear();
+
+	if ( w.hasError() ) {
+		qCCritical( nsIo ) << tr( "Failed to write %1" ).arg( fobj.fileName() );
+		return false;
+	}
+
+	return true;
+}
+
+void exportCol( const NifModel * nif, QFileInfo fileInfo )
+{
+	QSettings settings;
+	settings.beginGroup( "Import-Export" );
+	settings.beginGroup( "COLLADA" );
+
+	QString fname = QFileDialog::getSaveFileName( qApp->activeWindow(), tr( "Choose a .DAE file for export" ), QString( "%1%2.dae" ).arg( settings.value( "Path" ).toString() ).arg( fileInfo.baseName() ), "COLLADA (*.dae)" );
+
+	if ( fname.isEmpty() || !exportCol( nif, fname ) )
+		return;
+
+	settings.setValue( "Path", QString( "%1/" ).arg( QFileInfo( fname ).path() ) );
+
 	settings.endGroup(); // COLLADA
 	settings.endGroup(); // Import-Export
 }
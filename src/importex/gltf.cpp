@@ -0,0 +1,916 @@
+/***** BEGIN LICENSE BLOCK *****
+
+BSD License
+
+Copyright (c) 2005-2015, NIF File Format Library and Tools
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the NIF File Format Library and Tools project may not be
+   used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+***** END LICENCE BLOCK *****/
+
+#include "config.h"
+
+#include "nifmodel.h"
+#include "nvtristripwrapper.h"
+#include "gl/glcontroller.h"
+#include "gl/gltools.h"
+
+#include <QApplication>
+#include <QDebug>
+#include <QFileDialog>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QSettings>
+#include <QUrl>
+#include <QtEndian>
+
+#include <algorithm>
+#include <cmath>
+
+#define tr( x ) QApplication::tr( x )
+
+
+/*
+ *  .GLB EXPORT
+ *
+ * Writes a binary glTF 2.0 file: a JSON chunk describing the scene and one
+ * binary chunk. The arrays read from the model are copied into the binary
+ * chunk as they are laid out in memory, one buffer view per array.
+ */
+
+static_assert( sizeof( Vector2 ) == 8 && sizeof( Vector3 ) == 12 && sizeof( Color4 ) == 16
+	&& sizeof( Triangle ) == 6 && sizeof( Matrix4 ) == 64,
+	"The arrays are copied to the glTF buffer as they are laid out in memory" );
+
+// glTF component types and buffer view targets
+enum
+{
+	GltfUnsignedShort = 5123,
+	GltfFloat = 5126,
+	GltfArrayBuffer = 34962,
+	GltfElementArrayBuffer = 34963
+};
+
+//! The rate at which controllers are sampled, in frames per second
+static const float bakeRate = 30.0f;
+
+//! The geometry of a shape read from the model
+struct GltfGeometry
+{
+	QVector<Vector3> verts;
+	QVector<Vector3> norms;
+	QVector<Vector2> coords;
+	QVector<Color4> colors;
+	QVector<Triangle> tris;
+
+	// Four influences per vertex, if the shape is skinned
+	QVector<quint16> joints;
+	QVector<float> weights;
+	//! The blocks of the bones and the transforms from the shape to them
+	QVector<int> bones;
+	QVector<Matrix4> inverseBinds;
+	int skeletonRoot = -1;
+};
+
+static bool isShape( const NifModel * nif, const QModelIndex & iBlock )
+{
+	return nif->inherits( iBlock, "NiTriBasedGeom" ) || nif->inherits( iBlock, "BSTriShape" );
+}
+
+//! Keep the four strongest influences of every vertex, normalized
+static void packInfluences( const QVector<QVector<QPair<int, float>>> & vertexBones, GltfGeometry & g )
+{
+	g.joints.fill( 0, vertexBones.count() * 4 );
+	g.weights.fill( 0.0f, vertexBones.count() * 4 );
+
+	for ( int v = 0; v < vertexBones.count(); v++ ) {
+		QVector<QPair<int, float>> influences = vertexBones[v];
+		std::sort( influences.begin(), influences.end(), []( const QPair<int, float> & a, const QPair<int, float> & b ) {
+			return a.second > b.second;
+		} );
+
+		int count = qMin( influences.count(), 4 );
+		float sum = 0.0f;
+
+		for ( int i = 0; i < count; i++ )
+			sum += influences[i].second;
+
+		// A vertex without influences follows the first bone
+		if ( sum <= 0.0f ) {
+			g.weights[v * 4] = 1.0f;
+			continue;
+		}
+
+		for ( int i = 0; i < count; i++ ) {
+			g.joints[v * 4 + i] = quint16( influences[i].first );
+			g.weights[v * 4 + i] = influences[i].second / sum;
+		}
+	}
+}
+
+//! Read a NiTriShape or NiTriStrips and its NiSkinInstance
+static void readTriShape( const NifModel * nif, const QModelIndex & iShape, GltfGeometry & g )
+{
+	QModelIndex iData = nif->getBlock( nif->getLink( iShape, "Data" ), "NiTriBasedGeomData" );
+
+	if ( !iData.isValid() )
+		return;
+
+	g.verts = nif->getArray<Vector3>( iData, "Vertices" );
+	g.norms = nif->getArray<Vector3>( iData, "Normals" );
+	g.colors = nif->getArray<Color4>( iData, "Vertex Colors" );
+
+	QModelIndex iUV = nif->getIndex( iData, "UV Sets" );
+
+	if ( !iUV.isValid() )
+		iUV = nif->getIndex( iData, "UV Sets 2" );
+
+	g.coords = nif->getArray<Vector2>( iUV.child( 0, 0 ) );
+
+	QModelIndex iPoints = nif->getIndex( iData, "Points" );
+
+	if ( iPoints.isValid() ) {
+		QList<QVector<quint16> > strips;
+
+		for ( int r = 0; r < nif->rowCount( iPoints ); r++ )
+			strips.append( nif->getArray<quint16>( iPoints.child( r, 0 ) ) );
+
+		g.tris = triangulate( strips );
+	} else {
+		g.tris = nif->getArray<Triangle>( iData, "Triangles" );
+	}
+
+	QModelIndex iSkin = nif->getBlock( nif->getLink( iShape, "Skin Instance" ), "NiSkinInstance" );
+	QModelIndex iSkinData = nif->getBlock( nif->getLink( iSkin, "Data" ), "NiSkinData" );
+
+	if ( !iSkinData.isValid() )
+		return;
+
+	g.bones = nif->getLinkArray( iSkin, "Bones" );
+	g.skeletonRoot = nif->getLink( iSkin, "Skeleton Root" );
+
+	QModelIndex iBoneList = nif->getIndex( iSkinData, "Bone List" );
+
+	for ( int b = 0; b < g.bones.count(); b++ )
+		g.inverseBinds << Transform( nif, iBoneList.child( b, 0 ) ).toMatrix4();
+
+	// The influences are gathered as in Shape::updateData()
+	QVector<QVector<QPair<int, float>>> vertexBones( g.verts.count() );
+
+	QModelIndex iSkinPart = nif->getBlock( nif->getLink( iSkin, "Skin Partition" ), "NiSkinPartition" );
+
+	if ( !iSkinPart.isValid() )
+		iSkinPart = nif->getBlock( nif->getLink( iSkinData, "Skin Partition" ), "NiSkinPartition" );
+
+	if ( iSkinPart.isValid() ) {
+		QModelIndex iBlocks = nif->getIndex( iSkinPart, "Skin Partition Blocks" );
+		QVector<bool> skinned( g.verts.count(), false );
+
+		for ( int p = 0; p < nif->rowCount( iBlocks ); p++ ) {
+			SkinPartition part( nif, iBlocks.child( p, 0 ) );
+
+			for ( int v = 0; v < part.vertexMap.count(); v++ ) {
+				int vindex = part.vertexMap[v];
+
+				if ( vindex < 0 || vindex >= g.verts.count() )
+					break;
+
+				if ( skinned[vindex] )
+					continue;
+
+				skinned[vindex] = true;
+
+				for ( int w = 0; w < part.numWeightsPerVertex; w++ ) {
+					QPair<int, float> weight = part.weights.value( v * part.numWeightsPerVertex + w );
+					int bone = part.boneMap.value( weight.first, -1 );
+
+					if ( bone >= 0 && bone < g.bones.count() )
+						vertexBones[vindex].append( { bone, weight.second } );
+				}
+			}
+		}
+	} else {
+		for ( int b = 0; b < nif->rowCount( iBoneList ) && b < g.bones.count(); b++ ) {
+			BoneWeights bw( nif, iBoneList.child( b, 0 ), b, g.verts.count() );
+
+			for ( const VertexWeight & vw : bw.weights ) {
+				if ( vw.vertex >= 0 && vw.vertex < g.verts.count() )
+					vertexBones[vw.vertex].append( { b, vw.weight } );
+			}
+		}
+	}
+
+	packInfluences( vertexBones, g );
+}
+
+//! Read a BSTriShape, whose vertices are on the shape or, if skinned in version 100, on the NiSkinPartition
+static void readBSTriShape( const NifModel * nif, const QModelIndex & iShape, GltfGeometry & g )
+{
+	bool fo4 = ( nif->getUserVersion2() == 130 );
+	QModelIndex iSkin = nif->getBlock( nif->getLink( nif->getIndex( iShape, "Skin" ) ), fo4 ? "BSSkin::Instance" : "NiSkinInstance" );
+	QModelIndex iSkinData = nif->getBlock( nif->getLink( iSkin, "Data" ), fo4 ? "BSSkin::BoneData" : "NiSkinData" );
+	bool skinned = ( nif->get<quint16>( iShape, "VF" ) & 0x400 ) && iSkinData.isValid();
+
+	QModelIndex iVertData;
+	int numVerts = 0;
+
+	if ( skinned && nif->getUserVersion2() == 100 ) {
+		QModelIndex iSkinPart = nif->getBlock( nif->getLink( iSkin, "Skin Partition" ), "NiSkinPartition" );
+		iVertData = nif->getIndex( iSkinPart, "Vertex Data" );
+		numVerts = nif->rowCount( iVertData );
+
+		QModelIndex iPartitions = nif->getIndex( iSkinPart, "Partition" );
+
+		for ( int p = 0; p < nif->rowCount( iPartitions ); p++ )
+			g.tris << nif->getArray<Triangle>( iPartitions.child( p, 0 ), "Triangles" );
+	} else {
+		iVertData = nif->getIndex( iShape, "Vertex Data" );
+		numVerts = qMin( nif->get<int>( iShape, "Num Vertices" ), nif->rowCount( iVertData ) );
+		g.tris = nif->getArray<Triangle>( iShape, "Triangles" ).mid( 0, nif->get<int>( iShape, "Num Triangles" ) );
+	}
+
+	if ( numVerts <= 0 )
+		return;
+
+	// Every vertex has the same fields, find their rows once
+	static const NifFieldId fVertex( "Vertex" );
+	static const NifFieldId fNormal( "Normal" );
+	static const NifFieldId fUV( "UV" );
+	static const NifFieldId fVertexColors( "Vertex Colors" );
+	static const NifFieldId fBoneWeights( "Bone Weights" );
+	static const NifFieldId fBoneIndices( "Bone Indices" );
+
+	QModelIndex first = iVertData.child( 0, 0 );
+	int rVertex = nif->getIndex( first, fVertex ).row();
+	int rNormal = nif->getIndex( first, fNormal ).row();
+	int rUV = nif->getIndex( first, fUV ).row();
+	int rColors = nif->getIndex( first, fVertexColors ).row();
+	int rWeights = skinned ? nif->getIndex( first, fBoneWeights ).row() : -1;
+	int rIndices = skinned ? nif->getIndex( first, fBoneIndices ).row() : -1;
+
+	bool dynamic = nif->inherits( iShape, "BSDynamicTriShape" );
+
+	if ( dynamic ) {
+		for ( const Vector4 & v : nif->getArray<Vector4>( iShape, "Vertices" ).mid( 0, numVerts ) )
+			g.verts << Vector3( v );
+	}
+
+	if ( skinned && rWeights >= 0 && rIndices >= 0 ) {
+		g.joints.fill( 0, numVerts * 4 );
+		g.weights.fill( 0.0f, numVerts * 4 );
+	}
+
+	for ( int i = 0; i < numVerts; i++ ) {
+		QModelIndex iVert = iVertData.child( i, 0 );
+
+		if ( rVertex >= 0 && !dynamic )
+			g.verts << nif->get<Vector3>( iVert.child( rVertex, 0 ) );
+		if ( rNormal >= 0 )
+			g.norms << nif->get<ByteVector3>( iVert.child( rNormal, 0 ) );
+		if ( rUV >= 0 )
+			g.coords << nif->get<HalfVector2>( iVert.child( rUV, 0 ) );
+		if ( rColors >= 0 )
+			g.colors << nif->get<ByteColor4>( iVert.child( rColors, 0 ) );
+
+		if ( !g.weights.isEmpty() ) {
+			QVector<float> wts = nif->getArray<float>( iVert.child( rWeights, 0 ) );
+			QVector<quint8> bns = nif->getArray<quint8>( iVert.child( rIndices, 0 ) );
+			float sum = 0.0f;
+
+			for ( int j = 0; j < 4 && j < wts.count() && j < bns.count(); j++ )
+				sum += wts[j];
+
+			for ( int j = 0; j < 4 && j < wts.count() && j < bns.count(); j++ ) {
+				g.joints[i * 4 + j] = bns[j];
+				g.weights[i * 4 + j] = ( sum > 0.0f ) ? wts[j] / sum : float( j == 0 );
+			}
+		}
+	}
+
+	if ( g.weights.isEmpty() )
+		return;
+
+	g.bones = nif->getLinkArray( iSkin, "Bones" );
+	g.skeletonRoot = nif->getLink( iSkin, "Skeleton Root" );
+
+	QModelIndex iBoneList = nif->getIndex( iSkinData, "Bone List" );
+
+	for ( int b = 0; b < g.bones.count(); b++ )
+		g.inverseBinds << Transform( nif, iBoneList.child( b, 0 ) ).toMatrix4();
+}
+
+//! Collects the nodes, meshes and binary buffer of a .glb file
+class GltfExporter final
+{
+public:
+	GltfExporter( const NifModel * model ) : nif( model ) {}
+
+	//! Export the blocks, below a node which turns the Z up axis of NIFs into the Y up axis of glTF
+	void exportBlocks( const QList<int> & blocks );
+
+	//! The contents of the .glb file
+	QByteArray toGlb() const;
+
+protected:
+	//! Add the node of a NiNode or a shape and the nodes of its children, returning the node
+	int addNode( const QModelIndex & iBlock );
+	//! Add the mesh of a shape to its node
+	void addMesh( const QModelIndex & iShape, int node );
+	//! Add the material of a shape from its properties
+	int addMaterial( const QModelIndex & iShape );
+	//! Add a texture referring to a file by its path in the NIF
+	int addTexture( const QString & file );
+	//! Bake the transform controllers of a block into channels of the animation
+	void addAnimation( const QModelIndex & iBlock, int node );
+	//! Add the skins once all bones have nodes
+	void addSkins();
+
+	//! Append an array to the buffer as a buffer view and add an accessor for it, returning the accessor
+	int addAccessor( const void * data, int count, int componentType, const QString & type, int components,
+		int target = 0, const QJsonArray & min = QJsonArray(), const QJsonArray & max = QJsonArray() );
+
+	const NifModel * nif;
+
+	//! The binary chunk
+	QByteArray bin;
+
+	QVector<QJsonObject> nodes;
+	//! The children of each node
+	QVector<QJsonArray> children;
+	//! The node of each block
+	QHash<int, int> nodeOf;
+
+	QJsonArray bufferViews;
+	QJsonArray accessors;
+	QJsonArray meshes;
+	QJsonArray materials;
+	QJsonArray textures;
+	QJsonArray images;
+	QJsonArray skins;
+	QJsonArray channels;
+	QJsonArray samplers;
+	QHash<QString, int> textureOf;
+	bool usesDds = false;
+
+	//! A skin waiting for the nodes of its bones
+	struct PendingSkin
+	{
+		int node;
+		QVector<int> bones;
+		QVector<Matrix4> inverseBinds;
+		int skeletonRoot;
+	};
+	QVector<PendingSkin> pendingSkins;
+};
+
+int GltfExporter::addAccessor( const void * data, int count, int componentType, const QString & type, int components,
+	int target, const QJsonArray & min, const QJsonArray & max )
+{
+	int length = count * components * ( componentType == GltfFloat ? 4 : 2 );
+
+	QJsonObject view{ { "buffer", 0 }, { "byteOffset", bin.size() }, { "byteLength", length } };
+
+	if ( target )
+		view["target"] = target;
+
+	bufferViews.append( view );
+
+	bin.append( static_cast<const char *>( data ), length );
+
+	// Every buffer view starts on 4 bytes
+	while ( bin.size() % 4 )
+		bin.append( '\0' );
+
+	QJsonObject accessor{
+		{ "bufferView", bufferViews.count() - 1 },
+		{ "componentType", componentType },
+		{ "count", count },
+		{ "type", type }
+	};
+
+	if ( !min.isEmpty() ) {
+		accessor["min"] = min;
+		accessor["max"] = max;
+	}
+
+	accessors.append( accessor );
+	return accessors.count() - 1;
+}
+
+static void setTransform( QJsonObject & node, const Transform & t )
+{
+	Quat q = t.rotation.toQuat();
+
+	node["translation"] = QJsonArray{ t.translation[0], t.translation[1], t.translation[2] };
+	node["rotation"] = QJsonArray{ q[1], q[2], q[3], q[0] };
+	node["scale"] = QJsonArray{ t.scale, t.scale, t.scale };
+}
+
+void GltfExporter::exportBlocks( const QList<int> & blocks )
+{
+	// Rotating by -90 degrees about X turns +Z into +Y
+	nodes.append( QJsonObject{ { "name", "Z_UP" }, { "rotation", QJsonArray{ -0.70710678, 0.0, 0.0, 0.70710678 } } } );
+	children.append( QJsonArray() );
+
+	for ( int b : blocks ) {
+		QModelIndex iBlock = nif->getBlock( b );
+
+		if ( nif->inherits( iBlock, "NiNode" ) || isShape( nif, iBlock ) ) {
+			int child = addNode( iBlock );
+			children[0].append( child );
+		}
+	}
+
+	addSkins();
+}
+
+int GltfExporter::addNode( const QModelIndex & iBlock )
+{
+	int block = nif->getBlockNumber( iBlock );
+	int node = nodes.count();
+
+	nodes.append( QJsonObject() );
+	children.append( QJsonArray() );
+	nodeOf.insert( block, node );
+
+	QString name = nif->get<QString>( iBlock, "Name" );
+
+	if ( !name.isEmpty() )
+		nodes[node]["name"] = name;
+
+	setTransform( nodes[node], Transform( nif, iBlock ) );
+
+	if ( isShape( nif, iBlock ) ) {
+		addMesh( iBlock, node );
+	} else {
+		for ( int l : nif->getChildLinks( block ) ) {
+			QModelIndex iChild = nif->getBlock( l );
+
+			// A block linked twice is a node of the first parent only
+			if ( nodeOf.contains( l ) || !( nif->inherits( iChild, "NiNode" ) || isShape( nif, iChild ) ) )
+				continue;
+
+			int child = addNode( iChild );
+			children[node].append( child );
+		}
+	}
+
+	addAnimation( iBlock, node );
+
+	return node;
+}
+
+void GltfExporter::addMesh( const QModelIndex & iShape, int node )
+{
+	GltfGeometry g;
+
+	if ( nif->inherits( iShape, "BSTriShape" ) )
+		readBSTriShape( nif, iShape, g );
+	else
+		readTriShape( nif, iShape, g );
+
+	int numVerts = g.verts.count();
+
+	// Drop the triangles referring to missing vertices
+	QVector<Triangle> tris;
+	tris.reserve( g.tris.count() );
+
+	for ( const Triangle & t : g.tris ) {
+		if ( t[0] < numVerts && t[1] < numVerts && t[2] < numVerts )
+			tris << t;
+	}
+
+	if ( tris.isEmpty() )
+		return;
+
+	QJsonObject attributes;
+
+	Vector3 min = g.verts[0], max = g.verts[0];
+
+	for ( const Vector3 & v : g.verts ) {
+		min = Vector3( qMin( min[0], v[0] ), qMin( min[1], v[1] ), qMin( min[2], v[2] ) );
+		max = Vector3( qMax( max[0], v[0] ), qMax( max[1], v[1] ), qMax( max[2], v[2] ) );
+	}
+
+	attributes["POSITION"] = addAccessor( g.verts.constData(), numVerts, GltfFloat, "VEC3", 3, GltfArrayBuffer,
+		{ min[0], min[1], min[2] }, { max[0], max[1], max[2] } );
+
+	if ( g.norms.count() == numVerts ) {
+		// glTF requires unit normals
+		for ( Vector3 & n : g.norms ) {
+			n.normalize();
+
+			if ( n.length() < 0.5f )
+				n = Vector3( 0.0f, 0.0f, 1.0f );
+		}
+
+		attributes["NORMAL"] = addAccessor( g.norms.constData(), numVerts, GltfFloat, "VEC3", 3, GltfArrayBuffer );
+	}
+
+	if ( g.coords.count() == numVerts )
+		attributes["TEXCOORD_0"] = addAccessor( g.coords.constData(), numVerts, GltfFloat, "VEC2", 2, GltfArrayBuffer );
+
+	if ( g.colors.count() == numVerts )
+		attributes["COLOR_0"] = addAccessor( g.colors.constData(), numVerts, GltfFloat, "VEC4", 4, GltfArrayBuffer );
+
+	bool skinned = !g.bones.isEmpty() && g.weights.count() == numVerts * 4;
+
+	if ( skinned ) {
+		attributes["JOINTS_0"] = addAccessor( g.joints.constData(), numVerts, GltfUnsignedShort, "VEC4", 4, GltfArrayBuffer );
+		attributes["WEIGHTS_0"] = addAccessor( g.weights.constData(), numVerts, GltfFloat, "VEC4", 4, GltfArrayBuffer );
+
+		pendingSkins.append( { node, g.bones, g.inverseBinds, g.skeletonRoot } );
+	}
+
+	QJsonObject primitive{
+		{ "attributes", attributes },
+		{ "indices", addAccessor( tris.constData(), tris.count() * 3, GltfUnsignedShort, "SCALAR", 1, GltfElementArrayBuffer ) }
+	};
+
+	int material = addMaterial( iShape );
+
+	if ( material >= 0 )
+		primitive["material"] = material;
+
+	QJsonObject mesh{ { "primitives", QJsonArray{ primitive } } };
+
+	if ( nodes[node].contains( "name" ) )
+		mesh["name"] = nodes[node].value( "name" );
+
+	meshes.append( mesh );
+	nodes[node]["mesh"] = meshes.count() - 1;
+}
+
+int GltfExporter::addMaterial( const QModelIndex & iShape )
+{
+	Color4 baseColor( 1.0f, 1.0f, 1.0f, 1.0f );
+	QString texture;
+	QString alphaMode;
+	float alphaCutoff = 0.5f;
+
+	for ( int link : nif->getChildLinks( nif->getBlockNumber( iShape ) ) ) {
+		QModelIndex iProp = nif->getBlock( link );
+
+		if ( nif->isNiBlock( iProp, "NiMaterialProperty" ) ) {
+			baseColor = Color4( nif->get<Color3>( iProp, "Diffuse Color" ), nif->get<float>( iProp, "Alpha" ) );
+		} else if ( nif->isNiBlock( iProp, "NiTexturingProperty" ) ) {
+			QModelIndex iBase = nif->getBlock( nif->getLink( nif->getIndex( iProp, "Base Texture" ), "Source" ), "NiSourceTexture" );
+			texture = nif->get<QString>( iBase, "File Name" );
+		} else if ( nif->isNiBlock( iProp, "NiTextureProperty" ) ) {
+			QModelIndex iImage = nif->getBlock( nif->getLink( iProp, "Image" ), "NiImage" );
+			texture = nif->get<QString>( iImage, "File Name" );
+		} else if ( nif->isNiBlock( iProp, { "BSShaderNoLightingProperty", "SkyShaderProperty", "TileShaderProperty" } ) ) {
+			texture = nif->get<QString>( iProp, "File Name" );
+		} else if ( nif->isNiBlock( iProp, { "BSShaderPPLightingProperty", "Lighting30ShaderProperty", "BSLightingShaderProperty" } ) ) {
+			QModelIndex iTextures = nif->getIndex( nif->getBlock( nif->getLink( iProp, "Texture Set" ) ), "Textures" );
+			texture = nif->get<QString>( iTextures.child( 0, 0 ) );
+		} else if ( nif->isNiBlock( iProp, "BSEffectShaderProperty" ) ) {
+			texture = nif->get<QString>( iProp, "Source Texture" );
+		} else if ( nif->isNiBlock( iProp, "NiAlphaProperty" ) ) {
+			int flags = nif->get<int>( iProp, "Flags" );
+
+			if ( flags & 1 ) {
+				alphaMode = "BLEND";
+			} else if ( flags & 0x200 ) {
+				alphaMode = "MASK";
+				alphaCutoff = nif->get<int>( iProp, "Threshold" ) / 255.0f;
+			}
+		}
+	}
+
+	QJsonObject pbr{
+		{ "baseColorFactor", QJsonArray{ baseColor[0], baseColor[1], baseColor[2], baseColor[3] } },
+		{ "metallicFactor", 0.0 },
+		{ "roughnessFactor", 1.0 }
+	};
+
+	int tex = addTexture( texture );
+
+	if ( tex >= 0 )
+		pbr["baseColorTexture"] = QJsonObject{ { "index", tex } };
+
+	QJsonObject material{ { "pbrMetallicRoughness", pbr } };
+
+	QString name = nif->get<QString>( iShape, "Name" );
+
+	if ( !name.isEmpty() )
+		material["name"] = name;
+
+	if ( !alphaMode.isEmpty() )
+		material["alphaMode"] = alphaMode;
+
+	if ( alphaMode == "MASK" )
+		material["alphaCutoff"] = alphaCutoff;
+
+	materials.append( material );
+	return materials.count() - 1;
+}
+
+int GltfExporter::addTexture( const QString & file )
+{
+	if ( file.isEmpty() )
+		return -1;
+
+	QString path = QString( file ).replace( "\\", "/" );
+
+	auto it = textureOf.constFind( path.toLower() );
+
+	if ( it != textureOf.constEnd() )
+		return it.value();
+
+	images.append( QJsonObject{ { "uri", QString::fromLatin1( QUrl::toPercentEncoding( path, "/" ) ) } } );
+
+	// DDS images are only valid through the MSFT_texture_dds extension
+	QJsonObject texture;
+
+	if ( path.endsWith( ".dds", Qt::CaseInsensitive ) ) {
+		texture["extensions"] = QJsonObject{ { "MSFT_texture_dds", QJsonObject{ { "source", images.count() - 1 } } } };
+		usesDds = true;
+	} else {
+		texture["source"] = images.count() - 1;
+	}
+
+	textures.append( texture );
+	textureOf.insert( path.toLower(), textures.count() - 1 );
+
+	return textures.count() - 1;
+}
+
+void GltfExporter::addAnimation( const QModelIndex & iBlock, int node )
+{
+	QModelIndex iCtrl = nif->getBlock( nif->getLink( iBlock, "Controller" ) );
+
+	// Guard against controllers linked in a loop
+	for ( int c = 0; iCtrl.isValid() && c < 64; c++, iCtrl = nif->getBlock( nif->getLink( iCtrl, "Next Controller" ) ) ) {
+		if ( !nif->isNiBlock( iCtrl, { "NiTransformController", "NiKeyframeController" } ) )
+			continue;
+
+		QModelIndex iData;
+		QModelIndex iInterp = nif->getBlock( nif->getLink( iCtrl, "Interpolator" ), "NiTransformInterpolator" );
+
+		if ( iInterp.isValid() )
+			iData = nif->getBlock( nif->getLink( iInterp, "Data" ) );
+		else
+			iData = nif->getBlock( nif->getLink( iCtrl, "Data" ) );
+
+		if ( !nif->inherits( iData, "NiKeyframeData" ) )
+			continue;
+
+		QModelIndex iRotations = nif->getIndex( iData, "Rotations" );
+
+		if ( !iRotations.isValid() )
+			iRotations = iData;
+
+		QModelIndex iTranslations = nif->getIndex( iData, "Translations" );
+		QModelIndex iScales = nif->getIndex( iData, "Scales" );
+
+		float start = nif->get<float>( iCtrl, "Start Time" );
+		float stop = nif->get<float>( iCtrl, "Stop Time" );
+
+		if ( !( stop > start ) )
+			continue;
+
+		// Sample the keys, whatever their interpolation, at a fixed rate
+		int frames = qMax( 2, int( std::ceil( ( stop - start ) * bakeRate ) ) + 1 );
+
+		Transform rest( nif, iBlock );
+		QVector<float> times( frames );
+		QVector<Vector3> translations( frames );
+		QVector<float> rotations( frames * 4 );
+		QVector<Vector3> scales( frames );
+		bool hasTranslation = false, hasRotation = false, hasScale = false;
+		int lTrans = 0, lRotate = 0, lScale = 0;
+
+		for ( int f = 0; f < frames; f++ ) {
+			float time = start + ( stop - start ) * f / ( frames - 1 );
+			times[f] = time - start;
+
+			Transform tm = rest;
+			hasTranslation |= Controller::interpolate( tm.translation, iTranslations, time, lTrans );
+			hasRotation |= Controller::interpolate( tm.rotation, iRotations, time, lRotate );
+			hasScale |= Controller::interpolate( tm.scale, iScales, time, lScale );
+
+			translations[f] = tm.translation;
+			scales[f] = Vector3( tm.scale, tm.scale, tm.scale );
+
+			// Keep consecutive quaternions in the same hemisphere for linear interpolation
+			Quat q = tm.rotation.toQuat();
+			float sign = 1.0f;
+
+			if ( f > 0 ) {
+				float dot = rotations[f * 4 - 4] * q[1] + rotations[f * 4 - 3] * q[2] + rotations[f * 4 - 2] * q[3] + rotations[f * 4 - 1] * q[0];
+
+				if ( dot < 0.0f )
+					sign = -1.0f;
+			}
+
+			rotations[f * 4] = sign * q[1];
+			rotations[f * 4 + 1] = sign * q[2];
+			rotations[f * 4 + 2] = sign * q[3];
+			rotations[f * 4 + 3] = sign * q[0];
+		}
+
+		if ( !( hasTranslation || hasRotation || hasScale ) )
+			continue;
+
+		int input = addAccessor( times.constData(), frames, GltfFloat, "SCALAR", 1, 0, { 0.0 }, { times.last() } );
+
+		auto addChannel = [this, input, node]( const QString & path, int output ) {
+			samplers.append( QJsonObject{ { "input", input }, { "output", output }, { "interpolation", "LINEAR" } } );
+			channels.append( QJsonObject{
+				{ "sampler", samplers.count() - 1 },
+				{ "target", QJsonObject{ { "node", node }, { "path", path } } }
+			} );
+		};
+
+		if ( hasTranslation )
+			addChannel( "translation", addAccessor( translations.constData(), frames, GltfFloat, "VEC3", 3 ) );
+		if ( hasRotation )
+			addChannel( "rotation", addAccessor( rotations.constData(), frames, GltfFloat, "VEC4", 4 ) );
+		if ( hasScale )
+			addChannel( "scale", addAccessor( scales.constData(), frames, GltfFloat, "VEC3", 3 ) );
+	}
+}
+
+void GltfExporter::addSkins()
+{
+	for ( const PendingSkin & skin : pendingSkins ) {
+		QJsonArray joints;
+		bool missing = false;
+
+		// A bone which is not part of the export is replaced by the root node
+		for ( int b : skin.bones ) {
+			missing |= !nodeOf.contains( b );
+			joints.append( nodeOf.value( b, 0 ) );
+		}
+
+		if ( missing )
+			qCWarning( nsIo ) << tr( "The skin of %1 refers to bones which were not exported" ).arg( nodes[skin.node].value( "name" ).toString() );
+
+		QJsonObject obj{
+			{ "inverseBindMatrices", addAccessor( skin.inverseBinds.constData(), skin.inverseBinds.count(), GltfFloat, "MAT4", 16 ) },
+			{ "joints", joints }
+		};
+
+		if ( nodeOf.contains( skin.skeletonRoot ) )
+			obj["skeleton"] = nodeOf.value( skin.skeletonRoot );
+
+		skins.append( obj );
+		nodes[skin.node]["skin"] = skins.count() - 1;
+	}
+}
+
+//! Append a 32 bit little endian integer
+static void appendUInt32( QByteArray & out, quint32 value )
+{
+	value = qToLittleEndian( value );
+	out.append( reinterpret_cast<const char *>( &value ), 4 );
+}
+
+QByteArray GltfExporter::toGlb() const
+{
+	QJsonObject json;
+	json["asset"] = QJsonObject{ { "version", "2.0" }, { "generator", QString( "NifSkope %1" ).arg( NIFSKOPE_VERSION ) } };
+	json["scene"] = 0;
+	json["scenes"] = QJsonArray{ QJsonObject{ { "nodes", QJsonArray{ 0 } } } };
+
+	QJsonArray nodeArray;
+
+	for ( int n = 0; n < nodes.count(); n++ ) {
+		QJsonObject node = nodes[n];
+
+		if ( !children[n].isEmpty() )
+			node["children"] = children[n];
+
+		nodeArray.append( node );
+	}
+
+	json["nodes"] = nodeArray;
+
+	auto insert = [&json]( const QString & key, const QJsonArray & array ) {
+		if ( !array.isEmpty() )
+			json[key] = array;
+	};
+
+	insert( "meshes", meshes );
+	insert( "materials", materials );
+	insert( "textures", textures );
+	insert( "images", images );
+	insert( "skins", skins );
+	insert( "accessors", accessors );
+	insert( "bufferViews", bufferViews );
+
+	if ( !channels.isEmpty() )
+		json["animations"] = QJsonArray{ QJsonObject{ { "name", "Scene" }, { "channels", channels }, { "samplers", samplers } } };
+
+	if ( !bin.isEmpty() )
+		json["buffers"] = QJsonArray{ QJsonObject{ { "byteLength", bin.size() } } };
+
+	// The DDS textures have no fallback image, so a viewer without the extension must refuse the file
+	if ( usesDds ) {
+		json["extensionsUsed"] = QJsonArray{ "MSFT_texture_dds" };
+		json["extensionsRequired"] = QJsonArray{ "MSFT_texture_dds" };
+	}
+
+	// The JSON chunk is padded with spaces, the binary chunk already ends on 4 bytes
+	QByteArray text = QJsonDocument( json ).toJson( QJsonDocument::Compact );
+
+	while ( text.size() % 4 )
+		text.append( ' ' );
+
+	int length = 12 + 8 + text.size() + ( bin.isEmpty() ? 0 : 8 + bin.size() );
+
+	QByteArray glb;
+	glb.reserve( length );
+
+	appendUInt32( glb, 0x46546C67 ); // "glTF"
+	appendUInt32( glb, 2 );
+	appendUInt32( glb, length );
+
+	appendUInt32( glb, text.size() );
+	appendUInt32( glb, 0x4E4F534A ); // "JSON"
+	glb.append( text );
+
+	if ( !bin.isEmpty() ) {
+		appendUInt32( glb, bin.size() );
+		appendUInt32( glb, 0x004E4942 ); // "BIN"
+		glb.append( bin );
+	}
+
+	return glb;
+}
+
+//! Export the selected node or shape, or else the whole scene, to a GLB file without asking
+bool exportGltf( const NifModel * nif, const QModelIndex & index, QString fname )
+{
+	QList<int> blocks;
+	QModelIndex iBlock = nif->getBlock( index );
+
+	if ( iBlock.isValid() && ( nif->inherits( iBlock, "NiNode" ) || isShape( nif, iBlock ) ) )
+		blocks << nif->getBlockNumber( iBlock );
+	else
+		blocks = nif->getRootLinks();
+
+	if ( !fname.endsWith( ".glb", Qt::CaseInsensitive ) )
+		fname += ".glb";
+
+	// The keys are read from the model as it is now; a batch loads the next file into the same model without a scene
+	Controller::invalidateKeys();
+
+	GltfExporter gltf( nif );
+	gltf.exportBlocks( blocks );
+
+	QSaveFile file( fname );
+
+	if ( !file.open( QIODevice::WriteOnly ) || file.write( gltf.toGlb() ) < 0 || !file.commit() ) {
+		qCCritical( nsIo ) << tr( "Failed to write %1" ).arg( fname );
+		return false;
+	}
+
+	return true;
+}
+
+void exportGltf( const NifModel * nif, const QModelIndex & index )
+{
+	QSettings settings;
+	settings.beginGroup( "Import-Export" );
+	settings.beginGroup( "GLTF" );
+
+	QString fname = QFileDialog::getSaveFileName( qApp->activeWindow(), tr( "Choose a .GLB file for export" ), settings.value( "File Name" ).toString(), "glTF Binary (*.glb)" );
+
+	if ( fname.isEmpty() || !exportGltf( nif, index, fname ) )
+		return;
+
+	if ( !fname.endsWith( ".glb", Qt::CaseInsensitive ) )
+		fname += ".glb";
+
+	settings.setValue( "File Name", fname );
+
+	settings.endGroup(); // GLTF
+	settings.endGroup(); // Import-Export
+}
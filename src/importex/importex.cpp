@@ -43,6 +43,7 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 void exportObj( const NifModel * nif, const QModelIndex & index );
 void exportCol( const NifModel * nif, QFileInfo );
+void exportGltf( const NifModel * nif, const QModelIndex & index );
 void importObj( NifModel * nif, const QModelIndex & index );
 void import3ds( NifModel * nif, const QModelIndex & index );
 
@@ -50,6 +51,7 @@ void import3ds( NifModel * nif, const QModelIndex & index );
 void NifSkope::fillImportExportMenus()
 {
 	mExport->addAction( tr( "Export .OBJ" ) );
+	mExport->addAction( tr( "Export .GLB" ) );
 	//mExport->addAction( tr( "Export .DAE" ) );
 	mImport->addAction( tr( "Import .3DS" ) );
 	mImport->addAction( tr( "Import .OBJ" ) );
@@ -77,6 +79,8 @@ void NifSkope::sltImportExport( QAction * a )
 
 	if ( a->text() == tr( "Export .OBJ" ) )
 		exportObj( nif, index );
+	else if ( a->text() == tr( "Export .GLB" ) )
+		exportGltf( nif, index );
 	else if ( a->text() == tr( "Import .OBJ" ) )
 		importObj( nif, index );
 	else if ( a->text() == tr( "Import .3DS" ) )
@@ -32,6 +32,7 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "nifmodel.h"
 #include "nvtristripwrapper.h"
+#include "spellbook.h"
 #include "gl/gltex.h"
 
 #include <QApplication>
@@ -42,6 +43,10 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QRegularExpression>
 #include <QSettings>
 #include <QTextStream>
+#include <QThread>
+
+#include <cmath>
+#include <cstring>
 
 #define tr( x ) QApplication::tr( x )
 
@@ -55,145 +60,197 @@ QRegularExpression objCullRegExp;
  *  .OBJ EXPORT
  */
 
-static void writeData( const NifModel * nif, const QModelIndex & iData, QTextStream & obj, int ofs[1], Transform t )
+//! The geometry of a shape, read from the model before it is formatted
+struct ObjMesh
 {
-	// copy vertices
+	//! The lines before the geometry, such as the group and material
+	QByteArray header;
+	//! The transform to the scene
+	Transform t;
+	QVector<Vector3> verts;
+	QVector<Vector2> texco;
+	QVector<Vector3> norms;
+	QVector<Triangle> tris;
+	//! The indices of the first vertex, texcoord and normal in the file
+	int ofs[3] = { 1, 1, 1 };
+
+	//! The formatted geometry, see formatMesh()
+	QByteArray text;
+};
 
-	if ( nif->getUserVersion2() < 130 ) {
-		QVector<Vector3> verts = nif->getArray<Vector3>( iData, "Vertices" );
-		foreach( Vector3 v, verts )
-		{
-			v = t * v;
-			obj << "v " << qSetRealNumberPrecision( 17 ) << v[0] << " " << v[1] << " " << v[2] << "\r\n";
-		}
+//! Append the shortest of 6 to 9 significant digits which reads back as the same float
+static void appendFloat( QByteArray & out, float f )
+{
+	QByteArray num;
 
-		// copy texcoords
+	for ( int p = 6; p <= 9; p++ ) {
+		num = QByteArray::number( f, 'g', p );
 
-		QModelIndex iUV = nif->getIndex( iData, "UV Sets" );
+		if ( p == 9 || num.toFloat() == f )
+			break;
+	}
 
-		if ( !iUV.isValid() )
-			iUV = nif->getIndex( iData, "UV Sets 2" );
+	out += num;
+}
 
-		QVector<Vector2> texco = nif->getArray<Vector2>( iUV.child( 0, 0 ) );
-		foreach( Vector2 t, texco )
-		{
-			obj << "vt " << t[0] << " " << 1.0 - t[1] << "\r\n";
-		}
+//! Format the geometry of a mesh; only touches the mesh, so it may run on any thread
+static void formatMesh( ObjMesh & mesh )
+{
+	QByteArray & out = mesh.text;
+	out.reserve( mesh.header.size() + ( mesh.verts.count() + mesh.texco.count() + mesh.norms.count() ) * 36 + mesh.tris.count() * 40 );
+	out += mesh.header;
+
+	for ( Vector3 v : mesh.verts ) {
+		v = mesh.t * v;
+		out += "v ";
+		appendFloat( out, v[0] );
+		out += ' ';
+		appendFloat( out, v[1] );
+		out += ' ';
+		appendFloat( out, v[2] );
+		out += "\r\n";
+	}
 
-		// copy normals
+	for ( const Vector2 & c : mesh.texco ) {
+		out += "vt ";
+		appendFloat( out, c[0] );
+		out += ' ';
+		appendFloat( out, 1.0f - c[1] );
+		out += "\r\n";
+	}
 
-		QVector<Vector3> norms = nif->getArray<Vector3>( iData, "Normals" );
-		foreach( Vector3 n, norms )
-		{
-			n = t.rotation * n;
-			obj << "vn " << n[0] << " " << n[1] << " " << n[2] << "\r\n";
-		}
+	for ( Vector3 n : mesh.norms ) {
+		n = mesh.t.rotation * n;
+		out += "vn ";
+		appendFloat( out, n[0] );
+		out += ' ';
+		appendFloat( out, n[1] );
+		out += ' ';
+		appendFloat( out, n[2] );
+		out += "\r\n";
+	}
 
-		// get the triangles
+	bool hasTexco = !mesh.texco.isEmpty();
+	bool hasNorms = !mesh.norms.isEmpty();
 
-		QVector<Triangle> tris;
+	for ( const Triangle & t : mesh.tris ) {
+		out += 'f';
 
-		QModelIndex iPoints = nif->getIndex( iData, "Points" );
+		for ( int p = 0; p < 3; p++ ) {
+			out += ' ';
+			out += QByteArray::number( mesh.ofs[0] + t[p] );
 
-		if ( iPoints.isValid() ) {
-			QList<QVector<quint16> > strips;
+			if ( hasNorms ) {
+				out += '/';
 
-			for ( int r = 0; r < nif->rowCount( iPoints ); r++ )
-				strips.append( nif->getArray<quint16>( iPoints.child( r, 0 ) ) );
+				if ( hasTexco )
+					out += QByteArray::number( mesh.ofs[1] + t[p] );
 
-			tris = triangulate( strips );
-		} else {
-			tris = nif->getArray<Triangle>( iData, "Triangles" );
+				out += '/';
+				out += QByteArray::number( mesh.ofs[2] + t[p] );
+			} else if ( hasTexco ) {
+				out += '/';
+				out += QByteArray::number( mesh.ofs[1] + t[p] );
+			}
 		}
 
-		// write the triangles
-
-		foreach( Triangle t, tris )
-		{
-			obj << "f";
-
-			for ( int p = 0; p < 3; p++ ) {
-				obj << " " << ofs[0] + t[p];
-
-				if ( norms.count() )
-					if ( texco.count() )
-						obj << "/" << ofs[1] + t[p] << "/" << ofs[2] + t[p];
-					else
-						obj << "//" << ofs[2] + t[p];
-
+		out += "\r\n";
+	}
+}
 
-				else if ( texco.count() )
-					obj << "/" << ofs[1] + t[p];
-			}
+//! Start a mesh after the meshes read so far
+static ObjMesh & addMesh( QVector<ObjMesh> & meshes, const Transform & t, int ofs[3] )
+{
+	meshes.append( ObjMesh() );
+	ObjMesh & mesh = meshes.last();
+	mesh.t = t;
+	mesh.ofs[0] = ofs[0];
+	mesh.ofs[1] = ofs[1];
+	mesh.ofs[2] = ofs[2];
+
+	return mesh;
+}
 
-			obj << "\r\n";
-		}
+//! Finish a mesh, moving the offsets past its geometry
+static void endMesh( ObjMesh & mesh, int ofs[3] )
+{
+	ofs[0] += mesh.verts.count();
+	ofs[1] += mesh.texco.count();
+	ofs[2] += mesh.norms.count();
+}
 
-		ofs[0] += verts.count();
-		ofs[1] += texco.count();
-		ofs[2] += norms.count();
-	} else {
-		auto iVertData = nif->getIndex( iData, "Vertex Data" );
-		if ( !iVertData.isValid() )
-			return;
+static void readData( const NifModel * nif, const QModelIndex & iData, QVector<ObjMesh> & meshes, int ofs[3], Transform t )
+{
+	ObjMesh & mesh = addMesh( meshes, t, ofs );
 
-		QVector<Vector3> verts;
-		QVector<Vector2> coords;
-		QVector<Vector3> norms;
+	if ( nif->getUserVersion2() < 130 ) {
+		mesh.verts = nif->getArray<Vector3>( iData, "Vertices" );
 
-		auto numVerts = nif->get<int>( iData, "Num Vertices" );
-		for ( int i = 0; i < numVerts; i++ ) {
-			auto idx = nif->index( i, 0, iVertData );
+		// copy texcoords
 
-			verts += nif->get<Vector3>( idx, "Vertex" );
-			coords += nif->get<HalfVector2>( idx, "UV" );
-			norms += nif->get<ByteVector3>( idx, "Normal" );
-		}
+		QModelIndex iUV = nif->getIndex( iData, "UV Sets" );
 
-		for ( Vector3 & v : verts ) {
-			v = t * v;
-			obj << "v " << qSetRealNumberPrecision( 17 ) << v[0] << " " << v[1] << " " << v[2] << "\r\n";
-		}
+		if ( !iUV.isValid() )
+			iUV = nif->getIndex( iData, "UV Sets 2" );
 
-		for ( Vector2 & c : coords ) {
-			obj << "vt " << c[0] << " " << 1.0 - c[1] << "\r\n";
-		}
+		mesh.texco = nif->getArray<Vector2>( iUV.child( 0, 0 ) );
 
-		for ( Vector3 & n : norms ) {
-			n = t.rotation * n;
-			obj << "vn " << n[0] << " " << n[1] << " " << n[2] << "\r\n";
-		}
+		// copy normals
 
-		auto tris = nif->getArray<Triangle>( iData, "Triangles" );
+		mesh.norms = nif->getArray<Vector3>( iData, "Normals" );
 
-		for ( const Triangle & t : tris ) {
-			obj << "f";
+		// get the triangles
 
-			for ( int p = 0; p < 3; p++ ) {
-				obj << " " << ofs[0] + t[p];
+		QModelIndex iPoints = nif->getIndex( iData, "Points" );
 
-				if ( norms.count() )
-					if ( coords.count() )
-						obj << "/" << ofs[1] + t[p] << "/" << ofs[2] + t[p];
-					else
-						obj << "//" << ofs[2] + t[p];
+		if ( iPoints.isValid() ) {
+			QList<QVector<quint16> > strips;
 
+			for ( int r = 0; r < nif->rowCount( iPoints ); r++ )
+				strips.append( nif->getArray<quint16>( iPoints.child( r, 0 ) ) );
 
-				else if ( coords.count() )
-					obj << "/" << ofs[1] + t[p];
+			mesh.tris = triangulate( strips );
+		} else {
+			mesh.tris = nif->getArray<Triangle>( iData, "Triangles" );
+		}
+	} else {
+		auto iVertData = nif->getIndex( iData, "Vertex Data" );
+		auto numVerts = qMin( nif->get<int>( iData, "Num Vertices" ), nif->rowCount( iVertData ) );
+
+		if ( numVerts > 0 ) {
+			// Every vertex has the same fields, find their rows once
+			static const NifFieldId fVertex( "Vertex" );
+			static const NifFieldId fUV( "UV" );
+			static const NifFieldId fNormal( "Normal" );
+
+			auto first = nif->index( 0, 0, iVertData );
+			int rVertex = nif->getIndex( first, fVertex ).row();
+			int rUV = nif->getIndex( first, fUV ).row();
+			int rNormal = nif->getIndex( first, fNormal ).row();
+
+			mesh.verts.resize( numVerts );
+			mesh.texco.resize( numVerts );
+			mesh.norms.resize( numVerts );
+
+			for ( int i = 0; i < numVerts; i++ ) {
+				auto idx = nif->index( i, 0, iVertData );
+
+				if ( rVertex >= 0 )
+					mesh.verts[i] = nif->get<Vector3>( nif->index( rVertex, 0, idx ) );
+				if ( rUV >= 0 )
+					mesh.texco[i] = nif->get<HalfVector2>( nif->index( rUV, 0, idx ) );
+				if ( rNormal >= 0 )
+					mesh.norms[i] = nif->get<ByteVector3>( nif->index( rNormal, 0, idx ) );
 			}
 
-			obj << "\r\n";
+			mesh.tris = nif->getArray<Triangle>( iData, "Triangles" );
 		}
-
-		ofs[0] += verts.count();
-		ofs[1] += coords.count();
-		ofs[2] += norms.count();
 	}
-	
+
+	endMesh( mesh, ofs );
 }
 
-static void writeShape( const NifModel * nif, const QModelIndex & iShape, QTextStream & obj, QTextStream & mtl, int ofs[], Transform t )
+static void readShape( const NifModel * nif, const QModelIndex & iShape, QVector<ObjMesh> & meshes, QTextStream & mtl, int ofs[], Transform t )
 {
 	QString name = nif->get<QString>( iShape, "Name" );
 	QString matn = name, map_Kd, map_Ks, map_Ns, map_d, disp, decal, bump;
@@ -265,15 +322,15 @@ static void writeShape( const NifModel * nif, const QModelIndex & iShape, QTextS
 	if ( !bump.isEmpty() )
 		mtl << "bump " << decal << "\r\n\r\n";
 
-	obj << "\r\n# " << name << "\r\n\r\ng " << name << "\r\n" << "usemtl " << matn << "\r\n\r\n";
-
 	if ( nif->getUserVersion2() < 130 )
-		writeData( nif, nif->getBlock( nif->getLink( iShape, "Data" ) ), obj, ofs, t );
+		readData( nif, nif->getBlock( nif->getLink( iShape, "Data" ) ), meshes, ofs, t );
 	else
-		writeData( nif, iShape, obj, ofs, t );
+		readData( nif, iShape, meshes, ofs, t );
+
+	meshes.last().header = QString( "\r\n# " + name + "\r\n\r\ng " + name + "\r\n" + "usemtl " + matn + "\r\n\r\n" ).toUtf8();
 }
 
-static void writeParent( const NifModel * nif, const QModelIndex & iNode, QTextStream & obj, QTextStream & mtl, int ofs[], Transform t )
+static void readParent( const NifModel * nif, const QModelIndex & iNode, QVector<ObjMesh> & meshes, QTextStream & mtl, int ofs[], Transform t )
 {
 	// export culling
 	if ( objCulling && !objCullRegExp.pattern().isEmpty() && nif->get<QString>( iNode, "Name" ).contains( objCullRegExp ) )
@@ -284,11 +341,11 @@ static void writeParent( const NifModel * nif, const QModelIndex & iNode, QTextS
 		QModelIndex iChild = nif->getBlock( l );
 
 		if ( nif->inherits( iChild, "NiNode" ) )
-			writeParent( nif, iChild, obj, mtl, ofs, t );
+			readParent( nif, iChild, meshes, mtl, ofs, t );
 		else if ( nif->isNiBlock( iChild, { "NiTriShape", "NiTriStrips" } ) )
-			writeShape( nif, iChild, obj, mtl, ofs, t * Transform( nif, iChild ) );
+			readShape( nif, iChild, meshes, mtl, ofs, t * Transform( nif, iChild ) );
 		else if ( nif->isNiBlock( iChild, { "BSTriShape", "BSSubIndexTriShape", "BSMeshLODTriShape" } ) )
-			writeShape( nif, iChild, obj, mtl, ofs, t * Transform( nif, iChild ) );
+			readShape( nif, iChild, meshes, mtl, ofs, t * Transform( nif, iChild ) );
 		else if ( nif->inherits( iChild, "NiCollisionObject" ) ) {
 			QModelIndex iBody = nif->getBlock( nif->getLink( iChild, "Body" ) );
 
@@ -310,94 +367,72 @@ static void writeParent( const NifModel * nif, const QModelIndex & iNode, QTextS
 						QModelIndex iData = nif->getBlock( nif->getLink( iShape, "Data" ) );
 
 						if ( nif->isNiBlock( iData, "hkPackedNiTriStripsData" ) ) {
-							bt = t * bt;
-							obj << "\r\n# bhkPackedNiTriStripsShape\r\n\r\ng collision\r\n" << "usemtl collision\r\n\r\n";
-							QVector<Vector3> verts = nif->getArray<Vector3>( iData, "Vertices" );
-							foreach ( Vector3 v, verts ) {
-								v = bt * v;
-								obj << "v " << v[0] << " " << v[1] << " " << v[2] << "\r\n";
-							}
+							ObjMesh & mesh = addMesh( meshes, t * bt, ofs );
+							mesh.header = "\r\n# bhkPackedNiTriStripsShape\r\n\r\ng collision\r\nusemtl collision\r\n\r\n";
+							mesh.verts = nif->getArray<Vector3>( iData, "Vertices" );
 
 							QModelIndex iTris = nif->getIndex( iData, "Triangles" );
+							int numTris = nif->rowCount( iTris );
+
+							// Every triangle has the same fields, find their rows once
+							static const NifFieldId fTriangle( "Triangle" );
+							static const NifFieldId fNormal( "Normal" );
+							int rTriangle = ( numTris > 0 ) ? nif->getIndex( iTris.child( 0, 0 ), fTriangle ).row() : -1;
+							int rNormal = ( numTris > 0 ) ? nif->getIndex( iTris.child( 0, 0 ), fNormal ).row() : -1;
+
+							mesh.tris.reserve( numTris );
 
-							for ( int t = 0; t < nif->rowCount( iTris ); t++ ) {
-								Triangle tri = nif->get<Triangle>( iTris.child( t, 0 ), "Triangle" );
-								Vector3 n = nif->get<Vector3>( iTris.child( t, 0 ), "Normal" );
+							for ( int t = 0; t < numTris; t++ ) {
+								QModelIndex iTri = iTris.child( t, 0 );
+								Triangle tri = nif->get<Triangle>( iTri.child( rTriangle, 0 ) );
+								Vector3 n = nif->get<Vector3>( iTri.child( rNormal, 0 ) );
 
-								Vector3 a = verts.value( tri[0] );
-								Vector3 b = verts.value( tri[1] );
-								Vector3 c = verts.value( tri[2] );
+								Vector3 a = mesh.verts.value( tri[0] );
+								Vector3 b = mesh.verts.value( tri[1] );
+								Vector3 c = mesh.verts.value( tri[2] );
 
 								Vector3 fn = Vector3::crossproduct( b - a, c - a );
 								fn.normalize();
 
-								bool flip = Vector3::dotproduct( n, fn ) < 0;
+								// Face the triangle along its normal
+								if ( Vector3::dotproduct( n, fn ) < 0 )
+									tri.set( tri[0], tri[2], tri[1] );
 
-								obj << "f"
-								    << " " << tri[0] + ofs[0]
-								    << " " << tri[ flip ? 2 : 1 ] + ofs[0]
-								    << " " << tri[ flip ? 1 : 2 ] + ofs[0]
-								    << "\r\n";
+								mesh.tris << tri;
 							}
 
-							ofs[0] += verts.count();
+							endMesh( mesh, ofs );
 						}
 					}
 				} else if ( nif->isNiBlock( iShape, "bhkNiTriStripsShape" ) ) {
 					bt.scale = 1;
-					obj << "\r\n# bhkNiTriStripsShape\r\n\r\ng collision\r\n" << "usemtl collision\r\n\r\n";
 					QModelIndex iStrips = nif->getIndex( iShape, "Strips Data" );
 
-					for ( int r = 0; r < nif->rowCount( iStrips ); r++ )
-						writeData( nif, nif->getBlock( nif->getLink( iStrips.child( r, 0 ) ), "NiTriStripsData" ), obj, ofs, t * bt );
+					for ( int r = 0; r < nif->rowCount( iStrips ); r++ ) {
+						readData( nif, nif->getBlock( nif->getLink( iStrips.child( r, 0 ) ), "NiTriStripsData" ), meshes, ofs, t * bt );
+
+						if ( r == 0 )
+							meshes.last().header = "\r\n# bhkNiTriStripsShape\r\n\r\ng collision\r\nusemtl collision\r\n\r\n";
+					}
 				}
 			}
 		}
 	}
 }
 
-void exportObj( const NifModel * nif, const QModelIndex & index )
+//! Export the selected node or shape, or else the whole scene, to an OBJ and MTL file without asking
+bool exportObj( const NifModel * nif, const QModelIndex & index, QString fname )
 {
 	//objCulling = Options::get()->exportCullEnabled();
 	//objCullRegExp = Options::get()->cullExpression();
 
-	//--Determine how the file will export, and be sure the user wants to continue--//
 	QList<int> roots;
 	QModelIndex iBlock = nif->getBlock( index );
 
-	QString question;
-
-	if ( iBlock.isValid() ) {
-		roots.append( nif->getBlockNumber( index ) );
-
-		if ( nif->itemName( index ) == "NiNode" ) {
-			question = tr( "NiNode selected.  All children of selected node will be exported." );
-		} else if ( nif->itemName( index ) == "NiTriShape" || nif->itemName( index ) == "NiTriStrips" ) {
-			question = nif->itemName( index ) + tr( " selected.  Selected mesh will be exported." );
-		}
-	}
-
-	if ( question.size() == 0 ) {
-		question = tr( "No NiNode, NiTriShape,or NiTriStrips is selected.  Entire scene will be exported." );
+	if ( iBlock.isValid() && nif->isNiBlock( iBlock, { "NiNode", "NiTriShape", "NiTriStrips" } ) )
+		roots.append( nif->getBlockNumber( iBlock ) );
+	else
 		roots = nif->getRootLinks();
-	}
-
-	int result = QMessageBox::question( 0, tr( "Export OBJ" ), question, QMessageBox::Ok, QMessageBox::Cancel );
-
-	if ( result == QMessageBox::Cancel ) {
-		return;
-	}
-
-	//--Allow the user to select the file--//
-
-	QSettings settings;
-	settings.beginGroup( "Import-Export" );
-	settings.beginGroup( "OBJ" );
-
-	QString fname = QFileDialog::getSaveFileName( qApp->activeWindow(), tr( "Choose a .OBJ file for export" ), settings.value( "File Name" ).toString(), "OBJ (*.obj)" );
-
-	if ( fname.isEmpty() )
-		return;
 
 	while ( fname.endsWith( ".obj", Qt::CaseInsensitive ) )
 		fname = fname.left( fname.length() - 4 );
@@ -406,14 +441,14 @@ void exportObj( const NifModel * nif, const QModelIndex & index )
 
 	if ( !fobj.open( QIODevice::WriteOnly ) ) {
 		qCCritical( nsIo ) << tr( "Failed to write %1" ).arg( fobj.fileName() );
-		return;
+		return false;
 	}
 
 	QFile fmtl( fname + ".mtl" );
 
 	if ( !fmtl.open( QIODevice::WriteOnly ) ) {
 		qCCritical( nsIo ) << tr( "Failed to write %1" ).arg( fmtl.fileName() );
-		return;
+		return false;
 	}
 
 	fname = fmtl.fileName();
@@ -422,13 +457,14 @@ void exportObj( const NifModel * nif, const QModelIndex & index )
 	if ( i >= 0 )
 		fname = fname.remove( 0, i + 1 );
 
-	QTextStream sobj( &fobj );
 	QTextStream smtl( &fmtl );
 
-	sobj << "# exported with NifSkope\r\n\r\n" << "mtllib " << fname << "\r\n";
+	fobj.write( "# exported with NifSkope\r\n\r\nmtllib " + fname.toUtf8() + "\r\n" );
 
 	//--Translate NIF structure into file structure --//
 
+	// Read the geometry in file order, with the offsets of every mesh known up front
+	QVector<ObjMesh> meshes;
 	int ofs[3] = {
 		1, 1, 1
 	};
@@ -436,12 +472,70 @@ void exportObj( const NifModel * nif, const QModelIndex & index )
 		QModelIndex iBlock = nif->getBlock( l );
 
 		if ( nif->inherits( iBlock, "NiNode" ) )
-			writeParent( nif, iBlock, sobj, smtl, ofs, Transform() );
+			readParent( nif, iBlock, meshes, smtl, ofs, Transform() );
 		else if ( nif->isNiBlock( iBlock, { "NiTriShape", "NiTriStrips" } ) )
-			writeShape( nif, iBlock, sobj, smtl, ofs, Transform() );
+			readShape( nif, iBlock, meshes, smtl, ofs, Transform() );
 	}
 
-	settings.setValue( "File Name", fobj.fileName() );
+	// Format a batch of meshes in parallel and write them in order, keeping only one batch of text in memory
+	int batch = qMax( 1, QThread::idealThreadCount() ) * 4;
+
+	for ( int first = 0; first < meshes.count(); first += batch ) {
+		int count = qMin( batch, meshes.count() - first );
+
+		Spell::parallelFor( count, [&meshes, first]( int m ) {
+			formatMesh( meshes[first + m] );
+		} );
+
+		for ( int m = first; m < first + count; m++ ) {
+			fobj.write( meshes[m].text );
+			meshes[m] = ObjMesh();
+		}
+	}
+
+	return true;
+}
+
+void exportObj( const NifModel * nif, const QModelIndex & index )
+{
+	//--Be sure the user wants to continue--//
+	QModelIndex iBlock = nif->getBlock( index );
+
+	QString question;
+
+	if ( iBlock.isValid() ) {
+		if ( nif->itemName( index ) == "NiNode" ) {
+			question = tr( "NiNode selected.  All children of selected node will be exported." );
+		} else if ( nif->itemName( index ) == "NiTriShape" || nif->itemName( index ) == "NiTriStrips" ) {
+			question = nif->itemName( index ) + tr( " selected.  Selected mesh will be exported." );
+		}
+	}
+
+	if ( question.size() == 0 ) {
+		question = tr( "No NiNode, NiTriShape,or NiTriStrips is selected.  Entire scene will be exported." );
+	}
+
+	int result = QMessageBox::question( 0, tr( "Export OBJ" ), question, QMessageBox::Ok, QMessageBox::Cancel );
+
+	if ( result == QMessageBox::Cancel ) {
+		return;
+	}
+
+	//--Allow the user to select the file--//
+
+	QSettings settings;
+	settings.beginGroup( "Import-Export" );
+	settings.beginGroup( "OBJ" );
+
+	QString fname = QFileDialog::getSaveFileName( qApp->activeWindow(), tr( "Choose a .OBJ file for export" ), settings.value( "File Name" ).toString(), "OBJ (*.obj)" );
+
+	if ( fname.isEmpty() || !exportObj( nif, index, fname ) )
+		return;
+
+	if ( !fname.endsWith( ".obj", Qt::CaseInsensitive ) )
+		fname += ".obj";
+
+	settings.setValue( "File Name", fname );
 
 	settings.endGroup(); // OBJ
 	settings.endGroup(); // Import-Export
@@ -464,11 +558,158 @@ struct ObjPoint
 	}
 };
 
+inline uint qHash( const ObjPoint & p, uint seed = 0 )
+{
+	return ( ( uint( p.v ) * 73856093u ) ^ ( uint( p.t ) * 19349663u ) ^ ( uint( p.n ) * 83492791u ) ) ^ seed;
+}
+
 struct ObjFace
 {
 	ObjPoint p[3];
 };
 
+//! The welded geometry of the faces of a material, see weldFaces()
+struct ObjShape
+{
+	QString material;
+	QVector<Vector3> verts;
+	QVector<Vector3> norms;
+	QVector<Vector2> texco;
+	QVector<Triangle> triangles;
+};
+
+//! A token on a line of an OBJ file, pointing into the file contents
+struct ObjToken
+{
+	const char * s;
+	int n;
+
+	bool is( const char * keyword ) const
+	{
+		return int( qstrlen( keyword ) ) == n && memcmp( s, keyword, n ) == 0;
+	}
+
+	QString toString() const
+	{
+		return QString::fromUtf8( s, n );
+	}
+};
+
+//! Reads the lines of an OBJ file in place, without copying them into strings
+class ObjTokenizer
+{
+public:
+	ObjTokenizer( const char * data, qint64 size ) : p( data ), end( data + size ) {}
+
+	bool atEnd() const { return p >= end; }
+
+	//! Skip the rest of the line and its line break
+	void nextLine()
+	{
+		while ( p < end && *p != '\n' )
+			p++;
+
+		if ( p < end )
+			p++;
+	}
+
+	//! Whether there are no more tokens on the line
+	bool atEol()
+	{
+		skipSpace();
+		return p >= end || *p == '\n' || *p == '\r' || *p == '#';
+	}
+
+	//! The next token on the line, empty at the end of the line
+	ObjToken token()
+	{
+		skipSpace();
+		const char * s = p;
+
+		while ( p < end && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r' )
+			p++;
+
+		return { s, int( p - s ) };
+	}
+
+	//! The next token as a number, 0 if it is missing
+	double number()
+	{
+		ObjToken t = token();
+		return parseNumber( t.s, t.s + t.n );
+	}
+
+	//! Parse a decimal number in the C locale
+	static double parseNumber( const char * s, const char * e )
+	{
+		bool neg = false;
+
+		if ( s < e && ( *s == '-' || *s == '+' ) )
+			neg = ( *s++ == '-' );
+
+		// Keep the 19 leading significant digits which fit in the mantissa
+		quint64 mant = 0;
+		int digits = 0, exp = 0;
+
+		for ( ; s < e && *s >= '0' && *s <= '9'; s++ ) {
+			if ( digits < 19 ) {
+				mant = mant * 10 + ( *s - '0' );
+				digits += ( mant != 0 );
+			} else {
+				exp++;
+			}
+		}
+
+		if ( s < e && *s == '.' ) {
+			for ( s++; s < e && *s >= '0' && *s <= '9'; s++ ) {
+				if ( digits < 19 ) {
+					mant = mant * 10 + ( *s - '0' );
+					digits += ( mant != 0 );
+					exp--;
+				}
+			}
+		}
+
+		if ( s < e && ( *s == 'e' || *s == 'E' ) )
+			exp += parseIndex( ++s, e );
+
+		double value = double( mant );
+
+		if ( exp > 0 )
+			value *= std::pow( 10.0, exp );
+		else if ( exp < 0 )
+			value /= std::pow( 10.0, -exp );
+
+		return neg ? -value : value;
+	}
+
+	//! Parse an integer up to the next non digit, moving \a s past it
+	static int parseIndex( const char *& s, const char * e )
+	{
+		bool neg = false;
+
+		if ( s < e && ( *s == '-' || *s == '+' ) )
+			neg = ( *s++ == '-' );
+
+		int value = 0;
+
+		for ( ; s < e && *s >= '0' && *s <= '9'; s++ )
+			value = value * 10 + ( *s - '0' );
+
+		return neg ? -value : value;
+	}
+
+private:
+	void skipSpace()
+	{
+		while ( p < end && ( *p == ' ' || *p == '\t' ) )
+			p++;
+	}
+
+	const char * p;
+	const char * end;
+};
+
 struct ObjMaterial
 {
 	Color3 Ka, Kd, Ks;
@@ -528,6 +769,50 @@ static void readMtlLib( const QString & fname, QMap<QString, ObjMaterial> & omat
 		omaterials.insert( mtlid, mtl );
 }
 
+//! Weld the corners of the faces which share a vertex, texcoord and normal
+/*!
+ * A shape can only index 65536 vertices, so the faces are split into as
+ * many shapes as needed.
+ */
+static void weldFaces( const QString & material, const QVector<ObjFace> & faces, const QVector<Vector3> & overts, const QVector<Vector2> & otexco, const QVector<Vector3> & onorms, QVector<ObjShape> & shapes )
+{
+	const int maxVerts = 0x10000;
+
+	QHash<ObjPoint, int> welded;
+	welded.reserve( qMin( faces.count() * 3, maxVerts ) );
+
+	ObjShape * shape = nullptr;
+
+	for ( const ObjFace & face : faces ) {
+		// Start a new shape when the corners of the face might not fit
+		if ( !shape || shape->verts.count() > maxVerts - 3 ) {
+			shapes.append( ObjShape() );
+			shape = &shapes.last();
+			shape->material = material;
+			welded.clear();
+		}
+
+		Triangle tri;
+
+		for ( int c = 0; c < 3; c++ ) {
+			const ObjPoint & p = face.p[c];
+			auto it = welded.constFind( p );
+
+			if ( it == welded.constEnd() ) {
+				tri[c] = shape->verts.count();
+				welded.insert( p, tri[c] );
+				shape->verts.append( overts.value( p.v ) );
+				shape->norms.append( onorms.value( p.n ) );
+				shape->texco.append( otexco.value( p.t ) );
+			} else {
+				tri[c] = it.value();
+			}
+		}
+
+		shape->triangles.append( tri );
+	}
+}
+
 static void addLink( NifModel * nif, QModelIndex iBlock, QString name, qint32 link )
 {
 	QModelIndex iArray = nif->getIndex( iBlock, name );
@@ -538,9 +823,10 @@ static void addLink( NifModel * nif, QModelIndex iBlock, QString name, qint32 li
 	nif->setLink( iArray.child( numIndices, 0 ), link );
 }
 
-void importObj( NifModel * nif, const QModelIndex & index )
+//! Import an OBJ file over the selected node or shape without asking, returning false if it failed
+bool importObj( NifModel * nif, const QModelIndex & index, const QString & fname )
 {
-	//--Determine how the file will import, and be sure the user wants to continue--//
+	//--Determine where the meshes are imported to--//
 
 	// If no existing node is selected, create a group node.  Otherwise use selected node
 	QPersistentModelIndex iNode, iShape, iMaterial, iData, iTexProp, iTexSource;
@@ -549,8 +835,8 @@ void importObj( NifModel * nif, const QModelIndex & index )
 
 	//Be sure the user hasn't clicked on a NiTriStrips object
 	if ( iBlock.isValid() && nif->itemName( iBlock ) == "NiTriStrips" ) {
-		QMessageBox::information( 0, tr( "Import OBJ" ), tr( "You cannot import an OBJ file over a NiTriStrips object.  Please convert it to a NiTriShape object first by right-clicking and choosing Mesh > Triangulate" ) );
-		return;
+		qCCritical( nsIo ) << tr( "You cannot import an OBJ file over a NiTriStrips object." );
+		return false;
 	}
 
 	if ( iBlock.isValid() && nif->itemName( iBlock ) == "NiNode" ) {
@@ -599,120 +885,100 @@ void importObj( NifModel * nif, const QModelIndex & index )
 		}
 	}
 
-	QString question;
-
-	if ( iNode.isValid() == true ) {
-		if ( iShape.isValid() == true ) {
-			question = tr( "NiTriShape selected.  The first imported mesh will replace the selected one." );
-		} else {
-			question = tr( "NiNode selected.  Meshes will be attached to the selected node." );
-		}
-	} else {
-		question = tr( "No NiNode or NiTriShape selected.  Meshes will be imported to the root of the file." );
-	}
-
-	int result = QMessageBox::question( 0, tr( "Import OBJ" ), question, QMessageBox::Ok, QMessageBox::Cancel );
-
-	if ( result == QMessageBox::Cancel ) {
-		return;
-	}
-
 	//--Read the file--//
 
-	QSettings settings;
-	settings.beginGroup( "Import-Export" );
-	settings.beginGroup( "OBJ" );
-
-	QString fname = QFileDialog::getOpenFileName( qApp->activeWindow(), tr( "Choose a .OBJ file to import" ), settings.value( "File Name" ).toString(), "OBJ (*.obj)" );
-
-	if ( fname.isEmpty() )
-		return;
-
 	QFile fobj( fname );
 
 	if ( !fobj.open( QIODevice::ReadOnly ) ) {
 		qCCritical( nsIo ) << tr( "Failed to read %1" ).arg( fobj.fileName() );
-		return;
+		return false;
+	}
+
+	// Map the file if possible instead of reading it into memory
+	QByteArray contents;
+	qint64 size = fobj.size();
+	const char * data = reinterpret_cast<const char *>( fobj.map( 0, size ) );
+
+	if ( !data ) {
+		contents = fobj.readAll();
+		data = contents.constData();
+		size = contents.size();
 	}
 
-	QTextStream sobj( &fobj );
+	ObjTokenizer sobj( data, size );
 
 	QVector<Vector3> overts;
 	QVector<Vector3> onorms;
 	QVector<Vector2> otexco;
-	QMap<QString, QVector<ObjFace> *> ofaces;
+	QMap<QString, QVector<ObjFace> > ofaces;
 	QMap<QString, ObjMaterial> omaterials;
 
-	QVector<ObjFace> * mfaces = new QVector<ObjFace>();
-
 	QString usemtl = "None";
-	ofaces.insert( usemtl, mfaces );
+	QVector<ObjFace> * mfaces = &ofaces[usemtl];
 
-	while ( !sobj.atEnd() ) {
+	for ( ; !sobj.atEnd(); sobj.nextLine() ) {
 		// parse each line of the file
-		QString line = sobj.readLine();
+		ObjToken t = sobj.token();
+
+		if ( t.is( "v" ) ) {
+			double x = sobj.number(), y = sobj.number(), z = sobj.number();
+			overts.append( Vector3( x, y, z ) );
+		} else if ( t.is( "vt" ) ) {
+			double u = sobj.number(), v = sobj.number();
+			otexco.append( Vector2( u, 1.0 - v ) );
+		} else if ( t.is( "vn" ) ) {
+			double x = sobj.number(), y = sobj.number(), z = sobj.number();
+			onorms.append( Vector3( x, y, z ) );
+		} else if ( t.is( "f" ) ) {
+			ObjPoint points[4];
+			int count = 0;
+
+			while ( !sobj.atEol() ) {
+				if ( count == 4 ) {
+					qCCritical( nsNif ) << tr( "Please triangulate your mesh before import." );
+					return false;
+				}
 
-		QStringList t = line.split( " ", QString::SkipEmptyParts );
+				// v, v/t, v//n or v/t/n, with negative indices counting back from the last
+				ObjToken c = sobj.token();
+				const char * s = c.s;
+				const char * e = c.s + c.n;
+				int idx[3] = { 0, 0, 0 };
 
-		if ( t.value( 0 ) == "mtllib" ) {
-			readMtlLib( fname.left( qMax( fname.lastIndexOf( "/" ), fname.lastIndexOf( "\\" ) ) + 1 ) + t.value( 1 ), omaterials );
-		} else if ( t.value( 0 ) == "usemtl" ) {
-			usemtl = t.value( 1 );
-			//if ( usemtl.contains( "_" ) )
-			//	usemtl = usemtl.left( usemtl.indexOf( "_" ) );
+				for ( int i = 0; i < 3 && s < e; i++ ) {
+					idx[i] = ObjTokenizer::parseIndex( s, e );
 
-			mfaces = ofaces.value( usemtl );
+					if ( s < e && *s == '/' )
+						s++;
+				}
 
-			if ( !mfaces ) {
-				mfaces = new QVector<ObjFace>();
-				ofaces.insert( usemtl, mfaces );
-			}
-		} else if ( t.value( 0 ) == "v" ) {
-			overts.append( Vector3( t.value( 1 ).toDouble(), t.value( 2 ).toDouble(), t.value( 3 ).toDouble() ) );
-		} else if ( t.value( 0 ) == "vt" ) {
-			otexco.append( Vector2( t.value( 1 ).toDouble(), 1.0 - t.value( 2 ).toDouble() ) );
-		} else if ( t.value( 0 ) == "vn" ) {
-			onorms.append( Vector3( t.value( 1 ).toDouble(), t.value( 2 ).toDouble(), t.value( 3 ).toDouble() ) );
-		} else if ( t.value( 0 ) == "f" ) {
-			if ( t.count() > 5 ) {
-				qCCritical( nsNif ) << tr( "Please triangulate your mesh before import." );
-				return;
+				ObjPoint & p = points[count++];
+				p.v = ( idx[0] < 0 ) ? idx[0] + overts.count() : idx[0] - 1;
+				p.t = ( idx[1] < 0 ) ? idx[1] + otexco.count() : idx[1] - 1;
+				p.n = ( idx[2] < 0 ) ? idx[2] + onorms.count() : idx[2] - 1;
 			}
 
-			for ( int j = 1; j < t.count() - 2; j++ ) {
-				ObjFace face;
-
-				for ( int i = 0; i < 3; i++ ) {
-					QStringList lst = t.value( i == 0 ? 1 : j + i ).split( "/" );
-
-					int v = lst.value( 0 ).toInt();
-					if ( v < 0 )
-						v += overts.count();
-					else
-						v--;
-
-					int t = lst.value( 1 ).toInt();
-					if ( t < 0 )
-						v += otexco.count();
-					else
-						t--;
-
-					int n = lst.value( 2 ).toInt();
-					if ( n < 0 )
-						n += onorms.count();
-					else
-						n--;
-
-					face.p[i].v = v;
-					face.p[i].t = t;
-					face.p[i].n = n;
-				}
+			for ( int j = 1; j < count - 1; j++ )
+				mfaces->append( { { points[0], points[j], points[j + 1] } } );
+		} else if ( t.is( "usemtl" ) ) {
+			usemtl = sobj.token().toString();
+			//if ( usemtl.contains( "_" ) )
+			//	usemtl = usemtl.left( usemtl.indexOf( "_" ) );
 
-				mfaces->append( face );
-			}
+			mfaces = &ofaces[usemtl];
+		} else if ( t.is( "mtllib" ) ) {
+			readMtlLib( fname.left( qMax( fname.lastIndexOf( "/" ), fname.lastIndexOf( "\\" ) ) + 1 ) + sobj.token().toString(), omaterials );
 		}
 	}
 
+	// Weld the faces of each material, in the order of the material names
+	QVector<ObjShape> oshapes;
+
+	for ( auto it = ofaces.constBegin(); it != ofaces.constEnd(); ++it )
+		weldFaces( it.key(), it.value(), overts, otexco, onorms, oshapes );
+
+	ofaces.clear();
+
 	//--Translate file structures into NIF ones--//
 
 	if ( iNode.isValid() == false ) {
@@ -720,18 +986,22 @@ void importObj( NifModel * nif, const QModelIndex & index )
 		nif->set<QString>( iNode, "Name", "Scene Root" );
 	}
 
+	bool old = nif->holdUpdates( true );
+
 	// create a NiTriShape foreach material in the object
 	int shapecount = 0;
 	bool first_tri_shape = true;
-	QMapIterator<QString, QVector<ObjFace> *> it( ofaces );
 
-	while ( it.hasNext() ) {
-		it.next();
-
-		if ( !it.value()->count() )
+	for ( const ObjShape & oshape : oshapes ) {
+		if ( oshape.triangles.isEmpty() )
 			continue;
 
-		if ( it.key() != "collision" ) {
+		const QString & material = oshape.material;
+		const QVector<Vector3> & verts = oshape.verts;
+		const QVector<Vector3> & norms = oshape.norms;
+		const QVector<Triangle> & triangles = oshape.triangles;
+
+		if ( material != "collision" ) {
 			//If we are on the first shape, and one was selected in the 3D view, use the existing one
 			bool newiShape = false;
 
@@ -746,12 +1016,12 @@ void importObj( NifModel * nif, const QModelIndex & index )
 				addLink( nif, iNode, "Children", nif->getBlockNumber( iShape ) );
 			}
 
-			if ( !omaterials.contains( it.key() ) ) {
+			if ( !omaterials.contains( material ) ) {
 				Message::append( tr( "Warnings were generated during OBJ import." ),
-					tr( "Material '%1' not found in mtllib." ).arg( it.key() ) );
+					tr( "Material '%1' not found in mtllib." ).arg( material ) );
 			}
 
-			ObjMaterial mtl = omaterials.value( it.key() );
+			ObjMaterial mtl = omaterials.value( material );
 
 			// add material property, for non-Skyrim versions
 			if ( nif->getUserVersion() < 12 ) {
@@ -763,7 +1033,7 @@ void importObj( NifModel * nif, const QModelIndex & index )
 				}
 
 				if ( newiMaterial ) // don't affect a property  that is already there - that name is generated above on export and it has nothign to do with the stored name
-					nif->set<QString>( iMaterial, "Name", it.key() );
+					nif->set<QString>( iMaterial, "Name", material );
 
 				nif->set<Color3>( iMaterial, "Ambient Color", mtl.Ka );
 				nif->set<Color3>( iMaterial, "Diffuse Color", mtl.Kd );
@@ -845,38 +1115,6 @@ void importObj( NifModel * nif, const QModelIndex & index )
 
 			nif->setLink( iShape, "Data", nif->getBlockNumber( iData ) );
 
-			QVector<Vector3> verts;
-			QVector<Vector3> norms;
-			QVector<Vector2> texco;
-			QVector<Triangle> triangles;
-
-			QVector<ObjPoint> points;
-
-			foreach ( ObjFace oface, *( it.value() ) ) {
-				Triangle tri;
-
-				for ( int t = 0; t < 3; t++ ) {
-					ObjPoint p = oface.p[t];
-					int ix;
-
-					for ( ix = 0; ix < points.count(); ix++ ) {
-						if ( points[ix] == p )
-							break;
-					}
-
-					if ( ix == points.count() ) {
-						points.append( p );
-						verts.append( overts.value( ix ) );
-						norms.append( onorms.value( ix ) );
-						texco.append( otexco.value( ix ) );
-					}
-
-					tri[t] = p.v;
-				}
-
-				triangles.append( tri );
-			}
-
 			nif->set<int>( iData, "Num Vertices", verts.count() );
 			nif->set<int>( iData, "Has Vertices", 1 );
 			nif->updateArray( iData, "Vertices" );
@@ -896,7 +1134,7 @@ void importObj( NifModel * nif, const QModelIndex & index )
 
 			nif->updateArray( iTexCo );
 			nif->updateArray( iTexCo.child( 0, 0 ) );
-			nif->setArray<Vector2>( iTexCo.child( 0, 0 ), texco );
+			nif->setArray<Vector2>( iTexCo.child( 0, 0 ), oshape.texco );
 
 			nif->set<int>( iData, "Has Triangles", 1 );
 			nif->set<int>( iData, "Num Triangles", triangles.count() );
@@ -946,36 +1184,6 @@ void importObj( NifModel * nif, const QModelIndex & index )
 			nif->set<int>( iData, "Unknown Short 2", 0x4000 );
 		} else if ( nif->getVersionNumber() == 0x14000005 ) {
 			// create experimental havok collision mesh
-			QVector<Vector3> verts;
-			QVector<Vector3> norms;
-			QVector<Triangle> triangles;
-
-			QVector<ObjPoint> points;
-
-			foreach ( ObjFace oface, *( it.value() ) ) {
-				Triangle tri;
-
-				for ( int t = 0; t < 3; t++ ) {
-					ObjPoint p = oface.p[t];
-					int ix;
-
-					for ( ix = 0; ix < points.count(); ix++ ) {
-						if ( points[ix] == p )
-							break;
-					}
-
-					if ( ix == points.count() ) {
-						points.append( p );
-						verts.append( overts.value( p.v ) );
-						norms.append( onorms.value( p.n ) );
-					}
-
-					tri[t] = ix;
-				}
-
-				triangles.append( tri );
-			}
-
 			QPersistentModelIndex iData = nif->insertNiBlock( "NiTriStripsData" );
 
 			nif->set<int>( iData, "Num Vertices", verts.count() );
@@ -1054,13 +1262,54 @@ void importObj( NifModel * nif, const QModelIndex & index )
 		first_tri_shape = false;
 	}
 
-	qDeleteAll( ofaces );
+	if ( !old )
+		nif->holdUpdates( false );
+
+	nif->reset();
+
+	return true;
+}
+
+void importObj( NifModel * nif, const QModelIndex & index )
+{
+	//--Be sure the user wants to continue--//
+
+	QModelIndex iBlock = nif->getBlock( index );
+
+	//Be sure the user hasn't clicked on a NiTriStrips object
+	if ( iBlock.isValid() && nif->itemName( iBlock ) == "NiTriStrips" ) {
+		QMessageBox::information( 0, tr( "Import OBJ" ), tr( "You cannot import an OBJ file over a NiTriStrips object.  Please convert it to a NiTriShape object first by right-clicking and choosing Mesh > Triangulate" ) );
+		return;
+	}
+
+	QString question;
+
+	if ( iBlock.isValid() && nif->itemName( iBlock ) == "NiNode" ) {
+		question = tr( "NiNode selected.  Meshes will be attached to the selected node." );
+	} else if ( iBlock.isValid() && nif->itemName( iBlock ) == "NiTriShape" && nif->getParent( nif->getBlockNumber( iBlock ) ) != -1 ) {
+		question = tr( "NiTriShape selected.  The first imported mesh will replace the selected one." );
+	} else {
+		question = tr( "No NiNode or NiTriShape selected.  Meshes will be imported to the root of the file." );
+	}
+
+	int result = QMessageBox::question( 0, tr( "Import OBJ" ), question, QMessageBox::Ok, QMessageBox::Cancel );
+
+	if ( result == QMessageBox::Cancel ) {
+		return;
+	}
+
+	QSettings settings;
+	settings.beginGroup( "Import-Export" );
+	settings.beginGroup( "OBJ" );
+
+	QString fname = QFileDialog::getOpenFileName( qApp->activeWindow(), tr( "Choose a .OBJ file to import" ), settings.value( "File Name" ).toString(), "OBJ (*.obj)" );
+
+	if ( fname.isEmpty() || !importObj( nif, index, fname ) )
+		return;
 
 	settings.setValue( "File Name", fname );
 
 	settings.endGroup(); // OBJ
 	settings.endGroup(); // Import-Export
-
-	nif->reset();
 }
 
@@ -32,9 +32,28 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "kfmmodel.h"
 
+#include <QFileInfo>
+#include <QMutex>
+
 
 //! @file kfmmodel.cpp KfmModel
 
+//! An index cached by KfmModel::loadSequenceIndex()
+struct KfmIndexEntry
+{
+	//! The file as it was indexed
+	QDateTime modified;
+	qint64 size = 0;
+	//! The schema it was loaded with, indexes of a previous parse are not used
+	std::weak_ptr<const KfmSchema> schema;
+
+	std::shared_ptr<const KfmIndex> index;
+};
+
+static QMutex kfmIndexMutex;
+//! The indexes by absolute path
+static QHash<QString, KfmIndexEntry> kfmIndexes;
+
 KfmModel::KfmModel( QObject * parent ) : BaseModel( parent )
 {
 	clear();
@@ -100,6 +119,7 @@ void KfmModel::clear()
 	filename = QString();
 	folder = QString();
 	root->killChildren();
+	schema = currentSchema();
 	insertType( root, NifData( "Kfm", "Kfm" ) );
 	kfmroot = root->child( 0 );
 	version = 0x0200000b;
@@ -182,7 +202,7 @@ void KfmModel::insertType( NifItem * parent, const NifData & data, int at )
 		return;
 	}
 
-	NifBlockPtr compound = compounds.value( data.type() );
+	NifBlockPtr compound = schema->compounds.value( data.type() );
 
 	if ( compound ) {
 		NifItem * branch = insertBranch( parent, data, at );
@@ -234,8 +254,9 @@ void KfmModel::insertType( NifItem * parent, const NifData & data, int at )
 
 bool KfmModel::setItemValue( NifItem * item, const NifValue & val )
 {
+	recordValue( item );
 	item->value() = val;
-	emit dataChanged( createIndex( item->row(), ValueCol, item ), createIndex( item->row(), ValueCol, item ) );
+	notifyChanged( createIndex( item->row(), ValueCol, item ), createIndex( item->row(), ValueCol, item ) );
 	return true;
 }
 
@@ -248,7 +269,7 @@ bool KfmModel::setHeaderString( const QString & s )
 	if ( s.startsWith( ";Gamebryo KFM File Version " ) ) {
 		version = version2number( s.right( s.length() - 27 ) );
 
-		if ( isVersionSupported( version ) ) {
+		if ( schema->supportedVersions.contains( version ) ) {
 			return true;
 		} else {
 			Message::critical( nullptr, tr( "Version %1 is not supported." ).arg( version2string( version ) ) );
@@ -348,6 +369,89 @@ bool KfmModel::save( NifItem * parent, NifOStream & stream ) const
 	return true;
 }
 
+std::shared_ptr<const KfmIndex> KfmModel::sequenceIndex() const
+{
+	auto idx = std::make_shared<KfmIndex>();
+
+	QModelIndex iRoot = getKFMroot();
+	if ( !iRoot.isValid() )
+		return idx;
+
+	idx->version = version;
+	idx->nif = get<QString>( iRoot, "NIF File Name" );
+	idx->master = get<QString>( iRoot, "Master" );
+
+	QModelIndex iAnimations = getIndex( iRoot, "Animations" );
+
+	for ( int a = 0; a < rowCount( iAnimations ); a++ ) {
+		QModelIndex iAnim = index( a, 0, iAnimations );
+
+		KfmIndex::Sequence seq;
+		seq.id = get<int>( iAnim, "Event Code" );
+		seq.kf = get<QString>( iAnim, "KF File Name" );
+
+		QModelIndex iTransitions = getIndex( iAnim, "Transitions" );
+
+		for ( int t = 0; t < rowCount( iTransitions ); t++ ) {
+			QModelIndex iTrans = index( t, 0, iTransitions );
+
+			KfmIndex::Transition trans;
+			trans.target = get<int>( iTrans, "Animation" );
+			trans.type = get<int>( iTrans, "Type" );
+			seq.transitions.append( trans );
+		}
+
+		// The first sequence with an event code wins, as in the game
+		if ( !idx->ids.contains( seq.id ) )
+			idx->ids.insert( seq.id, idx->sequences.count() );
+
+		idx->sequences.append( seq );
+	}
+
+	return idx;
+}
+
+std::shared_ptr<const KfmIndex> KfmModel::loadSequenceIndex( const QString & path )
+{
+	QFileInfo info( path );
+	QString key = info.absoluteFilePath();
+
+	{
+		QMutexLocker lock( &kfmIndexMutex );
+
+		auto it = kfmIndexes.constFind( key );
+		if ( it != kfmIndexes.cend() && it->schema.lock() == currentSchema()
+			&& it->modified == info.lastModified() && it->size == info.size() )
+			return it->index;
+	}
+
+	// Loaded without the lock, so that files are indexed in parallel
+	KfmModel kfm;
+	kfm.setMessageMode( TstMessage );
+
+	if ( !kfm.loadFromFile( key ) )
+		return nullptr;
+
+	auto idx = kfm.sequenceIndex();
+	cacheSequenceIndex( key, idx );
+
+	return idx;
+}
+
+void KfmModel::cacheSequenceIndex( const QString & path, std::shared_ptr<const KfmIndex> idx )
+{
+	QFileInfo info( path );
+
+	KfmIndexEntry entry;
+	entry.modified = info.lastModified();
+	entry.size = info.size();
+	entry.schema = currentSchema();
+	entry.index = idx;
+
+	QMutexLocker lock( &kfmIndexMutex );
+	kfmIndexes.insert( info.absoluteFilePath(), entry );
+}
+
 NifItem * KfmModel::insertBranch( NifItem * parentItem, const NifData & data, int at )
 {
 	NifItem * item = parentItem->insertChild( data, at );
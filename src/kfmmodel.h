@@ -35,15 +35,64 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "basemodel.h" // Inherited
 
+#include <QDateTime>
 #include <QHash>
 #include <QReadWriteLock>
 #include <QStringList>
+#include <QVector>
 
 #include <memory>
 
 using NifBlockPtr = std::shared_ptr<NifBlock>;
 
-//! @file kfmmodel.h KfmModel
+//! @file kfmmodel.h KfmSchema, KfmIndex, KfmModel
+
+//! The XML structures of one parse of kfm.xml, never changed once published
+struct KfmSchema final
+{
+	QList<quint32> supportedVersions;
+	QHash<QString, NifBlockPtr> compounds;
+};
+
+//! A published KfmSchema, released once no model holds it any longer
+using KfmSchemaPtr = std::shared_ptr<const KfmSchema>;
+
+//! The animations of a KFM file without its item tree, see KfmModel::loadSequenceIndex()
+struct KfmIndex final
+{
+	//! A switch to another sequence
+	struct Transition
+	{
+		//! The event code of the sequence switched to
+		quint32 target = 0;
+		quint32 type = 0;
+	};
+
+	//! A sequence and the KF file it is stored in
+	struct Sequence
+	{
+		//! The event code identifying the sequence
+		quint32 id = 0;
+		QString kf;
+		QVector<Transition> transitions;
+	};
+
+	quint32 version = 0;
+	//! The NIF file animated, relative to the KFM
+	QString nif;
+	QString master;
+	QVector<Sequence> sequences;
+
+	//! The sequence with an event code, nullptr if there is none
+	const Sequence * sequence( quint32 id ) const
+	{
+		auto it = ids.constFind( id );
+		return ( it != ids.cend() ) ? &sequences.at( it.value() ) : nullptr;
+	}
+
+	//! The position of each sequence by its event code
+	QHash<quint32, int> ids;
+};
 
 class KfmModel final : public BaseModel
 {
@@ -55,9 +104,12 @@ public:
 	// call this once on startup to load the XML descriptions
 	static bool loadXML();
 
-	// when creating kfmmodels from outside the main thread better protect them with a QReadLocker
+	//! Serializes parsing the XML; models read the published schema without it, see currentSchema()
 	static QReadWriteLock XMLlock;
 
+	//! The XML structures of the last parse, published like NifModel::currentSchema()
+	static KfmSchemaPtr currentSchema();
+
 	// clear model data
 	void clear() override final;
 
@@ -85,6 +137,20 @@ public:
 
 	static QAbstractItemDelegate * createDelegate( QObject * parent );
 
+	//! Index the sequences of the loaded file
+	std::shared_ptr<const KfmIndex> sequenceIndex() const;
+
+	//! The index of a KFM file, cached per path until the file changes
+	/*!
+	 * Only the first request for a file loads it into an item tree, which is
+	 * dropped once the index is built. Safe to call from any thread.
+	 *
+	 * \return The index, or nullptr if the file could not be loaded
+	 */
+	static std::shared_ptr<const KfmIndex> loadSequenceIndex( const QString & path );
+	//! Cache the index of a file loaded elsewhere, such as by the main window
+	static void cacheSequenceIndex( const QString & path, std::shared_ptr<const KfmIndex> idx );
+
 protected:
 	void insertType( NifItem * parent, const NifData & data, int row = -1 );
 	NifItem * insertBranch( NifItem * parent, const NifData & data, int row = -1 );
@@ -108,10 +174,8 @@ protected:
 
 	NifItem * kfmroot;
 
-	// XML structures
-	static QList<quint32> supportedVersions;
-
-	static QHash<QString, NifBlockPtr> compounds;
+	//! The schema the model was cleared with
+	KfmSchemaPtr schema;
 
 	static QString parseXmlDescription( const QString & filename );
 
@@ -121,12 +185,12 @@ protected:
 
 inline bool KfmModel::isCompound( const QString & name )
 {
-	return compounds.contains( name );
+	return currentSchema()->compounds.contains( name );
 }
 
 inline bool KfmModel::isVersionSupported( quint32 v )
 {
-	return supportedVersions.contains( v );
+	return currentSchema()->supportedVersions.contains( v );
 }
 
 #endif
@@ -37,24 +37,34 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QApplication>
 #include <QMessageBox>
 
+#include <memory>
+
 #define err( X ) { errorStr = X; return false; }
 
 
 QReadWriteLock KfmModel::XMLlock;
-QList<quint32>                  KfmModel::supportedVersions;
-QHash<QString, NifBlockPtr>        KfmModel::compounds;
+
+//! The schema of the last parse, see KfmModel::currentSchema(); empty before the XML was parsed
+/*!
+ * Only accessed through std::atomic_load() and std::atomic_store(), as the
+ * schema of NifModel.
+ */
+static KfmSchemaPtr publishedSchema = std::make_shared<KfmSchema>();
 
 class KfmXmlHandler final : public QXmlDefaultHandler
 {
 	Q_DECLARE_TR_FUNCTIONS( KfmXmlHandler )
 
 public:
-	KfmXmlHandler() : depth( 0 ),
+	KfmXmlHandler( KfmSchema & x ) : xml( x ), depth( 0 ),
 		elements( { "niftoolsxml", "version", "compound", "add" } ),
 		blk( 0 )
 	{
 	}
 
+	//! The schema being filled
+	KfmSchema & xml;
+
 	int depth;
 	int stack[10];
 	QStringList elements;
@@ -108,7 +118,7 @@ public:
 				v = KfmModel::version2number( list.value( "num" ).trimmed() );
 
 				if ( v != 0 && !list.value( "num" ).isEmpty() )
-					KfmModel::supportedVersions.append( v );
+					xml.supportedVersions.append( v );
 				else
 					err( tr( "invalid version string" ) );
 
@@ -184,7 +194,7 @@ public:
 				if ( !blk->id.isEmpty() ) {
 					switch ( x ) {
 					case 2:
-						KfmModel::compounds.insert( blk->id, blk ); break;
+						xml.compounds.insert( blk->id, blk ); break;
 					}
 
 					blk = nullptr;
@@ -202,7 +212,7 @@ public:
 
 	bool checkType( const NifData & data )
 	{
-		return KfmModel::compounds.contains( data.type() ) || NifValue::type( data.type() ) != NifValue::tNone || data.type() == "TEMPLATE";
+		return xml.compounds.contains( data.type() ) || NifValue::type( data.type() ) != NifValue::tNone || data.type() == "TEMPLATE";
 	}
 
 	bool checkTemp( const NifData & data )
@@ -213,8 +223,8 @@ public:
 	bool endDocument() override final
 	{
 		// make a rough check of the maps
-		for ( const QString& key : KfmModel::compounds.keys() ) {
-			NifBlockPtr c = KfmModel::compounds.value( key );
+		for ( const QString& key : xml.compounds.keys() ) {
+			NifBlockPtr c = xml.compounds.value( key );
 			for ( const NifData& data : c->types ) {
 				if ( !checkType( data ) )
 					err( tr( "compound type %1 referes to unknown type %2" ).arg( key, data.type() ) );
@@ -269,22 +279,36 @@ bool KfmModel::loadXML()
 	return true;
 }
 
+KfmSchemaPtr KfmModel::currentSchema()
+{
+	return std::atomic_load( &publishedSchema );
+}
+
 QString KfmModel::parseXmlDescription( const QString & filename )
 {
+	// Only one parse at a time; models keep reading the published schema meanwhile
 	QWriteLocker lck( &XMLlock );
 
-	compounds.clear();
-	supportedVersions.clear();
+	// The replaced schema is released by the last model still holding it
+	std::shared_ptr<KfmSchema> xml = std::make_shared<KfmSchema>();
+
+	auto publish = [xml]() {
+		std::atomic_store( &publishedSchema, KfmSchemaPtr( xml ) );
+	};
 
 	QFile f( filename );
 
-	if ( !f.exists() )
+	if ( !f.exists() ) {
+		publish();
 		return tr( "kfm.xml could not be found. Please install it and restart the application." );
+	}
 
-	if ( !f.open( QIODevice::ReadOnly | QIODevice::Text ) )
+	if ( !f.open( QIODevice::ReadOnly | QIODevice::Text ) ) {
+		publish();
 		return tr( "Couldn't open KFM XML description file: %1" ).arg( filename );
+	}
 
-	KfmXmlHandler handler;
+	KfmXmlHandler handler( *xml );
 	QXmlSimpleReader reader;
 	reader.setContentHandler( &handler );
 	reader.setErrorHandler( &handler );
@@ -292,10 +316,11 @@ QString KfmModel::parseXmlDescription( const QString & filename )
 	reader.parse( source );
 
 	if ( !handler.errorString().isEmpty() ) {
-		compounds.clear();
-		supportedVersions.clear();
+		xml->compounds.clear();
+		xml->supportedVersions.clear();
 	}
 
+	publish();
+
 	return handler.errorString();
 }
-
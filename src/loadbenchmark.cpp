@@ -0,0 +1,277 @@
+/***** BEGIN LICENSE BLOCK *****
+
+BSD License
+
+Copyright (c) 2005-2015, NIF File Format Library and Tools
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the NIF File Format Library and Tools project may not be
+   used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+***** END LICENCE BLOCK *****/
+
+#include "loadbenchmark.h"
+
+#include "nifmodel.h"
+#include "gl/gltexloaders.h"
+
+#include <QBuffer>
+#include <QElapsedTimer>
+#include <QTextStream>
+
+#if defined( Q_OS_WIN )
+#include <windows.h>
+#include <psapi.h>
+#elif defined( Q_OS_UNIX )
+#include <sys/resource.h>
+#endif
+
+
+//! \file loadbenchmark.cpp LoadBenchmark implementation
+
+//! The peak resident memory of the process in bytes, 0 if it cannot be read
+static qint64 peakMemory()
+{
+#if defined( Q_OS_WIN )
+	PROCESS_MEMORY_COUNTERS counters;
+	if ( GetProcessMemoryInfo( GetCurrentProcess(), &counters, sizeof( counters ) ) )
+		return qint64( counters.PeakWorkingSetSize );
+#elif defined( Q_OS_UNIX )
+	struct rusage usage;
+	if ( getrusage( RUSAGE_SELF, &usage ) == 0 ) {
+#ifdef Q_OS_MACOS
+		return qint64( usage.ru_maxrss );
+#else
+		// Linux reports kilobytes
+		return qint64( usage.ru_maxrss ) * 1024;
+#endif
+	}
+#endif
+	return 0;
+}
+
+//! Bytes per nanosecond as megabytes per second
+static double megabytesPerSecond( qint64 bytes, qint64 nsecs )
+{
+	return nsecs > 0 ? double( bytes ) * 1000.0 / double( nsecs ) : 0.0;
+}
+
+//! Items per nanosecond as items per second
+static double perSecond( qint64 count, qint64 nsecs )
+{
+	return nsecs > 0 ? double( count ) * 1e9 / double( nsecs ) : 0.0;
+}
+
+void LoadBenchmark::Totals::add( const Totals & other )
+{
+	files += other.files;
+	failed += other.failed;
+	bytes += other.bytes;
+	blocks += other.blocks;
+	items += other.items;
+	readTime += other.readTime;
+	loadTime += other.loadTime;
+	saveTime += other.saveTime;
+	headerTime += other.headerTime;
+	arrayTime += other.arrayTime;
+	textureTime += other.textureTime;
+	headers += other.headers;
+	arrayValues += other.arrayValues;
+	textureBytes += other.textureBytes;
+	peakMemory = qMax( peakMemory, other.peakMemory );
+}
+
+LoadBenchmark::LoadBenchmark()
+{
+	runner.setThreads( 1 );
+}
+
+LoadBenchmark::~LoadBenchmark()
+{
+}
+
+bool LoadBenchmark::run( const QString & input, bool recursive )
+{
+	QStringList extensions{ "*.nif", "*.nifcache", "*.kf", "*.kfa" };
+
+	if ( !runner.open( input, extensions, recursive ) )
+		return false;
+
+	runner.run( [this]( NifModel & nif, const QString & file ) {
+		measure( nif, file );
+	} );
+
+	runner.close();
+
+	return true;
+}
+
+void LoadBenchmark::measure( NifModel & nif, const QString & file )
+{
+	Totals t;
+	t.files = 1;
+
+	QElapsedTimer timer;
+	QByteArray data;
+
+	// Reading is timed apart, so that the other throughputs do not depend on the disk or archive
+	timer.start();
+	bool read = runner.read( file, data );
+
+	t.readTime = timer.nsecsElapsed();
+	t.bytes = data.size();
+
+	bool loaded = read;
+	quint64 items = NifItem::allocations();
+
+	for ( int r = 0; r < repeat && loaded; r++ ) {
+		QBuffer buffer( &data );
+		buffer.open( QIODevice::ReadOnly );
+
+		timer.restart();
+		loaded = nif.load( buffer );
+		qint64 elapsed = timer.nsecsElapsed();
+
+		t.loadTime = ( r == 0 ) ? elapsed : qMin( t.loadTime, elapsed );
+
+		if ( r == 0 )
+			t.items = NifItem::allocations() - items;
+	}
+
+	if ( !loaded ) {
+		t.failed = 1;
+		t.peakMemory = peakMemory();
+		versions[tr( "failed" )].add( t );
+		qCWarning( ns ) << file << ":" << tr( "could not be loaded" );
+		return;
+	}
+
+	t.blocks = nif.getBlockCount();
+
+	// The header of a loose file is read on its own, as when the files of a folder are scanned
+	if ( !runner.getArchive() ) {
+		NifModel header;
+
+		timer.restart();
+		if ( header.loadHeaderOnly( file ) ) {
+			t.headerTime = timer.nsecsElapsed();
+			t.headers = 1;
+		}
+	}
+
+	// The arrays the renderer and the exporters extract from the geometry
+	timer.restart();
+
+	for ( int b = 0; b < t.blocks; b++ ) {
+		QModelIndex iBlock = nif.getBlock( b );
+
+		for ( const QString & name : { QStringLiteral( "Vertices" ), QStringLiteral( "Normals" ) } ) {
+			QModelIndex iArray = nif.getIndex( iBlock, name );
+			if ( iArray.isValid() )
+				t.arrayValues += nif.getArray<Vector3>( iArray ).count();
+		}
+
+		QModelIndex iTriangles = nif.getIndex( iBlock, "Triangles" );
+		if ( iTriangles.isValid() )
+			t.arrayValues += nif.getArray<Triangle>( iTriangles ).count();
+	}
+
+	t.arrayTime = timer.nsecsElapsed();
+
+	// Decoding needs no GL context for embedded textures, unlike the texture files
+	timer.restart();
+
+	for ( int b = 0; b < t.blocks; b++ ) {
+		QModelIndex iBlock = nif.getBlock( b );
+
+		if ( !nif.isNiBlock( iBlock, QStringList{ "NiPixelData", "NiPersistentSrcTextureRendererData" } ) )
+			continue;
+
+		TexPixelData pixelData;
+		if ( texReadPixelData( iBlock, pixelData ) )
+			t.textureBytes += texEncodeDDS( pixelData ).size();
+	}
+
+	t.textureTime = timer.nsecsElapsed();
+
+	for ( int r = 0; r < repeat; r++ ) {
+		QByteArray saved;
+		QBuffer buffer( &saved );
+		buffer.open( QIODevice::WriteOnly );
+
+		timer.restart();
+		nif.save( buffer );
+		qint64 elapsed = timer.nsecsElapsed();
+
+		t.saveTime = ( r == 0 ) ? elapsed : qMin( t.saveTime, elapsed );
+	}
+
+	QModelIndex iBSHeader = nif.getIndex( nif.getHeader(), "BS Header" );
+	quint32 bsVersion = iBSHeader.isValid() ? nif.get<int>( iBSHeader, "BS Version" ) : 0;
+
+	QString version = QString( "%1 / %2 / %3" ).arg( nif.getVersion() ).arg( nif.getUserVersion() ).arg( bsVersion );
+
+	t.peakMemory = peakMemory();
+	versions[version].add( t );
+}
+
+void LoadBenchmark::report( QTextStream & out ) const
+{
+	out << "Version\tFiles\tFailed\tMB\tBlocks\tLoad MB/s\tLoad Blocks/s\tSave MB/s\tHeaders/s"
+	    << "\tArray Values/s\tRead MB/s\tTexture MB/s\tItems/File\tPeak RSS MB\n";
+
+	auto row = [&out]( const QString & name, const Totals & t ) {
+		int loaded = t.files - t.failed;
+
+		out << name << '\t' << t.files << '\t' << t.failed << '\t'
+		    << QString::number( double( t.bytes ) / ( 1024.0 * 1024.0 ), 'f', 2 ) << '\t' << t.blocks << '\t'
+		    << QString::number( megabytesPerSecond( t.bytes, t.loadTime ), 'f', 2 ) << '\t'
+		    << qRound64( perSecond( t.blocks, t.loadTime ) ) << '\t'
+		    << QString::number( megabytesPerSecond( t.bytes, t.saveTime ), 'f', 2 ) << '\t'
+		    << qRound64( perSecond( t.headers, t.headerTime ) ) << '\t'
+		    << qRound64( perSecond( t.arrayValues, t.arrayTime ) ) << '\t'
+		    << QString::number( megabytesPerSecond( t.bytes, t.readTime ), 'f', 2 ) << '\t'
+		    << QString::number( megabytesPerSecond( t.textureBytes, t.textureTime ), 'f', 2 ) << '\t'
+		    << ( loaded > 0 ? t.items / quint64( loaded ) : 0 ) << '\t'
+		    << QString::number( double( t.peakMemory ) / ( 1024.0 * 1024.0 ), 'f', 1 ) << '\n';
+	};
+
+	Totals all;
+
+	for ( auto it = versions.cbegin(); it != versions.cend(); ++it ) {
+		row( it.key(), it.value() );
+		all.add( it.value() );
+	}
+
+	row( tr( "all" ), all );
+}
+
+int LoadBenchmark::failed() const
+{
+	int count = 0;
+
+	for ( const Totals & t : versions )
+		count += t.failed;
+
+	return count;
+}
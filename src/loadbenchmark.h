@@ -0,0 +1,131 @@
+/***** BEGIN LICENSE BLOCK *****
+
+BSD License
+
+Copyright (c) 2005-2015, NIF File Format Library and Tools
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the NIF File Format Library and Tools project may not be
+   used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+***** END LICENCE BLOCK *****/
+
+#ifndef LOADBENCHMARK_H
+#define LOADBENCHMARK_H
+
+#include "batchrunner.h"
+
+#include <QByteArray>
+#include <QCoreApplication>
+#include <QMap>
+#include <QString>
+
+
+//! \file loadbenchmark.h LoadBenchmark
+
+class NifModel;
+class QTextStream;
+
+//! Times the core file paths over a corpus of NIFs, per game version
+/*!
+ * Each file is read into memory first, so that loading and saving are timed
+ * without the disk. The files are processed one at a time by a single
+ * thread, which keeps the timings comparable between runs and machines.
+ *
+ * For every file it times reading the file or extracting it from an archive,
+ * NifModel::load() from memory, NifModel::loadHeaderOnly(), extracting the
+ * vertex, normal and triangle arrays with getArray(), decoding any embedded
+ * pixel data and NifModel::save() to memory. The results are summed per
+ * version, user version and BS version.
+ *
+ * Used by <tt>NifSkope -no-gui --benchmark ...</tt>, see main().
+ */
+class LoadBenchmark final
+{
+	Q_DECLARE_TR_FUNCTIONS( LoadBenchmark )
+
+public:
+	LoadBenchmark();
+	~LoadBenchmark();
+
+	//! Load and save each file this many times, keeping the fastest
+	void setRepeat( int num ) { repeat = qMax( 1, num ); }
+
+	//! Time the NIFs below a directory, in an archive, or a single file
+	/*!
+	 * \param input		A directory, an archive or a file
+	 * \param recursive	Whether to include the sub directories of a directory
+	 * \return			False if the input could not be opened
+	 */
+	bool run( const QString & input, bool recursive );
+
+	//! Print a tab separated row of throughputs per game version, and one for all of them
+	void report( QTextStream & out ) const;
+
+	//! The number of files which could not be read or loaded
+	int failed() const;
+
+protected:
+	//! The sums of one game version
+	struct Totals
+	{
+		int files = 0;
+		int failed = 0;
+		qint64 bytes = 0;
+		qint64 blocks = 0;
+		//! NifItems allocated by the first load of each file
+		quint64 items = 0;
+
+		//! Times in nanoseconds
+		qint64 readTime = 0;
+		qint64 loadTime = 0;
+		qint64 saveTime = 0;
+		qint64 headerTime = 0;
+		qint64 arrayTime = 0;
+		qint64 textureTime = 0;
+
+		//! Files timed with loadHeaderOnly(), which cannot read the files of an archive
+		int headers = 0;
+		//! Elements returned by getArray()
+		qint64 arrayValues = 0;
+		//! Bytes of decoded pixel data
+		qint64 textureBytes = 0;
+
+		//! Peak resident memory of the process once the last file of the version was done
+		qint64 peakMemory = 0;
+
+		void add( const Totals & other );
+	};
+
+	//! Time a file, adding the result to its version
+	void measure( NifModel & nif, const QString & file );
+
+	int repeat = 1;
+
+	BatchRunner runner;
+
+	//! The totals per "version / user version / BS version"
+	QMap<QString, Totals> versions;
+};
+
+#endif
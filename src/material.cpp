@@ -31,15 +31,18 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 ***** END LICENCE BLOCK *****/
 
 #include "material.h"
+#include "functionrunnable.h"
+#include "settingssnapshot.h"
 
 #include <fsengine/fsengine.h>
 #include <fsengine/fsmanager.h>
 
 #include <QBuffer>
+#include <QCoreApplication>
 #include <QDataStream>
 #include <QDebug>
 #include <QDir>
-#include <QSettings>
+#include <QFileSystemWatcher>
 
 #define BGSM 0x4D534742
 #define BGEM 0x4D454742
@@ -96,34 +99,29 @@ bool Material::readFile()
 
 QByteArray Material::find( QString path )
 {
-	QSettings settings;
-	QStringList folders = settings.value( "Settings/Resources/Folders", QStringList() ).toStringList();
-
 	QString filename;
 	QDir dir;
-	for ( QString folder : folders ) {
+	for ( const QString & folder : SettingsSnapshot::get()->resourceFolders ) {
 		dir.setPath( folder );
 
 		if ( dir.exists( path ) ) {
 			filename = QDir::fromNativeSeparators( dir.filePath( path ) );
 
 			QFile f( filename );
-			if ( f.open( QIODevice::ReadOnly ) )
+			if ( f.open( QIODevice::ReadOnly ) ) {
+				absolutePath = filename;
 				return f.readAll();
+			}
 		}
 	}
 
-	for ( FSArchiveFile * archive : FSManager::archiveList() ) {
-		if ( archive ) {
-			filename = QDir::fromNativeSeparators( path.toLower() );
-			if ( archive->hasFile( filename ) ) {
-				QByteArray outData;
-				archive->fileContents( filename, outData );
+	filename = QDir::fromNativeSeparators( path.toLower() );
+	if ( auto archive = FSManager::findArchive( filename ) ) {
+		QByteArray outData;
+		FSManager::fileContents( archive, filename, outData );
 
-				if ( !outData.isEmpty() ) {
-					return outData;
-				}
-			}
+		if ( !outData.isEmpty() ) {
+			return outData;
 		}
 	}
 
@@ -266,3 +264,118 @@ bool EffectMaterial::readFile()
 
 	return false;
 }
+
+
+/*
+	MaterialCache
+*/
+
+MaterialCache::MaterialCache( QObject * parent ) : QObject( parent )
+{
+	watcher = new QFileSystemWatcher( this );
+	connect( watcher, &QFileSystemWatcher::fileChanged, this, &MaterialCache::fileChanged );
+
+	readPool.setMaxThreadCount( 2 );
+}
+
+MaterialCache * MaterialCache::instance()
+{
+	// Deleted with the application, after the windows using it
+	static MaterialCache * cache = new MaterialCache( QCoreApplication::instance() );
+	return cache;
+}
+
+std::shared_ptr<Material> MaterialCache::get( const QString & name )
+{
+	QString key = name.toLower().replace( "\\", "/" );
+
+	auto it = materials.constFind( key );
+	if ( it != materials.constEnd() )
+		return it->material;
+
+	// The entry stays empty until the material is read, so it is only read once
+	materials.insert( key, Entry() );
+	reading++;
+
+	int gen = generation;
+
+	readPool.start( new FunctionRunnable( [this, key, name, gen]() {
+		Material * m;
+
+		if ( name.endsWith( ".bgem", Qt::CaseInsensitive ) )
+			m = new EffectMaterial( name );
+		else
+			m = new ShaderMaterial( name );
+
+		// Receivers on the GUI thread own the material
+		m->moveToThread( thread() );
+
+		QMetaObject::invokeMethod( this, "loaded", Qt::QueuedConnection,
+			Q_ARG( QString, key ), Q_ARG( QObject *, m ), Q_ARG( int, gen ) );
+	} ) );
+
+	return nullptr;
+}
+
+void MaterialCache::clear()
+{
+	materials.clear();
+	generation++;
+
+	if ( !watcher->files().isEmpty() )
+		watcher->removePaths( watcher->files() );
+
+	emit sigChanged();
+}
+
+void MaterialCache::loaded( const QString & key, QObject * material, int gen )
+{
+	std::shared_ptr<Material> m( static_cast<Material *>( material ) );
+	reading--;
+
+	auto it = materials.find( key );
+	if ( gen == generation && it != materials.end() && !it->material ) {
+		it->material = m;
+
+		if ( !m->absolutePath.isEmpty() ) {
+			it->modified = QFileInfo( m->absolutePath ).lastModified();
+
+			if ( !watcher->files().contains( m->absolutePath ) )
+				watcher->addPath( m->absolutePath );
+		}
+	}
+
+	// The scene is updated once for the materials a scene update asked for
+	if ( reading == 0 )
+		emit sigChanged();
+}
+
+void MaterialCache::fileChanged( const QString & filepath )
+{
+	QFileInfo info( filepath );
+	bool changed = false;
+
+	QMutableHashIterator<QString, Entry> it( materials );
+
+	while ( it.hasNext() ) {
+		it.next();
+
+		const Entry & e = it.value();
+
+		if ( !e.material || e.material->absolutePath != filepath )
+			continue;
+
+		// Editors may report a file more than once for one save
+		if ( info.exists() && info.lastModified() == e.modified )
+			continue;
+
+		// Read again the next time a property asks for it
+		it.remove();
+		changed = true;
+	}
+
+	if ( changed ) {
+		watcher->removePath( filepath );
+		emit sigChanged();
+	}
+}
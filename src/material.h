@@ -38,7 +38,14 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QObject>
 #include <QByteArray>
 #include <QDataStream>
+#include <QDateTime>
+#include <QHash>
 #include <QString>
+#include <QThreadPool>
+
+#include <memory>
+
+class QFileSystemWatcher;
 
 
 class Material : public QObject
@@ -50,6 +57,7 @@ class Material : public QObject
 	friend class BSShaderLightingProperty;
 	friend class BSLightingShaderProperty;
 	friend class BSEffectShaderProperty;
+	friend class MaterialCache;
 
 public:
 	Material( QString name );
@@ -68,13 +76,14 @@ protected:
 
 	bool fileExists = false;
 	QString localPath;
-	//QString absolutePath;
+	//! The path of the loose file read by find(), empty if the file is in an archive
+	QString absolutePath;
 
 	QDataStream in;
 	QByteArray data;
 
 	// Is not JSON format or otherwise unreadable
-	bool readable;
+	bool readable = false;
 
 	// BGSM & BGEM shared variables
 
@@ -211,4 +220,60 @@ protected:
 };
 
 
+/*! The materials read by all shader properties and windows
+ *
+ * A material file is found and parsed once on a worker thread and then shared
+ * by every shape referencing it. Loose files are watched and read again when
+ * they change.
+ */
+class MaterialCache final : public QObject
+{
+	Q_OBJECT
+
+public:
+	static MaterialCache * instance();
+
+	//! Get the material of a .bgsm or .bgem file
+	/*!
+	 * Materials which are not loaded yet are read on a worker thread and null
+	 * is returned; sigChanged() is emitted once all started reads finished. A material whose
+	 * file was not found or could not be read is returned as not valid.
+	 */
+	std::shared_ptr<Material> get( const QString & name );
+
+	//! Forget the materials, after the folders or archives changed
+	void clear();
+
+signals:
+	//! Materials finished loading or changed, the properties using them need updating
+	void sigChanged();
+
+protected slots:
+	void fileChanged( const QString & filepath );
+	//! Receives a material read by a worker thread
+	void loaded( const QString & key, QObject * material, int generation );
+
+protected:
+	MaterialCache( QObject * parent );
+
+	struct Entry
+	{
+		//! Null while being read
+		std::shared_ptr<Material> material;
+		//! The modification time of the loose file when it was read
+		QDateTime modified;
+	};
+
+	//! Entries by local path in lower case
+	QHash<QString, Entry> materials;
+	QFileSystemWatcher * watcher;
+
+	QThreadPool readPool;
+	//! Number of materials being read; sigChanged() is emitted once all of them are
+	int reading = 0;
+	//! Incremented by clear() so that reads started before it are ignored
+	int generation = 0;
+};
+
+
 #endif // MATERIAL_H
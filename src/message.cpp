@@ -3,6 +3,9 @@
 #include <QApplication>
 #include <QAbstractButton>
 #include <QMap>
+#include <QThread>
+
+#include <cstdio>
 
 
 Q_LOGGING_CATEGORY( ns, "nifskope" )
@@ -22,9 +25,36 @@ Message::~Message()
 
 }
 
+bool Message::hasGui()
+{
+	auto app = qobject_cast<QApplication *>( QCoreApplication::instance() );
+	return app && QThread::currentThread() == app->thread();
+}
+
+//! Print a message where no box can be shown
+static void print( const QString & str, const QString & err, QMessageBox::Icon icon )
+{
+	const char * type = "[Info]";
+
+	if ( icon == QMessageBox::Critical )
+		type = "[Critical]";
+	else if ( icon == QMessageBox::Warning )
+		type = "[Warning]";
+
+	if ( err.isEmpty() )
+		fprintf( stderr, "%s %s\n", type, qPrintable( str ) );
+	else
+		fprintf( stderr, "%s %s\n%s\n", type, qPrintable( str ), qPrintable( err ) );
+}
+
 //! Static helper for message box without detail text
 void Message::message( QWidget * parent, const QString & str, QMessageBox::Icon icon )
 {
+	if ( !hasGui() ) {
+		print( str, QString(), icon );
+		return;
+	}
+
 	auto msgBox = new QMessageBox( parent );
 
 	// Keep message box on top if it does not have a parent
@@ -43,6 +73,11 @@ void Message::message( QWidget * parent, const QString & str, QMessageBox::Icon
 //! Static helper for message box with detail text
 void Message::message( QWidget * parent, const QString & str, const QString & err, QMessageBox::Icon icon )
 {
+	if ( !hasGui() ) {
+		print( str, err, icon );
+		return;
+	}
+
 	if ( !parent )
 		parent = qApp->activeWindow();
 
@@ -65,6 +100,9 @@ void Message::message( QWidget * parent, const QString & str, const QString & er
 //! Static helper for installed message handler
 void Message::message( QWidget * parent, const QString & str, const QMessageLogContext * context, QMessageBox::Icon icon )
 {
+	// The message handler already printed it
+	if ( !hasGui() )
+		return;
 
 #ifdef QT_NO_DEBUG
 	if ( !QString( context->category ).startsWith( "nifskope", Qt::CaseInsensitive ) ) {
@@ -139,6 +177,11 @@ static QMap<QString, QMessageBox *> messageBoxes;
 
 void Message::append( QWidget * parent, const QString & str, const QString & err, QMessageBox::Icon icon )
 {
+	if ( !hasGui() ) {
+		print( str, err, icon );
+		return;
+	}
+
 	if ( !parent )
 		parent = qApp->activeWindow();
 
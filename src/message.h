@@ -37,6 +37,9 @@ public:
 
 	static void info( QWidget *, const QString & );
 	static void info( QWidget *, const QString &, const QString & );
+
+	//! Whether boxes and dialogs can be shown, which batch worker threads and -no-gui runs cannot
+	static bool hasGui();
 };
 
 class TestMessage
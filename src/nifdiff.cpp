@@ -0,0 +1,385 @@
+/***** BEGIN LICENSE BLOCK *****
+
+BSD License
+
+Copyright (c) 2005-2015, NIF File Format Library and Tools
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the NIF File Format Library and Tools project may not be
+   used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+***** END LICENCE BLOCK *****/
+
+#include "nifdiff.h"
+
+#include "nifmodel.h"
+
+#include <QHash>
+#include <QStringList>
+#include <QTextStream>
+
+#include <algorithm>
+#include <functional>
+
+
+//! \file nifdiff.cpp NifDiff implementation
+
+//! The header fields which follow from the blocks and strings, compared through them instead
+static const QStringList derivedHeaderFields = {
+	"Num Blocks", "Num Block Types", "Block Types", "Block Type Index", "Block Size",
+	"Num Strings", "Max String Length", "Strings", "Num Groups", "Groups"
+};
+
+int NifDiff::compare( const NifModel * original, const NifModel * modified )
+{
+	nifA = original;
+	nifB = modified;
+	results.clear();
+
+	matchBlocks();
+
+	Change change;
+	listed = 0;
+	truncated = false;
+	compareItems( nifA->getHeader(), nifB->getHeader(), QString(), change );
+
+	for ( int a = 0; a < matchA.count(); a++ ) {
+		int b = matchA.at( a );
+
+		listed = 0;
+		truncated = false;
+
+		if ( b < 0 ) {
+			Change removed;
+			removed.kind = Change::Removed;
+			removed.original = a;
+			removed.before = blockText( nifA, a );
+			addChange( removed );
+			continue;
+		}
+
+		Change changed;
+		changed.original = a;
+		changed.modified = b;
+		compareItems( nifA->getBlock( a ), nifB->getBlock( b ), QString(), changed );
+	}
+
+	for ( int b = 0; b < matchB.count(); b++ ) {
+		if ( matchB.at( b ) >= 0 )
+			continue;
+
+		listed = 0;
+		truncated = false;
+
+		Change added;
+		added.kind = Change::Added;
+		added.modified = b;
+		added.after = blockText( nifB, b );
+		addChange( added );
+	}
+
+	return results.count();
+}
+
+void NifDiff::matchBlocks()
+{
+	const int countA = nifA->getBlockCount();
+	const int countB = nifB->getBlockCount();
+
+	matchA.fill( -1, countA );
+	matchB.fill( -1, countB );
+
+	auto match = [this]( int a, int b ) {
+		matchA[a] = b;
+		matchB[b] = a;
+	};
+
+	auto key = []( const NifModel * nif, int block ) {
+		QModelIndex iBlock = nif->getBlock( block );
+		return nif->getBlockType( iBlock ) + QLatin1Char( '|' ) + nif->getBlockName( iBlock );
+	};
+
+	// The unmatched blocks of the modified file by key, in file order
+	auto candidates = [this]( const std::function<QString( int )> & keyOf ) {
+		QHash<QString, QVector<int>> blocks;
+		for ( int b = 0; b < matchB.count(); b++ ) {
+			if ( matchB.at( b ) < 0 )
+				blocks[keyOf( b )].append( b );
+		}
+		return blocks;
+	};
+
+	auto matchBy = [this, &candidates, &match]( const std::function<QString( const NifModel *, int )> & keyOf ) {
+		QHash<QString, QVector<int>> blocks = candidates( [this, &keyOf]( int b ) { return keyOf( nifB, b ); } );
+		QHash<QString, int> taken;
+
+		for ( int a = 0; a < matchA.count(); a++ ) {
+			if ( matchA.at( a ) >= 0 )
+				continue;
+
+			QString k = keyOf( nifA, a );
+			auto it = blocks.constFind( k );
+			if ( it == blocks.constEnd() )
+				continue;
+
+			int & next = taken[k];
+			if ( next < it.value().count() )
+				match( a, it.value().at( next++ ) );
+		}
+	};
+
+	// Unchanged blocks first, then through the links, then by name and finally by type alone
+	matchBy( [&key]( const NifModel * nif, int block ) {
+		return key( nif, block ) + QLatin1Char( '|' ) + QString::number( nif->digest( nif->getBlock( block ) ), 16 );
+	} );
+	matchLinked();
+
+	matchBy( key );
+	matchLinked();
+
+	matchBy( []( const NifModel * nif, int block ) { return nif->getBlockType( nif->getBlock( block ) ); } );
+}
+
+void NifDiff::matchLinked()
+{
+	bool found = true;
+
+	while ( found ) {
+		found = false;
+
+		for ( int a = 0; a < matchA.count(); a++ ) {
+			int b = matchA.at( a );
+			if ( b < 0 )
+				continue;
+
+			const QList<int> linksA = nifA->getChildLinks( a );
+			const QList<int> linksB = nifB->getChildLinks( b );
+
+			for ( int l = 0; l < std::min( linksA.count(), linksB.count() ); l++ ) {
+				int la = linksA.at( l );
+				int lb = linksB.at( l );
+
+				if ( la < 0 || lb < 0 || la >= matchA.count() || lb >= matchB.count() )
+					continue;
+				if ( matchA.at( la ) >= 0 || matchB.at( lb ) >= 0 )
+					continue;
+				if ( nifA->getBlockType( nifA->getBlock( la ) ) != nifB->getBlockType( nifB->getBlock( lb ) ) )
+					continue;
+
+				matchA[la] = lb;
+				matchB[lb] = la;
+				found = true;
+			}
+		}
+	}
+}
+
+void NifDiff::compareItems( const QModelIndex & a, const QModelIndex & b, const QString & path, Change & change, bool prune )
+{
+	if ( truncated )
+		return;
+
+	// Links digest the type and name of their target, which other blocks may share
+	if ( path.isEmpty() && nifA->getBlockNumber( a ) >= 0 ) {
+		QList<int> mapped;
+		for ( int l : nifA->getChildLinks( nifA->getBlockNumber( a ) ) )
+			mapped << ( ( l >= 0 && l < matchA.count() ) ? matchA.at( l ) : -1 );
+
+		prune = ( mapped == nifB->getChildLinks( nifB->getBlockNumber( b ) ) );
+	}
+
+	if ( prune && nifA->digest( a ) == nifB->digest( b ) )
+		return;
+
+	const int rowsA = nifA->rowCount( a );
+	const int rowsB = nifB->rowCount( b );
+
+	if ( rowsA == 0 && rowsB == 0 ) {
+		const NifValue & va = nifA->getValue( a );
+		const NifValue & vb = nifB->getValue( b );
+
+		if ( va.isLink() && vb.isLink() ) {
+			int la = nifA->getLink( a );
+			int lb = nifB->getLink( b );
+
+			// Links are the same when their targets were matched with each other
+			if ( la < 0 && lb < 0 )
+				return;
+			if ( la >= 0 && lb >= 0 && la < matchA.count() && matchA.at( la ) == lb )
+				return;
+		} else if ( va.type() == vb.type() && va.digest() == vb.digest()
+		            && ( va.type() != NifValue::tStringIndex || nifA->string( a ) == nifB->string( b ) ) ) {
+			return;
+		}
+
+		change.kind = Change::Changed;
+		change.path = path;
+		change.before = valueText( nifA, a );
+		change.after = valueText( nifB, b );
+		addChange( change );
+		return;
+	}
+
+	// The items failing their conditions are not in the file
+	auto present = []( const NifModel * nif, const QModelIndex & parent ) {
+		QVector<QModelIndex> rows;
+		for ( int r = 0; r < nif->rowCount( parent ); r++ ) {
+			QModelIndex child = nif->index( r, 0, parent );
+			if ( nif->evalCondition( child ) )
+				rows.append( child );
+		}
+		return rows;
+	};
+
+	const QVector<QModelIndex> childrenA = present( nifA, a );
+	const QVector<QModelIndex> childrenB = present( nifB, b );
+
+	const bool array = nifA->isArray( a );
+	const bool header = ( a == nifA->getHeader() );
+
+	auto childPath = [&path, array]( int row, const QString & name ) {
+		if ( array )
+			return path + QString( "[%1]" ).arg( row );
+
+		return path.isEmpty() ? name : path + QLatin1Char( '/' ) + name;
+	};
+
+	const int common = std::min( childrenA.count(), childrenB.count() );
+
+	for ( int r = 0; r < common && !truncated; r++ ) {
+		QString nameA = nifA->itemName( childrenA.at( r ) );
+		QString nameB = nifB->itemName( childrenB.at( r ) );
+
+		if ( header && derivedHeaderFields.contains( nameA ) )
+			continue;
+
+		if ( nameA != nameB ) {
+			// The layouts differ, as between versions
+			change.kind = Change::Changed;
+			change.path = childPath( r, nameA );
+			change.before = nameA;
+			change.after = nameB;
+			addChange( change );
+			continue;
+		}
+
+		compareItems( childrenA.at( r ), childrenB.at( r ), childPath( r, nameA ), change, prune );
+	}
+
+	for ( int r = common; r < childrenA.count() && !truncated; r++ ) {
+		QString name = nifA->itemName( childrenA.at( r ) );
+		if ( header && derivedHeaderFields.contains( name ) )
+			continue;
+
+		change.kind = Change::Removed;
+		change.path = childPath( r, name );
+		change.before = valueText( nifA, childrenA.at( r ) );
+		change.after.clear();
+		addChange( change );
+	}
+
+	for ( int r = common; r < childrenB.count() && !truncated; r++ ) {
+		QString name = nifB->itemName( childrenB.at( r ) );
+		if ( header && derivedHeaderFields.contains( name ) )
+			continue;
+
+		change.kind = Change::Added;
+		change.path = childPath( r, name );
+		change.before.clear();
+		change.after = valueText( nifB, childrenB.at( r ) );
+		addChange( change );
+	}
+}
+
+void NifDiff::addChange( const Change & change )
+{
+	if ( truncated )
+		return;
+
+	if ( listed++ < limit ) {
+		results.append( change );
+		return;
+	}
+
+	Change more = change;
+	more.kind = Change::Changed;
+	more.path = tr( "(more fields differ)" );
+	more.before.clear();
+	more.after.clear();
+	results.append( more );
+
+	truncated = true;
+}
+
+QString NifDiff::valueText( const NifModel * nif, const QModelIndex & index ) const
+{
+	const NifValue & value = nif->getValue( index );
+
+	if ( value.isLink() ) {
+		int link = nif->getLink( index );
+		return ( link < 0 ) ? QString( "None" ) : blockText( nif, link ) + QString( " [%1]" ).arg( link );
+	}
+
+	if ( value.type() == NifValue::tStringIndex )
+		return nif->string( index );
+
+	return nif->data( index.sibling( index.row(), NifModel::ValueCol ) ).toString();
+}
+
+QString NifDiff::blockText( const NifModel * nif, int block ) const
+{
+	QModelIndex iBlock = nif->getBlock( block );
+	QString name = nif->getBlockName( iBlock );
+
+	if ( name.isEmpty() )
+		return nif->getBlockType( iBlock );
+
+	return QString( "%1 \"%2\"" ).arg( nif->getBlockType( iBlock ), name );
+}
+
+void NifDiff::report( QTextStream & out ) const
+{
+	out << "Change\tOriginal\tModified\tBlock\tField\tBefore\tAfter\n";
+
+	// Newlines and tabs of the values would break the rows
+	auto cell = []( QString text ) {
+		return text.replace( '\t', ' ' ).replace( '\n', ' ' );
+	};
+
+	for ( const Change & c : results ) {
+		QString kind = ( c.kind == Change::Added ) ? tr( "added" ) : ( c.kind == Change::Removed ) ? tr( "removed" ) : tr( "changed" );
+
+		QString block;
+		if ( c.original >= 0 )
+			block = blockText( nifA, c.original );
+		else if ( c.modified >= 0 )
+			block = blockText( nifB, c.modified );
+		else
+			block = tr( "Header" );
+
+		out << kind << '\t'
+		    << ( c.original >= 0 ? QString::number( c.original ) : QString( "-" ) ) << '\t'
+		    << ( c.modified >= 0 ? QString::number( c.modified ) : QString( "-" ) ) << '\t'
+		    << cell( block ) << '\t' << cell( c.path ) << '\t' << cell( c.before ) << '\t' << cell( c.after ) << '\n';
+	}
+}
@@ -0,0 +1,126 @@
+/***** BEGIN LICENSE BLOCK *****
+
+BSD License
+
+Copyright (c) 2005-2015, NIF File Format Library and Tools
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the NIF File Format Library and Tools project may not be
+   used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+***** END LICENCE BLOCK *****/
+
+#ifndef NIFDIFF_H
+#define NIFDIFF_H
+
+#include <QCoreApplication>
+#include <QModelIndex>
+#include <QString>
+#include <QVector>
+
+
+//! \file nifdiff.h NifDiff
+
+class NifModel;
+class QTextStream;
+
+//! Lists the blocks and fields which differ between two loaded NIFs
+/*!
+ * Blocks are matched first by type, name and digest, then through the links
+ * of matched blocks, then by type and name, and finally by type alone, each
+ * in the order of the files. The fields of matched blocks are compared
+ * below the items whose NifModel::digest() differs, so identical subtrees
+ * are skipped without being walked.
+ *
+ * Links compare equal when their targets were matched with each other, and
+ * header string indices by their strings. Of the header only the fields
+ * which are not derived from the blocks are compared.
+ *
+ * Used by <tt>NifSkope -no-gui --diff original.nif modified.nif</tt>, see main().
+ */
+class NifDiff final
+{
+	Q_DECLARE_TR_FUNCTIONS( NifDiff )
+
+public:
+	//! A block or field which differs
+	struct Change
+	{
+		enum Kind
+		{
+			Added,
+			Removed,
+			Changed
+		};
+
+		Kind kind = Changed;
+		//! The block in the original and in the modified NIF, -1 for an added or removed block or the header
+		int original = -1;
+		int modified = -1;
+		//! The field within the block, empty for a whole block
+		QString path;
+		QString before;
+		QString after;
+	};
+
+	//! List at most this many fields per block, then a single row saying more differ
+	void setLimit( int num ) { limit = qMax( 1, num ); }
+
+	//! Compare two NIFs, returning the number of changes
+	int compare( const NifModel * original, const NifModel * modified );
+
+	//! The changes found by the last compare()
+	const QVector<Change> & changes() const { return results; }
+
+	//! Print a tab separated row per change
+	void report( QTextStream & out ) const;
+
+protected:
+	//! Match the blocks of the two files, filling matchA and matchB
+	void matchBlocks();
+	//! Match the unmatched blocks linked at the same positions from matched blocks, until none are left
+	void matchLinked();
+	//! Add a change of the fields below two items, skipping the items with equal digests if \a prune
+	void compareItems( const QModelIndex & a, const QModelIndex & b, const QString & path, Change & change, bool prune = true );
+	//! Add a change, stopping at the limit of the block
+	void addChange( const Change & change );
+	//! The value of a field as text, links by their target
+	QString valueText( const NifModel * nif, const QModelIndex & index ) const;
+	//! "Type Name" of a block
+	QString blockText( const NifModel * nif, int block ) const;
+
+	const NifModel * nifA = nullptr;
+	const NifModel * nifB = nullptr;
+
+	//! The block of the other NIF matched with each block, -1 if there is none
+	QVector<int> matchA;
+	QVector<int> matchB;
+
+	QVector<Change> results;
+	int limit = 100;
+	//! Fields listed for the block being compared
+	int listed = 0;
+	bool truncated = false;
+};
+
+#endif
@@ -0,0 +1,306 @@
+/***** BEGIN LICENSE BLOCK *****
+
+BSD License
+
+Copyright (c) 2005-2015, NIF File Format Library and Tools
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the NIF File Format Library and Tools project may not be
+   used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+***** END LICENCE BLOCK *****/
+
+#include "nifmodel.h"
+#include "settingssnapshot.h"
+
+#include <QBuffer>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QHash>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QSysInfo>
+
+
+//! \file nifdocumentcache.cpp NifModel document cache
+
+//! Identifies a document cache file
+#define DOCUMENT_CACHE_MAGIC 0x4e444f43
+//! Bump when the layout of the document cache changes
+#define DOCUMENT_CACHE_VERSION 1
+
+//! The cache file of a NIF, named by the SHA-1 of its absolute path, empty if there is no cache folder
+static QString documentCacheName( const QFileInfo & file )
+{
+	QString cacheDir = QStandardPaths::writableLocation( QStandardPaths::CacheLocation );
+	if ( cacheDir.isEmpty() )
+		return QString();
+
+	QByteArray key = QCryptographicHash::hash( file.absoluteFilePath().toUtf8(), QCryptographicHash::Sha1 );
+
+	return QDir( cacheDir ).filePath( QString( "documents/%1.cache" ).arg( QString( key.toHex() ) ) );
+}
+
+//! Write the key a cache file is valid for, the hash of the schema standing for the build as well
+static void saveDocumentKey( QDataStream & out, const QFileInfo & file, const QByteArray & xmlHash )
+{
+	out << quint32( DOCUMENT_CACHE_MAGIC ) << quint32( DOCUMENT_CACHE_VERSION ) << quint8( QSysInfo::ByteOrder )
+	    << file.absoluteFilePath() << qint64( file.size() ) << qint64( file.lastModified().toMSecsSinceEpoch() )
+	    << xmlHash;
+}
+
+//! Write an item and its children, adding the data they describe themselves with to \a table
+static void saveDocumentItem( QDataStream & out, NifItem * item, QHash<const void *, quint32> & ids, QVector<const NifItem *> & table )
+{
+	auto it = ids.constFind( item->sharedId() );
+	if ( it == ids.constEnd() ) {
+		it = ids.insert( item->sharedId(), quint32( table.count() ) );
+		table.append( item );
+	}
+
+	out << it.value()
+	    << qint8( item->isConditionValid() ? item->condition() : -1 )
+	    << qint8( item->isVercondValid() ? item->versionCondition() : -1 );
+
+	item->value().saveTo( out );
+
+	out << item->arrayConditions() << quint32( item->childCount() );
+
+	for ( NifItem * child : item->children() )
+		saveDocumentItem( out, child, ids, table );
+}
+
+//! Write the data an item describes itself with, as saveXmlData() without the default value
+static void saveDocumentData( QDataStream & out, const NifItem * item )
+{
+	out << item->name() << item->type() << item->temp() << item->arg()
+	    << item->arr1() << item->arr2() << item->cond() << item->ver1() << item->ver2()
+	    << item->text() << item->vercond();
+
+	out << item->isAbstract() << item->isBinary() << item->isTemplated() << item->isCompound()
+	    << item->isArray() << item->isMultiArray() << item->isConditionless();
+}
+
+//! Read the data written by saveDocumentData()
+static NifData loadDocumentData( QDataStream & in )
+{
+	QString name, type, temp, arg, arr1, arr2, cond, text, vercond;
+	quint32 ver1, ver2;
+	in >> name >> type >> temp >> arg >> arr1 >> arr2 >> cond >> ver1 >> ver2 >> text >> vercond;
+
+	bool abs, bin, tmpl, cmpd, arr, marr, condless;
+	in >> abs >> bin >> tmpl >> cmpd >> arr >> marr >> condless;
+
+	NifData data( name, type, temp, NifValue( NifValue::type( type ) ), arg, arr1, arr2, cond, ver1, ver2 );
+
+	data.setAbstract( abs );
+	data.setBinary( bin );
+	data.setTemplated( tmpl );
+	data.setIsCompound( cmpd );
+	data.setIsArray( arr );
+	data.setIsMultiArray( marr );
+	data.setIsConditionless( condless );
+	data.setText( text );
+
+	if ( !vercond.isEmpty() )
+		data.setVerCond( vercond );
+
+	return data;
+}
+
+//! Read an item written by saveDocumentItem() and append it to \a parent, then read its children
+static bool loadDocumentItem( QDataStream & in, NifItem * parent, const QVector<NifData> & table )
+{
+	quint32 id = 0;
+	qint8 cond = -1, vercond = -1;
+	in >> id >> cond >> vercond;
+
+	if ( in.status() != QDataStream::Ok || id >= quint32( table.count() ) )
+		return false;
+
+	NifItem * item = new NifItem( table.at( int( id ) ), parent );
+
+	if ( !item->value().loadFrom( in ) ) {
+		delete item;
+		return false;
+	}
+
+	if ( cond >= 0 )
+		item->setCondition( cond );
+	if ( vercond >= 0 )
+		item->setVersionCondition( vercond );
+
+	QVector<bool> arrConds;
+	quint32 rows = 0;
+	in >> arrConds >> rows;
+
+	item->resetArrayConditions( arrConds.count() );
+	for ( int c = 0; c < arrConds.count(); c++ )
+		item->updateArrayCondition( arrConds.at( c ), c );
+
+	// The links of the item are registered with its ancestors as it is appended
+	parent->appendChild( item );
+
+	// Every item takes more than a byte, so a broken count does not allocate
+	if ( in.status() != QDataStream::Ok || rows > quint32( in.device()->bytesAvailable() ) )
+		return false;
+
+	for ( quint32 r = 0; r < rows; r++ ) {
+		if ( !loadDocumentItem( in, item, table ) )
+			return false;
+	}
+
+	return true;
+}
+
+// documented in nifmodel.h
+bool NifModel::loadCached( const QFileInfo & file )
+{
+	// The schema clear() takes over, which the cache must have been written with
+	NifSchemaPtr xml = currentSchema();
+
+	if ( !SettingsSnapshot::get()->documentCache || !xml || xml->hash.isEmpty() )
+		return false;
+
+	QString cachename = documentCacheName( file );
+	if ( cachename.isEmpty() )
+		return false;
+
+	QFile f( cachename );
+	if ( !f.open( QIODevice::ReadOnly ) )
+		return false;
+
+	// Compare the key before reading the rest of the file
+	QByteArray expected;
+	{
+		QBuffer buffer( &expected );
+		buffer.open( QIODevice::WriteOnly );
+		QDataStream out( &buffer );
+		out.setVersion( QDataStream::Qt_5_0 );
+		saveDocumentKey( out, file, xml->hash );
+	}
+
+	if ( f.read( expected.size() ) != expected )
+		return false;
+
+	QByteArray data = f.readAll();
+	QBuffer buffer( &data );
+	buffer.open( QIODevice::ReadOnly );
+
+	QDataStream in( &buffer );
+	in.setVersion( QDataStream::Qt_5_0 );
+
+	quint32 fileVersion = 0, descriptors = 0;
+	in >> fileVersion >> descriptors;
+
+	if ( in.status() != QDataStream::Ok || descriptors > quint32( buffer.bytesAvailable() ) )
+		return false;
+
+	QVector<NifData> table;
+	table.reserve( int( descriptors ) );
+	for ( quint32 i = 0; i < descriptors && in.status() == QDataStream::Ok; i++ )
+		table.append( loadDocumentData( in ) );
+
+	quint32 rows = 0;
+	in >> rows;
+
+	if ( in.status() != QDataStream::Ok || rows < 2 || rows > quint32( buffer.bytesAvailable() ) )
+		return false;
+
+	clear();
+
+	if ( state != Loading )
+		setState( Loading );
+
+	root->killChildren();
+
+	bool ok = true;
+	for ( quint32 r = 0; r < rows && ok; r++ )
+		ok = loadDocumentItem( in, root, table );
+
+	if ( !ok || !buffer.atEnd() ) {
+		clear();
+		resetState();
+		return false;
+	}
+
+	version = fileVersion;
+	updateVersionKey();
+
+	// Whether the blocks ended where the header said is not kept, so the sizes are measured on save
+	updateBlockTable();
+	blockTable.invalidateSizes();
+
+	reset();
+	return true;
+}
+
+// documented in nifmodel.h
+void NifModel::saveCached( const QFileInfo & file ) const
+{
+	if ( !SettingsSnapshot::get()->documentCache || !schema || schema->hash.isEmpty() )
+		return;
+
+	QString cachename = documentCacheName( file );
+	if ( cachename.isEmpty() )
+		return;
+
+	loadPendingBlocks();
+
+	// The items come first so that the table of their data is complete when it is written
+	QByteArray items;
+	QHash<const void *, quint32> ids;
+	QVector<const NifItem *> table;
+	{
+		QBuffer buffer( &items );
+		buffer.open( QIODevice::WriteOnly );
+		QDataStream out( &buffer );
+		out.setVersion( QDataStream::Qt_5_0 );
+
+		out << quint32( root->childCount() );
+		for ( NifItem * row : root->children() )
+			saveDocumentItem( out, row, ids, table );
+	}
+
+	QDir().mkpath( QFileInfo( cachename ).absolutePath() );
+
+	QSaveFile f( cachename );
+	if ( !f.open( QIODevice::WriteOnly ) )
+		return;
+
+	QDataStream out( &f );
+	out.setVersion( QDataStream::Qt_5_0 );
+
+	saveDocumentKey( out, file, schema->hash );
+	out << quint32( version ) << quint32( table.count() );
+
+	for ( const NifItem * item : table )
+		saveDocumentData( out, item );
+
+	out.writeRawData( items.constData(), items.size() );
+
+	f.commit();
+}
@@ -300,6 +300,83 @@ QString Expression::toString() const
 	return QString();
 }
 
+QVariant Expression::apply( Operator op, const QVariant & l, const QVariant & r )
+{
+	switch ( op ) {
+	case Expression::e_not:
+		return QVariant::fromValue( !r.toBool() );
+	case Expression::e_not_eq:
+		return QVariant::fromValue( l != r );
+	case Expression::e_eq:
+		return QVariant::fromValue( l == r );
+	case Expression::e_gte:
+		return QVariant::fromValue( l.toUInt() >= r.toUInt() );
+	case Expression::e_lte:
+		return QVariant::fromValue( l.toUInt() <= r.toUInt() );
+	case Expression::e_gt:
+		return QVariant::fromValue( l.toUInt() > r.toUInt() );
+	case Expression::e_lt:
+		return QVariant::fromValue( l.toUInt() < r.toUInt() );
+	case Expression::e_bit_and:
+		return QVariant::fromValue( l.toUInt() & r.toUInt() );
+	case Expression::e_bit_or:
+		return QVariant::fromValue( l.toUInt() | r.toUInt() );
+	case Expression::e_add:
+		return QVariant::fromValue( l.toUInt() + r.toUInt() );
+	case Expression::e_sub:
+		return QVariant::fromValue( l.toUInt() - r.toUInt() );
+	case Expression::e_div:
+		return QVariant::fromValue( l.toUInt() / r.toUInt() );
+	case Expression::e_mul:
+		return QVariant::fromValue( l.toUInt() * r.toUInt() );
+	case Expression::e_bool_and:
+		return QVariant::fromValue( l.toBool() && r.toBool() );
+	case Expression::e_bool_or:
+		return QVariant::fromValue( l.toBool() || r.toBool() );
+	case Expression::e_nop:
+		return l;
+	}
+
+	return l;
+}
+
+void Expression::compile()
+{
+	program.clear();
+
+	// An empty condition evaluates to an invalid variant
+	if ( opcode == Expression::e_nop && !lhs.isValid() )
+		return;
+
+	compileExpression( *this, program );
+}
+
+void Expression::compileOperand( const QVariant & v, QVector<Instruction> & out )
+{
+	if ( v.type() == QVariant::UserType && v.canConvert<Expression>() )
+		compileExpression( v.value<Expression>(), out );
+	else
+		out.append( { Expression::e_nop, v } );
+}
+
+void Expression::compileExpression( const Expression & e, QVector<Instruction> & out )
+{
+	switch ( e.opcode ) {
+	case Expression::e_nop:
+		compileOperand( e.lhs, out );
+		break;
+	case Expression::e_not:
+		compileOperand( e.rhs, out );
+		out.append( { Expression::e_not, QVariant() } );
+		break;
+	default:
+		compileOperand( e.lhs, out );
+		compileOperand( e.rhs, out );
+		out.append( { e.opcode, QVariant() } );
+		break;
+	}
+}
+
 void Expression::NormalizeVariants( QVariant & l, QVariant & r ) const
 {
 	if ( l.isValid() && r.isValid() ) {
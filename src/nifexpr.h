@@ -36,7 +36,9 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <QRegularExpression>
 #include <QString>
+#include <QVarLengthArray>
 #include <QVariant>
+#include <QVector>
 
 
 //! @file nifexpr.h Expression
@@ -52,6 +54,16 @@ class Expression final
 	QVariant rhs;
 	Operator opcode;
 
+	//! A step of the compiled expression, either pushes a converted operand or applies an operator
+	struct Instruction
+	{
+		Operator op;
+		QVariant operand;
+	};
+
+	//! The expression tree flattened into postfix order
+	QVector<Instruction> program;
+
 public:
 	explicit Expression()
 	{
@@ -62,12 +74,14 @@ public:
 	{
 		opcode = Expression::e_nop;
 		partition( cond.mid( startpos, endpos - startpos + 1 ) );
+		compile();
 	}
 
 	Expression( const QString & cond )
 	{
 		opcode = Expression::e_nop;
 		partition( cond );
+		compile();
 	}
 
 	QString toString() const;
@@ -76,46 +90,27 @@ public:
 	template <class F>
 	QVariant evaluateValue( const F & convert ) const
 	{
-		QVariant l = convertValue( lhs, convert );
-		QVariant r = convertValue( rhs, convert );
-		NormalizeVariants( l, r );
-
-		switch ( opcode ) {
-		case Expression::e_not:
-			return QVariant::fromValue( !r.toBool() );
-		case Expression::e_not_eq:
-			return QVariant::fromValue( l != r );
-		case Expression::e_eq:
-			return QVariant::fromValue( l == r );
-		case Expression::e_gte:
-			return QVariant::fromValue( l.toUInt() >= r.toUInt() );
-		case Expression::e_lte:
-			return QVariant::fromValue( l.toUInt() <= r.toUInt() );
-		case Expression::e_gt:
-			return QVariant::fromValue( l.toUInt() > r.toUInt() );
-		case Expression::e_lt:
-			return QVariant::fromValue( l.toUInt() < r.toUInt() );
-		case Expression::e_bit_and:
-			return QVariant::fromValue( l.toUInt() & r.toUInt() );
-		case Expression::e_bit_or:
-			return QVariant::fromValue( l.toUInt() | r.toUInt() );
-		case Expression::e_add:
-			return QVariant::fromValue( l.toUInt() + r.toUInt() );
-		case Expression::e_sub:
-			return QVariant::fromValue( l.toUInt() - r.toUInt() );
-		case Expression::e_div:
-			return QVariant::fromValue( l.toUInt() / r.toUInt() );
-		case Expression::e_mul:
-			return QVariant::fromValue( l.toUInt() * r.toUInt() );
-		case Expression::e_bool_and:
-			return QVariant::fromValue( l.toBool() && r.toBool() );
-		case Expression::e_bool_or:
-			return QVariant::fromValue( l.toBool() || r.toBool() );
-		case Expression::e_nop:
-			return l;
+		if ( program.isEmpty() )
+			return evaluateTree( convert );
+
+		// Run the compiled program, operands are converted in the order the tree would convert them
+		QVarLengthArray<QVariant, 8> stack;
+
+		for ( const Instruction & ins : program ) {
+			if ( ins.op == Expression::e_nop ) {
+				stack.append( convert( ins.operand ) );
+			} else if ( ins.op == Expression::e_not ) {
+				stack.last() = QVariant::fromValue( !stack.last().toBool() );
+			} else {
+				QVariant r = stack.last();
+				stack.removeLast();
+				QVariant & l = stack.last();
+				NormalizeVariants( l, r );
+				l = apply( ins.op, l, r );
+			}
 		}
 
-		return l;
+		return stack.isEmpty() ? QVariant() : stack.last();
 	}
 
 	template <class F>
@@ -135,6 +130,28 @@ private:
 	void partition( const QString & cond, int offset = 0 );
 	void NormalizeVariants( QVariant & l, QVariant & r ) const;
 
+	//! Flatten the expression tree into program
+	void compile();
+	//! Append the postfix program of an operand to \a out
+	static void compileOperand( const QVariant & v, QVector<Instruction> & out );
+	//! Append the postfix program of an expression to \a out
+	static void compileExpression( const Expression & e, QVector<Instruction> & out );
+	//! Apply a binary operator to normalized operands
+	static QVariant apply( Operator op, const QVariant & l, const QVariant & r );
+
+	template <class F>
+	QVariant evaluateTree( const F & convert ) const
+	{
+		QVariant l = convertValue( lhs, convert );
+		QVariant r = convertValue( rhs, convert );
+		NormalizeVariants( l, r );
+
+		if ( opcode == Expression::e_not )
+			return QVariant::fromValue( !r.toBool() );
+
+		return apply( opcode, l, r );
+	}
+
 	template <class F>
 	QVariant convertValue( const QVariant & v, const F & convert ) const
 	{
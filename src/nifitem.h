@@ -37,12 +37,84 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "nifvalue.h"
 
 #include <QSharedData> // Inherited
+#include <QBitArray>
+#include <QHash>
 #include <QPointer>
+#include <QReadWriteLock>
 #include <QString>
 #include <QVector>
 
+#include <atomic>
 
-//! @file nifitem.h NifItem, NifBlock, NifData, NifSharedData
+
+//! @file nifitem.h NifItem, NifBlock, NifData, NifSharedData, NifNames, NifFieldId
+
+//! Table of interned item names, so that names can be compared by id
+class NifNames final
+{
+public:
+	//! Return the id of a name, adding it to the table if needed
+	static int id( const QString & name );
+
+private:
+	static QReadWriteLock lock;
+	static QHash<QString, int> ids;
+};
+
+/*! A field name with its interned id
+ *
+ * Construct once (e.g. as a static) and pass to NifModel::get(), NifModel::set()
+ * or NifModel::getIndex() to look up the same field repeatedly with integer compares.
+ */
+struct NifFieldId
+{
+	explicit NifFieldId( const QString & n ) : name( n ), id( NifNames::id( n ) ) {}
+
+	//! The name, for paths and messages
+	QString name;
+	//! The interned id of the name
+	int id;
+};
+
+/*! A version condition result cached for one set of header versions.
+ *
+ * The result is shared by every model reading files with the same versions, so it is read
+ * and written without a lock.
+ */
+class NifVersionCache final
+{
+public:
+	NifVersionCache() {}
+	NifVersionCache( const NifVersionCache & other )
+		: entry( other.entry.load( std::memory_order_relaxed ) ) {}
+
+	NifVersionCache & operator=( const NifVersionCache & other )
+	{
+		entry.store( other.entry.load( std::memory_order_relaxed ), std::memory_order_relaxed );
+		return *this;
+	}
+
+	//! Get the result cached for \a key, if any
+	bool get( quint32 key, bool & result ) const
+	{
+		quint32 e = entry.load( std::memory_order_relaxed );
+		if ( (e >> 1) != key )
+			return false;
+
+		result = e & 1;
+		return true;
+	}
+
+	//! Cache the result for \a key
+	void set( quint32 key, bool result )
+	{
+		entry.store( (key << 1) | (result ? 1 : 0), std::memory_order_relaxed );
+	}
+
+private:
+	//! Version key shifted left by one, and the result in the lowest bit
+	std::atomic<quint32> entry{ 0 };
+};
 
 /*! Shared data for NifData.
  *
@@ -71,22 +143,24 @@ private:
 
 	NifSharedData( const QString & n, const QString & t, const QString & tt, const QString & a, const QString & a1,
 				   const QString & a2, const QString & c, quint32 v1, quint32 v2, NifSharedData::DataFlags f )
-		: QSharedData(), name( n ), type( t ), temp( tt ), arg( a ), arr1( a1 ), arr2( a2 ),
+		: QSharedData(), name( n ), nameId( NifNames::id( n ) ), type( t ), temp( tt ), arg( a ), arr1( a1 ), arr2( a2 ),
 		cond( c ), ver1( v1 ), ver2( v2 ), condexpr( c ), arr1expr( a1 ), flags( f )
 	{
 	}
 
 	NifSharedData( const QString & n, const QString & t )
-		: QSharedData(), name( n ), type( t ) {}
+		: QSharedData(), name( n ), nameId( NifNames::id( n ) ), type( t ) {}
 
 	NifSharedData( const QString & n, const QString & t, const QString & txt )
-		: QSharedData(), name( n ), type( t ), text( txt ) {}
+		: QSharedData(), name( n ), nameId( NifNames::id( n ) ), type( t ), text( txt ) {}
 
 	NifSharedData()
 		: QSharedData() {}
 
 	//! Name.
 	QString name;
+	//! Interned id of the name.
+	int nameId = -1;
 	//! Type.
 	QString type;
 	//! Template type.
@@ -113,6 +187,12 @@ private:
 	QString vercond;
 	//! Version condition as an expression.
 	Expression verexpr;
+	//! Interned names of the sibling fields whose cond or arg refer to this field.
+	QVector<int> dependents;
+	//! Whether the dependents were indexed from the XML.
+	bool dependentsIndexed = false;
+	//! Version condition result for the last header versions it was evaluated with.
+	mutable NifVersionCache vercache;
 
 	DataFlags flags = None;
 };
@@ -137,6 +217,8 @@ public:
 
 	//! Get the name of the data.
 	inline const QString & name() const { return d->name; }
+	//! Get the interned id of the name of the data.
+	inline int nameId() const { return d->nameId; }
 	//! Get the type of the data.
 	inline const QString & type() const { return d->type; }
 	//! Get the template type of the data.
@@ -163,6 +245,14 @@ public:
 	inline const QString & vercond() const { return d->vercond; }
 	//! Get the version condition attribute of the data, as an expression.
 	inline const Expression & verexpr() const { return d->verexpr; }
+	//! Get the interned names of the sibling fields which depend on the data.
+	inline const QVector<int> & dependents() const { return d->dependents; }
+	//! Identifies the shared data, which is the same for the copies of a NifData until one is changed.
+	inline const void * sharedId() const { return d.constData(); }
+	//! Have the dependents of the data been indexed.
+	inline bool hasDependencyIndex() const { return d->dependentsIndexed; }
+	//! Get the version condition result shared by all items of the data.
+	inline NifVersionCache & versionCache() const { return d->vercache; }
 	//! Get the abstract attribute of the data.
 	inline bool isAbstract() const { return d->flags & NifSharedData::Abstract; }
 	//! Is the data binary. Binary means the data is being treated as one blob.
@@ -179,7 +269,7 @@ public:
 	inline bool isConditionless() const { return d->flags & NifSharedData::Conditionless; }
 
 	//! Sets the name of the data.
-	void setName( const QString & name ) { d->name = name; }
+	void setName( const QString & name ) { d->name = name; d->nameId = NifNames::id( name ); }
 	//! Sets the type of the data.
 	void setType( const QString & type ) { d->type = type; }
 	//! Sets the template type of the data.
@@ -212,6 +302,12 @@ public:
 		d->vercond = cond;
 		d->verexpr = Expression( cond );
 	}
+	//! Sets the interned names of the sibling fields which depend on the data.
+	void setDependents( const QVector<int> & ids )
+	{
+		d->dependents = ids;
+		d->dependentsIndexed = true;
+	}
 
 	inline void setFlag( NifSharedData::DataFlags flag, bool val )
 	{
@@ -254,6 +350,10 @@ struct NifBlock
 	bool abstract = false;
 	//! Data present.
 	QList<NifData> types;
+	//! Type id, assigned by NifModel::indexBlockTypes().
+	int typeId = -1;
+	//! Bits set for the type ids of the block and all its ancestors.
+	QBitArray ancestry;
 };
 
 //! An item which contains NifData
@@ -271,6 +371,20 @@ public:
 		qDeleteAll( childItems );
 	}
 
+	//! Allocate from the chunks of the calling thread instead of the general heap
+	static void * operator new( size_t size );
+	//! Release the slot, freeing its chunk with the last item in it
+	static void operator delete( void * ptr, size_t size );
+	//! The number of items the calling thread allocated so far, for benchmarks
+	static quint64 allocations();
+
+	//! Add the bytes of this item and the items below it to \a items, and of their values to \a values
+	/*!
+	 * The items are counted at the size of their slots. The data shared
+	 * with the item templates of the XML is not included.
+	 */
+	void memoryUsage( qint64 & items, qint64 & values, int & count ) const;
+
 	//! Return the parent item.
 	NifItem * parent() const
 	{
@@ -298,6 +412,18 @@ public:
 		childItems.reserve( childItems.count() + e );
 	}
 
+	//! Return the block this item was last found under
+	NifItem * cachedBlock() const
+	{
+		return owningBlock;
+	}
+
+	//! Remember the block this item was found under
+	void setCachedBlock( NifItem * block ) const
+	{
+		owningBlock = block;
+	}
+
 	//! Get child items
 	const QVector<NifItem *> & children()
 	{
@@ -351,6 +477,94 @@ public:
 		return child->row();
 	}
 
+	/*! Append a child item whose conditions and value are already known
+	 *
+	 * As insertChild(), without looking up the row of the child.
+	 *
+	 * @param child The item to append
+	 */
+	void appendChild( NifItem * child )
+	{
+		child->parentItem = this;
+		child->rowIdx = childItems.count();
+		childItems.append( child );
+
+		populateLinksUp( child );
+	}
+
+	/*! Copy the item and its children
+	 *
+	 * @param parent	The parent of the copy
+	 * @return			The copy, which belongs to the caller
+	 */
+	NifItem * clone( NifItem * parent ) const
+	{
+		NifItem * item = new NifItem( itemData, parent );
+		item->linkAncestorRows = linkAncestorRows;
+		item->linkRows = linkRows;
+		item->conditionStatus = conditionStatus;
+		item->vercondStatus = vercondStatus;
+		item->arrConds = arrConds;
+
+		item->childItems.reserve( childItems.count() );
+		for ( const NifItem * child : childItems )
+			item->childItems.append( child->clone( item ) );
+
+		return item;
+	}
+
+	/*! Append copies of a child item
+	 *
+	 * Faster than inserting each element of an array from its NifData, when
+	 * the types of the elements have been resolved once.
+	 *
+	 * @param child	The item to copy
+	 * @param count	The number of copies
+	 */
+	void appendClones( const NifItem * child, int count )
+	{
+		bool hasLinks = !child->linkRows.isEmpty() || !child->linkAncestorRows.isEmpty();
+
+		childItems.reserve( childItems.count() + count );
+
+		for ( int n = 0; n < count; n++ ) {
+			NifItem * item = child->clone( this );
+			childItems.append( item );
+			populateLinksUp( item );
+
+			if ( hasLinks )
+				populateLinkAncestors( item );
+		}
+	}
+
+	/*! Insert a copy of an item, such as a row kept to undo its removal
+	 *
+	 * @param item	The item to copy
+	 * @param at	The position to insert at; append if out of range
+	 */
+	void insertClone( const NifItem * item, int at )
+	{
+		NifItem * copy = item->clone( this );
+		insertChild( copy, at );
+
+		if ( !copy->linkRows.isEmpty() || !copy->linkAncestorRows.isEmpty() )
+			populateLinkAncestors( copy );
+	}
+
+	//! Inform this item and its ancestors that its child \a item has rows with links
+	void populateLinkAncestors( NifItem * item )
+	{
+		auto p = this;
+		auto c = item;
+		while ( p ) {
+			if ( !p->linkAncestorRows.contains( c->row() ) )
+				p->linkAncestorRows << c->row();
+
+			c = p;
+			p = p->parentItem;
+		}
+	}
+
 	//! Inform the parent and its ancestors of any links
 	void populateLinksUp( NifItem * item )
 	{
@@ -453,6 +667,16 @@ public:
 		return nullptr;
 	}
 
+	//! Return the child item with the specified interned name
+	NifItem * child( const NifFieldId & name )
+	{
+		for ( NifItem * child : childItems ) {
+			if ( child->nameId() == name.id )
+				return child;
+		}
+		return nullptr;
+	}
+
 	//! Return a count of the number of child items
 	int childCount() const
 	{
@@ -466,6 +690,23 @@ public:
 		childItems.clear();
 	}
 
+	/*! Replace the child items with copies of those of another item
+	 *
+	 * @param other	The item to copy the children of, usually the same row of another model
+	 */
+	void cloneChildren( const NifItem * other )
+	{
+		killChildren();
+
+		linkAncestorRows = other->linkAncestorRows;
+		linkRows = other->linkRows;
+		arrConds = other->arrConds;
+
+		childItems.reserve( other->childItems.count() );
+		for ( const NifItem * child : other->childItems )
+			childItems.append( child->clone( this ) );
+	}
+
 	const QVector<int> & getLinkAncestorRows() const
 	{
 		return linkAncestorRows;
@@ -591,34 +832,44 @@ public:
 	inline NifValue & value() { return itemData.value; }
 
 	//! Return the name of the data
-	inline QString name() const {   return itemData.name(); }
+	inline const QString & name() const {   return itemData.name(); }
+	//! Return the interned id of the name of the data
+	inline int nameId() const {   return itemData.nameId(); }
 	//! Return the type of the data
-	inline QString type() const {   return itemData.type(); }
+	inline const QString & type() const {   return itemData.type(); }
 	//! Return the template type of the data
-	inline QString temp() const {   return itemData.temp(); }
+	inline const QString & temp() const {   return itemData.temp(); }
 	//! Return the argument attribute of the data
-	inline QString arg()  const {   return itemData.arg();  }
+	inline const QString & arg()  const {   return itemData.arg();  }
 	//! Return the first array length of the data
-	inline QString arr1() const {   return itemData.arr1(); }
+	inline const QString & arr1() const {   return itemData.arr1(); }
 	//! Return the second array length of the data
-	inline QString arr2() const {   return itemData.arr2(); }
+	inline const QString & arr2() const {   return itemData.arr2(); }
 	//! Return the condition attribute of the data
-	inline QString cond() const {   return itemData.cond(); }
+	inline const QString & cond() const {   return itemData.cond(); }
 	//! Return the earliest version attribute of the data
 	inline quint32 ver1() const {   return itemData.ver1(); }
 	//! Return the latest version attribute of the data
 	inline quint32 ver2() const {   return itemData.ver2(); }
 	//! Return the description text of the data
-	inline QString text() const {   return itemData.text(); }
+	inline const QString & text() const {   return itemData.text(); }
 
 	//! Return the condition attribute of the data, as an expression
 	inline const Expression & condexpr() const {   return itemData.condexpr(); }
 	//! Return the arr1 attribute of the data, as an expression
 	inline const Expression & arr1expr() const {   return itemData.arr1expr(); }
 	//! Return the version condition attribute of the data
-	inline QString vercond() const {   return itemData.vercond();  }
+	inline const QString & vercond() const {   return itemData.vercond();  }
 	//! Return the version condition attribute of the data, as an expression
 	inline const Expression & verexpr() const {   return itemData.verexpr();  }
+	//! Return the interned names of the sibling fields which depend on the data
+	inline const QVector<int> & dependents() const {   return itemData.dependents();  }
+	//! Identifies the shared data of the item, see NifData::sharedId()
+	inline const void * sharedId() const { return itemData.sharedId(); }
+	//! Have the dependents of the data been indexed
+	inline bool hasDependencyIndex() const { return itemData.hasDependencyIndex(); }
+	//! Return the version condition result shared by all items of the data
+	inline NifVersionCache & versionCache() const { return itemData.versionCache(); }
 	//! Return the abstract attribute of the data
 	inline bool isAbstract() const { return itemData.isAbstract(); }
 	//! Is the item data binary. Binary means the data is being treated as one blob.
@@ -668,9 +919,11 @@ public:
 	//! Get the child items as an array
 	template <typename T> QVector<T> getArray() const
 	{
-		QVector<T> array;
+		// Fill a preallocated array in place rather than growing it per element
+		QVector<T> array( childItems.count() );
+		T * out = array.data();
 		for ( NifItem * child : childItems ) {
-			array.append( child->itemData.value.get<T>() );
+			*out++ = child->itemData.value.get<T>();
 		}
 		return array;
 	}
@@ -678,9 +931,15 @@ public:
 	//! Set the child items from an array
 	template <typename T> void setArray( const QVector<T> & array )
 	{
-		int x = 0;
-		for ( NifItem * child : childItems ) {
-			child->itemData.value.set<T>( array.value( x++ ) );
+		const int count = qMin( array.count(), childItems.count() );
+		const T * in = array.constData();
+		for ( int x = 0; x < count; x++ ) {
+			childItems.at( x )->itemData.value.set<T>( in[x] );
+		}
+
+		// Children beyond the end of the array are reset, as with QVector::value()
+		for ( int x = count; x < childItems.count(); x++ ) {
+			childItems.at( x )->itemData.value.set<T>( T() );
 		}
 	}
 
@@ -692,6 +951,29 @@ public:
 		}
 	}
 
+	//! Get the field at \a row of each compound child item as an array
+	template <typename T> QVector<T> getFieldArray( int row ) const
+	{
+		QVector<T> array( childItems.count() );
+		T * out = array.data();
+		for ( NifItem * child : childItems ) {
+			NifItem * field = child->child( row );
+			*out++ = field ? field->itemData.value.get<T>() : T();
+		}
+		return array;
+	}
+
+	//! Set the field at \a row of each compound child item from an array
+	template <typename T> void setFieldArray( int row, const QVector<T> & array )
+	{
+		const int count = qMin( array.count(), childItems.count() );
+		const T * in = array.constData();
+		for ( int x = 0; x < count; x++ ) {
+			if ( NifItem * field = childItems.at( x )->child( row ) )
+				field->itemData.value.set<T>( in[x] );
+		}
+	}
+
 private:
 	//! The data held by the item
 	NifData itemData;
@@ -711,6 +993,8 @@ private:
 	int vercondStatus = -1;
 	//! Item's row index, -1 is invalid, otherwise 0+
 	mutable int rowIdx = -1;
+	//! The block last found to contain this item, see NifModel::getBlockNumber()
+	mutable NifItem * owningBlock = nullptr;
 	//! If item is array with fixed compounds, the conditions are stored here for reuse
 	QVector<bool> arrConds;
 };
@@ -32,27 +32,97 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "nifmodel.h"
 #include "config.h"
+#include "functionrunnable.h"
 #include "settings.h"
+#include "settingssnapshot.h"
 
 #include "niftypes.h"
 #include "spellbook.h"
+#include "trace.h"
+#include "xxhash.h"
 
+#include <QBuffer>
 #include <QByteArray>
 #include <QColor>
 #include <QDebug>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
 #include <QFile>
+#include <QMutex>
 #include <QSettings>
+#include <QThreadPool>
 #include <QTime>
+#include <QVarLengthArray>
 #include <QtEndian>
 
+#include <algorithm>
+#include <atomic>
+
 
 //! @file nifmodel.cpp The NIF data model.
 
+//! Number of formatted values kept before the display cache is emptied
+#define DISPLAY_CACHE_SIZE 65536
+
 NifModel::NifModel( QObject * parent ) : BaseModel( parent )
 {
 	updateSettings();
 
 	clear();
+
+	connect( this, &NifModel::dataChanged, [this]( const QModelIndex & topLeft, const QModelIndex & bottomRight ) {
+		// A range over several root rows, as endTransaction() emits when it lost track of the
+		// changes, may cover any block; the invalid index tells the invalidators to drop everything
+		QModelIndex changed = topLeft;
+		if ( !topLeft.parent().isValid() && topLeft.row() != bottomRight.row() )
+			changed = QModelIndex();
+
+		invalidateBlockSize( changed );
+		invalidateDisplay( changed, bottomRight );
+		invalidateOffsets( changed );
+		invalidateStrings( changed );
+		invalidateDigests( changed );
+		invalidateHeaderTypes( changed );
+
+		static const QStringList versionFields = { "Version", "User Version", "User Version 2", "BS Version" };
+
+		NifItem * item = static_cast<NifItem *>( topLeft.internalPointer() );
+		if ( !changed.isValid() || ( item && topLeft.model() == this && versionFields.contains( item->name() ) ) )
+			updateVersionKey();
+	} );
+	connect( this, &NifModel::rowsInserted, [this]( const QModelIndex & parent, int first, int last ) {
+		shiftBlockSizes( parent, first, last, true );
+		// Blocks appended after those the header describes only add to its types
+		if ( !parent.isValid() && first - 1 < headerTypes.blocks )
+			headerTypes.blocks = -1;
+		displayCache.clear();
+		digestCache.clear();
+		clearOffsets();
+	} );
+	connect( this, &NifModel::rowsRemoved, [this]( const QModelIndex & parent, int first, int last ) {
+		shiftBlockSizes( parent, first, last, false );
+		if ( !parent.isValid() && first - 1 < headerTypes.blocks )
+			headerTypes.blocks = -1;
+		displayCache.clear();
+		digestCache.clear();
+		clearOffsets();
+	} );
+	// Links show the names of their targets and items may be renumbered or replaced
+	connect( this, &NifModel::linksChanged, [this]() {
+		displayCache.clear();
+		digestCache.clear();
+		// Before 3.3.0.13 the root blocks are tagged in the file
+		if ( version < 0x0303000d )
+			clearOffsets();
+	} );
+	connect( this, &NifModel::modelReset, [this]() {
+		displayCache.clear();
+		digestCache.clear();
+		clearOffsets();
+		stringTableCount = -1;
+		headerTypes.blocks = -1;
+	} );
 }
 
 void NifModel::updateSettings()
@@ -160,21 +230,84 @@ bool NifModel::evalVersion( NifItem * item, bool chkParents ) const
 			return false;
 	}
 
+	// The result only depends on the header versions, so files with the same versions share it
+	bool cached = false;
+	if ( versionKey && item->versionCache().get( versionKey, cached ) )
+		return cached;
 
-	if ( !item->evalVersion( version ) )
-		return false;
+	bool result = item->evalVersion( version );
 
-	QString vercond = item->vercond();
+	if ( result && !item->vercond().isEmpty() ) {
+		NifModelEval functor( this, getHeaderItem() );
+		result = item->verexpr().evaluateBool( functor );
 
-	if ( vercond.isEmpty() )
-		return true;
+		item->setVersionCondition( result );
+	}
+
+	if ( versionKey )
+		item->versionCache().set( versionKey, result );
+
+	return result;
+}
+
+//! Find the first item named \a name below \a parent
+static NifItem * findVersionItem( NifItem * parent, const QString & name )
+{
+	for ( NifItem * child : parent->children() ) {
+		if ( child->name() == name )
+			return child;
+
+		if ( NifItem * item = findVersionItem( child, name ) )
+			return item;
+	}
+
+	return nullptr;
+}
+
+void NifModel::updateVersionKey()
+{
+	// Keys are interned for the whole process so the cache is shared between models
+	static QMutex keyMutex;
+	static QHash<QPair<quint64, quint64>, quint32> keys;
+
+	versionKey = 0;
+
+	NifItem * header = getHeaderItem();
+	if ( !header )
+		return;
 
-	NifModelEval functor( this, getHeaderItem() );
-	bool expr = item->verexpr().evaluateBool( functor );
+	NifItem * bsVersion = findVersionItem( header, "BS Version" );
 
-	item->setVersionCondition( expr );
+	QPair<quint64, quint64> versions(
+		( quint64( version ) << 32 ) | getUserVersion(),
+		( quint64( getUserVersion2() ) << 32 ) | ( bsVersion ? bsVersion->value().toCount() : 0 )
+	);
 
-	return expr;
+	QMutexLocker lock( &keyMutex );
+
+	auto it = keys.constFind( versions );
+	if ( it != keys.constEnd() ) {
+		versionKey = it.value();
+	} else if ( keys.count() < 0x7fffffff ) {
+		versionKey = quint32( keys.count() + 1 );
+		keys.insert( versions, versionKey );
+	}
+}
+
+//! The empty header and footer built from the XML, copied by NifModel::clear() for every file
+struct ItemTemplates
+{
+	QMutex mutex;
+	//! The XML structures the items were built from, held so that a new schema never compares equal
+	NifSchemaPtr schema;
+	NifItem * header = nullptr;
+	NifItem * footer = nullptr;
+};
+
+static ItemTemplates & itemTemplates()
+{
+	static ItemTemplates templates;
+	return templates;
 }
 
 void NifModel::clear()
@@ -183,20 +316,52 @@ void NifModel::clear()
 	fileinfo = QFileInfo();
 	filename = QString();
 	folder = QString();
+	pendingBlocks.clear();
 	root->killChildren();
+	blockTable.clear();
+	clearOffsets();
+	stringTable.clear();
+	stringTableCount = -1;
+
+	NifSchemaPtr current = currentSchema();
+	if ( current != schema ) {
+		schema = current;
+		linkTypes.clear();
+	}
+
+	{
+		// Copying the items is cheaper than building them from the XML for each file
+		ItemTemplates & t = itemTemplates();
+		QMutexLocker lock( &t.mutex );
 
-	NifData headerData = NifData( "NiHeader", "Header" );
-	NifData footerData = NifData( "NiFooter", "Footer" );
-	headerData.setIsCompound( true );
-	headerData.setIsConditionless( true );
-	footerData.setIsCompound( true );
-	footerData.setIsConditionless( true );
+		if ( t.header && t.footer && t.schema == schema ) {
+			root->insertChild( t.header->clone( root ) );
+			root->insertChild( t.footer->clone( root ) );
+		} else {
+			NifData headerData = NifData( "NiHeader", "Header" );
+			NifData footerData = NifData( "NiFooter", "Footer" );
+			headerData.setIsCompound( true );
+			headerData.setIsConditionless( true );
+			footerData.setIsCompound( true );
+			footerData.setIsConditionless( true );
+
+			insertType( root, headerData );
+			insertType( root, footerData );
+
+			// Keep them unless the XML failed to load, reloading it drops them
+			if ( root->childCount() == 2 && root->child( 0 )->childCount() > 0 ) {
+				delete t.header;
+				delete t.footer;
+				t.header = root->child( 0 )->clone( nullptr );
+				t.footer = root->child( 1 )->clone( nullptr );
+				t.schema = schema;
+			}
+		}
+	}
 
-	insertType( root, headerData );
-	insertType( root, footerData );
 	version = version2number( cfg.startupVersion );
 
-	if ( !supportedVersions.isEmpty() && !isVersionSupported( version ) ) {
+	if ( !schema->supportedVersions.isEmpty() && !schema->supportedVersions.contains( version ) ) {
 		Message::warning( nullptr, tr( "Unsupported 'Startup Version' %1 specified, reverting to 20.0.0.5" ).arg( cfg.startupVersion ) );
 		version = 0x14000005;
 	}
@@ -237,6 +402,156 @@ void NifModel::clear()
 
 	lockUpdates = false;
 	needUpdates = utNone;
+
+	updateVersionKey();
+}
+
+void NifModel::takeContents( NifModel & other )
+{
+	beginResetModel();
+
+	std::swap( root, other.root );
+	fileinfo = other.fileinfo;
+	filename = other.filename;
+	folder = other.folder;
+	version = other.version;
+
+	childLinks.swap( other.childLinks );
+	parentLinks.swap( other.parentLinks );
+	linkedFrom.swap( other.linkedFrom );
+	droppedLinks.swap( other.droppedLinks );
+	rootLinks.swap( other.rootLinks );
+	pendingBlocks.swap( other.pendingBlocks );
+	std::swap( blockTable, other.blockTable );
+
+	lockUpdates = false;
+	needUpdates = utNone;
+
+	displayCache.clear();
+	clearOffsets();
+	updateVersionKey();
+
+	endResetModel();
+
+	other.clear();
+}
+
+void NifModel::copyContents( const NifModel & other )
+{
+	other.loadPendingBlocks();
+
+	beginResetModel();
+
+	root->killChildren();
+	for ( const NifItem * row : other.root->children() )
+		root->appendChild( row->clone( root ) );
+
+	fileinfo = other.fileinfo;
+	filename = other.filename;
+	folder = other.folder;
+	version = other.version;
+
+	childLinks = other.childLinks;
+	parentLinks = other.parentLinks;
+	linkedFrom = other.linkedFrom;
+	droppedLinks = other.droppedLinks;
+	rootLinks = other.rootLinks;
+	pendingBlocks.clear();
+	// The sources of the blocks are shared rather than copied
+	blockTable = other.blockTable;
+
+	lockUpdates = false;
+	needUpdates = utNone;
+
+	displayCache.clear();
+	clearOffsets();
+	updateVersionKey();
+
+	endResetModel();
+}
+
+bool NifModel::takeChangedBlocks( NifModel & other )
+{
+	loadPendingBlocks();
+	other.loadPendingBlocks();
+
+	const int rows = root->childCount();
+	const int numBlocks = getBlockCount();
+
+	if ( other.version != version || other.root->childCount() != rows || other.getBlockCount() != numBlocks
+	     || childLinks.count() != numBlocks || other.childLinks.count() != numBlocks )
+		return false;
+
+	for ( int r = 0; r < rows; r++ ) {
+		if ( root->child( r )->name() != other.root->child( r )->name() )
+			return false;
+	}
+
+	// The digests resolve the string indices, which are only kept as they are if the strings are
+	if ( version >= 0x14010003 ) {
+		NifItem * strings = getItem( getHeaderItem(), "Strings" );
+		NifItem * otherStrings = other.getItem( other.getHeaderItem(), "Strings" );
+
+		if ( !strings || !otherStrings || digest( strings ) != other.digest( otherStrings ) )
+			return false;
+	}
+
+	// The digests name the targets of links rather than their numbers, which the link lists hold
+	QVector<int> changed;
+	for ( int r = 0; r < rows; r++ ) {
+		int b = r - 1;
+		bool differs = digest( root->child( r ) ) != other.digest( other.root->child( r ) );
+
+		if ( !differs && b >= 0 && b < numBlocks )
+			differs = childLinks.at( b ) != other.childLinks.at( b ) || parentLinks.at( b ) != other.parentLinks.at( b );
+
+		if ( differs )
+			changed << r;
+	}
+
+	if ( changed.isEmpty() )
+		return true;
+
+	for ( int r : changed ) {
+		NifItem * item = root->child( r );
+		const NifItem * source = other.root->child( r );
+		QModelIndex parent = createIndex( r, 0, item );
+
+		if ( item->childCount() > 0 ) {
+			beginRemoveRows( parent, 0, item->childCount() - 1 );
+			item->killChildren();
+			endRemoveRows();
+		}
+
+		if ( source->childCount() > 0 ) {
+			beginInsertRows( parent, 0, source->childCount() - 1 );
+			item->cloneChildren( source );
+			endInsertRows();
+		}
+	}
+
+	droppedLinks.swap( other.droppedLinks );
+
+	if ( childLinks != other.childLinks || parentLinks != other.parentLinks ) {
+		childLinks.swap( other.childLinks );
+		parentLinks.swap( other.parentLinks );
+		linkedFrom.swap( other.linkedFrom );
+		rootLinks.swap( other.rootLinks );
+
+		emit linksChanged();
+	}
+
+	for ( int r : changed ) {
+		QModelIndex index = createIndex( r, 0, root->child( r ) );
+		emit dataChanged( index, index );
+	}
+
+	// The sizes and sources of the other file match the blocks now, unlike those the signals invalidated
+	std::swap( blockTable, other.blockTable );
+	clearOffsets();
+	stringTableCount = -1;
+
+	return true;
 }
 
 /*
@@ -306,59 +621,101 @@ void NifModel::updateHeader()
 		return;
 	}
 
+	// Block sizes and strings need the full block data
+	loadPendingBlocks();
+
+	// Batch processing does not report which blocks it modified
+	if ( changedWhileProcessing ) {
+		blockTable.invalidateSizes();
+		displayCache.clear();
+		clearOffsets();
+		headerTypes.blocks = -1;
+	}
+
 	NifItem * header = getHeaderItem();
+	const int numBlocks = getBlockCount();
 
-	set<int>( header, "Num Blocks", getBlockCount() );
 	NifItem * idxBlockTypes = getItem( header, "Block Types" );
 	NifItem * idxBlockTypeIndices = getItem( header, "Block Type Index" );
 	NifItem * idxBlockSize = getItem( header, "Block Size" );
 
+	// Only the blocks appended since the last update are typed, unless the blocks before them changed
+	int first = headerTypes.blocks;
+	if ( first < 0 || first > numBlocks || !idxBlockTypes || !idxBlockTypeIndices
+	     || idxBlockTypeIndices->childCount() != first || idxBlockTypes->childCount() != headerTypes.rows.count()
+	     || blockTable.types.count() != first )
+	{
+		first = 0;
+		headerTypes.rows.clear();
+		blockTable.types.clear();
+	}
+
+	set<int>( header, "Num Blocks", numBlocks );
+
 	// Update Block Types, Block Type Index, and Block Size
 	if ( idxBlockTypes && idxBlockTypeIndices ) {
-		QVector<QString> blocktypes;
+		const int typesBefore = headerTypes.rows.count();
 		QVector<int> blocktypeindices;
-		QVector<int> blocksizes;
+		blocktypeindices.reserve( numBlocks - first );
+		blockTable.types.reserve( numBlocks );
 
-		for ( int r = 1; r < root->childCount() - 1; r++ ) {
-			NifItem * block = root->child( r );
+		for ( int b = first; b < numBlocks; b++ ) {
+			NifItem * block = root->child( b + 1 );
 
 			// NiMesh hack
 			QString blockName = block->name();
 			if ( blockName == "NiDataStream" ) {
 				blockName = QString( "NiDataStream\x01%1\x01%2" ).arg( block->child( "Usage" )->value().get<int>() ).arg( block->child( "Access" )->value().get<int>() );
-				qDebug() << "Changing blockname to " << blockName;
-			}
-
-			int bTypeIdx = blocktypes.indexOf( blockName );
-			if ( bTypeIdx < 0 ) {
-				blocktypes.append( blockName );
-				bTypeIdx = blocktypes.count() - 1;
 			}
-			
-			blocktypeindices.append( bTypeIdx );
 
-			if ( version >= 0x14020000 && idxBlockSize ) {
-				updateArrays( block );
-				blocksizes.append( blockSize( block ) );
-			}
+			auto it = headerTypes.rows.constFind( blockName );
+			if ( it == headerTypes.rows.constEnd() )
+				it = headerTypes.rows.insert( blockName, headerTypes.rows.count() );
 
+			blocktypeindices.append( it.value() );
+			blockTable.types.append( blockName );
 		}
 
-		set<int>( header, "Num Block Types", blocktypes.count() );
+		set<int>( header, "Num Block Types", headerTypes.rows.count() );
 
 		updateArrayItem( idxBlockTypes );
 		updateArrayItem( idxBlockTypeIndices );
 
+		// Only the new rows are written, in one pass
+		for ( auto it = headerTypes.rows.cbegin(); it != headerTypes.rows.cend(); ++it ) {
+			if ( it.value() >= typesBefore && it.value() < idxBlockTypes->childCount() )
+				idxBlockTypes->child( it.value() )->value().set<QString>( it.key() );
+		}
+
+		for ( int b = first; b < numBlocks && b < idxBlockTypeIndices->childCount(); b++ )
+			idxBlockTypeIndices->child( b )->value().set<int>( blocktypeindices.at( b - first ) );
+
 		if ( version >= 0x14020000 && idxBlockSize ) {
 			updateArrayItem( idxBlockSize );
-		}
 
-		setState( Processing );
-		idxBlockTypes->setArray<QString>( blocktypes );
-		idxBlockTypeIndices->setArray<int>( blocktypeindices );
-		if ( blocksizes.count() )
-			idxBlockSize->setArray<int>( blocksizes );
-		restoreState();
+			if ( blockTable.sizes.count() != numBlocks || blockTable.sizeValid.count() != numBlocks ) {
+				blockTable.sizes.fill( 0, numBlocks );
+				blockTable.sizeValid.fill( false, numBlocks );
+			}
+
+			// Only measure the blocks modified since their size was last known
+			for ( int b = 0; b < numBlocks; b++ ) {
+				if ( !blockTable.hasSize( b ) ) {
+					NifItem * block = root->child( b + 1 );
+					updateArrays( block );
+					blockTable.sizes[b] = blockSize( block );
+				}
+			}
+
+			blockTable.validateSizes();
+
+			// Rows of removed or moved blocks hold the sizes of others
+			for ( int b = 0; b < numBlocks && b < idxBlockSize->childCount(); b++ )
+				idxBlockSize->child( b )->value().set<int>( int( blockTable.sizes.at( b ) ) );
+		} else {
+			blockTable.sizes.clear();
+			blockTable.sizeValid.clear();
+		}
 
 		// For 20.1 and above strings are saved in the header.  Max String Length must be updated.
 		if ( version >= 0x14010003 ) {
@@ -377,137 +734,505 @@ void NifModel::updateHeader()
 
 			set<uint>( header, "Max String Length", maxlen );
 		}
+
+		// Set last, the fields written above invalidate it
+		headerTypes.blocks = numBlocks;
 	}
 }
 
-/*
- *  search and find
- */
-
-NifItem * NifModel::getItem( NifItem * item, const QString & name ) const
+void NifModel::invalidateHeaderTypes( const QModelIndex & index )
 {
-	if ( !item || item == root )
-		return nullptr;
-
-	if ( item->isArray() || item->parent()->isArray() ) {
-		int slash = name.indexOf( "/" );
-		if ( slash > 0 ) {
-			QString left = name.left( slash );
-			QString right = name.right( name.length() - slash - 1 );
-
-			// Resolve ../ for arr1, arr2, arg passing
-			if ( left == ".." )
-				return getItem( item->parent(), right );
+	if ( headerTypes.blocks < 0 )
+		return;
 
-			return getItem( getItem( item, left ), right );
-		}
+	NifItem * item = static_cast<NifItem *>( index.internalPointer() );
+	if ( !( index.isValid() && item && index.model() == this ) ) {
+		headerTypes.blocks = -1;
+		return;
 	}
 
-	for ( auto child : item->children() ) {
-		if ( child && child->name() == name && evalCondition( child ) )
-			return child;
-	}
+	// NiDataStream blocks are typed by their usage and access, and the header arrays may be edited by hand
+	static const QStringList typeFields = {
+		"Usage", "Access", "Num Block Types", "Block Types", "Block Type Index"
+	};
 
-	return nullptr;
+	if ( typeFields.contains( item->name() ) )
+		headerTypes.blocks = -1;
 }
 
-/*
- *  array functions
- */
-
-static QString parentPrefix( const QString & x )
+void NifModel::updateBlockTable()
 {
-	for ( int c = 0; c < x.length(); c++ ) {
-		if ( !x[c].isNumber() )
-			return QString( "../" ) + x;
+	blockTable.clearSizes();
+
+	// block types are stored in the header for versions above 10.x.x.x
+	if ( version < 0x0a000000 )
+		return;
+
+	NifItem * header = getHeaderItem();
+	NifItem * idxBlockTypes = getItem( header, "Block Types" );
+	NifItem * idxBlockTypeIndices = getItem( header, "Block Type Index" );
+	NifItem * idxBlockSize = getItem( header, "Block Size" );
+
+	if ( !idxBlockTypes || !idxBlockTypeIndices )
+		return;
+
+	const QVector<QString> blocktypes = idxBlockTypes->getArray<QString>();
+	const int numblocks = idxBlockTypeIndices->childCount();
+
+	blockTable.types.reserve( numblocks );
+	for ( NifItem * child : idxBlockTypeIndices->children() ) {
+		// the upper bit or the blocktypeindex seems to be related to PhysX
+		blockTable.types.append( blocktypes.value( child->value().get<int>() & 0x7FFF ) );
 	}
 
-	return x;
+	// for version 20.2.0.? and above the block size is stored in the header
+	if ( version >= 0x14020000 && idxBlockSize ) {
+		blockTable.sizes = idxBlockSize->getArray<quint32>();
+		if ( blockTable.sizes.count() == numblocks )
+			blockTable.validateSizes();
+		else
+			blockTable.sizes.clear();
+	}
 }
 
-bool NifModel::updateByteArrayItem( NifItem * array )
+void NifModel::invalidateBlockSize( const QModelIndex & index )
 {
-	// New row count
-	int rows = getArraySize( array );
-	if ( rows == 0 )
-		return false;
+	if ( blockTable.sizeValid.isEmpty() )
+		return;
 
-	// Create byte array for holding blob data
-	QByteArray bytes;
-	bytes.resize( rows );
+	NifItem * item = static_cast<NifItem *>( index.internalPointer() );
+	if ( !( index.isValid() && item && index.model() == this ) ) {
+		blockTable.invalidateSizes();
+		return;
+	}
 
-	// Previous row count
-	int itemRows = array->childCount();
+	int b = getBlockNumber( item );
+	if ( b >= 0 ) {
+		if ( b < blockTable.sizeValid.count() )
+			blockTable.sizeValid[b] = false;
+		if ( b < blockTable.sourceValid.count() )
+			blockTable.sourceValid[b] = false;
+		return;
+	}
 
-	// Grab data from existing rows if appropriate and then purge
-	if ( itemRows > 1 ) {
-		for ( int i = 0; i < itemRows; i++ ) {
-			if ( NifItem * child = array->child( 0 ) ) {
-				bytes[i] = get<quint8>( child );
-			}
-		}
+	// The header fields used in block conditions change the layout of every block
+	static const QStringList layoutFields = {
+		"Version", "User Version", "User Version 2", "BS Version", "Endian Type"
+	};
 
-		beginRemoveRows( createIndex( array->row(), 0, array ), 0, itemRows - 1 );
-		array->removeChildren( 0, itemRows );
-		endRemoveRows();
+	if ( layoutFields.contains( item->name() ) )
+		blockTable.invalidateSizes();
+}
 
-		itemRows = 0;
+void NifModel::invalidateDisplay( const QModelIndex & topLeft, const QModelIndex & bottomRight )
+{
+	if ( displayCache.isEmpty() )
+		return;
+
+	NifItem * item = static_cast<NifItem *>( topLeft.internalPointer() );
+	if ( !( topLeft.isValid() && item && topLeft.model() == this ) || topLeft.row() != bottomRight.row()
+	     || topLeft.parent() != bottomRight.parent() ) {
+		displayCache.clear();
+		return;
 	}
 
-	// Create the dummy row for holding the byte array
-	if ( itemRows == 0 ) {
-		NifData data( array->name(), array->type(), array->temp(), NifValue( NifValue::tBlob ), parentPrefix( array->arg() ) );
-		data.setBinary( true );
+	// Other items show header strings, string palettes and block names
+	const NifValue & value = item->value();
+	if ( item->childCount() > 0 || value.isLink() || value.isByteArray() || value.isString()
+	     || value.type() == NifValue::tFilePath || item->name() == "Name" || getBlockNumber( item ) < 0 ) {
+		displayCache.clear();
+		return;
+	}
 
-		beginInsertRows( createIndex( array->row(), 0, array ), 0, 1 );
+	displayCache.remove( item );
+}
 
-		array->prepareInsert( 1 );
-		insertType( array, data );
+void NifModel::invalidateDigests( const QModelIndex & index )
+{
+	if ( digestCache.isEmpty() )
+		return;
 
-		endInsertRows();
+	NifItem * item = static_cast<NifItem *>( index.internalPointer() );
+	if ( !( index.isValid() && item && index.model() == this ) ) {
+		digestCache.clear();
+		return;
 	}
 
-	// Update the byte array
-	if ( NifItem * child = array->child( 0 ) ) {
-		QByteArray * bm = (child->isBinary()) ? get<QByteArray *>( child ) : nullptr;
-		if ( !bm ) {
-			set<QByteArray>( child, bytes );
-		} else if ( bm->size() == 0 ) {
-			*bm = bytes;
-		} else {
-			bm->resize( rows );
-		}
+	// Links digest the names of their targets, and string indices the header strings
+	if ( item->name() == "Name" || item->value().isString() || getBlockNumber( item ) < 0 ) {
+		digestCache.clear();
+		return;
 	}
 
-	return true;
+	for ( ; item && item != root; item = item->parent() )
+		digestCache.remove( item );
 }
 
-bool NifModel::updateArrayItem( NifItem * array )
+quint64 NifModel::digest( const QModelIndex & index ) const
 {
-	if ( !isArray( array ) )
-		return false;
+	NifItem * item = static_cast<NifItem *>( index.internalPointer() );
+	if ( !( index.isValid() && item && index.model() == this ) )
+		return 0;
 
-	// New row count
-	int rows = getArraySize( array );
+	return digest( item );
+}
 
-	// Binary array handling
-	if ( array->isBinary() ) {
-		if ( updateByteArrayItem( array ) )
-			return true;
-	}
+quint64 NifModel::digest( NifItem * item ) const
+{
+	auto cached = digestCache.constFind( item );
+	if ( cached != digestCache.constEnd() )
+		return cached.value();
 
-	// Error handling
-	if ( rows > 1024 * 1024 * 8 ) {
-		auto m = tr( "array %1 much too large. %2 bytes requested" ).arg( array->name() ).arg( rows );
-		if ( msgMode == UserMessage ) {
-			Message::append( nullptr, tr( "Could not update array item." ), m, QMessageBox::Critical );
-		} else {
-			testMsg( m );
+	const QString & name = item->name();
+	quint64 result = XXH64( name.constData(), size_t( name.size() ) * sizeof( QChar ), 0 );
+
+	if ( item->childCount() > 0 ) {
+		QVarLengthArray<quint64, 64> parts;
+		parts.append( result );
+
+		for ( NifItem * child : item->children() ) {
+			if ( evalCondition( child ) )
+				parts.append( digest( child ) );
 		}
 
-		return false;
-	} else if ( rows < 0 ) {
-		auto m = tr( "array %1 invalid" ).arg( array->name() );
+		result = XXH64( parts.constData(), size_t( parts.size() ) * sizeof( quint64 ), 0 );
+		digestCache.insert( item, result );
+		return result;
+	}
+
+	const NifValue & value = item->value();
+
+	if ( value.isLink() ) {
+		QModelIndex target = getBlock( value.toLink() );
+		QString key = target.isValid() ? getBlockType( target ) + QLatin1Char( '|' ) + getBlockName( target ) : QString();
+		return XXH64( key.constData(), size_t( key.size() ) * sizeof( QChar ), result + value.type() );
+	}
+
+	if ( value.type() == NifValue::tStringIndex ) {
+		QString s = string( createIndex( item->row(), 0, item ) );
+		return XXH64( s.constData(), size_t( s.size() ) * sizeof( QChar ), result + value.type() );
+	}
+
+	return value.digest( result );
+}
+
+void NifModel::invalidateStrings( const QModelIndex & index )
+{
+	if ( stringTableCount < 0 )
+		return;
+
+	// Only the header holds the strings
+	NifItem * item = static_cast<NifItem *>( index.internalPointer() );
+	if ( !( index.isValid() && item && index.model() == this ) || getBlockNumber( item ) < 0 )
+		stringTableCount = -1;
+}
+
+int NifModel::stringNumber( const QString & string ) const
+{
+	NifItem * iArray = getItem( getHeaderItem(), "Strings" );
+	if ( !iArray )
+		return -1;
+
+	int count = iArray->childCount();
+
+	if ( stringTableCount != count ) {
+		stringTable.clear();
+		stringTable.reserve( count );
+
+		// Backwards, so that the first of duplicate strings is kept
+		for ( int row = count - 1; row >= 0; row-- )
+			stringTable.insert( iArray->child( row )->value().get<QString>(), row );
+
+		stringTableCount = count;
+	}
+
+	int row = stringTable.value( string, -1 );
+
+	// Edits made while Processing emit no signals, check the row is still current
+	if ( row >= 0 && iArray->child( row )->value().get<QString>() != string ) {
+		stringTableCount = -1;
+		return stringNumber( string );
+	}
+
+	return row;
+}
+
+void NifModel::invalidateOffsets( const QModelIndex & index )
+{
+	NifItem * item = static_cast<NifItem *>( index.internalPointer() );
+	if ( !( index.isValid() && item && index.model() == this ) ) {
+		clearOffsets();
+		return;
+	}
+
+	while ( item->parent() && item->parent() != root )
+		item = item->parent();
+
+	// The header holds the fields the conditions of every block depend on
+	int row = item->row();
+	if ( row == 0 || item == itemOffsetsRow ) {
+		itemOffsets.clear();
+		itemOffsetsRow = nullptr;
+	}
+
+	// Only the rows after the modified one move
+	rowOffsetsValid = std::min( rowOffsetsValid, row + 1 );
+}
+
+void NifModel::clearOffsets()
+{
+	rowOffsetsValid = 0;
+	itemOffsets.clear();
+	itemOffsetsRow = nullptr;
+}
+
+void NifModel::shiftBlockSizes( const QModelIndex & parent, int first, int last, bool inserted )
+{
+	if ( blockTable.sizeValid.isEmpty() && blockTable.sourceValid.isEmpty() )
+		return;
+
+	if ( parent.isValid() ) {
+		invalidateBlockSize( parent );
+		return;
+	}
+
+	// Rows of the root item are the header, the blocks, and the footer
+	int b = first - 1;
+	int count = last - first + 1;
+
+	if ( b < 0 || b > blockTable.sizes.count() || ( !inserted && b + count > blockTable.sizes.count() ) ) {
+		blockTable.sizes.clear();
+		blockTable.sizeValid.clear();
+	} else if ( inserted ) {
+		blockTable.sizes.insert( b, count, 0 );
+		blockTable.sizeValid.insert( b, count, false );
+	} else {
+		blockTable.sizes.remove( b, count );
+		blockTable.sizeValid.remove( b, count );
+	}
+
+	if ( b < 0 || b > blockTable.sourceValid.count() || ( !inserted && b + count > blockTable.sourceValid.count() ) ) {
+		blockTable.sourceValid.fill( false );
+	} else if ( inserted ) {
+		blockTable.sourceOffsets.insert( b, count, 0 );
+		blockTable.sourceValid.insert( b, count, false );
+	} else {
+		blockTable.sourceOffsets.remove( b, count );
+		blockTable.sourceValid.remove( b, count );
+	}
+}
+
+void NifModel::invalidateBlockSource( NifItem * item )
+{
+	int b = getBlockNumber( item );
+	if ( b >= 0 && b < blockTable.sourceValid.count() )
+		blockTable.sourceValid[b] = false;
+}
+
+void NifModel::loadBlockSource( QIODevice & device, qint64 offset, int numblocks )
+{
+	qint64 total = 0;
+	for ( int b = 0; b < numblocks; b++ )
+		total += blockTable.sizes.at( b );
+
+	// A buffer owning its bytes, as a file decompressed from an archive, is shared instead of copied.
+	//	Raw data maps a file or an archive, which may be closed while the blocks are kept.
+	QBuffer * buffer = qobject_cast<QBuffer *>( &device );
+	qint64 ofs = 0;
+
+	if ( buffer && buffer->data().capacity() > 0 && offset + total <= buffer->data().size() ) {
+		blockTable.source = buffer->data();
+		ofs = offset;
+	} else {
+		const qint64 pos = device.pos();
+		device.seek( offset );
+		blockTable.source = device.read( total );
+		device.seek( pos );
+
+		if ( blockTable.source.size() != total ) {
+			blockTable.source.clear();
+			return;
+		}
+	}
+
+	blockTable.sourceOffsets.resize( numblocks );
+	for ( int b = 0; b < numblocks; b++ ) {
+		blockTable.sourceOffsets[b] = ofs;
+		ofs += blockTable.sizes.at( b );
+	}
+
+	blockTable.sourceValid.fill( true, numblocks );
+}
+
+/*
+ *  search and find
+ */
+
+NifItem * NifModel::getItem( NifItem * item, const QString & name ) const
+{
+	if ( !item || item == root )
+		return nullptr;
+
+	if ( !pendingBlocks.isEmpty() && item->parent() == root )
+		loadPendingBlock( item );
+
+	if ( item->isArray() || item->parent()->isArray() ) {
+		int slash = name.indexOf( "/" );
+		if ( slash > 0 ) {
+			QString left = name.left( slash );
+			QString right = name.right( name.length() - slash - 1 );
+
+			// Resolve ../ for arr1, arr2, arg passing
+			if ( left == ".." )
+				return getItem( item->parent(), right );
+
+			return getItem( getItem( item, left ), right );
+		}
+	}
+
+	for ( auto child : item->children() ) {
+		if ( child && child->name() == name && evalCondition( child ) )
+			return child;
+	}
+
+	return nullptr;
+}
+
+NifItem * NifModel::getItem( NifItem * item, const NifFieldId & name ) const
+{
+	if ( !item || item == root )
+		return nullptr;
+
+	// Paths are resolved one name at a time
+	if ( name.name.contains( "/" ) )
+		return getItem( item, name.name );
+
+	if ( !pendingBlocks.isEmpty() && item->parent() == root )
+		loadPendingBlock( item );
+
+	for ( auto child : item->children() ) {
+		if ( child && child->nameId() == name.id && evalCondition( child ) )
+			return child;
+	}
+
+	return nullptr;
+}
+
+QModelIndex NifModel::getIndex( const QModelIndex & parent, const NifFieldId & name ) const
+{
+	NifItem * parentItem = static_cast<NifItem *>( parent.internalPointer() );
+
+	if ( !( parent.isValid() && parentItem && parent.model() == this ) )
+		return QModelIndex();
+
+	NifItem * item = getItem( parentItem, name );
+
+	if ( item )
+		return createIndex( item->row(), 0, item );
+
+	return QModelIndex();
+}
+
+/*
+ *  array functions
+ */
+
+static QString parentPrefix( const QString & x )
+{
+	for ( int c = 0; c < x.length(); c++ ) {
+		if ( !x[c].isNumber() )
+			return QString( "../" ) + x;
+	}
+
+	return x;
+}
+
+bool NifModel::updateByteArrayItem( NifItem * array )
+{
+	// New row count
+	int rows = getArraySize( array );
+	if ( rows == 0 )
+		return false;
+
+	// Create byte array for holding blob data
+	QByteArray bytes( rows, '\0' );
+
+	// Previous row count
+	int itemRows = array->childCount();
+
+	// Grab data from existing rows if appropriate and then purge
+	if ( itemRows > 1 ) {
+		for ( int i = 0; i < std::min( itemRows, rows ); i++ ) {
+			if ( NifItem * child = array->child( i ) ) {
+				bytes[i] = get<quint8>( child );
+			}
+		}
+
+		beginRemoveRows( createIndex( array->row(), 0, array ), 0, itemRows - 1 );
+		array->removeChildren( 0, itemRows );
+		endRemoveRows();
+
+		itemRows = 0;
+	}
+
+	// Create the dummy row for holding the byte array
+	if ( itemRows == 0 ) {
+		NifData data( array->name(), array->type(), array->temp(), NifValue( NifValue::tBlob ), parentPrefix( array->arg() ) );
+		data.setBinary( true );
+
+		beginInsertRows( createIndex( array->row(), 0, array ), 0, 0 );
+
+		array->prepareInsert( 1 );
+		insertType( array, data );
+
+		endInsertRows();
+	}
+
+	// Update the byte array
+	if ( NifItem * child = array->child( 0 ) ) {
+		QByteArray * bm = (child->isBinary()) ? get<QByteArray *>( child ) : nullptr;
+		if ( !bm ) {
+			set<QByteArray>( child, bytes );
+		} else if ( bm->size() == 0 ) {
+			*bm = bytes;
+		} else {
+			// One allocation for the whole array, the new bytes are zero like new rows
+			int size = bm->size();
+			bm->resize( rows );
+			if ( rows > size )
+				std::fill( bm->begin() + size, bm->end(), '\0' );
+		}
+	}
+
+	return true;
+}
+
+bool NifModel::updateArrayItem( NifItem * array )
+{
+	if ( !isArray( array ) )
+		return false;
+
+	// New row count
+	int rows = getArraySize( array );
+
+	// Binary array handling
+	if ( array->isBinary() ) {
+		if ( updateByteArrayItem( array ) )
+			return true;
+	}
+
+	// Error handling
+	if ( rows > 1024 * 1024 * 8 ) {
+		auto m = tr( "array %1 much too large. %2 bytes requested" ).arg( array->name() ).arg( rows );
+		if ( msgMode == UserMessage ) {
+			Message::append( nullptr, tr( "Could not update array item." ), m, QMessageBox::Critical );
+		} else {
+			testMsg( m );
+		}
+
+		return false;
+	} else if ( rows < 0 ) {
+		auto m = tr( "array %1 invalid" ).arg( array->name() );
 		if ( msgMode == UserMessage ) {
 			Message::append( nullptr, tr( "Could not update array item." ), m, QMessageBox::Critical );
 		} else {
@@ -520,6 +1245,15 @@ bool NifModel::updateArrayItem( NifItem * array )
 	// Previous row count
 	int itemRows = array->childCount();
 
+	// Only elements which are links or hold links change the links of the block
+	auto holdsLinks = [array]( int row ) {
+		const NifItem * element = array->child( row );
+		return element && ( element->value().isLink() || !element->getLinkRows().isEmpty()
+		                    || !element->getLinkAncestorRows().isEmpty() );
+	};
+
+	bool relinked = false;
+
 	// Add item children
 	if ( rows > itemRows ) {
 		NifData data( array->name(),
@@ -539,14 +1273,22 @@ bool NifModel::updateArrayItem( NifItem * array )
 
 		array->prepareInsert( rows - itemRows );
 
-		for ( int c = itemRows; c < rows; c++ )
-			insertType( array, data );
+		// The elements only differ in their values, resolve the types of the first and copy it
+		insertType( array, data );
+
+		if ( NifItem * first = array->child( itemRows ) )
+			array->appendClones( first, rows - itemRows - 1 );
 
 		endInsertRows();
+
+		relinked = holdsLinks( itemRows );
 	}
 
 	// Remove item children
 	if ( rows < itemRows ) {
+		for ( int c = rows; c < itemRows && !relinked; c++ )
+			relinked = holdsLinks( c );
+
 		beginRemoveRows( createIndex( array->row(), 0, array ), rows, itemRows - 1 );
 
 		array->removeChildren( rows, itemRows - rows );
@@ -554,14 +1296,14 @@ bool NifModel::updateArrayItem( NifItem * array )
 		endRemoveRows();
 	}
 
-	if ( (state != Loading) && (rows != itemRows) && (isCompound( array->type() ) || NifValue::isLink( NifValue::type( array->type() ) )) ) {
+	if ( state != Loading && relinked ) {
 		NifItem * parent = array;
 
 		while ( parent->parent() && parent->parent() != root )
 			parent = parent->parent();
 
 		if ( parent != getFooterItem() ) {
-			updateLinks();
+			updateLinks( getBlockNumber( parent ) );
 			updateFooter();
 			emit linksChanged();
 		}
@@ -596,14 +1338,16 @@ bool NifModel::updateArrays( NifItem * parent )
 
 QModelIndex NifModel::insertNiBlock( const QString & identifier, int at )
 {
-	NifBlockPtr block = blocks.value( identifier );
+	NifBlockPtr block = schema->blocks.value( identifier );
 
 	if ( block ) {
 		if ( at < 0 || at > getBlockCount() )
 			at = -1;
 
-		if ( at >= 0 )
+		if ( at >= 0 ) {
+			loadPendingBlocks();
 			adjustLinks( root, at, 1 );
+		}
 
 		if ( at >= 0 )
 			at++;
@@ -647,14 +1391,59 @@ QModelIndex NifModel::insertNiBlock( const QString & identifier, int at )
 
 void NifModel::removeNiBlock( int blocknum )
 {
-	if ( blocknum < 0 || blocknum >= getBlockCount() )
+	removeNiBlocks( { blocknum } );
+}
+
+void NifModel::removeNiBlocks( const QList<int> & blocknums )
+{
+	int n = getBlockCount();
+
+	QVector<bool> removed( n, false );
+	int count = 0;
+
+	for ( const auto b : blocknums ) {
+		if ( b >= 0 && b < n && !removed[b] ) {
+			removed[b] = true;
+			count++;
+		}
+	}
+
+	if ( count == 0 )
 		return;
 
-	adjustLinks( root, blocknum, 0 );
-	adjustLinks( root, blocknum, -1 );
-	beginRemoveRows( QModelIndex(), blocknum + 1, blocknum + 1 );
-	root->removeChild( blocknum + 1 );
-	endRemoveRows();
+	loadPendingBlocks();
+
+	// Links to removed blocks are cleared, the others move down past the gaps
+	QMap<qint32, qint32> map;
+	int shift = 0;
+
+	for ( int b = 0; b < n; b++ ) {
+		if ( removed[b] ) {
+			map.insert( b, -1 );
+			shift++;
+		} else if ( shift > 0 ) {
+			map.insert( b, b - shift );
+		}
+	}
+
+	// Remove contiguous runs from the end so the earlier rows stay in place
+	for ( int last = n - 1; last >= 0; last-- ) {
+		if ( !removed[last] )
+			continue;
+
+		int first = last;
+		while ( first > 0 && removed[first - 1] )
+			first--;
+
+		beginRemoveRows( QModelIndex(), first + 1, last + 1 );
+		root->removeChildren( first + 1, last - first + 1 );
+		endRemoveRows();
+
+		last = first;
+	}
+
+	mapLinks( root, map );
+
 	updateLinks();
 	updateFooter();
 	emit linksChanged();
@@ -665,6 +1454,8 @@ void NifModel::moveNiBlock( int src, int dst )
 	if ( src < 0 || src >= getBlockCount() )
 		return;
 
+	loadPendingBlocks();
+
 	beginRemoveRows( QModelIndex(), src + 1, src + 1 );
 	NifItem * block = root->takeChild( src + 1 );
 	endRemoveRows();
@@ -714,11 +1505,100 @@ void NifModel::updateStrings( NifModel * src, NifModel * tgt, NifItem * item )
 	}
 }
 
-QMap<qint32, qint32> NifModel::moveAllNiBlocks( NifModel * targetnif, bool update )
+void NifModel::collectStrings( NifItem * item, QStringList & strings ) const
 {
-	int bcnt = getBlockCount();
+	NifValue::Type vt = item->value().type();
 
-	bool doStringUpdate = (  this->getVersionNumber() >= 0x14010003 || targetnif->getVersionNumber() >= 0x14010003 );
+	if ( vt == NifValue::tStringIndex || vt == NifValue::tSizedString || item->type() == "string" )
+		strings << string( createIndex( 0, 0, item ) );
+
+	for ( auto child : item->children() ) {
+		collectStrings( child, strings );
+	}
+}
+
+void NifModel::assignStrings( NifItem * item, const QStringList & strings, int & next )
+{
+	NifValue::Type vt = item->value().type();
+
+	if ( vt == NifValue::tStringIndex || vt == NifValue::tSizedString || item->type() == "string" )
+		assignString( createIndex( 0, 0, item ), strings.value( next++ ), false );
+
+	for ( auto child : item->children() ) {
+		assignStrings( child, strings, next );
+	}
+}
+
+std::shared_ptr<NifBlockCopy> NifModel::copyNiBlocks( const QList<qint32> & blocks )
+{
+	auto copy = std::make_shared<NifBlockCopy>();
+	copy->version = version;
+	copy->userVersion = getUserVersion();
+	copy->userVersion2 = getUserVersion2();
+	copy->blocks.reserve( blocks.count() );
+
+	// The string items refer to the header strings of this model
+	bool doStringUpdate = ( version >= 0x14010003 );
+
+	for ( const auto b : blocks ) {
+		NifItem * block = getBlockItem( b );
+		if ( !block )
+			return nullptr;
+
+		copy->blocks << block->clone( nullptr );
+
+		if ( doStringUpdate )
+			collectStrings( block, copy->strings );
+	}
+
+	return copy;
+}
+
+bool NifModel::canPasteNiBlocks( const NifBlockCopy & copy ) const
+{
+	return copy.version == version && copy.userVersion == getUserVersion() && copy.userVersion2 == getUserVersion2();
+}
+
+QModelIndex NifModel::pasteNiBlocks( const NifBlockCopy & copy, const QMap<qint32, qint32> & map )
+{
+	if ( copy.blocks.isEmpty() || !canPasteNiBlocks( copy ) )
+		return QModelIndex();
+
+	// Rows of the root item are the header, the blocks, and the footer
+	int first = getBlockCount() + 1;
+
+	beginInsertRows( QModelIndex(), first, first + copy.blocks.count() - 1 );
+
+	for ( int b = 0; b < copy.blocks.count(); b++ )
+		root->insertChild( copy.blocks.at( b )->clone( root ), first + b );
+
+	endInsertRows();
+
+	int next = 0;
+
+	for ( int b = 0; b < copy.blocks.count(); b++ ) {
+		NifItem * block = root->child( first + b );
+		mapLinks( block, map );
+
+		if ( !copy.strings.isEmpty() )
+			assignStrings( block, copy.strings, next );
+	}
+
+	updateHeader();
+	updateLinks();
+	updateFooter();
+	emit linksChanged();
+
+	return createIndex( first, 0, root->child( first ) );
+}
+
+QMap<qint32, qint32> NifModel::moveAllNiBlocks( NifModel * targetnif, bool update )
+{
+	int bcnt = getBlockCount();
+
+	bool doStringUpdate = (  this->getVersionNumber() >= 0x14010003 || targetnif->getVersionNumber() >= 0x14010003 );
+
+	loadPendingBlocks();
 
 	QMap<qint32, qint32> map;
 
@@ -772,10 +1652,11 @@ void NifModel::reorderBlocks( const QVector<qint32> & order )
 	}
 
 	QMap<qint32, qint32> linkMap;
-	QMap<qint32, qint32> blockMap;
+	// The block which goes to each position
+	QVector<qint32> blockMap( order.count(), -1 );
 
 	for ( qint32 n = 0; n < order.count(); n++ ) {
-		if ( blockMap.contains( order[n] ) || order[n] < 0 || order[n] >= getBlockCount() ) {
+		if ( order[n] < 0 || order[n] >= getBlockCount() || blockMap[order[n]] >= 0 ) {
 			if ( msgMode == UserMessage ) {
 				Message::critical( nullptr, err );
 			} else {
@@ -785,7 +1666,7 @@ void NifModel::reorderBlocks( const QVector<qint32> & order )
 			return;
 		}
 
-		blockMap.insert( order[n], n );
+		blockMap[order[n]] = n;
 
 		if ( order[n] != n )
 			linkMap.insert( n, order[n] );
@@ -794,12 +1675,15 @@ void NifModel::reorderBlocks( const QVector<qint32> & order )
 	if ( linkMap.isEmpty() )
 		return;
 
+	loadPendingBlocks();
+
 	// take all the blocks
 	beginRemoveRows( QModelIndex(), 1, root->childCount() - 2 );
-	QList<NifItem *> temp;
+	QVector<NifItem *> temp( order.count() );
 
-	for ( qint32 n = 0; n < order.count(); n++ )
-		temp.append( root->takeChild( 1 ) );
+	// from the last, so that the rows before do not move
+	for ( qint32 n = order.count() - 1; n >= 0; n-- )
+		temp[n] = root->takeChild( n + 1 );
 
 	endRemoveRows();
 
@@ -820,6 +1704,7 @@ void NifModel::reorderBlocks( const QVector<qint32> & order )
 
 void NifModel::mapLinks( const QMap<qint32, qint32> & map )
 {
+	loadPendingBlocks();
 	mapLinks( root, map );
 	updateLinks();
 	emit linksChanged();
@@ -888,11 +1773,22 @@ QModelIndex NifModel::getBlockOrHeader( const QModelIndex & idx ) const
 
 int NifModel::getBlockNumber( NifItem * block ) const
 {
-	while ( block && block->parent() != root )
-		block = block->parent();
+	// Items stay under the same block, only the block itself moves between rows
+	NifItem * cached = block ? block->cachedBlock() : nullptr;
 
-	if ( !block )
-		return -1;
+	if ( cached && cached->parent() == root ) {
+		block = cached;
+	} else {
+		NifItem * item = block;
+
+		while ( block && block->parent() != root )
+			block = block->parent();
+
+		if ( !block )
+			return -1;
+
+		item->setCachedBlock( block );
+	}
 
 	int num = block->row() - 1;
 
@@ -945,7 +1841,9 @@ NifItem * NifModel::getBlockItem( int x ) const
 	if ( x < 0 || x >= getBlockCount() )
 		return nullptr;
 
-	return root->child( x + 1 );
+	NifItem * block = root->child( x + 1 );
+	loadPendingBlock( block );
+	return block;
 }
 
 int NifModel::getBlockCount() const
@@ -963,7 +1861,7 @@ void NifModel::insertAncestor( NifItem * parent, const QString & identifier, int
 	setState( Inserting );
 
 	Q_UNUSED( at );
-	NifBlockPtr ancestor = blocks.value( identifier );
+	NifBlockPtr ancestor = schema->blocks.value( identifier );
 
 	if ( ancestor ) {
 		if ( !ancestor->ancestor.isEmpty() )
@@ -991,12 +1889,18 @@ bool NifModel::inherits( const QString & name, const QString & aunty ) const
 	if ( name == aunty )
 		return true;
 
-	NifBlockPtr type = blocks.value( name );
+	NifBlockPtr type = schema->blocks.value( name );
 
-	if ( type && ( type->ancestor == aunty || inherits( type->ancestor, aunty ) ) )
-		return true;
+	if ( !type )
+		return false;
 
-	return false;
+	if ( type->typeId >= 0 ) {
+		NifBlockPtr ancestor = schema->blocks.value( aunty );
+		return ancestor && ancestor->typeId >= 0 && ancestor->typeId < type->ancestry.size()
+		       && type->ancestry.testBit( ancestor->typeId );
+	}
+
+	return type->ancestor == aunty || inherits( type->ancestor, aunty );
 }
 
 bool NifModel::inherits( const QModelIndex & idx, const QString & aunty ) const
@@ -1025,18 +1929,23 @@ void NifModel::insertType( const QModelIndex & parent, const NifData & data, int
 void NifModel::insertType( NifItem * parent, const NifData & data, int at )
 {
 	setState( Inserting );
+	insertTypeItems( parent, data, at );
+	restoreState();
+}
 
+void NifModel::insertTypeItems( NifItem * parent, const NifData & data, int at )
+{
 	if ( data.isArray() ) {
-		NifItem * item = insertBranch( parent, data, at );
+		insertBranch( parent, data, at );
 	} else if ( data.isCompound() ) {
-		NifBlockPtr compound = compounds.value( data.type() );
+		NifBlockPtr compound = schema->compounds.value( data.type() );
 		if ( !compound )
 			return;
 		NifItem * branch = insertBranch( parent, data, at );
 		branch->prepareInsert( compound->types.count() );
 		const auto & types = compound->types;
 		for ( const NifData & d : types ) {
-			insertType( branch, d );
+			insertTypeItems( branch, d );
 		}
 	} else if ( data.isTemplated() ) {
 		QLatin1String tmpl( "TEMPLATE" );
@@ -1060,7 +1969,7 @@ void NifModel::insertType( NifItem * parent, const NifData & data, int at )
 		if ( d.temp() == tmpl )
 			d.setTemp( tmp );
 
-		insertType( parent, d, at );
+		insertTypeItems( parent, d, at );
 	} else {
 		NifItem * item = parent->insertChild( data, at );
 
@@ -1070,8 +1979,6 @@ void NifModel::insertType( NifItem * parent, const NifData & data, int at )
 			item->value().changeType( version < 0x14010003 ? NifValue::tSizedString : NifValue::tStringIndex );
 		}
 	}
-
-	restoreState();
 }
 
 
@@ -1081,8 +1988,9 @@ void NifModel::insertType( NifItem * parent, const NifData & data, int at )
 
 bool NifModel::setItemValue( NifItem * item, const NifValue & val )
 {
+	recordValue( item );
 	item->value() = val;
-	emit dataChanged( createIndex( item->row(), ValueCol, item ), createIndex( item->row(), ValueCol, item ) );
+	notifyChanged( createIndex( item->row(), ValueCol, item ), createIndex( item->row(), ValueCol, item ) );
 
 	if ( itemIsLink( item ) ) {
 		NifItem * parent = item;
@@ -1091,7 +1999,7 @@ bool NifModel::setItemValue( NifItem * item, const NifValue & val )
 			parent = parent->parent();
 
 		if ( parent != getFooterItem() ) {
-			updateLinks();
+			updateLinks( getBlockNumber( parent ) );
 			updateFooter();
 			emit linksChanged();
 		}
@@ -1104,6 +2012,110 @@ bool NifModel::setItemValue( NifItem * item, const NifValue & val )
  *  QAbstractModel interface
  */
 
+QModelIndex NifModel::index( int row, int column, const QModelIndex & parent ) const
+{
+	if ( !pendingBlocks.isEmpty() && parent.isValid() && parent.model() == this )
+		loadPendingBlock( static_cast<NifItem *>( parent.internalPointer() ) );
+
+	return BaseModel::index( row, column, parent );
+}
+
+int NifModel::rowCount( const QModelIndex & parent ) const
+{
+	if ( !pendingBlocks.isEmpty() && parent.isValid() && parent.model() == this )
+		loadPendingBlock( static_cast<NifItem *>( parent.internalPointer() ) );
+
+	return BaseModel::rowCount( parent );
+}
+
+QString NifModel::displayValue( const QModelIndex & index, NifItem * item ) const
+{
+	const NifValue & value = item->value();
+
+	if ( value.type() == NifValue::tString || value.type() == NifValue::tFilePath ) {
+		return QString( this->string( index ) ).replace( "\n", " " ).replace( "\r", " " );
+	}
+	else if ( item->value().type() == NifValue::tStringOffset )
+	{
+		int ofs = item->value().get<int>();
+		if ( ofs < 0 || ofs == 0x0000FFFF )
+			return QString( "<empty>" );
+
+		NifItem * palette = getItemX( item, "String Palette" );
+		int link = ( palette ? palette->value().toLink() : -1 );
+
+		if ( ( palette = getBlockItem( link ) ) && ( palette = getItem( palette, "Palette" ) ) ) {
+			QByteArray bytes = palette->value().get<QByteArray>();
+
+			if ( !(ofs < bytes.count()) )
+				return tr( "<offset invalid>" );
+
+			return QString( &bytes.data()[ofs] );
+		}
+
+		return tr( "<palette not found>" );
+	}
+	else if ( item->value().type() == NifValue::tStringIndex )
+	{
+		int idx = item->value().get<int>();
+		if ( idx == -1 )
+			return QString();
+
+		NifItem * header = getHeaderItem();
+		QModelIndex stringIndex = createIndex( header->row(), 0, header );
+		QString string = get<QString>( this->index( idx, 0, getIndex( stringIndex, "Strings" ) ) );
+
+		if ( idx < 0 )
+			return tr( "%1 - <index invalid>" ).arg( idx );
+
+		return QString( "%2 [%1]" ).arg( idx ).arg( string );
+	}
+	else if ( item->value().type() == NifValue::tBlockTypeIndex )
+	{
+
+		int idx = item->value().get<int>();
+		int offset = idx & 0x7FFF;
+		NifItem * blocktypes = getItemX( item, "Block Types" );
+		NifItem * blocktyp = ( blocktypes ? blocktypes->child( offset ) : 0 );
+
+		if ( !blocktyp )
+			return tr( "%1 - <index invalid>" ).arg( idx );
+
+		return QString( "%2 [%1]" ).arg( idx ).arg( blocktyp->value().get<QString>() );
+	}
+	else if ( item->value().isLink() )
+	{
+		int lnk = item->value().toLink();
+
+		if ( lnk >= 0 ) {
+			QModelIndex block = getBlock( lnk );
+
+			if ( !block.isValid() )
+				return tr( "%1 <invalid>" ).arg( lnk );
+
+			QModelIndex block_name = getIndex( block, "Name" );
+
+			if ( block_name.isValid() && !get<QString>( block_name ).isEmpty() )
+				return QString( "%1 (%2)" ).arg( lnk ).arg( get<QString>( block_name ) );
+
+			return QString( "%1 [%2]" ).arg( lnk ).arg( itemName( block ) );
+		}
+
+		return tr( "None" );
+	}
+	else if ( item->value().isCount() )
+	{
+		QString optId = NifValue::enumOptionName( item->type(), item->value().toCount() );
+
+		if ( optId.isEmpty() )
+			return item->value().toString();
+
+		return QString( "%1" ).arg( optId );
+	}
+
+	return item->value().toString().replace( "\n", " " ).replace( "\r", " " );
+}
+
 QVariant NifModel::data( const QModelIndex & idx, int role ) const
 {
 	QModelIndex index = buddy( idx );
@@ -1195,91 +2207,17 @@ QVariant NifModel::data( const QModelIndex & idx, int role ) const
 				break;
 			case ValueCol:
 				{
-					QString type = item->type();
-					const NifValue & value = item->value();
-
-					if ( value.type() == NifValue::tString || value.type() == NifValue::tFilePath ) {
-						return QString( this->string( index ) ).replace( "\n", " " ).replace( "\r", " " );
-					}
-					else if ( item->value().type() == NifValue::tStringOffset )
-					{
-						int ofs = item->value().get<int>();
-						if ( ofs < 0 || ofs == 0x0000FFFF )
-							return QString( "<empty>" );
-
-						NifItem * palette = getItemX( item, "String Palette" );
-						int link = ( palette ? palette->value().toLink() : -1 );
-
-						if ( ( palette = getBlockItem( link ) ) && ( palette = getItem( palette, "Palette" ) ) ) {
-							QByteArray bytes = palette->value().get<QByteArray>();
-
-							if ( !(ofs < bytes.count()) )
-								return tr( "<offset invalid>" );
-
-							return QString( &bytes.data()[ofs] );
-						}
-
-						return tr( "<palette not found>" );
-					}
-					else if ( item->value().type() == NifValue::tStringIndex )
-					{
-						int idx = item->value().get<int>();
-						if ( idx == -1 )
-							return QString();
-
-						NifItem * header = getHeaderItem();
-						QModelIndex stringIndex = createIndex( header->row(), 0, header );
-						QString string = get<QString>( this->index( idx, 0, getIndex( stringIndex, "Strings" ) ) );
-
-						if ( idx < 0 )
-							return tr( "%1 - <index invalid>" ).arg( idx );
-
-						return QString( "%2 [%1]" ).arg( idx ).arg( string );
-					}
-					else if ( item->value().type() == NifValue::tBlockTypeIndex )
-					{
+					// Formatting the values is the bulk of painting a large array
+					auto cached = displayCache.constFind( item );
+					if ( cached != displayCache.constEnd() )
+						return cached.value();
 
-						int idx = item->value().get<int>();
-						int offset = idx & 0x7FFF;
-						NifItem * blocktypes = getItemX( item, "Block Types" );
-						NifItem * blocktyp = ( blocktypes ? blocktypes->child( offset ) : 0 );
+					if ( displayCache.count() >= DISPLAY_CACHE_SIZE )
+						displayCache.clear();
 
-						if ( !blocktyp )
-							return tr( "%1 - <index invalid>" ).arg( idx );
-
-						return QString( "%2 [%1]" ).arg( idx ).arg( blocktyp->value().get<QString>() );
-					}
-					else if ( item->value().isLink() )
-					{
-						int lnk = item->value().toLink();
-
-						if ( lnk >= 0 ) {
-							QModelIndex block = getBlock( lnk );
-
-							if ( !block.isValid() )
-								return tr( "%1 <invalid>" ).arg( lnk );
-
-							QModelIndex block_name = getIndex( block, "Name" );
-
-							if ( block_name.isValid() && !get<QString>( block_name ).isEmpty() )
-								return QString( "%1 (%2)" ).arg( lnk ).arg( get<QString>( block_name ) );
-
-							return QString( "%1 [%2]" ).arg( lnk ).arg( itemName( block ) );
-						}
-
-						return tr( "None" );
-					}
-					else if ( item->value().isCount() )
-					{
-						QString optId = NifValue::enumOptionName( item->type(), item->value().toCount() );
-
-						if ( optId.isEmpty() )
-							return item->value().toString();
-
-						return QString( "%1" ).arg( optId );
-					}
-
-					return item->value().toString().replace( "\n", " " ).replace( "\r", " " );
+					QString display = displayValue( index, item );
+					displayCache.insert( item, display );
+					return display;
 				}
 				break;
 			case ArgCol:
@@ -1361,12 +2299,12 @@ QVariant NifModel::data( const QModelIndex & idx, int role ) const
 						              .arg( item->name() )
 						              .arg( QString( item->text() ).replace( "<", "&lt;" ).replace( "\n", "<br/>" ) );
 
-						if ( NifBlockPtr blk = blocks.value( item->name() ) ) {
+						if ( NifBlockPtr blk = schema->blocks.value( item->name() ) ) {
 							tip += "<p>Ancestors:<ul>";
 
-							while ( blocks.contains( blk->ancestor ) ) {
+							while ( schema->blocks.contains( blk->ancestor ) ) {
 								tip += QString( "<li>%1</li>" ).arg( blk->ancestor );
-								blk  = blocks.value( blk->ancestor );
+								blk  = schema->blocks.value( blk->ancestor );
 							}
 
 							tip += "</ul></p>";
@@ -1541,6 +2479,7 @@ bool NifModel::setData( const QModelIndex & index, const QVariant & value, int r
 	case NifModel::ValueCol:
 		{
 			QString type = item->type();
+			recordValue( item );
 			NifValue & val = item->value();
 
 			if ( val.type() == NifValue::tString || val.type() == NifValue::tFilePath ) {
@@ -1550,7 +2489,7 @@ bool NifModel::setData( const QModelIndex & index, const QVariant & value, int r
 				item->value().setFromVariant( value );
 
 				if ( isLink( index ) && getBlockOrHeader( index ) != getFooter() ) {
-					updateLinks();
+					updateLinks( getBlockNumber( item ) );
 					updateFooter();
 					emit linksChanged();
 				}
@@ -1590,13 +2529,13 @@ bool NifModel::setData( const QModelIndex & index, const QVariant & value, int r
 				parent = parent->parent();
 
 				if ( parent && parent->type() == "NiBlock" && parent->name() == "NiSourceTexture" )
-					emit dataChanged( createIndex( parent->row(), ValueCol, parent ), createIndex( parent->row(), ValueCol, parent ) );
+					notifyChanged( createIndex( parent->row(), ValueCol, parent ), createIndex( parent->row(), ValueCol, parent ) );
 			}
 		} else if ( item->name() == "Name" ) {
 			NifItem * parent = item->parent();
 
 			if ( parent && parent->type() == "NiBlock" )
-				emit dataChanged( createIndex( parent->row(), ValueCol, parent ), createIndex( parent->row(), ValueCol, parent ) );
+				notifyChanged( createIndex( parent->row(), ValueCol, parent ), createIndex( parent->row(), ValueCol, parent ) );
 		}
 	}
 
@@ -1604,7 +2543,12 @@ bool NifModel::setData( const QModelIndex & index, const QVariant & value, int r
 		// Reassess conditions for reliant data only when modifying value
 		invalidateDependentConditions( item );
 		// update original index
-		emit dataChanged( index, index );
+		notifyChanged( index, index );
+	} else {
+		// No signal is emitted for the edit, the block is still modified
+		invalidateBlockSize( index );
+		invalidateDisplay( index, index );
+		invalidateOffsets( index );
 	}
 
 	return true;
@@ -1636,7 +2580,7 @@ bool NifModel::removeRows( int row, int count, const QModelIndex & parent )
 		endRemoveRows();
 
 		if ( link ) {
-			updateLinks();
+			updateLinks( getBlockNumber( item ) );
 			updateFooter();
 			emit linksChanged();
 		}
@@ -1716,11 +2660,23 @@ bool NifModel::setHeaderString( const QString & s )
 
 bool NifModel::load( QIODevice & device )
 {
-	QSettings cfg;
-	bool ignoreSize = false;
-	ignoreSize = cfg.value( "Ignore Block Size", false ).toBool();
+	TRACE_SPAN( "NifModel::load", getFilename() );
+
+	auto settings = SettingsSnapshot::get();
+	bool ignoreSize = settings->ignoreBlockSize;
+	bool parallel = parallelLoading || settings->parallelLoading;
+	bool lazy = lazyLoading || settings->lazyLoading;
+	bool incremental = incrementalSaving || settings->incrementalSave;
+	bool profiling = profileBlocks || settings->profileBlocks;
+
+	// Blocks decoded on the thread pool or on first access cannot be timed one by one
+	if ( profiling )
+		parallel = lazy = false;
 
 	clear();
+	blockTimes.clear();
+
+	QElapsedTimer blockTimer;
 
 	NifIStream stream( this, &device );
 
@@ -1746,6 +2702,11 @@ bool NifModel::load( QIODevice & device )
 	numblocks = get<int>( header, "Num Blocks" );
 	//qDebug( "numblocks %i", numblocks );
 
+	// Resolve the block types and sizes once instead of per block
+	updateBlockTable();
+	bool sizesMatch = !ignoreSize;
+	const qint64 blocksStart = device.pos();
+
 	emit sigProgress( 0, numblocks );
 	//QTime t = QTime::currentTime();
 
@@ -1757,8 +2718,25 @@ bool NifModel::load( QIODevice & device )
 		if ( version >= 0x0303000d ) {
 			// read in the NiBlocks
 			QString prevblktyp;
+			int c = 0;
+
+			// Defer decoding or decode as many blocks as possible on the thread pool,
+			//	the rest are read in order
+			if ( lazy && !ignoreSize ) {
+				c = loadBlocksLazy( device, numblocks );
+				curpos = device.pos();
+
+				if ( c > 0 )
+					prevblktyp = root->child( c )->name();
+			} else if ( parallel && !ignoreSize ) {
+				c = loadBlocksParallel( device, numblocks );
+				curpos = device.pos();
+
+				if ( c > 0 )
+					prevblktyp = root->child( c )->name();
+			}
 
-			for ( int c = 0; c < numblocks; c++ ) {
+			for ( ; c < numblocks; c++ ) {
 				emit sigProgress( c + 1, numblocks );
 
 				if ( device.atEnd() )
@@ -1771,8 +2749,7 @@ bool NifModel::load( QIODevice & device )
 					if ( version >= 0x0a000000 ) {
 						// block types are stored in the header for versions above 10.x.x.x
 						//	the upper bit or the blocktypeindex seems to be related to PhysX
-						int blktypidx = get<int>( index( c, 0, getIndex( createIndex( header->row(), 0, header ), "Block Type Index" ) ) );
-						blktyp = get<QString>( index( blktypidx & 0x7FFF, 0, getIndex( createIndex( header->row(), 0, header ), "Block Types" ) ) );
+						blktyp = blockTable.types.value( c );
 
 						// note: some 10.0.1.0 version nifs from Oblivion in certain distributions seem to be missing
 						//		 these four bytes on the havok blocks
@@ -1793,7 +2770,7 @@ bool NifModel::load( QIODevice & device )
 
 						// for version 20.2.0.? and above the block size is stored in the header
 						if ( !ignoreSize && version >= 0x14020000 )
-							size = get<quint32>( index( c, 0, getIndex( createIndex( header->row(), 0, header ), "Block Size" ) ) );
+							size = blockTable.sizes.value( c );
 					} else {
 						int len;
 						device.read( (char *)&len, 4 );
@@ -1829,6 +2806,13 @@ bool NifModel::load( QIODevice & device )
 
 					if ( isNiBlock( blktyp ) ) {
 						//qDebug() << "loading block" << c << ":" << blktyp );
+						qint64 blockPos = device.pos();
+						quint64 blockItems = NifItem::allocations();
+						if ( profiling )
+							blockTimer.start();
+
+						TRACE_SPAN( "NifModel::loadBlock", blktyp );
+
 						QModelIndex newBlock = insertNiBlock( blktyp, -1 );
 
 						if ( !loadItem( root->child( c + 1 ), stream ) ) {
@@ -1836,6 +2820,14 @@ bool NifModel::load( QIODevice & device )
 							throw tr( "failed to load block number %1 (%2) previous block was %3" ).arg( c ).arg( blktyp ).arg( child ? child->name() : prevblktyp );
 						}
 
+						if ( profiling ) {
+							BlockProfile & p = blockTimes[blktyp];
+							p.count++;
+							p.loadTime += blockTimer.nsecsElapsed();
+							p.bytes += device.pos() - blockPos;
+							p.items += NifItem::allocations() - blockItems;
+						}
+
 						// NiMesh hack
 						if ( blktyp == "NiDataStream" ) {
 							set<qint32>( newBlock, "Usage", dataStreamUsage );
@@ -1865,6 +2857,8 @@ bool NifModel::load( QIODevice & device )
 					qint64 pos = device.pos();
 
 					if ( (curpos + size) != pos ) {
+						sizesMatch = false;
+
 						// unable to seek to location... abort
 						if ( device.seek( curpos + size ) ) {
 							auto m = tr( "device position incorrect after block number %1 (%2) at 0x%3 ended at 0x%4 (expected 0x%5)" )
@@ -1938,10 +2932,25 @@ bool NifModel::load( QIODevice & device )
 
 					if ( isNiBlock( blktyp ) ) {
 						//qDebug() << "loading block" << c << ":" << blktyp );
+						qint64 blockPos = device.pos();
+						quint64 blockItems = NifItem::allocations();
+						if ( profiling )
+							blockTimer.start();
+
+						TRACE_SPAN( "NifModel::loadBlock", blktyp );
+
 						insertNiBlock( blktyp, -1 );
 
 						if ( !loadItem( root->child( c + 1 ), stream ) )
 							throw tr( "failed to load block number %1 (%2) previous block was %3" ).arg( c ).arg( blktyp ).arg( root->child( c )->name() );
+
+						if ( profiling ) {
+							BlockProfile & p = blockTimes[blktyp];
+							p.count++;
+							p.loadTime += blockTimer.nsecsElapsed();
+							p.bytes += device.pos() - blockPos;
+							p.items += NifItem::allocations() - blockItems;
+						}
 					} else {
 						throw tr( "encountered unknown block (%1)" ).arg( blktyp );
 					}
@@ -1971,6 +2980,21 @@ bool NifModel::load( QIODevice & device )
 		return false;
 	}
 
+	// The loaded sizes are only reusable if every block ended where the header said it would
+	updateBlockTable();
+	if ( !sizesMatch || blockTable.sizes.count() != numblocks )
+		blockTable.invalidateSizes();
+	else if ( incremental && canLoadFromBlockTable( device, numblocks ) )
+		loadBlockSource( device, blocksStart, numblocks );
+
+	if ( profiling && !blockTimes.isEmpty() ) {
+		if ( msgMode == UserMessage ) {
+			Message::append( tr( "Block profile of %1" ).arg( fileinfo.fileName() ), blockProfileText(), QMessageBox::Information );
+		} else {
+			testMsg( blockProfileText() );
+		}
+	}
+
 	//qDebug() << t.msecsTo( QTime::currentTime() );
 	reset(); // notify model views that a significant change to the data structure has occurded
 	return true;
@@ -1978,8 +3002,12 @@ bool NifModel::load( QIODevice & device )
 
 bool NifModel::save( QIODevice & device ) const
 {
+	TRACE_SPAN( "NifModel::save", getFilename() );
+
 	NifOStream stream( this, &device );
 
+	loadPendingBlocks();
+
 	setState( Saving );
 
 	// Force update header and footer prior to save
@@ -2022,7 +3050,28 @@ bool NifModel::save( QIODevice & device ) const
 			}
 		}
 
-		if ( !saveItem( root->child( c ), stream ) ) {
+		bool saved = false;
+
+		QElapsedTimer blockTimer;
+		if ( !blockTimes.isEmpty() )
+			blockTimer.start();
+
+		// Write unmodified blocks back as they were loaded
+		if ( c > 0 && blockTable.hasSource( c - 1 ) ) {
+			const qint64 size = blockTable.sizes.value( c - 1 );
+			saved = ( device.write( blockTable.source.constData() + blockTable.sourceOffsets.at( c - 1 ), size ) == size );
+		} else {
+			saved = saveItem( root->child( c ), stream );
+		}
+
+		// Saves are timed for the block types of a profiled load
+		if ( blockTimer.isValid() ) {
+			auto p = blockTimes.find( root->child( c )->name() );
+			if ( p != blockTimes.end() )
+				p->saveTime += blockTimer.nsecsElapsed();
+		}
+
+		if ( !saved ) {
 			Message::critical( nullptr, tr( "Failed to write block %1 (%2)." ).arg( itemName( index( c, 0 ) ) ).arg( c - 1 ) );
 			resetState();
 			return false;
@@ -2040,9 +3089,60 @@ bool NifModel::save( QIODevice & device ) const
 	return true;
 }
 
+NifModel::MemoryUsage NifModel::memoryUsage() const
+{
+	MemoryUsage usage;
+	root->memoryUsage( usage.itemBytes, usage.valueBytes, usage.items );
+
+	usage.sourceBytes = blockTable.source.capacity();
+
+	// Hash nodes are estimated at a key, a value and two pointers each
+	usage.cacheBytes += qint64( displayCache.capacity() ) * ( sizeof( void * ) * 3 + sizeof( QString ) );
+	for ( const QString & text : displayCache )
+		usage.cacheBytes += qint64( text.capacity() ) * sizeof( QChar );
+	usage.cacheBytes += qint64( itemOffsets.capacity() ) * ( sizeof( void * ) * 3 + sizeof( int ) );
+	usage.cacheBytes += qint64( rowOffsets.capacity() ) * sizeof( int );
+	usage.cacheBytes += qint64( stringTable.capacity() ) * ( sizeof( void * ) * 2 + sizeof( QString ) + sizeof( int ) );
+	usage.cacheBytes += qint64( digestCache.capacity() ) * ( sizeof( void * ) * 3 + sizeof( quint64 ) );
+	usage.cacheBytes += qint64( blockTable.types.capacity() ) * sizeof( QString );
+	usage.cacheBytes += qint64( headerTypes.rows.capacity() ) * ( sizeof( void * ) * 2 + sizeof( QString ) + sizeof( int ) );
+	usage.cacheBytes += qint64( blockTable.sizes.capacity() ) * sizeof( quint32 );
+	usage.cacheBytes += qint64( blockTable.sourceOffsets.capacity() ) * sizeof( qint64 );
+
+	return usage;
+}
+
+QString NifModel::blockProfileText() const
+{
+	QStringList types = blockTimes.keys();
+	std::sort( types.begin(), types.end(), [this]( const QString & a, const QString & b ) {
+		return blockTimes.value( a ).loadTime > blockTimes.value( b ).loadTime;
+	} );
+
+	qint64 total = 0;
+	for ( const BlockProfile & p : blockTimes )
+		total += p.loadTime;
+
+	QString text = tr( "Block Type\tCount\tLoad ms\t%\tSave ms\tKB\tItems" ) + "\n";
+
+	for ( const QString & type : types ) {
+		const BlockProfile & p = blockTimes[type];
+
+		text += QString( "%1\t%2\t%3\t%4\t%5\t%6\t%7\n" ).arg( type ).arg( p.count )
+			.arg( double( p.loadTime ) / 1e6, 0, 'f', 3 )
+			.arg( total > 0 ? 100.0 * double( p.loadTime ) / double( total ) : 0.0, 0, 'f', 1 )
+			.arg( double( p.saveTime ) / 1e6, 0, 'f', 3 )
+			.arg( double( p.bytes ) / 1024.0, 0, 'f', 1 )
+			.arg( p.items );
+	}
+
+	return text;
+}
+
 bool NifModel::loadIndex( QIODevice & device, const QModelIndex & index )
 {
 	NifItem * item = static_cast<NifItem *>( index.internalPointer() );
+	loadPendingBlock( item );
 
 	if ( item && index.isValid() && index.model() == this ) {
 		NifIStream stream( this, &device );
@@ -2060,6 +3160,7 @@ bool NifModel::loadIndex( QIODevice & device, const QModelIndex & index )
 bool NifModel::loadAndMapLinks( QIODevice & device, const QModelIndex & index, const QMap<qint32, qint32> & map )
 {
 	NifItem * item = static_cast<NifItem *>( index.internalPointer() );
+	loadPendingBlock( item );
 
 	if ( item && index.isValid() && index.model() == this ) {
 		NifIStream stream( this, &device );
@@ -2082,7 +3183,11 @@ bool NifModel::loadHeaderOnly( const QString & fname )
 	QFile f( fname );
 
 	if ( !f.open( QIODevice::ReadOnly ) ) {
-		Message::critical( nullptr, tr( "Failed to open %1" ).arg( fname ) );
+		if ( msgMode == UserMessage ) {
+			Message::critical( nullptr, tr( "Failed to open %1" ).arg( fname ) );
+		} else {
+			testMsg( tr( "Failed to open %1" ).arg( fname ) );
+		}
 		return false;
 	}
 
@@ -2134,109 +3239,691 @@ bool NifModel::earlyRejection( const QString & filepath, const QString & blockId
 		}
 	}
 
-	return (ver_match && blk_match);
+	return (ver_match && blk_match);
+}
+
+QVector<NifModel::HeaderInfo> NifModel::scanHeaders( const QStringList & files )
+{
+	QVector<HeaderInfo> infos( files.count() );
+
+	// The headers can only be read once nif.xml has been loaded
+	if ( currentSchema()->blocks.isEmpty() )
+		return infos;
+
+	std::atomic<int> next( 0 );
+
+	auto scan = [&files, &infos, &next]() {
+		for ( int i = next++; i < files.count(); i = next++ ) {
+			HeaderInfo & info = infos[i];
+			info.filepath = files.at( i );
+
+			NifModel nif;
+			nif.setMessageMode( TstMessage );
+
+			if ( !nif.loadHeaderOnly( info.filepath ) )
+				continue;
+
+			NifItem * header = nif.getHeaderItem();
+
+			info.ok = true;
+			info.version = nif.getVersionNumber();
+			info.userVersion = nif.getUserVersion();
+			info.userVersion2 = nif.getUserVersion2();
+			info.numBlocks = nif.get<int>( header, "Num Blocks" );
+
+			// Block types are only stored in the header for 10.0.1.0 and above
+			NifItem * idxBlockTypes = nif.getItem( header, "Block Types" );
+			NifItem * idxBlockTypeIndices = nif.getItem( header, "Block Type Index" );
+			if ( !idxBlockTypes || !idxBlockTypeIndices )
+				continue;
+
+			const QVector<QString> blocktypes = idxBlockTypes->getArray<QString>();
+			for ( NifItem * child : idxBlockTypeIndices->children() )
+				info.blockTypes[ blocktypes.value( child->value().get<int>() & 0x7FFF ) ]++;
+		}
+	};
+
+	QThreadPool pool;
+	for ( int t = 0; t < pool.maxThreadCount(); t++ )
+		pool.start( new FunctionRunnable( scan ) );
+
+	pool.waitForDone();
+
+	return infos;
+}
+
+QVector<NifModel::HeaderInfo> NifModel::scanHeaders( const QString & directory, const QStringList & extensions, bool recursive )
+{
+	QStringList files;
+
+	QDirIterator it( directory, extensions, QDir::Files,
+	                 recursive ? QDirIterator::Subdirectories : QDirIterator::NoIteratorFlags );
+	while ( it.hasNext() )
+		files.append( it.next() );
+
+	return scanHeaders( files );
+}
+
+bool NifModel::saveIndex( QIODevice & device, const QModelIndex & index ) const
+{
+	NifOStream stream( this, &device );
+	NifItem * item = static_cast<NifItem *>( index.internalPointer() );
+	loadPendingBlock( item );
+	return ( item && index.isValid() && index.model() == this && saveItem( item, stream ) );
+}
+
+int NifModel::fileOffset( const QModelIndex & index ) const
+{
+	NifItem * target = static_cast<NifItem *>( index.internalPointer() );
+
+	if ( !( target && index.isValid() && index.model() == this ) )
+		return -1;
+
+	NifItem * row = target;
+	while ( row->parent() && row->parent() != root )
+		row = row->parent();
+
+	if ( row->parent() != root )
+		return -1;
+
+	loadPendingBlock( row );
+
+	int ofs = rowOffset( row->row() ) + rowPrefixSize( row->row() );
+	if ( target == row )
+		return ofs;
+
+	// Measure the whole row once, the inspector asks for many items of the same block
+	if ( itemOffsetsRow != row ) {
+		NifSStream stream( this );
+		itemOffsets.clear();
+		measureOffsets( row, stream, 0, &itemOffsets );
+		itemOffsetsRow = row;
+	}
+
+	return ofs + itemOffsets.value( target );
+}
+
+int NifModel::rowPrefixSize( int row ) const
+{
+	if ( row <= 0 || row > getBlockCount() )
+		return 0;
+
+	int ofs = 0;
+
+	if ( version > 0x0a000000 ) {
+		if ( version < 0x0a020000 ) {
+			ofs += 4;
+		}
+	} else {
+		if ( version < 0x0303000d ) {
+			if ( rootLinks.contains( row - 1 ) ) {
+				QString string = "Top Level Object";
+				ofs += 4 + string.length();
+			}
+		}
+
+		QString string = itemName( this->NifModel::index( row, 0 ) );
+		ofs += 4 + string.length();
+
+		if ( version < 0x0303000d ) {
+			ofs += 4;
+		}
+	}
+
+	return ofs;
+}
+
+int NifModel::rowOffset( int row ) const
+{
+	int rows = root->childCount();
+	if ( rowOffsets.count() != rows + 1 ) {
+		rowOffsets.resize( rows + 1 );
+		rowOffsetsValid = 0;
+	}
+
+	if ( rowOffsetsValid == 0 ) {
+		rowOffsets[0] = 0;
+		rowOffsetsValid = 1;
+	}
+
+	NifSStream stream( this );
+
+	while ( rowOffsetsValid <= row ) {
+		int r = rowOffsetsValid - 1;
+		int size;
+
+		// Use the cached block sizes for unmodified blocks
+		if ( r > 0 && blockTable.hasSize( r - 1 ) ) {
+			size = blockTable.sizes.at( r - 1 );
+		} else {
+			loadPendingBlock( root->child( r ) );
+			size = measureOffsets( root->child( r ), stream, 0, nullptr );
+		}
+
+		rowOffsets[r + 1] = rowOffsets[r] + rowPrefixSize( r ) + size;
+		rowOffsetsValid++;
+	}
+
+	return rowOffsets.at( row );
+}
+
+int NifModel::blockSize( const QModelIndex & index ) const
+{
+	NifItem * item = static_cast<NifItem *>( index.internalPointer() );
+
+	// Use the cached block sizes for unmodified blocks
+	if ( item && item->parent() == root ) {
+		int b = item->row() - 1;
+		if ( blockTable.hasSize( b ) )
+			return blockTable.sizes.at( b );
+	}
+
+	NifSStream stream( this );
+	return blockSize( item, stream );
+}
+
+int NifModel::blockSize( NifItem * parent ) const
+{
+	NifSStream stream( this );
+	return blockSize( parent, stream );
+}
+
+int NifModel::blockSize( NifItem * parent, NifSStream & stream ) const
+{
+	int size = 0;
+
+	if ( !parent )
+		return 0;
+
+	for ( int row = 0; row < parent->childCount(); row++ ) {
+		NifItem * child = parent->child( row );
+
+		if ( child->isAbstract() ) {
+			//qDebug() << "Not counting abstract item " << child->name();
+			continue;
+		}
+
+		if ( evalCondition( child ) ) {
+			if ( isArray( child ) || !child->arr2().isEmpty() || child->childCount() > 0 ) {
+				if ( isArray( child ) && child->childCount() != getArraySize( child ) ) {
+					if ( child->isBinary() ) {
+						// special byte
+					} else {
+						auto m = tr( "block %1 %2 array size mismatch" ).arg( getBlockNumber( parent ) ).arg( child->name() );
+						if ( msgMode == UserMessage ) {
+							Message::append( tr( "Warnings were generated while reading the blocks." ), m );
+						} else {
+							testMsg( m );
+						}
+					}
+				}
+
+				size += blockSize( child, stream );
+			} else {
+				size += stream.size( child->value() );
+			}
+		}
+	}
+
+	return size;
+}
+
+bool NifModel::loadItem( NifItem * parent, NifIStream & stream )
+{
+	if ( !parent )
+		return false;
+
+	for ( auto child : parent->children() ) {
+		if ( !child->isConditionless() )
+			child->invalidateCondition();
+
+		if ( child->isAbstract() ) {
+			//qDebug() << "Not loading abstract item " << child->name();
+			continue;
+		}
+
+		if ( evalCondition( child ) ) {
+			if ( isArray( child ) ) {
+				if ( !updateArrayItem( child ) )
+					return false;
+
+				if ( isFixedArray( child, stream ) ) {
+					// Arrays of plain values are read in one go
+					if ( !stream.readFixedArray( child ) )
+						return false;
+				} else if ( isRecordArray( child ) ) {
+					if ( !loadRecordArray( child, stream ) )
+						return false;
+				} else if ( !loadItem( child, stream ) ) {
+					return false;
+				}
+			} else if ( child->childCount() > 0 ) {
+				if ( !loadItem( child, stream ) )
+					return false;
+			} else {
+				if ( !stream.read( child->value() ) )
+					return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+bool NifModel::isFixedArray( NifItem * array, const NifIStream & stream ) const
+{
+	if ( array->isCompound() || array->isMultiArray() || array->isBinary() || array->childCount() == 0 )
+		return false;
+
+	const NifItem * first = array->child( 0 );
+	return first->childCount() == 0 && stream.fixedSize( first->value().type() ) > 0;
+}
+
+bool NifModel::isRecordArray( NifItem * array ) const
+{
+	if ( !array->isCompound() || array->isMultiArray() || array->isBinary() || array->childCount() < 2 )
+		return false;
+
+	// The conditions of fixed compounds are evaluated once for the array, see evalCondition()
+	if ( isFixedCompound( array->type() ) )
+		return true;
+
+	// Otherwise the fields must depend on the versions alone
+	for ( NifItem * field : array->child( 0 )->children() ) {
+		if ( !field->cond().isEmpty() )
+			return false;
+	}
+
+	return true;
+}
+
+bool NifModel::recordLayout( NifItem * element, QVector<int> & rows ) const
+{
+	const QVector<NifItem *> & fields = element->children();
+
+	for ( int f = 0; f < fields.count(); f++ ) {
+		NifItem * field = fields.at( f );
+		if ( field->isAbstract() || !evalCondition( field ) )
+			continue;
+
+		if ( isArray( field ) || !field->arr2().isEmpty() || field->childCount() > 0 )
+			return false;
+
+		rows.append( f );
+	}
+
+	return true;
+}
+
+bool NifModel::loadRecordArray( NifItem * array, NifIStream & stream, bool detached )
+{
+	auto load = [this, &stream, detached]( NifItem * element ) {
+		return detached ? loadDetachedItem( element, stream ) : loadItem( element, stream );
+	};
+
+	// The first element is read as any other, which evaluates the conditions the others share
+	NifItem * first = array->child( 0 );
+	if ( !load( first ) )
+		return false;
+
+	QVector<int> rows;
+	const int elements = array->childCount();
+	const int fields = first->childCount();
+
+	bool flat = recordLayout( first, rows );
+	for ( int e = 1; e < elements && flat; e++ )
+		flat = ( array->child( e )->childCount() == fields );
+
+	if ( !flat ) {
+		for ( int e = 1; e < elements; e++ ) {
+			if ( !load( array->child( e ) ) )
+				return false;
+		}
+
+		return true;
+	}
+
+	for ( int e = 1; e < elements; e++ ) {
+		NifItem * element = array->child( e );
+
+		for ( int f = 0; f < fields; f++ ) {
+			NifItem * field = element->child( f );
+			NifItem * original = first->child( f );
+
+			if ( original->isConditionValid() )
+				field->setCondition( original->condition() );
+			else
+				field->invalidateCondition();
+		}
+	}
+
+	// The fields of plain values of known sizes are copied out of the file for all elements at once
+	if ( stream.fixedRecordSize( first, rows ) > 0 )
+		return stream.readFixedRecords( array, rows );
+
+	for ( int e = 1; e < elements; e++ ) {
+		NifItem * element = array->child( e );
+
+		for ( int r : rows ) {
+			if ( !stream.read( element->child( r )->value() ) )
+				return false;
+		}
+	}
+
+	return true;
+}
+
+//! Split the NiMesh data stream usage and access out of a block type from the header
+static bool splitDataStreamType( QString & blktyp, qint32 & usage, qint32 & access )
+{
+	if ( !blktyp.startsWith( "NiDataStream\x01" ) )
+		return true;
+
+	QStringList splitStream = blktyp.split( "\x01" );
+	if ( splitStream.count() != 3 )
+		return false;
+
+	bool ok1 = false, ok2 = false;
+	usage = splitStream[1].toInt( &ok1 );
+	access = splitStream[2].toInt( &ok2 );
+	blktyp = splitStream[0];
+
+	return ok1 && ok2;
+}
+
+bool NifModel::canLoadFromBlockTable( QIODevice & device, int numblocks ) const
+{
+	// All block offsets must be known before the first block is read
+	if ( version < 0x14020000 || numblocks <= 0 || device.isSequential() )
+		return false;
+
+	if ( blockTable.types.count() != numblocks || blockTable.sizes.count() != numblocks )
+		return false;
+
+	// The block streams start after the header and cannot follow an endian switch
+	NifItem * endian = getItem( getHeaderItem(), "Endian Type" );
+	if ( endian && endian->value().toCount() == 0 )
+		return false;
+
+	return true;
+}
+
+int NifModel::loadBlocksParallel( QIODevice & device, int numblocks )
+{
+	if ( !canLoadFromBlockTable( device, numblocks ) )
+		return 0;
+
+	struct DetachedBlock
+	{
+		NifItem * parent = nullptr;
+		qint64 offset = 0;
+		quint32 size = 0;
+		qint32 dataStreamUsage = -1;
+		qint32 dataStreamAccess = -1;
+		bool ok = false;
+	};
+
+	QVector<DetachedBlock> detached( numblocks );
+
+	// Build the empty block trees in order, stopping at the first block that needs the serial path
+	int count = 0;
+	qint64 total = 0;
+	for ( ; count < numblocks; count++ ) {
+		QString blktyp = blockTable.types.at( count );
+		DetachedBlock & d = detached[count];
+
+		// Hack for NiMesh data streams
+		if ( !splitDataStreamType( blktyp, d.dataStreamUsage, d.dataStreamAccess ) )
+			break;
+
+		NifBlockPtr block = schema->blocks.value( blktyp );
+		if ( !block || block->abstract )
+			break;
+
+		d.parent = new NifItem( nullptr );
+		d.offset = total;
+		d.size = blockTable.sizes.at( count );
+		total += d.size;
+
+		NifItem * branch = insertBranch( d.parent, NifData( blktyp, "NiBlock", block->text ) );
+		branch->setCondition( true );
+
+		if ( !block->ancestor.isEmpty() )
+			insertAncestor( branch, block->ancestor );
+
+		branch->prepareInsert( block->types.count() );
+		for ( const NifData & data : block->types ) {
+			insertType( branch, data );
+		}
+	}
+
+	const qint64 start = device.pos();
+	QByteArray data;
+
+	// The blocks are decoded before returning, a buffer can be read in place
+	QBuffer * buffer = qobject_cast<QBuffer *>( &device );
+	if ( buffer && start + total <= buffer->data().size() ) {
+		data = QByteArray::fromRawData( buffer->data().constData() + start, int( total ) );
+		device.seek( start + total );
+	} else {
+		data = device.read( total );
+	}
+
+	if ( count == 0 || data.size() != total ) {
+		for ( const DetachedBlock & d : detached )
+			delete d.parent;
+
+		device.seek( start );
+		return 0;
+	}
+
+	// Decode each block from its own slice of the buffer
+	std::atomic<int> next( 0 );
+	auto decode = [this, &detached, &data, &next, count]() {
+		for ( int c = next++; c < count; c = next++ ) {
+			DetachedBlock & d = detached[c];
+			TRACE_SPAN( "NifModel::loadBlock", d.parent->child( 0 )->name() );
+
+			QByteArray slice = QByteArray::fromRawData( data.constData() + d.offset, d.size );
+			QBuffer buffer( &slice );
+			buffer.open( QIODevice::ReadOnly );
+
+			NifIStream stream( this, &buffer );
+			d.ok = loadDetachedItem( d.parent->child( 0 ), stream ) && buffer.pos() == d.size;
+		}
+	};
+
+	QThreadPool pool;
+	for ( int t = 0; t < pool.maxThreadCount(); t++ )
+		pool.start( new FunctionRunnable( decode ) );
+
+	pool.waitForDone();
+
+	// Splice the decoded blocks into the model in order, up to the first failure
+	int loaded = 0;
+	for ( ; loaded < count && detached.at( loaded ).ok; loaded++ ) {
+		emit sigProgress( loaded + 1, numblocks );
+
+		DetachedBlock & d = detached[loaded];
+
+		beginInsertRows( QModelIndex(), loaded + 1, loaded + 1 );
+		NifItem * branch = d.parent->takeChild( 0 );
+		root->insertChild( branch, loaded + 1 );
+		endInsertRows();
+
+		// NiMesh hack
+		if ( branch->name() == "NiDataStream" ) {
+			set<qint32>( branch, "Usage", d.dataStreamUsage );
+			set<qint32>( branch, "Access", d.dataStreamAccess );
+		}
+	}
+
+	for ( const DetachedBlock & d : detached )
+		delete d.parent;
+
+	// Leave the device at the first block which still has to be read
+	device.seek( start + ( loaded < count ? detached.at( loaded ).offset : total ) );
+
+	return loaded;
+}
+
+int NifModel::loadBlocksLazy( QIODevice & device, int numblocks )
+{
+	if ( !canLoadFromBlockTable( device, numblocks ) )
+		return 0;
+
+	// Add the block items and keep their data for decoding on first access
+	int c = 0;
+	for ( ; c < numblocks; c++ ) {
+		QString blktyp = blockTable.types.at( c );
+		PendingBlock pending;
+
+		// Hack for NiMesh data streams
+		if ( !splitDataStreamType( blktyp, pending.dataStreamUsage, pending.dataStreamAccess ) )
+			break;
+
+		NifBlockPtr block = schema->blocks.value( blktyp );
+		if ( !block || block->abstract )
+			break;
+
+		const qint64 pos = device.pos();
+		const quint32 size = blockTable.sizes.at( c );
+
+		pending.data = device.read( size );
+		if ( quint32( pending.data.size() ) != size ) {
+			device.seek( pos );
+			break;
+		}
+
+		emit sigProgress( c + 1, numblocks );
+
+		beginInsertRows( QModelIndex(), c + 1, c + 1 );
+		NifItem * branch = insertBranch( root, NifData( blktyp, "NiBlock", block->text ), c + 1 );
+		branch->setCondition( true );
+		endInsertRows();
+
+		pendingBlocks.insert( branch, pending );
+	}
+
+	return c;
 }
 
-bool NifModel::saveIndex( QIODevice & device, const QModelIndex & index ) const
+void NifModel::loadPendingBlock( NifItem * block ) const
 {
-	NifOStream stream( this, &device );
-	NifItem * item = static_cast<NifItem *>( index.internalPointer() );
-	return ( item && index.isValid() && index.model() == this && saveItem( item, stream ) );
+	if ( decodePendingBlock( block ) )
+		const_cast<NifModel *>( this )->updateLinks( getBlockNumber( block ) );
 }
 
-int NifModel::fileOffset( const QModelIndex & index ) const
+bool NifModel::decodePendingBlock( NifItem * block ) const
 {
-	NifSStream stream( this );
-	NifItem * target = static_cast<NifItem *>( index.internalPointer() );
+	if ( pendingBlocks.isEmpty() || !block )
+		return false;
 
-	if ( target && index.isValid() && index.model() == this ) {
-		int ofs = 0;
+	auto it = pendingBlocks.find( block );
+	if ( it == pendingBlocks.end() )
+		return false;
 
-		for ( int c = 0; c < root->childCount(); c++ ) {
-			if ( c > 0 && c <= getBlockCount() ) {
-				if ( version > 0x0a000000 ) {
-					if ( version < 0x0a020000 ) {
-						ofs += 4;
-					}
-				} else {
-					if ( version < 0x0303000d ) {
-						if ( rootLinks.contains( c - 1 ) ) {
-							QString string = "Top Level Object";
-							ofs += 4 + string.length();
-						}
-					}
+	PendingBlock pending = it.value();
+	pendingBlocks.erase( it );
 
-					QString string = itemName( this->NifModel::index( c, 0 ) );
-					ofs += 4 + string.length();
+	NifBlockPtr blk = schema->blocks.value( block->name() );
+	if ( !blk )
+		return false;
 
-					if ( version < 0x0303000d ) {
-						ofs += 4;
-					}
-				}
-			}
+	// The views have not seen any rows of the block yet, so it is filled in without notifying them
+	NifModel * self = const_cast<NifModel *>( this );
+
+	if ( !blk->ancestor.isEmpty() )
+		self->insertAncestor( block, blk->ancestor );
+
+	block->prepareInsert( blk->types.count() );
+	for ( const NifData & data : blk->types ) {
+		self->insertTypeItems( block, data );
+	}
+
+	TRACE_SPAN( "NifModel::loadBlock", block->name() );
+
+	QBuffer buffer( &pending.data );
+	buffer.open( QIODevice::ReadOnly );
+
+	NifIStream stream( self, &buffer );
+	bool ok = self->loadDetachedItem( block, stream ) && buffer.pos() == pending.data.size();
 
-			if ( fileOffset( root->child( c ), target, stream, ofs ) )
-				return ofs;
+	// NiMesh hack
+	if ( block->name() == "NiDataStream" ) {
+		if ( NifItem * usage = getItem( block, "Usage" ) )
+			usage->value().setCount( pending.dataStreamUsage );
+		if ( NifItem * access = getItem( block, "Access" ) )
+			access->value().setCount( pending.dataStreamAccess );
+	}
+
+	int b = getBlockNumber( block );
+
+	if ( !ok ) {
+		auto m = tr( "failed to load block number %1 (%2)" ).arg( b ).arg( block->name() );
+		if ( msgMode == UserMessage ) {
+			Message::append( tr( "Warnings were generated while reading NIF file." ), m );
+		} else {
+			testMsg( m );
 		}
 	}
 
-	return -1;
+	return true;
 }
 
-int NifModel::blockSize( const QModelIndex & index ) const
+void NifModel::loadPendingBlocks() const
 {
-	NifSStream stream( this );
-	return blockSize( static_cast<NifItem *>( index.internalPointer() ), stream );
-}
+	if ( pendingBlocks.isEmpty() )
+		return;
 
-int NifModel::blockSize( NifItem * parent ) const
-{
-	NifSStream stream( this );
-	return blockSize( parent, stream );
+	for ( NifItem * block : pendingBlocks.keys() )
+		loadPendingBlock( block );
+
+	// The root blocks are only known once every block has been decoded
+	const_cast<NifModel *>( this )->updateLinks();
 }
 
-int NifModel::blockSize( NifItem * parent, NifSStream & stream ) const
+bool NifModel::canHoldLinks( const QString & type ) const
 {
-	int size = 0;
+	if ( linkTypesVersion != version ) {
+		linkTypes.clear();
+		linkTypesVersion = version;
+	}
 
-	if ( !parent )
-		return 0;
+	auto it = linkTypes.constFind( type );
+	if ( it != linkTypes.constEnd() )
+		return it.value();
 
-	for ( int row = 0; row < parent->childCount(); row++ ) {
-		NifItem * child = parent->child( row );
+	NifBlockPtr blk = schema->blocks.value( type );
+	if ( !blk )
+		blk = schema->compounds.value( type );
 
-		if ( child->isAbstract() ) {
-			//qDebug() << "Not counting abstract item " << child->name();
-			continue;
-		}
+	// Compounds which contain themselves are answered by the other fields
+	linkTypes.insert( type, false );
 
-		if ( evalCondition( child ) ) {
-			if ( isArray( child ) || !child->arr2().isEmpty() || child->childCount() > 0 ) {
-				if ( isArray( child ) && child->childCount() != getArraySize( child ) ) {
-					if ( child->isBinary() ) {
-						// special byte
-					} else {
-						auto m = tr( "block %1 %2 array size mismatch" ).arg( getBlockNumber( parent ) ).arg( child->name() );
-						if ( msgMode == UserMessage ) {
-							Message::append( tr( "Warnings were generated while reading the blocks." ), m );
-						} else {
-							testMsg( m );
-						}
-					}
-				}
+	bool links = blk && !blk->ancestor.isEmpty() && canHoldLinks( blk->ancestor );
 
-				size += blockSize( child, stream );
-			} else {
-				size += stream.size( child->value() );
-			}
-		}
+	for ( int i = 0; blk && !links && i < blk->types.count(); i++ ) {
+		const NifData & data = blk->types.at( i );
+
+		if ( ( data.ver1() != 0 && version < data.ver1() ) || ( data.ver2() != 0 && version > data.ver2() ) )
+			continue;
+
+		// The argument of a template is only known where it is used
+		if ( data.value.isLink() || NifValue::isLink( NifValue::type( data.temp() ) ) || data.type() == "TEMPLATE" )
+			links = true;
+		else if ( data.isCompound() )
+			links = canHoldLinks( data.type() );
 	}
 
-	return size;
+	linkTypes.insert( type, links );
+	return links;
 }
 
-bool NifModel::loadItem( NifItem * parent, NifIStream & stream )
+bool NifModel::loadDetachedItem( NifItem * parent, NifIStream & stream )
 {
+	// Mirrors loadItem() without emitting signals, messages or changing the model state.
+	//	Errors are reported by reading the block again with loadItem().
 	if ( !parent )
 		return false;
 
@@ -2244,17 +3931,25 @@ bool NifModel::loadItem( NifItem * parent, NifIStream & stream )
 		if ( !child->isConditionless() )
 			child->invalidateCondition();
 
-		if ( child->isAbstract() ) {
-			//qDebug() << "Not loading abstract item " << child->name();
+		if ( child->isAbstract() )
 			continue;
-		}
 
 		if ( evalCondition( child ) ) {
 			if ( isArray( child ) ) {
-				if ( !updateArrayItem( child ) || !loadItem( child, stream ) )
+				if ( !updateDetachedArray( child ) )
 					return false;
+
+				if ( isFixedArray( child, stream ) ) {
+					if ( !stream.readFixedArray( child ) )
+						return false;
+				} else if ( isRecordArray( child ) ) {
+					if ( !loadRecordArray( child, stream, true ) )
+						return false;
+				} else if ( !loadDetachedItem( child, stream ) ) {
+					return false;
+				}
 			} else if ( child->childCount() > 0 ) {
-				if ( !loadItem( child, stream ) )
+				if ( !loadDetachedItem( child, stream ) )
 					return false;
 			} else {
 				if ( !stream.read( child->value() ) )
@@ -2266,6 +3961,61 @@ bool NifModel::loadItem( NifItem * parent, NifIStream & stream )
 	return true;
 }
 
+bool NifModel::updateDetachedArray( NifItem * array )
+{
+	if ( !isArray( array ) )
+		return false;
+
+	int rows = getArraySize( array );
+
+	if ( rows > 1024 * 1024 * 8 || rows < 0 )
+		return false;
+
+	// Binary array handling
+	if ( array->isBinary() && rows > 0 ) {
+		if ( array->childCount() == 0 ) {
+			NifData data( array->name(), array->type(), array->temp(), NifValue( NifValue::tBlob ), parentPrefix( array->arg() ) );
+			data.setBinary( true );
+			insertTypeItems( array, data );
+		}
+
+		QByteArray * bm = array->child( 0 )->value().get<QByteArray *>();
+		if ( !bm )
+			return false;
+
+		bm->resize( rows );
+		return true;
+	}
+
+	int itemRows = array->childCount();
+
+	if ( rows > itemRows ) {
+		NifData data( array->name(),
+					  array->type(),
+					  array->temp(),
+					  NifValue( NifValue::type( array->type() ) ),
+					  parentPrefix( array->arg() ),
+					  parentPrefix( array->arr2() ) // arr1 in children is parent arr2
+		);
+
+		data.setIsConditionless( true );
+		data.setIsCompound( array->isCompound() );
+		data.setIsArray( array->isMultiArray() );
+
+		array->prepareInsert( rows - itemRows );
+
+		// As in updateArrayItem()
+		insertTypeItems( array, data );
+
+		if ( NifItem * first = array->child( itemRows ) )
+			array->appendClones( first, rows - itemRows - 1 );
+	} else if ( rows < itemRows ) {
+		array->removeChildren( rows, itemRows - rows );
+	}
+
+	return true;
+}
+
 bool NifModel::loadHeader( NifItem * header, NifIStream & stream )
 {
 	// Load header separately and invalidate conditions before reading
@@ -2277,8 +4027,13 @@ bool NifModel::loadHeader( NifItem * header, NifIStream & stream )
 	set<int>( header, "User Version 2", 0 );
 
 	invalidateConditions( header, false );
-	
-	return loadItem( header, stream );
+
+	// The versions change while the header is read
+	versionKey = 0;
+	bool ok = loadItem( header, stream );
+	updateVersionKey();
+
+	return ok;
 }
 
 bool NifModel::saveItem( NifItem * parent, NifOStream & stream ) const
@@ -2304,8 +4059,12 @@ bool NifModel::saveItem( NifItem * parent, NifOStream & stream ) const
 					}
 				}
 
-				if ( !saveItem( child, stream ) )
+				if ( isArray( child ) && isRecordArray( child ) ) {
+					if ( !saveRecordArray( child, stream ) )
+						return false;
+				} else if ( !saveItem( child, stream ) ) {
 					return false;
+				}
 			} else {
 				if ( !stream.write( child->value() ) )
 					return false;
@@ -2316,26 +4075,51 @@ bool NifModel::saveItem( NifItem * parent, NifOStream & stream ) const
 	return true;
 }
 
-bool NifModel::fileOffset( NifItem * parent, NifItem * target, NifSStream & stream, int & ofs ) const
+bool NifModel::saveRecordArray( NifItem * array, NifOStream & stream ) const
 {
-	if ( parent == target )
-		return true;
+	NifItem * first = array->child( 0 );
+	if ( !saveItem( first, stream ) )
+		return false;
+
+	QVector<int> rows;
+	const bool flat = recordLayout( first, rows );
+	const int fields = first->childCount();
+
+	for ( int e = 1; e < array->childCount(); e++ ) {
+		NifItem * element = array->child( e );
+
+		if ( !flat || element->childCount() != fields ) {
+			if ( !saveItem( element, stream ) )
+				return false;
+
+			continue;
+		}
+
+		for ( int r : rows ) {
+			if ( !stream.write( element->child( r )->value() ) )
+				return false;
+		}
+	}
+
+	return true;
+}
 
+int NifModel::measureOffsets( NifItem * parent, NifSStream & stream, int ofs, QHash<const NifItem *, int> * offsets ) const
+{
 	for ( auto child : parent->children() ) {
-		if ( child == target )
-			return true;
+		if ( offsets )
+			offsets->insert( child, ofs );
 
 		if ( evalCondition( child ) ) {
 			if ( isArray( child ) || !child->arr2().isEmpty() || child->childCount() > 0 ) {
-				if ( fileOffset( child, target, stream, ofs ) )
-					return true;
+				ofs = measureOffsets( child, stream, ofs, offsets );
 			} else {
 				ofs += stream.size( child->value() );
 			}
 		}
 	}
 
-	return false;
+	return ofs;
 }
 
 NifItem * NifModel::insertBranch( NifItem * parentItem, const NifData & data, int at )
@@ -2386,6 +4170,10 @@ bool NifModel::evalCondition( NifItem * item, bool chkParents ) const
 
 void NifModel::invalidateConditions( NifItem * item, bool refresh )
 {
+	// Conditions are invalidated from the header after its versions were changed
+	if ( item == getHeaderItem() )
+		updateVersionKey();
+
 	for ( NifItem * c : item->children() ) {
 		c->invalidateCondition();
 		c->invalidateVersionCondition();
@@ -2419,9 +4207,17 @@ void NifModel::invalidateDependentConditions( NifItem * item )
 	if ( !p || p == root )
 		return;
 
-	QString name = item->name();
+	// Fields described by the XML know which of their siblings refer to them
+	bool indexed = item->hasDependencyIndex();
+	if ( indexed && item->dependents().isEmpty() )
+		return;
+
+	const QString & name = item->name();
 	for ( int i = item->row(); i < p->childCount(); i++ ) {
 		auto c = p->children().at( i );
+		if ( indexed && !item->dependents().contains( c->nameId() ) )
+			continue;
+
 		// String check for Name in cond or arg
 		//	Note: May cause some false positives but this is OK
 		if ( c->cond().contains( name ) ) {
@@ -2453,40 +4249,76 @@ void NifModel::updateLinks( int block )
 		return;
 	}
 
-	if ( block >= 0 ) {
-		childLinks[ block ].clear();
-		parentLinks[ block ].clear();
-		updateLinks( block, getBlockItem( block ) );
+	int n = getBlockCount();
+
+	// A single block can only be updated while the graph matches the block list
+	if ( block >= 0 && childLinks.count() == n && block < n ) {
+		for ( const auto c : childLinks[block] ) {
+			if ( c >= 0 && c < n )
+				linkedFrom[c].removeOne( block );
+		}
+
+		childLinks[block].clear();
+		parentLinks[block].clear();
+		if ( droppedLinks.count() == n )
+			droppedLinks[block].clear();
+		else
+			droppedLinks = QVector<QList<int> >( n );
+
+		updateLinks( block, root->child( block + 1 ) );
+
+		for ( const auto c : childLinks[block] ) {
+			if ( c >= 0 && c < n ) {
+				QList<int> & from = linkedFrom[c];
+				from.insert( std::lower_bound( from.begin(), from.end(), block ), block );
+			}
+		}
+
+		// Only links leaving this block can have closed a cycle
+		QStack<int> stack;
+		checkLinks( block, stack );
+
+		// Any change on the path of a cycle can have broken it
+		restoreLinks();
+
+		updateRootLinks();
 	} else {
-		rootLinks.clear();
-		childLinks.clear();
-		parentLinks.clear();
+		childLinks = QVector<QList<int> >( n );
+		parentLinks = QVector<QList<int> >( n );
+		linkedFrom = QVector<QList<int> >( n );
+		droppedLinks = QVector<QList<int> >( n );
 
-		// Run updateLinks() for each block
-		for ( int c = 0; c < getBlockCount(); c++ )
-			updateLinks( c );
+		// Blocks of types without links are left for decoding on first access
+		for ( int c = 0; c < n; c++ ) {
+			NifItem * item = root->child( c + 1 );
+			if ( pendingBlocks.isEmpty() || !pendingBlocks.contains( item ) || canHoldLinks( item->name() ) )
+				updateLinks( c, item );
+		}
 
 		// Run checkLinks() for each block
-		for ( int c = 0; c < getBlockCount(); c++ ) {
+		for ( int c = 0; c < n; c++ ) {
 			QStack<int> stack;
 			checkLinks( c, stack );
 		}
 
-
-		int n = getBlockCount();
-		QByteArray hasrefs( n, 0 );
-
 		for ( int c = 0; c < n; c++ ) {
-			for ( const auto d : childLinks.value( c ) ) {
-				if ( d >= 0 && d < n )
-					hasrefs[d] = 1;
+			for ( const auto d : childLinks[c] ) {
+				if ( d >= 0 && d < n && ( linkedFrom[d].isEmpty() || linkedFrom[d].last() != c ) )
+					linkedFrom[d].append( c );
 			}
 		}
 
-		for ( int c = 0; c < n; c++ ) {
-			if ( !hasrefs[c] )
-				rootLinks.append( c );
-		}
+		updateRootLinks();
+	}
+}
+
+void NifModel::updateRootLinks()
+{
+	rootLinks.clear();
+
+	for ( int c = 0; c < linkedFrom.count(); c++ ) {
+		if ( linkedFrom[c].isEmpty() )
+			rootLinks.append( c );
 	}
 }
 
@@ -2495,6 +4327,10 @@ void NifModel::updateLinks( int block, NifItem * parent )
 	if ( !parent )
 		return;
 
+	// The links of a block are only known once it has been decoded
+	if ( !pendingBlocks.isEmpty() && parent->parent() == root )
+		decodePendingBlock( parent );
+
 	auto links = parent->getLinkRows();
 	for ( int l : links ) {
 		NifItem * c = parent->child( l );
@@ -2539,6 +4375,12 @@ void NifModel::checkLinks( int block, QStack<int> & parents )
 			}
 
 			childLinks[block].removeAll( child );
+			if ( child >= 0 && child < linkedFrom.count() )
+				linkedFrom[child].removeOne( block );
+
+			// Kept to be restored once the cycle is broken, see restoreLinks()
+			if ( block < droppedLinks.count() && !droppedLinks[block].contains( child ) )
+				droppedLinks[block].append( child );
 		} else {
 			checkLinks( child, parents );
 		}
@@ -2546,6 +4388,57 @@ void NifModel::checkLinks( int block, QStack<int> & parents )
 	parents.pop();
 }
 
+void NifModel::restoreLinks()
+{
+	const int n = childLinks.count();
+	if ( droppedLinks.count() != n )
+		return;
+
+	for ( int b = 0; b < n; b++ ) {
+		QList<int> & dropped = droppedLinks[b];
+
+		for ( int i = 0; i < dropped.count(); ) {
+			const int child = dropped.at( i );
+
+			if ( child < 0 || child >= n || childLinks[b].contains( child ) ) {
+				dropped.removeAt( i );
+			} else if ( child != b && !reachesLink( child, b ) ) {
+				childLinks[b].append( child );
+
+				QList<int> & from = linkedFrom[child];
+				from.insert( std::lower_bound( from.begin(), from.end(), b ), b );
+
+				dropped.removeAt( i );
+			} else {
+				i++;
+			}
+		}
+	}
+}
+
+bool NifModel::reachesLink( int from, int to ) const
+{
+	const int n = childLinks.count();
+	QVector<bool> visited( n, false );
+	QStack<int> stack;
+	stack.push( from );
+
+	while ( !stack.isEmpty() ) {
+		int b = stack.pop();
+		if ( b == to )
+			return true;
+
+		if ( b < 0 || b >= n || visited.at( b ) )
+			continue;
+
+		visited[b] = true;
+		for ( int c : childLinks.at( b ) )
+			stack.push( c );
+	}
+
+	return false;
+}
+
 void NifModel::adjustLinks( NifItem * parent, int block, int delta )
 {
 	if ( !parent )
@@ -2558,10 +4451,14 @@ void NifModel::adjustLinks( NifItem * parent, int block, int delta )
 		int l = parent->value().toLink();
 
 		if ( l >= 0 && ( ( delta != 0 && l >= block ) || l == block ) ) {
+			recordValue( parent );
+
 			if ( delta == 0 )
 				parent->value().setLink( -1 );
 			else
 				parent->value().setLink( l + delta );
+
+			invalidateBlockSource( parent );
 		}
 	}
 }
@@ -2578,8 +4475,12 @@ void NifModel::mapLinks( NifItem * parent, const QMap<qint32, qint32> & map )
 		int l = parent->value().toLink();
 
 		if ( l >= 0 ) {
-			if ( map.contains( l ) )
-				parent->value().setLink( map[ l ] );
+			auto it = map.constFind( l );
+			if ( it != map.constEnd() && it.value() != l ) {
+				recordValue( parent );
+				parent->value().setLink( it.value() );
+				invalidateBlockSource( parent );
+			}
 		}
 	}
 }
@@ -2642,15 +4543,17 @@ bool NifModel::setLink( const QModelIndex & parent, const QString & name, qint32
 
 	NifItem * item = getItem( parentItem, name );
 
+	recordValue( item );
+
 	if ( item && item->value().setLink( l ) ) {
-		emit dataChanged( createIndex( item->row(), ValueCol, item ), createIndex( item->row(), ValueCol, item ) );
+		notifyChanged( createIndex( item->row(), ValueCol, item ), createIndex( item->row(), ValueCol, item ) );
 		NifItem * parent = item;
 
 		while ( parent->parent() && parent->parent() != root )
 			parent = parent->parent();
 
 		if ( parent != getFooterItem() ) {
-			updateLinks();
+			updateLinks( getBlockNumber( parent ) );
 			updateFooter();
 			emit linksChanged();
 		}
@@ -2668,15 +4571,17 @@ bool NifModel::setLink( const QModelIndex & index, qint32 l )
 	if ( !( index.isValid() && item && index.model() == this ) )
 		return false;
 
+	recordValue( item );
+
 	if ( item && item->value().setLink( l ) ) {
-		emit dataChanged( createIndex( item->row(), ValueCol, item ), createIndex( item->row(), ValueCol, item ) );
+		notifyChanged( createIndex( item->row(), ValueCol, item ), createIndex( item->row(), ValueCol, item ) );
 		NifItem * parent = item;
 
 		while ( parent->parent() && parent->parent() != root )
 			parent = parent->parent();
 
 		if ( parent != getFooterItem() ) {
-			updateLinks();
+			updateLinks( getBlockNumber( parent ) );
 			updateFooter();
 			emit linksChanged();
 		}
@@ -2695,6 +4600,7 @@ bool NifModel::setLinkArray( const QModelIndex & iArray, const QVector<qint32> &
 		bool ret = true;
 
 		for ( int c = 0; c < item->childCount() && c < links.count(); c++ ) {
+			recordValue( item->child( c ) );
 			ret &= item->child( c )->value().setLink( links[c] );
 		}
 
@@ -2702,7 +4608,7 @@ bool NifModel::setLinkArray( const QModelIndex & iArray, const QVector<qint32> &
 		int x = item->childCount() - 1;
 
 		if ( x >= 0 )
-			emit dataChanged( createIndex( 0, ValueCol, item->child( 0 ) ), createIndex( x, ValueCol, item->child( x ) ) );
+			notifyChanged( createIndex( 0, ValueCol, item->child( 0 ) ), createIndex( x, ValueCol, item->child( x ) ) );
 
 		NifItem * parent = item;
 
@@ -2710,7 +4616,7 @@ bool NifModel::setLinkArray( const QModelIndex & iArray, const QVector<qint32> &
 			parent = parent->parent();
 
 		if ( parent != getFooterItem() ) {
-			updateLinks();
+			updateLinks( getBlockNumber( parent ) );
 			updateFooter();
 			emit linksChanged();
 		}
@@ -2738,16 +4644,11 @@ bool NifModel::isLink( const QModelIndex & index, bool * isChildLink ) const
 
 int NifModel::getParent( int block ) const
 {
-	int parent = -1;
-
-	for ( int b = 0; b < getBlockCount(); b++ ) {
-		if ( childLinks.value( b ).contains( block ) ) {
-			parent = b;
-			break;
-		}
-	}
+	const QList<int> from = linkedFrom.value( block );
+	if ( from.isEmpty() )
+		return -1;
 
-	return parent;
+	return from.first();
 }
 
 int NifModel::getParent( const QModelIndex & index ) const
@@ -2815,6 +4716,7 @@ bool NifModel::assignString( const QModelIndex & index, const QString & string,
 
 bool NifModel::assignString( NifItem * item, const QString & string, bool replace )
 {
+	recordValue( item );
 	NifValue & v = item->value();
 
 	if ( getVersionNumber() >= 0x14010003 ) {
@@ -2858,23 +4760,32 @@ bool NifModel::assignString( NifItem * item, const QString & string, bool replac
 
 		// Simply replace the string
 		if ( replace && idx >= 0 && idx < nstrings ) {
+			// The signal may be held back by a transaction
+			stringTableCount = -1;
 			return BaseModel::set<QString>( iArray.child( idx, 0 ), string );
 		}
 
-		QVector<QString> stringVector = getArray<QString>( iArray );
-		idx = stringVector.indexOf( string );
+		idx = stringNumber( string );
 
 		// Already exists.  Just update the Index
-		if ( idx >= 0 && idx < stringVector.size() ) {
+		if ( idx >= 0 ) {
 			v.changeType( NifValue::tStringIndex );
 			return set<int>( pItem, idx );
 		}
 
+		// The table only lacks the new row, whatever the header signals while appending
+		bool current = ( stringTableCount == nstrings );
+
 		// Append string to end of list
 		set<uint>( header, "Num Strings", nstrings + 1 );
 		updateArray( header, "Strings" );
 		BaseModel::set<QString>( iArray.child( nstrings, 0 ), string );
 
+		if ( current ) {
+			stringTable.insert( string, nstrings );
+			stringTableCount = nstrings + 1;
+		}
+
 		v.changeType( NifValue::tStringIndex );
 		return set<int>( pItem, nstrings );
 	} // endif getVersionNumber() >= 0x14010003
@@ -2912,8 +4823,10 @@ void NifModel::convertNiBlock( const QString & identifier, const QModelIndex & i
 	}
 
 	NifItem * branch = static_cast<NifItem *>( index.internalPointer() );
-	NifBlockPtr srcBlock = blocks.value( btype );
-	NifBlockPtr dstBlock = blocks.value( identifier );
+	loadPendingBlock( branch );
+	invalidateBlockSize( index );
+	NifBlockPtr srcBlock = schema->blocks.value( btype );
+	NifBlockPtr dstBlock = schema->blocks.value( identifier );
 
 	if ( srcBlock && dstBlock && branch ) {
 		branch->setName( identifier );
@@ -2921,7 +4834,7 @@ void NifModel::convertNiBlock( const QString & identifier, const QModelIndex & i
 		if ( inherits( btype, identifier ) ) {
 			// Remove any level between the two types
 			for ( QString ancestor = btype; !ancestor.isNull() && ancestor != identifier; ) {
-				NifBlockPtr block = blocks.value( ancestor );
+				NifBlockPtr block = schema->blocks.value( ancestor );
 
 				if ( !block )
 					break;
@@ -2938,7 +4851,7 @@ void NifModel::convertNiBlock( const QString & identifier, const QModelIndex & i
 			QStringList types;
 
 			for ( QString ancestor = identifier; !ancestor.isNull() && ancestor != btype; ) {
-				NifBlockPtr block = blocks.value( ancestor );
+				NifBlockPtr block = schema->blocks.value( ancestor );
 
 				if ( !block )
 					break;
@@ -2948,7 +4861,7 @@ void NifModel::convertNiBlock( const QString & identifier, const QModelIndex & i
 			}
 
 			for ( const QString& ancestor : types ) {
-				NifBlockPtr block = blocks.value( ancestor );
+				NifBlockPtr block = schema->blocks.value( ancestor );
 
 				if ( !block )
 					break;
@@ -3045,9 +4958,29 @@ QVariant NifModelEval::operator()( const QVariant & v ) const
  *  ChangeValueCommand
  */
 
+//! The rows leading from the root to \a index, which stay valid when undoing a spell replaces the items
+static QVector<int> indexPath( QModelIndex index )
+{
+	QVector<int> path;
+	for ( ; index.isValid(); index = index.parent() )
+		path.prepend( index.row() );
+
+	return path;
+}
+
+//! The index of \a column at \a path, see indexPath()
+static QModelIndex pathIndex( NifModel * nif, const QVector<int> & path, int column )
+{
+	QModelIndex index;
+	for ( int i = 0; i < path.count(); i++ )
+		index = nif->index( path.at( i ), ( i == path.count() - 1 ) ? column : 0, index );
+
+	return index;
+}
+
 ChangeValueCommand::ChangeValueCommand( const QModelIndex & index,
 	const QVariant & value, const QString & valueString, const QString & valueType, NifModel * model )
-	: QUndoCommand(), nif( model ), idx( index )
+	: QUndoCommand(), nif( model ), path( indexPath( index ) ), column( index.column() )
 {
 	oldValue = index.data( Qt::EditRole );
 	newValue = value;
@@ -3064,17 +4997,58 @@ ChangeValueCommand::ChangeValueCommand( const QModelIndex & index,
 void ChangeValueCommand::redo()
 {
 	//qDebug() << "Redoing";
-	nif->setData( idx, newValue, Qt::EditRole );
-
-	//qDebug() << nif->data( idx ).toString();
+	nif->setData( pathIndex( nif, path, column ), newValue, Qt::EditRole );
 }
 
 void ChangeValueCommand::undo()
 {
 	//qDebug() << "Undoing";
-	nif->setData( idx, oldValue, Qt::EditRole );
+	nif->setData( pathIndex( nif, path, column ), oldValue, Qt::EditRole );
+}
+
+
+/*
+ *  ChangeValuesCommand
+ */
+
+ChangeValuesCommand::ChangeValuesCommand( const QVector<BaseModel::RecordedStep> & recorded, const QString & name, NifModel * model )
+	: QUndoCommand(), nif( model ), steps( recorded )
+{
+	setText( name );
 
-	//qDebug() << nif->data( idx ).toString();
+	for ( const auto & step : steps )
+		structural |= ( step.kind != BaseModel::RecordedStep::Values );
+}
+
+void ChangeValuesCommand::redo()
+{
+	// The edits were already made when the command was pushed
+	if ( firstRedo ) {
+		firstRedo = false;
+		return;
+	}
+
+	restore( false );
+}
+
+void ChangeValuesCommand::undo()
+{
+	restore( true );
+}
+
+void ChangeValuesCommand::restore( bool useOld )
+{
+	// Reassess the conditions of every touched block or header
+	for ( NifItem * row : nif->restoreRecording( steps, useOld ) )
+		nif->invalidateConditions( row, true );
+
+	if ( structural ) {
+		nif->updateLinks();
+		nif->updateFooter();
+		emit nif->linksChanged();
+	}
+
+	nif->updateHeader();
 }
 
 
@@ -3084,7 +5058,7 @@ void ChangeValueCommand::undo()
 
 ToggleCheckBoxListCommand::ToggleCheckBoxListCommand( const QModelIndex & index,
 	const QVariant & value, const QString & valueType, NifModel * model )
-	: QUndoCommand(), nif( model ), idx( index )
+	: QUndoCommand(), nif( model ), path( indexPath( index ) ), column( index.column() )
 {
 	oldValue = index.data( Qt::EditRole );
 	newValue = value;
@@ -3097,15 +5071,11 @@ ToggleCheckBoxListCommand::ToggleCheckBoxListCommand( const QModelIndex & index,
 void ToggleCheckBoxListCommand::redo()
 {
 	//qDebug() << "Redoing";
-	nif->setData( idx, newValue, Qt::EditRole );
-
-	//qDebug() << nif->data( idx ).toString();
+	nif->setData( pathIndex( nif, path, column ), newValue, Qt::EditRole );
 }
 
 void ToggleCheckBoxListCommand::undo()
 {
 	//qDebug() << "Undoing";
-	nif->setData( idx, oldValue, Qt::EditRole );
-
-	//qDebug() << nif->data( idx ).toString();
+	nif->setData( pathIndex( nif, path, column ), oldValue, Qt::EditRole );
 }
@@ -50,7 +50,42 @@ class SpellBook;
 using NifBlockPtr = std::shared_ptr<NifBlock>;
 using SpellBookPtr = std::shared_ptr<SpellBook>;
 
-//! @file nifmodel.h NifModel, NifModelEval, ChangeValueCommand, ToggleCheckBoxListCommand
+//! @file nifmodel.h NifModel, NifBlockCopy, NifModelEval, ChangeValueCommand, ToggleCheckBoxListCommand
+
+//! Blocks copied out of a NifModel, see NifModel::copyNiBlocks()
+class NifBlockCopy final
+{
+public:
+	NifBlockCopy() {}
+	~NifBlockCopy() { qDeleteAll( blocks ); }
+
+	//! The versions of the model the blocks were copied from
+	quint32 version = 0;
+	quint32 userVersion = 0;
+	quint32 userVersion2 = 0;
+
+	//! The copied block items
+	QVector<NifItem *> blocks;
+	//! The strings of the string items below the blocks in depth-first order, if the version indexes the header strings
+	QStringList strings;
+
+private:
+	Q_DISABLE_COPY( NifBlockCopy )
+};
+
+//! The XML structures of one parse of nif.xml, never changed once published
+struct NifSchema final
+{
+	QList<quint32> supportedVersions;
+	QHash<QString, NifBlockPtr> compounds;
+	QHash<QString, NifBlockPtr> fixedCompounds;
+	QHash<QString, NifBlockPtr> blocks;
+	//! SHA-1 of the nif.xml it was read from, the version and the NifValue types of the build, see NifModel::loadCached()
+	QByteArray hash;
+};
+
+//! A published NifSchema, released once no model or load holds it any longer
+using NifSchemaPtr = std::shared_ptr<const NifSchema>;
 
 //! The main data model for the NIF file.
 class NifModel final : public BaseModel
@@ -60,6 +95,8 @@ class NifModel final : public BaseModel
 	friend class NifXmlHandler;
 	friend class NifModelEval;
 	friend class NifOStream;
+	friend class NifSnapshot;
+	friend class ChangeValuesCommand;
 
 public:
 	NifModel( QObject * parent = 0 );
@@ -67,11 +104,22 @@ public:
 	//! Find and parse the XML file
 	static bool loadXML();
 
-	//! When creating NifModels from outside the main thread protect them with a QReadLocker
+	//! Serializes parsing the XML; loads on other threads do not need it, see currentSchema()
 	static QReadWriteLock XMLlock;
 
+	/*! The XML structures of the last parse
+	 *
+	 * Reading them does not wait for a parse: a parse fills a new schema and swaps
+	 * it in once it is complete. A replaced schema is released when the last holder
+	 * lets go of it; each model holds the schema it was cleared with until the next
+	 * clear(), so loads in flight keep reading it.
+	 */
+	static NifSchemaPtr currentSchema();
+
 	// QAbstractItemModel
 
+	QModelIndex index( int row, int column, const QModelIndex & parent = QModelIndex() ) const override final;
+	int rowCount( const QModelIndex & parent = QModelIndex() ) const override final;
 	QVariant data( const QModelIndex & index, int role = Qt::DisplayRole ) const override final;
 	bool setData( const QModelIndex & index, const QVariant & value, int role = Qt::EditRole ) override final;
 	bool removeRows( int row, int count, const QModelIndex & parent ) override final;
@@ -81,6 +129,21 @@ public:
 	// BaseModel
 	
 	void clear() override final;
+	//! Take over the file loaded into \a other, which is left empty
+	void takeContents( NifModel & other );
+	/*! Take over the blocks of \a other which differ from the blocks of this model
+	 *
+	 * For a file reloaded into \a other: the items of the header, the blocks
+	 * and the footer are compared by digest() and their links, and only the
+	 * rows which differ are replaced, each emitting dataChanged(), so that
+	 * views and the scene keep their state for the rest.
+	 *
+	 * @return False if the version, the block types or the header strings
+	 *         differ, leaving both models unchanged; use takeContents() then
+	 */
+	bool takeChangedBlocks( NifModel & other );
+	//! Copy the file loaded into \a other, which is unchanged, to save it on another thread
+	void copyContents( const NifModel & other );
 	bool load( QIODevice & device ) override final;
 	bool save( QIODevice & device ) const override final;
 
@@ -92,6 +155,13 @@ public:
 
 	template <typename T> T get( const QModelIndex & parent, const QString & name ) const;
 	template <typename T> bool set( const QModelIndex & parent, const QString & name, const T & v );
+	//! Get an item by a precomputed field name
+	template <typename T> T get( const QModelIndex & parent, const NifFieldId & name ) const;
+	//! Set an item by a precomputed field name
+	template <typename T> bool set( const QModelIndex & parent, const NifFieldId & name, const T & v );
+	//! Get the model index of a child by a precomputed field name
+	QModelIndex getIndex( const QModelIndex & parent, const NifFieldId & name ) const;
+	using BaseModel::getIndex;
 
 	// end BaseModel
 
@@ -116,6 +186,68 @@ public:
 	//! Loads the header from a filename
 	bool loadHeaderOnly( const QString & fname );
 
+	//! Restore the items of \a file from the document cache if it is enabled and the file is unchanged
+	bool loadCached( const QFileInfo & file ) override final;
+	//! Write the items just read from \a file to the document cache if it is enabled
+	void saveCached( const QFileInfo & file ) const override final;
+
+	//! Decode the blocks on a thread pool when the header stores their sizes (20.2.0.0 and above)
+	void setParallelLoading( bool enable ) { parallelLoading = enable; }
+	//! Only decode blocks on first access when the header stores their sizes (20.2.0.0 and above)
+	void setLazyLoading( bool enable ) { lazyLoading = enable; }
+	//! Keep the loaded block data and write unmodified blocks back verbatim (20.2.0.0 and above)
+	void setIncrementalSaving( bool enable ) { incrementalSaving = enable; }
+	//! Time loading and saving each block type, see blockProfile(); blocks are then loaded in order
+	void setProfiling( bool enable ) { profileBlocks = enable; }
+
+	//! Where the time of loading and saving went for one block type
+	struct BlockProfile
+	{
+		//! Blocks loaded
+		int count = 0;
+		//! Nanoseconds spent in loading and in saving the blocks
+		qint64 loadTime = 0;
+		qint64 saveTime = 0;
+		//! Bytes of the file the blocks were read from
+		qint64 bytes = 0;
+		//! NifItems allocated while loading the blocks
+		quint64 items = 0;
+	};
+
+	//! The profile per block type of the last load and the saves after it, empty unless profiling
+	const QHash<QString, BlockProfile> & blockProfile() const { return blockTimes; }
+	//! The profile as a table, the block types taking the longest to load first
+	QString blockProfileText() const;
+
+	//! The memory held by the document, see memoryUsage()
+	struct MemoryUsage
+	{
+		//! Items in the tree
+		int items = 0;
+		//! Bytes of the items and of their child and link arrays
+		qint64 itemBytes = 0;
+		//! Bytes of the strings, byte arrays and matrices of the values, beyond the items
+		qint64 valueBytes = 0;
+		//! Bytes of the file data kept for lazy loading and incremental saving
+		qint64 sourceBytes = 0;
+		//! Bytes of the display, offset and block tables
+		qint64 cacheBytes = 0;
+
+		qint64 total() const { return itemBytes + valueBytes + sourceBytes + cacheBytes; }
+	};
+
+	//! Measure the memory held by the document, walking every item
+	MemoryUsage memoryUsage() const;
+
+	/*! A 64-bit digest of the item and the items below it, see NifDiff
+	 *
+	 * Links are digested by the type and name of their target and string
+	 * indices by their string, so that moving blocks or reordering the header
+	 * strings keeps the digests. The items failing their conditions are left
+	 * out. Digests of the items with children are kept until they change.
+	 */
+	quint64 digest( const QModelIndex & index ) const;
+
 	//! Returns the the estimated file offset of the model index
 	int fileOffset( const QModelIndex & ) const;
 
@@ -136,6 +268,33 @@ public:
 	 */
 	bool earlyRejection( const QString & filepath, const QString & blockId, quint32 version );
 
+	//! Summary of a file header, see scanHeaders()
+	struct HeaderInfo
+	{
+		QString filepath;
+		//! Whether the header could be read
+		bool ok = false;
+		quint32 version = 0;
+		quint32 userVersion = 0;
+		quint32 userVersion2 = 0;
+		int numBlocks = 0;
+		//! Number of blocks of each type (10.0.1.0 and above)
+		QHash<QString, int> blockTypes;
+	};
+
+	/*! Reads the headers of several files concurrently
+	 *
+	 * Only the header of each file is read, as with loadHeaderOnly().
+	 *
+	 * @param files	The files to scan
+	 * @return		The header summary of each file, in the order of \a files
+	 */
+	static QVector<HeaderInfo> scanHeaders( const QStringList & files );
+	//! Reads the headers of the files in a directory concurrently, see scanHeaders()
+	static QVector<HeaderInfo> scanHeaders( const QString & directory,
+		const QStringList & extensions = { "*.nif", "*.nifcache", "*.texcache", "*.pcpatch", "*.kf", "*.kfa" },
+		bool recursive = true );
+
 	//! Returns the model index of the NiHeader
 	QModelIndex getHeader() const;
 	//! Updates the header infos ( num blocks etc. )
@@ -153,6 +312,8 @@ public:
 	QModelIndex insertNiBlock( const QString & identifier, int row = -1 );
 	//! Remove a block from the list
 	void removeNiBlock( int blocknum );
+	//! Remove several blocks from the list, remapping the links only once
+	void removeNiBlocks( const QList<int> & blocknums );
 	//! Move a block in the list
 	void moveNiBlock( int src, int dst );
 	//! Return the block name
@@ -204,6 +365,12 @@ public:
 	void reorderBlocks( const QVector<qint32> & order );
 	//! Moves all niblocks from this nif to another nif, returns a map which maps old block numbers to new block numbers
 	QMap<qint32, qint32> moveAllNiBlocks( NifModel * targetnif, bool update = true );
+	//! Copy blocks so that they can be pasted into models of the same version without reading them again
+	std::shared_ptr<NifBlockCopy> copyNiBlocks( const QList<qint32> & blocks );
+	//! Whether the blocks of \a copy have the version of this model
+	bool canPasteNiBlocks( const NifBlockCopy & copy ) const;
+	//! Append copies of the blocks of \a copy with their links mapped by \a map, returns the first of them
+	QModelIndex pasteNiBlocks( const NifBlockCopy & copy, const QMap<qint32, qint32> & map );
 	//! Convert a block from one type to another
 	void convertNiBlock( const QString & identifier, const QModelIndex & index );
 
@@ -278,7 +445,7 @@ public:
 	static QAbstractItemDelegate * createDelegate( QObject * parent, SpellBookPtr book );
 
 	//! Undo Stack for changes to NifModel
-	QUndoStack * undoStack;
+	QUndoStack * undoStack = nullptr;
 
 public slots:
 	void updateSettings();
@@ -292,6 +459,7 @@ protected:
 	// BaseModel
 
 	NifItem * getItem( NifItem * parent, const QString & name ) const override final;
+	NifItem * getItem( NifItem * parent, const NifFieldId & name ) const;
 
 	bool setItemValue( NifItem * item, const NifValue & v ) override final;
 
@@ -313,8 +481,42 @@ protected:
 
 	bool loadItem( NifItem * parent, NifIStream & stream );
 	bool loadHeader( NifItem * parent, NifIStream & stream );
+
+	//! Whether the blocks can be read using the offsets from the block table
+	bool canLoadFromBlockTable( QIODevice & device, int numblocks ) const;
+	//! Decode blocks on a thread pool, returns the number of blocks added to the model
+	int loadBlocksParallel( QIODevice & device, int numblocks );
+	//! Add blocks without decoding them, returns the number of blocks added to the model
+	int loadBlocksLazy( QIODevice & device, int numblocks );
+	//! Decode a block added by loadBlocksLazy() if it has not been accessed yet
+	void loadPendingBlock( NifItem * block ) const;
+	//! Decode a block added by loadBlocksLazy() without updating the links, false if it was decoded already
+	bool decodePendingBlock( NifItem * block ) const;
+	//! Whether a block or compound type has link fields in the version of the model
+	bool canHoldLinks( const QString & type ) const;
+	//! Decode all blocks added by loadBlocksLazy() which have not been accessed yet
+	void loadPendingBlocks() const;
+	//! Load an item which is not part of the model yet (thread-safe)
+	bool loadDetachedItem( NifItem * parent, NifIStream & stream );
+	//! Update the size of an array which is not part of the model yet (thread-safe)
+	bool updateDetachedArray( NifItem * array );
+	//! Whether an array only holds plain values which can be read with NifIStream::readFixedArray()
+	bool isFixedArray( NifItem * array, const NifIStream & stream ) const;
+	//! Whether the fields of every element of an array of compounds have the conditions of the first element
+	bool isRecordArray( NifItem * array ) const;
+	//! The rows of the fields present in \a element, false if one of them is not a plain value
+	bool recordLayout( NifItem * element, QVector<int> & rows ) const;
+	//! Load an array of compounds by the layout of its first element, see isRecordArray()
+	bool loadRecordArray( NifItem * array, NifIStream & stream, bool detached = false );
+	//! Save an array of compounds by the layout of its first element, see isRecordArray()
+	bool saveRecordArray( NifItem * array, NifOStream & stream ) const;
 	bool saveItem( NifItem * parent, NifOStream & stream ) const;
-	bool fileOffset( NifItem * parent, NifItem * target, NifSStream & stream, int & ofs ) const;
+	//! Record the offset of every item below \a parent starting at \a ofs, returns the offset past its end
+	int measureOffsets( NifItem * parent, NifSStream & stream, int ofs, QHash<const NifItem *, int> * offsets ) const;
+	//! The size of the type name and flags written before the block at root row \a row
+	int rowPrefixSize( int row ) const;
+	//! The file offset of root row \a row, extending the offset table as needed
+	int rowOffset( int row ) const;
 
 	NifItem * getHeaderItem() const;
 	NifItem * getFooterItem() const;
@@ -325,6 +527,8 @@ protected:
 
 	void insertAncestor( NifItem * parent, const QString & identifier, int row = -1 );
 	void insertType( NifItem * parent, const NifData & data, int row = -1 );
+	//! Insert the items of a type without changing the model state
+	void insertTypeItems( NifItem * parent, const NifData & data, int row = -1 );
 	NifItem * insertBranch( NifItem * parent, const NifData & data, int row = -1 );
 
 	bool updateByteArrayItem( NifItem * array );
@@ -333,21 +537,64 @@ protected:
 	void updateLinks( int block = -1 );
 	void updateLinks( int block, NifItem * parent );
 	void checkLinks( int block, QStack<int> & parents );
+	//! Restore the links dropped by checkLinks() which no longer close a cycle
+	void restoreLinks();
+	//! Whether block \a to can be reached from block \a from by child links
+	bool reachesLink( int from, int to ) const;
+	//! Recalculate the root blocks from the reverse link index
+	void updateRootLinks();
 	void adjustLinks( NifItem * parent, int block, int delta );
 	void mapLinks( NifItem * parent, const QMap<qint32, qint32> & map );
 
 	static void updateStrings( NifModel * src, NifModel * tgt, NifItem * item );
+	//! Append the strings below \a item as found by updateStrings()
+	void collectStrings( NifItem * item, QStringList & strings ) const;
+	//! Assign the strings collected by collectStrings() to the items below \a item, starting at \a next
+	void assignStrings( NifItem * item, const QStringList & strings, int & next );
 	bool assignString( NifItem * parent, const QString & string, bool replace = false );
 
 	//! NIF file version
 	quint32 version;
-
-	QHash<int, QList<int> > childLinks;
-	QHash<int, QList<int> > parentLinks;
+	//! Interned id of the header versions for the shared version condition cache, 0 while unknown
+	quint32 versionKey = 0;
+
+	//! Child links of each block, indexed by block number
+	QVector<QList<int> > childLinks;
+	//! Parent (upward) links of each block, indexed by block number
+	QVector<QList<int> > parentLinks;
+	//! Blocks with a child link to each block, in ascending order
+	QVector<QList<int> > linkedFrom;
+	//! Child links of each block which checkLinks() dropped for closing a cycle
+	QVector<QList<int> > droppedLinks;
 	QList<int> rootLinks;
 
 	bool lockUpdates;
 
+	//! Decode blocks in parallel during load
+	bool parallelLoading = false;
+	//! Defer decoding blocks until first access during load
+	bool lazyLoading = false;
+	//! Write unmodified blocks from their loaded data during save
+	bool incrementalSaving = false;
+	//! Time each block type during load and save
+	bool profileBlocks = false;
+	//! Filled while profiling, see blockProfile()
+	mutable QHash<QString, BlockProfile> blockTimes;
+
+	//! The raw data of a block which has not been decoded yet
+	struct PendingBlock
+	{
+		QByteArray data;
+		qint32 dataStreamUsage = -1;
+		qint32 dataStreamAccess = -1;
+	};
+
+	//! Blocks added by loadBlocksLazy() which have not been accessed yet
+	mutable QHash<NifItem *, PendingBlock> pendingBlocks;
+	//! The results of canHoldLinks() for linkTypesVersion
+	mutable QHash<QString, bool> linkTypes;
+	mutable quint32 linkTypesVersion = 0;
+
 	enum UpdateType
 	{
 		utNone   = 0,
@@ -360,14 +607,123 @@ protected:
 
 	void updateModel( UpdateType value = utAll );
 
+	//! Block types and sizes resolved once from the header
+	struct BlockTable
+	{
+		//! The type of each block, from "Block Types" and "Block Type Index"
+		QVector<QString> types;
+		//! The size of each block, from "Block Size" (20.2.0.0 and above) or measured by updateHeader()
+		QVector<quint32> sizes;
+		//! Whether each size still matches the contents of its block
+		QVector<bool> sizeValid;
+
+		//! The data of the blocks as loaded, kept for incremental saving
+		QByteArray source;
+		//! The offset of each block in source
+		QVector<qint64> sourceOffsets;
+		//! Whether each block is unmodified since it was loaded from source
+		QVector<bool> sourceValid;
+
+		//! Whether the size of block \a b is known and current
+		bool hasSize( int b ) const { return b >= 0 && b < sizeValid.count() && sizeValid.at( b ); }
+		//! Whether block \a b can be written from source
+		bool hasSource( int b ) const { return b >= 0 && b < sourceValid.count() && sourceValid.at( b ); }
+		//! Mark every block size as current
+		void validateSizes() { sizeValid.fill( true, sizes.count() ); }
+		//! Mark every block size and source as stale
+		void invalidateSizes()
+		{
+			sizeValid.fill( false, sizes.count() );
+			sourceValid.fill( false );
+		}
+
+		void clearSizes()
+		{
+			types.clear();
+			sizes.clear();
+			sizeValid.clear();
+		}
+
+		void clear()
+		{
+			clearSizes();
+			source.clear();
+			sourceOffsets.clear();
+			sourceValid.clear();
+		}
+	};
+
+	BlockTable blockTable;
+
+	//! The "Block Types" written by updateHeader(), so that the types of appended blocks are added without a rebuild
+	struct HeaderTypes
+	{
+		//! Row of each type in "Block Types"
+		QHash<QString, int> rows;
+		//! The blocks "Block Type Index" describes, -1 once blocks before their end were inserted, removed or retyped
+		int blocks = -1;
+	} headerTypes;
+
+	//! Mark the header block types as stale if \a index is a field they depend on
+	void invalidateHeaderTypes( const QModelIndex & index );
+
+	//! Resolve the block table from the header items
+	void updateBlockTable();
+	//! Mark the cached size of the block containing \a index as stale after it was modified
+	void invalidateBlockSize( const QModelIndex & index );
+	//! Intern the versions in the header as the key of the shared version condition cache
+	void updateVersionKey();
+
+	//! Formatted values of the value column, by item
+	mutable QHash<const NifItem *, QString> displayCache;
+	//! Format the value column of \a item for display
+	QString displayValue( const QModelIndex & index, NifItem * item ) const;
+	//! Drop the formatted values which depend on the modified items
+	void invalidateDisplay( const QModelIndex & topLeft, const QModelIndex & bottomRight );
+	//! Row of the first header string with each value, for 20.1.0.3 and above
+	mutable QHash<QString, int> stringTable;
+	//! The number of header strings stringTable holds, -1 while it is stale
+	mutable int stringTableCount = -1;
+	//! The row of \a string in the header strings, or -1
+	int stringNumber( const QString & string ) const;
+	//! Mark stringTable as stale after the header was modified
+	void invalidateStrings( const QModelIndex & index );
+	//! Digests of the items with children, see digest()
+	mutable QHash<const NifItem *, quint64> digestCache;
+	quint64 digest( NifItem * item ) const;
+	//! Drop the digests which depend on the modified item
+	void invalidateDigests( const QModelIndex & index );
+	//! File offset of each root row, only the first rowOffsetsValid entries are current
+	mutable QVector<int> rowOffsets;
+	mutable int rowOffsetsValid = 0;
+	//! Offsets of the items of one root row, relative to the end of its prefix
+	mutable QHash<const NifItem *, int> itemOffsets;
+	//! The root row itemOffsets was measured for
+	mutable const NifItem * itemOffsetsRow = nullptr;
+	//! Mark the offsets after the root row containing \a index as stale
+	void invalidateOffsets( const QModelIndex & index );
+	//! Mark every offset as stale
+	void clearOffsets();
+	//! Keep the cached block sizes in step with blocks being inserted or removed
+	void shiftBlockSizes( const QModelIndex & parent, int first, int last, bool inserted );
+	//! Mark the block containing \a item as modified after an edit which emits no signals
+	void invalidateBlockSource( NifItem * item );
+	//! Keep the data of the blocks starting at \a offset for incremental saving
+	void loadBlockSource( QIODevice & device, qint64 offset, int numblocks );
+
 	//! Parse the XML file using a NifXmlHandler
 	static QString parseXmlDescription( const QString & filename );
-
-	// XML structures
-	static QList<quint32> supportedVersions;
-	static QHash<QString, NifBlockPtr> compounds;
-	static QHash<QString, NifBlockPtr> fixedCompounds;
-	static QHash<QString, NifBlockPtr> blocks;
+	//! Load the XML structures from the cache if it was written for the XML with this \a hash
+	static bool loadXmlCache( NifSchema & xml, const QString & cachename, const QByteArray & hash );
+	//! Write the XML structures to the cache
+	static void saveXmlCache( const NifSchema & xml, const QString & cachename, const QByteArray & hash );
+	//! Index which fields of each compound and block the conditions of their siblings depend on
+	static void indexDependencies( NifSchema & xml );
+	//! Number the niobjects and record their ancestors so inherits() is a bit test
+	static void indexBlockTypes( NifSchema & xml );
+
+	//! The XML structures this model was last cleared with
+	NifSchemaPtr schema;
 
 private:
 	struct Settings
@@ -401,7 +757,27 @@ public:
 private:
 	NifModel * nif;
 	QVariant newValue, oldValue;
-	QModelIndex idx;
+	//! Rows leading to the item, see indexPath()
+	QVector<int> path;
+	int column;
+};
+
+
+//! Undoes and redoes the edits recorded while a spell was cast, including the rows it inserted or removed
+class ChangeValuesCommand : public QUndoCommand
+{
+public:
+	ChangeValuesCommand( const QVector<BaseModel::RecordedStep> & recorded, const QString & name, NifModel * model );
+	void redo() override;
+	void undo() override;
+private:
+	void restore( bool useOld );
+
+	NifModel * nif;
+	QVector<BaseModel::RecordedStep> steps;
+	//! Whether rows were inserted or removed, so the links have to be rebuilt
+	bool structural = false;
+	bool firstRedo = true;
 };
 
 
@@ -414,7 +790,9 @@ public:
 private:
 	NifModel * nif;
 	QVariant newValue, oldValue;
-	QModelIndex idx;
+	//! Rows leading to the item, see indexPath()
+	QVector<int> path;
+	int column;
 };
 
 
@@ -424,7 +802,8 @@ private:
 inline QStringList NifModel::allNiBlocks()
 {
 	QStringList lst;
-	for ( NifBlockPtr blk : blocks ) {
+	NifSchemaPtr xml = currentSchema();
+	for ( NifBlockPtr blk : xml->blocks ) {
 		if ( !blk->abstract )
 			lst.append( blk->id );
 	}
@@ -433,34 +812,34 @@ inline QStringList NifModel::allNiBlocks()
 
 inline bool NifModel::isAncestorOrNiBlock( const QString & name ) const
 {
-	return blocks.contains( name );
+	return schema->blocks.contains( name );
 }
 
 inline bool NifModel::isNiBlock( const QString & name )
 {
-	NifBlockPtr blk = blocks.value( name );
+	NifBlockPtr blk = currentSchema()->blocks.value( name );
 	return blk && !blk->abstract;
 }
 
 inline bool NifModel::isAncestor( const QString & name )
 {
-	NifBlockPtr blk = blocks.value( name );
+	NifBlockPtr blk = currentSchema()->blocks.value( name );
 	return blk && blk->abstract;
 }
 
 inline bool NifModel::isCompound( const QString & name )
 {
-	return compounds.contains( name );
+	return currentSchema()->compounds.contains( name );
 }
 
 inline bool NifModel::isFixedCompound( const QString & name )
 {
-	return fixedCompounds.contains( name );
+	return currentSchema()->fixedCompounds.contains( name );
 }
 
 inline bool NifModel::isVersionSupported( quint32 v )
 {
-	return supportedVersions.contains( v );
+	return currentSchema()->supportedVersions.contains( v );
 }
 
 inline QList<int> NifModel::getRootLinks() const
@@ -547,6 +926,17 @@ template <typename T> inline bool NifModel::set( NifItem * parent, const QString
 	return result;
 }
 
+template <typename T> inline T NifModel::get( const QModelIndex & parent, const NifFieldId & name ) const
+{
+	return get<T>( getIndex( parent, name ) );
+}
+
+template <typename T> inline bool NifModel::set( const QModelIndex & parent, const NifFieldId & name, const T & d )
+{
+	QModelIndex index = getIndex( parent, name );
+	return index.isValid() && set<T>( index, d );
+}
+
 template <> inline QString NifModel::get( const QModelIndex & index ) const
 {
 	return this->string( index );
@@ -151,47 +151,11 @@ public:
 		return blocks;
 	}
 
-	NifProxyItem * findItem( int b, bool scanParents = true )
-	{
-		if ( blockNumber == b )
-			return this;
-
-		for ( NifProxyItem * child : childItems ) {
-			if ( child->blockNumber == b )
-				return child;
-		}
-
-		for ( NifProxyItem * child : childItems ) {
-			if ( NifProxyItem * x = child->findItem( b, false ) )
-				return x;
-		}
-
-		if ( parentItem && scanParents ) {
-			NifProxyItem * root = parentItem;
-
-			while ( root && root->parentItem )
-				root = root->parentItem;
-
-			if ( NifProxyItem * x = root->findItem( b, false ) )
-				return x;
-		}
-
-		return nullptr;
-	}
-
-	void findAllItems( int b, QList<NifProxyItem *> & list )
-	{
-		for ( NifProxyItem * item : childItems ) {
-			item->findAllItems( b, list );
-		}
-
-		if ( blockNumber == b )
-			list.append( this );
-	}
-
 	int blockNumber;
 	NifProxyItem * parentItem;
 	QList<NifProxyItem *> childItems;
+	//! Whether the children follow the links of the block, rather than only showing a parent link
+	bool synced = false;
 };
 
 NifProxyModel::NifProxyModel( QObject * parent ) : QAbstractItemModel( parent )
@@ -240,10 +204,48 @@ void NifProxyModel::reset()
 	beginResetModel();
 	//qDebug() << "proxy reset";
 	root->killChildren();
+	blockItems.clear();
+	mirroredLinks.clear();
+	dirtyBlocks.clear();
 	updateRoot( true );
 	endResetModel();
 }
 
+NifProxyItem * NifProxyModel::addLink( NifProxyItem * parent, int link )
+{
+	NifProxyItem * child = parent->getLink( link );
+
+	if ( !child ) {
+		child = parent->addLink( link );
+		blockItems[link].append( child );
+	}
+
+	return child;
+}
+
+void NifProxyModel::delLink( NifProxyItem * parent, int link )
+{
+	NifProxyItem * child = parent->getLink( link );
+
+	if ( child ) {
+		forgetItem( child );
+		parent->delLink( link );
+	}
+}
+
+void NifProxyModel::forgetItem( NifProxyItem * item )
+{
+	for ( NifProxyItem * child : item->childItems )
+		forgetItem( child );
+
+	auto it = blockItems.find( item->block() );
+	if ( it != blockItems.end() ) {
+		it.value().removeOne( item );
+		if ( it.value().isEmpty() )
+			blockItems.erase( it );
+	}
+}
+
 void NifProxyModel::updateRoot( bool fast )
 {
 	if ( !( nif && nif->getBlockCount() > 0 ) ) {
@@ -252,6 +254,9 @@ void NifProxyModel::updateRoot( bool fast )
 				beginRemoveRows( QModelIndex(), 0, root->childCount() - 1 );
 
 			root->killChildren();
+			blockItems.clear();
+			mirroredLinks.clear();
+			dirtyBlocks.clear();
 
 			if ( !fast )
 				endRemoveRows();
@@ -262,59 +267,98 @@ void NifProxyModel::updateRoot( bool fast )
 
 	//qDebug() << "proxy update top level";
 
+	const QList<int> rootLinks = nif->getRootLinks();
+
 	// Make a copy to iterate over
 	auto items = root->childItems;
 	for ( NifProxyItem * item : items ) {
-		if ( !nif->getRootLinks().contains( item->block() ) ) {
+		if ( !rootLinks.contains( item->block() ) ) {
 			int at = root->rowLink( item->block() );
 
 			if ( !fast )
 				beginRemoveRows( QModelIndex(), at, at );
 
-			root->delLink( item->block() );
+			delLink( root, item->block() );
 
 			if ( !fast )
 				endRemoveRows();
 		}
 	}
 
-	for ( const auto l : nif->getRootLinks() ) {
+	for ( const auto l : rootLinks ) {
 		NifProxyItem * item = root->getLink( l );
 
 		if ( !item ) {
 			if ( !fast )
 				beginInsertRows( QModelIndex(), root->childCount(), root->childCount() );
 
-			item = root->addLink( l );
+			item = addLink( root, l );
 
 			if ( !fast )
 				endInsertRows();
 		}
 
-		updateItem( item, fast );
+		if ( !item->synced ) {
+			item->synced = true;
+			updateItem( item, fast );
+		}
+	}
+
+	// Only the items of blocks whose links changed since they were mirrored need updating
+	int n = nif->getBlockCount();
+	QList<int> changed;
+
+	for ( auto it = blockItems.constBegin(); it != blockItems.constEnd(); ++it ) {
+		int b = it.key();
+		Links links;
+
+		if ( b >= 0 && b < n )
+			links = Links( nif->getChildLinks( b ), nif->getParentLinks( b ) );
+
+		auto m = mirroredLinks.constFind( b );
+		if ( dirtyBlocks.contains( b ) || m == mirroredLinks.constEnd() || m.value() != links )
+			changed.append( b );
+	}
+
+	dirtyBlocks.clear();
+
+	for ( const auto b : changed ) {
+		// Updating one item may remove others, so look each of them up again
+		const auto blockCopy = blockItems.value( b );
+		for ( NifProxyItem * item : blockCopy ) {
+			if ( item->synced && blockItems.value( b ).contains( item ) )
+				updateItem( item, fast );
+		}
 	}
 }
 
 void NifProxyModel::updateItem( NifProxyItem * item, bool fast )
 {
-	QModelIndex index( createIndex( item->row(), 0, item ) );
+	QModelIndex index;
+	if ( !fast )
+		index = createIndex( item->row(), 0, item );
 
 	QList<int> parents( item->parentBlocks() );
 
+	const QList<int> childLinks = nif->getChildLinks( item->block() );
+	const QList<int> parentLinks = nif->getParentLinks( item->block() );
+
+	mirroredLinks.insert( item->block(), Links( childLinks, parentLinks ) );
+
 	for ( const auto l : item->childBlocks() ) {
-		if ( !( nif->getChildLinks( item->block() ).contains( l ) || nif->getParentLinks( item->block() ).contains( l ) ) ) {
+		if ( !( childLinks.contains( l ) || parentLinks.contains( l ) ) ) {
 			int at = item->rowLink( l );
 
 			if ( !fast )
 				beginRemoveRows( index, at, at );
 
-			item->delLink( l );
+			delLink( item, l );
 
 			if ( !fast )
 				endRemoveRows();
 		}
 	}
-	for ( const auto l : nif->getChildLinks( item->block() ) ) {
+	for ( const auto l : childLinks ) {
 		NifProxyItem * child = item->getLink( l );
 
 		if ( !child ) {
@@ -323,13 +367,18 @@ void NifProxyModel::updateItem( NifProxyItem * item, bool fast )
 			if ( !fast )
 				beginInsertRows( index, at, at );
 
-			child = item->addLink( l );
+			child = addLink( item, l );
 
 			if ( !fast )
 				endInsertRows();
 		}
 
+		// Existing children are kept up to date through the items of their own block
+		if ( child->synced )
+			continue;
+
 		if ( !parents.contains( child->block() ) ) {
+			child->synced = true;
 			updateItem( child, fast );
 		} else {
 			Message::append( tr( "Warnings were generated while reading NIF file." ),
@@ -337,14 +386,14 @@ void NifProxyModel::updateItem( NifProxyItem * item, bool fast )
 			);
 		}
 	}
-	for ( const auto l : nif->getParentLinks( item->block() ) ) {
+	for ( const auto l : parentLinks ) {
 		if ( !item->getLink( l ) ) {
 			int at = item->childCount();
 
 			if ( !fast )
 				beginInsertRows( index, at, at );
 
-			item->addLink( l );
+			addLink( item, l );
 
 			if ( !fast )
 				endInsertRows();
@@ -442,12 +491,29 @@ QModelIndex NifProxyModel::mapFrom( const QModelIndex & idx, const QModelIndex &
 			qDebug() << tr( "NifProxyModel::mapFrom() called with wrong ref model" );
 	}
 
-	item = item->findItem( blockNumber );
+	const QList<NifProxyItem *> items = blockItems.value( blockNumber );
+
+	if ( items.isEmpty() )
+		return QModelIndex();
 
-	if ( item )
-		return createIndex( item->row(), 0, item );
+	// Prefer the reference item itself or an item below it
+	NifProxyItem * found = nullptr;
+	for ( NifProxyItem * candidate : items ) {
+		NifProxyItem * p = candidate;
 
-	return QModelIndex();
+		while ( p && p != item )
+			p = p->parent();
+
+		if ( p ) {
+			found = candidate;
+			break;
+		}
+	}
+
+	if ( !found )
+		found = items.first();
+
+	return createIndex( found->row(), 0, found );
 }
 
 QList<QModelIndex> NifProxyModel::mapFrom( const QModelIndex & idx ) const
@@ -470,8 +536,7 @@ QList<QModelIndex> NifProxyModel::mapFrom( const QModelIndex & idx ) const
 	if ( blockNumber < 0 )
 		return indices;
 
-	QList<NifProxyItem *> items;
-	root->findAllItems( blockNumber, items );
+	const QList<NifProxyItem *> items = blockItems.value( blockNumber );
 	for ( NifProxyItem * item : items ) {
 		indices.append( createIndex( item->row(), idx.column() != NifModel::NameCol ? 1 : 0, item ) );
 	}
@@ -570,11 +635,13 @@ void NifProxyModel::xRowsAboutToBeRemoved( const QModelIndex & parent, int first
 	if ( !parent.isValid() ) {
 		// block removed
 		for ( int c = first; c <= last; c++ ) {
-			QList<NifProxyItem *> list;
-			root->findAllItems( c - 1, list );
-			for ( NifProxyItem * item : list ) {
+			// Items below removed items leave the index with them, so look each of them up again
+			while ( blockItems.contains( c - 1 ) ) {
+				NifProxyItem * item = blockItems.value( c - 1 ).first();
 				QModelIndex idx = createIndex( item->row(), 0, item );
 				beginRemoveRows( idx.parent(), idx.row(), idx.row() );
+				dirtyBlocks.insert( item->parentItem->block() );
+				forgetItem( item );
 				item->parentItem->childItems.removeAll( item );
 				delete item;
 				endRemoveRows();
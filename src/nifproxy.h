@@ -34,8 +34,11 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define NIFPROXYMODEL_H
 
 #include <QAbstractItemModel> // Inherited
+#include <QHash>
 #include <QList>
 #include <QModelIndex>
+#include <QPair>
+#include <QSet>
 #include <QVariant>
 
 
@@ -88,9 +91,26 @@ protected:
 	void updateRoot( bool fast );
 	void updateItem( NifProxyItem * item, bool fast );
 
+	//! Add a proxy item for \a link below \a parent, or return the existing one
+	NifProxyItem * addLink( NifProxyItem * parent, int link );
+	//! Remove the proxy item for \a link below \a parent
+	void delLink( NifProxyItem * parent, int link );
+	//! Remove \a item and the items below it from the block index
+	void forgetItem( NifProxyItem * item );
+
 	NifModel * nif;
 
 	NifProxyItem * root;
+
+	//! The child and parent links of a block
+	typedef QPair<QList<int>, QList<int> > Links;
+
+	//! Proxy items of each block number
+	QHash<int, QList<NifProxyItem *> > blockItems;
+	//! Links of each block when its proxy items were last updated
+	QHash<int, Links> mirroredLinks;
+	//! Blocks whose proxy items lost children outside of an update
+	QSet<int> dirtyBlocks;
 };
 
 #endif
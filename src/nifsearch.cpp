@@ -0,0 +1,156 @@
+/***** BEGIN LICENSE BLOCK *****
+
+BSD License
+
+Copyright (c) 2005-2015, NIF File Format Library and Tools
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the NIF File Format Library and Tools project may not be
+   used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+***** END LICENCE BLOCK *****/
+
+#include "nifsearch.h"
+
+#include "functionrunnable.h"
+#include "nifmodel.h"
+#include "nifsnapshot.h"
+
+
+//! @file nifsearch.cpp NifSearch
+
+//! Number of matches collected before they are sent to the UI thread
+#define SEARCH_BATCH_SIZE 256
+
+NifSearch::NifSearch( QObject * parent ) : QObject( parent )
+{
+	qRegisterMetaType<QList<int>>( "QList<int>" );
+
+	pool.setMaxThreadCount( 1 );
+}
+
+NifSearch::~NifSearch()
+{
+	cancel();
+	pool.waitForDone();
+}
+
+void NifSearch::setModel( NifModel * model )
+{
+	if ( nif )
+		disconnect( nif, nullptr, this, nullptr );
+
+	cancel();
+	snapshot.reset();
+
+	nif = model;
+
+	if ( nif ) {
+		// Any change to the model makes the snapshot stale
+		auto invalidate = [this]() { snapshot.reset(); };
+
+		connect( nif, &NifModel::dataChanged, this, invalidate );
+		connect( nif, &NifModel::rowsInserted, this, invalidate );
+		connect( nif, &NifModel::rowsRemoved, this, invalidate );
+		connect( nif, &NifModel::modelReset, this, invalidate );
+		connect( nif, &NifModel::linksChanged, this, invalidate );
+	}
+}
+
+void NifSearch::cancel()
+{
+	current++;
+}
+
+void NifSearch::search( const QString & text )
+{
+	int search = ++current;
+
+	if ( !nif || text.isEmpty() ) {
+		emit finished();
+		return;
+	}
+
+	if ( !snapshot )
+		snapshot = std::make_shared<const NifSnapshot>( nif );
+
+	std::shared_ptr<const NifSnapshot> items = snapshot;
+
+	// The text of the blocks is read from the snapshot on the worker thread
+	pool.start( new FunctionRunnable( [this, search, items, text]() {
+		QList<int> blocks;
+
+		for ( int b = 0; b < items->getBlockCount(); b++ ) {
+			if ( current != search )
+				return;
+
+			int block = items->block( b );
+			if ( items->name( block ).contains( text, Qt::CaseInsensitive ) || containsText( *items, block, text ) )
+				blocks.append( b );
+
+			if ( blocks.count() >= SEARCH_BATCH_SIZE ) {
+				QMetaObject::invokeMethod( this, "deliver", Qt::QueuedConnection,
+					Q_ARG( int, search ), Q_ARG( QList<int>, blocks ), Q_ARG( bool, false ) );
+				blocks.clear();
+			}
+		}
+
+		QMetaObject::invokeMethod( this, "deliver", Qt::QueuedConnection,
+			Q_ARG( int, search ), Q_ARG( QList<int>, blocks ), Q_ARG( bool, true ) );
+	} ) );
+}
+
+void NifSearch::deliver( int search, const QList<int> & blocks, bool done )
+{
+	// Results of canceled searches may still be queued
+	if ( search != current )
+		return;
+
+	if ( !blocks.isEmpty() )
+		emit matched( blocks );
+
+	if ( done )
+		emit finished();
+}
+
+bool NifSearch::containsText( const NifSnapshot & items, int parent, const QString & text )
+{
+	for ( int r = 0; r < items.rowCount( parent ); r++ ) {
+		int child = items.child( parent, r );
+
+		if ( items.rowCount( child ) > 0 ) {
+			if ( containsText( items, child, text ) )
+				return true;
+			continue;
+		}
+
+		// Only text values are searched, numbers would match almost every block
+		const NifValue & value = items.value( child );
+		if ( value.isString() || value.type() == NifValue::tFilePath || value.type() == NifValue::tStringIndex ) {
+			if ( items.string( child ).contains( text, Qt::CaseInsensitive ) )
+				return true;
+		}
+	}
+
+	return false;
+}
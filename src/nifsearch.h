@@ -0,0 +1,95 @@
+/***** BEGIN LICENSE BLOCK *****
+
+BSD License
+
+Copyright (c) 2005-2015, NIF File Format Library and Tools
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the NIF File Format Library and Tools project may not be
+   used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+***** END LICENCE BLOCK *****/
+
+#ifndef NIFSEARCH_H
+#define NIFSEARCH_H
+
+#include <QObject> // Inherited
+#include <QList>
+#include <QThreadPool>
+
+#include <atomic>
+#include <memory>
+
+
+class NifModel;
+class NifSnapshot;
+
+//! @file nifsearch.h NifSearch
+
+/*! Searches the blocks of a NifModel on a background thread
+ *
+ * A NifSnapshot of the model is taken on the first search after it changed, so edits made
+ * while a search runs do not race with it. The text of the blocks is read from it by the search.
+ */
+class NifSearch final : public QObject
+{
+	Q_OBJECT
+
+public:
+	NifSearch( QObject * parent = nullptr );
+	~NifSearch();
+
+	//! Set the model to search
+	void setModel( NifModel * model );
+
+	//! Start searching for \a text, canceling any running search
+	void search( const QString & text );
+	//! Cancel the running search
+	void cancel();
+
+signals:
+	//! Blocks matching the current search; emitted several times while the search runs
+	void matched( const QList<int> & blocks );
+	//! The current search has finished
+	void finished();
+
+protected slots:
+	//! Forward the matches of a search if it is still current
+	void deliver( int search, const QList<int> & blocks, bool done );
+
+protected:
+	//! Whether a text value below \a parent contains \a text, on the worker thread
+	static bool containsText( const NifSnapshot & items, int parent, const QString & text );
+
+	NifModel * nif = nullptr;
+
+	//! The items of the model, shared with the running search
+	std::shared_ptr<const NifSnapshot> snapshot;
+	//! Number of the current search, earlier searches stop when it changes
+	std::atomic<int> current{ 0 };
+
+	//! Runs the searches one at a time
+	QThreadPool pool;
+};
+
+#endif
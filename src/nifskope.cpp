@@ -33,16 +33,26 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "nifskope.h"
 #include "version.h"
 #include "settings.h"
+#include "settingssnapshot.h"
 
 #include "ui_nifskope.h"
 #include "ui/about_dialog.h"
 
+#include "assetscanner.h"
+#include "convertbatch.h"
+#include "functionrunnable.h"
 #include "glview.h"
 #include "gl/glscene.h"
 #include "kfmmodel.h"
+#include "loadbenchmark.h"
+#include "nifdiff.h"
 #include "nifmodel.h"
 #include "nifproxy.h"
+#include "nifsearch.h"
+#include "skeletoncompare.h"
+#include "spellbatch.h"
 #include "spellbook.h"
+#include "trace.h"
 #include "widgets/fileselect.h"
 #include "widgets/nifview.h"
 #include "widgets/refrbrowser.h"
@@ -60,11 +70,13 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QDir>
 #include <QFile>
 #include <QFileInfo>
+#include <QFileSystemWatcher>
 #include <QLocale>
 #include <QLocalSocket>
 #include <QMessageBox>
 #include <QProgressBar>
 #include <QSettings>
+#include <QTextStream>
 #include <QTimer>
 #include <QToolBar>
 #include <QToolButton>
@@ -78,6 +90,7 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QStandardItemModel>
 
 #include <fsengine/bsa.h>
+#include <fsengine/bsawriter.h>
 #include <fsengine/fsmanager.h>
 
 #ifdef WIN32
@@ -157,6 +170,7 @@ NifSkope::NifSkope()
 
 	// Migrate settings from older versions of NifSkope
 	migrateSettings();
+	SettingsSnapshot::rebuild();
 
 	// Update Settings struct from registry
 	updateSettings();
@@ -179,11 +193,23 @@ NifSkope::NifSkope()
 	indexStack = new QUndoStack( this );
 
 	// Setup Window Modified on data change
-	connect( nif, &NifModel::dataChanged, [this]( const QModelIndex &, const QModelIndex & ) {
+	auto edited = [this]() {
 		// Only if UI is enabled (prevents asterisk from flashing during save/load)
-		if ( !windowTitle().isEmpty() && isEnabled() )
+		if ( !windowTitle().isEmpty() && isEnabled() ) {
 			setWindowModified( true );
-	} );
+
+			// Edits while the file is written in the background are not in it
+			if ( saver )
+				saveEdited = true;
+		}
+	};
+
+	// Blocks and rows which are added, removed or moved are edits too
+	connect( nif, &NifModel::dataChanged, this, edited );
+	connect( nif, &NifModel::rowsInserted, this, edited );
+	connect( nif, &NifModel::rowsRemoved, this, edited );
+	connect( nif, &NifModel::layoutChanged, this, edited );
+	connect( nif, &NifModel::modelReset, this, edited );
 
 	kfm = new KfmModel( this );
 	kfmEmpty = new KfmModel( this );
@@ -200,6 +226,16 @@ NifSkope::NifSkope()
 	list->setItemDelegate( nif->createDelegate( this, book ) );
 	list->installEventFilter( this );
 
+	// Block List Filter
+	search = new NifSearch( this );
+	search->setModel( nif );
+	connect( search, &NifSearch::matched, this, &NifSkope::showListMatches );
+
+	auto filterTimer = new QTimer( this );
+	filterTimer->setSingleShot( true );
+	connect( ui->listFilter, &QLineEdit::textChanged, [filterTimer]() { filterTimer->start( 300 ); } );
+	connect( filterTimer, &QTimer::timeout, this, &NifSkope::filterList );
+
 	// Block Details
 	tree = ui->tree;
 	tree->setModel( nif );
@@ -303,6 +339,17 @@ NifSkope::NifSkope()
 	resizeTimer->setSingleShot( true );
 	connect( resizeTimer, &QTimer::timeout, this, &NifSkope::resizeDone );
 
+	// Reload on Change, an exporter may write the file in several steps
+	reloadTimer = new QTimer( this );
+	reloadTimer->setSingleShot( true );
+	reloadTimer->setInterval( 250 );
+	connect( reloadTimer, &QTimer::timeout, this, &NifSkope::reloadChanged );
+
+	fileWatcher = new QFileSystemWatcher( this );
+	connect( fileWatcher, &QFileSystemWatcher::fileChanged, this, [this]() {
+		reloadTimer->start();
+	} );
+
 	// Set Actions
 	initActions();
 
@@ -338,6 +385,11 @@ void NifSkope::exitRequested()
 
 NifSkope::~NifSkope()
 {
+	// The loader may still be reading the file
+	loadPool.waitForDone();
+	delete loader;
+	delete saver;
+
 	delete ui;
 }
 
@@ -545,6 +597,51 @@ void NifSkope::setListMode()
 			head->resizeSection( 1, s1 );
 		}
 	}
+
+	filterList();
+}
+
+void NifSkope::filterList()
+{
+	QAbstractItemModel * model = list->model();
+	if ( model != nif && model != proxy )
+		return;
+
+	QString text = ui->listFilter->text();
+
+	// Everything is hidden until the search reports the matching blocks
+	listRoots.clear();
+	for ( int r = 0; r < model->rowCount(); r++ ) {
+		if ( model == proxy )
+			listRoots.insert( nif->getBlockNumber( proxy->mapTo( proxy->index( r, 0, QModelIndex() ) ) ), r );
+
+		list->setRowHidden( r, QModelIndex(), !text.isEmpty() );
+	}
+
+	search->search( text );
+}
+
+void NifSkope::showListMatches( const QList<int> & blocks )
+{
+	for ( const auto b : blocks ) {
+		if ( list->model() == nif ) {
+			list->setRowHidden( b + 1, QModelIndex(), false );
+		} else if ( list->model() == proxy ) {
+			// Show the top level branch containing the block
+			int r = b;
+			for ( int i = 0; i < nif->getBlockCount(); i++ ) {
+				int p = nif->getParent( r );
+				if ( p < 0 )
+					break;
+
+				r = p;
+			}
+
+			auto it = listRoots.constFind( r );
+			if ( it != listRoots.constEnd() )
+				list->setRowHidden( it.value(), QModelIndex(), false );
+		}
+	}
 }
 
 // 'Recent Files' Helpers
@@ -782,13 +879,8 @@ void NifSkope::openArchive( const QString & archive )
 
 		setCurrentArchive( bsa );
 
-		// Models
-		bsaModel->init();
-
 		// Populate model from BSA
-		bsa->fillModel( bsaModel, "meshes" );
-
-		if ( bsaModel->rowCount() == 0 ) {
+		if ( !bsa->fillModel( bsaModel, "meshes" ) || bsaModel->rowCount() == 0 ) {
 			qCWarning( nsIo ) << "The BSA does not contain any meshes.";
 			clearCurrentArchive();
 			return;
@@ -958,8 +1050,23 @@ void NifSkope::reload()
 	QTimer::singleShot( 0, this, SLOT( load() ) );
 }
 
+//! Reads a file into a detached model on \a pool, then invokes a slot of the window with the result
+static void startLoading( QThreadPool & pool, NifSkope * owner, NifModel * model, const QString & file, const char * finished )
+{
+	pool.start( new FunctionRunnable( [owner, model, file, finished]() {
+		bool loaded = model->loadFromFile( file );
+
+		QMetaObject::invokeMethod( owner, finished, Qt::QueuedConnection,
+			Q_ARG( bool, loaded ), Q_ARG( QString, file ) );
+	} ) );
+}
+
 void NifSkope::load()
 {
+	// A file is already being read
+	if ( loader )
+		return;
+
 	emit beginLoading();
 
 	QFileInfo f( QDir::fromNativeSeparators( currentFile ) );
@@ -970,14 +1077,25 @@ void NifSkope::load()
 	// TODO: This is rather poor in terms of file validation
 
 	if ( f.suffix().compare( "kfm", Qt::CaseInsensitive ) == 0 ) {
-		emit completeLoading( kfm->loadFromFile( fname ), fname );
+		bool loaded = kfm->loadFromFile( fname );
+		emit completeLoading( loaded, fname );
+
+		// Later lookups of the sequences of this file do not load it again
+		std::shared_ptr<const KfmIndex> sequences = kfm->sequenceIndex();
+		if ( loaded )
+			KfmModel::cacheSequenceIndex( fname, sequences );
 
-		f.setFile( kfm->getFolder(), kfm->get<QString>( kfm->getKFMroot(), "NIF File Name" ) );
+		f.setFile( kfm->getFolder(), sequences->nif );
 	}
 
-	bool loaded = nif->loadFromFile( fname );
+	// Parse into a detached model so the window keeps painting and reporting progress
+	loader = new NifModel;
+	connect( loader, &NifModel::sigProgress, this, [this]( int c, int m ) {
+		progress->setRange( 0, m );
+		progress->setValue( c );
+	} );
 
-	emit completeLoading( loaded, fname );
+	startLoading( loadPool, this, loader, fname, "loadFinished" );
 
 	//if ( loaded ) {
 	//	filehash = fileChecksum( fname, QCryptographicHash::Md5 );
@@ -986,6 +1104,115 @@ void NifSkope::load()
 	//}
 }
 
+void NifSkope::loadFinished( bool loaded, const QString & fname )
+{
+	if ( !loader )
+		return;
+
+	if ( loaded )
+		nif->takeContents( *loader );
+
+	// The loader collects its warnings, show them from the GUI thread
+	for ( const TestMessage & m : loader->getMessages() ) {
+		Message::append( tr( "Warnings were generated while reading NIF file." ), m,
+			m.type() == QtCriticalMsg ? QMessageBox::Critical : QMessageBox::Warning );
+	}
+
+	delete loader;
+	loader = nullptr;
+
+	QString file = fname;
+	emit completeLoading( loaded, file );
+}
+
+void NifSkope::watchFile()
+{
+	if ( !fileWatcher->files().isEmpty() )
+		fileWatcher->removePaths( fileWatcher->files() );
+
+	watchedFile.clear();
+
+	// Files of archives have relative paths, and KFMs are loaded with their NIF
+	QFileInfo f( nif->getFileInfo() );
+	if ( !aAutoReload->isChecked() || !QFileInfo( currentFile ).isAbsolute()
+	     || currentFile.endsWith( ".kfm", Qt::CaseInsensitive ) || !f.exists() )
+		return;
+
+	watchedFile = f.absoluteFilePath();
+	watchedModified = f.lastModified();
+	fileWatcher->addPath( watchedFile );
+}
+
+void NifSkope::reloadChanged()
+{
+	if ( watchedFile.isEmpty() || loader )
+		return;
+
+	QFileInfo f( watchedFile );
+	if ( !f.exists() )
+		return;
+
+	// Replacing the file drops it from the watcher
+	if ( !fileWatcher->files().contains( watchedFile ) )
+		fileWatcher->addPath( watchedFile );
+
+	// Written by save(), or touched without a change
+	if ( saver || f.lastModified() == watchedModified )
+		return;
+
+	// Unsaved edits are not replaced
+	if ( isWindowModified() || !nif->undoStack->isClean() )
+		return;
+
+	watchedModified = f.lastModified();
+
+	loader = new NifModel;
+	startLoading( loadPool, this, loader, watchedFile, "reloadFinished" );
+}
+
+void NifSkope::reloadFinished( bool loaded, const QString & fname )
+{
+	if ( !loader )
+		return;
+
+	// A file read while it was being written fails, writing the rest notifies again
+	if ( !loaded || fname != watchedFile || isWindowModified() || !nif->undoStack->isClean() ) {
+		delete loader;
+		loader = nullptr;
+		return;
+	}
+
+	// The items of the replaced blocks are deleted, the root rows are kept
+	QPersistentModelIndex selected = currentIdx;
+	QPersistentModelIndex selectedRow = currentIdx;
+	while ( selectedRow.parent().isValid() )
+		selectedRow = selectedRow.parent();
+
+	if ( !nif->takeChangedBlocks( *loader ) ) {
+		// The blocks or their strings were added, removed or reordered, load the file as a whole
+		emit beginLoading();
+		loadFinished( true, fname );
+		return;
+	}
+
+	// Replacing the rows of the blocks is no edit, the window was not modified before
+	setWindowModified( false );
+
+	for ( const TestMessage & m : loader->getMessages() ) {
+		Message::append( tr( "Warnings were generated while reading NIF file." ), m,
+			m.type() == QtCriticalMsg ? QMessageBox::Critical : QMessageBox::Warning );
+	}
+
+	delete loader;
+	loader = nullptr;
+
+	// Commands and selections refer to the items which were replaced
+	nif->undoStack->clear();
+	indexStack->clear();
+
+	select( selected.isValid() ? QModelIndex( selected ) : QModelIndex( selectedRow ) );
+}
+
 void NifSkope::save()
 {
 	// Assure file path is absolute
@@ -996,6 +1223,12 @@ void NifSkope::save()
 		return;
 	}
 
+	// The file is still being written, see saveFinished()
+	if ( saver )
+		return;
+
+	saveEdited = false;
+
 	emit beginSave();
 
 	QString fname = currentFile;
@@ -1011,10 +1244,55 @@ void NifSkope::save()
 				select( idx );
 		}
 
-		emit completeSave( nif->saveToFile( fname ), fname );
+		// Updated while the window is disabled, so that the window is not marked as modified
+		nif->updateHeader();
+		nif->updateFooter();
+
+		// Serialize a copy in the background, so that the NIF can be edited meanwhile
+		saver = new NifModel;
+		saver->copyContents( *nif );
+		connect( saver, &NifModel::sigProgress, this, [this]( int c, int m ) {
+			progress->setRange( 0, m );
+			progress->setValue( c );
+		} );
+
+		setEnabled( true );
+
+		progress->setVisible( true );
+		progress->reset();
+
+		// Invokes saveFinished() with the result once the copy is written
+		NifModel * model = saver;
+		loadPool.start( new FunctionRunnable( [this, model, fname]() {
+			bool saved = model->saveToFile( fname );
+
+			QMetaObject::invokeMethod( this, "saveFinished", Qt::QueuedConnection,
+				Q_ARG( bool, saved ), Q_ARG( QString, fname ) );
+		} ) );
 	}
 }
 
+void NifSkope::saveFinished( bool saved, const QString & fname )
+{
+	if ( !saver )
+		return;
+
+	delete saver;
+	saver = nullptr;
+
+	QTimer::singleShot( saved ? 2500 : 0, progress, SLOT( hide() ) );
+
+	if ( !saved )
+		Message::critical( this, tr( "Failed to save %1" ).arg( fname ) );
+
+	// Another file was opened while this one was written
+	if ( fname != currentFile )
+		return;
+
+	QString file = fname;
+	emit completeSave( saved, file );
+}
+
 
 //! Opens website links using the QAction's tooltip text
 void NifSkope::openURL()
@@ -1324,6 +1602,9 @@ int main( int argc, char * argv[] )
 		QCommandLineOption portOption( {"p", "port"}, "Port NifSkope listens on", "port" );
 		parser.addOption( portOption );
 
+		QCommandLineOption traceOption( "trace", "Record a Chrome / Perfetto trace of the run into a JSON file", "file" );
+		parser.addOption( traceOption );
+
 		// Process options
 		parser.process( *a );
 
@@ -1331,6 +1612,9 @@ int main( int argc, char * argv[] )
 		if ( parser.isSet( portOption ) )
 			port = parser.value( portOption ).toInt();
 
+		// Saved as the application exits
+		Trace::Recording trace( parser.value( traceOption ) );
+
 		// Files were passed to NifSkope
 		for ( const QString & arg : parser.positionalArguments() ) {
 			QString fname = QDir::current().filePath( arg );
@@ -1362,7 +1646,307 @@ int main( int argc, char * argv[] )
 			return 0;
 		}
 	} else {
-		// Future command line batch tools here
+		// Batch tools without the GUI
+		app->setOrganizationName( "NifTools" );
+		app->setOrganizationDomain( "niftools.org" );
+		app->setApplicationName( "NifSkope " + NifSkopeVersion::rawToMajMin( NIFSKOPE_VERSION ) );
+		app->setApplicationVersion( NIFSKOPE_VERSION );
+
+		qRegisterMetaType<NifValue>( "NifValue" );
+		QMetaType::registerComparators<NifValue>();
+
+		QCommandLineParser parser;
+		parser.setSingleDashWordOptionMode( QCommandLineParser::ParseAsLongOptions );
+		parser.addHelpOption();
+		parser.addVersionOption();
+		parser.addPositionalArgument( "input", "Folders or archives to process, or folders and files to convert", "[input...]" );
+
+		QCommandLineOption noGuiOption( "no-gui", "Run without the GUI" );
+		parser.addOption( noGuiOption );
+
+		QCommandLineOption spellOption( {"s", "spell"},
+			QString( "Spell to cast on every file, as Page/Name, or %1 for the sanitizing spells. Repeat for a chain." )
+				.arg( SpellBatch::sanitizeName ),
+			"spell" );
+		parser.addOption( spellOption );
+
+		QCommandLineOption outputOption( {"o", "output"}, "Folder to write the files to, mirroring the input, instead of replacing them", "folder" );
+		parser.addOption( outputOption );
+
+		QCommandLineOption threadsOption( {"t", "threads"}, "Number of worker threads", "count" );
+		parser.addOption( threadsOption );
+
+		QCommandLineOption recursiveOption( {"r", "recursive"}, "Include the sub folders" );
+		parser.addOption( recursiveOption );
+
+		QCommandLineOption skeletonOption( {"k", "skeleton"},
+			"Instead of casting spells, compare the bones of every file with a reference skeleton NIF or skel.dat, printing a table",
+			"reference" );
+		parser.addOption( skeletonOption );
+
+		QCommandLineOption toleranceOption( "tolerance", "How far the bone transforms may be from the reference", "value" );
+		parser.addOption( toleranceOption );
+
+		QCommandLineOption exportOption( {"e", "export"},
+			QString( "Instead of casting spells, export every NIF to a format: %1" ).arg( ConvertBatch::exportFormats.join( ", " ) ),
+			"format" );
+		parser.addOption( exportOption );
+
+		QCommandLineOption importOption( {"i", "import"},
+			QString( "Instead of casting spells, import every file of a format into a NIF: %1" ).arg( ConvertBatch::importFormats.join( ", " ) ),
+			"format" );
+		parser.addOption( importOption );
+
+		QCommandLineOption templateOption( "template", "NIF the imported meshes are added to, giving the version of the new files", "nif" );
+		parser.addOption( templateOption );
+
+		QCommandLineOption benchmarkOption( {"b", "benchmark"},
+			"Instead of casting spells, time loading, saving and reading every file, printing a table per game version" );
+		parser.addOption( benchmarkOption );
+
+		QCommandLineOption repeatOption( "repeat", "How many times the benchmark loads and saves each file, keeping the fastest", "count" );
+		parser.addOption( repeatOption );
+
+		QCommandLineOption diffOption( {"d", "diff"},
+			"Instead of casting spells, compare two NIFs, printing the blocks and fields of the second which differ from the first" );
+		parser.addOption( diffOption );
+
+		QCommandLineOption assetsOption( {"a", "assets"},
+			"Instead of casting spells, list the textures and materials every file depends on and where they were found" );
+		parser.addOption( assetsOption );
+
+		QCommandLineOption missingOption( "missing", "List only the missing assets, one row per file referencing any" );
+		parser.addOption( missingOption );
+
+		QCommandLineOption dataOption( "data", "Data folder to search for loose textures and materials. Repeat for several.", "folder" );
+		parser.addOption( dataOption );
+
+		QCommandLineOption packOption( {"p", "pack"},
+			QString( "Instead of casting spells, pack the folders and archives after the first argument into the archive it names, of a format: %1" )
+				.arg( BSAWriter::formatNames().join( ", " ) ),
+			"format" );
+		parser.addOption( packOption );
+
+		QCommandLineOption storeOption( "store", "Store the packed files without compressing them" );
+		parser.addOption( storeOption );
+
+		QCommandLineOption traceOption( "trace", "Record a Chrome / Perfetto trace of the run into a JSON file", "file" );
+		parser.addOption( traceOption );
+
+		parser.process( *app );
+
+		bool converting = parser.isSet( exportOption ) || parser.isSet( importOption );
+
+		if ( !( parser.isSet( spellOption ) || parser.isSet( skeletonOption ) || parser.isSet( benchmarkOption )
+		        || parser.isSet( diffOption ) || parser.isSet( assetsOption )
+		        || parser.isSet( packOption ) || converting )
+		     || parser.positionalArguments().isEmpty() )
+			parser.showHelp( 1 );
+
+		// Saved as the tool returns
+		Trace::Recording trace( parser.value( traceOption ) );
+
+		NifModel::loadXML();
+
+		if ( parser.isSet( diffOption ) ) {
+			const QStringList files = parser.positionalArguments();
+			if ( files.count() != 2 )
+				parser.showHelp( 2 );
+
+			NifModel nifs[2];
+
+			for ( int n = 0; n < 2; n++ ) {
+				if ( !nifs[n].loadFromFile( QDir::current().absoluteFilePath( files.at( n ) ) ) ) {
+					fprintf( stderr, "Could not load %s\n", qPrintable( files.at( n ) ) );
+					return 2;
+				}
+			}
+
+			NifDiff diff;
+			diff.compare( &nifs[0], &nifs[1] );
+
+			QTextStream out( stdout );
+			diff.report( out );
+			out.flush();
+
+			// Like diff(1): 0 for equal files, 1 for differences and 2 for errors
+			return diff.changes().isEmpty() ? 0 : 1;
+		}
+
+		if ( parser.isSet( benchmarkOption ) ) {
+			LoadBenchmark benchmark;
+
+			if ( parser.isSet( repeatOption ) )
+				benchmark.setRepeat( parser.value( repeatOption ).toInt() );
+
+			for ( const QString & arg : parser.positionalArguments() ) {
+				if ( !benchmark.run( QDir::current().absoluteFilePath( arg ), parser.isSet( recursiveOption ) ) ) {
+					fprintf( stderr, "Could not open %s\n", qPrintable( arg ) );
+					return 1;
+				}
+			}
+
+			QTextStream out( stdout );
+			benchmark.report( out );
+			out.flush();
+
+			return ( benchmark.failed() > 0 ) ? 1 : 0;
+		}
+
+		if ( parser.isSet( packOption ) ) {
+			BSAWriter::Format format;
+			if ( !BSAWriter::formatByName( parser.value( packOption ), format ) ) {
+				fprintf( stderr, "Unknown format: %s\n", qPrintable( parser.value( packOption ) ) );
+				return 1;
+			}
+
+			QStringList args = parser.positionalArguments();
+			if ( args.count() < 2 )
+				parser.showHelp( 2 );
+
+			BSAWriter writer( format );
+			writer.setCompressed( !parser.isSet( storeOption ) );
+			if ( parser.isSet( threadsOption ) )
+				writer.setThreads( parser.value( threadsOption ).toInt() );
+
+			// The archives are read while the new one is written
+			QVector<std::shared_ptr<FSArchiveHandler>> inputs;
+
+			for ( const QString & arg : args.mid( 1 ) ) {
+				QString input = QDir::current().absoluteFilePath( arg );
+
+				if ( QFileInfo( input ).isDir() ) {
+					writer.addFolder( input );
+				} else if ( auto archive = FSArchiveHandler::openArchive( input ) ) {
+					writer.addArchive( archive->getArchive() );
+					inputs.append( archive );
+				} else {
+					fprintf( stderr, "Could not open %s\n", qPrintable( arg ) );
+					return 1;
+				}
+			}
+
+			if ( !writer.write( QDir::current().absoluteFilePath( args.first() ) ) ) {
+				fprintf( stderr, "Could not write %s: %s\n", qPrintable( args.first() ), qPrintable( writer.statusText() ) );
+				return 1;
+			}
+
+			fprintf( stderr, "%d files packed\n", writer.fileCount() );
+
+			return 0;
+		}
+
+		if ( parser.isSet( assetsOption ) ) {
+			AssetScanner scanner;
+
+			for ( const QString & folder : parser.values( dataOption ) )
+				scanner.addDataFolder( QDir::current().absoluteFilePath( folder ) );
+			if ( parser.isSet( threadsOption ) )
+				scanner.setThreads( parser.value( threadsOption ).toInt() );
+
+			for ( const QString & arg : parser.positionalArguments() ) {
+				if ( !scanner.run( QDir::current().absoluteFilePath( arg ), parser.isSet( recursiveOption ) ) ) {
+					fprintf( stderr, "Could not open %s\n", qPrintable( arg ) );
+					return 1;
+				}
+			}
+
+			QTextStream out( stdout );
+			if ( parser.isSet( missingOption ) )
+				scanner.reportMissing( out );
+			else
+				scanner.report( out );
+			out.flush();
+
+			fprintf( stderr, "%d files reference missing assets, %d failed\n", scanner.missing(), scanner.failed() );
+
+			return ( scanner.missing() > 0 || scanner.failed() > 0 ) ? 1 : 0;
+		}
+
+		if ( parser.isSet( skeletonOption ) ) {
+			SkeletonCompare compare;
+
+			if ( !compare.setReference( QDir::current().absoluteFilePath( parser.value( skeletonOption ) ) ) ) {
+				fprintf( stderr, "Could not read the bones of %s\n", qPrintable( parser.value( skeletonOption ) ) );
+				return 1;
+			}
+
+			if ( parser.isSet( toleranceOption ) )
+				compare.setTolerance( parser.value( toleranceOption ).toFloat() );
+			if ( parser.isSet( threadsOption ) )
+				compare.setThreads( parser.value( threadsOption ).toInt() );
+
+			for ( const QString & arg : parser.positionalArguments() ) {
+				if ( !compare.run( QDir::current().absoluteFilePath( arg ), parser.isSet( recursiveOption ) ) ) {
+					fprintf( stderr, "Could not open %s\n", qPrintable( arg ) );
+					return 1;
+				}
+			}
+
+			QTextStream out( stdout );
+			compare.report( out );
+			out.flush();
+
+			fprintf( stderr, "%d files differ from the reference, %d failed\n", compare.differing(), compare.failed() );
+
+			return ( compare.failed() > 0 ) ? 1 : 0;
+		}
+
+		if ( converting ) {
+			ConvertBatch convert;
+
+			bool known = parser.isSet( exportOption ) ? convert.setExport( parser.value( exportOption ) )
+			                                            : convert.setImport( parser.value( importOption ) );
+			if ( !known ) {
+				fprintf( stderr, "Unknown format: %s\n", qPrintable( parser.value( parser.isSet( exportOption ) ? exportOption : importOption ) ) );
+				return 1;
+			}
+
+			if ( parser.isSet( templateOption ) && !convert.setTemplate( QDir::current().absoluteFilePath( parser.value( templateOption ) ) ) ) {
+				fprintf( stderr, "Could not load %s\n", qPrintable( parser.value( templateOption ) ) );
+				return 1;
+			}
+
+			if ( parser.isSet( outputOption ) )
+				convert.setOutput( QDir::current().absoluteFilePath( parser.value( outputOption ) ) );
+			if ( parser.isSet( threadsOption ) )
+				convert.setThreads( parser.value( threadsOption ).toInt() );
+
+			for ( const QString & arg : parser.positionalArguments() ) {
+				if ( !convert.run( QDir::current().absoluteFilePath( arg ), parser.isSet( recursiveOption ) ) ) {
+					fprintf( stderr, "Could not open %s\n", qPrintable( arg ) );
+					return 1;
+				}
+			}
+
+			fprintf( stderr, "%d files converted, %d failed\n", convert.saved(), convert.failed() );
+
+			return ( convert.failed() > 0 ) ? 1 : 0;
+		}
+
+		SpellBatch batch;
+
+		QStringList errors = batch.setSpells( parser.values( spellOption ) );
+		if ( !errors.isEmpty() ) {
+			fprintf( stderr, "%s\n", qPrintable( errors.join( "\n" ) ) );
+			return 1;
+		}
+
+		if ( parser.isSet( outputOption ) )
+			batch.setOutput( QDir::current().absoluteFilePath( parser.value( outputOption ) ) );
+		if ( parser.isSet( threadsOption ) )
+			batch.setThreads( parser.value( threadsOption ).toInt() );
+
+		for ( const QString & arg : parser.positionalArguments() ) {
+			if ( !batch.run( QDir::current().absoluteFilePath( arg ), parser.isSet( recursiveOption ) ) ) {
+				fprintf( stderr, "Could not open %s, archives need an output folder\n", qPrintable( arg ) );
+				return 1;
+			}
+		}
+
+		fprintf( stderr, "%d files saved, %d failed\n", batch.saved(), batch.failed() );
+
+		return ( batch.failed() > 0 ) ? 1 : 0;
 	}
 
 	return 0;
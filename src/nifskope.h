@@ -37,8 +37,11 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <QMainWindow>     // Inherited
 #include <QObject>         // Inherited
+#include <QDateTime>
 #include <QFileInfo>
+#include <QHash>
 #include <QModelIndex>
+#include <QThreadPool>
 #include <QUndoCommand>
 
 #include <memory>
@@ -60,6 +63,7 @@ class InspectView;
 class KfmModel;
 class NifModel;
 class NifProxyModel;
+class NifSearch;
 class NifTreeView;
 class ReferenceBrowser;
 class SettingsDialog;
@@ -73,6 +77,7 @@ class QStandardItemModel;
 class QAction;
 class QActionGroup;
 class QComboBox;
+class QFileSystemWatcher;
 class QGraphicsScene;
 class QLocale;
 class QModelIndex;
@@ -168,6 +173,12 @@ public slots:
 	//! Reparse the nif.xml and kfm.xml files and reload the current file.
 	void on_aReload_triggered();
 
+	//! Start or stop watching the current file for changes.
+	void on_aAutoReload_toggled( bool );
+
+	//! Start recording a trace, or stop and save it.
+	void on_aRecordTrace_toggled( bool );
+
 	//! A slot that creates a new NifSkope application window.
 	void on_aWindow_triggered();
 
@@ -204,7 +215,15 @@ protected slots:
 	void archiveDlg();
 
 	void load();
+	//! Hand the file parsed by the background load over to the NIF model
+	void loadFinished( bool loaded, const QString & fname );
+	//! Reload the watched file in the background after it changed on disk
+	void reloadChanged();
+	//! Take over the blocks of the reloaded file which changed, see NifModel::takeChangedBlocks()
+	void reloadFinished( bool loaded, const QString & fname );
 	void save();
+	//! Finish the background save of save(), see NifModel::copyContents()
+	void saveFinished( bool saved, const QString & fname );
 
 	void reload();
 
@@ -222,6 +241,11 @@ protected slots:
 	//! Set the list mode
 	void setListMode();
 
+	//! Hide the block list rows and start searching for the filter text
+	void filterList();
+	//! Show the block list rows for blocks matching the filter
+	void showListMatches( const QList<int> & blocks );
+
 	//! Override the view font
 	void overrideViewFont();
 
@@ -257,6 +281,8 @@ private:
 	void loadFile( const QString & );
 	void saveFile( const QString & );
 	void checkFile( QFileInfo fInfo, QByteArray filehash );
+	//! Watch the loaded file for "Reload on Change", if it is a NIF on disk
+	void watchFile();
 
 	void openRecentFile();
 	void setCurrentFile( const QString & );
@@ -297,6 +323,27 @@ private:
 	NifProxyModel * proxy;
 	//! Stores the KFM file in memory.
 	KfmModel * kfm;
+	//! Searches the blocks for the block list filter.
+	NifSearch * search;
+	//! Rows of the top level branches of the hierarchy, by block number
+	QHash<int, int> listRoots;
+	//! Parses the NIF file off the GUI thread, see load().
+	NifModel * loader = nullptr;
+	//! Writes the NIF off the GUI thread, see save().
+	NifModel * saver = nullptr;
+	//! Whether the NIF was edited while saver was writing it.
+	bool saveEdited = false;
+	//! Runs the background load and save.
+	QThreadPool loadPool;
+
+	//! Watches the current file while "Reload on Change" is checked, see watchFile().
+	QFileSystemWatcher * fileWatcher;
+	//! Waits for the writes of a file to settle before reloadChanged().
+	QTimer * reloadTimer;
+	//! The absolute path of the watched file, empty if none is.
+	QString watchedFile;
+	//! The modification time of the watched file when it was last loaded or saved.
+	QDateTime watchedModified;
 
 	NifModel * nifEmpty;
 	NifProxyModel * proxyEmpty;
@@ -352,6 +399,7 @@ private:
 	QToolBar * tool;
 
 	QAction * aSanitize;
+	QAction * aAutoReload;
 
 	QAction * undoAction;
 	QAction * redoAction;
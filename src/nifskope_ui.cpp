@@ -44,6 +44,7 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "nifmodel.h"
 #include "nifproxy.h"
 #include "spellbook.h"
+#include "trace.h"
 #include "widgets/fileselect.h"
 #include "widgets/floatslider.h"
 #include "widgets/floatedit.h"
@@ -117,6 +118,7 @@ NifSkope * NifSkope::createWindow( const QString & fname )
 void NifSkope::initActions()
 {
 	aSanitize = ui->aSanitize;
+	aAutoReload = ui->aAutoReload;
 	aList = ui->aList;
 	aHierarchy = ui->aHierarchy;
 	aCondition = ui->aCondition;
@@ -185,6 +187,7 @@ void NifSkope::initActions()
 	ui->aShowMarkers->setData( Scene::ShowMarkers );
 	ui->aShowHidden->setData( Scene::ShowHidden );
 	ui->aDoSkinning->setData( Scene::DoSkinning );
+	ui->aShowStats->setData( Scene::ShowStats );
 
 	ui->aTextures->setData( Scene::DoTexturing );
 	ui->aVertexColors->setData( Scene::DoVertexColors );
@@ -212,7 +215,8 @@ void NifSkope::initActions()
 	connect( selectActions, &QActionGroup::triggered, ogl->getScene(), &Scene::updateSelectMode );
 
 	showActions = agroup( { ui->aShowAxes, ui->aShowGrid, ui->aShowNodes, ui->aShowCollision,
-						  ui->aShowConstraints, ui->aShowMarkers, ui->aShowHidden, ui->aDoSkinning
+						  ui->aShowConstraints, ui->aShowMarkers, ui->aShowHidden, ui->aDoSkinning,
+						  ui->aShowStats
 	}, false );
 	connect( showActions, &QActionGroup::triggered, ogl->getScene(), &Scene::updateSceneOptionsGroup );
 
@@ -264,6 +268,8 @@ void NifSkope::initActions()
 	connect( ui->aAboutQt, &QAction::triggered, qApp, &QApplication::aboutQt );
 
 	connect( ui->aPrintView, &QAction::triggered, ogl, &GLView::saveImage );
+	connect( ui->aBakeAnimation, &QAction::triggered, ogl, &GLView::saveAnimation );
+	connect( ui->aBenchmarkRender, &QAction::triggered, ogl, &GLView::benchmarkRender );
 
 #ifdef QT_NO_DEBUG
 	ui->aColorKeyDebug->setDisabled( true );
@@ -882,6 +888,8 @@ void NifSkope::onLoadComplete( bool success, QString & fname )
 
 		enableUi();
 
+		filterList();
+
 	} else {
 		// File failed to load
 		Message::critical( this, tr( "Failed to load %1" ).arg( fname ) );
@@ -904,6 +912,8 @@ void NifSkope::onLoadComplete( bool success, QString & fname )
 	nif->undoStack->clear();
 	indexStack->clear();
 
+	watchFile();
+
 	// Center the model on load
 	ogl->center();
 
@@ -937,9 +947,14 @@ void NifSkope::onSaveComplete( bool success, QString & fname )
 	if ( success ) {
 		// Update if Save As results in filename change
 		setWindowFilePath( fname );
-		// Mark window as unmodified
-		nif->undoStack->setClean();
-		setWindowModified( false );
+		// Mark window as unmodified, unless it was edited during a background save
+		if ( !saveEdited ) {
+			nif->undoStack->setClean();
+			setWindowModified( false );
+		}
+
+		// Saving As watches the new file, and the notification of the write is ignored
+		watchFile();
 	}
 }
 
@@ -992,6 +1007,7 @@ void NifSkope::saveUi() const
 	settings.setValue( "UI/Window Geometry", saveGeometry() );
 
 	settings.setValue( "File/Auto Sanitize", aSanitize->isChecked() );
+	settings.setValue( "File/Auto Reload", aAutoReload->isChecked() );
 
 	settings.setValue( "UI/List Mode", (gListMode->checkedAction() == aList ? "list" : "hierarchy") );
 	settings.setValue( "UI/Show Non-applicable Rows", aCondition->isChecked() );
@@ -1016,6 +1032,7 @@ void NifSkope::restoreUi()
 	restoreState( settings.value( "UI/Window State" ).toByteArray(), 0x073 );
 
 	aSanitize->setChecked( settings.value( "File/Auto Sanitize", true ).toBool() );
+	aAutoReload->setChecked( settings.value( "File/Auto Reload", false ).toBool() );
 
 	if ( settings.value( "UI/List Mode", "hierarchy" ).toString() == "list" )
 		aList->setChecked( true );
@@ -1248,6 +1265,33 @@ void NifSkope::on_aReload_triggered()
 	}
 }
 
+void NifSkope::on_aAutoReload_toggled( bool )
+{
+	watchFile();
+}
+
+void NifSkope::on_aRecordTrace_toggled( bool checked )
+{
+	if ( checked ) {
+		Trace::start();
+		return;
+	}
+
+	Trace::stop();
+
+	QString folder = nif->getFolder();
+	QString filename = QFileDialog::getSaveFileName( this, tr( "Record Trace" ),
+		folder + ( !folder.isEmpty() ? "/" : "" ) + "trace.json",
+		tr( "Chrome / Perfetto Trace (*.json)" )
+	);
+
+	if ( filename.isEmpty() )
+		return;
+
+	if ( !Trace::save( filename ) )
+		Message::critical( this, tr( "Could not save %1" ).arg( filename ) );
+}
+
 void NifSkope::on_aSelectFont_triggered()
 {
 	bool ok;
@@ -0,0 +1,186 @@
+/***** BEGIN LICENSE BLOCK *****
+
+BSD License
+
+Copyright (c) 2005-2015, NIF File Format Library and Tools
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the NIF File Format Library and Tools project may not be
+   used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+***** END LICENCE BLOCK *****/
+
+#include "nifsnapshot.h"
+
+#include "nifmodel.h"
+
+#include <QVarLengthArray>
+
+
+//! \file nifsnapshot.cpp NifSnapshot implementation
+
+NifSnapshot::NifSnapshot( const NifModel * nif )
+{
+	// Conditions and lazily loaded blocks are resolved here, on the thread of the model
+	nif->loadPendingBlocks();
+
+	version = nif->getVersionNumber();
+
+	NifItem * header = nif->getHeaderItem();
+	if ( NifItem * item = nif->getItem( header, "User Version" ) )
+		userVersion = item->value().get<quint32>();
+	if ( NifItem * bs = nif->getItem( header, "BS Header" ) ) {
+		if ( NifItem * item = nif->getItem( bs, "BS Version" ) )
+			bsVersion = item->value().get<quint32>();
+	}
+
+	const int numBlocks = nif->getBlockCount();
+	blocks.fill( -1, numBlocks );
+	childLinks.resize( numBlocks );
+	parentLinks.resize( numBlocks );
+
+	items.append( Entry() );
+
+	// The rows of the root are the header, the blocks and the footer, which have no conditions
+	NifItem * root = nif->root;
+	const int rows = root->childCount();
+
+	items[0].first = 1;
+	items[0].count = rows;
+
+	for ( int r = 0; r < rows; r++ ) {
+		NifItem * row = root->child( r );
+		Entry e;
+		e.name = row->name();
+		e.value = row->value();
+		e.parent = 0;
+		e.block = ( r > 0 && r <= numBlocks ) ? r - 1 : -1;
+		items.append( e );
+
+		if ( e.block >= 0 )
+			blocks[e.block] = items.count() - 1;
+	}
+
+	for ( int r = 0; r < rows; r++ )
+		addChildren( nif, root->child( r ), 1 + r, items.at( 1 + r ).block );
+
+	if ( version >= 0x14010003 )
+		strings = child( this->header(), "Strings" );
+
+	items.squeeze();
+}
+
+void NifSnapshot::addChildren( const NifModel * nif, NifItem * item, int entry, int block )
+{
+	QVarLengthArray<NifItem *, 64> present;
+	for ( NifItem * child : item->children() ) {
+		if ( nif->evalCondition( child ) )
+			present.append( child );
+	}
+
+	const int first = items.count();
+	items[entry].first = first;
+	items[entry].count = present.count();
+
+	// The children are appended together, so that they are found by their range
+	for ( NifItem * child : present ) {
+		Entry e;
+		e.name = child->name();
+		e.value = child->value();
+		e.parent = entry;
+		e.block = block;
+
+		if ( block >= 0 && e.value.isLink() ) {
+			int link = e.value.toLink();
+			if ( link >= 0 )
+				( e.value.type() == NifValue::tLink ? childLinks : parentLinks )[block].append( link );
+		}
+
+		items.append( e );
+	}
+
+	for ( int c = 0; c < present.count(); c++ )
+		addChildren( nif, present[c], first + c, block );
+}
+
+int NifSnapshot::child( int item, int row ) const
+{
+	if ( !isValid( item ) || row < 0 || row >= items.at( item ).count )
+		return -1;
+
+	return items.at( item ).first + row;
+}
+
+int NifSnapshot::child( int item, const QString & name ) const
+{
+	if ( !isValid( item ) )
+		return -1;
+
+	const Entry & e = items.at( item );
+	for ( int c = e.first; c < e.first + e.count; c++ ) {
+		if ( items.at( c ).name == name )
+			return c;
+	}
+
+	return -1;
+}
+
+const NifValue & NifSnapshot::value( int item ) const
+{
+	static const NifValue none;
+	return isValid( item ) ? items.at( item ).value : none;
+}
+
+int NifSnapshot::getLink( int item ) const
+{
+	const NifValue & v = value( item );
+	return v.isLink() ? v.toLink() : -1;
+}
+
+QString NifSnapshot::string( int item ) const
+{
+	if ( !isValid( item ) )
+		return QString();
+
+	const NifValue & v = value( item );
+
+	if ( v.type() == NifValue::tSizedString )
+		return v.get<QString>();
+
+	// See NifModel::string()
+	if ( version >= 0x14010003 ) {
+		int idx = -1;
+
+		if ( v.type() == NifValue::tStringIndex )
+			idx = v.get<int>();
+		else if ( !v.isValid() )
+			idx = get<int>( item, "Index" );
+
+		return ( idx < 0 ) ? QString() : get<QString>( child( strings, idx ) );
+	}
+
+	if ( v.type() != NifValue::tNone )
+		return v.get<QString>();
+
+	return get<QString>( item, "String" );
+}
@@ -0,0 +1,170 @@
+/***** BEGIN LICENSE BLOCK *****
+
+BSD License
+
+Copyright (c) 2005-2015, NIF File Format Library and Tools
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the NIF File Format Library and Tools project may not be
+   used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+***** END LICENCE BLOCK *****/
+
+#ifndef NIFSNAPSHOT_H
+#define NIFSNAPSHOT_H
+
+#include "nifvalue.h"
+
+#include <QString>
+#include <QVector>
+
+
+//! \file nifsnapshot.h NifSnapshot
+
+class NifItem;
+class NifModel;
+
+//! An immutable copy of the items of a NifModel, for reading on worker threads
+/*!
+ * NifModel keeps lazily filled caches and evaluates the conditions of its
+ * items on demand, writing the results into the items, so it may only be
+ * used from the thread it lives in. A snapshot is taken on that thread once,
+ * evaluating every condition and keeping only the items which are present in
+ * the file. Afterwards it never changes, and all of its functions may be
+ * called from any number of threads at the same time, while the model goes
+ * on serving the views and being edited.
+ *
+ * Items are referred to by number, -1 being no item. The items of the root
+ * are the header, the blocks and the footer, see header(), block() and
+ * footer(). The children of an item are numbered consecutively.
+ *
+ * \code
+ * // On the thread of the model
+ * auto snapshot = std::make_shared<const NifSnapshot>( nif );
+ *
+ * // On any thread
+ * QVector<Vector3> verts = snapshot->getArray<Vector3>( snapshot->block( b ), "Vertices" );
+ * \endcode
+ */
+class NifSnapshot final
+{
+public:
+	//! Copy the items of \a nif, on the thread the model lives in
+	explicit NifSnapshot( const NifModel * nif );
+
+	quint32 getVersionNumber() const { return version; }
+	quint32 getUserVersion() const { return userVersion; }
+	//! The "BS Version" of the "BS Header", 0 if there is none
+	quint32 getBSVersion() const { return bsVersion; }
+
+	int getBlockCount() const { return blocks.count(); }
+	//! The item of block \a b, -1 if there is no such block
+	int block( int b ) const { return blocks.value( b, -1 ); }
+	//! The block containing \a item, -1 for the header and the footer
+	int blockOf( int item ) const { return isValid( item ) ? items.at( item ).block : -1; }
+	//! The type of block \a b, as its item is named
+	QString blockType( int b ) const { return name( block( b ) ); }
+	//! The "Name" of block \a b
+	QString blockName( int b ) const { return string( block( b ), "Name" ); }
+
+	int header() const { return child( 0, 0 ); }
+	int footer() const { return child( 0, rowCount( 0 ) - 1 ); }
+
+	bool isValid( int item ) const { return item >= 0 && item < items.count(); }
+	int parent( int item ) const { return isValid( item ) ? items.at( item ).parent : -1; }
+	int rowCount( int item ) const { return isValid( item ) ? items.at( item ).count : 0; }
+	int child( int item, int row ) const;
+	//! The first child named \a name, -1 if there is none
+	int child( int item, const QString & name ) const;
+
+	//! The name of an item, empty for no item
+	QString name( int item ) const { return isValid( item ) ? items.at( item ).name : QString(); }
+	//! The value of an item, a value of type NifValue::tNone for no item
+	const NifValue & value( int item ) const;
+
+	template <typename T> T get( int item ) const { return value( item ).get<T>(); }
+	template <typename T> T get( int item, const QString & name ) const { return get<T>( child( item, name ) ); }
+
+	//! The values of the children of an array
+	template <typename T> QVector<T> getArray( int item ) const;
+	template <typename T> QVector<T> getArray( int item, const QString & name ) const { return getArray<T>( child( item, name ) ); }
+
+	//! The block a link points to, -1 if the item is no link or points to none
+	int getLink( int item ) const;
+	int getLink( int item, const QString & name ) const { return getLink( child( item, name ) ); }
+
+	//! The blocks linked by child links from block \a b
+	QVector<int> getChildLinks( int b ) const { return childLinks.value( b ); }
+	//! The blocks linked by parent links from block \a b
+	QVector<int> getParentLinks( int b ) const { return parentLinks.value( b ); }
+
+	//! A string, resolved from the header strings for version 20.1.0.3 and above
+	QString string( int item ) const;
+	QString string( int item, const QString & name ) const { return string( child( item, name ) ); }
+
+protected:
+	struct Entry
+	{
+		QString name;
+		NifValue value;
+		int parent = -1;
+		//! The number of the first child
+		int first = 0;
+		int count = 0;
+		int block = -1;
+	};
+
+	//! Append the present children of \a item as the children of \a entry, then their children
+	void addChildren( const NifModel * nif, NifItem * item, int entry, int block );
+
+	QVector<Entry> items;
+	QVector<int> blocks;
+	QVector<QVector<int>> childLinks;
+	QVector<QVector<int>> parentLinks;
+	//! The "Strings" of the header, -1 below 20.1.0.3
+	int strings = -1;
+
+	quint32 version = 0;
+	quint32 userVersion = 0;
+	quint32 bsVersion = 0;
+};
+
+
+// Templates
+
+template <typename T> inline QVector<T> NifSnapshot::getArray( int item ) const
+{
+	const int count = rowCount( item );
+	QVector<T> array( count );
+
+	if ( count > 0 ) {
+		const Entry * in = items.constData() + items.at( item ).first;
+		T * out = array.data();
+		for ( int c = 0; c < count; c++ )
+			out[c] = in[c].value.get<T>();
+	}
+
+	return array;
+}
+
+#endif
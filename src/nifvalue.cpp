@@ -35,18 +35,32 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "half.h"
 #include "nifmodel.h"
+#include "xxhash.h"
 
+#include <QBuffer>
 #include <QDataStream>
 #include <QIODevice>
 #include <QSettings>
+#include <QVarLengthArray>
+
+#include <atomic>
+#include <climits>
+#include <cstring>
+#include <new>
 
 
 //! @file nifvalue.cpp NifValue, NifIStream, NifOStream, NifSStream
 
-QHash<QString, NifValue::Type>        NifValue::typeMap;
-QHash<QString, QString>               NifValue::typeTxt;
-QHash<QString, NifValue::EnumOptions> NifValue::enumMap;
-QHash<QString, QString>               NifValue::aliasMap;
+//! The tables before the XML is loaded
+static const NifValue::TypeTables emptyTables;
+//! The tables the loads read, replaced as a whole by NifValue::publishTypes()
+/*!
+ * Replaced tables are never deleted, since a load on another thread may still
+ * be reading them; the XML is only reloaded on request, so they add up slowly.
+ */
+static std::atomic<const NifValue::TypeTables *> publishedTables{ &emptyTables };
+//! The tables being filled by the thread parsing the XML
+static thread_local NifValue::TypeTables * buildingTables = nullptr;
 
 /*
  *  NifValue
@@ -67,10 +81,38 @@ NifValue::~NifValue()
 	clear();
 }
 
+const NifValue::TypeTables & NifValue::tables()
+{
+	// The parsing thread sees the tables it fills, so the XML can refer to its own types
+	if ( buildingTables )
+		return *buildingTables;
+
+	return *publishedTables.load( std::memory_order_acquire );
+}
+
+NifValue::TypeTables & NifValue::buildTables()
+{
+	if ( !buildingTables )
+		initialize();
+
+	return *buildingTables;
+}
+
+void NifValue::publishTypes()
+{
+	if ( buildingTables ) {
+		publishedTables.store( buildingTables, std::memory_order_release );
+		buildingTables = nullptr;
+	}
+}
+
 void NifValue::initialize()
 {
-	typeMap.clear();
-	typeTxt.clear();
+	// Tables which were never published are not read by any other thread
+	delete buildingTables;
+	buildingTables = new TypeTables;
+
+	QHash<QString, Type> & typeMap = buildingTables->typeMap;
 
 	typeMap.insert( "bool",   NifValue::tBool );
 	typeMap.insert( "byte",   NifValue::tByte );
@@ -120,27 +162,29 @@ void NifValue::initialize()
 	typeMap.insert( "HalfVector2", NifValue::tHalfVector2 );
 	typeMap.insert( "HalfTexCoord", NifValue::tHalfVector2 );
 	typeMap.insert( "ByteColor4", NifValue::tByteColor4 );
-
-	enumMap.clear();
 }
 
 NifValue::Type NifValue::type( const QString & id )
 {
-	if ( typeMap.isEmpty() )
+	if ( tables().typeMap.isEmpty() ) {
 		initialize();
+		publishTypes();
+	}
 
-	return typeMap.value( id, tNone );
+	return tables().typeMap.value( id, tNone );
 }
 
 void NifValue::setTypeDescription( const QString & typId, const QString & txt )
 {
-	typeTxt[typId] = QString( txt ).replace( "<", "&lt;" ).replace( "\n", "<br/>" );
+	buildTables().typeTxt[typId] = QString( txt ).replace( "<", "&lt;" ).replace( "\n", "<br/>" );
 }
 
 QString NifValue::typeDescription( const QString & typId )
 {
-	if ( !enumMap.contains( typId ) )
-		return QString( "<p><b>%1</b></p><p>%2</p>" ).arg( typId, typeTxt.value( typId ) );
+	const TypeTables & t = tables();
+
+	if ( !t.enumMap.contains( typId ) )
+		return QString( "<p><b>%1</b></p><p>%2</p>" ).arg( typId, t.typeTxt.value( typId ) );
 
 	// Cache the generated HTML description
 	static QHash<QString, QString> txtCache;
@@ -148,10 +192,10 @@ QString NifValue::typeDescription( const QString & typId )
 	if ( txtCache.contains( typId ) )
 		return txtCache[typId];
 	
-	QString txt = QString( "<p><b>%1 (%2)</b><p>%3</p>" ).arg( typId, aliasMap.value( typId ), typeTxt.value( typId ) );
+	QString txt = QString( "<p><b>%1 (%2)</b><p>%3</p>" ).arg( typId, t.aliasMap.value( typId ), t.typeTxt.value( typId ) );
 
 	txt += "<table><tr><td><table>";
-	QMapIterator<quint32, QPair<QString, QString> > it( enumMap[ typId ].o );
+	QMapIterator<quint32, QPair<QString, QString> > it( t.enumMap.value( typId ).o );
 	int cnt = 0;
 
 	while ( it.hasNext() ) {
@@ -172,14 +216,90 @@ QString NifValue::typeDescription( const QString & typId )
 	return txt;
 }
 
+quint64 NifValue::typeSignature()
+{
+	// Sorted, the order of a QHash differs between runs
+	const TypeTables & t = tables();
+	QMap<QString, Type> types;
+	for ( auto it = t.typeMap.cbegin(); it != t.typeMap.cend(); ++it )
+		types.insert( it.key(), it.value() );
+
+	QByteArray data;
+	QDataStream out( &data, QIODevice::WriteOnly );
+	out << quint32( sizeof( NifValue ) );
+	for ( auto it = types.cbegin(); it != types.cend(); ++it )
+		out << it.key() << quint32( it.value() );
+
+	return XXH64( data.constData(), size_t( data.size() ), 0 );
+}
+
+void NifValue::saveTypeMaps( QDataStream & out )
+{
+	const TypeTables & t = tables();
+
+	out << quint32( t.typeMap.count() );
+	for ( auto it = t.typeMap.cbegin(); it != t.typeMap.cend(); ++it )
+		out << it.key() << quint32( it.value() );
+
+	out << quint32( t.enumMap.count() );
+	for ( auto it = t.enumMap.cbegin(); it != t.enumMap.cend(); ++it )
+		out << it.key() << quint32( it.value().t ) << it.value().o;
+
+	out << t.typeTxt << t.aliasMap;
+}
+
+bool NifValue::loadTypeMaps( QDataStream & in )
+{
+	QHash<QString, Type> types;
+	QHash<QString, EnumOptions> enums;
+	QHash<QString, QString> txt;
+	QHash<QString, QString> aliases;
+
+	quint32 count = 0;
+	in >> count;
+	for ( quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++ ) {
+		QString id;
+		quint32 t = 0;
+		in >> id >> t;
+
+		if ( t > tNone )
+			return false;
+
+		types.insert( id, Type( t ) );
+	}
+
+	in >> count;
+	for ( quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++ ) {
+		QString id;
+		quint32 t = 0;
+		EnumOptions eo;
+		in >> id >> t >> eo.o;
+		eo.t = EnumType( t );
+
+		enums.insert( id, eo );
+	}
+
+	in >> txt >> aliases;
+
+	if ( in.status() != QDataStream::Ok )
+		return false;
+
+	TypeTables & t = buildTables();
+	t.typeMap = types;
+	t.enumMap = enums;
+	t.typeTxt = txt;
+	t.aliasMap = aliases;
+
+	return true;
+}
+
 bool NifValue::registerAlias( const QString & alias, const QString & original )
 {
-	if ( typeMap.isEmpty() )
-		initialize();
+	TypeTables & t = buildTables();
 
-	if ( typeMap.contains( original ) && !typeMap.contains( alias ) ) {
-		typeMap.insert( alias, typeMap[original] );
-		aliasMap.insert( alias, original );
+	if ( t.typeMap.contains( original ) && !t.typeMap.contains( alias ) ) {
+		t.typeMap.insert( alias, t.typeMap[original] );
+		t.aliasMap.insert( alias, original );
 		return true;
 	}
 
@@ -188,7 +308,7 @@ bool NifValue::registerAlias( const QString & alias, const QString & original )
 
 bool NifValue::registerEnumOption( const QString & eid, const QString & oid, quint32 oval, const QString & otxt )
 {
-	QMap<quint32, QPair<QString, QString> > & e = enumMap[eid].o;
+	QMap<quint32, QPair<QString, QString> > & e = buildTables().enumMap[eid].o;
 
 	if ( e.contains( oval ) )
 		return false;
@@ -200,9 +320,10 @@ bool NifValue::registerEnumOption( const QString & eid, const QString & oid, qui
 QStringList NifValue::enumOptions( const QString & eid )
 {
 	QStringList opts;
+	auto eo = tables().enumMap.constFind( eid );
 
-	if ( enumMap.contains( eid ) ) {
-		QMapIterator<quint32, QPair<QString, QString> > it( enumMap[ eid ].o );
+	if ( eo != tables().enumMap.cend() ) {
+		QMapIterator<quint32, QPair<QString, QString> > it( eo->o );
 
 		while ( it.hasNext() ) {
 			it.next();
@@ -215,22 +336,27 @@ QStringList NifValue::enumOptions( const QString & eid )
 
 bool NifValue::registerEnumType( const QString & eid, EnumType eTyp )
 {
-	if ( enumMap.contains( eid ) )
+	TypeTables & t = buildTables();
+
+	if ( t.enumMap.contains( eid ) )
 		return false;
 
-	enumMap[eid].t = eTyp;
+	t.enumMap[eid].t = eTyp;
 	return true;
 }
 
 NifValue::EnumType NifValue::enumType( const QString & eid )
 {
-	return (enumMap.contains( eid )) ? enumMap[eid].t : EnumType::eNone;
+	auto eo = tables().enumMap.constFind( eid );
+	return ( eo != tables().enumMap.cend() ) ? eo->t : EnumType::eNone;
 }
 
 QString NifValue::enumOptionName( const QString & eid, quint32 val )
 {
-	if ( enumMap.contains( eid ) ) {
-		NifValue::EnumOptions & eo = enumMap[eid];
+	auto found = tables().enumMap.constFind( eid );
+
+	if ( found != tables().enumMap.cend() ) {
+		const NifValue::EnumOptions & eo = *found;
 
 		if ( eo.t == NifValue::eFlags ) {
 			QString text;
@@ -273,13 +399,15 @@ QString NifValue::enumOptionName( const QString & eid, quint32 val )
 
 QString NifValue::enumOptionText( const QString & eid, quint32 val )
 {
-	return enumMap.value( eid ).o.value( val ).second;
+	return tables().enumMap.value( eid ).o.value( val ).second;
 }
 
 quint32 NifValue::enumOptionValue( const QString & eid, const QString & oid, bool * ok )
 {
-	if ( enumMap.contains( eid ) ) {
-		EnumOptions & eo = enumMap[ eid ];
+	auto found = tables().enumMap.constFind( eid );
+
+	if ( found != tables().enumMap.cend() ) {
+		const EnumOptions & eo = *found;
 		QMapIterator<quint32, QPair<QString, QString> > it( eo.o );
 
 		if ( eo.t == NifValue::eFlags ) {
@@ -335,43 +463,65 @@ quint32 NifValue::enumOptionValue( const QString & eid, const QString & oid, boo
 
 const NifValue::EnumOptions & NifValue::enumOptionData( const QString & eid )
 {
-	return enumMap[eid];
+	static const EnumOptions none;
+
+	auto eo = tables().enumMap.constFind( eid );
+	return ( eo != tables().enumMap.cend() ) ? *eo : none;
+}
+
+template <typename T> void * NifValue::construct()
+{
+	// Small values live inside the NifValue, val.data then points at inlineData
+	if ( sizeof( T ) <= sizeof( inlineData ) && alignof( T ) <= alignof( double ) )
+		return new ( inlineData ) T();
+
+	return new T();
+}
+
+template <typename T> void NifValue::destroy()
+{
+	T * data = static_cast<T *>( val.data );
+
+	if ( val.data == static_cast<void *>( inlineData ) )
+		data->~T();
+	else
+		delete data;
 }
 
 void NifValue::clear()
 {
 	switch ( typ ) {
 	case tVector4:
-		delete static_cast<Vector4 *>( val.data );
+		destroy<Vector4>();
 		break;
 	case tVector3:
 	case tHalfVector3:
 	case tByteVector3:
-		delete static_cast<Vector3 *>( val.data );
+		destroy<Vector3>();
 		break;
 	case tVector2:
 	case tHalfVector2:
-		delete static_cast<Vector2 *>( val.data );
+		destroy<Vector2>();
 		break;
 	case tMatrix:
-		delete static_cast<Matrix *>( val.data );
+		destroy<Matrix>();
 		break;
 	case tMatrix4:
-		delete static_cast<Matrix4 *>( val.data );
+		destroy<Matrix4>();
 		break;
 	case tQuat:
 	case tQuatXYZW:
-		delete static_cast<Quat *>( val.data );
+		destroy<Quat>();
 		break;
 	case tByteMatrix:
-		delete static_cast<ByteMatrix *>( val.data );
+		destroy<ByteMatrix>();
 		break;
 	case tByteArray:
 	case tStringPalette:
-		delete static_cast<QByteArray *>( val.data );
+		destroy<QByteArray>();
 		break;
 	case tTriangle:
-		delete static_cast<Triangle *>( val.data );
+		destroy<Triangle>();
 		break;
 	case tString:
 	case tSizedString:
@@ -380,17 +530,17 @@ void NifValue::clear()
 	case tHeaderString:
 	case tLineString:
 	case tChar8String:
-		delete static_cast<QString *>( val.data );
+		destroy<QString>();
 		break;
 	case tColor3:
-		delete static_cast<Color3 *>( val.data );
+		destroy<Color3>();
 		break;
 	case tColor4:
 	case tByteColor4:
-		delete static_cast<Color4 *>( val.data );
+		destroy<Color4>();
 		break;
 	case tBlob:
-		delete static_cast<QByteArray *>( val.data );
+		destroy<QByteArray>();
 		break;
 	default:
 		break;
@@ -400,6 +550,286 @@ void NifValue::clear()
 	val.u32 = 0;
 }
 
+template <typename T> qint64 NifValue::allocated() const
+{
+	return ( val.data == static_cast<const void *>( inlineData ) ) ? 0 : qint64( sizeof( T ) );
+}
+
+qint64 NifValue::heapSize() const
+{
+	switch ( typ ) {
+	case tVector4:
+		return allocated<Vector4>();
+	case tMatrix:
+		return allocated<Matrix>();
+	case tMatrix4:
+		return allocated<Matrix4>();
+	case tByteMatrix:
+		{
+			const ByteMatrix * m = static_cast<const ByteMatrix *>( val.data );
+			return allocated<ByteMatrix>() + m->count();
+		}
+	case tByteArray:
+	case tStringPalette:
+	case tBlob:
+		return allocated<QByteArray>() + static_cast<const QByteArray *>( val.data )->capacity();
+	case tString:
+	case tSizedString:
+	case tText:
+	case tShortString:
+	case tHeaderString:
+	case tLineString:
+	case tChar8String:
+		return allocated<QString>() + qint64( static_cast<const QString *>( val.data )->capacity() ) * sizeof( QChar );
+	default:
+		// The other types are stored in val or in inlineData
+		return 0;
+	}
+}
+
+quint64 NifValue::digest( quint64 seed ) const
+{
+	// The type is part of the seed, so that 0 as a float and as a link differ
+	seed = seed * 31 + typ;
+
+	switch ( typ ) {
+	case tByte:
+		return XXH64( &val.u08, 1, seed );
+	case tWord:
+	case tFlags:
+	case tStringOffset:
+	case tBlockTypeIndex:
+	case tShort:
+		return XXH64( &val.u16, 2, seed );
+	case tBool:
+	case tInt:
+	case tUInt:
+	case tULittle32:
+	case tStringIndex:
+	case tFileVersion:
+	case tLink:
+	case tUpLink:
+	case tFloat:
+	case tHfloat:
+		return XXH64( &val.u32, 4, seed );
+	case tString:
+	case tSizedString:
+	case tText:
+	case tShortString:
+	case tHeaderString:
+	case tLineString:
+	case tChar8String:
+	case tFilePath:
+		{
+			const QString * s = static_cast<const QString *>( val.data );
+			return XXH64( s->constData(), size_t( s->size() ) * sizeof( QChar ), seed );
+		}
+	case tColor3:
+		return XXH64( static_cast<const Color3 *>( val.data )->data(), 3 * sizeof( float ), seed );
+	case tColor4:
+	case tByteColor4:
+		return XXH64( static_cast<const Color4 *>( val.data )->data(), 4 * sizeof( float ), seed );
+	case tVector2:
+	case tHalfVector2:
+		return XXH64( static_cast<const Vector2 *>( val.data )->data(), 2 * sizeof( float ), seed );
+	case tVector3:
+	case tHalfVector3:
+	case tByteVector3:
+		return XXH64( static_cast<const Vector3 *>( val.data )->data(), 3 * sizeof( float ), seed );
+	case tVector4:
+		return XXH64( static_cast<const Vector4 *>( val.data )->data(), 4 * sizeof( float ), seed );
+	case tQuat:
+	case tQuatXYZW:
+		return XXH64( &( *static_cast<const Quat *>( val.data ) )[0], 4 * sizeof( float ), seed );
+	case tMatrix:
+		return XXH64( static_cast<const Matrix *>( val.data )->data(), 9 * sizeof( float ), seed );
+	case tMatrix4:
+		return XXH64( static_cast<const Matrix4 *>( val.data )->data(), 16 * sizeof( float ), seed );
+	case tTriangle:
+		return XXH64( &( *static_cast<const Triangle *>( val.data ) )[0], 3 * sizeof( quint16 ), seed );
+	case tByteMatrix:
+		{
+			const ByteMatrix * m = static_cast<const ByteMatrix *>( val.data );
+			quint64 dims[2] = { quint64( m->count( 0 ) ), quint64( m->count( 1 ) ) };
+			return XXH64( m->data(), size_t( m->count() ), XXH64( dims, sizeof( dims ), seed ) );
+		}
+	case tByteArray:
+	case tStringPalette:
+	case tBlob:
+		{
+			const QByteArray * a = static_cast<const QByteArray *>( val.data );
+			return XXH64( a->constData(), size_t( a->size() ), seed );
+		}
+	default:
+		return seed;
+	}
+}
+
+//! The number of floats of the types stored as float vectors, 0 for the others
+static int valueFloats( NifValue::Type t )
+{
+	switch ( t ) {
+	case NifValue::tVector2:
+	case NifValue::tHalfVector2:
+		return 2;
+	case NifValue::tVector3:
+	case NifValue::tHalfVector3:
+	case NifValue::tByteVector3:
+	case NifValue::tColor3:
+		return 3;
+	case NifValue::tVector4:
+	case NifValue::tColor4:
+	case NifValue::tByteColor4:
+	case NifValue::tQuat:
+	case NifValue::tQuatXYZW:
+		return 4;
+	case NifValue::tMatrix:
+		return 9;
+	case NifValue::tMatrix4:
+		return 16;
+	default:
+		return 0;
+	}
+}
+
+//! The floats of a value stored as a float vector, see valueFloats()
+template <typename T> static float * valueFloatData( void * data )
+{
+	return const_cast<float *>( static_cast<T *>( data )->data() );
+}
+
+//! The floats of a value stored as a float vector, see valueFloats()
+static float * valueFloatData( NifValue::Type t, void * data )
+{
+	switch ( t ) {
+	case NifValue::tVector2:
+	case NifValue::tHalfVector2:
+		return valueFloatData<Vector2>( data );
+	case NifValue::tVector3:
+	case NifValue::tHalfVector3:
+	case NifValue::tByteVector3:
+		return valueFloatData<Vector3>( data );
+	case NifValue::tColor3:
+		return valueFloatData<Color3>( data );
+	case NifValue::tVector4:
+		return valueFloatData<Vector4>( data );
+	case NifValue::tColor4:
+	case NifValue::tByteColor4:
+		return valueFloatData<Color4>( data );
+	case NifValue::tQuat:
+	case NifValue::tQuatXYZW:
+		return &( *static_cast<Quat *>( data ) )[0];
+	case NifValue::tMatrix:
+		return valueFloatData<Matrix>( data );
+	case NifValue::tMatrix4:
+		return valueFloatData<Matrix4>( data );
+	default:
+		return nullptr;
+	}
+}
+
+void NifValue::saveTo( QDataStream & out ) const
+{
+	out << quint8( typ );
+
+	if ( int floats = valueFloats( typ ) ) {
+		out.writeRawData( reinterpret_cast<const char *>( valueFloatData( typ, val.data ) ), floats * int( sizeof( float ) ) );
+		return;
+	}
+
+	switch ( typ ) {
+	case tString:
+	case tSizedString:
+	case tText:
+	case tShortString:
+	case tHeaderString:
+	case tLineString:
+	case tChar8String:
+		out << *static_cast<const QString *>( val.data );
+		return;
+	case tByteArray:
+	case tStringPalette:
+	case tBlob:
+		out << *static_cast<const QByteArray *>( val.data );
+		return;
+	case tTriangle:
+		out.writeRawData( reinterpret_cast<const char *>( &( *static_cast<const Triangle *>( val.data ) )[0] ), 3 * sizeof( quint16 ) );
+		return;
+	case tByteMatrix:
+		{
+			const ByteMatrix * m = static_cast<const ByteMatrix *>( val.data );
+			out << qint32( m->count( 0 ) ) << qint32( m->count( 1 ) );
+			out.writeRawData( m->data(), m->count() );
+			return;
+		}
+	case tNone:
+		return;
+	default:
+		// The other types are stored in val
+		out.writeRawData( reinterpret_cast<const char *>( &val.u32 ), 4 );
+		return;
+	}
+}
+
+bool NifValue::loadFrom( QDataStream & in )
+{
+	quint8 t = tNone;
+	in >> t;
+
+	if ( t > tByteColor4 && t != tNone )
+		return false;
+
+	changeType( Type( t ) );
+
+	if ( int floats = valueFloats( typ ) ) {
+		const int len = floats * int( sizeof( float ) );
+		return in.readRawData( reinterpret_cast<char *>( valueFloatData( typ, val.data ) ), len ) == len;
+	}
+
+	switch ( typ ) {
+	case tString:
+	case tSizedString:
+	case tText:
+	case tShortString:
+	case tHeaderString:
+	case tLineString:
+	case tChar8String:
+		in >> *static_cast<QString *>( val.data );
+		break;
+	case tByteArray:
+	case tStringPalette:
+	case tBlob:
+		in >> *static_cast<QByteArray *>( val.data );
+		break;
+	case tTriangle:
+		{
+			const int len = 3 * sizeof( quint16 );
+			return in.readRawData( reinterpret_cast<char *>( &( *static_cast<Triangle *>( val.data ) )[0] ), len ) == len;
+		}
+	case tByteMatrix:
+		{
+			qint32 len0 = 0, len1 = 0;
+			in >> len0 >> len1;
+
+			if ( len0 < 0 || len1 < 0 || ( len1 > 0 && len0 > INT_MAX / len1 ) )
+				return false;
+
+			ByteMatrix m( len0, len1 );
+			if ( in.readRawData( m.data(), m.count() ) != m.count() )
+				return false;
+
+			static_cast<ByteMatrix *>( val.data )->swap( m );
+			break;
+		}
+	case tNone:
+		break;
+	default:
+		return in.readRawData( reinterpret_cast<char *>( &val.u32 ), 4 ) == 4;
+	}
+
+	return in.status() == QDataStream::Ok;
+}
+
 void NifValue::changeType( Type t )
 {
 	if ( typ == t )
@@ -416,27 +846,27 @@ void NifValue::changeType( Type t )
 	case tVector3:
 	case tHalfVector3:
 	case tByteVector3:
-		val.data = new Vector3();
+		val.data = construct<Vector3>();
 		break;
 	case tVector4:
-		val.data = new Vector4();
+		val.data = construct<Vector4>();
 		return;
 	case tMatrix:
-		val.data = new Matrix();
+		val.data = construct<Matrix>();
 		return;
 	case tMatrix4:
-		val.data = new Matrix4();
+		val.data = construct<Matrix4>();
 		return;
 	case tQuat:
 	case tQuatXYZW:
-		val.data = new Quat();
+		val.data = construct<Quat>();
 		return;
 	case tVector2:
 	case tHalfVector2:
-		val.data = new Vector2();
+		val.data = construct<Vector2>();
 		return;
 	case tTriangle:
-		val.data = new Triangle();
+		val.data = construct<Triangle>();
 		return;
 	case tString:
 	case tSizedString:
@@ -445,28 +875,28 @@ void NifValue::changeType( Type t )
 	case tHeaderString:
 	case tLineString:
 	case tChar8String:
-		val.data = new QString();
+		val.data = construct<QString>();
 		return;
 	case tColor3:
-		val.data = new Color3();
+		val.data = construct<Color3>();
 		return;
 	case tColor4:
 	case tByteColor4:
-		val.data = new Color4();
+		val.data = construct<Color4>();
 		return;
 	case tByteArray:
 	case tStringPalette:
-		val.data = new QByteArray();
+		val.data = construct<QByteArray>();
 		return;
 	case tByteMatrix:
-		val.data = new ByteMatrix();
+		val.data = construct<ByteMatrix>();
 		return;
 	case tStringOffset:
 	case tStringIndex:
 		val.u32 = 0xffffffff;
 		return;
 	case tBlob:
-		val.data = new QByteArray();
+		val.data = construct<QByteArray>();
 		return;
 	default:
 		val.u32 = 0;
@@ -1029,10 +1459,259 @@ void NifIStream::init()
 	dataStream->setFloatingPointPrecision( QDataStream::SinglePrecision );
 
 	maxLength = 0x8000;
+
+	memory = nullptr;
+	memorySize = 0;
+
+	if ( QBuffer * buffer = qobject_cast<QBuffer *>( device ) ) {
+		memory = buffer->data().constData();
+		memorySize = buffer->data().size();
+	}
+}
+
+bool NifIStream::readRaw( char * data, qint64 len )
+{
+	if ( !memory )
+		return device->read( data, len ) == len;
+
+	qint64 pos = device->pos();
+	if ( len < 0 || pos + len > memorySize )
+		return false;
+
+	memcpy( data, memory + pos, len );
+	return device->seek( pos + len );
+}
+
+int NifIStream::fixedSize( NifValue::Type t ) const
+{
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+	if ( bigEndian )
+		return 0;
+
+	switch ( t ) {
+	case NifValue::tByte:
+		return 1;
+	case NifValue::tWord:
+	case NifValue::tShort:
+	case NifValue::tFlags:
+	case NifValue::tBlockTypeIndex:
+	case NifValue::tHfloat:
+		return 2;
+	case NifValue::tHalfVector2:
+		return 4;
+	case NifValue::tHalfVector3:
+		return 6;
+	case NifValue::tStringOffset:
+	case NifValue::tInt:
+	case NifValue::tUInt:
+	case NifValue::tULittle32:
+	case NifValue::tStringIndex:
+	case NifValue::tFloat:
+		return 4;
+	case NifValue::tTriangle:
+		return 6;
+	case NifValue::tVector2:
+		return 8;
+	case NifValue::tVector3:
+	case NifValue::tColor3:
+		return 12;
+	case NifValue::tVector4:
+	case NifValue::tQuat:
+	case NifValue::tColor4:
+		return 16;
+	case NifValue::tMatrix:
+		return 36;
+	case NifValue::tMatrix4:
+		return 64;
+	default:
+		break;
+	}
+#else
+	Q_UNUSED( t );
+#endif
+
+	return 0;
+}
+
+char * NifIStream::fixedStorage( NifValue & val ) const
+{
+	switch ( val.type() ) {
+	case NifValue::tVector2:
+	case NifValue::tHalfVector2:
+		return (char *)static_cast<Vector2 *>( val.val.data )->xy;
+	case NifValue::tVector3:
+	case NifValue::tHalfVector3:
+		return (char *)static_cast<Vector3 *>( val.val.data )->xyz;
+	case NifValue::tVector4:
+		return (char *)static_cast<Vector4 *>( val.val.data )->xyzw;
+	case NifValue::tTriangle:
+		return (char *)static_cast<Triangle *>( val.val.data )->v;
+	case NifValue::tQuat:
+		return (char *)static_cast<Quat *>( val.val.data )->wxyz;
+	case NifValue::tColor3:
+		return (char *)static_cast<Color3 *>( val.val.data )->rgb;
+	case NifValue::tColor4:
+		return (char *)static_cast<Color4 *>( val.val.data )->rgba;
+	case NifValue::tMatrix:
+		return (char *)static_cast<Matrix *>( val.val.data )->m;
+	case NifValue::tMatrix4:
+		return (char *)static_cast<Matrix4 *>( val.val.data )->m;
+	default:
+		// Counts and floats live in the value itself, clear the unused upper bytes
+		val.val.u32 = 0;
+		return (char *)&val.val.u32;
+	}
+}
+
+bool NifIStream::readFixedArray( NifItem * array )
+{
+	if ( !array || array->childCount() == 0 )
+		return true;
+
+	const NifValue::Type t = array->child( 0 )->value().type();
+	const int size = fixedSize( t );
+	if ( size == 0 )
+		return false;
+
+	const int count = array->childCount();
+	QByteArray bytes;
+	const char * src;
+	int stored = size;
+
+	if ( t == NifValue::tHfloat || t == NifValue::tHalfVector2 || t == NifValue::tHalfVector3 ) {
+		// Widen all the halves in one pass, the values hold them as floats
+		QVector<uint16_t> halves( count * size / 2 );
+		if ( !readRaw( (char *)halves.data(), size * count ) )
+			return false;
+
+		bytes.resize( halves.count() * sizeof( float ) );
+		half_to_float_n( halves.constData(), (float *)bytes.data(), halves.count() );
+		stored = size * 2;
+	} else {
+		bytes.resize( size * count );
+		if ( !readRaw( bytes.data(), bytes.size() ) )
+			return false;
+	}
+
+	src = bytes.constData();
+	for ( NifItem * child : array->children() ) {
+		NifValue & val = child->value();
+		if ( val.type() != t )
+			return false;
+
+		memcpy( fixedStorage( val ), src, stored );
+		src += stored;
+	}
+
+	return true;
+}
+
+int NifIStream::fixedRecordSize( const NifItem * element, const QVector<int> & rows ) const
+{
+	int size = 0;
+
+	for ( int r : rows ) {
+		const NifItem * field = element->child( r );
+		const int s = field ? fixedSize( field->value().type() ) : 0;
+		if ( s == 0 )
+			return 0;
+
+		size += s;
+	}
+
+	return size;
+}
+
+bool NifIStream::readFixedRecords( NifItem * array, const QVector<int> & rows )
+{
+	const int count = array ? array->childCount() - 1 : 0;
+	if ( count <= 0 || rows.isEmpty() )
+		return true;
+
+	const NifItem * first = array->child( 0 );
+	const int size = fixedRecordSize( first, rows );
+	if ( size == 0 || qint64( size ) * count > INT_MAX )
+		return false;
+
+	QVarLengthArray<NifValue::Type, 16> types;
+	QVarLengthArray<int, 16> sizes;
+	for ( int r : rows ) {
+		types.append( first->child( r )->value().type() );
+		sizes.append( fixedSize( types.last() ) );
+	}
+
+	QByteArray bytes( size * count, Qt::Uninitialized );
+	if ( !readRaw( bytes.data(), bytes.size() ) )
+		return false;
+
+	const char * src = bytes.constData();
+	for ( int e = 1; e <= count; e++ ) {
+		NifItem * element = array->child( e );
+
+		for ( int f = 0; f < rows.count(); f++ ) {
+			NifValue & val = element->child( rows.at( f ) )->value();
+			if ( val.type() != types[f] )
+				return false;
+
+			char * dst = fixedStorage( val );
+
+			switch ( types[f] ) {
+			case NifValue::tHfloat:
+			case NifValue::tHalfVector2:
+			case NifValue::tHalfVector3:
+				{
+					// Padded to four as in read()
+					uint16_t h[4] = { 0, 0, 0, 0 };
+					float wide[4];
+
+					memcpy( h, src, sizes[f] );
+					half_to_float_n( h, wide, 4 );
+					memcpy( dst, wide, sizes[f] * 2 );
+					break;
+				}
+			default:
+				memcpy( dst, src, sizes[f] );
+				break;
+			}
+
+			src += sizes[f];
+		}
+	}
+
+	return true;
 }
 
 bool NifIStream::read( NifValue & val )
 {
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+	// Fixed-layout values are copied straight out of memory
+	if ( memory && !bigEndian ) {
+		switch ( val.type() ) {
+		case NifValue::tStringOffset:
+		case NifValue::tInt:
+		case NifValue::tUInt:
+		case NifValue::tStringIndex:
+			return readRaw( (char *)&val.val.u32, 4 );
+		case NifValue::tFloat:
+			return readRaw( (char *)&val.val.f32, 4 );
+		case NifValue::tVector2:
+			return readRaw( (char *)static_cast<Vector2 *>( val.val.data )->xy, 8 );
+		case NifValue::tVector3:
+			return readRaw( (char *)static_cast<Vector3 *>( val.val.data )->xyz, 12 );
+		case NifValue::tVector4:
+			return readRaw( (char *)static_cast<Vector4 *>( val.val.data )->xyzw, 16 );
+		case NifValue::tTriangle:
+			return readRaw( (char *)static_cast<Triangle *>( val.val.data )->v, 6 );
+		case NifValue::tQuat:
+			return readRaw( (char *)static_cast<Quat *>( val.val.data )->wxyz, 16 );
+		case NifValue::tColor4:
+			return readRaw( (char *)static_cast<Color4 *>( val.val.data )->rgba, 16 );
+		default:
+			break;
+		}
+	}
+#endif
+
 	switch ( val.type() ) {
 	case NifValue::tBool:
 		{
@@ -1126,35 +1805,33 @@ bool NifIStream::read( NifValue & val )
 		}
 	case NifValue::tHalfVector3:
 		{
-			uint16_t x, y, z;
-			union { float f; uint32_t i; } xu, yu, zu;
+			// Padded to four, which converts in one instruction where the target has one
+			uint16_t h[4] = { 0, 0, 0, 0 };
+			float f[4];
+
+			*dataStream >> h[0];
+			*dataStream >> h[1];
+			*dataStream >> h[2];
+
+			half_to_float_n( h, f, 4 );
 
-			*dataStream >> x;
-			*dataStream >> y;
-			*dataStream >> z;
-			
-			xu.i = half_to_float( x );
-			yu.i = half_to_float( y );
-			zu.i = half_to_float( z );
-	
 			Vector3 * v = static_cast<Vector3 *>(val.val.data);
-			v->xyz[0] = xu.f; v->xyz[1] = yu.f; v->xyz[2] = zu.f;
+			v->xyz[0] = f[0]; v->xyz[1] = f[1]; v->xyz[2] = f[2];
 	
 			return ( dataStream->status() == QDataStream::Ok );
 		}
 	case NifValue::tHalfVector2:
 		{
-			uint16_t x, y;
-			union { float f; uint32_t i; } xu, yu;
+			uint16_t h[4] = { 0, 0, 0, 0 };
+			float f[4];
 
-			*dataStream >> x;
-			*dataStream >> y;
-			
-			xu.i = half_to_float( x );
-			yu.i = half_to_float( y );
+			*dataStream >> h[0];
+			*dataStream >> h[1];
+
+			half_to_float_n( h, f, 4 );
 	
 			Vector2 * v = static_cast<Vector2 *>(val.val.data);
-			v->xy[0] = xu.f; v->xy[1] = yu.f;
+			v->xy[0] = f[0]; v->xy[1] = f[1];
 	
 			return ( dataStream->status() == QDataStream::Ok );
 		}
@@ -1185,12 +1862,12 @@ bool NifIStream::read( NifValue & val )
 	case NifValue::tQuatXYZW:
 		{
 			Quat * q = static_cast<Quat *>( val.val.data );
-			return device->read( (char *)&q->wxyz[1], 12 ) == 12 && device->read( (char *)q->wxyz, 4 ) == 4;
+			return readRaw( (char *)&q->wxyz[1], 12 ) && readRaw( (char *)q->wxyz, 4 );
 		}
 	case NifValue::tMatrix:
-		return device->read( (char *)static_cast<Matrix *>( val.val.data )->m, 36 ) == 36;
+		return readRaw( (char *)static_cast<Matrix *>( val.val.data )->m, 36 );
 	case NifValue::tMatrix4:
-		return device->read( (char *)static_cast<Matrix4 *>( val.val.data )->m, 64 ) == 64;
+		return readRaw( (char *)static_cast<Matrix4 *>( val.val.data )->m, 64 );
 	case NifValue::tVector2:
 		{
 			Vector2 * v = static_cast<Vector2 *>( val.val.data );
@@ -1198,7 +1875,7 @@ bool NifIStream::read( NifValue & val )
 			return ( dataStream->status() == QDataStream::Ok );
 		}
 	case NifValue::tColor3:
-		return device->read( (char *)static_cast<Color3 *>( val.val.data )->rgb, 12 ) == 12;
+		return readRaw( (char *)static_cast<Color3 *>( val.val.data )->rgb, 12 );
 	case NifValue::tByteColor4:
 		{
 			quint8 r, g, b, a;
@@ -1433,7 +2110,7 @@ bool NifIStream::read( NifValue & val )
 		{
 			if ( val.val.data ) {
 				QByteArray * array = static_cast<QByteArray *>( val.val.data );
-				return device->read( array->data(), array->size() ) == array->size();
+				return readRaw( array->data(), array->size() );
 			}
 
 			return false;
@@ -1534,16 +2211,10 @@ bool NifOStream::write( const NifValue & val )
 			if ( !vec )
 				return false;
 
-			union { float f; uint32_t i; } xu, yu, zu;
-
-			xu.f = vec->xyz[0];
-			yu.f = vec->xyz[1];
-			zu.f = vec->xyz[2];
-
-			uint16_t v[3];
-			v[0] = half_from_float( xu.i );
-			v[1] = half_from_float( yu.i );
-			v[2] = half_from_float( zu.i );
+			// Padded to four as when reading
+			float f[4] = { vec->xyz[0], vec->xyz[1], vec->xyz[2], 0.0f };
+			uint16_t v[4];
+			half_from_float_n( f, v, 4 );
 	
 			return device->write( (char*)v, 6 ) == 6;
 		}
@@ -1553,14 +2224,9 @@ bool NifOStream::write( const NifValue & val )
 			if ( !vec )
 				return false;
 
-			union { float f; uint32_t i; } xu, yu;
-
-			xu.f = vec->xy[0];
-			yu.f = vec->xy[1];
-
-			uint16_t v[2];
-			v[0] = half_from_float( xu.i );
-			v[1] = half_from_float( yu.i );
+			float f[4] = { vec->xy[0], vec->xy[1], 0.0f, 0.0f };
+			uint16_t v[4];
+			half_from_float_n( f, v, 4 );
 	
 			return device->write( (char*)v, 4 ) == 4;
 		}
@@ -40,6 +40,7 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QPair>
 #include <QString>
 #include <QVariant>
+#include <QVector>
 
 #include <memory>
 
@@ -167,14 +168,29 @@ public:
 	 */
 	void changeType( Type );
 
+	//! Bytes allocated on the heap for the data, beyond the NifValue itself
+	qint64 heapSize() const;
+
+	//! A 64-bit xxHash of the data, which is equal for equal values of the same type
+	quint64 digest( quint64 seed = 0 ) const;
+
+	//! Write the type and the data in the byte order of the machine, for NifModel::saveCached()
+	void saveTo( QDataStream & out ) const;
+	//! Read a value written by saveTo(), false if the stream is broken
+	bool loadFrom( QDataStream & in );
+
 	// *** apparently not used ***
 	//template <typename T> static Type typeId();
 
 	/*! Initialize the class data
 	 *
-	 * Sets typeMap. Clears typeTxt and enumMap (which will be filled later during xml parsing).
+	 * Starts new registries on this thread with the typeMap set, and typeTxt and enumMap
+	 * empty (which will be filled later during xml parsing). The other threads keep
+	 * reading the published registries until publishTypes() is called.
 	 */
 	static void initialize();
+	//! Make the registries filled on this thread the ones every thread reads
+	static void publishTypes();
 
 	/*! Get the Type corresponding to a string typId, as stored in the typeMap.
 	 *
@@ -235,6 +251,13 @@ public:
 	//! Get list of all options that have been registered for the given enum type.
 	static const EnumOptions & enumOptionData( const QString & eid );
 
+	//! A digest of the registered types and their numbers, called after initialize() to identify the built-in types.
+	static quint64 typeSignature();
+	//! Write the type, alias and enum registries, for caching the parsed XML.
+	static void saveTypeMaps( QDataStream & out );
+	//! Replace the type, alias and enum registries with ones written by saveTypeMaps().
+	static bool loadTypeMaps( QDataStream & in );
+
 
 	//! Check if the type is not tNone.
 	static bool isValid( Type t ) { return t != tNone; }
@@ -341,6 +364,37 @@ public:
 	//! Set the data from an instance of type T. Return true if successful.
 	template <typename T> bool set( const T & x );
 
+	//! The registries filled from the XML, never changed once published
+	struct TypeTables
+	{
+		//! A dictionary yielding the Type from a type string.
+		QHash<QString, Type> typeMap;
+
+		/*! A dictionary yielding the enumeration dictionary from a string.
+		 *
+		 * Enums are stored as mappings from quint32 to pairs of strings, where
+		 * the first string in the pair is the enumerant string, and the second
+		 * is the enumerant documentation string. For example,
+		 * enumMap["AlphaFormat"][1] = QPair<"ALPHA_BINARY", "Texture is either fully transparent or fully opaque.">
+		 */
+		QHash<QString, EnumOptions>  enumMap;
+
+		//! A dictionary yielding the documentation string of a type string.
+		QHash<QString, QString>  typeTxt;
+
+		/*! A dictionary yielding the underlying type string from an alias string.
+		 *
+		 * Enums are stored as an underlying type (not always uint) which is normally not visible.
+		 * This dictionary allows that type to be exposed, eg. for NifValue::typeDescription().
+		 */
+		QHash<QString, QString> aliasMap;
+	};
+
+	//! The published registries, or those being filled when called while parsing the XML
+	static const TypeTables & tables();
+	//! The registries being filled on this thread, started by initialize()
+	static TypeTables & buildTables();
+
 protected:
 	//! The type of this data.
 	Type typ = tNone;
@@ -359,6 +413,16 @@ protected:
 	//! The data value.
 	Value val;
 
+	//! Storage for values up to 16 bytes (vectors, colors, quaternions, triangles, strings), avoiding a heap allocation
+	alignas( double ) char inlineData[16];
+
+	//! Create the data of type T, in inlineData if it fits
+	template <typename T> void * construct();
+	//! Destroy the data of type T created by construct()
+	template <typename T> void destroy();
+	//! Bytes of the data of type T created by construct(), 0 if it is in inlineData
+	template <typename T> qint64 allocated() const;
+
 	/*! Get the data as an object of type T.
 	 *
 	 * If the type t is not equal to the actual type of the data, then return T(). Serves
@@ -372,28 +436,6 @@ protected:
 	 * return true. Helper function for set, intended for internal use only.
 	 */
 	template <typename T> bool setType( Type t, T v );
-
-	//! A dictionary yielding the Type from a type string.
-	static QHash<QString, Type> typeMap;
-
-	/*! A dictionary yielding the enumeration dictionary from a string.
-	 *
-	 * Enums are stored as mappings from quint32 to pairs of strings, where
-	 * the first string in the pair is the enumerant string, and the second
-	 * is the enumerant documentation string. For example,
-	 * enumMap["AlphaFormat"][1] = QPair<"ALPHA_BINARY", "Texture is either fully transparent or fully opaque.">
-	 */
-	static QHash<QString, EnumOptions>  enumMap;
-
-	//! A dictionary yielding the documentation string of a type string.
-	static QHash<QString, QString>  typeTxt;
-
-	/*! A dictionary yielding the underlying type string from an alias string.
-	 *
-	 * Enums are stored as an underlying type (not always uint) which is normally not visible.
-	 * This dictionary allows that type to be exposed, eg. for NifValue::typeDescription().
-	 */
-	static QHash<QString, QString> aliasMap;
 };
 
 Q_DECLARE_METATYPE( NifValue )
@@ -419,11 +461,46 @@ public:
 	//! Reads a NifValue from the underlying device. Returns true if successful.
 	bool read( NifValue & );
 
+	/*! Reads raw bytes from the underlying device. Returns true if all bytes were read.
+	 *
+	 * For devices backed by memory (a QBuffer, for example over a mapped file or
+	 * archive contents) the bytes are copied directly without going through QIODevice::read().
+	 */
+	bool readRaw( char * data, qint64 len );
+
+	//! Whether the underlying device is backed by memory
+	bool isMemoryBacked() const { return memory != nullptr; }
+
+	//! The size in bytes of a value of the given type if it can be copied straight from the file, otherwise 0.
+	int fixedSize( NifValue::Type t ) const;
+
+	/*! Reads all children of an array of a fixed-layout type with a single read.
+	 *
+	 * The children must be plain values of the same type, see fixedSize().
+	 */
+	bool readFixedArray( NifItem * array );
+
+	//! The size in bytes of the fields \a rows of a compound if they can all be copied straight from the file, otherwise 0.
+	int fixedRecordSize( const NifItem * element, const QVector<int> & rows ) const;
+
+	/*! Reads the fields \a rows of the elements of an array after the first with a single read.
+	 *
+	 * The fields must be present in every element and of the types of the first, see fixedRecordSize().
+	 */
+	bool readFixedRecords( NifItem * array, const QVector<int> & rows );
+
 private:
 	//! The model that data is being read into.
 	BaseModel * model;
 	//! The underlying device that data is being read from.
 	QIODevice * device;
+	//! The memory backing the device, if any
+	const char * memory = nullptr;
+	//! The size of the memory backing the device
+	qint64 memorySize = 0;
+
+	//! The storage of a fixed-layout value
+	char * fixedStorage( NifValue & val ) const;
 	//! The data stream that is wrapped around the device (simplifies endian conversion)
 	std::unique_ptr<QDataStream> dataStream;
 
@@ -36,7 +36,16 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <QtXml> // QXmlDefaultHandler Inherited
 #include <QApplication>
+#include <QBuffer>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
 #include <QMessageBox>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include <cstring>
+#include <memory>
 
 
 //! \file nifxml.cpp NifXmlHandler, NifModel XML
@@ -44,11 +53,42 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 //! Set NifXmlHandler::errorStr and return
 #define err( X ) { errorStr = X; return false; }
 
+//! Identifies a parsed XML cache file
+#define XML_CACHE_MAGIC 0x4e58434d
+//! Bump when the layout of the parsed XML cache changes
+#define XML_CACHE_VERSION 2
+
 QReadWriteLock             NifModel::XMLlock;
-QList<quint32>             NifModel::supportedVersions;
-QHash<QString, NifBlockPtr> NifModel::compounds;
-QHash<QString, NifBlockPtr> NifModel::fixedCompounds;
-QHash<QString, NifBlockPtr> NifModel::blocks;
+
+//! The schema of the last parse, see NifModel::currentSchema(); empty before the XML was parsed
+/*!
+ * Only accessed through std::atomic_load() and std::atomic_store(), so that a
+ * parse swaps it while other threads copy it.
+ */
+static NifSchemaPtr publishedSchema = std::make_shared<NifSchema>();
+
+QReadWriteLock              NifNames::lock;
+QHash<QString, int>         NifNames::ids;
+
+// documented in nifitem.h
+int NifNames::id( const QString & name )
+{
+	{
+		QReadLocker lck( &lock );
+		auto it = ids.constFind( name );
+		if ( it != ids.constEnd() )
+			return it.value();
+	}
+
+	QWriteLocker lck( &lock );
+	auto it = ids.constFind( name );
+	if ( it != ids.constEnd() )
+		return it.value();
+
+	int id = ids.count();
+	ids.insert( name, id );
+	return id;
+}
 
 //! Parses nif.xml
 class NifXmlHandler final : public QXmlDefaultHandler
@@ -80,7 +120,7 @@ public:
 	static inline QString tr( const char * key, const char * comment = 0 ) { return QCoreApplication::translate( "NifXmlHandler", key, comment ); }
 
 	//! Constructor
-	NifXmlHandler()
+	NifXmlHandler( NifSchema & x ) : xml( x )
 	{
 		depth = 0;
 		tags.insert( "niftoolsxml", tagFile );
@@ -95,6 +135,9 @@ public:
 		blk = 0;
 	}
 
+	//! The XML structures being filled
+	NifSchema & xml;
+
 	//! Current position on stack
 	int depth;
 	//! Tag stack
@@ -185,7 +228,7 @@ public:
 						if ( id.isEmpty() )
 							err( tr( "compound and niblocks must have a name" ) );
 
-						if ( NifModel::compounds.contains( id ) || NifModel::blocks.contains( id ) )
+						if ( xml.compounds.contains( id ) || xml.blocks.contains( id ) )
 							err( tr( "multiple declarations of %1" ).arg( id ) );
 
 						if ( !blk )
@@ -198,14 +241,14 @@ public:
 							blk->ancestor = list.value( "inherit" );
 
 							if ( !blk->ancestor.isEmpty() ) {
-								if ( !NifModel::blocks.contains( blk->ancestor ) )
+								if ( !xml.blocks.contains( blk->ancestor ) )
 									err( tr( "forward declaration of block id %1" ).arg( blk->ancestor ) );
 							}
 						}
 
 						QString externalCond = list.value( "externalcond" );
 						if ( externalCond == "1" ) {
-							NifModel::fixedCompounds.insert( blk->id, blk );
+							xml.fixedCompounds.insert( blk->id, blk );
 						}
 					}
 				}
@@ -243,7 +286,7 @@ public:
 					int v = NifModel::version2number( list.value( "num" ).trimmed() );
 
 					if ( v != 0 && !list.value( "num" ).isEmpty() )
-						NifModel::supportedVersions.append( v );
+						xml.supportedVersions.append( v );
 					else
 						err( tr( "invalid version tag" ) );
 				}
@@ -278,7 +321,7 @@ public:
 					QString bin = list.value( "binary" );
 
 					bool isTemplated = (type == "TEMPLATE" || tmpl == "TEMPLATE");
-					bool isCompound = NifModel::compounds.contains( type );
+					bool isCompound = xml.compounds.contains( type );
 					bool isArray = !arr1.isEmpty();
 					bool isMultiArray = !arr2.isEmpty();
 
@@ -418,10 +461,10 @@ public:
 
 				switch ( x ) {
 				case tagCompound:
-					NifModel::compounds.insert( blk->id, blk );
+					xml.compounds.insert( blk->id, blk );
 					break;
 				case tagBlock:
-					NifModel::blocks.insert( blk->id, blk );
+					xml.blocks.insert( blk->id, blk );
 					break;
 				default:
 					break;
@@ -494,7 +537,7 @@ public:
 	//! Checks that the type of the data is valid
 	bool checkType( const NifData & data )
 	{
-		return ( NifModel::compounds.contains( data.type() )
+		return ( xml.compounds.contains( data.type() )
 		        || NifValue::type( data.type() ) != NifValue::tNone
 		        || data.type() == "TEMPLATE"
 		);
@@ -506,8 +549,8 @@ public:
 		return ( data.temp().isEmpty()
 		        || NifValue::type( data.temp() ) != NifValue::tNone
 		        || data.temp() == "TEMPLATE"
-		        || NifModel::blocks.contains( data.temp() )
-		        || NifModel::compounds.contains( data.temp() )
+		        || xml.blocks.contains( data.temp() )
+		        || xml.compounds.contains( data.temp() )
 		);
 	}
 
@@ -515,8 +558,8 @@ public:
 	bool endDocument() override final
 	{
 		// make a rough check of the maps
-		for ( const QString& key : NifModel::compounds.keys() ) {
-			NifBlockPtr c = NifModel::compounds.value( key );
+		for ( const QString& key : xml.compounds.keys() ) {
+			NifBlockPtr c = xml.compounds.value( key );
 			for ( NifData data :c->types ) {
 				if ( !checkType( data ) )
 					err( tr( "compound type %1 refers to unknown type %2" ).arg( key, data.type() ) );
@@ -529,10 +572,10 @@ public:
 			}
 		}
 
-		for ( const QString& key : NifModel::blocks.keys() ) {
-			NifBlockPtr blk = NifModel::blocks.value( key );
+		for ( const QString& key : xml.blocks.keys() ) {
+			NifBlockPtr blk = xml.blocks.value( key );
 
-			if ( !blk->ancestor.isEmpty() && !NifModel::blocks.contains( blk->ancestor ) )
+			if ( !blk->ancestor.isEmpty() && !xml.blocks.contains( blk->ancestor ) )
 				err( tr( "niobject %1 inherits unknown ancestor %2" ).arg( key, blk->ancestor ) );
 
 			if ( blk->ancestor == key )
@@ -593,39 +636,338 @@ bool NifModel::loadXML()
 	return true;
 }
 
+// documented in nifmodel.h
+NifSchemaPtr NifModel::currentSchema()
+{
+	return std::atomic_load( &publishedSchema );
+}
+
 // documented in nifmodel.h
 QString NifModel::parseXmlDescription( const QString & filename )
 {
+	// Only one parse at a time; loads keep reading the published schema meanwhile
 	QWriteLocker lck( &XMLlock );
 
-	compounds.clear();
-	blocks.clear();
+	// The replaced schema is released by the last model or load still holding it
+	std::shared_ptr<NifSchema> xml = std::make_shared<NifSchema>();
 
-	supportedVersions.clear();
+	auto publish = [xml]() {
+		NifValue::publishTypes();
+		std::atomic_store( &publishedSchema, NifSchemaPtr( xml ) );
+	};
 
 	NifValue::initialize();
 
 	QFile f( filename );
 
-	if ( !f.exists() )
+	if ( !f.exists() ) {
+		publish();
 		return tr( "nif.xml could not be found. Please install it and restart the application." );
+	}
 
-	if ( !f.open( QIODevice::ReadOnly | QIODevice::Text ) )
+	if ( !f.open( QIODevice::ReadOnly | QIODevice::Text ) ) {
+		publish();
 		return tr( "Couldn't open NIF XML description file: %1" ).arg( filename );
+	}
+
+	QByteArray data = f.readAll();
+
+	// The caches also depend on the build, whose types may be added or numbered differently
+	QCryptographicHash xmlHash( QCryptographicHash::Sha1 );
+	xmlHash.addData( data );
+	xmlHash.addData( NIFSKOPE_VERSION );
+	const quint64 types = NifValue::typeSignature();
+	xmlHash.addData( reinterpret_cast<const char *>( &types ), sizeof( types ) );
+
+	QByteArray hash = xmlHash.result();
+	xml->hash = hash;
+
+	// Skip parsing when the cache was written for this exact XML
+	QString cacheDir = QStandardPaths::writableLocation( QStandardPaths::CacheLocation );
+	QString cachename = cacheDir.isEmpty() ? QString() : QDir( cacheDir ).filePath( "nif.xml.cache" );
+
+	if ( !cachename.isEmpty() && loadXmlCache( *xml, cachename, hash ) ) {
+		indexDependencies( *xml );
+		indexBlockTypes( *xml );
+		publish();
+		return QString();
+	}
+
+	QBuffer buffer( &data );
+	buffer.open( QIODevice::ReadOnly );
 
-	NifXmlHandler handler;
+	NifXmlHandler handler( *xml );
 	QXmlSimpleReader reader;
 	reader.setContentHandler( &handler );
 	reader.setErrorHandler( &handler );
-	QXmlInputSource source( &f );
+	QXmlInputSource source( &buffer );
 	reader.parse( source );
 
 	if ( !handler.errorString().isEmpty() ) {
-		compounds.clear();
-		blocks.clear();
-		supportedVersions.clear();
+		xml->compounds.clear();
+		xml->blocks.clear();
+		xml->supportedVersions.clear();
+	} else {
+		indexDependencies( *xml );
+		indexBlockTypes( *xml );
+
+		if ( !cachename.isEmpty() ) {
+			QDir().mkpath( cacheDir );
+			saveXmlCache( *xml, cachename, hash );
+		}
 	}
 
+	publish();
+
 	return handler.errorString();
 }
 
+//! Write the XML description of a single data item
+static void saveXmlData( QDataStream & out, const NifData & data )
+{
+	out << data.name() << data.type() << data.temp() << data.arg()
+	    << data.arr1() << data.arr2() << data.cond() << data.ver1() << data.ver2()
+	    << data.text() << data.vercond();
+
+	out << data.isAbstract() << data.isBinary() << data.isTemplated() << data.isCompound()
+	    << data.isArray() << data.isMultiArray() << data.isConditionless();
+
+	// Default value
+	const NifValue & v = data.value;
+	if ( v.isCount() || v.isFloat() )
+		out << v.toCount();
+	else if ( v.isFileVersion() )
+		out << v.toFileVersion();
+	else if ( v.isLink() )
+		out << quint32( v.toLink() );
+	else
+		out << v.toString();
+}
+
+//! Read the XML description of a single data item written by saveXmlData()
+static NifData loadXmlData( QDataStream & in )
+{
+	QString name, type, temp, arg, arr1, arr2, cond, text, vercond;
+	quint32 ver1, ver2;
+	in >> name >> type >> temp >> arg >> arr1 >> arr2 >> cond >> ver1 >> ver2 >> text >> vercond;
+
+	bool abs, bin, tmpl, cmpd, arr, marr, condless;
+	in >> abs >> bin >> tmpl >> cmpd >> arr >> marr >> condless;
+
+	NifData data( name, type, temp, NifValue( NifValue::type( type ) ), arg, arr1, arr2, cond, ver1, ver2 );
+
+	data.setAbstract( abs );
+	data.setBinary( bin );
+	data.setTemplated( tmpl );
+	data.setIsCompound( cmpd );
+	data.setIsArray( arr );
+	data.setIsMultiArray( marr );
+	data.setIsConditionless( condless );
+	data.setText( text );
+
+	if ( !vercond.isEmpty() )
+		data.setVerCond( vercond );
+
+	NifValue & v = data.value;
+	if ( v.isCount() || v.isFileVersion() ) {
+		quint32 c;
+		in >> c;
+		v.isCount() ? v.setCount( c ) : v.setFileVersion( c );
+	} else if ( v.isFloat() ) {
+		quint32 c;
+		in >> c;
+		float f;
+		memcpy( &f, &c, 4 );
+		v.setFloat( f );
+	} else if ( v.isLink() ) {
+		quint32 l;
+		in >> l;
+		v.setLink( qint32( l ) );
+	} else {
+		QString s;
+		in >> s;
+		if ( !s.isEmpty() )
+			v.setFromString( s );
+	}
+
+	return data;
+}
+
+//! Write the XML descriptions of compounds or blocks
+static void saveXmlBlocks( QDataStream & out, const QHash<QString, NifBlockPtr> & hash )
+{
+	out << quint32( hash.count() );
+	for ( NifBlockPtr blk : hash ) {
+		out << blk->id << blk->ancestor << blk->text << blk->abstract;
+
+		out << quint32( blk->types.count() );
+		for ( const NifData & data : blk->types )
+			saveXmlData( out, data );
+	}
+}
+
+//! Read the XML descriptions of compounds or blocks written by saveXmlBlocks()
+static bool loadXmlBlocks( QDataStream & in, QHash<QString, NifBlockPtr> & hash )
+{
+	quint32 count = 0;
+	in >> count;
+	for ( quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++ ) {
+		NifBlockPtr blk = NifBlockPtr( new NifBlock );
+		in >> blk->id >> blk->ancestor >> blk->text >> blk->abstract;
+
+		quint32 ntypes = 0;
+		in >> ntypes;
+		for ( quint32 t = 0; t < ntypes && in.status() == QDataStream::Ok; t++ )
+			blk->types.append( loadXmlData( in ) );
+
+		hash.insert( blk->id, blk );
+	}
+
+	return in.status() == QDataStream::Ok;
+}
+
+// documented in nifmodel.h
+bool NifModel::loadXmlCache( NifSchema & xml, const QString & cachename, const QByteArray & hash )
+{
+	QFile f( cachename );
+
+	if ( !f.open( QIODevice::ReadOnly ) )
+		return false;
+
+	QByteArray data = f.readAll();
+	QDataStream in( data );
+	in.setVersion( QDataStream::Qt_5_0 );
+
+	quint32 magic = 0, cacheVersion = 0;
+	QByteArray cacheHash;
+	in >> magic >> cacheVersion >> cacheHash;
+
+	if ( magic != XML_CACHE_MAGIC || cacheVersion != XML_CACHE_VERSION || cacheHash != hash )
+		return false;
+
+	// The enum and alias types must be known before the data items are created
+	if ( !NifValue::loadTypeMaps( in ) )
+		return false;
+
+	in >> xml.supportedVersions;
+
+	QHash<QString, NifBlockPtr> cmpds, blks;
+	QStringList fixedIds;
+
+	bool ok = loadXmlBlocks( in, cmpds ) && loadXmlBlocks( in, blks );
+	in >> fixedIds;
+
+	if ( !ok || in.status() != QDataStream::Ok ) {
+		NifValue::initialize();
+		xml.supportedVersions.clear();
+		return false;
+	}
+
+	xml.compounds = cmpds;
+	xml.blocks = blks;
+
+	// Fixed compounds share their description with compounds
+	xml.fixedCompounds.clear();
+	for ( const QString & id : fixedIds ) {
+		if ( xml.compounds.contains( id ) )
+			xml.fixedCompounds.insert( id, xml.compounds.value( id ) );
+		else if ( xml.blocks.contains( id ) )
+			xml.fixedCompounds.insert( id, xml.blocks.value( id ) );
+	}
+
+	return true;
+}
+
+// documented in nifmodel.h
+void NifModel::saveXmlCache( const NifSchema & xml, const QString & cachename, const QByteArray & hash )
+{
+	QSaveFile f( cachename );
+
+	if ( !f.open( QIODevice::WriteOnly ) )
+		return;
+
+	QDataStream out( &f );
+	out.setVersion( QDataStream::Qt_5_0 );
+
+	out << quint32( XML_CACHE_MAGIC ) << quint32( XML_CACHE_VERSION ) << hash;
+
+	NifValue::saveTypeMaps( out );
+
+	out << xml.supportedVersions;
+
+	saveXmlBlocks( out, xml.compounds );
+	saveXmlBlocks( out, xml.blocks );
+	out << QStringList( xml.fixedCompounds.keys() );
+
+	f.commit();
+}
+
+//! Collect the fields of a block after those of its ancestors, in the order they are inserted
+static void collectXmlFields( const QHash<QString, NifBlockPtr> & hash, const NifBlockPtr & blk, QList<NifData *> & fields )
+{
+	if ( !blk )
+		return;
+
+	if ( !blk->ancestor.isEmpty() && blk->ancestor != blk->id )
+		collectXmlFields( hash, hash.value( blk->ancestor ), fields );
+
+	for ( NifData & data : blk->types )
+		fields.append( &data );
+}
+
+//! Add the later fields whose cond or arg mention each field to its dependents
+static void indexXmlDependencies( const QHash<QString, NifBlockPtr> & hash, QHash<NifData *, QVector<int>> & dependents )
+{
+	for ( const NifBlockPtr & blk : hash ) {
+		QList<NifData *> fields;
+		collectXmlFields( hash, blk, fields );
+
+		for ( int i = 0; i < fields.count(); i++ ) {
+			const QString & name = fields[i]->name();
+			if ( name.isEmpty() )
+				continue;
+
+			QVector<int> & ids = dependents[ fields[i] ];
+
+			// Same substring test as the unindexed walk, so it may include some false positives
+			for ( int j = i; j < fields.count(); j++ ) {
+				const NifData * c = fields[j];
+				if ( ( c->cond().contains( name ) || c->arg().contains( name ) ) && !ids.contains( c->nameId() ) )
+					ids.append( c->nameId() );
+			}
+		}
+	}
+}
+
+// documented in nifmodel.h
+void NifModel::indexDependencies( NifSchema & xml )
+{
+	// Ancestor fields are shared by every descendant, so they collect the dependents of all of them
+	QHash<NifData *, QVector<int>> dependents;
+	indexXmlDependencies( xml.compounds, dependents );
+	indexXmlDependencies( xml.blocks, dependents );
+
+	for ( auto it = dependents.begin(); it != dependents.end(); ++it )
+		it.key()->setDependents( it.value() );
+}
+
+// documented in nifmodel.h
+void NifModel::indexBlockTypes( NifSchema & xml )
+{
+	QStringList ids = xml.blocks.keys();
+	ids.sort();
+
+	for ( int i = 0; i < ids.count(); i++ )
+		xml.blocks[ids.at( i )]->typeId = i;
+
+	for ( const NifBlockPtr & blk : xml.blocks ) {
+		blk->ancestry = QBitArray( ids.count() );
+
+		// The count guards against ancestor cycles in a broken XML
+		NifBlockPtr type = blk;
+		for ( int depth = 0; type && depth < ids.count(); depth++ ) {
+			blk->ancestry.setBit( type->typeId );
+			type = type->ancestor.isEmpty() ? NifBlockPtr() : xml.blocks.value( type->ancestor );
+		}
+	}
+}
@@ -34,6 +34,7 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <QDebug>
 #include <QByteArray>
+#include <QMutex>
 
 #ifdef _MSC_VER
 #pragma warning(push)
@@ -88,6 +89,9 @@ extern "C"
 
 // TODO: investigate the C++ interfaces to Qhull; the Qt interface requires GCC 4.3
 
+//! Serializes the use of the Qhull globals
+static QMutex qhullMutex;
+
 //! An interface to <a href="http://www.qhull.org">Qhull</a> for generating Havok-compatible convex shapes
 QVector<Triangle> compute_convex_hull( const QVector<Vector3> & verts, QVector<Vector4> & hullVerts, QVector<Vector4> & hullNorms, float roundError )
 {
@@ -139,6 +143,8 @@ QVector<Triangle> compute_convex_hull( const QVector<Vector3> & verts, QVector<V
 		points[i * 3 + 2] = verts[i][2];
 	}
 
+	QMutexLocker lock( &qhullMutex );
+
 	/* initialize dim, numpoints, points[], ismalloc here */
 	exitcode = qh_new_qhull( dim, numpoints, points, ismalloc,
 		flags, outfile, errfile );
@@ -42,6 +42,7 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 //! Computes a convex hull using <a href="http://www.qhull.org">Qhull</a>,
 //! Copyright (c) 1993-2010 C.B. Barber and The Geometry Center.
+//! Qhull keeps its state in globals, so calls from several threads run one at a time.
 QVector<Triangle> compute_convex_hull( const QVector<Vector3> & verts,
                                        QVector<Vector4> & hullVerts,
                                        QVector<Vector4> & hullNorms,
@@ -3,6 +3,9 @@
 #include "widgets/colorwheel.h"
 #include "widgets/floatslider.h"
 #include "ui/settingsdialog.h"
+#include "gl/gltex.h"
+#include "material.h"
+#include "settingssnapshot.h"
 
 #include "ui_settingsgeneral.h"
 #include "ui_settingsrender.h"
@@ -529,6 +532,8 @@ SettingsResources::SettingsResources( QWidget * parent ) :
 			ui->btnArchiveDown->setEnabled( idx.row() < archives->rowCount() - 1 );
 		}
 	);
+
+	connect( ui->archiveCacheSize, static_cast<void (QSpinBox::*)(int)>(&QSpinBox::valueChanged), this, &SettingsPane::modifyPane );
 }
 
 SettingsResources::~SettingsResources()
@@ -549,6 +554,11 @@ void SettingsResources::read()
 	ui->archivesList->setCurrentIndex( archives->index( 0, 0 ) );
 
 	ui->chkAlternateExt->setChecked( settings.value( "Settings/Resources/Alternate Extensions", true ).toBool() );
+	ui->archiveCacheSize->setValue( settings.value( "Settings/Resources/Archive Cache Size", 256 ).toInt() );
+
+	auto stats = FSManager::cacheStats();
+	ui->archiveCacheStats->setText( tr( "%1 hits, %2 misses, %3 of %4 MB used" )
+		.arg( stats.hits ).arg( stats.misses ).arg( stats.size / 1024 ).arg( stats.budget / 1024 ) );
 
 	setModified( false );
 }
@@ -563,15 +573,17 @@ void SettingsResources::write()
 	settings.setValue( "Settings/Resources/Folders", folders->stringList() );
 	settings.setValue( "Settings/Resources/Archives", archives->stringList() );
 
-	// Sync FSManager to Archives list
-	archiveMgr->archives.clear();
-	for ( const QString an : archives->stringList() ) {
-		if ( !archiveMgr->archives.contains( an ) )
-			if ( auto a = FSArchiveHandler::openArchive( an ) )
-				archiveMgr->archives.insert( an, a );
-	}
+	// Sync FSManager to Archives list, only the added archives are opened
+	archiveMgr->openArchives( archives->stringList() );
 
 	settings.setValue( "Settings/Resources/Alternate Extensions", ui->chkAlternateExt->isChecked() );
+	settings.setValue( "Settings/Resources/Archive Cache Size", ui->archiveCacheSize->value() );
+	FSManager::updateCacheSize();
+
+	// The folders, archives and alternate extensions decide where textures and materials are found
+	SettingsSnapshot::rebuild();
+	TexCache::clearFound();
+	MaterialCache::instance()->clear();
 
 	setModified( false );
 
@@ -0,0 +1,76 @@
+/***** BEGIN LICENSE BLOCK *****
+
+BSD License
+
+Copyright (c) 2005-2015, NIF File Format Library and Tools
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the NIF File Format Library and Tools project may not be
+   used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+***** END LICENCE BLOCK *****/
+
+#include "settingssnapshot.h"
+
+#include <QSettings>
+
+#include <atomic>
+
+
+//! \file settingssnapshot.cpp SettingsSnapshot implementation
+
+//! Replaced as a whole by rebuild(), readers keep the snapshot they got
+static std::shared_ptr<const SettingsSnapshot> current;
+
+std::shared_ptr<const SettingsSnapshot> SettingsSnapshot::get()
+{
+	auto snapshot = std::atomic_load( &current );
+
+	if ( !snapshot ) {
+		rebuild();
+		snapshot = std::atomic_load( &current );
+	}
+
+	return snapshot;
+}
+
+void SettingsSnapshot::rebuild()
+{
+	auto snapshot = std::make_shared<SettingsSnapshot>();
+
+	QSettings settings;
+
+	snapshot->ignoreBlockSize = settings.value( "Ignore Block Size", false ).toBool();
+	snapshot->parallelLoading = settings.value( "Parallel Block Loading", false ).toBool();
+	snapshot->lazyLoading = settings.value( "Lazy Block Loading", false ).toBool();
+	snapshot->incrementalSave = settings.value( "Incremental Save", false ).toBool();
+	snapshot->profileBlocks = settings.value( "Profile Blocks", false ).toBool();
+	snapshot->documentCache = settings.value( "Document Cache", false ).toBool();
+
+	snapshot->resourceFolders = settings.value( "Settings/Resources/Folders", QStringList() ).toStringList();
+	snapshot->alternateExtensions = settings.value( "Settings/Resources/Alternate Extensions", false ).toBool();
+
+	snapshot->anisotropicFiltering = settings.value( "Settings/Render/General/Anisotropic Filtering", 4.0 ).toFloat();
+
+	std::atomic_store( &current, std::shared_ptr<const SettingsSnapshot>( snapshot ) );
+}
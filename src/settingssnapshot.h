@@ -0,0 +1,78 @@
+/***** BEGIN LICENSE BLOCK *****
+
+BSD License
+
+Copyright (c) 2005-2015, NIF File Format Library and Tools
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the NIF File Format Library and Tools project may not be
+   used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+***** END LICENCE BLOCK *****/
+
+#ifndef SETTINGSSNAPSHOT_H
+#define SETTINGSSNAPSHOT_H
+
+#include <QStringList>
+
+#include <memory>
+
+
+//! \file settingssnapshot.h SettingsSnapshot
+
+//! The settings read for every file, texture or material
+/*!
+ * Reading QSettings locks and parses the settings store, so the values used
+ * on the hot paths are read once into an immutable snapshot. The snapshot is
+ * rebuilt when the settings are saved, see SettingsDialog::apply().
+ */
+struct SettingsSnapshot final
+{
+	// NIF loading, see NifModel::load()
+
+	bool ignoreBlockSize = false;
+	bool parallelLoading = false;
+	bool lazyLoading = false;
+	bool incrementalSave = false;
+	//! Time each block type, see NifModel::blockProfile()
+	bool profileBlocks = false;
+	//! Restore unchanged files from a cache of their parsed items, see NifModel::loadCached()
+	bool documentCache = false;
+
+	// Resources, see TexCache::find() and Material::find()
+
+	QStringList resourceFolders;
+	bool alternateExtensions = false;
+
+	// Rendering
+
+	//! Exponent of the anisotropic filtering level, see get_max_anisotropy()
+	float anisotropicFiltering = 4.0f;
+
+	//! The current snapshot; safe to call from any thread
+	static std::shared_ptr<const SettingsSnapshot> get();
+	//! Read the settings into a new snapshot, after they changed
+	static void rebuild();
+};
+
+#endif
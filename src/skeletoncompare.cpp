@@ -0,0 +1,244 @@
+/***** BEGIN LICENSE BLOCK *****
+
+BSD License
+
+Copyright (c) 2005-2015, NIF File Format Library and Tools
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the NIF File Format Library and Tools project may not be
+   used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+***** END LICENCE BLOCK *****/
+
+#include "skeletoncompare.h"
+
+#include "nifmodel.h"
+
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QSet>
+#include <QStack>
+#include <QTextStream>
+
+#include <algorithm> // std::sort
+#include <cmath>
+#include <functional>
+
+
+//! \file skeletoncompare.cpp SkeletonCompare implementation
+
+//! Call \a node with the name and local transform of every node below the roots of a NIF
+/*!
+ * The roots themselves are the scenes of the files rather than bones, so they are skipped.
+ */
+static void forEachNode( const NifModel * nif, const std::function<void( const QString &, const Transform & )> & node )
+{
+	QStack<int> stack;
+	QSet<int> visited;
+
+	for ( const auto root : nif->getRootLinks() ) {
+		visited.insert( root );
+
+		for ( const auto link : nif->getChildLinks( root ) )
+			stack.push( link );
+	}
+
+	while ( !stack.isEmpty() ) {
+		int b = stack.pop();
+		QModelIndex iNode = nif->getBlock( b, "NiNode" );
+
+		if ( !iNode.isValid() || visited.contains( b ) )
+			continue;
+
+		visited.insert( b );
+
+		QString name = nif->get<QString>( iNode, "Name" );
+
+		if ( !name.isEmpty() )
+			node( name, Transform( nif, iNode ) );
+
+		for ( const auto link : nif->getChildLinks( b ) )
+			stack.push( link );
+	}
+}
+
+SkeletonCompare::SkeletonCompare()
+{
+}
+
+SkeletonCompare::~SkeletonCompare()
+{
+}
+
+bool SkeletonCompare::setReference( const QString & file )
+{
+	bones.clear();
+	boneIndex.clear();
+
+	auto add = [this]( const QString & name, const Transform & local ) {
+		if ( boneIndex.contains( name ) )
+			return;
+
+		boneIndex.insert( name, bones.count() );
+		bones.append( { name, local } );
+	};
+
+	if ( file.endsWith( ".dat", Qt::CaseInsensitive ) ) {
+		// The format written by spScanSkeleton: name, local and world transforms, ending with an empty name
+		QFile f( file );
+
+		if ( !f.open( QIODevice::ReadOnly ) )
+			return false;
+
+		QDataStream stream( &f );
+		QString name;
+		Transform local, world;
+
+		for ( stream >> name; !name.isEmpty() && stream.status() == QDataStream::Ok; stream >> name ) {
+			stream >> local >> world;
+			add( name, local );
+		}
+	} else {
+		NifModel nif;
+
+		if ( !nif.loadFromFile( file ) )
+			return false;
+
+		forEachNode( &nif, add );
+	}
+
+	return !bones.isEmpty();
+}
+
+bool SkeletonCompare::run( const QString & input, bool recursive )
+{
+	QStringList extensions{ "*.nif", "*.nifcache", "*.kf", "*.kfa" };
+
+	if ( !runner.open( input, extensions, recursive ) )
+		return false;
+
+	runner.run( [this]( NifModel & nif, const QString & file ) {
+		Result result = compare( nif, file );
+
+		QMutexLocker lock( &resultMutex );
+		results.append( result );
+	} );
+
+	runner.close();
+
+	return true;
+}
+
+SkeletonCompare::Result SkeletonCompare::compare( NifModel & nif, const QString & file ) const
+{
+	Result result;
+	result.file = runner.filePath( file );
+
+	if ( !runner.load( nif, file ) ) {
+		result.error = tr( "could not be loaded" );
+		return result;
+	}
+
+	QVector<bool> found( bones.count(), false );
+
+	forEachNode( &nif, [&]( const QString & name, const Transform & local ) {
+		int b = boneIndex.value( name, -1 );
+
+		if ( b < 0 ) {
+			result.extra << name;
+		} else if ( !found[b] ) {
+			found[b] = true;
+
+			if ( differs( local, bones[b].local ) )
+				result.transformed << name;
+		}
+	} );
+
+	for ( int b = 0; b < bones.count(); b++ ) {
+		if ( !found[b] )
+			result.missing << bones[b].name;
+	}
+
+	return result;
+}
+
+bool SkeletonCompare::differs( const Transform & a, const Transform & b ) const
+{
+	if ( !( std::fabs( a.scale - b.scale ) <= tolerance ) )
+		return true;
+
+	for ( int i = 0; i < 3; i++ ) {
+		if ( !( std::fabs( a.translation[i] - b.translation[i] ) <= tolerance ) )
+			return true;
+
+		for ( int j = 0; j < 3; j++ ) {
+			if ( !( std::fabs( a.rotation( i, j ) - b.rotation( i, j ) ) <= tolerance ) )
+				return true;
+		}
+	}
+
+	return false;
+}
+
+void SkeletonCompare::report( QTextStream & out ) const
+{
+	QMutexLocker lock( &resultMutex );
+
+	QVector<Result> sorted = results;
+	std::sort( sorted.begin(), sorted.end(), []( const Result & a, const Result & b ) {
+		return a.file < b.file;
+	} );
+
+	out << "File\tMissing\tExtra\tTransformed\tMissing Bones\tExtra Bones\tTransformed Bones\n";
+
+	for ( const Result & r : sorted ) {
+		out << QDir::toNativeSeparators( r.file ) << '\t';
+
+		if ( !r.error.isEmpty() ) {
+			out << r.error << '\n';
+			continue;
+		}
+
+		out << r.missing.count() << '\t' << r.extra.count() << '\t' << r.transformed.count() << '\t'
+		    << r.missing.join( ", " ) << '\t' << r.extra.join( ", " ) << '\t' << r.transformed.join( ", " ) << '\n';
+	}
+}
+
+int SkeletonCompare::differing() const
+{
+	QMutexLocker lock( &resultMutex );
+
+	return std::count_if( results.constBegin(), results.constEnd(), []( const Result & r ) {
+		return r.error.isEmpty() && !( r.missing.isEmpty() && r.extra.isEmpty() && r.transformed.isEmpty() );
+	} );
+}
+
+int SkeletonCompare::failed() const
+{
+	QMutexLocker lock( &resultMutex );
+
+	return std::count_if( results.constBegin(), results.constEnd(), []( const Result & r ) {
+		return !r.error.isEmpty();
+	} );
+}
@@ -0,0 +1,125 @@
+/***** BEGIN LICENSE BLOCK *****
+
+BSD License
+
+Copyright (c) 2005-2015, NIF File Format Library and Tools
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the NIF File Format Library and Tools project may not be
+   used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+***** END LICENCE BLOCK *****/
+
+#ifndef SKELETONCOMPARE_H
+#define SKELETONCOMPARE_H
+
+#include "batchrunner.h"
+#include "niftypes.h"
+
+#include <QCoreApplication>
+#include <QHash>
+#include <QMutex>
+#include <QStringList>
+#include <QVector>
+
+
+//! \file skeletoncompare.h SkeletonCompare
+
+class NifModel;
+class QTextStream;
+
+//! Compares the bones of every file of a folder or archive with a reference skeleton
+/*!
+ * The reference is read once and its bones indexed by name, then worker
+ * threads load the files with their own NifModel and look each node up in
+ * the index. Nothing is written back; the results are printed as a table.
+ *
+ * Used by <tt>NifSkope -no-gui --skeleton ...</tt>, see main().
+ */
+class SkeletonCompare final
+{
+	Q_DECLARE_TR_FUNCTIONS( SkeletonCompare )
+
+public:
+	SkeletonCompare();
+	~SkeletonCompare();
+
+	//! Read the reference skeleton from a NIF or a skel.dat file, returning false if it has no bones
+	bool setReference( const QString & file );
+	//! Set how far a local transform may be from the reference, in each component
+	void setTolerance( float tol ) { tolerance = qMax( 0.0f, tol ); }
+	//! Set the number of worker threads
+	void setThreads( int num ) { runner.setThreads( num ); }
+
+	//! Compare the NIFs below a directory, in an archive, or a single NIF
+	/*!
+	 * \param input		A directory, an archive or a file
+	 * \param recursive	Whether to include the sub directories of a directory
+	 * \return			False if the input could not be opened
+	 */
+	bool run( const QString & input, bool recursive );
+
+	//! Print a tab separated row per file compared so far, sorted by file
+	void report( QTextStream & out ) const;
+
+	//! The number of files which differ from the reference
+	int differing() const;
+	//! The number of files which could not be loaded
+	int failed() const;
+
+protected:
+	//! A bone of the reference skeleton
+	struct Bone
+	{
+		QString name;
+		Transform local;
+	};
+
+	//! The bones of a file which differ from the reference
+	struct Result
+	{
+		QString file;
+		QString error;
+		QStringList missing;
+		QStringList extra;
+		QStringList transformed;
+	};
+
+	//! Load and compare a file
+	Result compare( NifModel & nif, const QString & file ) const;
+	//! Whether two local transforms are further apart than the tolerance
+	bool differs( const Transform & a, const Transform & b ) const;
+
+	QVector<Bone> bones;
+	//! The index in bones of each bone name
+	QHash<QString, int> boneIndex;
+	float tolerance = 0.001f;
+
+	BatchRunner runner;
+
+	//! Serializes adding to results
+	mutable QMutex resultMutex;
+	QVector<Result> results;
+};
+
+#endif
@@ -0,0 +1,143 @@
+/***** BEGIN LICENSE BLOCK *****
+
+BSD License
+
+Copyright (c) 2005-2015, NIF File Format Library and Tools
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the NIF File Format Library and Tools project may not be
+   used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+***** END LICENCE BLOCK *****/
+
+#include "spellbatch.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+
+
+//! \file spellbatch.cpp SpellBatch implementation
+
+const QString SpellBatch::sanitizeName = "Sanitize";
+
+SpellBatch::SpellBatch()
+{
+}
+
+SpellBatch::~SpellBatch()
+{
+}
+
+QStringList SpellBatch::setSpells( const QStringList & names )
+{
+	QStringList errors;
+	spells.clear();
+
+	for ( const QString & name : names ) {
+		// A null spell stands for the sanitizing spells
+		if ( name.compare( sanitizeName, Qt::CaseInsensitive ) == 0 ) {
+			spells << nullptr;
+			continue;
+		}
+
+		SpellPtr spell = SpellBook::lookup( name );
+
+		if ( !spell )
+			errors << tr( "Unknown spell: %1" ).arg( name );
+		else if ( spell->interactive() )
+			errors << tr( "%1 asks for input and cannot run without the GUI" ).arg( name );
+		else
+			spells << spell;
+	}
+
+	return errors;
+}
+
+bool SpellBatch::run( const QString & input, bool recursive )
+{
+	QStringList extensions{ "*.nif", "*.nifcache", "*.texcache", "*.pcpatch", "*.kf", "*.kfa" };
+
+	if ( !runner.open( input, extensions, recursive ) )
+		return false;
+
+	// Changes to the files of an archive can only be written to the mirror tree
+	if ( runner.getArchive() && output.isEmpty() ) {
+		runner.close();
+		return false;
+	}
+
+	runner.run( [this]( NifModel & nif, const QString & file ) {
+		QString error = process( nif, file );
+
+		if ( error.isEmpty() ) {
+			numSaved.ref();
+		} else {
+			numFailed.ref();
+			qCWarning( ns ) << file << ":" << error;
+		}
+	} );
+
+	runner.close();
+
+	return true;
+}
+
+QString SpellBatch::process( NifModel & nif, const QString & file )
+{
+	if ( !runner.load( nif, file ) )
+		return tr( "could not be loaded" );
+
+	bool old = nif.holdUpdates( true );
+
+	for ( SpellPtr spell : spells ) {
+		if ( !spell )
+			SpellBook::sanitize( &nif );
+		else
+			spell->castIfApplicable( &nif, QModelIndex() );
+	}
+
+	if ( !old )
+		nif.holdUpdates( false );
+
+	// Files of an archive are named relative to it, files of a directory are below the root
+	QString target = file;
+
+	if ( !output.isEmpty() ) {
+		QString relative = runner.getArchive() ? file : QDir( runner.getRoot() ).relativeFilePath( file );
+		target = QDir( output ).filePath( relative );
+
+		QMutexLocker lock( &dirMutex );
+
+		if ( !QDir().mkpath( QFileInfo( target ).absolutePath() ) )
+			return tr( "could not create the folder of %1" ).arg( target );
+	}
+
+	// Write a temporary file and replace the target once it is complete
+	QSaveFile f( target );
+
+	if ( !f.open( QIODevice::WriteOnly ) || !nif.save( f ) || !f.commit() )
+		return tr( "could not be saved to %1: %2" ).arg( target, f.errorString() );
+
+	return QString();
+}
@@ -0,0 +1,106 @@
+/***** BEGIN LICENSE BLOCK *****
+
+BSD License
+
+Copyright (c) 2005-2015, NIF File Format Library and Tools
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the NIF File Format Library and Tools project may not be
+   used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+***** END LICENCE BLOCK *****/
+
+#ifndef SPELLBATCH_H
+#define SPELLBATCH_H
+
+#include "batchrunner.h"
+#include "spellbook.h"
+
+#include <QAtomicInt>
+#include <QCoreApplication>
+#include <QMutex>
+#include <QStringList>
+
+
+//! \file spellbatch.h SpellBatch
+
+//! Applies a chain of spells to every file of a folder or archive
+/*!
+ * Every worker thread loads, casts and saves one file at a time with its own
+ * NifModel. The spells are cast on the root index, so the chain is made of
+ * the spells which work on the whole file, such as those on the Batch page.
+ * Spells asking for input, see Spell::interactive(), are rejected by setSpells().
+ *
+ * Used by <tt>NifSkope -no-gui --spell ...</tt>, see main().
+ */
+class SpellBatch final
+{
+	Q_DECLARE_TR_FUNCTIONS( SpellBatch )
+
+public:
+	//! The name which stands for SpellBook::sanitize() in the chain
+	static const QString sanitizeName;
+
+	SpellBatch();
+	~SpellBatch();
+
+	//! Set the chain of spells by their "Page/Name"
+	/*!
+	 * \return	An error for each name which was not found or is an interactive spell,
+	 * 			empty if the chain can be cast
+	 */
+	QStringList setSpells( const QStringList & names );
+	//! Write below \a directory, mirroring the input tree, instead of replacing the files
+	void setOutput( const QString & directory ) { output = directory; }
+	//! Set the number of worker threads
+	void setThreads( int num ) { runner.setThreads( num ); }
+
+	//! Cast the spells on the NIFs below a directory, in an archive, or a single NIF
+	/*!
+	 * \param input		A directory, an archive or a file
+	 * \param recursive	Whether to include the sub directories of a directory
+	 * \return			False if the input could not be opened
+	 */
+	bool run( const QString & input, bool recursive );
+
+	//! The number of files which were saved
+	int saved() const { return numSaved.load(); }
+	//! The number of files which could not be loaded, casts or saved
+	int failed() const { return numFailed.load(); }
+
+protected:
+	//! Load, cast and save a file, returning an error or an empty string
+	QString process( NifModel & nif, const QString & file );
+
+	QList<SpellPtr> spells;
+	QString output;
+
+	BatchRunner runner;
+	//! Serializes creating the directories of the mirror tree
+	QMutex dirMutex;
+
+	QAtomicInt numSaved;
+	QAtomicInt numFailed;
+};
+
+#endif
@@ -32,16 +32,227 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "spellbook.h"
 
+#include "functionrunnable.h"
+#include "nifsnapshot.h"
+#include "trace.h"
 #include "ui/checkablemessagebox.h"
 
+#include <QApplication>
 #include <QCache>
 #include <QDir>
+#include <QProgressDialog>
 #include <QSettings>
+#include <QThreadPool>
+
+#include <algorithm>
+#include <atomic>
 
 
 
 //! \file spellbook.cpp SpellBook implementation
 
+void Spell::parallelFor( int count, const std::function<void( int )> & work )
+{
+	if ( count <= 0 )
+		return;
+
+	std::atomic<int> next( 0 );
+
+	// Each thread takes the next item until there are none left
+	auto take = [count, &next, &work]() {
+		for ( int i = next++; i < count; i = next++ )
+			work( i );
+	};
+
+	QThreadPool pool;
+	for ( int t = 0; t < qMin( pool.maxThreadCount(), count ); t++ )
+		pool.start( new FunctionRunnable( take ) );
+
+	pool.waitForDone();
+}
+
+bool Spell::parallelFor( int count, const std::function<void( int )> & work, const QString & label )
+{
+	if ( !Message::hasGui() ) {
+		parallelFor( count, work );
+		return true;
+	}
+
+	std::atomic<int> done( 0 );
+	std::atomic<bool> cancelled( false );
+
+	auto step = [&work, &done, &cancelled]( int i ) {
+		if ( !cancelled ) {
+			work( i );
+			done++;
+		}
+	};
+
+	QProgressDialog dlg( label, tr( "Cancel" ), 0, count );
+	dlg.setWindowModality( Qt::ApplicationModal );
+
+	std::function<void( int )> stepper = step;
+
+	// Run the work on another thread so that the dialog stays responsive
+	QThreadPool pool;
+	pool.start( new FunctionRunnable( [count, &stepper]() { Spell::parallelFor( count, stepper ); } ) );
+
+	while ( !pool.waitForDone( 50 ) ) {
+		dlg.setValue( done );
+		QCoreApplication::processEvents();
+
+		if ( dlg.wasCanceled() )
+			cancelled = true;
+	}
+
+	return !cancelled;
+}
+
+QModelIndex Spell::castTask( NifModel * nif, const QModelIndex & index )
+{
+	SpellTaskPtr t = task( nif, index );
+	if ( !t )
+		return index;
+
+	NifSnapshot snapshot( nif );
+	SpellProgress progress;
+
+	t->compute( snapshot, progress );
+
+	return t->commit( nif );
+}
+
+//! Spells by the items they may apply to, see Spell::applicableBlocks()
+class SpellIndex final
+{
+public:
+	void add( SpellPtr spell );
+
+	//! The spells whose metadata allows \a index, in the order they were added
+	QList<SpellPtr> candidates( const NifModel * nif, const QModelIndex & index );
+
+private:
+	struct Entry
+	{
+		SpellPtr spell;
+		QStringList blocks;
+		QSet<int> values;
+		QSet<QString> fields;
+	};
+
+	bool matches( const Entry & entry, const NifModel * nif, const QString & block, int value, const QString & field ) const;
+
+	//! In the order they were added
+	QVector<Entry> entries;
+	//! The entries without metadata, which are always candidates
+	QVector<int> any;
+	//! The other entries by their first declared field, else by their first value type, else by block types
+	QHash<QString, QVector<int>> byField;
+	QHash<int, QVector<int>> byValue;
+	QVector<int> byBlock;
+	//! The entries of byBlock, by the block types which inherit one of theirs
+	QHash<QString, QVector<int>> blockTypes;
+};
+
+void SpellIndex::add( SpellPtr spell )
+{
+	Entry entry;
+	entry.spell = spell;
+	entry.blocks = spell->applicableBlocks();
+
+	for ( NifValue::Type type : spell->applicableValues() )
+		entry.values.insert( type );
+	for ( const QString & field : spell->applicableFields() )
+		entry.fields.insert( field );
+
+	const int e = entries.count();
+	entries.append( entry );
+
+	if ( !entry.fields.isEmpty() ) {
+		for ( const QString & field : entry.fields )
+			byField[field].append( e );
+	} else if ( !entry.values.isEmpty() ) {
+		for ( int value : entry.values )
+			byValue[value].append( e );
+	} else if ( !entry.blocks.isEmpty() ) {
+		byBlock.append( e );
+		blockTypes.clear();
+	} else {
+		any.append( e );
+	}
+}
+
+bool SpellIndex::matches( const Entry & entry, const NifModel * nif, const QString & block, int value, const QString & field ) const
+{
+	if ( !entry.fields.isEmpty() && !entry.fields.contains( field ) )
+		return false;
+
+	if ( !entry.values.isEmpty() && !entry.values.contains( value ) )
+		return false;
+
+	if ( entry.blocks.isEmpty() )
+		return true;
+
+	if ( block.isEmpty() )
+		return false;
+
+	for ( const QString & type : entry.blocks ) {
+		if ( nif->inherits( block, type ) )
+			return true;
+	}
+
+	return false;
+}
+
+QList<SpellPtr> SpellIndex::candidates( const NifModel * nif, const QModelIndex & index )
+{
+	QVector<int> found = any;
+
+	if ( nif && index.isValid() ) {
+		const QString field = nif->itemName( index );
+		const int value = nif->getValue( index ).type();
+
+		int b = nif->getBlockNumber( index );
+		const QString block = ( b >= 0 ) ? nif->itemName( nif->getBlock( b ) ) : QString();
+
+		for ( int e : byField.value( field ) ) {
+			if ( matches( entries.at( e ), nif, block, value, field ) )
+				found.append( e );
+		}
+
+		for ( int e : byValue.value( value ) ) {
+			if ( matches( entries.at( e ), nif, block, value, field ) )
+				found.append( e );
+		}
+
+		if ( !block.isEmpty() ) {
+			// Which of them a block type inherits does not change, only look it up once
+			auto it = blockTypes.find( block );
+
+			if ( it == blockTypes.end() ) {
+				QVector<int> types;
+				for ( int e : byBlock ) {
+					if ( matches( entries.at( e ), nif, block, value, field ) )
+						types.append( e );
+				}
+
+				it = blockTypes.insert( block, types );
+			}
+
+			found += it.value();
+		}
+
+		std::sort( found.begin(), found.end() );
+	}
+
+	QList<SpellPtr> spells;
+	spells.reserve( found.count() );
+	for ( int e : found )
+		spells.append( entries.at( e ).spell );
+
+	return spells;
+}
+
 QList<SpellPtr> & SpellBook::spells()
 {
 	static QList<SpellPtr> _spells = QList<SpellPtr>();
@@ -60,19 +271,26 @@ QMultiHash<QString, SpellPtr> & SpellBook::hash()
 	return _hash;
 }
 
-QList<SpellPtr> & SpellBook::instants()
-{
-	static QList<SpellPtr> _instants = QList<SpellPtr>();
-	return _instants;
-}
-
 QList<SpellPtr> & SpellBook::sanitizers()
 {
 	static QList<SpellPtr> _sanitizers = QList<SpellPtr>();
 	return _sanitizers;
 }
 
-SpellBook::SpellBook( NifModel * nif, const QModelIndex & index, QObject * receiver, const char * member ) : QMenu(), Nif( 0 )
+SpellIndex & SpellBook::spellIndex()
+{
+	static SpellIndex _index;
+	return _index;
+}
+
+SpellIndex & SpellBook::instantIndex()
+{
+	static SpellIndex _index;
+	return _index;
+}
+
+SpellBook::SpellBook( NifModel * nif, const QModelIndex & index, QObject * receiver, const char * member )
+	: QMenu(), Nif( 0 ), Receiver( receiver ), Member( member )
 {
 	setTitle( "Spells" );
 
@@ -103,6 +321,11 @@ SpellBook::~SpellBook()
 
 void SpellBook::cast( NifModel * nif, const QModelIndex & index, SpellPtr spell )
 {
+	if ( SpellJob::running( nif ) ) {
+		Message::info( this, tr( "Another spell is still running on this file." ) );
+		return;
+	}
+
 	QSettings cfg;
 
 	bool suppressConfirm = cfg.value( "Settings/Suppress Undoable Confirmation", false ).toBool();
@@ -111,33 +334,69 @@ void SpellBook::cast( NifModel * nif, const QModelIndex & index, SpellPtr spell
 	QDialogButtonBox::StandardButton response = QDialogButtonBox::Yes;
 
 	if ( !suppressConfirm ) {
-		response = CheckableMessageBox::question( this, "Confirmation", "This action cannot currently be undone. Do you want to continue?", "Do not ask me again", &accepted );
+		response = CheckableMessageBox::question( this, "Confirmation", "Actions which add or remove rows cannot currently be undone. Do you want to continue?", "Do not ask me again", &accepted );
 
 		if ( accepted )
 			cfg.setValue( "Settings/Suppress Undoable Confirmation", true );
 	}
 	
 	if ( (response == QDialogButtonBox::Yes) && spell && spell->isApplicable( nif, index ) ) {
-		bool noSignals = spell->batch();
-		if ( noSignals )
-			nif->setState( BaseModel::Processing );
-		// Cast the spell and return index
-		auto idx = spell->cast( nif, index );
-		if ( noSignals )
-			nif->resetState();
-
-		// Refresh the header
-		nif->invalidateConditions( nif->getHeader(), true );
-		nif->updateHeader();
-
-		if ( noSignals && nif->getProcessingResult() ) {
-			emit nif->dataChanged( idx, idx );
+		// Without the GUI nothing is gained by waiting on another thread
+		SpellTaskPtr task = Message::hasGui() ? spell->task( nif, index ) : nullptr;
+
+		if ( task ) {
+			SpellJob * job = new SpellJob( nif, spell, task );
+			connect( job, &SpellJob::progress, this, &SpellBook::sigProgress );
+
+			// A context menu is gone by the time the job is committed
+			if ( Receiver && !Member.isEmpty() )
+				connect( job, SIGNAL( committed( const QModelIndex & ) ), Receiver, Member.constData() );
+			return;
 		}
 
+		QModelIndex idx = commit( nif, spell, [nif, &index, &spell]() { return spell->cast( nif, index ); } );
+
 		emit sigIndex( idx );
 	}
 }
 
+QModelIndex SpellBook::commit( NifModel * nif, SpellPtr spell, const std::function<QModelIndex()> & write )
+{
+	TRACE_SPAN( "Spell::cast", spell->name() );
+
+	bool noSignals = spell->batch();
+	if ( noSignals )
+		nif->setState( BaseModel::Processing );
+	else
+		nif->beginTransaction();	// Report the spell's edits as one change per modified parent
+	nif->beginRecording();
+	// Cast the spell and return index
+	auto idx = write();
+
+	QVector<BaseModel::RecordedStep> steps;
+	if ( nif->endRecording( steps ) ) {
+		if ( !steps.isEmpty() && nif->undoStack )
+			nif->undoStack->push( new ChangeValuesCommand( steps, spell->name(), nif ) );
+	} else if ( nif->undoStack ) {
+		// The model was reset or the edits were too large, the rows the earlier commands refer to may have moved
+		nif->undoStack->clear();
+	}
+	if ( noSignals )
+		nif->resetState();
+	else
+		nif->endTransaction();
+
+	// Refresh the header
+	nif->invalidateConditions( nif->getHeader(), true );
+	nif->updateHeader();
+
+	if ( noSignals && nif->getProcessingResult() ) {
+		emit nif->dataChanged( idx, idx );
+	}
+
+	return idx;
+}
+
 void SpellBook::sltSpellTriggered( QAction * action )
 {
 	SpellPtr spell = Map.value( action );
@@ -168,25 +427,31 @@ void SpellBook::sltIndex( const QModelIndex & index )
 
 void SpellBook::checkActions()
 {
-	checkActions( this, QString() );
+	// Only the spells whose metadata allows the index run their full check
+	QSet<Spell *> candidates;
+	if ( Nif ) {
+		for ( SpellPtr spell : SpellBook::candidates( Nif, Index ) )
+			candidates.insert( spell.get() );
+	}
+
+	checkActions( this, candidates );
 }
 
-void SpellBook::checkActions( QMenu * menu, const QString & page )
+void SpellBook::checkActions( QMenu * menu, const QSet<Spell *> & candidates )
 {
 	bool menuEnable = false;
 	for ( QAction * action : menu->actions() ) {
 		if ( action->menu() ) {
-			checkActions( action->menu(), action->menu()->title() );
+			checkActions( action->menu(), candidates );
 			menuEnable |= action->menu()->isEnabled();
 			action->setVisible( action->menu()->isEnabled() );
 		} else {
-			for ( SpellPtr spell : spells() ) {
-				if ( action->text() == spell->name() && page == spell->page() ) {
-					bool actionEnable = Nif && spell->isApplicable( Nif, Index );
-					action->setVisible( actionEnable );
-					action->setEnabled( actionEnable );
-					menuEnable |= actionEnable;
-				}
+			SpellPtr spell = Map.value( action );
+			if ( spell ) {
+				bool actionEnable = candidates.contains( spell.get() ) && spell->isApplicable( Nif, Index );
+				action->setVisible( actionEnable );
+				action->setEnabled( actionEnable );
+				menuEnable |= actionEnable;
 			}
 		}
 	}
@@ -222,8 +487,10 @@ void SpellBook::registerSpell( SpellPtr spell )
 	spells().append( spell );
 	hash().insertMulti( spell->name(), spell );
 
+	spellIndex().add( spell );
+
 	if ( spell->instant() )
-		instants().append( spell );
+		instantIndex().add( spell );
 
 	if ( spell->sanity() )
 		sanitizers().append( spell );
@@ -270,17 +537,25 @@ SpellPtr SpellBook::lookup( const QKeySequence & hotkey )
 
 SpellPtr SpellBook::instant( const NifModel * nif, const QModelIndex & index )
 {
-	for ( SpellPtr spell : instants() ) {
+	for ( SpellPtr spell : instantIndex().candidates( nif, index ) ) {
 		if ( spell->isApplicable( nif, index ) )
 			return spell;
 	}
 	return nullptr;
 }
 
+QList<SpellPtr> SpellBook::candidates( const NifModel * nif, const QModelIndex & index )
+{
+	return spellIndex().candidates( nif, index );
+}
+
 QModelIndex SpellBook::sanitize( NifModel * nif )
 {
 	QPersistentModelIndex ridx;
 
+	// Update the model once after all sanitizers ran
+	bool oldHoldUpdates = nif->holdUpdates( true );
+
 	for ( SpellPtr spell : sanitizers() ) {
 		if ( spell->isApplicable( nif, QModelIndex() ) ) {
 			QModelIndex idx = spell->cast( nif, QModelIndex() );
@@ -290,6 +565,9 @@ QModelIndex SpellBook::sanitize( NifModel * nif )
 		}
 	}
 
+	if ( !oldHoldUpdates )
+		nif->holdUpdates( false );
+
 	return ridx;
 }
 
@@ -300,3 +578,118 @@ QAction * SpellBook::exec( const QPoint & pos, QAction * act )
 
 	return nullptr;
 }
+
+
+struct SpellJob::State
+{
+	SpellTaskPtr task;
+	std::shared_ptr<const NifSnapshot> snapshot;
+	SpellProgress progress;
+	std::atomic<bool> done{ false };
+	//! The name of the spell, for the trace
+	QString name;
+};
+
+SpellJob::SpellJob( NifModel * model, SpellPtr s, SpellTaskPtr task )
+	: QObject( model ), nif( model ), spell( s ), state( std::make_shared<State>() )
+{
+	state->task = task;
+	state->name = s->name();
+	state->snapshot = std::make_shared<const NifSnapshot>( nif );
+
+	// Any change after the snapshot makes the result stale
+	auto invalidate = [this]() { stale = true; };
+
+	connect( nif, &NifModel::dataChanged, this, invalidate );
+	connect( nif, &NifModel::rowsInserted, this, invalidate );
+	connect( nif, &NifModel::rowsRemoved, this, invalidate );
+	connect( nif, &NifModel::modelReset, this, invalidate );
+	connect( nif, &NifModel::linksChanged, this, invalidate );
+
+	dialog = new QProgressDialog( spell->name(), tr( "Cancel" ), 0, 0, QApplication::activeWindow() );
+	dialog->setAutoReset( false );
+	dialog->setAutoClose( false );
+	connect( dialog.data(), &QProgressDialog::canceled, this, &SpellJob::cancel );
+
+	// The state outlives a canceled job until the task returns
+	std::shared_ptr<State> computed = state;
+
+	QThreadPool::globalInstance()->start( new FunctionRunnable( [computed]() {
+		TRACE_SPAN( "SpellTask::compute", computed->name );
+
+		computed->task->compute( *computed->snapshot, computed->progress );
+		computed->snapshot.reset();
+		computed->done = true;
+	} ) );
+
+	connect( &timer, &QTimer::timeout, this, &SpellJob::poll );
+	timer.start( 50 );
+}
+
+SpellJob::~SpellJob()
+{
+	state->progress.cancel();
+
+	if ( dialog )
+		dialog->deleteLater();
+}
+
+SpellJob * SpellJob::running( const NifModel * nif )
+{
+	return nif ? nif->findChild<SpellJob *>( QString(), Qt::FindDirectChildrenOnly ) : nullptr;
+}
+
+void SpellJob::cancel()
+{
+	state->progress.cancel();
+	timer.stop();
+
+	// The worker may still be computing; it only holds the state
+	setParent( nullptr );
+	deleteLater();
+}
+
+void SpellJob::poll()
+{
+	int value = state->progress.getValue();
+	int maximum = state->progress.getMaximum();
+
+	if ( !state->done ) {
+		if ( dialog ) {
+			dialog->setMaximum( maximum );
+			dialog->setValue( qMin( value, maximum ) );
+		}
+
+		emit progress( value, maximum );
+		return;
+	}
+
+	timer.stop();
+
+	if ( dialog ) {
+		// Closing the dialog must not cancel the job
+		dialog->disconnect( this );
+		dialog->close();
+	}
+
+	disconnect( nif, nullptr, this, nullptr );
+
+	if ( stale ) {
+		Message::append( tr( "%1 was not applied." ).arg( spell->name() ),
+			tr( "The file was changed while the spell was running." ), QMessageBox::Information );
+	} else {
+		SpellTaskPtr task = state->task;
+		NifModel * model = nif;
+
+		QModelIndex idx = SpellBook::commit( model, spell, [task, model]() { return task->commit( model ); } );
+
+		// The committed task may hold indices, which must go on this thread
+		state->task.reset();
+
+		emit progress( maximum, maximum );
+		emit committed( idx );
+	}
+
+	setParent( nullptr );
+	deleteLater();
+}
@@ -44,11 +44,21 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QList>
 #include <QMap>
 #include <QPersistentModelIndex>
+#include <QPointer>
+#include <QSet>
 #include <QString>
+#include <QTimer>
 
+#include <atomic>
+#include <functional>
 #include <memory>
 
 
+class NifSnapshot;
+class SpellIndex;
+class QProgressDialog;
+
+
 using QIconPtr = std::shared_ptr<QIcon>;
 
 //! \file spellbook.h Spell, SpellBook and Librarian
@@ -56,6 +66,54 @@ using QIconPtr = std::shared_ptr<QIcon>;
 //! Register a Spell using a Librarian
 #define REGISTER_SPELL( SPELL ) static Librarian __ ## SPELL ## __( new SPELL );
 
+//! The progress of a SpellTask, shared with the thread computing it
+class SpellProgress final
+{
+public:
+	//! Set the number of steps
+	void setMaximum( int steps ) { maximum = steps; }
+	//! Set the number of steps done
+	void setValue( int steps ) { value = steps; }
+	//! Count a step as done; may be called from several threads
+	void step() { value++; }
+
+	int getValue() const { return value; }
+	int getMaximum() const { return maximum; }
+
+	//! Ask the task to stop; its result is not committed
+	void cancel() { canceled = true; }
+	//! Whether SpellTask::compute() should return as soon as it can
+	bool isCanceled() const { return canceled; }
+
+private:
+	std::atomic<int> value{ 0 };
+	std::atomic<int> maximum{ 0 };
+	std::atomic<bool> canceled{ false };
+};
+
+//! The work of a spell which is computed on a worker thread, see Spell::task()
+class SpellTask
+{
+public:
+	virtual ~SpellTask() {}
+
+	//! Compute the changes from a snapshot of the model, on a worker thread
+	/*!
+	 * Must not touch the model, nor show messages; keep them for commit().
+	 * A task which is canceled or not committed may be deleted on the worker
+	 * thread, so it should not hold model indices before commit().
+	 */
+	virtual void compute( const NifSnapshot & snapshot, SpellProgress & progress ) = 0;
+
+	//! Write the computed changes to the model, on the GUI thread
+	/*!
+	 * \return The index to select, as Spell::cast()
+	 */
+	virtual QModelIndex commit( NifModel * nif ) = 0;
+};
+
+using SpellTaskPtr = std::shared_ptr<SpellTask>;
+
 //! Flexible context menu magic functions.
 class Spell
 {
@@ -77,17 +135,48 @@ public:
 	virtual bool instant() const { return false; }
 	//! Whether the spell performs a sanitizing function
 	virtual bool sanity() const { return false; }
+	//! Whether the spell asks for input or needs the GUI, which rules it out of SpellBatch
+	virtual bool interactive() const { return false; }
 	//! Whether the spell has a high processing cost
 	virtual bool batch() const { return (page() == "Batch") || (page() == "Block") || (page() == "Mesh"); }
 	//! Hotkey sequence
 	virtual QKeySequence hotkey() const { return QKeySequence(); }
 
+	//! The block types the spell applies to or within, empty for any
+	/*!
+	 * The metadata of applicableBlocks(), applicableValues() and
+	 * applicableFields() lets SpellBook skip isApplicable() for the items the
+	 * spell can never apply to; a spell declaring any applies to no item
+	 * outside a block, nor without an index. A block type stands for the
+	 * types inheriting it. It is read once, when the spell is registered.
+	 */
+	virtual QStringList applicableBlocks() const { return QStringList(); }
+	//! The value types of the items the spell applies to, empty for any
+	virtual QList<NifValue::Type> applicableValues() const { return QList<NifValue::Type>(); }
+	//! The names of the items the spell applies to, empty for any
+	virtual QStringList applicableFields() const { return QStringList(); }
+
 	//! Determine if/when the spell can be cast
 	virtual bool isApplicable( const NifModel * nif, const QModelIndex & index ) = 0;
 
 	//! Cast (apply) the spell
 	virtual QModelIndex cast( NifModel * nif, const QModelIndex & index ) = 0;
 
+	//! The work of the spell to compute on a worker thread, nullptr to cast() it instead
+	/*!
+	 * Called on the GUI thread once isApplicable() returned true. SpellBook
+	 * computes the task on a NifSnapshot while the interface stays
+	 * responsive, showing the progress, and then commits it as one undo step.
+	 * Spells returning a task usually implement cast() with castTask(), which
+	 * is used without the GUI.
+	 */
+	virtual SpellTaskPtr task( const NifModel * nif, const QModelIndex & index )
+	{
+		Q_UNUSED( nif );
+		Q_UNUSED( index );
+		return nullptr;
+	}
+
 	//! Cast the spell if applicable
 	void castIfApplicable( NifModel * nif, const QModelIndex & index )
 	{
@@ -95,6 +184,22 @@ public:
 			cast( nif, index );
 	}
 
+	//! Run work( i ) for each i below count on all cores and wait for it to finish
+	/*!
+	 * For batch spells: the model is not safe to use from several threads, so
+	 * read what each item needs first, compute with this, then write the results.
+	 */
+	static void parallelFor( int count, const std::function<void( int )> & work );
+
+	//! Run work( i ) for each i below count on all cores, showing \a label and the progress
+	/*!
+	 * The dialog appears if the work takes more than a few seconds. If it is
+	 * cancelled, the items not started yet are skipped.
+	 *
+	 * \return False if the work was cancelled
+	 */
+	static bool parallelFor( int count, const std::function<void( int )> & work, const QString & label );
+
 	//! i18n wrapper for various strings
 	/*!
 	 * Note that we don't use QObject::tr() because that doesn't provide
@@ -104,6 +209,10 @@ public:
 	 * No spells should reimplement this function.
 	 */
 	static inline QString tr( const char * key, const char * comment = 0 ) { return QCoreApplication::translate( "Spell", key, comment ); }
+
+protected:
+	//! Compute and commit task() on this thread
+	QModelIndex castTask( NifModel * nif, const QModelIndex & index );
 };
 
 using SpellPtr = std::shared_ptr<Spell>;
@@ -131,10 +240,15 @@ public:
 	static SpellPtr lookup( const QKeySequence & hotkey );
 	//! Locate instant spells by datatype
 	static SpellPtr instant( const NifModel * nif, const QModelIndex & index );
+	//! The spells which may apply to \a index by their metadata, in the order they were registered
+	static QList<SpellPtr> candidates( const NifModel * nif, const QModelIndex & index );
 
 	//! Cast all sanitizing spells
 	static QModelIndex sanitize( NifModel * nif );
 
+	//! Run \a write, which changes the model for \a spell, as one undo step and refresh the header
+	static QModelIndex commit( NifModel * nif, SpellPtr spell, const std::function<QModelIndex()> & write );
+
 public slots:
 	void sltNif( NifModel * nif );
 
@@ -146,6 +260,8 @@ public slots:
 
 signals:
 	void sigIndex( const QModelIndex & index );
+	//! The progress of a spell running on a worker thread
+	void sigProgress( int value, int maximum );
 
 protected slots:
 	void sltSpellTriggered( QAction * action );
@@ -154,16 +270,61 @@ protected:
 	NifModel * Nif;
 	QPersistentModelIndex Index;
 	QMap<QAction *, SpellPtr> Map;
+	//! Told the index of spells committed after the book may be gone
+	QPointer<QObject> Receiver;
+	QByteArray Member;
 
 	void newSpellRegistered( SpellPtr spell );
-	void checkActions( QMenu * menu, const QString & page );
+	void checkActions( QMenu * menu, const QSet<Spell *> & candidates );
 
 private:
 	static QList<SpellPtr> & spells();
 	static QList<SpellBook *> & books();
 	static QMultiHash<QString, SpellPtr> & hash();
-	static QList<SpellPtr> & instants();
 	static QList<SpellPtr> & sanitizers();
+	static SpellIndex & spellIndex();
+	static SpellIndex & instantIndex();
+};
+
+//! Computes the SpellTask of a spell on a worker thread, then commits it
+/*!
+ * The job is a child of the model and deletes itself when it is done. If the
+ * model changes before the task is computed, its result is thrown away.
+ */
+class SpellJob final : public QObject
+{
+	Q_OBJECT
+
+public:
+	//! Start computing \a task on a snapshot of \a nif
+	SpellJob( NifModel * nif, SpellPtr spell, SpellTaskPtr task );
+	~SpellJob();
+
+	//! The job running on \a nif, nullptr if there is none
+	static SpellJob * running( const NifModel * nif );
+
+public slots:
+	//! Stop the task and delete the job without committing
+	void cancel();
+
+signals:
+	void progress( int value, int maximum );
+	//! The task was committed; \a index is the index it returned
+	void committed( const QModelIndex & index );
+
+protected slots:
+	void poll();
+
+protected:
+	struct State;
+
+	NifModel * nif;
+	SpellPtr spell;
+	std::shared_ptr<State> state;
+	QTimer timer;
+	QPointer<QProgressDialog> dialog;
+	//! The model was changed after the snapshot was taken
+	bool stale = false;
 };
 
 //! SpellBook manager
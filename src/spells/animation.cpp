@@ -1,7 +1,9 @@
 #include "spellbook.h"
 #include "settings.h"
 
+#include <QElapsedTimer>
 #include <QFileDialog>
+#include <QSet>
 
 
 // Brief description is deliberately not autolinked to class Spell
@@ -23,6 +25,7 @@ class spAttachKf final : public Spell
 public:
 	QString name() const override final { return Spell::tr( "Attach .KF" ); }
 	QString page() const override final { return Spell::tr( "Animation" ); }
+	bool interactive() const override final { return true; }
 
 	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
 	{
@@ -299,6 +302,193 @@ public:
 
 REGISTER_SPELL( spAttachKf )
 
+//! Loads .KF files on worker threads and matches their controlled blocks with a skeleton
+class ValidateKfTask final : public SpellTask
+{
+public:
+	ValidateKfTask( const QStringList & files, const QSet<QString> & names ) : kfnames( files ), skeleton( names ) {}
+
+	void compute( const NifSnapshot &, SpellProgress & progress ) override final
+	{
+		QElapsedTimer total;
+		total.start();
+
+		results.resize( kfnames.count() );
+		progress.setMaximum( kfnames.count() );
+
+		Spell::parallelFor( kfnames.count(), [this, &progress]( int i ) {
+			if ( !progress.isCanceled() )
+				validate( results[i], kfnames.at( i ) );
+
+			progress.step();
+		} );
+
+		msecs = total.elapsed();
+	}
+
+	QModelIndex commit( NifModel * ) override final
+	{
+		if ( results.isEmpty() )
+			return QModelIndex();
+
+		int failed = 0, unmatched = 0, blocks = 0;
+		qint64 slowest = 0;
+		QStringList details;
+
+		for ( const Result & result : results ) {
+			if ( !result.error.isEmpty() ) {
+				failed++;
+				details << QString( "%1: %2" ).arg( result.filepath, result.error );
+				continue;
+			}
+
+			blocks += result.blocks;
+			slowest = qMax( slowest, result.msecs );
+
+			if ( !result.missing.isEmpty() ) {
+				unmatched++;
+				details << Spell::tr( "%1: no target for %2" ).arg( result.filepath, result.missing.join( ", " ) );
+			}
+		}
+
+		QString summary = Spell::tr( "Checked %1 .KF files with %2 controlled blocks in %3 s (slowest file %4 ms): %5 failed to load, %6 have unmatched targets." )
+			.arg( results.count() ).arg( blocks ).arg( msecs / 1000.0, 0, 'f', 2 ).arg( slowest ).arg( failed ).arg( unmatched );
+
+		if ( details.isEmpty() )
+			Message::info( qApp->activeWindow(), summary );
+		else
+			Message::warning( qApp->activeWindow(), summary, details.join( "\n" ) );
+
+		return QModelIndex();
+	}
+
+protected:
+	//! The outcome for one .KF file
+	struct Result
+	{
+		QString filepath;
+		//! Why the file could not be checked, empty if it could
+		QString error;
+		int sequences = 0;
+		int blocks = 0;
+		QStringList missing;
+		qint64 msecs = 0;
+	};
+
+	//! Load \a filepath into its own model and match its targets with the skeleton
+	void validate( Result & result, const QString & filepath ) const
+	{
+		result.filepath = filepath;
+
+		QElapsedTimer timer;
+		timer.start();
+
+		NifModel kf;
+		kf.setMessageMode( BaseModel::TstMessage );
+
+		QFile kffile( result.filepath );
+
+		if ( !kffile.open( QFile::ReadOnly ) ) {
+			result.error = Spell::tr( "failed to open .kf %1" ).arg( result.filepath );
+			return;
+		}
+
+		if ( !kf.load( kffile ) ) {
+			result.error = Spell::tr( "failed to load .kf from file %1" ).arg( result.filepath );
+			return;
+		}
+
+		for ( const auto l : kf.getRootLinks() ) {
+			QModelIndex iSeq = kf.getBlock( l, "NiControllerSequence" );
+
+			if ( !iSeq.isValid() ) {
+				result.error = Spell::tr( "this is not a normal .kf file; there should be only NiControllerSequences as root blocks" );
+				break;
+			}
+
+			result.sequences++;
+
+			QString rootName = kf.get<QString>( iSeq, "Target Name" );
+
+			if ( rootName.isEmpty() )
+				rootName = kf.get<QString>( iSeq, "Text Keys Name" ); // 10.0.1.0
+
+			if ( !skeleton.contains( rootName ) && !result.missing.contains( rootName ) )
+				result.missing << rootName;
+
+			QModelIndex iCtrlBlcks = kf.getIndex( iSeq, "Controlled Blocks" );
+
+			for ( int r = 0; r < kf.rowCount( iCtrlBlcks ); r++ ) {
+				QString nodeName = kf.string( iCtrlBlcks.child( r, 0 ), "Node Name", false );
+
+				if ( nodeName.isEmpty() )
+					nodeName = kf.string( iCtrlBlcks.child( r, 0 ), "Target Name", false ); // 10.0.1.0
+
+				if ( nodeName.isEmpty() ) {
+					QModelIndex iNodeName = kf.getIndex( iCtrlBlcks.child( r, 0 ), "Node Name Offset" );
+					nodeName = iNodeName.sibling( iNodeName.row(), NifModel::ValueCol ).data( NifSkopeDisplayRole ).toString();
+				}
+
+				result.blocks++;
+
+				if ( !skeleton.contains( nodeName ) && !result.missing.contains( nodeName ) )
+					result.missing << nodeName;
+			}
+		}
+
+		result.msecs = timer.elapsed();
+	}
+
+	QStringList kfnames;
+	//! Every object the animations could target
+	QSet<QString> skeleton;
+	QVector<Result> results;
+	qint64 msecs = 0;
+};
+
+//! Check many .KF files against the skeleton of a .NIF without attaching them
+/*!
+ * The node names of the .NIF are read once; the .KF files are then loaded on
+ * worker threads, each into its own model, and their controlled blocks matched
+ * by name. Files which fail to load or control nodes the .NIF does not have are
+ * reported, with the time taken.
+ */
+class spValidateKf final : public Spell
+{
+public:
+	QString name() const override final { return Spell::tr( "Validate .KF Files" ); }
+	QString page() const override final { return Spell::tr( "Animation" ); }
+	bool interactive() const override final { return true; }
+
+	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
+	{
+		return nif && !index.isValid();
+	}
+
+	SpellTaskPtr task( const NifModel * nif, const QModelIndex & ) override final
+	{
+		QStringList kfnames = QFileDialog::getOpenFileNames( qApp->activeWindow(), Spell::tr( "Choose .kf file(s)" ), nif->getFolder(), "Keyframe (*.kf)" );
+
+		// Read from the skeleton once, on the thread of the model
+		QSet<QString> skeleton;
+		for ( int b = 0; b < nif->getBlockCount() && !kfnames.isEmpty(); b++ ) {
+			QModelIndex iBlock = nif->getBlock( b, "NiAVObject" );
+
+			if ( iBlock.isValid() )
+				skeleton.insert( nif->get<QString>( iBlock, "Name" ) );
+		}
+
+		return std::make_shared<ValidateKfTask>( kfnames, skeleton );
+	}
+
+	QModelIndex cast( NifModel * nif, const QModelIndex & index ) override final
+	{
+		return castTask( nif, index );
+	}
+};
+
+REGISTER_SPELL( spValidateKf )
+
 //! Convert quaternions to euler rotations.
 /*!
  * There doesn't seem to be much use for this - most official meshes use
@@ -469,6 +469,7 @@ class spCopyBlock final : public Spell
 public:
 	QString name() const override final { return Spell::tr( "Copy" ); }
 	QString page() const override final { return Spell::tr( "Block" ); }
+	bool interactive() const override final { return true; }
 	QKeySequence hotkey() const { return{ Qt::CTRL + Qt::SHIFT + Qt::Key_C }; }
 
 	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
@@ -499,6 +500,7 @@ class spPasteBlock final : public Spell
 public:
 	QString name() const override final { return Spell::tr( "Paste" ); }
 	QString page() const override final { return Spell::tr( "Block" ); }
+	bool interactive() const override final { return true; }
 
 	QString acceptFormat( const QString & format, const NifModel * nif )
 	{
@@ -565,6 +567,7 @@ class spPasteOverBlock final : public Spell
 public:
 	QString name() const override final { return Spell::tr( "Paste Over" ); }
 	QString page() const override final { return Spell::tr( "Block" ); }
+	bool interactive() const override final { return true; }
 	QKeySequence hotkey() const { return{ Qt::CTRL + Qt::SHIFT + Qt::Key_V }; }
 
 	QString acceptFormat( const QString & format, const NifModel * nif, const QModelIndex & block )
@@ -618,11 +621,20 @@ public:
 REGISTER_SPELL( spPasteOverBlock )
 
 //! Copy a branch (a block and its descendents) to the clipboard
+//! The mime format holding the id of the branch last copied by this process
+static const QString branchIdFormat = "nifskope/nibranchid";
+
+//! The branch last copied by this process, pasted without reading it again while the clipboard holds its id
+static std::shared_ptr<NifBlockCopy> copiedBranch;
+//! The id of copiedBranch
+static QByteArray copiedBranchId;
+
 class spCopyBranch final : public Spell
 {
 public:
 	QString name() const override final { return Spell::tr( "Copy Branch" ); }
 	QString page() const override final { return Spell::tr( "Block" ); }
+	bool interactive() const override final { return true; }
 	QKeySequence hotkey() const { return QKeySequence( QKeySequence::Copy ); }
 
 	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
@@ -691,6 +703,13 @@ public:
 			}
 			QMimeData * mime = new QMimeData;
 			mime->setData( QString( "nifskope/nibranch/%1" ).arg( nif->getVersion() ), data );
+
+			// Other processes read the bytes, this one clones the items
+			static int copies = 0;
+			copiedBranch = nif->copyNiBlocks( blocks );
+			copiedBranchId = QString( "%1/%2" ).arg( QCoreApplication::applicationPid() ).arg( ++copies ).toLatin1();
+			mime->setData( branchIdFormat, copiedBranchId );
+
 			QApplication::clipboard()->setMimeData( mime );
 		}
 
@@ -706,6 +725,7 @@ class spPasteBranch final : public Spell
 public:
 	QString name() const override final { return Spell::tr( "Paste Branch" ); }
 	QString page() const override final { return Spell::tr( "Block" ); }
+	bool interactive() const override final { return true; }
 	// Doesn't work unless the menu entry is unique
 	QKeySequence hotkey() const { return QKeySequence( QKeySequence::Paste ); }
 
@@ -794,6 +814,15 @@ public:
 
 						QModelIndex iRoot;
 
+						if ( copiedBranch && copiedBranch->blocks.count() == count
+						     && mime->data( branchIdFormat ) == copiedBranchId
+						     && nif->canPasteNiBlocks( *copiedBranch ) )
+						{
+							iRoot = nif->pasteNiBlocks( *copiedBranch, blockMap );
+							blockLink( nif, index, iRoot );
+							return iRoot;
+						}
+
 						for ( int c = 0; c < count; c++ ) {
 							QString type;
 							ds >> type;
@@ -832,6 +861,7 @@ class spPasteBranch2 final : public Spell
 public:
 	QString name() const override final { return Spell::tr( "Paste At End" ); }
 	QString page() const override final { return Spell::tr( "Block" ); }
+	bool interactive() const override final { return true; }
 	// hotkey() won't work here, probably because the context menu is not available
 
 	QString acceptFormat( const QString & format, const NifModel * nif )
@@ -990,6 +1020,7 @@ class spRemoveBlocksById final : public Spell
 public:
 	QString name() const override final { return Spell::tr( "Remove By Id" ); }
 	QString page() const override final { return Spell::tr( "Block" ); }
+	bool interactive() const override final { return true; }
 
 	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
 	{
@@ -1013,17 +1044,15 @@ public:
 
 		QRegularExpression exp( match );
 
-		int n = 0;
+		QList<int> matches;
 
-		while ( n < nif->getBlockCount() ) {
-			QModelIndex iBlock = nif->getBlock( n );
-
-			if ( nif->itemName( iBlock ).indexOf( exp ) >= 0 )
-				nif->removeNiBlock( n );
-			else
-				n++;
+		for ( int n = 0; n < nif->getBlockCount(); n++ ) {
+			if ( nif->itemName( nif->getBlock( n ) ).indexOf( exp ) >= 0 )
+				matches.append( n );
 		}
 
+		nif->removeNiBlocks( matches );
+
 		return QModelIndex();
 	}
 };
@@ -1066,18 +1095,15 @@ public:
 		QList<quint32> branch = getBranch( nif, nif->getBlockNumber( index ) );
 		//qDebug() << branch;
 		// remove non-branch blocks
-		int n = 0; // tracks the current block number in the new system (after some blocks have been removed already)
-		int m = 0; // tracks the block number in the old system i.e.  as they are numbered in the branch list
+		QList<int> remove;
 
-		while ( n < nif->getBlockCount() ) {
-			if ( !branch.contains( m ) )
-				nif->removeNiBlock( n );
-			else
-				n++;
-
-			m++;
+		for ( int n = 0; n < nif->getBlockCount(); n++ ) {
+			if ( !branch.contains( quint32( n ) ) )
+				remove.append( n );
 		}
 
+		nif->removeNiBlocks( remove );
+
 		// done
 		return QModelIndex();
 	}
@@ -16,6 +16,7 @@ class spEditBounds final : public Spell
 public:
 	QString name() const override final { return Spell::tr( "Edit" ); }
 	QString page() const override final { return Spell::tr( "Bounds" ); }
+	bool interactive() const override final { return true; }
 
 	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
 	{
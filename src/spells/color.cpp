@@ -2,6 +2,8 @@
 
 #include "widgets/colorwheel.h"
 
+#include <functional>
+
 
 // Brief description is deliberately not autolinked to class Spell
 /*! \file color.cpp
@@ -16,8 +18,10 @@ class spChooseColor final : public Spell
 public:
 	QString name() const override final { return Spell::tr( "Choose" ); }
 	QString page() const override final { return Spell::tr( "Color" ); }
+	bool interactive() const override final { return true; }
 	QIcon icon() const { return ColorWheel::getIcon(); }
 	bool instant() const { return true; }
+	QList<NifValue::Type> applicableValues() const override final { return { NifValue::tColor3, NifValue::tColor4, NifValue::tByteColor4 }; }
 
 	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
 	{
@@ -49,6 +53,7 @@ class spSetAllColor final : public Spell
 public:
 	QString name() const override final { return Spell::tr( "Set All" ); }
 	QString page() const override final { return Spell::tr( "Color" ); }
+	bool interactive() const override final { return true; }
 	QIcon icon() const { return ColorWheel::getIcon(); }
 	bool instant() const { return true; }
 
@@ -66,9 +71,227 @@ public:
 			nif->setArray<Color3>( index, ColorWheel::choose( nif->get<Color3>( colorIdx ) ) );
 		else if ( typ == NifValue::tColor4 )
 			nif->setArray<Color4>( index, ColorWheel::choose( nif->get<Color4>( colorIdx ) ) );
+		else if ( typ == NifValue::tByteColor4 ) {
+			auto col = ColorWheel::choose( nif->get<ByteColor4>( colorIdx ) );
+			nif->setArray<ByteColor4>( index, *static_cast<ByteColor4 *>(&col) );
+		}
 
 		return index;
 	}
 };
 
 REGISTER_SPELL( spSetAllColor )
+
+//! The vertex colors of a shape
+struct VertexColorArray
+{
+	QPersistentModelIndex iArray;
+	//! The row of the color in each vertex of a BSTriShape, or -1 if the array holds the colors
+	int row = -1;
+
+	bool isValid() const { return iArray.isValid(); }
+};
+
+//! Find the vertex colors of a shape or its data
+static VertexColorArray findVertexColors( const NifModel * nif, const QModelIndex & index )
+{
+	VertexColorArray colors;
+	QModelIndex iBlock = nif->getBlock( index );
+
+	if ( nif->inherits( iBlock, "NiTriBasedGeom" ) )
+		iBlock = nif->getBlock( nif->getLink( iBlock, "Data" ) );
+
+	if ( nif->inherits( iBlock, "NiGeometryData" ) ) {
+		QModelIndex iColors = nif->getIndex( iBlock, "Vertex Colors" );
+
+		if ( nif->rowCount( iColors ) > 0 )
+			colors.iArray = iColors;
+	} else if ( nif->inherits( iBlock, "BSTriShape" ) ) {
+		// Every vertex has the same fields, find the row of the color once
+		static const NifFieldId fVertexColors( "Vertex Colors" );
+		QModelIndex iVertData = nif->getIndex( iBlock, "Vertex Data" );
+
+		if ( nif->rowCount( iVertData ) > 0 ) {
+			colors.row = nif->getIndex( nif->index( 0, 0, iVertData ), fVertexColors ).row();
+
+			if ( colors.row >= 0 )
+				colors.iArray = iVertData;
+		}
+	}
+
+	return colors;
+}
+
+//! Read the vertex colors of a shape as one array
+static QVector<Color4> readVertexColors( const NifModel * nif, const VertexColorArray & colors )
+{
+	if ( colors.row < 0 )
+		return nif->getArray<Color4>( colors.iArray );
+
+	QVector<ByteColor4> bytes = nif->getFieldArray<ByteColor4>( colors.iArray, colors.row );
+	QVector<Color4> values( bytes.count() );
+
+	for ( int v = 0; v < bytes.count(); v++ )
+		values[v] = bytes[v];
+
+	return values;
+}
+
+//! Write the vertex colors of a shape as one array, clamped to the range a color can hold
+static void writeVertexColors( NifModel * nif, const VertexColorArray & colors, QVector<Color4> values )
+{
+	for ( Color4 & c : values ) {
+		for ( int i = 0; i < 4; i++ )
+			c[i] = qBound( 0.0f, c[i], 1.0f );
+	}
+
+	if ( colors.row < 0 ) {
+		nif->setArray<Color4>( colors.iArray, values );
+		return;
+	}
+
+	QVector<ByteColor4> bytes( values.count() );
+
+	for ( int v = 0; v < values.count(); v++ )
+		static_cast<Color4 &>( bytes[v] ) = values[v];
+
+	nif->setFieldArray<ByteColor4>( colors.iArray, colors.row, bytes );
+}
+
+//! Apply \a op to the vertex colors of shapes, reporting the changes once
+static void applyVertexColors( NifModel * nif, const QList<VertexColorArray> & shapes, const std::function<void( QVector<Color4> & )> & op )
+{
+	bool old = nif->holdUpdates( true );
+
+	for ( const VertexColorArray & colors : shapes ) {
+		QVector<Color4> values = readVertexColors( nif, colors );
+		op( values );
+		writeVertexColors( nif, colors, values );
+	}
+
+	if ( !old )
+		nif->holdUpdates( false );
+}
+
+//! Find the vertex colors of every shape in the model
+static QList<VertexColorArray> findAllVertexColors( const NifModel * nif )
+{
+	QList<VertexColorArray> shapes;
+
+	for ( int n = 0; n < nif->getBlockCount(); n++ ) {
+		QModelIndex iBlock = nif->getBlock( n );
+
+		// Shapes are found through their data, so that shared data is changed once
+		if ( nif->inherits( iBlock, "NiTriBasedGeom" ) )
+			continue;
+
+		VertexColorArray colors = findVertexColors( nif, iBlock );
+
+		if ( colors.isValid() )
+			shapes << colors;
+	}
+
+	return shapes;
+}
+
+//! Multiply each vertex color by a color
+static void multiplyColors( QVector<Color4> & values, const Color4 & by )
+{
+	for ( Color4 & c : values ) {
+		for ( int i = 0; i < 4; i++ )
+			c[i] *= by[i];
+	}
+}
+
+//! Set the vertex colors of a shape
+class spFillVertexColors final : public Spell
+{
+public:
+	QString name() const override final { return Spell::tr( "Fill Vertex Colors" ); }
+	QString page() const override final { return Spell::tr( "Color" ); }
+	bool interactive() const override final { return true; }
+
+	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
+	{
+		return findVertexColors( nif, index ).isValid();
+	}
+
+	QModelIndex cast( NifModel * nif, const QModelIndex & index ) override final
+	{
+		VertexColorArray colors = findVertexColors( nif, index );
+		Color4 initial = readVertexColors( nif, colors ).value( 0 );
+		Color4 color = ColorWheel::choose( initial );
+
+		// The dialog returns the initial color when it is cancelled
+		if ( color == initial )
+			return index;
+
+		applyVertexColors( nif, { colors }, [&color]( QVector<Color4> & values ) {
+			values.fill( color );
+		} );
+
+		return index;
+	}
+};
+
+REGISTER_SPELL( spFillVertexColors )
+
+//! Multiply the vertex colors of a shape by a color
+class spMultiplyVertexColors final : public Spell
+{
+public:
+	QString name() const override final { return Spell::tr( "Multiply Vertex Colors" ); }
+	QString page() const override final { return Spell::tr( "Color" ); }
+	bool interactive() const override final { return true; }
+
+	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
+	{
+		return findVertexColors( nif, index ).isValid();
+	}
+
+	QModelIndex cast( NifModel * nif, const QModelIndex & index ) override final
+	{
+		Color4 by = ColorWheel::choose( Color4( 1.0f, 1.0f, 1.0f, 1.0f ) );
+
+		if ( by == Color4( 1.0f, 1.0f, 1.0f, 1.0f ) )
+			return index;
+
+		applyVertexColors( nif, { findVertexColors( nif, index ) }, [&by]( QVector<Color4> & values ) {
+			multiplyColors( values, by );
+		} );
+
+		return index;
+	}
+};
+
+REGISTER_SPELL( spMultiplyVertexColors )
+
+//! Multiply the vertex colors of all shapes by a color
+class spMultiplyAllVertexColors final : public Spell
+{
+public:
+	QString name() const override final { return Spell::tr( "Multiply All Vertex Colors" ); }
+	QString page() const override final { return Spell::tr( "Batch" ); }
+	bool interactive() const override final { return true; }
+
+	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
+	{
+		return nif && !index.isValid() && !findAllVertexColors( nif ).isEmpty();
+	}
+
+	QModelIndex cast( NifModel * nif, const QModelIndex & index ) override final
+	{
+		Color4 by = ColorWheel::choose( Color4( 1.0f, 1.0f, 1.0f, 1.0f ) );
+
+		if ( by == Color4( 1.0f, 1.0f, 1.0f, 1.0f ) )
+			return index;
+
+		applyVertexColors( nif, findAllVertexColors( nif ), [&by]( QVector<Color4> & values ) {
+			multiplyColors( values, by );
+		} );
+
+		return index;
+	}
+};
+
+REGISTER_SPELL( spMultiplyAllVertexColors )
@@ -21,6 +21,7 @@ class spEditFlags final : public Spell
 {
 public:
 	QString name() const override final { return Spell::tr( "Flags" ); }
+	bool interactive() const override final { return true; }
 	bool instant() const { return true; }
 	QIcon icon() const { return QIcon( ":/img/flag" ); }
 
@@ -1,6 +1,7 @@
 #include "spellbook.h"
 
 #include "blocks.h"
+#include "mesh.h"
 #include "nvtristripwrapper.h"
 #include "qhull.h"
 
@@ -13,6 +14,7 @@
 #include <QPushButton>
 
 #include <algorithm> // std::sort
+#include <cmath>
 
 
 // Brief description is deliberately not autolinked to class Spell
@@ -25,190 +27,318 @@
 //! For Havok coordinate transforms
 static const float havokConst = 7.0;
 
-//! Creates a convex hull using Qhull
-class spCreateCVS final : public Spell
+//! Settings asked for by spCreateCVS and spCreateAllCVS
+struct ConvexShapeSettings
 {
-public:
-	QString name() const override final { return Spell::tr( "Create Convex Shape" ); }
-	QString page() const override final { return Spell::tr( "Havok" ); }
+	//! The maximum roundoff error of the hull
+	float roundError = 0.25f;
+	//! The collision radius
+	float radius = 0.05f;
+};
 
-	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
-	{
-		if ( !nif->inherits( index, "NiTriBasedGeom" ) || !nif->checkVersion( 0x0A000100, 0 ) )
-			return false;
+//! Ask for the convex shape settings
+static bool askConvexShapeSettings( ConvexShapeSettings & settings )
+{
+	// ask for precision
+	QDialog dlg;
+	QVBoxLayout * vbox = new QVBoxLayout;
+	dlg.setLayout( vbox );
+
+	vbox->addWidget( new QLabel( Spell::tr( "Enter the maximum roundoff error to use" ) ) );
+	vbox->addWidget( new QLabel( Spell::tr( "Larger values will give a less precise but better performing hull" ) ) );
+
+	QDoubleSpinBox * precSpin = new QDoubleSpinBox;
+	precSpin->setRange( 0, 5 );
+	precSpin->setDecimals( 3 );
+	precSpin->setSingleStep( 0.01 );
+	precSpin->setValue( settings.roundError );
+	vbox->addWidget( precSpin );
+
+	vbox->addWidget( new QLabel( Spell::tr( "Collision Radius" ) ) );
+
+	QDoubleSpinBox * spnRadius = new QDoubleSpinBox;
+	spnRadius->setRange( 0, 0.5 );
+	spnRadius->setDecimals( 4 );
+	spnRadius->setSingleStep( 0.001 );
+	spnRadius->setValue( settings.radius );
+	vbox->addWidget( spnRadius );
+
+	QHBoxLayout * hbox = new QHBoxLayout;
+	vbox->addLayout( hbox );
+
+	QPushButton * ok = new QPushButton;
+	ok->setText( Spell::tr( "Ok" ) );
+	hbox->addWidget( ok );
+
+	QPushButton * cancel = new QPushButton;
+	cancel->setText( Spell::tr( "Cancel" ) );
+	hbox->addWidget( cancel );
+
+	QObject::connect( ok, &QPushButton::clicked, &dlg, &QDialog::accept );
+	QObject::connect( cancel, &QPushButton::clicked, &dlg, &QDialog::reject );
+
+	if ( dlg.exec() != QDialog::Accepted )
+		return false;
+
+	settings.roundError = precSpin->value();
+	settings.radius = spnRadius->value();
+	return true;
+}
+
+//! A shape a convex shape is made for
+struct ConvexShapeJob
+{
+	QPersistentModelIndex iShape;
+	//! The vertices of the shape, offset by its translation
+	QVector<Vector3> verts;
+	float havokScale = 1.0f;
+
+	//! Whether computeConvexShape() ran
+	bool done = false;
+	QVector<Vector4> convexVerts;
+	QVector<Vector4> convexNorms;
+};
 
-		QModelIndex iData = nif->getBlock( nif->getLink( index, "Data" ) );
-		return iData.isValid();
+//! Read the vertices of a shape
+static bool readConvexShape( const NifModel * nif, const QModelIndex & index, ConvexShapeJob & job )
+{
+	QModelIndex iData = nif->getBlock( nif->getLink( index, "Data" ) );
+
+	if ( !iData.isValid() )
+		return false;
+
+	job.iShape = index;
+
+	job.havokScale = (nif->checkVersion( 0x14020007, 0x14020007 ) && nif->getUserVersion() >= 12) ? 10.0f : 1.0f;
+	job.havokScale *= havokConst;
+
+	/* get the verts of our mesh */
+	QVector<Vector3> verts = nif->getArray<Vector3>( iData, "Vertices" );
+
+	// Offset by translation of NiTriShape
+	Vector3 trans = nif->get<Vector3>( index, "Translation" );
+	job.verts.reserve( verts.count() );
+	for ( auto v : verts ) {
+		job.verts.append( v + trans );
 	}
 
-	QModelIndex cast( NifModel * nif, const QModelIndex & index ) override final
-	{
-		QModelIndex iData = nif->getBlock( nif->getLink( index, "Data" ) );
+	return true;
+}
 
-		if ( !iData.isValid() )
-			return index;
+//! Quantise the vertices to a fraction of the roundoff error and remove the duplicates, so that Qhull has fewer points to consider
+static QVector<Vector3> simplifyHullInput( const QVector<Vector3> & verts, float roundError )
+{
+	float step = roundError / 4;
 
-		float havokScale = (nif->checkVersion( 0x14020007, 0x14020007 ) && nif->getUserVersion() >= 12) ? 10.0f : 1.0f;
+	QVector<float> data;
+	data.reserve( verts.count() * 3 );
 
-		havokScale *= havokConst;
+	for ( const Vector3 & v : verts ) {
+		for ( int i = 0; i < 3; i++ )
+			data << ( ( step > 0 ) ? std::round( v[i] / step ) * step : v[i] );
+	}
 
-		/* those will be filled with the CVS data */
-		QVector<Vector4> convex_verts, convex_norms;
+	QVector<int> remap = weldVertices( data, 3 );
+	QVector<Vector3> points;
 
-		/* get the verts of our mesh */
-		QVector<Vector3> verts = nif->getArray<Vector3>( iData, "Vertices" );
-		QVector<Vector3> vertsTrans;
+	for ( int v = 0; v < remap.count(); v++ ) {
+		if ( remap[v] == v )
+			points.append( Vector3( data[v * 3], data[v * 3 + 1], data[v * 3 + 2] ) );
+	}
 
-		// Offset by translation of NiTriShape
-		Vector3 trans = nif->get<Vector3>( index, "Translation" );
-		for ( auto v : verts ) {
-			vertsTrans.append( v + trans );
-		}
+	return points;
+}
 
-		// to store results
-		QVector<Vector4> hullVerts, hullNorms;
+//! Sort the elements and remove the duplicates
+static void sortUnique( QVector<Vector4> & list )
+{
+	std::sort( list.begin(), list.end(), Vector4::lexLessThan );
+	list.erase( std::unique( list.begin(), list.end() ), list.end() );
+}
 
-		// ask for precision
-		QDialog dlg;
-		QVBoxLayout * vbox = new QVBoxLayout;
-		dlg.setLayout( vbox );
+//! Make the convex hull of a shape; only touches the job, so it may run on any thread
+static void computeConvexShape( ConvexShapeJob & job, float roundError )
+{
+	// to store results
+	QVector<Vector4> hullVerts, hullNorms;
 
-		vbox->addWidget( new QLabel( Spell::tr( "Enter the maximum roundoff error to use" ) ) );
-		vbox->addWidget( new QLabel( Spell::tr( "Larger values will give a less precise but better performing hull" ) ) );
+	/* make a convex hull from it */
+	compute_convex_hull( simplifyHullInput( job.verts, roundError ), hullVerts, hullNorms, roundError );
 
-		QDoubleSpinBox * precSpin = new QDoubleSpinBox;
-		precSpin->setRange( 0, 5 );
-		precSpin->setDecimals( 3 );
-		precSpin->setSingleStep( 0.01 );
-		precSpin->setValue( 0.25 );
-		vbox->addWidget( precSpin );
+	// sort and remove duplicate vertices
+	for ( Vector4 vert : hullVerts )
+		job.convexVerts.append( vert / job.havokScale );
 
-		vbox->addWidget( new QLabel( Spell::tr( "Collision Radius" ) ) );
+	sortUnique( job.convexVerts );
 
-		QDoubleSpinBox * spnRadius = new QDoubleSpinBox;
-		spnRadius->setRange( 0, 0.5 );
-		spnRadius->setDecimals( 4 );
-		spnRadius->setSingleStep( 0.001 );
-		spnRadius->setValue( 0.05 );
-		vbox->addWidget( spnRadius );
+	// sort and remove duplicate normals
+	for ( const Vector4 & norm : hullNorms )
+		job.convexNorms.append( Vector4( Vector3( norm ), norm[3] / job.havokScale ) );
 
-		QHBoxLayout * hbox = new QHBoxLayout;
-		vbox->addLayout( hbox );
+	sortUnique( job.convexNorms );
 
-		QPushButton * ok = new QPushButton;
-		ok->setText( Spell::tr( "Ok" ) );
-		hbox->addWidget( ok );
+	job.done = true;
+}
 
-		QPushButton * cancel = new QPushButton;
-		cancel->setText( Spell::tr( "Cancel" ) );
-		hbox->addWidget( cancel );
+//! Write the convex shape of a shape into the collision object of its parent
+static void writeConvexShape( NifModel * nif, const ConvexShapeJob & job, float radius )
+{
+	const QPersistentModelIndex & index = job.iShape;
 
-		QObject::connect( ok, &QPushButton::clicked, &dlg, &QDialog::accept );
-		QObject::connect( cancel, &QPushButton::clicked, &dlg, &QDialog::reject );
+	/* create the CVS block */
+	QModelIndex iCVS = nif->insertNiBlock( "bhkConvexVerticesShape" );
 
-		if ( dlg.exec() != QDialog::Accepted ) {
-			return index;
-		}
+	/* set CVS verts */
+	nif->set<uint>( iCVS, "Num Vertices", job.convexVerts.count() );
+	nif->updateArray( iCVS, "Vertices" );
+	nif->setArray<Vector4>( iCVS, "Vertices", job.convexVerts );
 
-		/* make a convex hull from it */
-		compute_convex_hull( vertsTrans, hullVerts, hullNorms, (float)precSpin->value() );
+	/* set CVS norms */
+	nif->set<uint>( iCVS, "Num Normals", job.convexNorms.count() );
+	nif->updateArray( iCVS, "Normals" );
+	nif->setArray<Vector4>( iCVS, "Normals", job.convexNorms );
 
-		// sort and remove duplicate vertices
-		QList<Vector4> sortedVerts;
-		for ( Vector4 vert : hullVerts ) {
-			vert /= havokScale;
+	// radius is always 0.1?
+	// TODO: Figure out if radius is not arbitrarily set in vanilla NIFs
+	nif->set<float>( iCVS, "Radius", radius );
 
-			if ( !sortedVerts.contains( vert ) ) {
-				sortedVerts.append( vert );
-			}
-		}
-		std::sort( sortedVerts.begin(), sortedVerts.end(), Vector4::lexLessThan );
-		QListIterator<Vector4> vertIter( sortedVerts );
+	// for arrow detection: [0, 0, -0, 0, 0, -0]
+	nif->set<float>( nif->getIndex( iCVS, "Unknown 6 Floats" ).child( 2, 0 ), -0.0 );
+	nif->set<float>( nif->getIndex( iCVS, "Unknown 6 Floats" ).child( 5, 0 ), -0.0 );
 
-		while ( vertIter.hasNext() ) {
-			Vector4 sorted = vertIter.next();
-			convex_verts.append( sorted );
-		}
+	QModelIndex iParent = nif->getBlock( nif->getParent( nif->getBlockNumber( index ) ) );
+	QModelIndex collisionLink = nif->getIndex( iParent, "Collision Object" );
+	QModelIndex collisionObject = nif->getBlock( nif->getLink( collisionLink ) );
 
-		// sort and remove duplicate normals
-		QList<Vector4> sortedNorms;
-		for ( Vector4 norm : hullNorms ) {
-			norm = Vector4( Vector3( norm ), norm[3] / havokScale );
+	// create bhkCollisionObject
+	if ( !collisionObject.isValid() ) {
+		collisionObject = nif->insertNiBlock( "bhkCollisionObject" );
 
-			if ( !sortedNorms.contains( norm ) ) {
-				sortedNorms.append( norm );
-			}
-		}
-		std::sort( sortedNorms.begin(), sortedNorms.end(), Vector4::lexLessThan );
-		QListIterator<Vector4> normIter( sortedNorms );
+		nif->setLink( collisionLink, nif->getBlockNumber( collisionObject ) );
+		nif->setLink( collisionObject, "Target", nif->getBlockNumber( iParent ) );
+	}
 
-		while ( normIter.hasNext() ) {
-			Vector4 sorted = normIter.next();
-			convex_norms.append( sorted );
-		}
+	QModelIndex rigidBodyLink = nif->getIndex( collisionObject, "Body" );
+	QModelIndex rigidBody = nif->getBlock( nif->getLink( rigidBodyLink ) );
 
-		/* create the CVS block */
-		QModelIndex iCVS = nif->insertNiBlock( "bhkConvexVerticesShape" );
+	// create bhkRigidBody
+	if ( !rigidBody.isValid() ) {
+		rigidBody = nif->insertNiBlock( "bhkRigidBody" );
 
-		/* set CVS verts */
-		nif->set<uint>( iCVS, "Num Vertices", convex_verts.count() );
-		nif->updateArray( iCVS, "Vertices" );
-		nif->setArray<Vector4>( iCVS, "Vertices", convex_verts );
+		nif->setLink( rigidBodyLink, nif->getBlockNumber( rigidBody ) );
+	}
 
-		/* set CVS norms */
-		nif->set<uint>( iCVS, "Num Normals", convex_norms.count() );
-		nif->updateArray( iCVS, "Normals" );
-		nif->setArray<Vector4>( iCVS, "Normals", convex_norms );
+	QModelIndex shapeLink = nif->getIndex( rigidBody, "Shape" );
+	QModelIndex shape = nif->getBlock( nif->getLink( shapeLink ) );
 
-		// radius is always 0.1?
-		// TODO: Figure out if radius is not arbitrarily set in vanilla NIFs
-		nif->set<float>( iCVS, "Radius", spnRadius->value() );
+	// set link and delete old one
+	nif->setLink( shapeLink, nif->getBlockNumber( iCVS ) );
 
-		// for arrow detection: [0, 0, -0, 0, 0, -0]
-		nif->set<float>( nif->getIndex( iCVS, "Unknown 6 Floats" ).child( 2, 0 ), -0.0 );
-		nif->set<float>( nif->getIndex( iCVS, "Unknown 6 Floats" ).child( 5, 0 ), -0.0 );
+	if ( shape.isValid() ) {
+		// cheaper than calling spRemoveBranch
+		nif->removeNiBlock( nif->getBlockNumber( shape ) );
+	}
+}
 
-		QModelIndex iParent = nif->getBlock( nif->getParent( nif->getBlockNumber( index ) ) );
-		QModelIndex collisionLink = nif->getIndex( iParent, "Collision Object" );
-		QModelIndex collisionObject = nif->getBlock( nif->getLink( collisionLink ) );
+//! Creates a convex hull using Qhull
+class spCreateCVS final : public Spell
+{
+public:
+	QString name() const override final { return Spell::tr( "Create Convex Shape" ); }
+	QString page() const override final { return Spell::tr( "Havok" ); }
+	bool interactive() const override final { return true; }
 
-		// create bhkCollisionObject
-		if ( !collisionObject.isValid() ) {
-			collisionObject = nif->insertNiBlock( "bhkCollisionObject" );
+	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
+	{
+		if ( !nif->inherits( index, "NiTriBasedGeom" ) || !nif->checkVersion( 0x0A000100, 0 ) )
+			return false;
 
-			nif->setLink( collisionLink, nif->getBlockNumber( collisionObject ) );
-			nif->setLink( collisionObject, "Target", nif->getBlockNumber( iParent ) );
-		}
+		QModelIndex iData = nif->getBlock( nif->getLink( index, "Data" ) );
+		return iData.isValid();
+	}
+
+	QModelIndex cast( NifModel * nif, const QModelIndex & index ) override final
+	{
+		ConvexShapeJob job;
+
+		if ( !readConvexShape( nif, index, job ) )
+			return index;
+
+		ConvexShapeSettings settings;
+
+		if ( !askConvexShapeSettings( settings ) )
+			return index;
+
+		computeConvexShape( job, settings.roundError );
+		writeConvexShape( nif, job, settings.radius );
+
+		Message::info( nullptr, Spell::tr( "Created hull with %1 vertices, %2 normals" ).arg( job.convexVerts.count() ).arg( job.convexNorms.count() ) );
+
+		// returning iCVS here can crash NifSkope if a child array is selected
+		return job.iShape;
+	}
+};
+
+REGISTER_SPELL( spCreateCVS )
+
+//! Creates convex hulls for all shapes
+class spCreateAllCVS final : public Spell
+{
+public:
+	QString name() const override final { return Spell::tr( "Create All Convex Shapes" ); }
+	QString page() const override final { return Spell::tr( "Batch" ); }
+	bool interactive() const override final { return true; }
+
+	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
+	{
+		return nif && !index.isValid() && nif->checkVersion( 0x0A000100, 0 );
+	}
 
-		QModelIndex rigidBodyLink = nif->getIndex( collisionObject, "Body" );
-		QModelIndex rigidBody = nif->getBlock( nif->getLink( rigidBodyLink ) );
+	QModelIndex cast( NifModel * nif, const QModelIndex & ) override final
+	{
+		spCreateCVS creator;
+		QVector<ConvexShapeJob> jobs;
 
-		// create bhkRigidBody
-		if ( !rigidBody.isValid() ) {
-			rigidBody = nif->insertNiBlock( "bhkRigidBody" );
+		for ( int n = 0; n < nif->getBlockCount(); n++ ) {
+			QModelIndex idx = nif->getBlock( n );
+			ConvexShapeJob job;
 
-			nif->setLink( rigidBodyLink, nif->getBlockNumber( rigidBody ) );
+			if ( creator.isApplicable( nif, idx ) && readConvexShape( nif, idx, job ) )
+				jobs.append( job );
 		}
 
-		QModelIndex shapeLink = nif->getIndex( rigidBody, "Shape" );
-		QModelIndex shape = nif->getBlock( nif->getLink( shapeLink ) );
+		ConvexShapeSettings settings;
+
+		if ( jobs.isEmpty() || !askConvexShapeSettings( settings ) )
+			return QModelIndex();
 
-		// set link and delete old one
-		nif->setLink( shapeLink, nif->getBlockNumber( iCVS ) );
+		ConvexShapeJob * data = jobs.data();
+		float roundError = settings.roundError;
+		Spell::parallelFor( jobs.count(), [data, roundError]( int i ) {
+			computeConvexShape( data[i], roundError );
+		}, Spell::tr( "Creating convex shapes..." ) );
 
-		if ( shape.isValid() ) {
-			// cheaper than calling spRemoveBranch
-			nif->removeNiBlock( nif->getBlockNumber( shape ) );
+		// Update the model once after all shapes are written, skipping those cancelled
+		bool oldHoldUpdates = nif->holdUpdates( true );
+		int count = 0;
+
+		for ( const ConvexShapeJob & job : jobs ) {
+			if ( job.done && job.iShape.isValid() ) {
+				writeConvexShape( nif, job, settings.radius );
+				count++;
+			}
 		}
 
-		Message::info( nullptr, Spell::tr( "Created hull with %1 vertices, %2 normals" ).arg( convex_verts.count() ).arg( convex_norms.count() ) );
+		if ( !oldHoldUpdates )
+			nif->holdUpdates( false );
 
-		// returning iCVS here can crash NifSkope if a child array is selected
-		return index;
+		Message::info( nullptr, Spell::tr( "Created %1 of %2 convex shapes" ).arg( count ).arg( jobs.count() ) );
+
+		return QModelIndex();
 	}
 };
 
-REGISTER_SPELL( spCreateCVS )
+REGISTER_SPELL( spCreateAllCVS )
 
 //! Transforms Havok constraints
 class spConstraintHelper final : public Spell
@@ -361,6 +491,163 @@ public:
 
 REGISTER_SPELL( spStiffSpringHelper )
 
+//! A bhkNiTriStripsShape packed into a bhkPackedNiTriStripsShape
+struct PackStripsJob
+{
+	QPersistentModelIndex iShape;
+	int material = 0;
+	//! The vertices and strips of each NiTriStripsData
+	QList<QVector<Vector3>> dataVerts;
+	QList<QList<QVector<quint16>>> dataStrips;
+
+	//! The welded vertices in Havok units
+	QVector<Vector3> vertices;
+	QVector<Triangle> triangles;
+	QVector<Vector3> normals;
+};
+
+//! Read the strips of a bhkNiTriStripsShape
+static void readPackStrips( const NifModel * nif, const QModelIndex & iShape, PackStripsJob & job )
+{
+	job.iShape = iShape;
+	job.material = nif->get<int>( iShape, "Material" );
+
+	for ( const auto lData : nif->getLinkArray( iShape, "Strips Data" ) ) {
+		QModelIndex iData = nif->getBlock( lData, "NiTriStripsData" );
+
+		if ( !iData.isValid() )
+			continue;
+
+		QList<QVector<quint16>> strips;
+		QModelIndex iPoints = nif->getIndex( iData, "Points" );
+
+		for ( int x = 0; x < nif->rowCount( iPoints ); x++ )
+			strips << nif->getArray<quint16>( iPoints.child( x, 0 ) );
+
+		job.dataVerts << nif->getArray<Vector3>( iData, "Vertices" );
+		job.dataStrips << strips;
+	}
+}
+
+//! Triangulate and weld the strips of a job; only touches the job, so it may run on any thread
+/*!
+ * The vertices which the strips of all NiTriStripsData share are welded into
+ * one, so that the packed shape is a connected mesh. Triangles which collapse
+ * and vertices which are no longer used are dropped.
+ */
+static void computePackStrips( PackStripsJob & job )
+{
+	QVector<Vector3> verts;
+	QVector<Triangle> tris;
+
+	for ( int d = 0; d < job.dataVerts.count(); d++ ) {
+		const QVector<Vector3> & vrts = job.dataVerts[d];
+		int offset = verts.count();
+
+		for ( const Triangle & t : triangulate( job.dataStrips[d] ) ) {
+			if ( t[0] < vrts.count() && t[1] < vrts.count() && t[2] < vrts.count() )
+				tris << Triangle( t[0] + offset, t[1] + offset, t[2] + offset );
+		}
+
+		for ( const Vector3 & v : vrts )
+			verts << v / havokConst;
+	}
+
+	QVector<float> positions;
+	positions.reserve( verts.count() * 3 );
+
+	for ( const Vector3 & v : verts )
+		positions << v[0] << v[1] << v[2];
+
+	QVector<int> remap = weldVertices( positions, 3 );
+	QVector<int> newIndex( verts.count(), -1 );
+
+	job.vertices.clear();
+	job.triangles.clear();
+	job.normals.clear();
+
+	for ( const Triangle & t : tris ) {
+		int corner[3] = { remap[t[0]], remap[t[1]], remap[t[2]] };
+
+		if ( corner[0] == corner[1] || corner[1] == corner[2] || corner[2] == corner[0] )
+			continue;
+
+		for ( int & c : corner ) {
+			if ( newIndex[c] < 0 ) {
+				newIndex[c] = job.vertices.count();
+				job.vertices << verts[c];
+			}
+
+			c = newIndex[c];
+		}
+
+		const Vector3 & a = job.vertices[corner[0]];
+		const Vector3 & b = job.vertices[corner[1]];
+		const Vector3 & c = job.vertices[corner[2]];
+
+		job.triangles << Triangle( corner[0], corner[1], corner[2] );
+		job.normals << Vector3::crossproduct( b - a, c - a ).normalize();
+	}
+}
+
+//! Replace the bhkNiTriStripsShape of a job by a bhkPackedNiTriStripsShape, returning the new shape
+static QModelIndex writePackStrips( NifModel * nif, const PackStripsJob & job )
+{
+	QPersistentModelIndex iShape = job.iShape;
+	const QVector<Vector3> & vertices = job.vertices;
+	const QVector<Triangle> & triangles = job.triangles;
+
+	QPersistentModelIndex iPackedShape = nif->insertNiBlock( "bhkPackedNiTriStripsShape", nif->getBlockNumber( iShape ) );
+
+	nif->set<int>( iPackedShape, "Num Sub Shapes", 1 );
+	QModelIndex iSubShapes = nif->getIndex( iPackedShape, "Sub Shapes" );
+	nif->updateArray( iSubShapes );
+	nif->set<int>( iSubShapes.child( 0, 0 ), "Layer", 1 );
+	nif->set<int>( iSubShapes.child( 0, 0 ), "Num Vertices", vertices.count() );
+	nif->set<int>( iSubShapes.child( 0, 0 ), "Material", job.material );
+	nif->setArray<float>( iPackedShape, "Unknown Floats", { 0.0f, 0.0f, 0.1f, 0.0f, 1.0f, 1.0f, 1.0f, 1.0f, 0.1f } );
+	nif->set<float>( iPackedShape, "Scale", 1.0f );
+	nif->setArray<float>( iPackedShape, "Unknown Floats 2", { 1.0f, 1.0f, 1.0f } );
+
+	QModelIndex iPackedData = nif->insertNiBlock( "hkPackedNiTriStripsData", nif->getBlockNumber( iPackedShape ) );
+	nif->setLink( iPackedShape, "Data", nif->getBlockNumber( iPackedData ) );
+
+	nif->set<int>( iPackedData, "Num Triangles", triangles.count() );
+	QModelIndex iTriangles = nif->getIndex( iPackedData, "Triangles" );
+	nif->updateArray( iTriangles );
+
+	// Every triangle has the same fields, find their rows once
+	static const NifFieldId fTriangle( "Triangle" );
+	static const NifFieldId fNormal( "Normal" );
+	int rTriangle = triangles.isEmpty() ? -1 : nif->getIndex( iTriangles.child( 0, 0 ), fTriangle ).row();
+	int rNormal = triangles.isEmpty() ? -1 : nif->getIndex( iTriangles.child( 0, 0 ), fNormal ).row();
+
+	for ( int t = 0; t < triangles.size(); t++ ) {
+		QModelIndex iTriangle = iTriangles.child( t, 0 );
+		nif->set<Triangle>( iTriangle.child( rTriangle, 0 ), triangles[ t ] );
+
+		if ( rNormal >= 0 )
+			nif->set<Vector3>( iTriangle.child( rNormal, 0 ), job.normals.value( t ) );
+	}
+
+	nif->set<int>( iPackedData, "Num Vertices", vertices.count() );
+	QModelIndex iVertices = nif->getIndex( iPackedData, "Vertices" );
+	nif->updateArray( iVertices );
+	nif->setArray<Vector3>( iVertices, vertices );
+
+	QMap<qint32, qint32> lnkmap;
+	lnkmap.insert( nif->getBlockNumber( iShape ), nif->getBlockNumber( iPackedShape ) );
+	nif->mapLinks( lnkmap );
+
+	// *** THIS SOMETIMES CRASHES NIFSKOPE        ***
+	// *** UNCOMMENT WHEN BRANCH REMOVER IS FIXED ***
+	// See issue #2508255
+	spRemoveBranch BranchRemover;
+	BranchRemover.castIfApplicable( nif, iShape );
+
+	return iPackedShape;
+}
+
 //! Packs Havok strips
 class spPackHavokStrips final : public Spell
 {
@@ -375,97 +662,85 @@ public:
 
 	QModelIndex cast( NifModel * nif, const QModelIndex & iBlock ) override final
 	{
-		QPersistentModelIndex iShape( iBlock );
-
-		QVector<Vector3> vertices;
-		QVector<Triangle> triangles;
-		QVector<Vector3> normals;
+		PackStripsJob job;
+		readPackStrips( nif, iBlock, job );
+		computePackStrips( job );
 
-		for ( const auto lData : nif->getLinkArray( iShape, "Strips Data" ) ) {
-			QModelIndex iData = nif->getBlock( lData, "NiTriStripsData" );
+		if ( job.vertices.isEmpty() || job.triangles.isEmpty() ) {
+			Message::warning( nullptr, Spell::tr( "No mesh data was found." ) );
+			return iBlock;
+		}
 
-			if ( iData.isValid() ) {
-				QVector<Vector3> vrts = nif->getArray<Vector3>( iData, "Vertices" );
-				QVector<Triangle> tris;
-				QVector<Vector3> nrms;
+		return writePackStrips( nif, job );
+	}
+};
 
-				QModelIndex iPoints = nif->getIndex( iData, "Points" );
+REGISTER_SPELL( spPackHavokStrips )
 
-				for ( int x = 0; x < nif->rowCount( iPoints ); x++ ) {
-					tris += triangulate( nif->getArray<quint16>( iPoints.child( x, 0 ) ) );
-				}
+//! Packs the Havok strips of all shapes in this model
+/*!
+ * The strips are triangulated and welded in parallel. Once the shapes are
+ * replaced, the MOPP codes are updated where they can be.
+ */
+class spPackAllHavokStrips final : public Spell
+{
+public:
+	QString name() const override final { return Spell::tr( "Pack All Strips" ); }
+	QString page() const override final { return Spell::tr( "Batch" ); }
 
-				QMutableVectorIterator<Triangle> it( tris );
+	bool isApplicable( const NifModel * nif, const QModelIndex & idx ) override final
+	{
+		if ( !nif || idx.isValid() )
+			return false;
 
-				while ( it.hasNext() ) {
-					Triangle & tri = it.next();
+		for ( int n = 0; n < nif->getBlockCount(); n++ ) {
+			if ( nif->isNiBlock( nif->getBlock( n ), "bhkNiTriStripsShape" ) )
+				return true;
+		}
 
-					Vector3 a = vrts.value( tri[0] );
-					Vector3 b = vrts.value( tri[1] );
-					Vector3 c = vrts.value( tri[2] );
+		return false;
+	}
 
-					nrms << Vector3::crossproduct( b - a, c - a ).normalize();
+	QModelIndex cast( NifModel * nif, const QModelIndex & ) override final
+	{
+		QVector<PackStripsJob> jobs;
 
-					tri[0] += vertices.count();
-					tri[1] += vertices.count();
-					tri[2] += vertices.count();
-				}
+		for ( int n = 0; n < nif->getBlockCount(); n++ ) {
+			QModelIndex iBlock = nif->getBlock( n );
 
-				for ( const Vector3& v : vrts ) {
-					vertices += v / 7;
-				}
-				triangles += tris;
-				normals += nrms;
+			if ( nif->isNiBlock( iBlock, "bhkNiTriStripsShape" ) ) {
+				PackStripsJob job;
+				readPackStrips( nif, iBlock, job );
+				jobs.append( job );
 			}
 		}
 
-		if ( vertices.isEmpty() || triangles.isEmpty() ) {
-			Message::warning( nullptr, Spell::tr( "No mesh data was found." ) );
-			return iShape;
-		}
+		Spell::parallelFor( jobs.count(), [&jobs]( int i ) {
+			computePackStrips( jobs[i] );
+		}, Spell::tr( "Packing strips..." ) );
 
-		QPersistentModelIndex iPackedShape = nif->insertNiBlock( "bhkPackedNiTriStripsShape", nif->getBlockNumber( iShape ) );
+		bool old = nif->holdUpdates( true );
 
-		nif->set<int>( iPackedShape, "Num Sub Shapes", 1 );
-		QModelIndex iSubShapes = nif->getIndex( iPackedShape, "Sub Shapes" );
-		nif->updateArray( iSubShapes );
-		nif->set<int>( iSubShapes.child( 0, 0 ), "Layer", 1 );
-		nif->set<int>( iSubShapes.child( 0, 0 ), "Num Vertices", vertices.count() );
-		nif->set<int>( iSubShapes.child( 0, 0 ), "Material", nif->get<int>( iShape, "Material" ) );
-		nif->setArray<float>( iPackedShape, "Unknown Floats", { 0.0f, 0.0f, 0.1f, 0.0f, 1.0f, 1.0f, 1.0f, 1.0f, 0.1f } );
-		nif->set<float>( iPackedShape, "Scale", 1.0f );
-		nif->setArray<float>( iPackedShape, "Unknown Floats 2", { 1.0f, 1.0f, 1.0f } );
-
-		QModelIndex iPackedData = nif->insertNiBlock( "hkPackedNiTriStripsData", nif->getBlockNumber( iPackedShape ) );
-		nif->setLink( iPackedShape, "Data", nif->getBlockNumber( iPackedData ) );
-
-		nif->set<int>( iPackedData, "Num Triangles", triangles.count() );
-		QModelIndex iTriangles = nif->getIndex( iPackedData, "Triangles" );
-		nif->updateArray( iTriangles );
-
-		for ( int t = 0; t < triangles.size(); t++ ) {
-			nif->set<Triangle>( iTriangles.child( t, 0 ), "Triangle", triangles[ t ] );
-			nif->set<Vector3>( iTriangles.child( t, 0 ), "Normal", normals.value( t ) );
+		for ( const PackStripsJob & job : jobs ) {
+			if ( job.vertices.isEmpty() || job.triangles.isEmpty() )
+				Message::append( Spell::tr( "Some strips could not be packed." ), Spell::tr( "Block %1: %2" )
+					.arg( nif->getBlockNumber( job.iShape ) ).arg( Spell::tr( "No mesh data was found." ) ) );
+			else
+				writePackStrips( nif, job );
 		}
 
-		nif->set<int>( iPackedData, "Num Vertices", vertices.count() );
-		QModelIndex iVertices = nif->getIndex( iPackedData, "Vertices" );
-		nif->updateArray( iVertices );
-		nif->setArray<Vector3>( iVertices, vertices );
+		if ( !old )
+			nif->holdUpdates( false );
 
-		QMap<qint32, qint32> lnkmap;
-		lnkmap.insert( nif->getBlockNumber( iShape ), nif->getBlockNumber( iPackedShape ) );
-		nif->mapLinks( lnkmap );
+		// The MOPP codes of the packed shapes are out of date
+		SpellPtr mopp = SpellBook::lookup( Spell::tr( "Batch" ) + "/" + Spell::tr( "Update All MOPP Code" ) );
 
-		// *** THIS SOMETIMES CRASHES NIFSKOPE        ***
-		// *** UNCOMMENT WHEN BRANCH REMOVER IS FIXED ***
-		// See issue #2508255
-		spRemoveBranch BranchRemover;
-		BranchRemover.castIfApplicable( nif, iShape );
+		if ( mopp )
+			mopp->castIfApplicable( nif, QModelIndex() );
 
-		return iPackedShape;
+		return QModelIndex();
 	}
 };
 
-REGISTER_SPELL( spPackHavokStrips )
+REGISTER_SPELL( spPackAllHavokStrips )
 
@@ -68,6 +68,7 @@ class spEditStringIndex final : public Spell
 public:
 	QString name() const override final { return Spell::tr( "Edit String Index" ); }
 	QString page() const override final { return Spell::tr( "" ); }
+	bool interactive() const override final { return true; }
 	QIcon icon() const
 	{
 		if ( !txt_xpm_icon )
@@ -76,6 +77,7 @@ public:
 		return *txt_xpm_icon;
 	}
 	bool instant() const { return true; }
+	QList<NifValue::Type> applicableValues() const override final { return { NifValue::tStringIndex, NifValue::tString, NifValue::tFilePath }; }
 
 	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
 	{
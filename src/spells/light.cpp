@@ -57,6 +57,7 @@ class spLightEdit final : public Spell
 public:
 	QString name() const override final { return Spell::tr( "Light" ); }
 	QString page() const override final { return Spell::tr( "" ); }
+	bool interactive() const override final { return true; }
 	bool instant() const { return true; }
 	QIcon icon() const
 	{
@@ -65,6 +66,7 @@ public:
 
 		return *light42_xpm_icon;
 	}
+	QStringList applicableBlocks() const override final { return { "NiLight" }; }
 
 	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
 	{
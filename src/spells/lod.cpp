@@ -0,0 +1,728 @@
+#include "spellbook.h"
+#include "blocks.h"
+
+#include "nifsnapshot.h"
+
+#include <QBuffer>
+#include <QHash>
+#include <QInputDialog>
+#include <QRegularExpression>
+#include <QSettings>
+
+#include <algorithm>
+#include <cfloat>
+#include <functional> // std::greater
+#include <queue>
+
+
+// Brief description is deliberately not autolinked to class Spell
+/*! \file lod.cpp
+ * \brief Level of detail generation spells
+ *
+ * All classes here inherit from the Spell class.
+ */
+
+//! The error of a point against a set of planes, as the symmetric 4x4 matrix of Garland and Heckbert
+struct Quadric
+{
+	//! The upper triangle of the matrix, row by row
+	double a[10] = {};
+
+	//! Add the plane n . p + d = 0 of a unit normal, weighted by \a w
+	void addPlane( const Vector3 & n, double d, double w )
+	{
+		const double x = n[0], y = n[1], z = n[2];
+
+		a[0] += w * x * x; a[1] += w * x * y; a[2] += w * x * z; a[3] += w * x * d;
+		a[4] += w * y * y; a[5] += w * y * z; a[6] += w * y * d;
+		a[7] += w * z * z; a[8] += w * z * d;
+		a[9] += w * d * d;
+	}
+
+	Quadric & operator+=( const Quadric & other )
+	{
+		for ( int i = 0; i < 10; i++ )
+			a[i] += other.a[i];
+
+		return *this;
+	}
+
+	//! The weighted sum of the squared distances of \a p to the planes
+	double error( const Vector3 & p ) const
+	{
+		const double x = p[0], y = p[1], z = p[2];
+
+		return a[0] * x * x + 2 * a[1] * x * y + 2 * a[2] * x * z + 2 * a[3] * x
+		     + a[4] * y * y + 2 * a[5] * y * z + 2 * a[6] * y
+		     + a[7] * z * z + 2 * a[8] * z
+		     + a[9];
+	}
+};
+
+//! Collapses the edges of a triangle mesh one by one, the cheapest by quadric error first
+/*!
+ * Each collapse moves a vertex onto one of its neighbours, so every vertex
+ * which is left keeps its position, normal, UVs, colors and skin weights.
+ * The vertices of edges used by a single triangle are never moved: those are
+ * the borders of the mesh and the seams along which vertices are split for
+ * their UVs, normals or colors, so the seams stay where they are.
+ */
+class MeshSimplifier final
+{
+public:
+	MeshSimplifier( const QVector<Vector3> & vertices, const QVector<Triangle> & triangles )
+		: verts( vertices ), faces( triangles )
+	{
+	}
+
+	//! Collapse edges until at most \a target triangles are left, returning the triangles
+	QVector<Triangle> simplify( int target, const SpellProgress & progress );
+
+protected:
+	struct Candidate
+	{
+		double cost;
+		int from;
+		int to;
+		int stamp;
+
+		bool operator>( const Candidate & other ) const { return cost > other.cost; }
+	};
+
+	//! The vertices of the triangles around \a v, without \a v
+	QVector<int> neighbours( int v ) const;
+	//! Whether moving \a from onto \a to keeps the surface manifold and flips no triangle
+	bool canCollapse( int from, int to ) const;
+	//! Queue the cheapest collapse of \a v, replacing the one queued before
+	void queue( int v );
+
+	const QVector<Vector3> & verts;
+	QVector<Triangle> faces;
+	QVector<bool> removed;
+	QVector<QVector<int>> vertexFaces;
+	QVector<Quadric> quadrics;
+	QVector<bool> locked;
+	QVector<bool> collapsed;
+	QVector<int> stamps;
+	std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> heap;
+};
+
+QVector<Triangle> MeshSimplifier::simplify( int target, const SpellProgress & progress )
+{
+	const int numVerts = verts.count();
+
+	removed.fill( false, faces.count() );
+	vertexFaces.resize( numVerts );
+	quadrics.resize( numVerts );
+	locked.fill( false, numVerts );
+	collapsed.fill( false, numVerts );
+	stamps.fill( 0, numVerts );
+
+	int alive = 0;
+	QHash<quint32, int> edgeUse;
+
+	for ( int f = 0; f < faces.count(); f++ ) {
+		const Triangle & t = faces.at( f );
+
+		if ( t[0] >= numVerts || t[1] >= numVerts || t[2] >= numVerts || t[0] == t[1] || t[1] == t[2] || t[2] == t[0] ) {
+			removed[f] = true;
+			continue;
+		}
+
+		alive++;
+
+		Vector3 n = Vector3::crossproduct( verts[t[1]] - verts[t[0]], verts[t[2]] - verts[t[0]] );
+		const float area = n.length();
+
+		for ( int k = 0; k < 3; k++ ) {
+			vertexFaces[t[k]].append( f );
+
+			quint16 a = t[k], b = t[( k + 1 ) % 3];
+			edgeUse[( quint32( qMin( a, b ) ) << 16 ) | qMax( a, b )]++;
+
+			if ( area > 0 )
+				quadrics[t[k]].addPlane( n / area, -Vector3::dotproduct( n / area, verts[t[0]] ), area );
+		}
+	}
+
+	// Borders, seams and edges shared by more than two triangles stay
+	for ( auto it = edgeUse.cbegin(); it != edgeUse.cend(); ++it ) {
+		if ( it.value() != 2 ) {
+			locked[int( it.key() >> 16 )] = true;
+			locked[int( it.key() & 0xffff )] = true;
+		}
+	}
+
+	for ( int v = 0; v < numVerts; v++ )
+		queue( v );
+
+	int collapses = 0;
+
+	while ( alive > target && !heap.empty() ) {
+		if ( ( ++collapses & 1023 ) == 0 && progress.isCanceled() )
+			break;
+
+		const Candidate c = heap.top();
+		heap.pop();
+
+		if ( c.stamp != stamps.at( c.from ) || collapsed.at( c.from ) || collapsed.at( c.to ) )
+			continue;
+
+		if ( !canCollapse( c.from, c.to ) ) {
+			// Tried again once its neighbourhood changes
+			stamps[c.from]++;
+			continue;
+		}
+
+		for ( int f : vertexFaces.at( c.from ) ) {
+			if ( removed.at( f ) )
+				continue;
+
+			Triangle & t = faces[f];
+
+			if ( t[0] == c.to || t[1] == c.to || t[2] == c.to ) {
+				removed[f] = true;
+				alive--;
+				continue;
+			}
+
+			for ( int k = 0; k < 3; k++ ) {
+				if ( t[k] == c.from )
+					t[k] = quint16( c.to );
+			}
+
+			vertexFaces[c.to].append( f );
+		}
+
+		collapsed[c.from] = true;
+		vertexFaces[c.from].clear();
+		quadrics[c.to] += quadrics.at( c.from );
+
+		QVector<int> & around = vertexFaces[c.to];
+		around.erase( std::remove_if( around.begin(), around.end(), [this]( int f ) { return removed.at( f ); } ), around.end() );
+
+		queue( c.to );
+		for ( int n : neighbours( c.to ) )
+			queue( n );
+	}
+
+	QVector<Triangle> result;
+	result.reserve( alive );
+
+	for ( int f = 0; f < faces.count(); f++ ) {
+		if ( !removed.at( f ) )
+			result.append( faces.at( f ) );
+	}
+
+	return result;
+}
+
+QVector<int> MeshSimplifier::neighbours( int v ) const
+{
+	QVector<int> result;
+
+	for ( int f : vertexFaces.at( v ) ) {
+		if ( removed.at( f ) )
+			continue;
+
+		for ( int k = 0; k < 3; k++ ) {
+			int n = faces.at( f )[k];
+			if ( n != v && !result.contains( n ) )
+				result.append( n );
+		}
+	}
+
+	return result;
+}
+
+bool MeshSimplifier::canCollapse( int from, int to ) const
+{
+	// The edge must be shared by as many triangles as the two vertices have neighbours in common
+	const QVector<int> fromNeighbours = neighbours( from );
+	const QVector<int> toNeighbours = neighbours( to );
+
+	int common = 0;
+	for ( int n : fromNeighbours ) {
+		if ( toNeighbours.contains( n ) )
+			common++;
+	}
+
+	int shared = 0;
+
+	for ( int f : vertexFaces.at( from ) ) {
+		if ( removed.at( f ) )
+			continue;
+
+		const Triangle & t = faces.at( f );
+
+		if ( t[0] == to || t[1] == to || t[2] == to ) {
+			shared++;
+			continue;
+		}
+
+		// The triangles which are kept must not turn over or become slivers
+		Vector3 p[3], q[3];
+		for ( int k = 0; k < 3; k++ ) {
+			p[k] = verts.at( t[k] );
+			q[k] = ( t[k] == from ) ? verts.at( to ) : p[k];
+		}
+
+		Vector3 before = Vector3::crossproduct( p[1] - p[0], p[2] - p[0] );
+		Vector3 after = Vector3::crossproduct( q[1] - q[0], q[2] - q[0] );
+
+		if ( Vector3::dotproduct( before, after ) <= 0.2f * before.length() * after.length() )
+			return false;
+	}
+
+	return shared == common;
+}
+
+void MeshSimplifier::queue( int v )
+{
+	if ( locked.at( v ) || collapsed.at( v ) )
+		return;
+
+	const int stamp = ++stamps[v];
+
+	Candidate best{ DBL_MAX, v, -1, stamp };
+
+	for ( int n : neighbours( v ) ) {
+		Quadric q = quadrics.at( v );
+		q += quadrics.at( n );
+
+		const double cost = q.error( verts.at( n ) );
+		if ( cost < best.cost ) {
+			best.cost = cost;
+			best.to = n;
+		}
+	}
+
+	if ( best.to >= 0 )
+		heap.push( best );
+}
+
+
+//! One level of detail of a shape
+struct LODLevel
+{
+	//! The vertex of the shape each vertex of the level is copied from
+	QVector<int> vertices;
+	//! The triangles, numbered by the vertices of the level
+	QVector<Triangle> triangles;
+};
+
+//! The levels of detail computed for a shape
+struct LODJob
+{
+	int shape = -1;
+	int data = -1;
+	//! The bounding sphere of the shape, in the space of its parent
+	Vector3 center;
+	float radius = 0;
+	QVector<LODLevel> levels;
+	QString error;
+};
+
+//! Whether \a index is a shape "Generate LOD" can be cast on
+static bool canGenerateLOD( const NifModel * nif, const QModelIndex & index )
+{
+	if ( !nif->isNiBlock( index, "NiTriShape" ) )
+		return false;
+
+	// Skin partitions hold the triangles of the shape, the levels would need their own
+	if ( nif->getLink( index, "Skin Instance" ) >= 0 )
+		return false;
+
+	if ( !nif->isNiBlock( nif->getBlock( nif->getLink( index, "Data" ) ), "NiTriShapeData" ) )
+		return false;
+
+	// The levels replace the shape below its parent node
+	QModelIndex iParent = nif->getBlock( nif->getParent( nif->getBlockNumber( index ) ) );
+
+	return nif->inherits( iParent, "NiNode" ) && !nif->isNiBlock( iParent, "NiLODNode" );
+}
+
+//! Compute the levels of a shape with this fraction of the triangles of the shape each
+static void computeLOD( const NifSnapshot & snapshot, LODJob & job, const QVector<float> & ratios, const SpellProgress & progress )
+{
+	const int iShape = snapshot.block( job.shape );
+	const int iData = snapshot.block( job.data );
+
+	if ( iShape < 0 || iData < 0 ) {
+		job.error = Spell::tr( "Block %1 is no longer a shape with triangle data." ).arg( job.shape );
+		return;
+	}
+
+	const QVector<Vector3> verts = snapshot.getArray<Vector3>( iData, "Vertices" );
+	QVector<Triangle> tris = snapshot.getArray<Triangle>( iData, "Triangles" );
+
+	if ( verts.isEmpty() || tris.isEmpty() ) {
+		job.error = Spell::tr( "Block %1 has no triangles." ).arg( job.shape );
+		return;
+	}
+
+	const int original = tris.count();
+
+	// Each level is simplified from the one before, so the seams it keeps are the same
+	for ( float ratio : ratios ) {
+		MeshSimplifier simplifier( verts, tris );
+		QVector<Triangle> reduced = simplifier.simplify( qMax( 1, int( original * ratio ) ), progress );
+
+		if ( progress.isCanceled() )
+			return;
+
+		if ( reduced.isEmpty() || reduced.count() >= tris.count() )
+			break;
+
+		tris = reduced;
+
+		// Only the vertices the triangles use are copied, in their order in the shape
+		QVector<int> renumber( verts.count(), -1 );
+		for ( const Triangle & t : tris ) {
+			for ( int k = 0; k < 3; k++ )
+				renumber[t[k]] = 0;
+		}
+
+		LODLevel level;
+		for ( int v = 0; v < verts.count(); v++ ) {
+			if ( renumber.at( v ) == 0 ) {
+				renumber[v] = level.vertices.count();
+				level.vertices.append( v );
+			}
+		}
+
+		level.triangles.reserve( tris.count() );
+		for ( const Triangle & t : tris )
+			level.triangles.append( Triangle( renumber.at( t[0] ), renumber.at( t[1] ), renumber.at( t[2] ) ) );
+
+		job.levels.append( level );
+	}
+}
+
+//! Copy a block to the end of the blocks, without linking it
+static QModelIndex copyBlock( NifModel * nif, const QModelIndex & iBlock )
+{
+	QByteArray data;
+	QBuffer buffer( &data );
+
+	if ( !buffer.open( QIODevice::WriteOnly ) || !nif->saveIndex( buffer, iBlock ) )
+		return QModelIndex();
+
+	buffer.close();
+
+	if ( !buffer.open( QIODevice::ReadOnly ) )
+		return QModelIndex();
+
+	QModelIndex iCopy = nif->insertNiBlock( nif->getBlockName( iBlock ), nif->getBlockCount() );
+	nif->loadIndex( buffer, iCopy );
+
+	return iCopy;
+}
+
+//! The elements of \a values picked by \a map
+template <typename T> static QVector<T> pick( const QVector<T> & values, const QVector<int> & map )
+{
+	QVector<T> result;
+	result.reserve( map.count() );
+
+	for ( int v : map )
+		result.append( values.value( v ) );
+
+	return result;
+}
+
+//! Write a level into a copy of the data of its shape
+static void writeLODData( NifModel * nif, const QModelIndex & iData, const LODLevel & level )
+{
+	static const QStringList vectors{ "Vertices", "Normals", "Tangents", "Bitangents" };
+
+	// Read everything while the arrays still have the size of the shape
+	QVector<QVector<Vector3>> vectorValues;
+	for ( const QString & name : vectors )
+		vectorValues << nif->getArray<Vector3>( iData, name );
+
+	QVector<Color4> colors = nif->getArray<Color4>( iData, "Vertex Colors" );
+
+	QModelIndex iUVSets = nif->getIndex( iData, "UV Sets" );
+	QVector<QVector<Vector2>> uvSets;
+	for ( int r = 0; iUVSets.isValid() && r < nif->rowCount( iUVSets ); r++ )
+		uvSets << nif->getArray<Vector2>( iUVSets.child( r, 0 ) );
+
+	nif->set<int>( iData, "Num Vertices", level.vertices.count() );
+
+	for ( int i = 0; i < vectors.count(); i++ ) {
+		QModelIndex iArray = nif->getIndex( iData, vectors.at( i ) );
+		if ( iArray.isValid() && !vectorValues.at( i ).isEmpty() ) {
+			nif->updateArray( iArray );
+			nif->setArray<Vector3>( iArray, pick( vectorValues.at( i ), level.vertices ) );
+		}
+	}
+
+	QModelIndex iColors = nif->getIndex( iData, "Vertex Colors" );
+	if ( iColors.isValid() && !colors.isEmpty() ) {
+		nif->updateArray( iColors );
+		nif->setArray<Color4>( iColors, pick( colors, level.vertices ) );
+	}
+
+	if ( iUVSets.isValid() ) {
+		nif->updateArray( iUVSets );
+
+		for ( int r = 0; r < nif->rowCount( iUVSets ) && r < uvSets.count(); r++ ) {
+			QModelIndex iUVs = iUVSets.child( r, 0 );
+			nif->updateArray( iUVs );
+			nif->setArray<Vector2>( iUVs, pick( uvSets.at( r ), level.vertices ) );
+		}
+	}
+
+	nif->set<int>( iData, "Num Triangles", level.triangles.count() );
+	nif->set<int>( iData, "Num Triangle Points", level.triangles.count() * 3 );
+	nif->set<int>( iData, "Has Triangles", 1 );
+	nif->updateArray( iData, "Triangles" );
+	nif->setArray<Triangle>( iData, "Triangles", level.triangles );
+
+	// The match groups number the vertices of the shape
+	nif->set<int>( iData, "Num Match Groups", 0 );
+	nif->updateArray( iData, "Match Groups" );
+}
+
+//! Replace each shape below its parent by a NiLODNode holding the shape and its levels
+class LODTask final : public SpellTask
+{
+public:
+	LODTask( const QVector<int> & shapes, const QVector<float> & levelRatios ) : blocks( shapes ), ratios( levelRatios ) {}
+
+	//! Read the data block of each shape, on the GUI thread before compute()
+	void prepare( const NifModel * nif )
+	{
+		jobs.resize( blocks.count() );
+
+		for ( int i = 0; i < blocks.count(); i++ ) {
+			QModelIndex iShape = nif->getBlock( blocks.at( i ) );
+			QModelIndex iData = nif->getBlock( nif->getLink( iShape, "Data" ) );
+
+			jobs[i].shape = blocks.at( i );
+			jobs[i].data = nif->getBlockNumber( iData );
+			jobs[i].center = Transform( nif, iShape ) * nif->get<Vector3>( iData, "Center" );
+			jobs[i].radius = nif->get<float>( iData, "Radius" ) * Transform( nif, iShape ).scale;
+		}
+	}
+
+	void compute( const NifSnapshot & snapshot, SpellProgress & progress ) override final
+	{
+		progress.setMaximum( jobs.count() );
+
+		Spell::parallelFor( jobs.count(), [this, &snapshot, &progress]( int i ) {
+			if ( progress.isCanceled() )
+				return;
+
+			computeLOD( snapshot, jobs[i], ratios, progress );
+			progress.step();
+		} );
+	}
+
+	QModelIndex commit( NifModel * nif ) override final
+	{
+		// The new blocks are appended, so the numbers of the shapes stay valid
+		bool oldHoldUpdates = nif->holdUpdates( true );
+
+		QModelIndex last;
+
+		for ( const LODJob & job : jobs ) {
+			if ( !job.error.isEmpty() ) {
+				Message::append( Spell::tr( "Generate LOD failed on one or more blocks." ), job.error );
+				continue;
+			}
+
+			if ( job.levels.isEmpty() )
+				continue;
+
+			QModelIndex iNode = commitJob( nif, job );
+			if ( iNode.isValid() )
+				last = iNode;
+		}
+
+		if ( !oldHoldUpdates )
+			nif->holdUpdates( false );
+
+		return last;
+	}
+
+protected:
+	QModelIndex commitJob( NifModel * nif, const LODJob & job ) const
+	{
+		QPersistentModelIndex iShape = nif->getBlock( job.shape );
+		QPersistentModelIndex iData = nif->getBlock( job.data );
+		QPersistentModelIndex iParent = nif->getBlock( nif->getParent( job.shape ) );
+
+		QModelIndex iChildren = nif->getIndex( iParent, "Children" );
+		int row = -1;
+		for ( int r = 0; iChildren.isValid() && r < nif->rowCount( iChildren ) && row < 0; r++ ) {
+			if ( nif->getLink( iChildren.child( r, 0 ) ) == job.shape )
+				row = r;
+		}
+
+		if ( !iShape.isValid() || !iData.isValid() || row < 0 ) {
+			Message::append( Spell::tr( "Generate LOD failed on one or more blocks." ),
+				Spell::tr( "Block %1 is no longer the child of a node." ).arg( job.shape ) );
+			return QModelIndex();
+		}
+
+		QPersistentModelIndex iLOD = nif->insertNiBlock( "NiLODNode", nif->getBlockCount() );
+		nif->set<QString>( iLOD, "Name", nif->get<QString>( iShape, "Name" ) + " LOD" );
+
+		nif->setLink( nif->getIndex( iParent, "Children" ).child( row, 0 ), nif->getBlockNumber( iLOD ) );
+		blockLink( nif, iLOD, iShape );
+
+		for ( const LODLevel & level : job.levels ) {
+			QPersistentModelIndex iLevel = copyBlock( nif, iShape );
+			QPersistentModelIndex iLevelData = copyBlock( nif, iData );
+
+			if ( !iLevel.isValid() || !iLevelData.isValid() )
+				break;
+
+			// Controllers and collisions target the shape itself
+			nif->setLink( iLevel, "Controller", -1 );
+			nif->setLink( iLevel, "Collision Object", -1 );
+			nif->setLink( iLevel, "Data", nif->getBlockNumber( iLevelData ) );
+
+			writeLODData( nif, iLevelData, level );
+			blockLink( nif, iLOD, iLevel );
+		}
+
+		// Levels switch at multiples of the size of the shape
+		QModelIndex iRanges = iLOD;
+
+		if ( nif->checkVersion( 0x0a010000, 0 ) ) {
+			QModelIndex iRangeData = nif->insertNiBlock( "NiRangeLODData", nif->getBlockCount() );
+			nif->setLink( iLOD, "LOD Level Data", nif->getBlockNumber( iRangeData ) );
+			iRanges = iRangeData;
+		}
+
+		const int levels = nif->getLinkArray( iLOD, "Children" ).count();
+		const float step = qMax( job.radius, 1.0f ) * 8.0f;
+
+		nif->set<Vector3>( iRanges, "LOD Center", job.center );
+		nif->set<int>( iRanges, "Num LOD Levels", levels );
+
+		QModelIndex iLevels = nif->getIndex( iRanges, "LOD Levels" );
+		if ( iLevels.isValid() ) {
+			nif->updateArray( iLevels );
+
+			float nearExtent = 0;
+			for ( int l = 0; l < nif->rowCount( iLevels ); l++ ) {
+				float farExtent = ( l == levels - 1 ) ? FLT_MAX : step * float( 1 << l );
+				nif->set<float>( iLevels.child( l, 0 ), "Near Extent", nearExtent );
+				nif->set<float>( iLevels.child( l, 0 ), "Far Extent", farExtent );
+				nearExtent = farExtent;
+			}
+		}
+
+		return iLOD;
+	}
+
+	QVector<int> blocks;
+	QVector<float> ratios;
+	QVector<LODJob> jobs;
+};
+
+//! Ask for the fractions of the triangles to keep at each level, empty if cancelled
+static QVector<float> askLODRatios( const QString & key )
+{
+	QSettings settings;
+
+	bool ok = true;
+	QString text = QInputDialog::getText( nullptr, Spell::tr( "Generate LOD" ),
+		Spell::tr( "Fraction of the triangles to keep at each level:" ), QLineEdit::Normal,
+		settings.value( key, "0.5 0.25" ).toString(), &ok );
+
+	if ( !ok )
+		return QVector<float>();
+
+	settings.setValue( key, text );
+
+	QVector<float> ratios;
+	for ( const QString & part : text.split( QRegularExpression( "[\\s,;]+" ), QString::SkipEmptyParts ) ) {
+		float r = part.toFloat( &ok );
+		if ( ok && r > 0.0f && r < 1.0f )
+			ratios << r;
+	}
+
+	// Each level has fewer triangles than the one before
+	std::sort( ratios.begin(), ratios.end(), std::greater<float>() );
+	ratios.erase( std::unique( ratios.begin(), ratios.end() ), ratios.end() );
+
+	return ratios;
+}
+
+//! Generate simplified copies of a shape to show at a distance
+/*!
+ * Replaces the shape below its parent by a NiLODNode holding the shape and
+ * the copies, see MeshSimplifier. Both the skinned shapes and BSTriShape
+ * are left out: the skin partitions would have to be rebuilt for each level,
+ * and the games of BSTriShape do not switch NiLODNode children.
+ */
+class spGenerateLOD final : public Spell
+{
+public:
+	QString name() const override final { return Spell::tr( "Generate LOD" ); }
+	QString page() const override final { return Spell::tr( "Mesh" ); }
+	bool interactive() const override final { return true; }
+	QStringList applicableBlocks() const override final { return { "NiTriShape" }; }
+
+	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
+	{
+		return canGenerateLOD( nif, index );
+	}
+
+	SpellTaskPtr task( const NifModel * nif, const QModelIndex & index ) override final
+	{
+		QVector<float> ratios = askLODRatios( QString( "%1/%2/%3/Ratios" ).arg( "Spells", page(), name() ) );
+
+		auto task = std::make_shared<LODTask>( ratios.isEmpty() ? QVector<int>() : QVector<int>{ nif->getBlockNumber( index ) }, ratios );
+		task->prepare( nif );
+		return task;
+	}
+
+	QModelIndex cast( NifModel * nif, const QModelIndex & index ) override final
+	{
+		return castTask( nif, index );
+	}
+};
+
+REGISTER_SPELL( spGenerateLOD )
+
+//! Generate LOD for every shape of the file
+class spGenerateAllLODs final : public Spell
+{
+public:
+	QString name() const override final { return Spell::tr( "Generate LOD for All Shapes" ); }
+	QString page() const override final { return Spell::tr( "Optimize" ); }
+	bool interactive() const override final { return true; }
+
+	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
+	{
+		return nif && !index.isValid();
+	}
+
+	SpellTaskPtr task( const NifModel * nif, const QModelIndex & ) override final
+	{
+		QVector<int> blocks;
+		QVector<float> ratios = askLODRatios( QString( "%1/%2/%3/Ratios" ).arg( "Spells", "Mesh", "Generate LOD" ) );
+
+		for ( int b = 0; b < nif->getBlockCount() && !ratios.isEmpty(); b++ ) {
+			if ( canGenerateLOD( nif, nif->getBlock( b ) ) )
+				blocks << b;
+		}
+
+		auto task = std::make_shared<LODTask>( blocks, ratios );
+		task->prepare( nif );
+		return task;
+	}
+
+	QModelIndex cast( NifModel * nif, const QModelIndex & index ) override final
+	{
+		return castTask( nif, index );
+	}
+};
+
+REGISTER_SPELL( spGenerateAllLODs )
@@ -97,6 +97,7 @@ class spMaterialEdit final : public Spell
 public:
 	QString name() const override final { return Spell::tr( "Material" ); }
 	QString page() const override final { return Spell::tr( "" ); }
+	bool interactive() const override final { return true; }
 	bool instant() const { return true; }
 	QIcon icon() const
 	{
@@ -105,6 +106,7 @@ public:
 
 		return *mat42_xpm_icon;
 	}
+	QStringList applicableBlocks() const override final { return { "NiMaterialProperty" }; }
 
 	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
 	{
@@ -3,8 +3,12 @@
 
 #include <QDialog>
 #include <QGridLayout>
+#include <QHash>
+#include <QSet>
 
 #include <cfloat>
+#include <cmath>
+#include <cstring>
 
 
 // Brief description is deliberately not autolinked to class Spell
@@ -14,6 +18,95 @@
  * All classes here inherit from the Spell class.
  */
 
+//! A cell of the grid weldVertices() hashes positions into
+struct WeldCell
+{
+	qint64 x, y, z;
+
+	bool operator==( const WeldCell & other ) const
+	{
+		return x == other.x && y == other.y && z == other.z;
+	}
+};
+
+static inline uint qHash( const WeldCell & cell, uint seed = 0 )
+{
+	return qHashBits( &cell, sizeof( WeldCell ), seed );
+}
+
+QVector<int> weldVertices( const QVector<float> & data, int stride, float epsilon )
+{
+	int count = ( stride >= 3 ) ? data.count() / stride : 0;
+	QVector<int> remap( count );
+
+	epsilon = qMax( epsilon, 0.0f );
+
+	auto cellOf = [epsilon]( const float * p, int dx, int dy, int dz ) {
+		WeldCell cell;
+
+		if ( epsilon > 0 ) {
+			cell.x = qint64( std::floor( p[0] / epsilon ) ) + dx;
+			cell.y = qint64( std::floor( p[1] / epsilon ) ) + dy;
+			cell.z = qint64( std::floor( p[2] / epsilon ) ) + dz;
+		} else {
+			// The bits of the position, with -0 and 0 in the same cell
+			float v[3] = { p[0] + 0.0f, p[1] + 0.0f, p[2] + 0.0f };
+			quint32 b[3];
+			memcpy( b, v, sizeof( b ) );
+			cell.x = b[0]; cell.y = b[1]; cell.z = b[2];
+		}
+
+		return cell;
+	};
+
+	auto same = [&data, stride, epsilon]( int a, int b ) {
+		const float * va = data.constData() + a * stride;
+		const float * vb = data.constData() + b * stride;
+
+		for ( int i = 0; i < stride; i++ ) {
+			if ( epsilon > 0 ? !( std::fabs( va[i] - vb[i] ) <= epsilon ) : !( va[i] == vb[i] ) )
+				return false;
+		}
+
+		return true;
+	};
+
+	// The first vertex of each kind, by cell
+	QHash<WeldCell, QVector<int>> cells;
+	cells.reserve( count );
+
+	// With a tolerance, a match may be in any of the neighbouring cells
+	int reach = ( epsilon > 0 ) ? 1 : 0;
+
+	for ( int v = 0; v < count; v++ ) {
+		const float * p = data.constData() + v * stride;
+		remap[v] = v;
+
+		for ( int dx = -reach; dx <= reach && remap[v] == v; dx++ ) {
+			for ( int dy = -reach; dy <= reach && remap[v] == v; dy++ ) {
+				for ( int dz = -reach; dz <= reach && remap[v] == v; dz++ ) {
+					auto it = cells.constFind( cellOf( p, dx, dy, dz ) );
+
+					if ( it == cells.constEnd() )
+						continue;
+
+					for ( int first : it.value() ) {
+						if ( same( v, first ) ) {
+							remap[v] = first;
+							break;
+						}
+					}
+				}
+			}
+		}
+
+		if ( remap[v] == v )
+			cells[cellOf( p, 0, 0, 0 )].append( v );
+	}
+
+	return remap;
+}
+
 //! Find shape data of triangle geometry
 static QModelIndex getShape( const NifModel * nif, const QModelIndex & index )
 {
@@ -49,191 +142,401 @@ static QModelIndex getTriShapeData( const NifModel * nif, const QModelIndex & in
 	return QModelIndex();
 }
 
-//! Removes elements of the specified type from an array
-template <typename T> static void removeFromArray( QVector<T> & array, QMap<quint16, bool> map )
+//! Removes degenerate triangles and triangles which repeat an earlier one, returning how many were removed
+/*!
+ * A triangle repeats another if it has the same corners in the same winding.
+ * The corners are rotated to start with the smallest one and hashed, so this
+ * is linear in the number of triangles.
+ */
+static int pruneTriangles( QVector<Triangle> & tris )
 {
-	for ( int x = array.count() - 1; x >= 0; x-- ) {
-		if ( !map.contains( x ) )
-			array.remove( x );
+	QSet<quint64> seen;
+	seen.reserve( tris.count() );
+
+	int kept = 0;
+
+	for ( int i = 0; i < tris.count(); i++ ) {
+		const Triangle t = tris[i];
+
+		if ( t[0] == t[1] || t[1] == t[2] || t[2] == t[0] )
+			continue;
+
+		int first = ( t[1] < t[0] && t[1] < t[2] ) ? 1 : ( t[2] < t[0] && t[2] < t[1] ) ? 2 : 0;
+		quint64 key = ( quint64( t[first] ) << 32 ) | ( quint64( t[(first + 1) % 3] ) << 16 ) | t[(first + 2) % 3];
+
+		if ( seen.contains( key ) )
+			continue;
+
+		seen.insert( key );
+		tris[kept++] = t;
 	}
+
+	int removed = tris.count() - kept;
+	tris.resize( kept );
+
+	return removed;
+}
+
+//! Keeps the elements of an array whose index is mapped to a new one, see removeWasteVertices()
+template <typename T> static void compactArray( QVector<T> & array, const QVector<int> & newIndex )
+{
+	int kept = 0;
+
+	for ( int x = 0; x < array.count() && x < newIndex.count(); x++ ) {
+		if ( newIndex[x] >= 0 )
+			array[kept++] = array[x];
+	}
+
+	array.resize( kept );
 }
 
-//! Removes waste vertices from the specified data and shape
-static void removeWasteVertices( NifModel * nif, const QModelIndex & iData, const QModelIndex & iShape )
+//! Removes the vertices which are not kept from the partitions of a skin, returning false if they can't be
+static bool compactSkinPartition( NifModel * nif, const QModelIndex & iSkinPart, const QVector<int> & newIndex )
 {
-	try
+	//! A partition with its vertices removed
+	struct CompactPartition
 	{
-		// read the data
+		QModelIndex iPart;
+		QVector<int> vertexMap;
+		QVector<QVector<float>> weights;
+		QVector<QVector<int>> bones;
+		QVector<Triangle> tris;
+		QVector<QVector<quint16>> strips;
+	};
+
+	QModelIndex iParts = nif->getIndex( iSkinPart, "Skin Partition Blocks" );
+	QVector<CompactPartition> parts;
+
+	// Everything is checked before anything is written, so that no partition is left half done
+	for ( int p = 0; p < nif->rowCount( iParts ); p++ ) {
+		CompactPartition part;
+		part.iPart = iParts.child( p, 0 );
+		part.vertexMap = nif->getArray<int>( part.iPart, "Vertex Map" );
+
+		if ( part.vertexMap.isEmpty() )
+			return false;
+
+		QVector<int> localIndex( part.vertexMap.count(), -1 );
+		int numLocal = 0;
+
+		for ( int l = 0; l < part.vertexMap.count(); l++ ) {
+			int v = part.vertexMap[l];
 
-		QVector<Vector3> verts = nif->getArray<Vector3>( iData, "Vertices" );
+			if ( v < 0 || v >= newIndex.count() )
+				return false;
 
-		if ( !verts.count() ) {
-			throw QString( Spell::tr( "No vertices" ) );
+			if ( newIndex[v] >= 0 ) {
+				localIndex[l] = numLocal++;
+				part.vertexMap[numLocal - 1] = newIndex[v];
+			}
 		}
 
-		QVector<Vector3> norms = nif->getArray<Vector3>( iData, "Normals" );
-		QVector<Color4> colors = nif->getArray<Color4>( iData, "Vertex Colors" );
-		QList<QVector<Vector2> > texco;
-		QModelIndex iUVSets = nif->getIndex( iData, "UV Sets" );
+		part.vertexMap.resize( numLocal );
 
-		for ( int r = 0; r < nif->rowCount( iUVSets ); r++ ) {
-			texco << nif->getArray<Vector2>( iUVSets.child( r, 0 ) );
+		QModelIndex iWeights = nif->getIndex( part.iPart, "Vertex Weights" );
+		QModelIndex iBones = nif->getIndex( part.iPart, "Bone Indices" );
 
-			if ( texco.last().count() != verts.count() )
-				throw QString( Spell::tr( "UV array size differs" ) );
-		}
+		for ( int l = 0; l < nif->rowCount( iWeights ); l++ )
+			part.weights << nif->getArray<float>( iWeights.child( l, 0 ) );
 
-		int numVerts = verts.count();
+		for ( int l = 0; l < nif->rowCount( iBones ); l++ )
+			part.bones << nif->getArray<int>( iBones.child( l, 0 ) );
 
-		if ( numVerts != nif->get<int>( iData, "Num Vertices" )
-		     || ( norms.count() && norms.count() != numVerts )
-		     || ( colors.count() && colors.count() != numVerts ) )
-		{
-			throw QString( Spell::tr( "Vertex array size differs" ) );
-		}
+		compactArray( part.weights, localIndex );
+		compactArray( part.bones, localIndex );
 
-		// detect unused vertices
+		auto local = [&localIndex]( quint16 l ) {
+			return ( l < localIndex.count() ) ? localIndex[l] : -1;
+		};
 
-		QMap<quint16, bool> used;
+		if ( nif->get<int>( part.iPart, "Num Strips" ) > 0 ) {
+			// Strips can't lose vertices without being rebuilt
+			QModelIndex iStrips = nif->getIndex( part.iPart, "Strips" );
 
-		QVector<Triangle> tris = nif->getArray<Triangle>( iData, "Triangles" );
-		for ( const Triangle& tri : tris ) {
-			for ( int t = 0; t < 3; t++ ) {
-				used.insert( tri[t], true );
-			}
-		}
+			for ( int s = 0; s < nif->rowCount( iStrips ); s++ ) {
+				QVector<quint16> strip = nif->getArray<quint16>( iStrips.child( s, 0 ) );
 
-		QList<QVector<quint16> > strips;
-		QModelIndex iPoints = nif->getIndex( iData, "Points" );
+				for ( quint16 & l : strip ) {
+					if ( local( l ) < 0 )
+						return false;
 
-		for ( int r = 0; r < nif->rowCount( iPoints ); r++ ) {
-			strips << nif->getArray<quint16>( iPoints.child( r, 0 ) );
-			for ( const auto p : strips.last() ) {
-				used.insert( p, true );
+					l = local( l );
+				}
+
+				part.strips << strip;
 			}
+		} else {
+			for ( Triangle t : nif->getArray<Triangle>( part.iPart, "Triangles" ) ) {
+				if ( local( t[0] ) < 0 || local( t[1] ) < 0 || local( t[2] ) < 0 )
+					continue;
+
+				t.set( local( t[0] ), local( t[1] ), local( t[2] ) );
+				part.tris << t;
+			}
+
+			pruneTriangles( part.tris );
 		}
 
-		// remove them
+		parts << part;
+	}
 
-		Message::info( nullptr, Spell::tr( "Removed %1 vertices" ).arg( verts.count() - used.count() ) );
+	for ( const CompactPartition & part : parts ) {
+		nif->set<int>( part.iPart, "Num Vertices", part.vertexMap.count() );
 
-		if ( verts.count() == used.count() )
-			return;
+		QModelIndex iVertexMap = nif->getIndex( part.iPart, "Vertex Map" );
+		nif->updateArray( iVertexMap );
+		nif->setArray<int>( iVertexMap, part.vertexMap );
 
-		removeFromArray( verts, used );
-		removeFromArray( norms, used );
-		removeFromArray( colors, used );
+		QModelIndex iWeights = nif->getIndex( part.iPart, "Vertex Weights" );
+		nif->updateArray( iWeights );
 
-		for ( int c = 0; c < texco.count(); c++ )
-			removeFromArray( texco[c], used );
+		for ( int l = 0; l < nif->rowCount( iWeights ) && l < part.weights.count(); l++ ) {
+			nif->updateArray( iWeights.child( l, 0 ) );
+			nif->setArray<float>( iWeights.child( l, 0 ), part.weights[l] );
+		}
 
-		// adjust the faces
+		QModelIndex iBones = nif->getIndex( part.iPart, "Bone Indices" );
+		nif->updateArray( iBones );
 
-		QMap<quint16, quint16> map;
-		quint16 y = 0;
+		for ( int l = 0; l < nif->rowCount( iBones ) && l < part.bones.count(); l++ ) {
+			nif->updateArray( iBones.child( l, 0 ) );
+			nif->setArray<int>( iBones.child( l, 0 ), part.bones[l] );
+		}
+
+		if ( !part.strips.isEmpty() ) {
+			QModelIndex iStrips = nif->getIndex( part.iPart, "Strips" );
 
-		for ( quint16 x = 0; x < numVerts; x++ ) {
-			if ( used.contains( x ) )
-				map.insert( x, y++ );
+			for ( int s = 0; s < nif->rowCount( iStrips ) && s < part.strips.count(); s++ )
+				nif->setArray<quint16>( iStrips.child( s, 0 ), part.strips[s] );
+		} else {
+			nif->set<int>( part.iPart, "Num Triangles", part.tris.count() );
+			QModelIndex iTriangles = nif->getIndex( part.iPart, "Triangles" );
+			nif->updateArray( iTriangles );
+			nif->setArray<Triangle>( iTriangles, part.tris );
 		}
+	}
 
-		QMutableVectorIterator<Triangle> itri( tris );
+	return true;
+}
 
-		while ( itri.hasNext() ) {
-			Triangle & tri = itri.next();
+//! Removes waste vertices from the specified data and shape, returning how many were removed
+/*!
+ * The vertices used by the triangles and strips are marked in one pass and
+ * every array indexed by vertex is compacted with the same mapping: the
+ * vertex channels, the tangent space, the skin weights, the skin partition
+ * and the morphs. Throws a QString if the arrays don't match.
+ */
+static int removeWasteVertices( NifModel * nif, const QModelIndex & iData, const QModelIndex & iShape )
+{
+	// read the data
 
-			for ( int t = 0; t < 3; t++ ) {
-				if ( map.contains( tri[t] ) )
-					tri[t] = map[ tri[t] ];
-			}
+	QVector<Vector3> verts = nif->getArray<Vector3>( iData, "Vertices" );
 
-		}
+	if ( !verts.count() ) {
+		throw QString( Spell::tr( "No vertices" ) );
+	}
 
-		QMutableListIterator<QVector<quint16> > istrip( strips );
+	QVector<Vector3> norms = nif->getArray<Vector3>( iData, "Normals" );
+	QVector<Vector3> tangents = nif->getArray<Vector3>( iData, "Tangents" );
+	QVector<Vector3> bitangents = nif->getArray<Vector3>( iData, "Bitangents" );
+	QVector<Color4> colors = nif->getArray<Color4>( iData, "Vertex Colors" );
+	QList<QVector<Vector2> > texco;
+	QModelIndex iUVSets = nif->getIndex( iData, "UV Sets" );
 
-		while ( istrip.hasNext() ) {
-			QVector<quint16> & strip = istrip.next();
+	for ( int r = 0; r < nif->rowCount( iUVSets ); r++ ) {
+		texco << nif->getArray<Vector2>( iUVSets.child( r, 0 ) );
 
-			for ( int s = 0; s < strip.size(); s++ ) {
-				if ( map.contains( strip[s] ) )
-					strip[s] = map[ strip[s] ];
-			}
-		}
+		if ( texco.last().count() != verts.count() )
+			throw QString( Spell::tr( "UV array size differs" ) );
+	}
 
-		// write back the data
+	int numVerts = verts.count();
 
-		nif->setArray<Triangle>( iData, "Triangles", tris );
+	if ( numVerts != nif->get<int>( iData, "Num Vertices" )
+	     || ( norms.count() && norms.count() != numVerts )
+	     || ( tangents.count() && tangents.count() != numVerts )
+	     || ( bitangents.count() && bitangents.count() != numVerts )
+	     || ( colors.count() && colors.count() != numVerts ) )
+	{
+		throw QString( Spell::tr( "Vertex array size differs" ) );
+	}
+
+	// detect unused vertices
 
-		for ( int r = 0; r < nif->rowCount( iPoints ); r++ )
-			nif->setArray<quint16>( iPoints.child( r, 0 ), strips[r] );
+	QVector<bool> used( numVerts, false );
 
-		nif->set<int>( iData, "Num Vertices", verts.count() );
-		nif->updateArray( iData, "Vertices" );
-		nif->setArray<Vector3>( iData, "Vertices", verts );
-		nif->updateArray( iData, "Normals" );
-		nif->setArray<Vector3>( iData, "Normals", norms );
-		nif->updateArray( iData, "Vertex Colors" );
-		nif->setArray<Color4>( iData, "Vertex Colors", colors );
+	auto use = [&used, numVerts]( quint16 v ) {
+		if ( v >= numVerts )
+			throw QString( Spell::tr( "bad triangle - vertex index out of range" ) );
 
-		for ( int r = 0; r < nif->rowCount( iUVSets ); r++ ) {
-			nif->updateArray( iUVSets.child( r, 0 ) );
-			nif->setArray<Vector2>( iUVSets.child( r, 0 ), texco[r] );
+		used[v] = true;
+	};
+
+	QVector<Triangle> tris = nif->getArray<Triangle>( iData, "Triangles" );
+	for ( const Triangle& tri : tris ) {
+		for ( int t = 0; t < 3; t++ ) {
+			use( tri[t] );
 		}
+	}
 
-		// process NiSkinData
+	QList<QVector<quint16> > strips;
+	QModelIndex iPoints = nif->getIndex( iData, "Points" );
 
-		QModelIndex iSkinInst = nif->getBlock( nif->getLink( iShape, "Skin Instance" ), "NiSkinInstance" );
+	for ( int r = 0; r < nif->rowCount( iPoints ); r++ ) {
+		strips << nif->getArray<quint16>( iPoints.child( r, 0 ) );
+		for ( const auto p : strips.last() ) {
+			use( p );
+		}
+	}
 
-		QModelIndex iSkinData = nif->getBlock( nif->getLink( iSkinInst, "Data" ), "NiSkinData" );
-		QModelIndex iBones = nif->getIndex( iSkinData, "Bone List" );
+	// the new index of each vertex, or -1 if it is removed
 
-		for ( int b = 0; b < nif->rowCount( iBones ); b++ ) {
-			QVector<QPair<int, float> > weights;
-			QModelIndex iWeights = nif->getIndex( iBones.child( b, 0 ), "Vertex Weights" );
+	QVector<int> newIndex( numVerts, -1 );
+	int numUsed = 0;
 
-			for ( int w = 0; w < nif->rowCount( iWeights ); w++ ) {
-				weights.append( QPair<int, float>( nif->get<int>( iWeights.child( w, 0 ), "Index" ), nif->get<float>( iWeights.child( w, 0 ), "Weight" ) ) );
-			}
+	for ( int v = 0; v < numVerts; v++ ) {
+		if ( used[v] )
+			newIndex[v] = numUsed++;
+	}
 
-			for ( int x = weights.count() - 1; x >= 0; x-- ) {
-				if ( !used.contains( weights[x].first ) )
-					weights.remove( x );
-			}
+	if ( numUsed == numVerts )
+		return 0;
 
-			QMutableVectorIterator<QPair<int, float> > it( weights );
+	// remove them
 
-			while ( it.hasNext() ) {
-				QPair<int, float> & w = it.next();
+	compactArray( verts, newIndex );
+	compactArray( norms, newIndex );
+	compactArray( tangents, newIndex );
+	compactArray( bitangents, newIndex );
+	compactArray( colors, newIndex );
 
-				if ( map.contains( w.first ) )
-					w.first = map[ w.first ];
-			}
+	for ( int c = 0; c < texco.count(); c++ )
+		compactArray( texco[c], newIndex );
 
-			nif->set<int>( iBones.child( b, 0 ), "Num Vertices", weights.count() );
-			nif->updateArray( iWeights );
+	// adjust the faces
 
-			for ( int w = 0; w < weights.count(); w++ ) {
-				nif->set<int>( iWeights.child( w, 0 ), "Index", weights[w].first );
-				nif->set<float>( iWeights.child( w, 0 ), "Weight", weights[w].second );
-			}
+	for ( Triangle & tri : tris ) {
+		for ( int t = 0; t < 3; t++ )
+			tri[t] = newIndex[ tri[t] ];
+	}
+
+	for ( QVector<quint16> & strip : strips ) {
+		for ( quint16 & p : strip )
+			p = newIndex[p];
+	}
+
+	// write back the data
+
+	nif->setArray<Triangle>( iData, "Triangles", tris );
+
+	for ( int r = 0; r < nif->rowCount( iPoints ); r++ )
+		nif->setArray<quint16>( iPoints.child( r, 0 ), strips[r] );
+
+	nif->set<int>( iData, "Num Vertices", verts.count() );
+	nif->updateArray( iData, "Vertices" );
+	nif->setArray<Vector3>( iData, "Vertices", verts );
+	nif->updateArray( iData, "Normals" );
+	nif->setArray<Vector3>( iData, "Normals", norms );
+	nif->updateArray( iData, "Tangents" );
+	nif->setArray<Vector3>( iData, "Tangents", tangents );
+	nif->updateArray( iData, "Bitangents" );
+	nif->setArray<Vector3>( iData, "Bitangents", bitangents );
+	nif->updateArray( iData, "Vertex Colors" );
+	nif->setArray<Color4>( iData, "Vertex Colors", colors );
+
+	for ( int r = 0; r < nif->rowCount( iUVSets ); r++ ) {
+		nif->updateArray( iUVSets.child( r, 0 ) );
+		nif->setArray<Vector2>( iUVSets.child( r, 0 ), texco[r] );
+	}
+
+	// process the Oblivion tangent space
+
+	for ( const auto link : nif->getChildLinks( nif->getBlockNumber( iShape ) ) ) {
+		QModelIndex iTSpace = nif->getBlock( link, "NiBinaryExtraData" );
+
+		if ( !iTSpace.isValid() || nif->get<QString>( iTSpace, "Name" ) != "Tangent space (binormal & tangent vectors)" )
+			continue;
+
+		QByteArray data = nif->get<QByteArray>( iTSpace, "Binary Data" );
+
+		if ( data.size() != numVerts * 2 * int( sizeof( Vector3 ) ) )
+			continue;
+
+		QVector<Vector3> tan( numVerts ), bin( numVerts );
+		memcpy( tan.data(), data.constData(), numVerts * sizeof( Vector3 ) );
+		memcpy( bin.data(), data.constData() + numVerts * sizeof( Vector3 ), numVerts * sizeof( Vector3 ) );
+		compactArray( tan, newIndex );
+		compactArray( bin, newIndex );
+
+		nif->set<QByteArray>( iTSpace, "Binary Data", QByteArray( (const char *)tan.constData(), tan.count() * sizeof( Vector3 ) ) + QByteArray( (const char *)bin.constData(), bin.count() * sizeof( Vector3 ) ) );
+	}
+
+	// process NiGeomMorpherController
+
+	for ( QModelIndex iCtrl = nif->getBlock( nif->getLink( iShape, "Controller" ) ); iCtrl.isValid();
+	      iCtrl = nif->getBlock( nif->getLink( iCtrl, "Next Controller" ) ) )
+	{
+		QModelIndex iMorphData = nif->getBlock( nif->getLink( iCtrl, "Data" ), "NiMorphData" );
+
+		if ( !nif->isNiBlock( iCtrl, "NiGeomMorpherController" ) || nif->get<int>( iMorphData, "Num Vertices" ) != numVerts )
+			continue;
+
+		QModelIndex iMorphs = nif->getIndex( iMorphData, "Morphs" );
+		QVector<QVector<Vector3>> morphs;
+
+		for ( int m = 0; m < nif->rowCount( iMorphs ); m++ ) {
+			morphs << nif->getArray<Vector3>( iMorphs.child( m, 0 ), "Vectors" );
+			compactArray( morphs.last(), newIndex );
 		}
 
-		// process NiSkinPartition
+		nif->set<int>( iMorphData, "Num Vertices", verts.count() );
+
+		for ( int m = 0; m < nif->rowCount( iMorphs ); m++ ) {
+			nif->updateArray( iMorphs.child( m, 0 ), "Vectors" );
+			nif->setArray<Vector3>( iMorphs.child( m, 0 ), "Vectors", morphs[m] );
+		}
+	}
 
-		QModelIndex iSkinPart = nif->getBlock( nif->getLink( iSkinInst, "Skin Partition" ), "NiSkinPartition" );
+	// process NiSkinData
 
-		if ( !iSkinPart.isValid() )
-			iSkinPart = nif->getBlock( nif->getLink( iSkinData, "Skin Partition" ), "NiSkinPartition" );
+	QModelIndex iSkinInst = nif->getBlock( nif->getLink( iShape, "Skin Instance" ), "NiSkinInstance" );
 
-		if ( iSkinPart.isValid() ) {
-			nif->removeNiBlock( nif->getBlockNumber( iSkinPart ) );
-			Message::warning( nullptr, Spell::tr( "The skin partition was removed, please regenerate it with the skin partition spell" ) );
+	QModelIndex iSkinData = nif->getBlock( nif->getLink( iSkinInst, "Data" ), "NiSkinData" );
+	QModelIndex iBones = nif->getIndex( iSkinData, "Bone List" );
+
+	for ( int b = 0; b < nif->rowCount( iBones ); b++ ) {
+		QVector<QPair<int, float> > weights;
+		QModelIndex iWeights = nif->getIndex( iBones.child( b, 0 ), "Vertex Weights" );
+
+		for ( int w = 0; w < nif->rowCount( iWeights ); w++ ) {
+			int v = nif->get<int>( iWeights.child( w, 0 ), "Index" );
+
+			if ( v >= 0 && v < numVerts && newIndex[v] >= 0 )
+				weights.append( QPair<int, float>( newIndex[v], nif->get<float>( iWeights.child( w, 0 ), "Weight" ) ) );
+		}
+
+		nif->set<int>( iBones.child( b, 0 ), "Num Vertices", weights.count() );
+		nif->updateArray( iWeights );
+
+		for ( int w = 0; w < weights.count(); w++ ) {
+			nif->set<int>( iWeights.child( w, 0 ), "Index", weights[w].first );
+			nif->set<float>( iWeights.child( w, 0 ), "Weight", weights[w].second );
 		}
 	}
-	catch ( QString e )
-	{
-		Message::warning( nullptr, Spell::tr( "There were errors during the operation" ), e );
+
+	// process NiSkinPartition
+
+	QModelIndex iSkinPart = nif->getBlock( nif->getLink( iSkinInst, "Skin Partition" ), "NiSkinPartition" );
+
+	if ( !iSkinPart.isValid() )
+		iSkinPart = nif->getBlock( nif->getLink( iSkinData, "Skin Partition" ), "NiSkinPartition" );
+
+	if ( iSkinPart.isValid() && !compactSkinPartition( nif, iSkinPart, newIndex ) ) {
+		nif->removeNiBlock( nif->getBlockNumber( iSkinPart ) );
+		Message::warning( nullptr, Spell::tr( "The skin partition was removed, please regenerate it with the skin partition spell" ) );
 	}
+
+	return numVerts - numUsed;
 }
 
 //! Flip texture UV coordinates
@@ -401,52 +704,15 @@ public:
 	{
 		QModelIndex iData = getTriShapeData( nif, index );
 
-		QList<Triangle> tris = nif->getArray<Triangle>( iData, "Triangles" ).toList();
-		int cnt = 0;
-
-		int i = 0;
-
-		while ( i < tris.count() ) {
-			const Triangle & t = tris[i];
-
-			if ( t[0] == t[1] || t[1] == t[2] || t[2] == t[0] ) {
-				tris.removeAt( i );
-				cnt++;
-			} else {
-				i++;
-			}
-		}
-
-		i = 0;
-
-		while ( i < tris.count() ) {
-			const Triangle & t = tris[i];
-
-			int j = i + 1;
-
-			while ( j < tris.count() ) {
-				const Triangle & r = tris[j];
-
-				if ( ( t[0] == r[0] && t[1] == r[1] && t[2] == r[2] )
-				     || ( t[0] == r[1] && t[1] == r[2] && t[2] == r[0] )
-				     || ( t[0] == r[2] && t[1] == r[0] && t[2] == r[1] ) )
-				{
-					tris.removeAt( j );
-					cnt++;
-				} else {
-					j++;
-				}
-			}
-
-			i++;
-		}
+		QVector<Triangle> tris = nif->getArray<Triangle>( iData, "Triangles" );
+		int cnt = pruneTriangles( tris );
 
 		if ( cnt > 0 ) {
 			Message::info( nullptr, Spell::tr( "Removed %1 triangles" ).arg( cnt ) );
 			nif->set<int>( iData, "Num Triangles", tris.count() );
 			nif->set<int>( iData, "Num Triangle Points", tris.count() * 3 );
 			nif->updateArray( iData, "Triangles" );
-			nif->setArray<Triangle>( iData, "Triangles", tris.toVector() );
+			nif->setArray<Triangle>( iData, "Triangles", tris );
 		}
 
 		return index;
@@ -504,33 +770,30 @@ public:
 
 			// detect the dublicates
 
-			QMap<quint16, quint16> map;
+			int stride = 3 + ( norms.count() ? 3 : 0 ) + ( colors.count() ? 4 : 0 ) + 2 * texco.count();
+			QVector<float> data;
+			data.reserve( numVerts * stride );
 
-			for ( int a = 0; a < numVerts; a++ ) {
-				Vector3 v = verts[a];
+			for ( int v = 0; v < numVerts; v++ ) {
+				data << verts[v][0] << verts[v][1] << verts[v][2];
 
-				for ( int b = 0; b < a; b++ ) {
-					if ( !( v == verts[b] ) )
-						continue;
+				if ( norms.count() )
+					data << norms[v][0] << norms[v][1] << norms[v][2];
 
-					if ( norms.count() && !( norms[a] == norms[b] ) )
-						continue;
+				if ( colors.count() )
+					data << colors[v][0] << colors[v][1] << colors[v][2] << colors[v][3];
 
-					if ( colors.count() && !( colors[a] == colors[b] ) )
-						continue;
+				for ( const QVector<Vector2> & uv : texco )
+					data << uv[v][0] << uv[v][1];
+			}
 
-					int t = 0;
+			QVector<int> remap = weldVertices( data, stride );
 
-					for ( t = 0; t < texco.count(); t++ ) {
-						if ( !( texco[t][a] == texco[t][b] ) )
-							break;
-					}
-
-					if ( t < texco.count() )
-						continue;
+			QMap<quint16, quint16> map;
 
-					map.insert( b, a );
-				}
+			for ( int v = 0; v < numVerts; v++ ) {
+				if ( remap[v] != v )
+					map.insert( v, remap[v] );
 			}
 
 			//qDebug() << QString( Spell::tr("detected % duplicates") ).arg( map.count() );
@@ -570,7 +833,8 @@ public:
 
 			// finally, remove the now unused vertices
 
-			removeWasteVertices( nif, iData, iShape );
+			int removed = removeWasteVertices( nif, iData, iShape );
+			Message::info( nullptr, Spell::tr( "Removed %1 vertices" ).arg( removed ) );
 		}
 		catch ( QString e )
 		{
@@ -600,7 +864,15 @@ public:
 		QModelIndex iShape = getShape( nif, index );
 		QModelIndex iData  = nif->getBlock( nif->getLink( iShape, "Data" ) );
 
-		removeWasteVertices( nif, iData, iShape );
+		try
+		{
+			int removed = removeWasteVertices( nif, iData, iShape );
+			Message::info( nullptr, Spell::tr( "Removed %1 vertices" ).arg( removed ) );
+		}
+		catch ( QString e )
+		{
+			Message::warning( nullptr, Spell::tr( "There were errors during the operation" ), e );
+		}
 
 		return index;
 	}
@@ -608,6 +880,61 @@ public:
 
 REGISTER_SPELL( spRemoveWasteVertices )
 
+//! Removes redundant triangles and unused vertices in one go
+/*!
+ * The skin, the skin partition, the morphs and the tangent space are
+ * compacted along with the vertices, and the center and radius updated.
+ */
+class spCompactGeometry final : public Spell
+{
+public:
+	QString name() const override final { return Spell::tr( "Compact Geometry" ); }
+	QString page() const override final { return Spell::tr( "Mesh" ); }
+
+	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
+	{
+		return getShape( nif, index ).isValid();
+	}
+
+	QModelIndex cast( NifModel * nif, const QModelIndex & index ) override final
+	{
+		QModelIndex iShape = getShape( nif, index );
+		QModelIndex iData  = nif->getBlock( nif->getLink( iShape, "Data" ) );
+
+		try
+		{
+			int removedTris = 0;
+
+			if ( nif->isNiBlock( iData, "NiTriShapeData" ) ) {
+				QVector<Triangle> tris = nif->getArray<Triangle>( iData, "Triangles" );
+				removedTris = pruneTriangles( tris );
+
+				if ( removedTris > 0 ) {
+					nif->set<int>( iData, "Num Triangles", tris.count() );
+					nif->set<int>( iData, "Num Triangle Points", tris.count() * 3 );
+					nif->updateArray( iData, "Triangles" );
+					nif->setArray<Triangle>( iData, "Triangles", tris );
+				}
+			}
+
+			int removedVerts = removeWasteVertices( nif, iData, iShape );
+
+			if ( removedVerts > 0 )
+				spUpdateCenterRadius().cast( nif, iData );
+
+			Message::info( nullptr, Spell::tr( "Removed %1 triangles and %2 vertices" ).arg( removedTris ).arg( removedVerts ) );
+		}
+		catch ( QString e )
+		{
+			Message::warning( nullptr, Spell::tr( "There were errors during the operation" ), e );
+		}
+
+		return index;
+	}
+};
+
+REGISTER_SPELL( spCompactGeometry )
+
 /*
  * spUpdateCenterRadius
  */
@@ -678,6 +1005,46 @@ QModelIndex spUpdateCenterRadius::cast( NifModel * nif, const QModelIndex & inde
 
 REGISTER_SPELL( spUpdateCenterRadius )
 
+//! The vertices of a BSTriShape and the bounds found for them
+struct BoundsJob
+{
+	QPersistentModelIndex iShape;
+	QVector<Vector3> verts;
+	BoundSphere bounds;
+};
+
+//! Read the vertex positions of a BSTriShape, finding the row of the position once
+static void readBoundsVertices( const NifModel * nif, BoundsJob & job )
+{
+	static const NifFieldId fVertex( "Vertex" );
+
+	QModelIndex iVertData = nif->getIndex( job.iShape, "Vertex Data" );
+	int numVerts = nif->rowCount( iVertData );
+	int rVertex = ( numVerts > 0 ) ? nif->getIndex( nif->index( 0, 0, iVertData ), fVertex ).row() : -1;
+
+	if ( rVertex < 0 )
+		return;
+
+	job.verts.reserve( numVerts );
+
+	for ( int i = 0; i < numVerts; i++ )
+		job.verts += nif->get<Vector3>( nif->index( rVertex, 0, nif->index( i, 0, iVertData ) ) );
+}
+
+//! Write the bounds found for a BSTriShape, unless they did not change
+static bool writeBounds( NifModel * nif, const BoundsJob & job )
+{
+	auto boundsIdx = nif->getIndex( job.iShape, "Bounding Sphere" );
+	BoundSphere old( nif, boundsIdx );
+
+	if ( old.center == job.bounds.center && old.radius == job.bounds.radius )
+		return false;
+
+	nif->set<Vector3>( boundsIdx, "Center", job.bounds.center );
+	nif->set<float>( boundsIdx, "Radius", job.bounds.radius );
+	return true;
+}
+
 //! Updates Bounds of BSTriShape
 class spUpdateBounds final : public Spell
 {
@@ -692,24 +1059,16 @@ public:
 
 	QModelIndex cast( NifModel * nif, const QModelIndex & index ) override final
 	{
-		auto vertData = nif->getIndex( index, "Vertex Data" );
+		BoundsJob job;
+		job.iShape = index;
+		readBoundsVertices( nif, job );
 
-		// Retrieve the verts
-		QVector<Vector3> verts;
-		for ( int i = 0; i < nif->rowCount( vertData ); i++ ) {
-			verts << nif->get<Vector3>( vertData.child( i, 0 ), "Vertex" );
-		}
-
-		if ( verts.isEmpty() )
+		if ( job.verts.isEmpty() )
 			return index;
 
 		// Creating a bounding sphere from the verts
-		BoundSphere bounds = BoundSphere( verts );
-
-		// Update the bounding sphere
-		auto boundsIdx = nif->getIndex( index, "Bounding Sphere" );
-		nif->set<Vector3>( boundsIdx, "Center", bounds.center );
-		nif->set<float>( boundsIdx, "Radius", bounds.radius );
+		job.bounds = BoundSphere( job.verts );
+		writeBounds( nif, job );
 
 		return index;
 	}
@@ -737,21 +1096,36 @@ public:
 
 	QModelIndex cast( NifModel * nif, const QModelIndex & ) override final
 	{
-		QList<QPersistentModelIndex> indices;
-
 		spUpdateBounds updBounds;
 
+		QVector<BoundsJob> jobs;
+
 		for ( int n = 0; n < nif->getBlockCount(); n++ ) {
 			QModelIndex idx = nif->getBlock( n );
 
-			if ( updBounds.isApplicable( nif, idx ) )
-				indices << idx;
-		}
+			if ( updBounds.isApplicable( nif, idx ) ) {
+				BoundsJob job;
+				job.iShape = idx;
+				readBoundsVertices( nif, job );
 
-		for ( const QModelIndex& idx : indices ) {
-			updBounds.castIfApplicable( nif, idx );
+				if ( !job.verts.isEmpty() )
+					jobs.append( job );
+			}
 		}
 
+		Spell::parallelFor( jobs.count(), [&jobs]( int i ) {
+			jobs[i].bounds = BoundSphere( jobs[i].verts );
+		} );
+
+		// Bounds which did not change are not written again
+		bool old = nif->holdUpdates( true );
+
+		for ( const BoundsJob & job : jobs )
+			writeBounds( nif, job );
+
+		if ( !old )
+			nif->holdUpdates( false );
+
 		return QModelIndex();
 	}
 };
@@ -3,9 +3,23 @@
 
 #include "spellbook.h"
 
+#include <QVector>
+
 
 //! \file mesh.h Mesh spell headers
 
+//! Find the vertices which have the same attributes as an earlier vertex
+/*!
+ * Vertices are hashed into a grid by position, so this is linear in the
+ * number of vertices rather than quadratic.
+ *
+ * \param data		The attributes of each vertex, \a stride floats per vertex starting with its position
+ * \param stride	The number of floats per vertex, at least 3
+ * \param epsilon	How far apart each attribute may be, 0 to weld only identical vertices
+ * \return			For each vertex, the first vertex it is the same as, or itself
+ */
+QVector<int> weldVertices( const QVector<float> & data, int stride, float epsilon = 0 );
+
 //! Update center and radius of a mesh
 class spUpdateCenterRadius final : public Spell
 {
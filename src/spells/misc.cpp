@@ -106,6 +106,7 @@ public:
 	QString name() const override final { return Spell::tr( "Follow Link" ); }
 	bool instant() const { return true; }
 	QIcon icon() const { return QIcon( ":/img/link" ); }
+	QList<NifValue::Type> applicableValues() const override final { return { NifValue::tLink, NifValue::tUpLink }; }
 
 	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
 	{
@@ -154,6 +155,7 @@ class spExportBinary final : public Spell
 {
 public:
 	QString name() const override final { return Spell::tr( "Export Binary" ); }
+	bool interactive() const override final { return true; }
 
 	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
 	{
@@ -202,6 +204,7 @@ class spImportBinary final : public Spell
 {
 public:
 	QString name() const override final { return Spell::tr( "Import Binary" ); }
+	bool interactive() const override final { return true; }
 
 	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
 	{
@@ -1,5 +1,9 @@
 #include "spellbook.h"
 
+#include <QMutex>
+
+#include <cstring>
+
 
 // Brief description is deliberately not autolinked to class Spell
 /*! \file moppcode.cpp
@@ -32,6 +36,8 @@ private:
 	typedef int (__stdcall * fnRetrieveMoppOrigin)( Vector3 * value );
 
 	void * hMoppLib;
+	//! The library keeps the code it generated until it is retrieved, so generate one at a time
+	QMutex mutex;
 	fnGenerateMoppCode GenerateMoppCode;
 	fnRetrieveMoppCode RetrieveMoppCode;
 	fnRetrieveMoppScale RetrieveMoppScale;
@@ -68,6 +74,7 @@ public:
 	QByteArray CalculateMoppCode( QVector<Vector3> const & verts, QVector<Triangle> const & tris, Vector3 * origin, float * scale )
 	{
 		QByteArray code;
+		QMutexLocker lock( &mutex );
 
 		if ( Initialize() ) {
 			int len = GenerateMoppCode( verts.size(), &verts[0], tris.size(), &tris[0] );
@@ -96,6 +103,7 @@ public:
 	                              Vector3 * origin, float * scale )
 	{
 		QByteArray code;
+		QMutexLocker lock( &mutex );
 
 		if ( Initialize() ) {
 			int len;
@@ -125,6 +133,107 @@ public:
 }
 TheHavokCode;
 
+//! A bhkMoppBvTreeShape whose MOPP code is generated
+struct MoppCodeJob
+{
+	//! The bhkMoppBvTreeShape; writing MOPP code inserts no blocks, so the number stays valid
+	int block = -1;
+	QVector<int> subshapeVerts;
+	QVector<Vector3> verts;
+	QVector<Triangle> triangles;
+
+	QByteArray code;
+	Vector3 origin;
+	float scale = 0;
+};
+
+//! Read the geometry of a MOPP shape, returning why it cannot be used if it cannot
+static QString readMoppCode( const NifModel * nif, const QModelIndex & iBlock, MoppCodeJob & job )
+{
+	job.block = nif->getBlockNumber( iBlock );
+
+	QModelIndex ibhkPackedNiTriStripsShape = nif->getBlock( nif->getLink( iBlock, "Shape" ) );
+
+	if ( !nif->isNiBlock( ibhkPackedNiTriStripsShape, "bhkPackedNiTriStripsShape" ) )
+		return Spell::tr( "Only bhkPackedNiTriStripsShape is supported at this time." );
+
+	QModelIndex ihkPackedNiTriStripsData = nif->getBlock( nif->getLink( ibhkPackedNiTriStripsShape, "Data" ) );
+
+	if ( !nif->isNiBlock( ihkPackedNiTriStripsData, "hkPackedNiTriStripsData" ) )
+		return Spell::tr( "Insufficient data to calculate MOPP code" );
+
+	QModelIndex iSubShapeParent;
+
+	if ( nif->checkVersion( 0x14000004, 0x14000005 ) )
+		iSubShapeParent = ibhkPackedNiTriStripsShape;
+	else if ( nif->checkVersion( 0x14020007, 0x14020007 ) )
+		iSubShapeParent = ihkPackedNiTriStripsData;
+
+	if ( iSubShapeParent.isValid() ) {
+		int nSubShapes = nif->get<int>( iSubShapeParent, "Num Sub Shapes" );
+		QModelIndex ihkSubShapes = nif->getIndex( iSubShapeParent, "Sub Shapes" );
+		job.subshapeVerts.resize( nSubShapes );
+
+		for ( int t = 0; t < nSubShapes; t++ ) {
+			job.subshapeVerts[t] = nif->get<int>( ihkSubShapes.child( t, 0 ), "Num Vertices" );
+		}
+	}
+
+	job.verts = nif->getArray<Vector3>( ihkPackedNiTriStripsData, "Vertices" );
+
+	int nTriangles = nif->get<int>( ihkPackedNiTriStripsData, "Num Triangles" );
+	QModelIndex iTriangles = nif->getIndex( ihkPackedNiTriStripsData, "Triangles" );
+
+	// Every triangle has the same fields, find the row of the triangle once
+	static const NifFieldId fTriangle( "Triangle" );
+	int rTriangle = ( nTriangles > 0 ) ? nif->getIndex( iTriangles.child( 0, 0 ), fTriangle ).row() : -1;
+
+	if ( rTriangle >= 0 ) {
+		job.triangles.resize( nTriangles );
+
+		for ( int t = 0; t < nTriangles; t++ ) {
+			job.triangles[t] = nif->get<Triangle>( iTriangles.child( t, 0 ).child( rTriangle, 0 ) );
+		}
+	}
+
+	if ( job.verts.isEmpty() || job.triangles.isEmpty() ) {
+		return Spell::tr( "Insufficient data to calculate MOPP code" ) + "\n"
+			+ Spell::tr( "Vertices: %1, Triangles: %2" ).arg( !job.verts.isEmpty() ).arg( !job.triangles.isEmpty() );
+	}
+
+	return QString();
+}
+
+//! Generate the MOPP code; only touches the job, so it may run on any thread
+static void computeMoppCode( MoppCodeJob & job )
+{
+	job.code = TheHavokCode.CalculateMoppCode( job.subshapeVerts, job.verts, job.triangles, &job.origin, &job.scale );
+}
+
+//! Write the MOPP code into its bhkMoppBvTreeShape
+static void writeMoppCode( NifModel * nif, const MoppCodeJob & job )
+{
+	QModelIndex iMopp = nif->getBlock( job.block );
+
+	QModelIndex iCodeOrigin = nif->getIndex( iMopp, "Origin" );
+	nif->set<Vector3>( iCodeOrigin, job.origin );
+
+	QModelIndex iCodeScale = nif->getIndex( iMopp, "Scale" );
+	nif->set<float>( iCodeScale, job.scale );
+
+	QModelIndex iCodeSize = nif->getIndex( iMopp, "MOPP Data Size" );
+	QModelIndex iCode = nif->getIndex( iMopp, "MOPP Data" );
+
+	if ( iCodeSize.isValid() && iCode.isValid() ) {
+		nif->set<int>( iCodeSize, job.code.size() );
+		nif->updateArray( iCode );
+
+		QVector<quint8> bytes( job.code.size() );
+		memcpy( bytes.data(), job.code.constData(), job.code.size() );
+		nif->setArray<quint8>( iCode, bytes );
+	}
+}
+
 //! Update Havok MOPP for a given shape
 class spMoppCode final : public Spell
 {
@@ -156,90 +265,84 @@ public:
 			return iBlock;
 		}
 
-		QPersistentModelIndex ibhkMoppBvTreeShape = iBlock;
+		MoppCodeJob job;
+		QString error = readMoppCode( nif, iBlock, job );
 
-		QModelIndex ibhkPackedNiTriStripsShape = nif->getBlock( nif->getLink( ibhkMoppBvTreeShape, "Shape" ) );
-
-		if ( !nif->isNiBlock( ibhkPackedNiTriStripsShape, "bhkPackedNiTriStripsShape" ) ) {
-			Message::warning( nullptr, Spell::tr( "Only bhkPackedNiTriStripsShape is supported at this time." ) );
+		if ( !error.isEmpty() ) {
+			Message::warning( nullptr, error );
 			return iBlock;
 		}
 
-		QModelIndex ihkPackedNiTriStripsData = nif->getBlock( nif->getLink( ibhkPackedNiTriStripsShape, "Data" ) );
-
-		if ( !nif->isNiBlock( ihkPackedNiTriStripsData, "hkPackedNiTriStripsData" ) )
-			return iBlock;
-
-		QVector<int> subshapeVerts;
-
-		if ( nif->checkVersion( 0x14000004, 0x14000005 ) ) {
-			int nSubShapes = nif->get<int>( ibhkPackedNiTriStripsShape, "Num Sub Shapes" );
-			QModelIndex ihkSubShapes = nif->getIndex( ibhkPackedNiTriStripsShape, "Sub Shapes" );
-			subshapeVerts.resize( nSubShapes );
+		computeMoppCode( job );
 
-			for ( int t = 0; t < nSubShapes; t++ ) {
-				subshapeVerts[t] = nif->get<int>( ihkSubShapes.child( t, 0 ), "Num Vertices" );
-			}
-		} else if ( nif->checkVersion( 0x14020007, 0x14020007 ) ) {
-			int nSubShapes = nif->get<int>( ihkPackedNiTriStripsData, "Num Sub Shapes" );
-			QModelIndex ihkSubShapes = nif->getIndex( ihkPackedNiTriStripsData, "Sub Shapes" );
-			subshapeVerts.resize( nSubShapes );
-
-			for ( int t = 0; t < nSubShapes; t++ ) {
-				subshapeVerts[t] = nif->get<int>( ihkSubShapes.child( t, 0 ), "Num Vertices" );
-			}
-		}
+		if ( job.code.size() == 0 )
+			Message::critical( nullptr, Spell::tr( "Failed to generate MOPP code" ) );
+		else
+			writeMoppCode( nif, job );
 
-		QVector<Vector3> verts = nif->getArray<Vector3>( ihkPackedNiTriStripsData, "Vertices" );
-		QVector<Triangle> triangles;
+		return iBlock;
+	}
+};
 
-		int nTriangles = nif->get<int>( ihkPackedNiTriStripsData, "Num Triangles" );
-		QModelIndex iTriangles = nif->getIndex( ihkPackedNiTriStripsData, "Triangles" );
-		triangles.resize( nTriangles );
+REGISTER_SPELL( spMoppCode )
 
-		for ( int t = 0; t < nTriangles; t++ ) {
-			triangles[t] = nif->get<Triangle>( iTriangles.child( t, 0 ), "Triangle" );
-		}
+//! Generates the MOPP code of many shapes on a worker thread
+class MoppCodeTask final : public SpellTask
+{
+public:
+	//! Read the geometry of each shape, on the GUI thread before compute()
+	void prepare( const NifModel * nif, const QVector<int> & blocks )
+	{
+		for ( const int b : blocks ) {
+			MoppCodeJob job;
+			QString error = readMoppCode( nif, nif->getBlock( b ), job );
 
-		if ( verts.isEmpty() || triangles.isEmpty() ) {
-			Message::critical( nullptr, Spell::tr( "Insufficient data to calculate MOPP code" ),
-				Spell::tr("Vertices: %1, Triangles: %2").arg( !verts.isEmpty() ).arg( !triangles.isEmpty() )
-			);
-			return iBlock;
+			if ( error.isEmpty() )
+				jobs.append( job );
+			else
+				errors << Spell::tr( "Block %1: %2" ).arg( b ).arg( error );
 		}
+	}
 
-		Vector3 origin;
-		float scale;
-		QByteArray moppcode = TheHavokCode.CalculateMoppCode( subshapeVerts, verts, triangles, &origin, &scale );
+	void compute( const NifSnapshot &, SpellProgress & progress ) override final
+	{
+		progress.setMaximum( jobs.count() );
 
-		if ( moppcode.size() == 0 ) {
-			Message::critical( nullptr, Spell::tr( "Failed to generate MOPP code" ) );
-		} else {
-			QModelIndex iCodeOrigin = nif->getIndex( ibhkMoppBvTreeShape, "Origin" );
-			nif->set<Vector3>( iCodeOrigin, origin );
+		Spell::parallelFor( jobs.count(), [this, &progress]( int i ) {
+			if ( progress.isCanceled() )
+				return;
 
-			QModelIndex iCodeScale = nif->getIndex( ibhkMoppBvTreeShape, "Scale" );
-			nif->set<float>( iCodeScale, scale );
+			computeMoppCode( jobs[i] );
+			progress.step();
+		} );
+	}
 
-			QModelIndex iCodeSize = nif->getIndex( ibhkMoppBvTreeShape, "MOPP Data Size" );
-			QModelIndex iCode = nif->getIndex( ibhkMoppBvTreeShape, "MOPP Data" );
+	QModelIndex commit( NifModel * nif ) override final
+	{
+		for ( const QString & error : errors )
+			Message::append( Spell::tr( "Some MOPP codes could not be updated." ), error );
 
-			if ( iCodeSize.isValid() && iCode.isValid() ) {
-				nif->set<int>( iCodeSize, moppcode.size() );
-				nif->updateArray( iCode );
+		// Update the model once after all shapes are written
+		bool oldHoldUpdates = nif->holdUpdates( true );
 
-				//nif->set<QByteArray>( iCode, moppcode );
-				for ( int i = 0; i < moppcode.size(); ++i ) {
-					nif->set<quint8>( iCode.child( i, 0 ), moppcode[i] );
-				}
-			}
+		for ( const MoppCodeJob & job : jobs ) {
+			if ( job.code.size() == 0 )
+				Message::append( Spell::tr( "Some MOPP codes could not be updated." ), Spell::tr( "Block %1: %2" )
+					.arg( job.block ).arg( Spell::tr( "Failed to generate MOPP code" ) ) );
+			else
+				writeMoppCode( nif, job );
 		}
 
-		return iBlock;
+		if ( !oldHoldUpdates )
+			nif->holdUpdates( false );
+
+		return QModelIndex();
 	}
-};
 
-REGISTER_SPELL( spMoppCode )
+protected:
+	QVector<MoppCodeJob> jobs;
+	QStringList errors;
+};
 
 //! Update MOPP code on all shapes in this model
 class spAllMoppCodes final : public Spell
@@ -263,24 +366,25 @@ public:
 		return false;
 	}
 
-	QModelIndex cast( NifModel * nif, const QModelIndex & ) override final
+	SpellTaskPtr task( const NifModel * nif, const QModelIndex & ) override final
 	{
-		QList<QPersistentModelIndex> indices;
+		QVector<int> blocks;
 
 		spMoppCode TSpacer;
 
 		for ( int n = 0; n < nif->getBlockCount(); n++ ) {
-			QModelIndex idx = nif->getBlock( n );
-
-			if ( TSpacer.isApplicable( nif, idx ) )
-				indices << idx;
+			if ( TSpacer.isApplicable( nif, nif->getBlock( n ) ) )
+				blocks << n;
 		}
 
-		for ( const QModelIndex& idx : indices ) {
-			TSpacer.castIfApplicable( nif, idx );
-		}
+		auto task = std::make_shared<MoppCodeTask>();
+		task->prepare( nif, blocks );
+		return task;
+	}
 
-		return QModelIndex();
+	QModelIndex cast( NifModel * nif, const QModelIndex & index ) override final
+	{
+		return castTask( nif, index );
 	}
 };
 
@@ -4,10 +4,13 @@
 
 #include <QDialog>
 #include <QDoubleSpinBox>
+#include <QHash>
 #include <QLabel>
 #include <QLayout>
 #include <QPushButton>
 
+#include <cmath>
+
 
 // Brief description is deliberately not autolinked to class Spell
 /*! \file normals.cpp
@@ -152,12 +155,29 @@ public:
 
 REGISTER_SPELL( spFlipNormals )
 
+//! A cell of the grid spSmoothNormals hashes vertices into
+struct SmoothCell
+{
+	qint64 x, y, z;
+
+	bool operator==( const SmoothCell & other ) const
+	{
+		return x == other.x && y == other.y && z == other.z;
+	}
+};
+
+static inline uint qHash( const SmoothCell & cell, uint seed = 0 )
+{
+	return qHashBits( &cell, sizeof( SmoothCell ), seed );
+}
+
 //! Smooths the normals of a mesh
 class spSmoothNormals final : public Spell
 {
 public:
 	QString name() const override final { return Spell::tr( "Smooth Normals" ); }
 	QString page() const override final { return Spell::tr( "Mesh" ); }
+	bool interactive() const override final { return true; }
 
 	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
 	{
@@ -176,11 +196,26 @@ public:
 			norms = nif->getArray<Vector3>( iData, "Normals" );
 		} else {
 			int numVerts = nif->get<int>( index, "Num Vertices" );
+
+			// Every vertex has the same fields, find their rows once
+			static const NifFieldId fVertex( "Vertex" );
+			static const NifFieldId fNormal( "Normal" );
+
+			auto first = nif->index( 0, 0, iData );
+			int rVertex = nif->getIndex( first, fVertex ).row();
+			int rNormal = nif->getIndex( first, fNormal ).row();
+
+			if ( numVerts > 0 && ( rVertex < 0 || rNormal < 0 ) )
+				return index;
+
+			verts.reserve( numVerts );
+			norms.reserve( numVerts );
+
 			for ( int i = 0; i < numVerts; i++ ) {
 				auto idx = nif->index( i, 0, iData );
 
-				verts += nif->get<Vector3>( idx, "Vertex" );
-				norms += nif->get<ByteVector3>( idx, "Normal" );
+				verts += nif->get<Vector3>( nif->index( rVertex, 0, idx ) );
+				norms += nif->get<ByteVector3>( nif->index( rNormal, 0, idx ) );
 			}
 		}
 
@@ -230,19 +265,53 @@ public:
 
 		QVector<Vector3> snorms( norms );
 
-		for ( int i = 0; i < verts.count(); i++ ) {
-			const Vector3 & a = verts[i];
-			Vector3 an = norms[i];
-
-			for ( int j = i + 1; j < verts.count(); j++ ) {
-				const Vector3 & b = verts[j];
-
-				if ( ( a - b ).squaredLength() < maxd ) {
-					Vector3 bn = norms[j];
-
-					if ( Vector3::angle( an, bn ) < maxa ) {
-						snorms[i] += bn;
-						snorms[j] += an;
+		// Hash the vertices into a grid of cells as wide as the distance, so each
+		// vertex is only compared with those in the neighbouring cells
+		float cellSize = std::sqrt( maxd );
+
+		if ( maxd > 0 ) {
+			QHash<SmoothCell, QVector<int>> cells;
+			cells.reserve( verts.count() );
+
+			auto cellOf = [cellSize]( const Vector3 & v ) {
+				return SmoothCell { qint64( std::floor( v[0] / cellSize ) ),
+				                    qint64( std::floor( v[1] / cellSize ) ),
+				                    qint64( std::floor( v[2] / cellSize ) ) };
+			};
+
+			for ( int i = 0; i < verts.count(); i++ )
+				cells[cellOf( verts[i] )].append( i );
+
+			for ( int i = 0; i < verts.count(); i++ ) {
+				const Vector3 & a = verts[i];
+				Vector3 an = norms[i];
+				SmoothCell c = cellOf( a );
+
+				for ( qint64 dx = -1; dx <= 1; dx++ ) {
+					for ( qint64 dy = -1; dy <= 1; dy++ ) {
+						for ( qint64 dz = -1; dz <= 1; dz++ ) {
+							auto it = cells.constFind( SmoothCell { c.x + dx, c.y + dy, c.z + dz } );
+
+							if ( it == cells.constEnd() )
+								continue;
+
+							for ( int j : it.value() ) {
+								// Each pair once, as the vertices later in the list
+								if ( j <= i )
+									continue;
+
+								const Vector3 & b = verts[j];
+
+								if ( ( a - b ).squaredLength() < maxd ) {
+									Vector3 bn = norms[j];
+
+									if ( Vector3::angle( an, bn ) < maxa ) {
+										snorms[i] += bn;
+										snorms[j] += an;
+									}
+								}
+							}
+						}
 					}
 				}
 			}
@@ -5,8 +5,13 @@
 #include "tangentspace.h"
 #include "transform.h"
 
+#include "gl/gltools.h"
+
 #include <QBuffer>
+#include <QDataStream>
+#include <QHash>
 #include <QMessageBox>
+#include <QSet>
 
 #include <algorithm> // std::sort
 #include <functional> //std::greater
@@ -40,76 +45,74 @@ public:
 
 	QModelIndex cast( NifModel * nif, const QModelIndex & ) override final
 	{
-		int numRemoved = 0;
-		QMap<qint32, QByteArray> props;
 		QMap<qint32, qint32> map;
 
-		do {
-			props.clear();
-			map.clear();
+		// The textures are merged first, so that the properties using them compare equal
+		// in the same pass
+		mergeBlocks( nif, map, []( const NifModel * nif, const QModelIndex & iBlock ) {
+			return nif->inherits( iBlock, "NiSourceTexture" );
+		} );
+		mergeBlocks( nif, map, []( const NifModel * nif, const QModelIndex & iBlock ) {
+			// BSShaderProperty blocks need to be unique
+			return nif->inherits( iBlock, "NiProperty" ) && !nif->inherits( iBlock, "BSShaderProperty" );
+		} );
+
+		QList<qint32> l = map.keys();
+		std::sort( l.begin(), l.end(), std::greater<qint32>() );
+		for ( const auto b : l ) {
+			nif->removeNiBlock( b );
+		}
 
-			for ( qint32 b = 0; b < nif->getBlockCount(); b++ ) {
-				QModelIndex iBlock = nif->getBlock( b );
-				QString original_material_name;
+		Message::info( nullptr, Spell::tr( "Removed %1 properties" ).arg( map.count() ) );
+		return QModelIndex();
+	}
 
-				if ( nif->isNiBlock( iBlock, "NiMaterialProperty" ) ) {
-					original_material_name = nif->get<QString>( iBlock, "Name" );
+	//! Link the blocks accepted by \a filter to the first block with the same content, adding them to \a map
+	static void mergeBlocks( NifModel * nif, QMap<qint32, qint32> & map, bool ( *filter )( const NifModel *, const QModelIndex & ) )
+	{
+		// The first block of each content; QHash only compares the bytes of blocks with the same hash
+		QHash<QByteArray, qint32> first;
+		QMap<qint32, qint32> merged;
 
-					if ( nif->get<QString>( iBlock, "Name" ).contains( "Material" ) )
-						nif->set<QString>( iBlock, "Name", "Material" );
-					else if ( nif->get<QString>( iBlock, "Name" ).contains( "Default" ) )
-						nif->set<QString>( iBlock, "Name", "Default" );
-				}
+		for ( qint32 b = 0; b < nif->getBlockCount(); b++ ) {
+			QModelIndex iBlock = nif->getBlock( b );
 
-				if ( nif->inherits( iBlock, "BSShaderProperty" ) || nif->isNiBlock( iBlock, "BSShaderTextureSet" ) ) {
-					// these need to be unique
-					continue;
-				}
+			if ( map.contains( b ) || !filter( nif, iBlock ) )
+				continue;
 
-				if ( nif->inherits( iBlock, "NiProperty" ) || nif->inherits( iBlock, "NiSourceTexture" ) ) {
-					QBuffer data;
-					data.open( QBuffer::WriteOnly );
-					data.write( nif->itemName( iBlock ).toLatin1() );
-					nif->saveIndex( data, iBlock );
-					props.insert( b, data.buffer() );
-				}
+			QString original_material_name;
 
-				// restore name
-				if ( nif->isNiBlock( iBlock, "NiMaterialProperty" ) ) {
-					nif->set<QString>( iBlock, "Name", original_material_name );
-				}
-			}
+			if ( nif->isNiBlock( iBlock, "NiMaterialProperty" ) ) {
+				original_material_name = nif->get<QString>( iBlock, "Name" );
 
-			for ( const auto x : props.keys() ) {
-				for ( const auto y : props.keys() ) {
-					if ( x < y && ( !map.contains( y ) ) && props[x].size() == props[y].size() ) {
-						int c = 0;
+				if ( original_material_name.contains( "Material" ) )
+					nif->set<QString>( iBlock, "Name", "Material" );
+				else if ( original_material_name.contains( "Default" ) )
+					nif->set<QString>( iBlock, "Name", "Default" );
+			}
 
-						while ( c < props[x].size() ) {
-							if ( props[x][c] != props[y][c] )
-								break;
-							c++;
-						}
+			QBuffer data;
+			data.open( QBuffer::WriteOnly );
+			data.write( nif->itemName( iBlock ).toLatin1() );
+			nif->saveIndex( data, iBlock );
 
-						if ( c == props[x].size() )
-							map.insert( y, x );
-					}
-				}
+			// restore name
+			if ( nif->isNiBlock( iBlock, "NiMaterialProperty" ) ) {
+				nif->set<QString>( iBlock, "Name", original_material_name );
 			}
 
-			if ( !map.isEmpty() ) {
-				numRemoved += map.count();
-				nif->mapLinks( map );
-				QList<qint32> l = map.keys();
-				std::sort( l.begin(), l.end(), std::greater<qint32>() );
-				for ( const auto b : l ) {
-					nif->removeNiBlock( b );
-				}
-			}
-		} while ( !map.isEmpty() );
+			auto it = first.constFind( data.buffer() );
 
-		Message::info( nullptr, Spell::tr( "Removed %1 properties" ).arg( numRemoved ) );
-		return QModelIndex();
+			if ( it == first.constEnd() )
+				first.insert( data.buffer(), b );
+			else
+				merged.insert( b, it.value() );
+		}
+
+		if ( !merged.isEmpty() ) {
+			nif->mapLinks( merged );
+			map.unite( merged );
+		}
 	}
 };
 
@@ -252,277 +255,494 @@ public:
 
 REGISTER_SPELL( spRemoveBogusNodes )
 
-//! Combines geometry data
-/*!
- * Can fail for a number of reasons, usually due to mismatched properties (see
- * spCombiProps for why that can fail) or non-geometry children (extra data,
- * skin instance etc.).
+//! A shape that may be combined with the other shapes of its group
+struct CombineCandidate
+{
+	//! The shape block
+	qint32 shape;
+	//! The block holding the geometry, the shape itself for BSTriShape
+	qint32 data;
+};
+
+/*! Find the key which is equal for all shapes that may be combined with each other
+ *
+ * The key holds the block type, the flags, the property links and the layout of
+ * the vertices. Since the transform of a BSTriShape cannot be applied to its
+ * packed vertices, BSTriShape also need to have the same transform.
+ *
+ * @return The key, or an empty key if the shape must stay as it is
  */
-class spCombiTris final : public Spell
+static QByteArray combineSignature( const NifModel * nif, const QModelIndex & iShape, qint32 & lData )
 {
-public:
-	QString name() const override final { return Spell::tr( "Combine Shapes" ); }
-	QString page() const override final { return Spell::tr( "Optimize" ); }
+	bool isTriShape = nif->isNiBlock( iShape, "BSTriShape" );
+	QModelIndex iData;
 
-	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
-	{
-		return nif && nif->isNiBlock( index, "NiNode" );
+	if ( isTriShape ) {
+		iData = iShape;
+		lData = nif->getBlockNumber( iShape );
+
+		if ( nif->get<int>( iShape, "Data Size" ) <= 0
+		     || nif->rowCount( nif->getIndex( iShape, "Vertex Data" ) ) != nif->get<int>( iShape, "Num Vertices" ) )
+		{
+			return QByteArray();
+		}
+	} else {
+		lData = nif->getLink( iShape, "Data" );
+		iData = nif->getBlock( lData, "NiTriBasedGeomData" );
+
+		if ( !iData.isValid() || !nif->getIndex( iData, "Vertices" ).isValid() )
+			return QByteArray();
 	}
 
-	QModelIndex cast( NifModel * nif, const QModelIndex & index ) override final
-	{
-		// join meshes which share properties and parent
-		// ( animated ones are left untouched )
+	QVector<qint32> lProps = nif->getLinkArray( iShape, "Properties" );
+	std::sort( lProps.begin(), lProps.end() );
 
-		QPersistentModelIndex iParent( index );
+	// The order of the shader and alpha property links matters
+	QVector<qint32> lBSProps = nif->getLinkArray( iShape, "BS Properties" );
 
-		// populate a list of possible candidates
+	if ( isTriShape )
+		lBSProps << nif->getLink( iShape, "Shader Property" ) << nif->getLink( iShape, "Alpha Property" );
 
-		QList<qint32> lTris;
+	// Controllers, skins and other extra data would not fit the combined shape
+	for ( const auto l : nif->getChildLinks( nif->getBlockNumber( iShape ) ) ) {
+		if ( l == lData || lProps.contains( l ) || lBSProps.contains( l ) )
+			continue;
 
-		for ( const auto lChild : nif->getLinkArray( iParent, "Children" ) ) {
-			if ( nif->getParent( lChild ) == nif->getBlockNumber( iParent ) ) {
-				QModelIndex iChild = nif->getBlock( lChild );
+		QModelIndex iBlock = nif->getBlock( l );
 
-				if ( nif->isNiBlock( iChild, { "NiTriShape", "NiTriStrips" } ) )
-					lTris << lChild;
-			}
-		}
+		if ( nif->isNiBlock( iBlock, "NiBinaryExtraData" ) && nif->get<QString>( iBlock, "Name" ) == "Tangent space (binormal & tangent vectors)" )
+			continue;
 
-		// detect matches
+		qCWarning( nsSpell ) << Spell::tr( "Attached %1 prevents %2 from being combined." )
+			.arg( nif->itemName( iBlock ) )
+			.arg( nif->get<QString>( iShape, "Name" ) );
 
-		QMap<qint32, QList<qint32> > match;
-		QList<qint32> found;
+		return QByteArray();
+	}
 
-		for ( const auto lTriA : lTris ) {
-			if ( found.contains( lTriA ) )
-				continue;
+	QByteArray key;
+	QDataStream stream( &key, QIODevice::WriteOnly );
 
-			for ( const auto lTriB : lTris ) {
-				if ( matches( nif, nif->getBlock( lTriA ), nif->getBlock( lTriB ) ) ) {
-					match[ lTriA ] << lTriB;
-					found << lTriB;
-				}
-			}
+	stream << nif->itemName( iShape ) << nif->get<quint32>( iShape, "Flags" ) << lProps << lBSProps;
+
+	if ( isTriShape ) {
+		Transform t( nif, iShape );
+
+		stream << nif->get<quint32>( iShape, "VF" ) << nif->get<quint32>( iShape, "Vertex Size" ) << t.scale;
+
+		for ( int i = 0; i < 3; i++ ) {
+			stream << t.translation[i];
+
+			for ( int j = 0; j < 3; j++ )
+				stream << t.rotation( i, j );
 		}
+	} else {
+		for ( const QString & name : { "Normals", "Vertex Colors" } )
+			stream << nif->getIndex( iData, name ).isValid();
 
-		// combine the matches
+		stream << nif->rowCount( nif->getIndex( iData, "UV Sets" ) );
 
-		spApplyTransformation ApplyTransform;
-		spTangentSpace TSpace;
+		for ( const QString & name : { "Vector Flags", "BS Vector Flags" } ) {
+			QModelIndex iFlags = nif->getIndex( iData, name );
+			stream << ( iFlags.isValid() ? nif->get<quint32>( iFlags ) : 0 );
+		}
+	}
 
-		QList<QPersistentModelIndex> remove;
+	return key;
+}
 
-		for ( const auto lTriA : match.keys() ) {
-			ApplyTransform.cast( nif, nif->getBlock( lTriA ) );
+//! Append the first \a count elements of \a b to \a a, padding a shorter \a b with T()
+template <typename T> static void appendArray( QVector<T> & a, const QVector<T> & b, int count )
+{
+	int base = a.count();
+	a += b.mid( 0, count );
+	a.resize( base + count );
+}
 
-			for ( const auto lTriB : match[lTriA] ) {
-				ApplyTransform.cast( nif, nif->getBlock( lTriB ) );
-				combine( nif, nif->getBlock( lTriA ), nif->getBlock( lTriB ) );
-				remove << nif->getBlock( lTriB );
-			}
+//! Combine the geometry data of NiTriShape and NiTriStrips into the data of the first, with a single write per array
+static void combineGeomData( NifModel * nif, const QVector<CombineCandidate> & group )
+{
+	QModelIndex iDataA = nif->getBlock( group.first().data );
+
+	bool hasNormals = nif->getIndex( iDataA, "Normals" ).isValid();
+	bool hasColors = nif->getIndex( iDataA, "Vertex Colors" ).isValid();
+	QModelIndex iUVSetsA = nif->getIndex( iDataA, "UV Sets" );
+
+	QVector<Vector3> verts, norms;
+	QVector<Color4> colors;
+	QVector<QVector<Vector2>> uvSets( nif->rowCount( iUVSetsA ) );
+	QVector<Triangle> tris;
+	QVector<QVector<quint16>> strips;
+	int numTris = 0;
+
+	for ( const CombineCandidate & c : group ) {
+		QModelIndex iData = nif->getBlock( c.data );
+
+		int base = verts.count();
+		int num = nif->get<int>( iData, "Num Vertices" );
+
+		appendArray( verts, nif->getArray<Vector3>( iData, "Vertices" ), num );
+
+		if ( hasNormals )
+			appendArray( norms, nif->getArray<Vector3>( iData, "Normals" ), num );
 
-			TSpace.castIfApplicable( nif, nif->getBlock( lTriA ) );
+		if ( hasColors )
+			appendArray( colors, nif->getArray<Color4>( iData, "Vertex Colors" ), num );
+
+		QModelIndex iUVSets = nif->getIndex( iData, "UV Sets" );
+
+		for ( int r = 0; r < uvSets.count(); r++ )
+			appendArray( uvSets[r], nif->getArray<Vector2>( nif->index( r, 0, iUVSets ) ), num );
+
+		for ( Triangle t : nif->getArray<Triangle>( iData, "Triangles" ) ) {
+			t[0] += base;
+			t[1] += base;
+			t[2] += base;
+			tris += t;
 		}
 
-		// remove the now obsolete shapes
+		numTris += nif->get<int>( iData, "Num Triangles" );
+
+		QModelIndex iPoints = nif->getIndex( iData, "Points" );
 
-		spRemoveBranch BranchRemover;
+		for ( int r = 0; r < nif->rowCount( iPoints ); r++ ) {
+			QVector<quint16> strip = nif->getArray<quint16>( nif->index( r, 0, iPoints ) );
 
-		for ( const QModelIndex& rem : remove ) {
-			BranchRemover.cast( nif, rem );
+			for ( quint16 & p : strip )
+				p += base;
+
+			strips += strip;
 		}
+	}
 
-		return iParent;
+	nif->set<int>( iDataA, "Num Vertices", verts.count() );
+
+	nif->updateArray( iDataA, "Vertices" );
+	nif->setArray<Vector3>( iDataA, "Vertices", verts );
+
+	if ( hasNormals ) {
+		nif->updateArray( iDataA, "Normals" );
+		nif->setArray<Vector3>( iDataA, "Normals", norms );
 	}
 
-	//! Determine if two shapes are identical
-	bool matches( const NifModel * nif, QModelIndex iTriA, QModelIndex iTriB )
-	{
-		if ( iTriA == iTriB
-			 || nif->itemName( iTriA ) != nif->itemName( iTriB )
-		     || nif->get<int>( iTriA, "Flags" ) != nif->get<int>( iTriB, "Flags" ) )
-		{
-			return false;
-		}
+	if ( hasColors ) {
+		nif->updateArray( iDataA, "Vertex Colors" );
+		nif->setArray<Color4>( iDataA, "Vertex Colors", colors );
+	}
 
-		QVector<qint32> lPrpsA = nif->getLinkArray( iTriA, "Properties" );
-		QVector<qint32> lPrpsB = nif->getLinkArray( iTriB, "Properties" );
+	for ( int r = 0; r < uvSets.count(); r++ ) {
+		QModelIndex iUVs = nif->index( r, 0, iUVSetsA );
+		nif->updateArray( iUVs );
+		nif->setArray<Vector2>( iUVs, uvSets[r] );
+	}
 
-		std::sort( lPrpsA.begin(), lPrpsA.end() /*, std::less<qint32>()*/ );
-		std::sort( lPrpsB.begin(), lPrpsB.end() /*, std::less<qint32>()*/ );
+	nif->set<int>( iDataA, "Num Triangles", numTris );
 
-		if ( lPrpsA != lPrpsB )
-			return false;
+	if ( nif->getIndex( iDataA, "Triangles" ).isValid() ) {
+		nif->set<int>( iDataA, "Num Triangle Points", tris.count() * 3 );
+		nif->updateArray( iDataA, "Triangles" );
+		nif->setArray<Triangle>( iDataA, "Triangles", tris );
+	}
 
-		for ( const auto l : nif->getChildLinks( nif->getBlockNumber( iTriA ) ) ) {
-			if ( lPrpsA.contains( l ) )
-				continue;
+	QModelIndex iPointsA = nif->getIndex( iDataA, "Points" );
 
-			QModelIndex iBlock = nif->getBlock( l );
+	if ( iPointsA.isValid() ) {
+		QVector<quint16> lengths;
+		lengths.reserve( strips.count() );
 
-			if ( nif->isNiBlock( iBlock, "NiTriShapeData" ) )
-				continue;
-			if ( nif->isNiBlock( iBlock, "NiTriStripsData" ) )
-				continue;
-			if ( nif->isNiBlock( iBlock, "NiBinaryExtraData" ) && nif->get<QString>( iBlock, "Name" ) == "Tangent space (binormal & tangent vectors)" )
-				continue;
+		for ( const auto & strip : strips )
+			lengths += strip.count();
 
-			qCWarning( nsSpell ) << Spell::tr( "Attached %1 prevents %2 and %3 from matching." )
-				.arg( nif->itemName( iBlock ) )
-				.arg( nif->get<QString>( iTriA, "Name" ) )
-				.arg( nif->get<QString>( iTriB, "Name" ) );
+		nif->set<int>( iDataA, "Num Strips", strips.count() );
+		nif->updateArray( iDataA, "Strip Lengths" );
+		nif->setArray<quint16>( iDataA, "Strip Lengths", lengths );
+		nif->updateArray( iPointsA );
 
-			return false;
+		for ( int r = 0; r < strips.count(); r++ ) {
+			QModelIndex iStrip = nif->index( r, 0, iPointsA );
+			nif->updateArray( iStrip );
+			nif->setArray<quint16>( iStrip, strips[r] );
 		}
+	}
 
-		for ( const auto l : nif->getChildLinks( nif->getBlockNumber( iTriB ) ) ) {
-			if ( lPrpsB.contains( l ) )
-				continue;
+	spUpdateCenterRadius CenterRadius;
+	CenterRadius.castIfApplicable( nif, iDataA );
+}
 
-			QModelIndex iBlock = nif->getBlock( l );
+//! Combine BSTriShape with the same vertex layout and transform into the first
+static void combineTriShapes( NifModel * nif, const QVector<CombineCandidate> & group )
+{
+	QModelIndex iShapeA = nif->getBlock( group.first().shape );
+	QModelIndex iVertDataA = nif->getIndex( iShapeA, "Vertex Data" );
 
-			if ( nif->isNiBlock( iBlock, "NiTriShapeData" ) )
-				continue;
-			if ( nif->isNiBlock( iBlock, "NiTriStripsData" ) )
-				continue;
-			if ( nif->isNiBlock( iBlock, "NiBinaryExtraData" ) && nif->get<QString>( iBlock, "Name" ) == "Tangent space (binormal & tangent vectors)" )
-				continue;
+	int numA = nif->rowCount( iVertDataA );
+	int numVerts = 0;
+	QVector<Triangle> tris;
 
-			qCWarning( nsSpell ) << Spell::tr( "Attached %1 prevents %2 and %3 from matching." )
-				.arg( nif->itemName( iBlock ) )
-				.arg( nif->get<QString>( iTriA, "Name" ) )
-				.arg( nif->get<QString>( iTriB, "Name" ) );
-			
-			return false;
-		}
+	for ( const CombineCandidate & c : group ) {
+		QModelIndex iShape = nif->getBlock( c.shape );
 
-		QModelIndex iDataA = nif->getBlock( nif->getLink( iTriA, "Data" ), "NiTriBasedGeomData" );
-		QModelIndex iDataB = nif->getBlock( nif->getLink( iTriB, "Data" ), "NiTriBasedGeomData" );
+		for ( Triangle t : nif->getArray<Triangle>( iShape, "Triangles" ) ) {
+			t[0] += numVerts;
+			t[1] += numVerts;
+			t[2] += numVerts;
+			tris += t;
+		}
 
-		return dataMatches( nif, iDataA, iDataB );
+		numVerts += nif->rowCount( nif->getIndex( iShape, "Vertex Data" ) );
 	}
 
-	//! Determines if two sets of shape data are identical
-	bool dataMatches( const NifModel * nif, QModelIndex iDataA, QModelIndex iDataB )
-	{
-		if ( iDataA == iDataB )
-			return true;
+	// The data size counts the bytes of the vertices and of the triangles
+	int vertexBytes = ( numA > 0 ) ? ( nif->get<int>( iShapeA, "Data Size" ) - nif->get<int>( iShapeA, "Num Triangles" ) * 6 ) / numA : 0;
+
+	nif->set<int>( iShapeA, "Num Vertices", numVerts );
+	nif->set<int>( iShapeA, "Num Triangles", tris.count() );
+	nif->set<int>( iShapeA, "Data Size", vertexBytes * numVerts + tris.count() * 6 );
+	nif->updateArray( iVertDataA );
+
+	// The vertices have the same fields, so they are copied field by field
+	int next = numA;
 
-		for ( const QString& id : QStringList{ "Vertices", "Normals", "Vertex Colors", "UV Sets" } ) {
-			QModelIndex iA = nif->getIndex( iDataA, id );
-			QModelIndex iB = nif->getIndex( iDataB, id );
+	for ( int s = 1; s < group.count(); s++ ) {
+		QModelIndex iVertData = nif->getIndex( nif->getBlock( group[s].shape ), "Vertex Data" );
 
-			if ( iA.isValid() != iB.isValid() )
-				return false;
+		for ( int v = 0; v < nif->rowCount( iVertData ); v++ ) {
+			QModelIndex iVertB = nif->index( v, 0, iVertData );
+			QModelIndex iVertA = nif->index( next++, 0, iVertDataA );
 
-			if ( id == "UV Sets" && nif->rowCount( iA ) != nif->rowCount( iB ) )
-				return false;
+			for ( int f = 0; f < nif->rowCount( iVertB ); f++ )
+				nif->setValue( nif->index( f, 0, iVertA ), nif->getValue( nif->index( f, 0, iVertB ) ) );
 		}
-		return true;
 	}
 
-	//! Combines meshes a and b ( a += b )
-	void combine( NifModel * nif, QModelIndex iTriA, QModelIndex iTriB )
-	{
-		nif->set<quint32>( iTriB, "Flags", nif->get<quint32>( iTriB, "Flags" ) | 1 );
+	nif->updateArray( iShapeA, "Triangles" );
+	nif->setArray<Triangle>( iShapeA, "Triangles", tris );
 
-		QModelIndex iDataA = nif->getBlock( nif->getLink( iTriA, "Data" ), "NiTriBasedGeomData" );
-		QModelIndex iDataB = nif->getBlock( nif->getLink( iTriB, "Data" ), "NiTriBasedGeomData" );
+	static const NifFieldId fVertex( "Vertex" );
 
-		int numA = nif->get<int>( iDataA, "Num Vertices" );
-		int numB = nif->get<int>( iDataB, "Num Vertices" );
-		nif->set<int>( iDataA, "Num Vertices", numA + numB );
+	int rVertex = ( numVerts > 0 ) ? nif->getIndex( nif->index( 0, 0, iVertDataA ), fVertex ).row() : -1;
 
-		nif->updateArray( iDataA, "Vertices" );
-		nif->setArray<Vector3>( iDataA, "Vertices", nif->getArray<Vector3>( iDataA, "Vertices" ).mid( 0, numA ) + nif->getArray<Vector3>( iDataB, "Vertices" ) );
+	if ( rVertex >= 0 ) {
+		QVector<Vector3> verts;
+		verts.reserve( numVerts );
 
-		nif->updateArray( iDataA, "Normals" );
-		nif->setArray<Vector3>( iDataA, "Normals", nif->getArray<Vector3>( iDataA, "Normals" ).mid( 0, numA ) + nif->getArray<Vector3>( iDataB, "Normals" ) );
+		for ( int v = 0; v < numVerts; v++ )
+			verts += nif->get<Vector3>( nif->index( rVertex, 0, nif->index( v, 0, iVertDataA ) ) );
 
-		nif->updateArray( iDataA, "Vertex Colors" );
-		nif->setArray<Color4>( iDataA, "Vertex Colors", nif->getArray<Color4>( iDataA, "Vertex Colors" ).mid( 0, numA ) + nif->getArray<Color4>( iDataB, "Vertex Colors" ) );
+		BoundSphere bounds( verts );
 
-		QModelIndex iUVa = nif->getIndex( iDataA, "UV Sets" );
-		QModelIndex iUVb = nif->getIndex( iDataB, "UV Sets" );
+		QModelIndex iBounds = nif->getIndex( iShapeA, "Bounding Sphere" );
+		nif->set<Vector3>( iBounds, "Center", bounds.center );
+		nif->set<float>( iBounds, "Radius", bounds.radius );
+	}
+}
 
-		for ( int r = 0; r < nif->rowCount( iUVa ); r++ ) {
-			nif->updateArray( iUVa.child( r, 0 ) );
-			nif->setArray<Vector2>( iUVa.child( r, 0 ), nif->getArray<Vector2>( iUVa.child( r, 0 ) ).mid( 0, numA ) + nif->getArray<Vector2>( iUVb.child( r, 0 ) ) );
-		}
+//! Whether Combine Shapes may join the shapes below a node
+static bool canCombineChildren( const NifModel * nif, const QModelIndex & index )
+{
+	return nif->isNiBlock( index, { "NiNode", "BSFadeNode" } );
+}
+
+/*! Join the shapes below a node which share their properties
+ *
+ * Shapes are grouped by combineSignature() in a single pass. A group is split
+ * where its vertices would no longer fit the 16 bit triangle indices.
+ *
+ * @return The number of shapes removed
+ */
+static int combineShapes( NifModel * nif, const QModelIndex & iNode )
+{
+	// The most vertices the 16 bit indices of the triangles can address
+	const int maxVertices = 0xFFFF;
 
-		int triCntA = nif->get<int>( iDataA, "Num Triangles" );
-		int triCntB = nif->get<int>( iDataB, "Num Triangles" );
-		nif->set<int>( iDataA, "Num Triangles", triCntA + triCntB );
-		nif->set<int>( iDataA, "Num Triangle Points", ( triCntA + triCntB ) * 3 );
+	qint32 lNode = nif->getBlockNumber( iNode );
 
-		QVector<Triangle> triangles = nif->getArray<Triangle>( iDataB, "Triangles" );
-		QMutableVectorIterator<Triangle> itTri( triangles );
+	QHash<QByteArray, int> groupOf;
+	QVector<QVector<CombineCandidate>> groups;
+	QVector<int> groupVerts;
+	QSet<qint32> usedData;
+
+	for ( const auto lChild : nif->getLinkArray( iNode, "Children" ) ) {
+		if ( nif->getParent( lChild ) != lNode )
+			continue;
+
+		QModelIndex iChild = nif->getBlock( lChild );
+
+		if ( !nif->isNiBlock( iChild, { "NiTriShape", "NiTriStrips", "BSTriShape" } ) )
+			continue;
+
+		CombineCandidate c;
+		c.shape = lChild;
+
+		QByteArray key = combineSignature( nif, iChild, c.data );
+
+		// Shapes sharing their data would apply the transforms twice
+		if ( key.isEmpty() || usedData.contains( c.data ) )
+			continue;
 
-		while ( itTri.hasNext() ) {
-			Triangle & tri = itTri.next();
-			tri[0] += numA;
-			tri[1] += numA;
-			tri[2] += numA;
+		usedData.insert( c.data );
+
+		int numVerts = nif->get<int>( nif->getBlock( c.data ), "Num Vertices" );
+		auto it = groupOf.find( key );
+
+		if ( it == groupOf.end() || groupVerts[it.value()] + numVerts > maxVertices ) {
+			it = groupOf.insert( key, groups.count() );
+			groups.append( QVector<CombineCandidate>() );
+			groupVerts.append( 0 );
 		}
 
-		nif->updateArray( iDataA, "Triangles" );
-		nif->setArray<Triangle>( iDataA, "Triangles", triangles + nif->getArray<Triangle>( iDataA, "Triangles" ) );
+		groups[it.value()].append( c );
+		groupVerts[it.value()] += numVerts;
+	}
 
-		int stripCntA = nif->get<int>( iDataA, "Num Strips" );
-		int stripCntB = nif->get<int>( iDataB, "Num Strips" );
-		nif->set<int>( iDataA, "Num Strips", stripCntA + stripCntB );
+	spApplyTransformation ApplyTransform;
+	spTangentSpace TSpace;
 
-		nif->updateArray( iDataA, "Strip Lengths" );
-		nif->updateArray( iDataA, "Points" );
+	QList<QPersistentModelIndex> remove;
+
+	for ( const auto & group : groups ) {
+		if ( group.count() < 2 )
+			continue;
 
-		for ( int r = 0; r < stripCntB; r++ ) {
-			QVector<quint16> strip = nif->getArray<quint16>( nif->getIndex( iDataB, "Points" ).child( r, 0 ) );
-			QMutableVectorIterator<quint16> it( strip );
+		QModelIndex iShapeA = nif->getBlock( group.first().shape );
 
-			while ( it.hasNext() )
-				it.next() += numA;
+		if ( nif->isNiBlock( iShapeA, "BSTriShape" ) ) {
+			combineTriShapes( nif, group );
+		} else {
+			for ( const CombineCandidate & c : group )
+				ApplyTransform.cast( nif, nif->getBlock( c.shape ) );
 
-			nif->set<int>( nif->getIndex( iDataA, "Strip Lengths" ).child( r + stripCntA, 0 ), strip.size() );
-			nif->updateArray( nif->getIndex( iDataA, "Points" ).child( r + stripCntA, 0 ) );
-			nif->setArray<quint16>( nif->getIndex( iDataA, "Points" ).child( r + stripCntA, 0 ), strip );
+			combineGeomData( nif, group );
+			TSpace.castIfApplicable( nif, iShapeA );
 		}
 
-		spUpdateCenterRadius CenterRadius;
-		CenterRadius.castIfApplicable( nif, iDataA );
+		for ( int s = 1; s < group.count(); s++ )
+			remove << nif->getBlock( group[s].shape );
+	}
+
+	// remove the now obsolete shapes
+
+	spRemoveBranch BranchRemover;
+
+	for ( const QModelIndex & rem : remove ) {
+		BranchRemover.cast( nif, rem );
+	}
+
+	return remove.count();
+}
+
+//! Combines geometry data
+/*!
+ * Can fail for a number of reasons, usually due to mismatched properties (see
+ * spCombiProps for why that can fail) or non-geometry children (extra data,
+ * skin instance etc.).
+ *
+ * \sa spCombiAllTris
+ */
+class spCombiTris final : public Spell
+{
+public:
+	QString name() const override final { return Spell::tr( "Combine Shapes" ); }
+	QString page() const override final { return Spell::tr( "Optimize" ); }
+
+	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
+	{
+		return nif && canCombineChildren( nif, index );
+	}
+
+	QModelIndex cast( NifModel * nif, const QModelIndex & index ) override final
+	{
+		// join meshes which share properties and parent
+		// ( animated ones are left untouched )
+
+		QPersistentModelIndex iParent( index );
+
+		bool old = nif->holdUpdates( true );
+		combineShapes( nif, iParent );
+
+		if ( !old )
+			nif->holdUpdates( false );
+
+		return iParent;
 	}
 };
 
 REGISTER_SPELL( spCombiTris )
 
-
-void scan( QModelIndex idx, NifModel * nif, QMap<QString, qint32> & usedStrings, bool hasCED )
+//! Combines geometry data below every node of the file
+class spCombiAllTris final : public Spell
 {
-	for ( int i = 0; i < nif->rowCount( idx ); i++ ) {
-		auto child = idx.child( i, 2 );
-		if ( nif->rowCount( child ) > 0 ) {
-			scan( child, nif, usedStrings, hasCED );
-			continue;
+public:
+	QString name() const override final { return Spell::tr( "Combine All Shapes" ); }
+	QString page() const override final { return Spell::tr( "Optimize" ); }
+
+	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
+	{
+		return nif && !index.isValid();
+	}
+
+	QModelIndex cast( NifModel * nif, const QModelIndex & ) override final
+	{
+		// Removing shapes renumbers the blocks
+		QList<QPersistentModelIndex> nodes;
+
+		for ( int b = 0; b < nif->getBlockCount(); b++ ) {
+			QModelIndex iBlock = nif->getBlock( b );
+
+			if ( canCombineChildren( nif, iBlock ) )
+				nodes << iBlock;
 		}
 
-		NifValue val;
-		val.setFromVariant( child.data( Qt::EditRole ) );
-		if ( val.type() == NifValue::tStringIndex ) {
-			if ( nif->get<int>( child ) == -1 )
-				continue;
+		int cnt = 0;
+		bool old = nif->holdUpdates( true );
 
-			auto str = nif->get<QString>( child );
-			if ( !usedStrings.contains( str ) )
-				usedStrings.insert( str, usedStrings.size() );
+		for ( const QModelIndex & iNode : nodes ) {
+			if ( iNode.isValid() )
+				cnt += combineShapes( nif, iNode );
+		}
 
-			qint32 value = usedStrings[str];
-			if ( hasCED && value > 0 )
-				value++;
+		if ( !old )
+			nif->holdUpdates( false );
+
+		if ( cnt > 0 )
+			Message::info( nullptr, Spell::tr( "Combined %1 shapes into others" ).arg( cnt ) );
+
+		return QModelIndex();
+	}
+};
+
+REGISTER_SPELL( spCombiAllTris )
+
+
+//! The items referring to header strings, found in one pass over the model
+struct StringRefs
+{
+	//! The referring items in model order
+	QVector<QModelIndex> items;
+	//! The string index each item refers to
+	QVector<qint32> strings;
 
-			nif->set<int>( child, value );
+	//! Collect the references under \a idx
+	void scan( const NifModel * nif, const QModelIndex & idx )
+	{
+		for ( int i = 0; i < nif->rowCount( idx ); i++ ) {
+			auto child = idx.child( i, 0 );
+			if ( nif->rowCount( child ) > 0 ) {
+				scan( nif, child );
+				continue;
+			}
+
+			if ( nif->getValue( child ).type() == NifValue::tStringIndex ) {
+				qint32 str = nif->get<int>( child );
+				if ( str == -1 )
+					continue;
+
+				items.append( child );
+				strings.append( str );
+			}
 		}
 	}
-}
+};
 
 //! Removes unused strings from the header
 class spRemoveUnusedStrings final : public Spell
@@ -545,13 +765,52 @@ public:
 
 		bool hasCED = cedIdx >= 0;
 
-		QMap<QString, qint32> usedStrings;
+		StringRefs refs;
 		for ( qint32 b = 0; b < nif->getBlockCount(); b++ )
-			scan( nif->getBlock( b ), nif, usedStrings, hasCED );
+			refs.scan( nif, nif->getBlock( b ) );
+
+		// Number the strings in the order they are first used, the same text sharing a number
+		QHash<QString, qint32> usedStrings;
+		QVector<QString> newStrings;
+		QVector<qint32> remap( originalStrings.count(), -1 );
+
+		for ( qint32 & str : refs.strings ) {
+			if ( str < 0 || str >= remap.count() )
+				continue;
+
+			if ( remap[str] < 0 ) {
+				const QString & text = originalStrings[str];
+				auto it = usedStrings.constFind( text );
+
+				if ( it != usedStrings.constEnd() ) {
+					remap[str] = it.value();
+				} else {
+					remap[str] = newStrings.count();
+					usedStrings.insert( text, newStrings.count() );
+					newStrings.append( text );
+				}
+			}
+
+			qint32 value = remap[str];
+			if ( hasCED && value > 0 )
+				value++;
+
+			str = value;
+		}
 
-		QVector<QString> newStrings( usedStrings.size() );
-		for ( auto kv : usedStrings.toStdMap() )
-			newStrings[kv.second] = kv.first;
+		// Pause updates between model/view
+		bool oldHoldUpdates = nif->holdUpdates( true );
+		nif->setEmitChanges( false );
+
+		for ( int i = 0; i < refs.items.count(); i++ ) {
+			// Unpause updates if last
+			if ( i == refs.items.count() - 1 )
+				nif->setEmitChanges( true );
+
+			nif->set<int>( refs.items[i], refs.strings[i] );
+		}
+
+		nif->setEmitChanges( true );
 
 		int newSize = newStrings.size();
 
@@ -565,16 +824,26 @@ public:
 		nif->setArray<QString>( nif->getHeader(), "Strings", newStrings );
 		nif->updateHeader();
 
+		if ( !oldHoldUpdates )
+			nif->holdUpdates( false );
+
 		// Remove new from original to see what was removed
+		QSet<QString> kept;
 		for ( const auto & s : newStrings )
-			originalStrings.removeAll( s );
+			kept.insert( s );
+
+		QStringList removed;
+		for ( const auto & s : originalStrings ) {
+			if ( !kept.contains( s ) )
+				removed << s;
+		}
 
 		QString msg;
-		if ( originalStrings.size() )
-			msg = "Removed:\r\n" + QStringList::fromVector( originalStrings ).join( "\r\n" );
+		if ( removed.size() )
+			msg = "Removed:\r\n" + removed.join( "\r\n" );
 
 		Message::info( nullptr, Spell::tr( "Strings Removed: %1. New string table has %2 entries." )
-					   .arg( originalStrings.size() ).arg( newSize ), msg
+					   .arg( removed.size() ).arg( newSize ), msg
 		);
 
 		return QModelIndex();
@@ -13,62 +13,95 @@
  * All classes here inherit from the Spell class.
  */
 
+//! Comparator for link sort.
+/**
+ * If booleans of the pair are not equal, sort based on the first boolean.
+ * For spReorderLinks this will determine a sort of geometry before nodes
+ * in the children links array.
+ */
+static bool compareChildLinks( QPair<qint32, bool> a, QPair<qint32, bool> b )
+{
+	return a.second != b.second ? a.second : a.first < b.first;
+}
+
+//! Remove the empty links of a link array, putting geometry first if \a geometryFirst is set
+static void sanitizeLinkArray( NifModel * nif, const QModelIndex & iBlock, const QString & num, const QString & array, bool geometryFirst )
+{
+	QModelIndex iNum = nif->getIndex( iBlock, num );
+	QModelIndex iArray = nif->getIndex( iBlock, array );
+
+	if ( !iNum.isValid() || !iArray.isValid() )
+		return;
+
+	QVector<qint32> old = nif->getLinkArray( iArray );
+	QList<QPair<qint32, bool> > links;
+
+	for ( const auto l : old ) {
+		if ( l >= 0 )
+			links.append( QPair<qint32, bool>( l, geometryFirst && nif->inherits( nif->getBlock( l ), "NiTriBasedGeom" ) ) );
+	}
+
+	if ( geometryFirst )
+		std::stable_sort( links.begin(), links.end(), compareChildLinks );
+
+	QVector<qint32> result;
+	result.reserve( links.count() );
+
+	for ( const auto & l : links )
+		result.append( l.first );
+
+	// update count & array even if there are no rows (i.e. prune empty children)
+	if ( result != old ) {
+		nif->set<int>( iNum, result.count() );
+		nif->updateArray( iArray );
+		nif->setLinkArray( iArray, result );
+	}
+}
+
+/*! Fix the link arrays of all blocks in one pass
+ *
+ * \param reorderChildren	Put geometry before nodes in the children
+ * \param collapse		Remove the empty links of the other arrays as well
+ */
+static void sanitizeLinkArrays( NifModel * nif, bool reorderChildren, bool collapse )
+{
+	for ( int n = 0; n < nif->getBlockCount(); n++ ) {
+		QModelIndex iBlock = nif->getBlock( n );
+
+		// remove empty children links
+		sanitizeLinkArray( nif, iBlock, "Num Children", "Children", reorderChildren );
+
+		if ( !collapse )
+			continue;
+
+		// remove empty property links
+		sanitizeLinkArray( nif, iBlock, "Num Properties", "Properties", false );
+		// remove empty extra data links
+		sanitizeLinkArray( nif, iBlock, "Num Extra Data List", "Extra Data List", false );
+		// remove empty modifier links (NiParticleSystem crashes Oblivion for those)
+		sanitizeLinkArray( nif, iBlock, "Num Modifiers", "Modifiers", false );
+	}
+}
+
 //! Reorders blocks to put shapes before nodes (for Oblivion / FO3)
+/*!
+ * Not a sanity spell itself; spSanitizeLinkArrays does this in the same
+ * pass when sanitizing.
+ */
 class spReorderLinks final : public Spell
 {
 public:
 	QString name() const override final { return Spell::tr( "Reorder Link Arrays" ); }
 	QString page() const override final { return Spell::tr( "Sanitize" ); }
-	bool sanity() const { return true; }
 
 	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
 	{
 		return ( !index.isValid() && ( nif->getVersionNumber() >= 0x14000004 ) );
 	}
 
-	//! Comparator for link sort.
-	/**
-	 * If booleans of the pair are not equal, sort based on the first boolean.
-	 * For spReorderLinks this will determine a sort of geometry before nodes
-	 * in the children links array.
-	 */
-	static bool compareChildLinks( QPair<qint32, bool> a, QPair<qint32, bool> b )
-	{
-		return a.second != b.second ? a.second : a.first < b.first;
-	}
-
 	QModelIndex cast( NifModel * nif, const QModelIndex & ) override final
 	{
-		for ( int n = 0; n < nif->getBlockCount(); n++ ) {
-			QModelIndex iBlock = nif->getBlock( n );
-
-			QModelIndex iNumChildren = nif->getIndex( iBlock, "Num Children" );
-			QModelIndex iChildren = nif->getIndex( iBlock, "Children" );
-
-			if ( iNumChildren.isValid() && iChildren.isValid() ) {
-				QList<QPair<qint32, bool> > links;
-
-				for ( int r = 0; r < nif->rowCount( iChildren ); r++ ) {
-					qint32 l = nif->getLink( iChildren.child( r, 0 ) );
-
-					if ( l >= 0 ) {
-						links.append( QPair<qint32, bool>( l, nif->inherits( nif->getBlock( l ), "NiTriBasedGeom" ) ) );
-					}
-				}
-
-				std::stable_sort( links.begin(), links.end(), compareChildLinks );
-
-				for ( int r = 0; r < links.count(); r++ ) {
-					if ( links[r].first != nif->getLink( iChildren.child( r, 0 ) ) ) {
-						nif->setLink( iChildren.child( r, 0 ), links[r].first );
-					}
-				}
-
-				// update child count & array even if there are no rows (i.e. prune empty children)
-				nif->set<int>( iNumChildren, links.count() );
-				nif->updateArray( iChildren );
-			}
-		}
+		sanitizeLinkArrays( nif, true, false );
 
 		return QModelIndex();
 	}
@@ -76,7 +109,7 @@ public:
 
 REGISTER_SPELL( spReorderLinks )
 
-//! Removes empty members from link arrays
+//! Removes empty members from link arrays, and reorders the children as spReorderLinks does
 class spSanitizeLinkArrays final : public Spell
 {
 public:
@@ -92,31 +125,7 @@ public:
 
 	QModelIndex cast( NifModel * nif, const QModelIndex & ) override final
 	{
-		for ( int n = 0; n < nif->getBlockCount(); n++ ) {
-			QModelIndex iBlock = nif->getBlock( n );
-
-			spCollapseArray arrayCollapser;
-
-			// remove empty children links
-			QModelIndex iNumChildren = nif->getIndex( iBlock, "Num Children" );
-			QModelIndex iChildren = nif->getIndex( iBlock, "Children" );
-			arrayCollapser.numCollapser( nif, iNumChildren, iChildren );
-
-			// remove empty property links
-			QModelIndex iNumProperties = nif->getIndex( iBlock, "Num Properties" );
-			QModelIndex iProperties = nif->getIndex( iBlock, "Properties" );
-			arrayCollapser.numCollapser( nif, iNumProperties, iProperties );
-
-			// remove empty extra data links
-			QModelIndex iNumExtraData = nif->getIndex( iBlock, "Num Extra Data List" );
-			QModelIndex iExtraData = nif->getIndex( iBlock, "Extra Data List" );
-			arrayCollapser.numCollapser( nif, iNumExtraData, iExtraData );
-
-			// remove empty modifier links (NiParticleSystem crashes Oblivion for those)
-			QModelIndex iNumModifiers = nif->getIndex( iBlock, "Num Modifiers" );
-			QModelIndex iModifiers = nif->getIndex( iBlock, "Modifiers" );
-			arrayCollapser.numCollapser( nif, iNumModifiers, iModifiers );
-		}
+		sanitizeLinkArrays( nif, nif->getVersionNumber() >= 0x14000004, true );
 
 		return QModelIndex();
 	}
@@ -194,20 +203,22 @@ public:
 	}
 
 	// build the nif tree at node block; the block itself and its children are recursively added to
-	// the newblocks list
-	void addTree( NifModel * nif, qint32 block, QList<qint32> & newblocks )
+	// the newblocks list, added marks the blocks in it
+	void addTree( NifModel * nif, qint32 block, QList<qint32> & newblocks, QVector<bool> & added )
 	{
 		// is the block already added?
-		if ( newblocks.contains( block ) )
+		if ( block < 0 || block >= added.count() || added[block] )
 			return;
 
+		added[block] = true;
+
 		// special case: add bhkConstraint entities before bhkConstraint
 		// (these are actually links, not refs)
 		QModelIndex iBlock( nif->getBlock( block ) );
 
 		if ( nif->inherits( iBlock, "bhkConstraint" ) ) {
 			for ( const auto entity : nif->getLinkArray( iBlock, "Entities" ) ) {
-				addTree( nif, entity, newblocks );
+				addTree( nif, entity, newblocks, added );
 			}
 		}
 
@@ -215,7 +226,7 @@ public:
 		// add all children of block that should be before block
 		for ( const auto child : nif->getChildLinks( block ) ) {
 			if ( childBeforeParent( nif, child ) )
-				addTree( nif, child, newblocks ); // now add this child and all of its children
+				addTree( nif, child, newblocks, added ); // now add this child and all of its children
 		}
 
 		// add the block
@@ -223,7 +234,7 @@ public:
 		// add all children of block that should be after block
 		for ( const auto child : nif->getChildLinks( block ) ) {
 			if ( !childBeforeParent( nif, child ) )
-				addTree( nif, child, newblocks ); // now add this child and all of its children
+				addTree( nif, child, newblocks, added ); // now add this child and all of its children
 		}
 	}
 
@@ -239,11 +250,12 @@ public:
 		// assigned number 1
 		// etc.
 		QList<qint32> newblocks;
+		QVector<bool> added( nif->getBlockCount(), false );
 
 		// add blocks recursively
 		for ( const auto rootblock : rootblocks )
 		{
-			addTree( nif, rootblock, newblocks );
+			addTree( nif, rootblock, newblocks, added );
 		}
 
 		// check whether all blocks have been added
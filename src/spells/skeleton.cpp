@@ -11,8 +11,12 @@
 #include <QMessageBox>
 #include <QPushButton>
 #include <QSpinBox>
+#include <QtAlgorithms>
 
 #include <algorithm> // std::sort
+#include <functional>
+#include <queue>
+#include <tuple>
 
 #define SKEL_DAT ":/res/skel.dat"
 
@@ -256,745 +260,978 @@ inline void qRotate( Triangle & t )
 	}
 }
 
-//! Make skin partition
-class spSkinPartition final : public Spell
+//! A set of bones of a skin, one bit per bone
+class BoneMask
 {
 public:
-	QString name() const override final { return Spell::tr( "Make Skin Partition" ); }
-	QString page() const override final { return Spell::tr( "Mesh" ); }
+	BoneMask( int numBones = 0 ) : bits( ( numBones + 63 ) / 64, 0 ) {}
 
-	bool isApplicable( const NifModel * nif, const QModelIndex & iShape ) override final
+	//! Add a bone
+	void set( int bone )
 	{
-		if ( nif->isNiBlock( iShape, { "NiTriShape", "NiTriStrips" } ) ) {
-			QModelIndex iSkinInst = nif->getBlock( nif->getLink( iShape, "Skin Instance" ), "NiSkinInstance" );
-
-			if ( iSkinInst.isValid() ) {
-				return nif->getBlock( nif->getLink( iSkinInst, "Data" ), "NiSkinData" ).isValid();
+		bits[bone >> 6] |= quint64( 1 ) << ( bone & 63 );
+	}
+	//! The number of bones
+	int count() const
+	{
+		int c = 0;
+		for ( quint64 w : bits )
+			c += qPopulationCount( w );
+		return c;
+	}
+	//! The number of bones in either set
+	int countUnion( const BoneMask & other ) const
+	{
+		int c = 0;
+		for ( int i = 0; i < bits.count(); i++ )
+			c += qPopulationCount( bits[i] | other.bits[i] );
+		return c;
+	}
+	//! Whether all bones of \a other are in the set
+	bool contains( const BoneMask & other ) const
+	{
+		for ( int i = 0; i < bits.count(); i++ ) {
+			if ( other.bits[i] & ~bits[i] )
+				return false;
+		}
+		return true;
+	}
+	//! Add the bones of \a other
+	BoneMask & operator|=( const BoneMask & other )
+	{
+		for ( int i = 0; i < bits.count(); i++ )
+			bits[i] |= other.bits[i];
+		return *this;
+	}
+	//! The bones in ascending order
+	QList<int> bones() const
+	{
+		QList<int> list;
+		for ( int i = 0; i < bits.count(); i++ ) {
+			for ( int b = 0; b < 64; b++ ) {
+				if ( bits[i] & ( quint64( 1 ) << b ) )
+					list.append( i * 64 + b );
 			}
 		}
-
-		return false;
+		return list;
 	}
 
-	typedef QPair<int, float> boneweight;
+private:
+	QVector<quint64> bits;
+};
 
-	//! Helper for sorting a boneweight list
-	struct boneweight_equivalence
-	{
-		bool operator()( const boneweight & lhs, const boneweight & rhs )
-		{
-			if ( lhs.second == 0.0 ) {
-				if ( rhs.second == 0.0 ) {
-					return rhs.first < lhs.first;
-				} else {
-					return true;
-				}
+typedef QPair<int, float> boneweight;
 
-				return false;
-			} else if ( rhs.second == lhs.second ) {
-				return lhs.first < rhs.first;
+//! Helper for sorting a boneweight list
+struct boneweight_equivalence
+{
+	bool operator()( const boneweight & lhs, const boneweight & rhs )
+	{
+		if ( lhs.second == 0.0 ) {
+			if ( rhs.second == 0.0 ) {
+				return rhs.first < lhs.first;
 			} else {
-				return rhs.second < lhs.second;
+				return true;
 			}
+
+			return false;
+		} else if ( rhs.second == lhs.second ) {
+			return lhs.first < rhs.first;
+		} else {
+			return rhs.second < lhs.second;
 		}
-	};
+	}
+};
 
-	//! A bone and Triangle set
-	typedef struct
-	{
-		QList<int> bones;
-		QVector<Triangle> triangles;
-	} Partition;
+//! A bone and Triangle set
+struct SkinPartition
+{
+	BoneMask bones;
+	QVector<Triangle> triangles;
+};
 
-	QModelIndex cast( NifModel * nif, const QModelIndex & iBlock ) override final
-	{
-		int mbpp = 0, mbpv = 0;
-		bool make_strips = false;
-		return cast( nif, iBlock, mbpp, mbpv, make_strips );
-	}
+//! A shape being partitioned by spSkinPartition
+struct SkinPartitionJob
+{
+	QPersistentModelIndex iShape;
+	QPersistentModelIndex iData;
+	QPersistentModelIndex iSkinInst;
+	QPersistentModelIndex iSkinData;
+	QPersistentModelIndex iSkinPart;
+
+	int numVerts = 0;
+	int numBones = 0;
+	//! The most bones a vertex is weighted to
+	int maxBones = 0;
+	//! The bone weights of each vertex
+	QVector<QList<boneweight>> weights;
+	QVector<Vector3> verts;
+	QVector<Triangle> triangles;
+
+	//! The partition of each (rotated) triangle in the existing BSDismemberSkinInstance partitions
+	QMap<Triangle, quint32> trimap;
+	//! The partition of the triangles not in trimap
+	quint32 defaultPart = 0;
+
+	//! The partitions made by computeSkinPartition()
+	QVector<SkinPartition> parts;
+	//! Why the shape could not be partitioned
+	QString error;
+};
 
-	//! Cast with extra parameters
-	QModelIndex cast( NifModel * nif, const QModelIndex & iBlock, int & maxBonesPerPartition, int & maxBonesPerVertex, bool make_strips, bool pad = false )
-	{
-		QPersistentModelIndex iShape = iBlock;
-		QString iShapeType = "";
+//! Triangulate the strips of a strips array
+static QVector<Triangle> triangulateStrips( const NifModel * nif, const QModelIndex & iPoints )
+{
+	QList<QVector<quint16> > strips;
 
-		if ( nif->isNiBlock( iShape, "NiTriShape" ) ) {
-			iShapeType = "NiTriShape";
-		} else if ( nif->isNiBlock( iShape, "NiTriStrips" ) ) {
-			iShapeType = "NiTriStrips";
-		}
+	for ( int s = 0; s < nif->rowCount( iPoints ); s++ )
+		strips.append( nif->getArray<quint16>( iPoints.child( s, 0 ) ) );
 
-		try
-		{
-			QPersistentModelIndex iData;
+	return triangulate( strips );
+}
 
-			if ( iShapeType == "NiTriShape" ) {
-				iData = nif->getBlock( nif->getLink( iShape, "Data" ), "NiTriShapeData" );
-			} else if ( iShapeType == "NiTriStrips" ) {
-				iData = nif->getBlock( nif->getLink( iShape, "Data" ), "NiTriStripsData" );
-			}
+//! Find the blocks of a skinned shape
+static void findSkinBlocks( const NifModel * nif, const QModelIndex & iBlock, SkinPartitionJob & job )
+{
+	job.iShape = iBlock;
 
-			QPersistentModelIndex iSkinInst = nif->getBlock( nif->getLink( iShape, "Skin Instance" ), "NiSkinInstance" );
-			QPersistentModelIndex iSkinData = nif->getBlock( nif->getLink( iSkinInst, "Data" ), "NiSkinData" );
-			QModelIndex iSkinPart = nif->getBlock( nif->getLink( iSkinInst, "Skin Partition" ), "NiSkinPartition" );
+	bool isStrips = nif->isNiBlock( iBlock, "NiTriStrips" );
+	job.iData = nif->getBlock( nif->getLink( iBlock, "Data" ), isStrips ? "NiTriStripsData" : "NiTriShapeData" );
+	job.iSkinInst = nif->getBlock( nif->getLink( iBlock, "Skin Instance" ), "NiSkinInstance" );
+	job.iSkinData = nif->getBlock( nif->getLink( job.iSkinInst, "Data" ), "NiSkinData" );
+	job.iSkinPart = nif->getBlock( nif->getLink( job.iSkinInst, "Skin Partition" ), "NiSkinPartition" );
 
-			if ( !iSkinPart.isValid() )
-				iSkinPart = nif->getBlock( nif->getLink( iSkinData, "Skin Partition" ), "NiSkinPartition" );
+	if ( !job.iSkinPart.isValid() )
+		job.iSkinPart = nif->getBlock( nif->getLink( job.iSkinData, "Skin Partition" ), "NiSkinPartition" );
+}
 
-			// read in the weights from NiSkinData
+//! Read the geometry and weights of a skinned shape, throwing a QString if they are unusable
+static void readSkinPartition( const NifModel * nif, const QModelIndex & iBlock, SkinPartitionJob & job )
+{
+	findSkinBlocks( nif, iBlock, job );
 
-			int numVerts = nif->get<int>( iData, "Num Vertices" );
-			QVector<QList<boneweight> > weights( numVerts );
+	bool isStrips = nif->isNiBlock( iBlock, "NiTriStrips" );
 
-			QModelIndex iBoneList = nif->getIndex( iSkinData, "Bone List" );
-			int numBones = nif->rowCount( iBoneList );
+	// read in the weights from NiSkinData
 
-			for ( int bone = 0; bone < numBones; bone++ ) {
-				QModelIndex iVertexWeights = nif->getIndex( iBoneList.child( bone, 0 ), "Vertex Weights" );
+	job.numVerts = nif->get<int>( job.iData, "Num Vertices" );
+	job.weights.resize( job.numVerts );
 
-				for ( int r = 0; r < nif->rowCount( iVertexWeights ); r++ ) {
-					int vertex = nif->get<int>( iVertexWeights.child( r, 0 ), "Index" );
-					float weight = nif->get<float>( iVertexWeights.child( r, 0 ), "Weight" );
+	QModelIndex iBoneList = nif->getIndex( job.iSkinData, "Bone List" );
+	job.numBones = nif->rowCount( iBoneList );
 
-					if ( vertex >= weights.count() )
-						throw QString( Spell::tr( "bad NiSkinData - vertex count does not match" ) );
+	// Every weight has the same fields, find their rows once
+	static const NifFieldId fIndex( "Index" );
+	static const NifFieldId fWeight( "Weight" );
 
-					weights[vertex].append( boneweight( bone, weight ) );
-				}
-			}
+	for ( int bone = 0; bone < job.numBones; bone++ ) {
+		QModelIndex iVertexWeights = nif->getIndex( iBoneList.child( bone, 0 ), "Vertex Weights" );
+		int count = nif->rowCount( iVertexWeights );
 
-			// count min and max bones per vertex
+		if ( count <= 0 )
+			continue;
 
-			int minBones, maxBones;
-			minBones = maxBones = weights.value( 0 ).count();
-			for ( const QList<boneweight> list : weights ) {
-				if ( list.count() < minBones )
-					minBones = list.count();
+		auto first = nif->index( 0, 0, iVertexWeights );
+		int rIndex = nif->getIndex( first, fIndex ).row();
+		int rWeight = nif->getIndex( first, fWeight ).row();
 
-				if ( list.count() > maxBones )
-					maxBones = list.count();
-			}
+		for ( int r = 0; r < count; r++ ) {
+			auto idx = nif->index( r, 0, iVertexWeights );
+			int vertex = nif->get<int>( nif->index( rIndex, 0, idx ) );
+			float weight = nif->get<float>( nif->index( rWeight, 0, idx ) );
 
-			if ( minBones <= 0 )
-				throw QString( Spell::tr( "bad NiSkinData - some vertices have no weights at all" ) );
+			if ( vertex < 0 || vertex >= job.weights.count() )
+				throw QString( Spell::tr( "bad NiSkinData - vertex count does not match" ) );
 
-			// query max bones per vertex/partition
+			job.weights[vertex].append( boneweight( bone, weight ) );
+		}
+	}
 
-			if ( maxBonesPerPartition <= 0 || maxBonesPerVertex <= 0 ) {
-				SkinPartitionDialog dlg( maxBones );
+	// count min and max bones per vertex
 
-				if ( dlg.exec() != QDialog::Accepted )
-					return iBlock;
+	int minBones;
+	minBones = job.maxBones = job.weights.value( 0 ).count();
+	for ( const QList<boneweight> & list : job.weights ) {
+		if ( list.count() < minBones )
+			minBones = list.count();
 
-				maxBonesPerPartition = dlg.maxBonesPerPartition();
-				maxBonesPerVertex = dlg.maxBonesPerVertex();
-				make_strips = dlg.makeStrips();
-				pad = dlg.padPartitions();
-			}
+		if ( list.count() > job.maxBones )
+			job.maxBones = list.count();
+	}
 
-			// reduce vertex influences if necessary
+	if ( minBones <= 0 )
+		throw QString( Spell::tr( "bad NiSkinData - some vertices have no weights at all" ) );
 
-			if ( maxBones > maxBonesPerVertex ) {
-				QMutableVectorIterator<QList<boneweight> > it( weights );
-				int c = 0;
+	job.verts = nif->getArray<Vector3>( job.iData, "Vertices" );
 
-				while ( it.hasNext() ) {
-					QList<boneweight> & lst = it.next();
-					std::sort( lst.begin(), lst.end(), boneweight_equivalence() );
+	if ( isStrips )
+		job.triangles = triangulateStrips( nif, nif->getIndex( job.iData, "Points" ) );
+	else
+		job.triangles = nif->getArray<Triangle>( job.iData, "Triangles" );
 
-					if ( lst.count() > maxBonesPerVertex )
-						c++;
+	for ( const Triangle & tri : job.triangles ) {
+		if ( tri[0] >= job.numVerts || tri[1] >= job.numVerts || tri[2] >= job.numVerts )
+			throw QString( Spell::tr( "bad triangle - vertex index out of range" ) );
+	}
 
-					while ( lst.count() > maxBonesPerVertex ) {
-						lst.removeLast();
-					}
+	if ( nif->inherits( job.iSkinInst, "BSDismemberSkinInstance" ) ) {
+		// First find a partition to dump dangling faces.  Torso is prefered if available.
+		quint32 nparts = nif->get<uint>( job.iSkinInst, "Num Partitions" );
+		QModelIndex iPartData = nif->getIndex( job.iSkinInst, "Partitions" );
 
-					float totalWeight = 0;
-					for ( const auto bw : lst ) {
-						totalWeight += bw.second;
-					}
+		for ( quint32 i = 0; i < nparts; ++i ) {
+			QModelIndex iPart = iPartData.child( i, 0 );
 
-					for ( int b = 0; b < lst.count(); b++ ) {
-						// normalize
-						lst[b].second /= totalWeight;
-					}
-				}
+			if ( !iPart.isValid() )
+				continue;
 
-				qCWarning( nsSpell ) << Spell::tr( "Reduced %1 vertices to %2 bone influences (maximum number of bones per vertex was %3)" )
-					.arg( c )
-					.arg( maxBonesPerVertex )
-					.arg( maxBones );
+			if ( nif->get<uint>( iPart, "Body Part" ) == 0 /* Torso */ ) {
+				job.defaultPart = i;
+				break;
 			}
+		}
 
-			maxBones = maxBonesPerVertex;
+		job.defaultPart = qMin( nparts - 1, job.defaultPart );
 
-			// reduces bone weights so that the triangles fit into the partitions
+		// enumerate existing partitions and select faces into same partition
+		quint32 nskinparts = nif->get<int>( job.iSkinPart, "Num Skin Partition Blocks" );
+		iPartData = nif->getIndex( job.iSkinPart, "Skin Partition Blocks" );
 
-			QList<Triangle> triangles;
+		for ( quint32 i = 0; i < nskinparts; ++i ) {
+			QModelIndex iPart = iPartData.child( i, 0 );
 
-			if ( iShapeType == "NiTriShape" ) {
-				triangles = nif->getArray<Triangle>( iData, "Triangles" ).toList();
-			} else if ( iShapeType == "NiTriStrips" ) {
-				// triangulate first (code copied from strippify.cpp)
-				QList<QVector<quint16> > strips;
-				QModelIndex iPoints = nif->getIndex( iData, "Points" );
+			if ( !iPart.isValid() )
+				continue;
 
-				for ( int s = 0; s < nif->rowCount( iPoints ); s++ ) {
-					QVector<quint16> strip;
-					QModelIndex iStrip = iPoints.child( s, 0 );
+			quint32 finalPart = qMin( nparts - 1, i );
 
-					for ( int p = 0; p < nif->rowCount( iStrip ); p++ ) {
-						strip.append( nif->get<int>( iStrip.child( p, 0 ) ) );
-					}
+			QVector<int> vertmap = nif->getArray<int>( iPart, "Vertex Map" );
 
-					strips.append( strip );
-				}
+			quint8 hasFaces  = nif->get<quint8>( iPart, "Has Faces" );
+			quint8 numStrips = nif->get<quint8>( iPart, "Num Strips" );
+			QVector<Triangle> partTriangles;
 
-				triangles = triangulate( strips ).toList();
+			if ( hasFaces && numStrips == 0 ) {
+				partTriangles = nif->getArray<Triangle>( iPart, "Triangles" );
+			} else if ( numStrips != 0 ) {
+				partTriangles = triangulateStrips( nif, nif->getIndex( iPart, "Strips" ) );
 			}
 
-			QMap<Triangle, quint32> trimap;
-			quint32 defaultPart = 0;
+			for ( Triangle tri : partTriangles ) {
+				if ( !vertmap.isEmpty() ) {
+					tri[0] = vertmap.value( tri[0] );
+					tri[1] = vertmap.value( tri[1] );
+					tri[2] = vertmap.value( tri[2] );
+				}
 
-			if ( nif->inherits( iSkinInst, "BSDismemberSkinInstance" ) ) {
-				// First find a partition to dump dangling faces.  Torso is prefered if available.
-				quint32 nparts = nif->get<uint>( iSkinInst, "Num Partitions" );
-				QModelIndex iPartData = nif->getIndex( iSkinInst, "Partitions" );
+				qRotate( tri );
+				job.trimap.insert( tri, finalPart );
+			}
+		}
+	}
+}
 
-				for ( quint32 i = 0; i < nparts; ++i ) {
-					QModelIndex iPart = iPartData.child( i, 0 );
+//! Group the vertices which have the same position and weights, for removing bones from all of them together
+static QVector<QVector<int>> matchSkinVertices( const SkinPartitionJob & job )
+{
+	QVector<QVector<int>> match( job.numVerts );
 
-					if ( !iPart.isValid() )
-						continue;
+	if ( job.verts.count() < job.numVerts ) {
+		for ( int v = 0; v < job.numVerts; v++ )
+			match[v].append( v );
 
-					if ( nif->get<uint>( iPart, "Body Part" ) == 0 /* Torso */ ) {
-						defaultPart = i;
-						break;
-					}
-				}
+		return match;
+	}
 
-				defaultPart = qMin( nparts - 1, defaultPart );
+	// Sort by position so that vertices with the same position are adjacent
+	QVector<int> order( job.numVerts );
 
-				// enumerate existing partitions and select faces into same partition
-				quint32 nskinparts = nif->get<int>( iSkinPart, "Num Skin Partition Blocks" );
-				iPartData = nif->getIndex( iSkinPart, "Skin Partition Blocks" );
+	for ( int v = 0; v < job.numVerts; v++ )
+		order[v] = v;
 
-				for ( quint32 i = 0; i < nskinparts; ++i ) {
-					QModelIndex iPart = iPartData.child( i, 0 );
+	const QVector<Vector3> & verts = job.verts;
+	std::sort( order.begin(), order.end(), [&verts]( int a, int b ) {
+		for ( int i = 0; i < 3; i++ ) {
+			if ( verts[a][i] != verts[b][i] )
+				return verts[a][i] < verts[b][i];
+		}
+		return a < b;
+	} );
 
-					if ( !iPart.isValid() )
-						continue;
+	for ( int i = 0; i < order.count(); ) {
+		int end = i + 1;
 
-					quint32 finalPart = qMin( nparts - 1, i );
+		while ( end < order.count() && verts[order[end]] == verts[order[i]] )
+			end++;
 
-					QVector<int> vertmap = nif->getArray<int>( iPart, "Vertex Map" );
+		for ( int a = i; a < end; a++ ) {
+			for ( int b = i; b < end; b++ ) {
+				if ( a == b || job.weights[order[a]] == job.weights[order[b]] )
+					match[order[a]].append( order[b] );
+			}
+		}
 
-					quint8 hasFaces  = nif->get<quint8>( iPart, "Has Faces" );
-					quint8 numStrips = nif->get<quint8>( iPart, "Num Strips" );
-					QVector<Triangle> partTriangles;
+		i = end;
+	}
 
-					if ( hasFaces && numStrips == 0 ) {
-						partTriangles = nif->getArray<Triangle>( iPart, "Triangles" );
-					} else if ( numStrips != 0 ) {
-						// triangulate first (code copied from strippify.cpp)
-						QList<QVector<quint16> > strips;
-						QModelIndex iPoints = nif->getIndex( iPart, "Strips" );
+	return match;
+}
 
-						for ( int s = 0; s < nif->rowCount( iPoints ); s++ ) {
-							QVector<quint16> strip;
-							QModelIndex iStrip = iPoints.child( s, 0 );
+//! Split a shape into partitions of at most \a maxBonesPerPartition bones; only touches the job, so it may run on any thread
+static void computeSkinPartition( SkinPartitionJob & job, int maxBonesPerPartition, int maxBonesPerVertex )
+{
+	try
+	{
+		QVector<QList<boneweight>> & weights = job.weights;
+		const QVector<Triangle> & triangles = job.triangles;
 
-							for ( int p = 0; p < nif->rowCount( iStrip ); p++ ) {
-								strip.append( nif->get<int>( iStrip.child( p, 0 ) ) );
-							}
+		// reduce vertex influences if necessary
 
-							strips.append( strip );
-						}
+		if ( job.maxBones > maxBonesPerVertex ) {
+			int c = 0;
 
-						partTriangles = triangulate( strips );
-					}
+			for ( QList<boneweight> & lst : weights ) {
+				std::sort( lst.begin(), lst.end(), boneweight_equivalence() );
 
-					for ( int j = 0; j < partTriangles.count(); ++j ) {
-						Triangle t = partTriangles[j];
-						Triangle tri = t;
+				if ( lst.count() > maxBonesPerVertex )
+					c++;
 
-						if ( !vertmap.isEmpty() ) {
-							tri[0] = vertmap[tri[0]];
-							tri[1] = vertmap[tri[1]];
-							tri[2] = vertmap[tri[2]];
-						}
+				while ( lst.count() > maxBonesPerVertex ) {
+					lst.removeLast();
+				}
 
-						qRotate( tri );
-						trimap.insert( tri, finalPart );
-					}
+				float totalWeight = 0;
+				for ( const auto bw : lst ) {
+					totalWeight += bw.second;
+				}
+
+				for ( int b = 0; b < lst.count(); b++ ) {
+					// normalize
+					lst[b].second /= totalWeight;
 				}
 			}
 
-			QMap<int, int> match;
-			bool doMatch = true;
+			qCWarning( nsSpell ) << Spell::tr( "Reduced %1 vertices to %2 bone influences (maximum number of bones per vertex was %3)" )
+				.arg( c )
+				.arg( maxBonesPerVertex )
+				.arg( job.maxBones );
+		}
 
-			QList<int> tribones;
+		// the bones of each vertex and triangle
 
-			int cnt = 0;
+		auto vertexBones = [&job, &weights]( int v ) {
+			BoneMask mask( job.numBones );
+			for ( const auto bw : weights[v] )
+				mask.set( bw.first );
+			return mask;
+		};
 
-			for ( const Triangle& tri : triangles )
-			{
-				do {
-					tribones.clear();
+		QVector<BoneMask> vertBones( job.numVerts );
 
-					for ( int c = 0; c < 3; c++ ) {
-						for ( const auto bw : weights[tri[c]] ) {
-							if ( !tribones.contains( bw.first ) )
-								tribones.append( bw.first );
-						}
-					}
+		for ( int v = 0; v < job.numVerts; v++ )
+			vertBones[v] = vertexBones( v );
 
-					if ( tribones.count() > maxBonesPerPartition ) {
-						// sum up the weights for each bone
-						// bones with weight == 1 can't be removed
+		auto triangleBones = [&vertBones]( const Triangle & tri ) {
+			BoneMask mask = vertBones[tri[0]];
+			mask |= vertBones[tri[1]];
+			mask |= vertBones[tri[2]];
+			return mask;
+		};
 
-						QMap<int, float> sum;
-						QList<int> nono;
+		// reduces bone weights so that the triangles fit into the partitions
 
-						for ( int t = 0; t < 3; t++ ) {
-							if ( weights[tri[t]].count() == 1 )
-								nono.append( weights[tri[t]].first().first );
+		QVector<QVector<int>> match;
+		int cnt = 0;
 
-							for ( const auto bw : weights[tri[t]] ) {
-								sum[ bw.first ] += bw.second;
-							}
-						}
+		for ( const Triangle & tri : triangles ) {
+			while ( triangleBones( tri ).count() > maxBonesPerPartition ) {
+				// sum up the weights for each bone
+				// bones with weight == 1 can't be removed
 
-						// select the bone to remove
+				QMap<int, float> sum;
+				QList<int> nono;
 
-						float minWeight = 5.0;
-						int minBone = -1;
+				for ( int t = 0; t < 3; t++ ) {
+					if ( weights[tri[t]].count() == 1 )
+						nono.append( weights[tri[t]].first().first );
 
-						for ( const auto b : sum.keys() ) {
-							if ( !nono.contains( b ) && sum[b] < minWeight ) {
-								minWeight = sum[b];
-								minBone = b;
-							}
-						}
+					for ( const auto bw : weights[tri[t]] ) {
+						sum[ bw.first ] += bw.second;
+					}
+				}
 
-						if ( minBone < 0 )  // this shouldn't never happen
-							throw QString( "internal error 0x01" );
+				// select the bone to remove
 
-						// do a vertex match detect
+				float minWeight = 5.0;
+				int minBone = -1;
 
-						if ( doMatch ) {
-							QVector<Vector3> verts = nif->getArray<Vector3>( iData, "Vertices" );
+				for ( auto it = sum.constBegin(); it != sum.constEnd(); ++it ) {
+					if ( !nono.contains( it.key() ) && it.value() < minWeight ) {
+						minWeight = it.value();
+						minBone = it.key();
+					}
+				}
 
-							for ( int a = 0; a < verts.count(); a++ ) {
-								match.insertMulti( a, a );
+				if ( minBone < 0 )  // this shouldn't never happen
+					throw QString( "internal error 0x01" );
 
-								for ( int b = a + 1; b < verts.count(); b++ ) {
-									if ( verts[a] == verts[b] && weights[a] == weights[b] ) {
-										match.insertMulti( a, b );
-										match.insertMulti( b, a );
-									}
-								}
-							}
-						}
+				// do a vertex match detect
 
-						// now remove that bone from all vertices of this triangle and from all matching vertices too
+				if ( match.isEmpty() )
+					match = matchSkinVertices( job );
 
-						for ( int t = 0; t < 3; t++ ) {
-							bool rem = false;
-							for ( const auto v : match.values( tri[t] ) )
-							{
-								QList<boneweight> & bws = weights[ v ];
-								QMutableListIterator<boneweight> it( bws );
+				// now remove that bone from all vertices of this triangle and from all matching vertices too
 
-								while ( it.hasNext() ) {
-									boneweight & bw = it.next();
+				for ( int t = 0; t < 3; t++ ) {
+					bool rem = false;
+					for ( const auto v : match[tri[t]] )
+					{
+						QList<boneweight> & bws = weights[ v ];
+						QMutableListIterator<boneweight> it( bws );
 
-									if ( bw.first == minBone ) {
-										it.remove();
-										rem = true;
-									}
-								}
+						while ( it.hasNext() ) {
+							boneweight & bw = it.next();
 
-								float totalWeight = 0;
-								for ( const auto bw : bws ) {
-									totalWeight += bw.second;
-								}
+							if ( bw.first == minBone ) {
+								it.remove();
+								rem = true;
+							}
+						}
 
-								if ( totalWeight == 0 )
-									throw QString( "internal error 0x02" );
+						float totalWeight = 0;
+						for ( const auto bw : bws ) {
+							totalWeight += bw.second;
+						}
 
-								for ( int b = 0; b < bws.count(); b++ ) {
-									// normalize
-									bws[b].second /= totalWeight;
-								}
-							}
+						if ( totalWeight == 0 )
+							throw QString( "internal error 0x02" );
 
-							if ( rem )
-								cnt++;
+						for ( int b = 0; b < bws.count(); b++ ) {
+							// normalize
+							bws[b].second /= totalWeight;
 						}
+
+						vertBones[v] = vertexBones( v );
 					}
-				} while ( tribones.count() > maxBonesPerPartition );
-			}
 
-			if ( cnt > 0 )
-				qCWarning( nsSpell ) << Spell::tr( "Removed %1 bone influences" ).arg( cnt );
+					if ( rem )
+						cnt++;
+				}
+			}
+		}
 
-			// split the triangles into partitions
+		if ( cnt > 0 )
+			qCWarning( nsSpell ) << Spell::tr( "Removed %1 bone influences" ).arg( cnt );
 
-			bool merged = true;
+		QVector<BoneMask> triBones( triangles.count() );
 
-			QList<Partition> parts;
+		for ( int i = 0; i < triangles.count(); i++ )
+			triBones[i] = triangleBones( triangles[i] );
 
-			if ( !trimap.isEmpty() ) {
-				QMutableListIterator<Triangle> it( triangles );
+		// split the triangles into partitions
 
-				while ( it.hasNext() ) {
-					Triangle tri = it.next();
-					qRotate( tri );
-					QMap<Triangle, quint32>::iterator partItr = trimap.find( tri );
-					int partIdx = ( partItr != trimap.end() ) ? partItr.value() : defaultPart;
+		QVector<SkinPartition> & parts = job.parts;
 
-					if ( partIdx >= 0 ) {
-						//Triangle & tri = *it;
+		if ( !job.trimap.isEmpty() ) {
+			for ( int i = 0; i < triangles.count(); i++ ) {
+				Triangle tri = triangles[i];
+				qRotate( tri );
+				auto partItr = job.trimap.constFind( tri );
+				int partIdx = ( partItr != job.trimap.constEnd() ) ? partItr.value() : job.defaultPart;
 
-						// Ensure enough partitions
-						while ( partIdx >= int( parts.size() ) )
-							parts.push_back( Partition() );
+				// Ensure enough partitions
+				while ( partIdx >= parts.count() )
+					parts.append( SkinPartition{ BoneMask( job.numBones ), QVector<Triangle>() } );
 
-						Partition & part = parts[partIdx];
+				parts[partIdx].bones |= triBones[i];
+				parts[partIdx].triangles.append( tri );
+			}
+		} else {
+			// the triangles around each vertex
+			QVector<int> offsets( job.numVerts + 1, 0 );
 
-						QList<int> tribones;
+			for ( const Triangle & tri : triangles ) {
+				for ( int c = 0; c < 3; c++ )
+					offsets[tri[c] + 1]++;
+			}
 
-						for ( int c = 0; c < 3; c++ ) {
-							for ( const auto bw : weights[tri[c]] ) {
-								if ( !tribones.contains( bw.first ) )
-									tribones.append( bw.first );
-							}
-						}
+			for ( int v = 0; v < job.numVerts; v++ )
+				offsets[v + 1] += offsets[v];
 
-						part.bones = mergeBones( part.bones, tribones );
-						part.triangles.append( tri );
-						it.remove();
-					}
-				}
+			QVector<int> adjacency( offsets[job.numVerts] );
+			QVector<int> fill = offsets;
 
-				merged = false; // when explicit mapping enabled, no merging is allowed
+			for ( int i = 0; i < triangles.count(); i++ ) {
+				for ( int c = 0; c < 3; c++ )
+					adjacency[fill[triangles[i][c]]++] = i;
 			}
 
-			while ( !triangles.isEmpty() ) {
-				Partition part;
+			QVector<bool> assigned( triangles.count(), false );
+			QVector<int> usedBy( job.numVerts, -1 );
+			int cursor = 0;
 
-				QHash<int, bool> usedVerts;
+			while ( true ) {
+				while ( cursor < triangles.count() && assigned[cursor] )
+					cursor++;
 
-				bool addtriangles;
+				if ( cursor >= triangles.count() )
+					break;
 
-				do {
-					QMutableListIterator<Triangle> it( triangles );
+				int p = parts.count();
+				parts.append( SkinPartition{ BoneMask( job.numBones ), QVector<Triangle>() } );
+				SkinPartition & part = parts.last();
 
-					while ( it.hasNext() ) {
-						Triangle & tri = it.next();
+				// Triangles next to the partition, by the number of bones they would add
+				typedef std::pair<int, int> Candidate;
+				std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> frontier;
 
-						QList<int> tribones;
+				auto add = [&]( int i ) {
+					assigned[i] = true;
+					part.bones |= triBones[i];
+					part.triangles.append( triangles[i] );
 
-						for ( int c = 0; c < 3; c++ ) {
-							for ( const auto bw : weights[tri[c]] ) {
-								if ( !tribones.contains( bw.first ) )
-									tribones.append( bw.first );
-							}
-						}
+					int numBones = part.bones.count();
+
+					for ( int c = 0; c < 3; c++ ) {
+						int v = triangles[i][c];
 
-						if ( part.bones.isEmpty() || containsBones( part.bones, tribones ) ) {
-							part.bones = mergeBones( part.bones, tribones );
-							part.triangles.append( tri );
-							usedVerts[ tri[0] ] = true;
-							usedVerts[ tri[1] ] = true;
-							usedVerts[ tri[2] ] = true;
-							it.remove();
+						if ( usedBy[v] == p )
+							continue;
+
+						usedBy[v] = p;
+
+						for ( int k = offsets[v]; k < offsets[v + 1]; k++ ) {
+							int j = adjacency[k];
+
+							if ( !assigned[j] )
+								frontier.push( Candidate( part.bones.countUnion( triBones[j] ) - numBones, j ) );
 						}
 					}
+				};
 
-					addtriangles = false;
+				add( cursor );
 
-					if ( part.bones.count() < maxBonesPerPartition ) {
-						// if we have room left in the partition then add an adjacent triangle
-						it.toFront();
+				bool grown;
 
-						while ( it.hasNext() ) {
-							Triangle & tri = it.next();
-
-							if ( usedVerts.contains( tri[0] ) || usedVerts.contains( tri[1] ) || usedVerts.contains( tri[2] ) ) {
-								QList<int> tribones;
-
-								for ( int c = 0; c < 3; c++ ) {
-									for ( const auto bw : weights[tri[c]] ) {
-										if ( !tribones.contains( bw.first ) )
-											tribones.append( bw.first );
-									}
-								}
-
-								tribones = mergeBones( part.bones, tribones );
-
-								if ( tribones.count() <= maxBonesPerPartition ) {
-									part.bones = tribones;
-									part.triangles.append( tri );
-									usedVerts[ tri[0] ] = true;
-									usedVerts[ tri[1] ] = true;
-									usedVerts[ tri[2] ] = true;
-									it.remove();
-									addtriangles = true;
-									//break;
-								}
-							}
-						}
+				do {
+					grown = false;
+
+					// any triangle which adds no bones
+					for ( int i = cursor; i < triangles.count(); i++ ) {
+						if ( !assigned[i] && part.bones.contains( triBones[i] ) )
+							add( i );
 					}
-				} while ( addtriangles );
 
-				parts.append( part );
-			}
+					// then the adjacent triangles which add the fewest bones
+					while ( !frontier.empty() ) {
+						Candidate c = frontier.top();
+						frontier.pop();
 
-			//qDebug() << parts.count() << "small partitions";
+						if ( assigned[c.second] )
+							continue;
 
-			// merge partitions
+						int bones = part.bones.countUnion( triBones[c.second] );
 
-			while ( merged ) {
-				merged = false;
+						// The partition only gains bones, so this triangle will never fit
+						if ( bones > maxBonesPerPartition )
+							continue;
 
-				for ( int p1 = 0; p1 < parts.count() && !merged; p1++ ) {
-					if ( parts[p1].bones.count() < maxBonesPerPartition ) {
-						for ( int p2 = p1 + 1; p2 < parts.count() && !merged; p2++ ) {
-							QList<int> mergedBones = mergeBones( parts[p1].bones, parts[p2].bones );
+						int added = bones - part.bones.count();
 
-							if ( mergedBones.count() <= maxBonesPerPartition ) {
-								parts[p1].bones = mergedBones;
-								parts[p1].triangles << parts[p2].triangles;
-								parts.removeAt( p2 );
-								merged = true;
-							}
+						if ( added < c.first ) {
+							frontier.push( Candidate( added, c.second ) );
+							continue;
 						}
+
+						add( c.second );
+						grown = true;
 					}
-				}
+				} while ( grown );
 			}
 
-			//qDebug() << parts.count() << "partitions";
+			// merge partitions, the pairs with the fewest bones first
+
+			typedef std::tuple<int, int, int> Merge;
+			std::priority_queue<Merge, std::vector<Merge>, std::greater<Merge>> merges;
+			QVector<bool> alive( parts.count(), true );
 
-			// create the NiSkinPartition if it doesn't exist yet
+			auto pushMerge = [&]( int a, int b ) {
+				if ( a > b )
+					std::swap( a, b );
 
-			if ( !iSkinPart.isValid() ) {
-				iSkinPart = nif->insertNiBlock( "NiSkinPartition", nif->getBlockNumber( iSkinData ) + 1 );
-				nif->setLink( iSkinInst, "Skin Partition", nif->getBlockNumber( iSkinPart ) );
-				nif->setLink( iSkinData, "Skin Partition", nif->getBlockNumber( iSkinPart ) );
+				if ( parts[a].bones.count() >= maxBonesPerPartition )
+					return;
+
+				int bones = parts[a].bones.countUnion( parts[b].bones );
+
+				if ( bones <= maxBonesPerPartition )
+					merges.push( Merge( bones, a, b ) );
+			};
+
+			for ( int a = 0; a < parts.count(); a++ ) {
+				for ( int b = a + 1; b < parts.count(); b++ )
+					pushMerge( a, b );
 			}
 
-			// start writing NiSkinPartition
+			while ( !merges.empty() ) {
+				Merge m = merges.top();
+				merges.pop();
+
+				int a = std::get<1>( m ), b = std::get<2>( m );
 
-			nif->set<int>( iSkinPart, "Num Skin Partition Blocks", parts.count() );
-			nif->updateArray( iSkinPart, "Skin Partition Blocks" );
+				if ( !alive[a] || !alive[b] )
+					continue;
 
-			QModelIndex iBSSkinInstPartData;
+				// Either partition may have grown by a merge since
+				if ( parts[a].bones.countUnion( parts[b].bones ) != std::get<0>( m ) ) {
+					pushMerge( a, b );
+					continue;
+				}
 
-			if ( nif->inherits( iSkinInst, "BSDismemberSkinInstance" ) ) {
-				quint32 nparts = nif->get<uint>( iSkinInst, "Num Partitions" );
-				iBSSkinInstPartData = nif->getIndex( iSkinInst, "Partitions" );
+				parts[a].bones |= parts[b].bones;
+				parts[a].triangles << parts[b].triangles;
+				parts[b].triangles.clear();
+				alive[b] = false;
 
-				// why is QList.count() signed? cast to squash warning
-				if ( nparts != (quint32)parts.count() ) {
-					qCWarning( nsSpell ) << "BSDismemberSkinInstance partition count does not match Skin Partition count.  Adjusting to fit.";
-					nif->set<uint>( iSkinInst, "Num Partitions", parts.count() );
-					nif->updateArray( iSkinInst, "Partitions" );
+				for ( int c = 0; c < parts.count(); c++ ) {
+					if ( c != a && alive[c] )
+						pushMerge( a, c );
 				}
 			}
 
-			QList<int> prevPartBones;
+			QVector<SkinPartition> merged;
 
 			for ( int p = 0; p < parts.count(); p++ ) {
-				QModelIndex iPart = nif->getIndex( iSkinPart, "Skin Partition Blocks" ).child( p, 0 );
+				if ( alive[p] )
+					merged.append( parts[p] );
+			}
 
-				QList<int> bones = parts[p].bones;
-				std::sort( bones.begin(), bones.end() /*, std::less<int>()*/ );
+			parts = merged;
+		}
 
-				// set partition flags for bs skin instance if present
-				if ( iBSSkinInstPartData.isValid() ) {
-					if ( bones != prevPartBones ) {
-						prevPartBones = bones;
-						nif->set<uint>( iBSSkinInstPartData.child( p, 0 ), "Part Flag", 257 );
-					}
-				}
+		// resort the bone weights in bone order
+		for ( QList<boneweight> & bw : weights )
+			std::sort( bw.begin(), bw.end(), boneweight_equivalence() );
+	}
+	catch ( QString err )
+	{
+		job.error = err;
+		job.parts.clear();
+	}
+}
 
-				QVector<Triangle> triangles = parts[p].triangles;
+//! Write the partitions of a shape into its NiSkinPartition
+static void writeSkinPartition( NifModel * nif, SkinPartitionJob & job, int maxBonesPerPartition, int maxBones, bool make_strips, bool pad )
+{
+	const QVector<SkinPartition> & parts = job.parts;
 
-				// Create the vertex map
+	// create the NiSkinPartition if it doesn't exist yet
 
-				int idx = 0;
-				QVector<int> vidx( numVerts, -1 );
-				for ( const Triangle& tri : triangles ) {
-					for ( int t = 0; t < 3; t++ ) {
-						int v = tri[t];
+	if ( !job.iSkinPart.isValid() ) {
+		job.iSkinPart = nif->insertNiBlock( "NiSkinPartition", nif->getBlockNumber( job.iSkinData ) + 1 );
+		nif->setLink( job.iSkinInst, "Skin Partition", nif->getBlockNumber( job.iSkinPart ) );
+		nif->setLink( job.iSkinData, "Skin Partition", nif->getBlockNumber( job.iSkinPart ) );
+	}
 
-						if ( vidx[v] < 0 )
-							vidx[v] = idx++;
-					}
-				}
-				QVector<int> vertices( idx, -1 );
+	const QPersistentModelIndex & iSkinPart = job.iSkinPart;
 
-				for ( int i = 0; i < numVerts; ++i ) {
-					int v = vidx[i];
+	// start writing NiSkinPartition
 
-					if ( v >= 0 ) {
-						vertices[v] = i;
-					}
-				}
+	nif->set<int>( iSkinPart, "Num Skin Partition Blocks", parts.count() );
+	nif->updateArray( iSkinPart, "Skin Partition Blocks" );
 
-				// map the vertices
+	QModelIndex iBSSkinInstPartData;
 
-				for ( int tri = 0; tri < triangles.count(); tri++ ) {
-					for ( int t = 0; t < 3; t++ ) {
-						triangles[tri][t] = vertices.indexOf( triangles[tri][t] );
-					}
-				}
+	if ( nif->inherits( job.iSkinInst, "BSDismemberSkinInstance" ) ) {
+		quint32 nparts = nif->get<uint>( job.iSkinInst, "Num Partitions" );
+		iBSSkinInstPartData = nif->getIndex( job.iSkinInst, "Partitions" );
 
-				// stripify the triangles
-				QList<QVector<quint16> > strips;
-				int numTriangles = 0;
+		// why is QList.count() signed? cast to squash warning
+		if ( nparts != (quint32)parts.count() ) {
+			qCWarning( nsSpell ) << "BSDismemberSkinInstance partition count does not match Skin Partition count.  Adjusting to fit.";
+			nif->set<uint>( job.iSkinInst, "Num Partitions", parts.count() );
+			nif->updateArray( job.iSkinInst, "Partitions" );
+		}
+	}
 
-				if ( make_strips == true ) {
-					strips = stripify( triangles );
+	QList<int> prevPartBones;
+	QVector<int> vidx( job.numVerts, -1 );
+	QVector<int> boneSlot( job.numBones, 0 );
 
-					for ( const QVector<quint16>& strip : strips ) {
-						numTriangles += strip.count() - 2;
-					}
-				} else {
-					numTriangles = triangles.count();
-				}
+	for ( int p = 0; p < parts.count(); p++ ) {
+		QModelIndex iPart = nif->getIndex( iSkinPart, "Skin Partition Blocks" ).child( p, 0 );
 
-				// fill in counts
-				if ( pad ) {
-					while ( bones.size() < maxBonesPerPartition ) {
-						bones.append( 0 );
-					}
-				}
+		QList<int> bones = parts[p].bones.bones();
 
-				// resort the bone weights in bone order
-				QMutableVectorIterator<QList<boneweight> > it( weights );
+		// set partition flags for bs skin instance if present
+		if ( iBSSkinInstPartData.isValid() ) {
+			if ( bones != prevPartBones ) {
+				prevPartBones = bones;
+				nif->set<uint>( iBSSkinInstPartData.child( p, 0 ), "Part Flag", 257 );
+			}
+		}
 
-				while ( it.hasNext() ) {
-					QList<boneweight> & bw = it.next();
-					std::sort( bw.begin(), bw.end(), boneweight_equivalence() );
-				}
+		// Create the vertex map and map the triangles onto it
 
-				nif->set<int>( iPart, "Num Vertices", vertices.count() );
-				nif->set<int>( iPart, "Num Triangles", numTriangles );
-				nif->set<int>( iPart, "Num Bones", bones.count() );
-				nif->set<int>( iPart, "Num Strips", strips.count() );
-				nif->set<int>( iPart, "Num Weights Per Vertex", maxBones );
+		QVector<Triangle> triangles = parts[p].triangles;
+		QVector<int> vertices;
+		vidx.fill( -1 );
 
-				// fill in bone map
+		for ( Triangle & tri : triangles ) {
+			for ( int t = 0; t < 3; t++ ) {
+				int v = tri[t];
 
-				QModelIndex iBoneMap = nif->getIndex( iPart, "Bones" );
-				nif->updateArray( iBoneMap );
-				nif->setArray<int>( iBoneMap, bones.toVector() );
+				if ( vidx[v] < 0 ) {
+					vidx[v] = vertices.count();
+					vertices.append( v );
+				}
 
-				// fill in vertex map
+				tri[t] = vidx[v];
+			}
+		}
 
-				nif->set<int>( iPart, "Has Vertex Map", 1 );
-				QModelIndex iVertexMap = nif->getIndex( iPart, "Vertex Map" );
-				nif->updateArray( iVertexMap );
-				nif->setArray<int>( iVertexMap, vertices );
+		// stripify the triangles
+		QList<QVector<quint16> > strips;
+		int numTriangles = 0;
 
-				// fill in vertex weights
+		if ( make_strips == true ) {
+			strips = stripify( triangles );
 
-				nif->set<int>( iPart, "Has Vertex Weights", 1 );
-				QModelIndex iVWeights = nif->getIndex( iPart, "Vertex Weights" );
-				nif->updateArray( iVWeights );
+			for ( const QVector<quint16>& strip : strips ) {
+				numTriangles += strip.count() - 2;
+			}
+		} else {
+			numTriangles = triangles.count();
+		}
 
-				for ( int v = 0; v < nif->rowCount( iVWeights ); v++ ) {
-					QModelIndex iVertex = iVWeights.child( v, 0 );
-					nif->updateArray( iVertex );
-					QList<boneweight> list = weights.value( vertices[v] );
+		for ( int b = 0; b < bones.count(); b++ )
+			boneSlot[bones[b]] = b;
 
-					for ( int b = 0; b < maxBones; b++ )
-						nif->set<float>( iVertex.child( b, 0 ), list.count() > b ? list[ b ].second : 0.0 );
-				}
+		// fill in counts
+		if ( pad ) {
+			while ( bones.size() < maxBonesPerPartition ) {
+				bones.append( 0 );
+			}
+		}
 
-				nif->set<int>( iPart, "Has Faces", 1 );
+		nif->set<int>( iPart, "Num Vertices", vertices.count() );
+		nif->set<int>( iPart, "Num Triangles", numTriangles );
+		nif->set<int>( iPart, "Num Bones", bones.count() );
+		nif->set<int>( iPart, "Num Strips", strips.count() );
+		nif->set<int>( iPart, "Num Weights Per Vertex", maxBones );
 
-				if ( make_strips == true ) {
-					//Clear out any existing triangle data that might be left over from an existing Skin Partition
-					QModelIndex iTriangles = nif->getIndex( iPart, "Triangles" );
-					nif->updateArray( iTriangles );
+		// fill in bone map
 
-					// write the strips
-					QModelIndex iStripLengths = nif->getIndex( iPart, "Strip Lengths" );
-					nif->updateArray( iStripLengths );
+		QModelIndex iBoneMap = nif->getIndex( iPart, "Bones" );
+		nif->updateArray( iBoneMap );
+		nif->setArray<int>( iBoneMap, bones.toVector() );
 
-					for ( int s = 0; s < nif->rowCount( iStripLengths ); s++ )
-						nif->set<int>( iStripLengths.child( s, 0 ), strips.value( s ).count() );
+		// fill in vertex map
 
-					QModelIndex iStrips = nif->getIndex( iPart, "Strips" );
-					nif->updateArray( iStrips );
+		nif->set<int>( iPart, "Has Vertex Map", 1 );
+		QModelIndex iVertexMap = nif->getIndex( iPart, "Vertex Map" );
+		nif->updateArray( iVertexMap );
+		nif->setArray<int>( iVertexMap, vertices );
 
-					for ( int s = 0; s < nif->rowCount( iStrips ); s++ ) {
-						nif->updateArray( iStrips.child( s, 0 ) );
-						nif->setArray<quint16>( iStrips.child( s, 0 ), strips.value( s ) );
-					}
-				} else {
-					//Clear out any existing strip data that might be left over from an existing Skin Partition
-					QModelIndex iStripLengths = nif->getIndex( iPart, "Strip Lengths" );
-					nif->updateArray( iStripLengths );
-					QModelIndex iStrips = nif->getIndex( iPart, "Strips" );
-					nif->updateArray( iStrips );
-
-					QModelIndex iTriangles = nif->getIndex( iPart, "Triangles" );
-					nif->updateArray( iTriangles );
-					nif->setArray<Triangle>( iTriangles, triangles );
-				}
+		// fill in vertex weights and bones, padded with zeros by setArray()
 
-				// fill in vertex bones
+		nif->set<int>( iPart, "Has Vertex Weights", 1 );
+		QModelIndex iVWeights = nif->getIndex( iPart, "Vertex Weights" );
+		nif->updateArray( iVWeights );
 
-				nif->set<int>( iPart, "Has Bone Indices", 1 );
-				QModelIndex iVBones = nif->getIndex( iPart, "Bone Indices" );
-				nif->updateArray( iVBones );
+		nif->set<int>( iPart, "Has Bone Indices", 1 );
+		QModelIndex iVBones = nif->getIndex( iPart, "Bone Indices" );
+		nif->updateArray( iVBones );
 
-				for ( int v = 0; v < nif->rowCount( iVBones ); v++ ) {
-					QModelIndex iVertex = iVBones.child( v, 0 );
-					nif->updateArray( iVertex );
-					QList<boneweight> list = weights.value( vertices[v] );
+		QVector<float> vertexWeights;
+		QVector<int> vertexBones;
 
-					for ( int b = 0; b < maxBones; b++ )
-						nif->set<int>( iVertex.child( b, 0 ), list.count() > b ? bones.indexOf( list[ b ].first ) : 0 );
-				}
+		for ( int v = 0; v < vertices.count(); v++ ) {
+			const QList<boneweight> & list = job.weights[vertices[v]];
+
+			vertexWeights.clear();
+			vertexBones.clear();
+
+			for ( int b = 0; b < maxBones && b < list.count(); b++ ) {
+				vertexWeights.append( list[b].second );
+				vertexBones.append( boneSlot[list[b].first] );
 			}
 
-			// done
+			QModelIndex iVertex = iVWeights.child( v, 0 );
+			nif->updateArray( iVertex );
+			nif->setArray<float>( iVertex, vertexWeights );
 
-			return iShape;
+			iVertex = iVBones.child( v, 0 );
+			nif->updateArray( iVertex );
+			nif->setArray<int>( iVertex, vertexBones );
 		}
-		catch ( QString err )
-		{
-			if ( !err.isEmpty() )
-				QMessageBox::warning( 0, "NifSkope", err );
 
-			return iShape;
+		nif->set<int>( iPart, "Has Faces", 1 );
+
+		//Clear out any existing triangle or strip data that might be left over from an existing Skin Partition
+		QModelIndex iTriangles = nif->getIndex( iPart, "Triangles" );
+		nif->updateArray( iTriangles );
+		QModelIndex iStripLengths = nif->getIndex( iPart, "Strip Lengths" );
+		nif->updateArray( iStripLengths );
+		QModelIndex iStrips = nif->getIndex( iPart, "Strips" );
+		nif->updateArray( iStrips );
+
+		if ( make_strips == true ) {
+			// write the strips
+			for ( int s = 0; s < nif->rowCount( iStripLengths ); s++ )
+				nif->set<int>( iStripLengths.child( s, 0 ), strips.value( s ).count() );
+
+			for ( int s = 0; s < nif->rowCount( iStrips ); s++ ) {
+				nif->updateArray( iStrips.child( s, 0 ) );
+				nif->setArray<quint16>( iStrips.child( s, 0 ), strips.value( s ) );
+			}
+		} else {
+			nif->setArray<Triangle>( iTriangles, triangles );
 		}
 	}
+}
 
-	static QList<int> mergeBones( QList<int> a, QList<int> b )
+//! Makes the skin partitions of skinned shapes on a worker thread
+/*!
+ * The shapes are read and the settings asked for once for all shapes before
+ * the task is computed, then the shapes are partitioned in parallel.
+ */
+class SkinPartitionTask final : public SpellTask
+{
+public:
+	//! Read the shapes and ask for the settings, on the GUI thread before compute()
+	void prepare( const NifModel * nif, const QVector<int> & shapes )
 	{
-		for ( const auto c : b ) {
-			if ( !a.contains( c ) ) {
-				a.append( c );
+		int maxBones = 0;
+
+		for ( const int b : shapes ) {
+			SkinPartitionJob job;
+
+			try
+			{
+				readSkinPartition( nif, nif->getBlock( b ), job );
+				maxBones = qMax( maxBones, job.maxBones );
+
+				// The task may be deleted on the worker thread, the blocks are found again by commit()
+				job.iShape = job.iData = job.iSkinInst = job.iSkinData = job.iSkinPart = QPersistentModelIndex();
+
+				jobs.append( job );
+				blocks.append( b );
+			}
+			catch ( QString err )
+			{
+				errors << err;
 			}
 		}
-		return a;
+
+		if ( shapes.count() == 1 )
+			selected = shapes.first();
+
+		// query max bones per vertex/partition
+
+		if ( !jobs.isEmpty() ) {
+			SkinPartitionDialog dlg( maxBones );
+
+			if ( dlg.exec() != QDialog::Accepted ) {
+				jobs.clear();
+				blocks.clear();
+				errors.clear();
+				return;
+			}
+
+			maxBonesPerPartition = dlg.maxBonesPerPartition();
+			maxBonesPerVertex = dlg.maxBonesPerVertex();
+			makeStrips = dlg.makeStrips();
+			pad = dlg.padPartitions();
+		}
 	}
 
-	static bool containsBones( QList<int> a, QList<int> b )
+	void compute( const NifSnapshot &, SpellProgress & progress ) override final
 	{
-		for ( const auto c : b ) {
-			if ( !a.contains( c ) )
-				return false;
+		progress.setMaximum( jobs.count() );
+
+		Spell::parallelFor( jobs.count(), [this, &progress]( int i ) {
+			if ( progress.isCanceled() )
+				return;
+
+			computeSkinPartition( jobs[i], maxBonesPerPartition, maxBonesPerVertex );
+			progress.step();
+		} );
+	}
+
+	QModelIndex commit( NifModel * nif ) override final
+	{
+		// Writing may insert blocks, so every shape is found first
+		QPersistentModelIndex iSelected = nif->getBlock( selected );
+
+		for ( int i = 0; i < jobs.count(); i++ )
+			findSkinBlocks( nif, nif->getBlock( blocks.at( i ) ), jobs[i] );
+
+		// Update the model once after all shapes are written; strips are made here
+		// as NvTriStrip keeps its settings in globals
+		bool oldHoldUpdates = nif->holdUpdates( true );
+
+		for ( SkinPartitionJob & job : jobs ) {
+			if ( job.error.isEmpty() )
+				writeSkinPartition( nif, job, maxBonesPerPartition, maxBonesPerVertex, makeStrips, pad );
+			else
+				errors << job.error;
 		}
-		return true;
+
+		if ( !oldHoldUpdates )
+			nif->holdUpdates( false );
+
+		if ( !errors.isEmpty() )
+			QMessageBox::warning( 0, "NifSkope", errors.join( "\n" ) );
+
+		return iSelected;
+	}
+
+protected:
+	QVector<SkinPartitionJob> jobs;
+	//! The shape of each job
+	QVector<int> blocks;
+	QStringList errors;
+	//! The shape to select after a single shape was partitioned
+	int selected = -1;
+
+	int maxBonesPerPartition = 0;
+	int maxBonesPerVertex = 0;
+	bool makeStrips = false;
+	bool pad = false;
+};
+
+//! Make skin partition
+class spSkinPartition final : public Spell
+{
+public:
+	QString name() const override final { return Spell::tr( "Make Skin Partition" ); }
+	QString page() const override final { return Spell::tr( "Mesh" ); }
+	bool interactive() const override final { return true; }
+
+	bool isApplicable( const NifModel * nif, const QModelIndex & iShape ) override final
+	{
+		if ( nif->isNiBlock( iShape, { "NiTriShape", "NiTriStrips" } ) ) {
+			QModelIndex iSkinInst = nif->getBlock( nif->getLink( iShape, "Skin Instance" ), "NiSkinInstance" );
+
+			if ( iSkinInst.isValid() ) {
+				return nif->getBlock( nif->getLink( iSkinInst, "Data" ), "NiSkinData" ).isValid();
+			}
+		}
+
+		return false;
+	}
+
+	SpellTaskPtr task( const NifModel * nif, const QModelIndex & index ) override final
+	{
+		auto task = std::make_shared<SkinPartitionTask>();
+		task->prepare( nif, { nif->getBlockNumber( index ) } );
+		return task;
+	}
+
+	QModelIndex cast( NifModel * nif, const QModelIndex & index ) override final
+	{
+		return castTask( nif, index );
 	}
 };
 
@@ -1006,36 +1243,32 @@ class spAllSkinPartitions final : public Spell
 public:
 	QString name() const override final { return Spell::tr( "Make All Skin Partitions" ); }
 	QString page() const override final { return Spell::tr( "Batch" ); }
+	bool interactive() const override final { return true; }
 
 	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
 	{
 		return nif && !index.isValid();
 	}
 
-	QModelIndex cast( NifModel * nif, const QModelIndex & index ) override final
+	SpellTaskPtr task( const NifModel * nif, const QModelIndex & ) override final
 	{
-		Q_UNUSED( index );
-		QList<QPersistentModelIndex> indices;
+		QVector<int> shapes;
 
 		spSkinPartition Partitioner;
 
 		for ( int n = 0; n < nif->getBlockCount(); n++ ) {
-			QModelIndex idx = nif->getBlock( n );
-
-			if ( Partitioner.isApplicable( nif, idx ) )
-				indices.append( idx );
-		}
-
-		int mbpp = 0, mbpv = 0;
-		bool make_strips = false;
-
-		for ( const QModelIndex& idx : indices ) {
-			Partitioner.cast( nif, idx, mbpp, mbpv, make_strips );
+			if ( Partitioner.isApplicable( nif, nif->getBlock( n ) ) )
+				shapes << n;
 		}
 
-		qCWarning( nsSpell ) << Spell::tr( "did %1 partitions" ).arg( indices.count() );
+		auto task = std::make_shared<SkinPartitionTask>();
+		task->prepare( nif, shapes );
+		return task;
+	}
 
-		return QModelIndex();
+	QModelIndex cast( NifModel * nif, const QModelIndex & index ) override final
+	{
+		return castTask( nif, index );
 	}
 };
 
@@ -1231,6 +1464,7 @@ class spMirrorSkeleton final : public Spell
 public:
 	QString name() const override final { return Spell::tr( "Mirror armature" ); }
 	QString page() const override final { return Spell::tr( "Skeleton" ); }
+	bool interactive() const override final { return true; }
 
 	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
 	{
@@ -2,6 +2,7 @@
 #include "spellbook.h"
 
 #include <QDialog>
+#include <QHash>
 #include <QLabel>
 #include <QLayout>
 #include <QLineEdit>
@@ -73,6 +74,7 @@ class spEditStringOffset final : public Spell
 public:
 	QString name() const override final { return Spell::tr( "Edit String Offset" ); }
 	QString page() const override final { return Spell::tr( "" ); }
+	bool interactive() const override final { return true; }
 	QIcon icon() const
 	{
 		if ( !txt_xpm_icon )
@@ -81,6 +83,7 @@ public:
 		return *txt_xpm_icon;
 	}
 	bool instant() const { return true; }
+	QList<NifValue::Type> applicableValues() const override final { return { NifValue::tStringOffset }; }
 
 	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
 	{
@@ -91,8 +94,9 @@ public:
 	{
 		QModelIndex iPalette = getStringPalette( nif, index );
 
-		QMap<QString, int> strings = readStringPalette( nif, iPalette );
-		QString string = getString( strings, nif->get<int>( index ) );
+		QByteArray bytes = nif->get<QByteArray>( iPalette, "Palette" );
+		QMap<QString, int> strings = readStringPalette( bytes );
+		QString string = getString( bytes, nif->get<int>( index ) );
 
 		QDialog dlg;
 
@@ -127,7 +131,7 @@ public:
 		if ( dlg.exec() != QDialog::Accepted )
 			return index;
 
-		nif->set<int>( index, addString( nif, iPalette, le->text() ) );
+		nif->set<int>( index, addString( nif, iPalette, le->text(), bytes, strings ) );
 
 		return index;
 	}
@@ -144,14 +148,13 @@ public:
 	}
 
 	//! Reads a string palette and returns a map of strings to offsets
-	static QMap<QString, int> readStringPalette( const NifModel * nif, const QModelIndex & iPalette )
+	static QMap<QString, int> readStringPalette( const QByteArray & bytes )
 	{
-		QByteArray bytes = nif->get<QByteArray>( iPalette, "Palette" );
 		QMap<QString, int> strings;
 		int x = 0;
 
 		while ( x < bytes.count() ) {
-			QString s( &bytes.data()[x] );
+			QString s( &bytes.constData()[x] );
 			strings.insert( s, x );
 			x += s.length() + 1;
 		}
@@ -159,19 +162,11 @@ public:
 		return strings;
 	}
 
-	//! Gets a particular string from a string palette
-	static QString getString( const QMap<QString, int> strings, int ofs )
+	//! Gets the string at an offset of a string palette
+	static QString getString( const QByteArray & bytes, int ofs )
 	{
-		if ( ofs >= 0 ) {
-			QMapIterator<QString, int> it( strings );
-
-			while ( it.hasNext() ) {
-				it.next();
-
-				if ( ofs == it.value() )
-					return it.key();
-			}
-		}
+		if ( ofs >= 0 && ofs < bytes.count() && ( ofs == 0 || bytes[ofs - 1] == '\0' ) )
+			return QString( &bytes.constData()[ofs] );
 
 		return QString();
 	}
@@ -181,19 +176,20 @@ public:
 	 * \param nif The model the string palette is in
 	 * \param iPalette The index of the string palette
 	 * \param string The string to add or find
+	 * \param bytes The palette, as read from the model
+	 * \param strings The palette read by readStringPalette( bytes )
 	 * \return The index of the string in the palette
 	 */
-	static int addString( NifModel * nif, const QModelIndex & iPalette, const QString & string )
+	static int addString( NifModel * nif, const QModelIndex & iPalette, const QString & string, QByteArray bytes, const QMap<QString, int> & strings )
 	{
 		if ( string.isEmpty() )
 			return 0xffffffff;
 
-		QMap<QString, int> strings = readStringPalette( nif, iPalette );
+		auto it = strings.constFind( string );
 
-		if ( strings.contains( string ) )
-			return strings[ string ];
+		if ( it != strings.constEnd() )
+			return it.value();
 
-		QByteArray bytes = nif->get<QByteArray>( iPalette, "Palette" );
 		int ofs = bytes.count();
 		bytes += string.toLatin1();
 		bytes.append( '\0' );
@@ -289,6 +285,7 @@ class spEditStringEntries final : public Spell
 public:
 	QString name() const override final { return Spell::tr( "Replace Entries" ); }
 	QString page() const override final { return Spell::tr( "String Palette" ); }
+	bool interactive() const override final { return true; }
 
 	bool instant() const { return false; }
 
@@ -352,7 +349,7 @@ public:
 		bytes.clear();
 		x = 0;
 
-		QMap<int, int> offsetMap;
+		QHash<int, int> offsetMap;
 
 		for ( int i = 0; i < newEntries.size(); i++ ) {
 			QString s = newEntries.at( i );
@@ -368,62 +365,39 @@ public:
 			}
 		}
 
-		// find all NiSequence blocks in the current model
-		QList<QPersistentModelIndex> sequenceList;
-
-		for ( int i = 0; i < nif->getBlockCount(); i++ ) {
-			QPersistentModelIndex current = nif->getBlock( i, "NiSequence" );
-
-			if ( current.isValid() ) {
-				sequenceList.append( current );
-			}
-		}
-
-		qDebug() << "Found sequences " << sequenceList;
-
-		// find their string palettes
+		// find the NiSequence blocks which use that palette
 		QList<QPersistentModelIndex> sequenceUpdateList;
-		QListIterator<QPersistentModelIndex> sequenceListIterator( sequenceList );
 
-		while ( sequenceListIterator.hasNext() ) {
-			QPersistentModelIndex temp = sequenceListIterator.next();
-			QPersistentModelIndex tempPalette = nif->getBlock( nif->getLink( temp, "String Palette" ) );
+		for ( int i = 0; i < nif->getBlockCount(); i++ ) {
+			QModelIndex current = nif->getBlock( i, "NiSequence" );
 
-			//qDebug() << "Sequence " << temp << " uses " << tempPalette;
-			if ( iPalette == tempPalette ) {
-				//qDebug() << "Identical to this sequence palette!";
-				sequenceUpdateList.append( temp );
-			}
+			if ( current.isValid() && nif->getBlock( nif->getLink( current, "String Palette" ) ) == iPalette )
+				sequenceUpdateList.append( current );
 		}
 
 		// update all references to that palette
-		QListIterator<QPersistentModelIndex> sequenceUpdateIterator( sequenceUpdateList );
 		int numRefsUpdated = 0;
 
-		while ( sequenceUpdateIterator.hasNext() ) {
-			QPersistentModelIndex nextBlock = sequenceUpdateIterator.next();
-			//qDebug() << "Need to update " << nextBlock;
-
-			QPersistentModelIndex blocks = nif->getIndex( nextBlock, "Controlled Blocks" );
+		for ( const QPersistentModelIndex & nextBlock : sequenceUpdateList ) {
+			QModelIndex blocks = nif->getIndex( nextBlock, "Controlled Blocks" );
 
 			for ( int i = 0; i < nif->rowCount( blocks ); i++ ) {
-				QPersistentModelIndex thisBlock = blocks.child( i, 0 );
+				QModelIndex thisBlock = blocks.child( i, 0 );
 
 				for ( int j = 0; j < nif->rowCount( thisBlock ); j++ ) {
-					if ( nif->getValue( thisBlock.child( j, 0 ) ).type() == NifValue::tStringOffset ) {
+					QModelIndex iOffset = thisBlock.child( j, 0 );
+
+					if ( nif->getValue( iOffset ).type() == NifValue::tStringOffset ) {
 						// we shouldn't ever exceed the limit of an int, even though the type
 						// is properly a uint
-						int oldValue = nif->get<int>( thisBlock.child( j, 0 ) );
-						qDebug() << "Index " << thisBlock.child( j, 0 )
-						           << " is a string offset with name "
-						           << nif->itemName( thisBlock.child( j, 0 ) )
-						           << " and value "
-						           << nif->get<int>( thisBlock.child( j, 0 ) );
-
+						int oldValue = nif->get<int>( iOffset );
 
 						if ( oldValue != -1 ) {
 							int newValue = offsetMap.value( oldValue );
-							nif->set<int>( thisBlock.child( j, 0 ), newValue );
+
+							if ( newValue != oldValue )
+								nif->set<int>( iOffset, newValue );
+
 							numRefsUpdated++;
 						}
 					}
@@ -448,6 +422,7 @@ class spStringPaletteLister final : public Spell
 public:
 	QString name() const override final { return Spell::tr( "Edit String Palettes" ); }
 	QString page() const override final { return Spell::tr( "Animation" ); }
+	bool interactive() const override final { return true; }
 
 	bool instant() const { return false; }
 
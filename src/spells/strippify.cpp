@@ -1,7 +1,12 @@
 #include "spellbook.h"
 
+#include "nifsnapshot.h"
 #include "nvtristripwrapper.h"
 
+#include <QPair>
+
+#include <algorithm>
+
 
 // TODO: Move these to blocks.h / misc.h / wherever
 template <typename T> void copyArray( NifModel * nif, const QModelIndex & iDst, const QModelIndex & iSrc )
@@ -23,131 +28,194 @@ template <typename T> void copyValue( NifModel * nif, const QModelIndex & iDst,
 }
 
 
-class spStrippify final : public Spell
+//! The triangles which are not degenerate
+static QVector<Triangle> validTriangles( const QVector<Triangle> & tris )
 {
-	QString name() const override final { return Spell::tr( "Stripify" ); }
-	QString page() const override final { return Spell::tr( "Mesh" ); }
+	QVector<Triangle> triangles;
+	triangles.reserve( tris.count() );
 
-	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
-	{
-		return nif->checkVersion( 0x0a000000, 0 ) && nif->isNiBlock( index, "NiTriShape" );
+	for ( const Triangle & tri : tris ) {
+		if ( tri[0] != tri[1] && tri[1] != tri[2] && tri[2] != tri[0] )
+			triangles.append( tri );
 	}
 
-	QModelIndex cast( NifModel * nif, const QModelIndex & index ) override final
-	{
-		QPersistentModelIndex idx = index;
-		QPersistentModelIndex iData = nif->getBlock( nif->getLink( idx, "Data" ), "NiTriShapeData" );
+	return triangles;
+}
 
-		if ( !iData.isValid() )
-			return idx;
+//! Replace the NiTriShapeData of a NiTriShape by a NiTriStripsData holding \a strips, making it a NiTriStrips
+static void writeStrips( NifModel * nif, const QModelIndex & index, const QList<QVector<quint16>> & strips )
+{
+	QPersistentModelIndex idx = index;
+	QPersistentModelIndex iData = nif->getBlock( nif->getLink( idx, "Data" ), "NiTriShapeData" );
 
-		QVector<Triangle> triangles;
-		QModelIndex iTriangles = nif->getIndex( iData, "Triangles" );
+	if ( !iData.isValid() || strips.count() <= 0 )
+		return;
 
-		if ( !iTriangles.isValid() )
-			return idx;
+	nif->insertNiBlock( "NiTriStripsData", nif->getBlockNumber( idx ) + 1 );
+	QModelIndex iStripData = nif->getBlock( nif->getBlockNumber( idx ) + 1, "NiTriStripsData" );
 
-		int skip = 0;
+	if ( iStripData.isValid() ) {
+		copyValue<int>( nif, iStripData, iData, "Num Vertices" );
 
-		for ( int t = 0; t < nif->rowCount( iTriangles ); t++ ) {
-			Triangle tri = nif->get<Triangle>( iTriangles.child( t, 0 ) );
+		nif->set<int>( iStripData, "Has Vertices", 1 );
+		copyArray<Vector3>( nif, iStripData, iData, "Vertices" );
 
-			if ( tri[0] != tri[1] && tri[1] != tri[2] && tri[2] != tri[0] )
-				triangles.append( tri );
-			else
-				skip++;
+		copyValue<int>( nif, iStripData, iData, "Has Normals" );
+		copyArray<Vector3>( nif, iStripData, iData, "Normals" );
+
+		copyValue<int>( nif, iStripData, iData, "TSpace Flag" );
+		copyArray<Vector3>( nif, iStripData, iData, "Bitangents" );
+		copyArray<Vector3>( nif, iStripData, iData, "Tangents" );
+
+		copyValue<int>( nif, iStripData, iData, "Has Vertex Colors" );
+		copyArray<Color4>( nif, iStripData, iData, "Vertex Colors" );
+
+		copyValue<int>( nif, iStripData, iData, "Has UV" );
+		copyValue<int>( nif, iStripData, iData, "Num UV Sets" );
+		copyValue<int>( nif, iStripData, iData, "Vector Flags" );
+		copyValue<int>( nif, iStripData, iData, "BS Num UV Sets" );
+		copyValue<int>( nif, iStripData, iData, "Num UV Sets 2" );
+		QModelIndex iDstUV = nif->getIndex( iStripData, "UV Sets" );
+		QModelIndex iSrcUV = nif->getIndex( iData, "UV Sets" );
+
+		if ( iDstUV.isValid() && iSrcUV.isValid() ) {
+			nif->updateArray( iDstUV );
+
+			for ( int r = 0; r < nif->rowCount( iDstUV ); r++ ) {
+				copyArray<Vector2>( nif, iDstUV.child( r, 0 ), iSrcUV.child( r, 0 ) );
+			}
 		}
 
-		//qDebug() << "num triangles" << triangles.count() << "skipped" << skip;
+		iDstUV = nif->getIndex( iStripData, "UV Sets 2" );
+		iSrcUV = nif->getIndex( iData, "UV Sets 2" );
 
+		if ( iDstUV.isValid() && iSrcUV.isValid() ) {
+			nif->updateArray( iDstUV );
 
-		QList<QVector<quint16> > strips = stripify( triangles );
+			for ( int r = 0; r < nif->rowCount( iDstUV ); r++ ) {
+				copyArray<Vector2>( nif, iDstUV.child( r, 0 ), iSrcUV.child( r, 0 ) );
+			}
+		}
 
-		if ( strips.count() <= 0 )
-			return idx;
+		copyValue<Vector3>( nif, iStripData, iData, "Center" );
+		copyValue<float>( nif, iStripData, iData, "Radius" );
+
+		nif->set<int>( iStripData, "Num Strips", strips.count() );
+		nif->set<int>( iStripData, "Has Points", 1 );
+
+		QModelIndex iLengths = nif->getIndex( iStripData, "Strip Lengths" );
+		QModelIndex iPoints  = nif->getIndex( iStripData, "Points" );
+
+		if ( iLengths.isValid() && iPoints.isValid() ) {
+			nif->updateArray( iLengths );
+			nif->updateArray( iPoints );
+			int x = 0;
+			int z = 0;
+			for ( const QVector<quint16>& strip : strips ) {
+				nif->set<int>( iLengths.child( x, 0 ), strip.count() );
+				QModelIndex iStrip = iPoints.child( x, 0 );
+				nif->updateArray( iStrip );
+				nif->setArray<quint16>( iStrip, strip );
+				x++;
+				z += strip.count() - 2;
+			}
+			nif->set<int>( iStripData, "Num Triangles", z );
 
-		nif->insertNiBlock( "NiTriStripsData", nif->getBlockNumber( idx ) + 1 );
-		QModelIndex iStripData = nif->getBlock( nif->getBlockNumber( idx ) + 1, "NiTriStripsData" );
+			nif->setData( idx.sibling( idx.row(), NifModel::NameCol ), "NiTriStrips" );
+			int lnk = nif->getLink( idx, "Data" );
+			nif->setLink( idx, "Data", nif->getBlockNumber( iStripData ) );
+			nif->removeNiBlock( lnk );
+		}
+	}
+}
 
-		if ( iStripData.isValid() ) {
-			copyValue<int>( nif, iStripData, iData, "Num Vertices" );
+class spStrippify final : public Spell
+{
+	QString name() const override final { return Spell::tr( "Stripify" ); }
+	QString page() const override final { return Spell::tr( "Mesh" ); }
 
-			nif->set<int>( iStripData, "Has Vertices", 1 );
-			copyArray<Vector3>( nif, iStripData, iData, "Vertices" );
+	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
+	{
+		return nif->checkVersion( 0x0a000000, 0 ) && nif->isNiBlock( index, "NiTriShape" );
+	}
 
-			copyValue<int>( nif, iStripData, iData, "Has Normals" );
-			copyArray<Vector3>( nif, iStripData, iData, "Normals" );
+	QModelIndex cast( NifModel * nif, const QModelIndex & index ) override final
+	{
+		QPersistentModelIndex idx = index;
+		QModelIndex iData = nif->getBlock( nif->getLink( idx, "Data" ), "NiTriShapeData" );
+		QModelIndex iTriangles = nif->getIndex( iData, "Triangles" );
 
-			copyValue<int>( nif, iStripData, iData, "TSpace Flag" );
-			copyArray<Vector3>( nif, iStripData, iData, "Bitangents" );
-			copyArray<Vector3>( nif, iStripData, iData, "Tangents" );
+		if ( !iTriangles.isValid() )
+			return idx;
 
-			copyValue<int>( nif, iStripData, iData, "Has Vertex Colors" );
-			copyArray<Color4>( nif, iStripData, iData, "Vertex Colors" );
+		writeStrips( nif, idx, stripify( validTriangles( nif->getArray<Triangle>( iTriangles ) ) ) );
 
-			copyValue<int>( nif, iStripData, iData, "Has UV" );
-			copyValue<int>( nif, iStripData, iData, "Num UV Sets" );
-			copyValue<int>( nif, iStripData, iData, "Vector Flags" );
-			copyValue<int>( nif, iStripData, iData, "BS Num UV Sets" );
-			copyValue<int>( nif, iStripData, iData, "Num UV Sets 2" );
-			QModelIndex iDstUV = nif->getIndex( iStripData, "UV Sets" );
-			QModelIndex iSrcUV = nif->getIndex( iData, "UV Sets" );
+		return idx;
+	}
+};
 
-			if ( iDstUV.isValid() && iSrcUV.isValid() ) {
-				nif->updateArray( iDstUV );
+REGISTER_SPELL( spStrippify )
 
-				for ( int r = 0; r < nif->rowCount( iDstUV ); r++ ) {
-					copyArray<Vector2>( nif, iDstUV.child( r, 0 ), iSrcUV.child( r, 0 ) );
-				}
-			}
+//! Makes the strips of many NiTriShape on a worker thread
+class StripifyTask final : public SpellTask
+{
+public:
+	//! Find the data of each shape, on the GUI thread before compute()
+	void prepare( const NifModel * nif, const QVector<int> & shapes )
+	{
+		for ( const int b : shapes ) {
+			QModelIndex iData = nif->getBlock( nif->getLink( nif->getBlock( b ), "Data" ), "NiTriShapeData" );
 
-			iDstUV = nif->getIndex( iStripData, "UV Sets 2" );
-			iSrcUV = nif->getIndex( iData, "UV Sets 2" );
+			if ( !nif->getIndex( iData, "Triangles" ).isValid() )
+				continue;
 
-			if ( iDstUV.isValid() && iSrcUV.isValid() ) {
-				nif->updateArray( iDstUV );
+			Job job;
+			job.shape = b;
+			job.data = nif->getBlockNumber( iData );
+			jobs.append( job );
+		}
+	}
 
-				for ( int r = 0; r < nif->rowCount( iDstUV ); r++ ) {
-					copyArray<Vector2>( nif, iDstUV.child( r, 0 ), iSrcUV.child( r, 0 ) );
-				}
-			}
+	void compute( const NifSnapshot & snapshot, SpellProgress & progress ) override final
+	{
+		progress.setMaximum( jobs.count() );
 
-			copyValue<Vector3>( nif, iStripData, iData, "Center" );
-			copyValue<float>( nif, iStripData, iData, "Radius" );
-
-			nif->set<int>( iStripData, "Num Strips", strips.count() );
-			nif->set<int>( iStripData, "Has Points", 1 );
-
-			QModelIndex iLengths = nif->getIndex( iStripData, "Strip Lengths" );
-			QModelIndex iPoints  = nif->getIndex( iStripData, "Points" );
-
-			if ( iLengths.isValid() && iPoints.isValid() ) {
-				nif->updateArray( iLengths );
-				nif->updateArray( iPoints );
-				int x = 0;
-				int z = 0;
-				for ( const QVector<quint16>& strip : strips ) {
-					nif->set<int>( iLengths.child( x, 0 ), strip.count() );
-					QModelIndex iStrip = iPoints.child( x, 0 );
-					nif->updateArray( iStrip );
-					nif->setArray<quint16>( iStrip, strip );
-					x++;
-					z += strip.count() - 2;
-				}
-				nif->set<int>( iStripData, "Num Triangles", z );
+		// One shape at a time, as NvTriStrip keeps its settings in globals
+		for ( Job & job : jobs ) {
+			if ( progress.isCanceled() )
+				return;
 
-				nif->setData( idx.sibling( idx.row(), NifModel::NameCol ), "NiTriStrips" );
-				int lnk = nif->getLink( idx, "Data" );
-				nif->setLink( idx, "Data", nif->getBlockNumber( iStripData ) );
-				nif->removeNiBlock( lnk );
-			}
+			job.strips = stripify( validTriangles( snapshot.getArray<Triangle>( snapshot.block( job.data ), "Triangles" ) ) );
+			progress.step();
 		}
+	}
 
-		return idx;
+	QModelIndex commit( NifModel * nif ) override final
+	{
+		// Writing inserts and removes blocks, so every shape is found first
+		QList<QPersistentModelIndex> shapes;
+
+		for ( const Job & job : jobs )
+			shapes << nif->getBlock( job.shape );
+
+		for ( int i = 0; i < jobs.count(); i++ ) {
+			if ( shapes.at( i ).isValid() )
+				writeStrips( nif, shapes.at( i ), jobs.at( i ).strips );
+		}
+
+		return QModelIndex();
 	}
-};
 
-REGISTER_SPELL( spStrippify )
+protected:
+	struct Job
+	{
+		int shape = -1;
+		int data = -1;
+		QList<QVector<quint16>> strips;
+	};
+
+	QVector<Job> jobs;
+};
 
 
 class spStrippifyAll final : public Spell
@@ -161,24 +229,23 @@ public:
 		return nif->checkVersion( 0x0a000000, 0 ) && !index.isValid();
 	}
 
-	QModelIndex cast( NifModel * nif, const QModelIndex & ) override final
+	SpellTaskPtr task( const NifModel * nif, const QModelIndex & ) override final
 	{
-		QList<QPersistentModelIndex> iTriShapes;
+		QVector<int> shapes;
 
 		for ( int l = 0; l < nif->getBlockCount(); l++ ) {
-			QModelIndex idx = nif->getBlock( l, "NiTriShape" );
-
-			if ( idx.isValid() )
-				iTriShapes << idx;
+			if ( nif->getBlock( l, "NiTriShape" ).isValid() )
+				shapes << l;
 		}
 
-		spStrippify Stripper;
-
-		for ( const QModelIndex& idx : iTriShapes ) {
-			Stripper.castIfApplicable( nif, idx );
-		}
+		auto task = std::make_shared<StripifyTask>();
+		task->prepare( nif, shapes );
+		return task;
+	}
 
-		return QModelIndex();
+	QModelIndex cast( NifModel * nif, const QModelIndex & index ) override final
+	{
+		return castTask( nif, index );
 	}
 };
 
@@ -463,3 +530,471 @@ public:
 
 REGISTER_SPELL( spUnstichStrips )
 
+
+
+//! Size of the post-transform vertex cache the triangle order is optimized for
+static const int vertexCacheSize = 16;
+
+//! Count the vertices a FIFO vertex cache of \a cacheSize has to transform for the triangles
+static int countCacheMisses( const QVector<Triangle> & tris, int numVerts, int cacheSize )
+{
+	// The miss at which each vertex entered the cache; it is evicted cacheSize misses later
+	QVector<int> entered( numVerts, -cacheSize - 1 );
+	int misses = 0;
+
+	for ( const Triangle & t : tris ) {
+		for ( int p = 0; p < 3; p++ ) {
+			if ( misses - entered[t[p]] > cacheSize )
+				entered[t[p]] = misses++;
+		}
+	}
+
+	return misses;
+}
+
+//! Reorder triangles for the vertex cache
+/*!
+ * Tipsify, Sander, Nehab and Barczak, "Fast Triangle Reordering for Vertex
+ * Locality and Reduced Overdraw", 2007: emits all remaining triangles around
+ * a vertex and continues with the neighbour most likely to still be cached.
+ * Linear in the number of triangles.
+ *
+ * \param clusters	Receives the position in the result of each run which began after a dead end
+ */
+static QVector<Triangle> tipsify( const QVector<Triangle> & tris, int numVerts, int cacheSize, QVector<int> & clusters )
+{
+	// The triangles around each vertex
+	QVector<int> live( numVerts, 0 );
+
+	for ( const Triangle & t : tris ) {
+		for ( int p = 0; p < 3; p++ )
+			live[t[p]]++;
+	}
+
+	QVector<int> offsets( numVerts + 1, 0 );
+
+	for ( int v = 0; v < numVerts; v++ )
+		offsets[v + 1] = offsets[v] + live[v];
+
+	QVector<int> adjacency( offsets[numVerts] );
+	QVector<int> fill = offsets;
+
+	for ( int i = 0; i < tris.count(); i++ ) {
+		for ( int p = 0; p < 3; p++ )
+			adjacency[fill[tris[i][p]]++] = i;
+	}
+
+	QVector<int> stamp( numVerts, 0 );
+	QVector<bool> emitted( tris.count(), false );
+	QVector<int> deadEnd;
+	QVector<int> candidates;
+	QVector<Triangle> out;
+	out.reserve( tris.count() );
+
+	int time = cacheSize + 1;
+	int cursor = 0;
+
+	auto skipDeadEnd = [&]() {
+		while ( !deadEnd.isEmpty() ) {
+			int d = deadEnd.takeLast();
+
+			if ( live[d] > 0 )
+				return d;
+		}
+
+		for ( ; cursor < numVerts; cursor++ ) {
+			if ( live[cursor] > 0 )
+				return cursor;
+		}
+
+		return -1;
+	};
+
+	clusters.clear();
+	int fan = skipDeadEnd();
+	bool jumped = true;
+
+	while ( fan >= 0 ) {
+		if ( jumped )
+			clusters.append( out.count() );
+
+		candidates.clear();
+
+		for ( int k = offsets[fan]; k < offsets[fan + 1]; k++ ) {
+			int i = adjacency[k];
+
+			if ( emitted[i] )
+				continue;
+
+			const Triangle & t = tris[i];
+
+			for ( int p = 0; p < 3; p++ ) {
+				int v = t[p];
+				deadEnd.append( v );
+				candidates.append( v );
+				live[v]--;
+
+				if ( time - stamp[v] > cacheSize )
+					stamp[v] = time++;
+			}
+
+			emitted[i] = true;
+			out.append( t );
+		}
+
+		// Prefer the vertex which stays in the cache for all its remaining triangles
+		int next = -1;
+		int best = -1;
+
+		for ( int v : candidates ) {
+			if ( live[v] <= 0 )
+				continue;
+
+			int priority = 0;
+
+			if ( time - stamp[v] + 2 * live[v] <= cacheSize )
+				priority = time - stamp[v];
+
+			if ( priority > best ) {
+				best = priority;
+				next = v;
+			}
+		}
+
+		jumped = ( next < 0 );
+		fan = jumped ? skipDeadEnd() : next;
+	}
+
+	return out;
+}
+
+//! Sort the clusters of tipsify() so that those facing out of the mesh are drawn first, as they tend to occlude the others
+static QVector<Triangle> sortForOverdraw( const QVector<Triangle> & tris, const QVector<int> & clusters, const QVector<Vector3> & verts )
+{
+	if ( clusters.count() < 2 )
+		return tris;
+
+	Vector3 meshCenter;
+
+	for ( const Vector3 & v : verts )
+		meshCenter += v;
+
+	meshCenter /= verts.count();
+
+	QVector<QPair<float, int>> order;
+	order.reserve( clusters.count() );
+
+	for ( int c = 0; c < clusters.count(); c++ ) {
+		int end = ( c + 1 < clusters.count() ) ? clusters[c + 1] : tris.count();
+		Vector3 center, normal;
+
+		for ( int i = clusters[c]; i < end; i++ ) {
+			const Triangle & t = tris[i];
+			Vector3 n = Vector3::crossproduct( verts[t[1]] - verts[t[0]], verts[t[2]] - verts[t[0]] );
+
+			// Weighted by area, which is the length of n
+			center += ( verts[t[0]] + verts[t[1]] + verts[t[2]] ) * ( n.length() / 3.0f );
+			normal += n;
+		}
+
+		float area = normal.length();
+		float facing = 0;
+
+		if ( area > 0 )
+			facing = Vector3::dotproduct( center / area - meshCenter, normal / area );
+
+		order.append( qMakePair( -facing, c ) );
+	}
+
+	std::stable_sort( order.begin(), order.end() );
+
+	QVector<Triangle> out;
+	out.reserve( tris.count() );
+
+	for ( const auto & o : order ) {
+		int c = o.second;
+		int end = ( c + 1 < clusters.count() ) ? clusters[c + 1] : tris.count();
+
+		for ( int i = clusters[c]; i < end; i++ )
+			out.append( tris[i] );
+	}
+
+	return out;
+}
+
+//! A shape whose triangles are reordered by the triangle order spells
+struct TriangleOrderJob
+{
+	//! The shape
+	QPersistentModelIndex iShape;
+	//! The block holding the triangles
+	QPersistentModelIndex iData;
+	//! The triangles, reordered by optimizeTriangleOrder()
+	QVector<Triangle> tris;
+	//! The vertex positions, empty if the overdraw cannot be sorted
+	QVector<Vector3> verts;
+	//! The number of vertices the triangles use
+	int numVerts = 0;
+	//! Whether the vertices may be reordered as well
+	bool reorderVertices = false;
+	//! The new position of each vertex, empty if they keep their order
+	QVector<int> vertexOrder;
+	//! Cache misses before and after
+	int missesBefore = 0, missesAfter = 0;
+};
+
+//! Whether the triangles of the shape can be reordered
+static bool canOrderTriangles( const NifModel * nif, const QModelIndex & iShape )
+{
+	if ( nif->isNiBlock( iShape, "NiTriShape" ) )
+		return nif->getBlock( nif->getLink( iShape, "Data" ), "NiTriShapeData" ).isValid();
+
+	// Segments and LODs refer to ranges of triangles, skin partitions have their own
+	if ( nif->isNiBlock( iShape, { "BSTriShape", "BSDynamicTriShape" } ) )
+		return nif->rowCount( nif->getIndex( iShape, "Triangles" ) ) > 0
+		       && ( nif->getUserVersion2() == 130 || nif->getLink( iShape, "Skin" ) < 0 );
+
+	return false;
+}
+
+//! Read the triangles of a shape
+static bool readTriangleOrder( const NifModel * nif, const QModelIndex & iShape, TriangleOrderJob & job )
+{
+	job.iShape = iShape;
+
+	if ( nif->isNiBlock( iShape, "NiTriShape" ) ) {
+		job.iData = nif->getBlock( nif->getLink( iShape, "Data" ), "NiTriShapeData" );
+		job.verts = nif->getArray<Vector3>( job.iData, "Vertices" );
+
+		// Other blocks refer to the vertices of skinned and morphed shapes by index
+		int numVerts = job.verts.count();
+		job.reorderVertices = numVerts > 0
+			&& nif->getLink( iShape, "Skin Instance" ) < 0
+			&& nif->getLink( iShape, "Controller" ) < 0
+			&& nif->get<int>( job.iData, "Num Match Groups" ) == 0;
+
+		for ( const QString & name : { "Normals", "Tangents", "Bitangents", "Vertex Colors" } ) {
+			int count = nif->rowCount( nif->getIndex( job.iData, name ) );
+			job.reorderVertices &= ( count <= 0 || count == numVerts );
+		}
+
+		for ( const QString & name : { "UV Sets", "UV Sets 2" } ) {
+			QModelIndex iUVSets = nif->getIndex( job.iData, name );
+
+			for ( int r = 0; r < nif->rowCount( iUVSets ); r++ )
+				job.reorderVertices &= ( nif->rowCount( iUVSets.child( r, 0 ) ) == numVerts );
+		}
+	} else {
+		job.iData = iShape;
+
+		// Every vertex has the same fields, find the row of the position once
+		static const NifFieldId fVertex( "Vertex" );
+
+		QModelIndex iVertData = nif->getIndex( iShape, "Vertex Data" );
+		int numVerts = nif->rowCount( iVertData );
+		int rVertex = ( numVerts > 0 ) ? nif->getIndex( nif->index( 0, 0, iVertData ), fVertex ).row() : -1;
+
+		if ( rVertex >= 0 ) {
+			job.verts.reserve( numVerts );
+
+			for ( int i = 0; i < numVerts; i++ )
+				job.verts += nif->get<Vector3>( nif->index( rVertex, 0, nif->index( i, 0, iVertData ) ) );
+		}
+	}
+
+	job.tris = nif->getArray<Triangle>( job.iData, "Triangles" );
+
+	for ( const Triangle & t : job.tris )
+		job.numVerts = qMax( job.numVerts, int( qMax( t[0], qMax( t[1], t[2] ) ) ) + 1 );
+
+	if ( job.numVerts > job.verts.count() ) {
+		job.verts.clear();
+		job.reorderVertices = false;
+	}
+
+	return !job.tris.isEmpty();
+}
+
+//! Reorder the triangles for the vertex cache and overdraw, and the vertices for fetching; only touches the job, so it may run on any thread
+static void optimizeTriangleOrder( TriangleOrderJob & job )
+{
+	job.missesBefore = countCacheMisses( job.tris, job.numVerts, vertexCacheSize );
+
+	QVector<int> clusters;
+	QVector<Triangle> tris = tipsify( job.tris, job.numVerts, vertexCacheSize, clusters );
+
+	if ( !job.verts.isEmpty() )
+		tris = sortForOverdraw( tris, clusters, job.verts );
+
+	job.missesAfter = countCacheMisses( tris, job.numVerts, vertexCacheSize );
+
+	// Sorting clusters may lose more than it gains on small meshes
+	if ( job.missesAfter > job.missesBefore ) {
+		job.missesAfter = job.missesBefore;
+		return;
+	}
+
+	job.tris = tris;
+
+	if ( !job.reorderVertices )
+		return;
+
+	// Number the vertices in the order the triangles first use them, the unused ones last
+	int count = job.verts.count();
+	job.vertexOrder.fill( -1, count );
+	int next = 0;
+
+	for ( Triangle & t : job.tris ) {
+		for ( int p = 0; p < 3; p++ ) {
+			if ( job.vertexOrder[t[p]] < 0 )
+				job.vertexOrder[t[p]] = next++;
+
+			t[p] = job.vertexOrder[t[p]];
+		}
+	}
+
+	for ( int & o : job.vertexOrder ) {
+		if ( o < 0 )
+			o = next++;
+	}
+}
+
+//! Move each element of an array to the position given by \a order
+template <typename T> static void reorderArray( NifModel * nif, const QModelIndex & iArray, const QVector<int> & order )
+{
+	QVector<T> src = nif->getArray<T>( iArray );
+
+	if ( src.count() != order.count() )
+		return;
+
+	QVector<T> dst( src.count() );
+
+	for ( int i = 0; i < src.count(); i++ )
+		dst[order[i]] = src[i];
+
+	nif->setArray<T>( iArray, dst );
+}
+
+//! Write the reordered triangles and vertices of a shape
+static void writeTriangleOrder( NifModel * nif, const TriangleOrderJob & job )
+{
+	if ( !job.iData.isValid() || job.missesAfter >= job.missesBefore )
+		return;
+
+	nif->setArray<Triangle>( job.iData, "Triangles", job.tris );
+
+	if ( job.vertexOrder.isEmpty() )
+		return;
+
+	reorderArray<Vector3>( nif, nif->getIndex( job.iData, "Vertices" ), job.vertexOrder );
+	reorderArray<Vector3>( nif, nif->getIndex( job.iData, "Normals" ), job.vertexOrder );
+	reorderArray<Vector3>( nif, nif->getIndex( job.iData, "Tangents" ), job.vertexOrder );
+	reorderArray<Vector3>( nif, nif->getIndex( job.iData, "Bitangents" ), job.vertexOrder );
+	reorderArray<Color4>( nif, nif->getIndex( job.iData, "Vertex Colors" ), job.vertexOrder );
+
+	for ( const QString & name : { "UV Sets", "UV Sets 2" } ) {
+		QModelIndex iUVSets = nif->getIndex( job.iData, name );
+
+		for ( int r = 0; r < nif->rowCount( iUVSets ); r++ )
+			reorderArray<Vector2>( nif, iUVSets.child( r, 0 ), job.vertexOrder );
+	}
+}
+
+//! Optimize the triangle order of the shapes in parallel and report the average cache miss ratio
+static void updateTriangleOrders( NifModel * nif, const QList<QPersistentModelIndex> & shapes )
+{
+	QVector<TriangleOrderJob> jobs;
+	jobs.reserve( shapes.count() );
+
+	for ( const QPersistentModelIndex & iShape : shapes ) {
+		TriangleOrderJob job;
+
+		if ( iShape.isValid() && readTriangleOrder( nif, iShape, job ) )
+			jobs.append( job );
+	}
+
+	TriangleOrderJob * data = jobs.data();
+	Spell::parallelFor( jobs.count(), [data]( int i ) {
+		optimizeTriangleOrder( data[i] );
+	} );
+
+	// Update the model once after all shapes are written
+	bool oldHoldUpdates = nif->holdUpdates( true );
+
+	int numTris = 0, before = 0, after = 0, changed = 0;
+
+	for ( const TriangleOrderJob & job : jobs ) {
+		writeTriangleOrder( nif, job );
+
+		numTris += job.tris.count();
+		before += job.missesBefore;
+		after += job.missesAfter;
+		changed += ( job.missesAfter < job.missesBefore ) ? 1 : 0;
+	}
+
+	if ( !oldHoldUpdates )
+		nif->holdUpdates( false );
+
+	if ( numTris > 0 ) {
+		Message::info( nullptr, Spell::tr( "Reordered the triangles of %1 of %2 shapes" ).arg( changed ).arg( jobs.count() ),
+			Spell::tr( "Average cache miss ratio for a cache of %1 vertices: %2 before, %3 after" )
+			.arg( vertexCacheSize )
+			.arg( float( before ) / numTris, 0, 'f', 3 )
+			.arg( float( after ) / numTris, 0, 'f', 3 )
+		);
+	}
+}
+
+//! Reorder the triangles of a shape for the vertex cache, as an alternative to strips
+class spOptimizeTriangleOrder final : public Spell
+{
+public:
+	QString name() const override final { return Spell::tr( "Optimize Triangle Order" ); }
+	QString page() const override final { return Spell::tr( "Mesh" ); }
+
+	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
+	{
+		return canOrderTriangles( nif, nif->getBlock( index ) );
+	}
+
+	QModelIndex cast( NifModel * nif, const QModelIndex & index ) override final
+	{
+		QPersistentModelIndex idx = index;
+		updateTriangleOrders( nif, { nif->getBlock( index ) } );
+
+		return idx;
+	}
+};
+
+REGISTER_SPELL( spOptimizeTriangleOrder )
+
+//! Reorder the triangles of all shapes for the vertex cache
+class spOptimizeAllTriangleOrders final : public Spell
+{
+public:
+	QString name() const override final { return Spell::tr( "Optimize Triangle Order of all Shapes" ); }
+	QString page() const override final { return Spell::tr( "Optimize" ); }
+
+	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
+	{
+		return nif && !index.isValid();
+	}
+
+	QModelIndex cast( NifModel * nif, const QModelIndex & ) override final
+	{
+		QList<QPersistentModelIndex> shapes;
+
+		for ( int l = 0; l < nif->getBlockCount(); l++ ) {
+			QModelIndex idx = nif->getBlock( l );
+
+			if ( canOrderTriangles( nif, idx ) )
+				shapes << idx;
+		}
+
+		updateTriangleOrders( nif, shapes );
+
+		return QModelIndex();
+	}
+};
+
+REGISTER_SPELL( spOptimizeAllTriangleOrders )
@@ -1,5 +1,6 @@
 #include "tangentspace.h"
 
+#include "nifsnapshot.h"
 #include "nvtristripwrapper.h"
 
 
@@ -38,19 +39,53 @@ bool spTangentSpace::isApplicable( const NifModel * nif, const QModelIndex & ind
 	return false;
 }
 
-QModelIndex spTangentSpace::cast( NifModel * nif, const QModelIndex & iBlock )
+//! The geometry of a shape read for the tangents and bitangents, and the result
+struct TangentSpaceJob
 {
-	QPersistentModelIndex iShape = iBlock;
-
-	QModelIndex iData;
-	if ( nif->getUserVersion2() < 130 )
-		iData = nif->getBlock( nif->getLink( iShape, "Data" ) );
-	else
-		iData = nif->getIndex( iShape, "Vertex Data" );
+	QPersistentModelIndex iShape;
+	QPersistentModelIndex iData;
 
 	QVector<Vector3> verts;
 	QVector<Vector3> norms;
 	QVector<Vector2> texco;
+	QVector<Triangle> triangles;
+	int numUVSets = 0;
+	int tspaceFlags = 0;
+
+	QVector<Vector3> tan;
+	QVector<Vector3> bin;
+};
+
+//! Why the geometry of a job is not enough to calculate its tangents, empty if it is
+static QString checkTangentSpace( int block, const TangentSpaceJob & job )
+{
+	if ( job.verts.isEmpty() || job.norms.count() != job.verts.count() || job.texco.count() != job.verts.count() || job.triangles.isEmpty() ) {
+		return Spell::tr( "Block %1: Insufficient information to calculate tangents and bitangents. V: %2, N: %3, Tex: %4, Tris: %5" )
+			.arg( block )
+			.arg( job.verts.count() )
+			.arg( job.norms.count() )
+			.arg( job.texco.count() )
+			.arg( job.triangles.count() );
+	}
+
+	return QString();
+}
+
+//! Read the geometry of a shape, false with a message if there is not enough
+static bool readTangentSpace( const NifModel * nif, const QModelIndex & iBlock, TangentSpaceJob & job )
+{
+	job.iShape = iBlock;
+	const QPersistentModelIndex & iShape = job.iShape;
+
+	if ( nif->getUserVersion2() < 130 )
+		job.iData = nif->getBlock( nif->getLink( iShape, "Data" ) );
+	else
+		job.iData = nif->getIndex( iShape, "Vertex Data" );
+
+	const QPersistentModelIndex & iData = job.iData;
+	QVector<Vector3> & verts = job.verts;
+	QVector<Vector3> & norms = job.norms;
+	QVector<Vector2> & texco = job.texco;
 
 	if ( nif->getUserVersion2() < 130 ) {
 		verts = nif->getArray<Vector3>( iData, "Vertices" );
@@ -58,17 +93,32 @@ QModelIndex spTangentSpace::cast( NifModel * nif, const QModelIndex & iBlock )
 	} else {
 		int numVerts = nif->get<int>( iShape, "Num Vertices" );
 
-		for ( int i = 0; i < numVerts; i++ ) {
-			auto idx = nif->index( i, 0, iData );
-			verts += nif->get<Vector3>( idx, "Vertex" );
-			norms += nif->get<ByteVector3>( idx, "Normal" );;
-			texco += nif->get<HalfVector2>( idx, "UV" );
+		// Every vertex has the same fields, find their rows once
+		static const NifFieldId fVertex( "Vertex" );
+		static const NifFieldId fNormal( "Normal" );
+		static const NifFieldId fUV( "UV" );
+
+		auto first = nif->index( 0, 0, iData );
+		int rVertex = nif->getIndex( first, fVertex ).row();
+		int rNormal = nif->getIndex( first, fNormal ).row();
+		int rUV = nif->getIndex( first, fUV ).row();
+
+		if ( rVertex >= 0 && rNormal >= 0 && rUV >= 0 ) {
+			verts.reserve( numVerts );
+			norms.reserve( numVerts );
+			texco.reserve( numVerts );
+
+			for ( int i = 0; i < numVerts; i++ ) {
+				auto idx = nif->index( i, 0, iData );
+				verts += nif->get<Vector3>( nif->index( rVertex, 0, idx ) );
+				norms += nif->get<ByteVector3>( nif->index( rNormal, 0, idx ) );
+				texco += nif->get<HalfVector2>( nif->index( rUV, 0, idx ) );
+			}
 		}
 	}
 
-	QVector<Color4> vxcol = nif->getArray<Color4>( iData, "Vertex Colors" );
-	int numUVSets = nif->get<int>( iData, "Num UV Sets" );
-	int tspaceFlags = nif->get<int>( iData, "TSpace Flag" );
+	job.numUVSets = nif->get<int>( iData, "Num UV Sets" );
+	job.tspaceFlags = nif->get<int>( iData, "TSpace Flag" );
 
 	if ( nif->getUserVersion2() < 130 ) {
 		QModelIndex iTexCo = nif->getIndex( iData, "UV Sets" );
@@ -81,7 +131,7 @@ QModelIndex spTangentSpace::cast( NifModel * nif, const QModelIndex & iBlock )
 	}
 
 
-	QVector<Triangle> triangles;
+	QVector<Triangle> & triangles = job.triangles;
 	QModelIndex iPoints = nif->getIndex( iData, "Points" );
 
 	if ( iPoints.isValid() ) {
@@ -97,22 +147,106 @@ QModelIndex spTangentSpace::cast( NifModel * nif, const QModelIndex & iBlock )
 		triangles = nif->getArray<Triangle>( iShape, "Triangles" );
 	}
 
-	if ( verts.isEmpty() || norms.count() != verts.count() || texco.count() != verts.count() || triangles.isEmpty() ) {
-		Message::append( tr( "Update Tangent Spaces failed on one or more blocks." ),
-			tr( "Block %1: Insufficient information to calculate tangents and bitangents. V: %2, N: %3, Tex: %4, Tris: %5" )
-			.arg( nif->getBlockNumber( iBlock ) )
-			.arg( verts.count() )
-			.arg( norms.count() )
-			.arg( texco.count() )
-			.arg( triangles.count() )
-		);
-		return iBlock;
+	QString error = checkTangentSpace( nif->getBlockNumber( iBlock ), job );
+	if ( !error.isEmpty() ) {
+		Message::append( Spell::tr( "Update Tangent Spaces failed on one or more blocks." ), error );
+		return false;
+	}
+
+	return true;
+}
+
+//! Read the geometry of a shape from a snapshot, false with the reason in \a error if there is not enough
+/*!
+ * As readTangentSpace() above, but safe on any thread. The indices of the
+ * job are left for the GUI thread to find.
+ */
+static bool readTangentSpace( const NifSnapshot & snapshot, int block, TangentSpaceJob & job, QString & error )
+{
+	const int iShape = snapshot.block( block );
+	const quint32 userVersion2 = snapshot.get<quint32>( snapshot.header(), "User Version 2" );
+
+	int iData;
+	if ( userVersion2 < 130 )
+		iData = snapshot.block( snapshot.getLink( iShape, "Data" ) );
+	else
+		iData = snapshot.child( iShape, "Vertex Data" );
+
+	if ( userVersion2 < 130 ) {
+		job.verts = snapshot.getArray<Vector3>( iData, "Vertices" );
+		job.norms = snapshot.getArray<Vector3>( iData, "Normals" );
+	} else {
+		int numVerts = qMin( snapshot.get<int>( iShape, "Num Vertices" ), snapshot.rowCount( iData ) );
+
+		// Every vertex has the same fields, find their rows once
+		const int first = snapshot.child( iData, 0 );
+		auto rowOf = [&snapshot, first]( const QString & name ) {
+			int field = snapshot.child( first, name );
+			return ( field >= 0 ) ? field - snapshot.child( first, 0 ) : -1;
+		};
+
+		int rVertex = rowOf( "Vertex" );
+		int rNormal = rowOf( "Normal" );
+		int rUV = rowOf( "UV" );
+
+		if ( rVertex >= 0 && rNormal >= 0 && rUV >= 0 ) {
+			job.verts.reserve( numVerts );
+			job.norms.reserve( numVerts );
+			job.texco.reserve( numVerts );
+
+			for ( int i = 0; i < numVerts; i++ ) {
+				int vertex = snapshot.child( iData, i );
+				job.verts += snapshot.get<Vector3>( snapshot.child( vertex, rVertex ) );
+				job.norms += snapshot.get<ByteVector3>( snapshot.child( vertex, rNormal ) );
+				job.texco += snapshot.get<HalfVector2>( snapshot.child( vertex, rUV ) );
+			}
+		}
+	}
+
+	job.numUVSets = snapshot.get<int>( iData, "Num UV Sets" );
+	job.tspaceFlags = snapshot.get<int>( iData, "TSpace Flag" );
+
+	if ( userVersion2 < 130 ) {
+		int iTexCo = snapshot.child( iData, "UV Sets" );
+
+		if ( iTexCo < 0 )
+			iTexCo = snapshot.child( iData, "UV Sets 2" );
+
+		job.texco = snapshot.getArray<Vector2>( snapshot.child( iTexCo, 0 ) );
 	}
 
-	QVector<Vector3> tan( verts.count() );
-	QVector<Vector3> bin( verts.count() );
+	int iPoints = snapshot.child( iData, "Points" );
+
+	if ( iPoints >= 0 ) {
+		QList<QVector<quint16> > strips;
+
+		for ( int r = 0; r < snapshot.rowCount( iPoints ); r++ )
+			strips.append( snapshot.getArray<quint16>( snapshot.child( iPoints, r ) ) );
+
+		job.triangles = triangulate( strips );
+	} else if ( userVersion2 < 130 ) {
+		job.triangles = snapshot.getArray<Triangle>( iData, "Triangles" );
+	} else if ( userVersion2 == 130 ) {
+		job.triangles = snapshot.getArray<Triangle>( iShape, "Triangles" );
+	}
 
-	QMultiHash<int, int> vmap;
+	error = checkTangentSpace( block, job );
+
+	return error.isEmpty();
+}
+
+//! Calculate the tangents and bitangents; only touches the job, so it may run on any thread
+static void computeTangentSpace( TangentSpaceJob & job )
+{
+	const QVector<Vector3> & verts = job.verts;
+	const QVector<Vector3> & norms = job.norms;
+	const QVector<Vector2> & texco = job.texco;
+	const QVector<Triangle> & triangles = job.triangles;
+
+	QVector<Vector3> & tan = job.tan;
+	QVector<Vector3> & bin = job.bin;
+	tan.fill( Vector3(), verts.count() );
+	bin.fill( Vector3(), verts.count() );
 
 	//int skptricnt = 0;
 
@@ -120,7 +254,7 @@ QModelIndex spTangentSpace::cast( NifModel * nif, const QModelIndex & iBlock )
 		// for each triangle caculate the texture flow direction
 		//qDebug() << "triangle" << t;
 
-		Triangle & tri = triangles[t];
+		const Triangle & tri = triangles[t];
 
 		int i1 = tri[0];
 		int i2 = tri[1];
@@ -214,8 +348,16 @@ QModelIndex spTangentSpace::cast( NifModel * nif, const QModelIndex & iBlock )
 		//qDebug() << n << t << b;
 		//qDebug() << "";
 	}
+}
 
-	//qDebug() << "unassigned vertices" << cnt;
+//! Write the tangents and bitangents of a job to its shape
+static void writeTangentSpace( NifModel * nif, const TangentSpaceJob & job )
+{
+	const QPersistentModelIndex & iShape = job.iShape;
+	const QPersistentModelIndex & iData = job.iData;
+	const QVector<Vector3> & tan = job.tan;
+	const QVector<Vector3> & bin = job.bin;
+	int tspaceFlags = job.tspaceFlags;
 
 	bool isOblivion = false;
 
@@ -247,13 +389,13 @@ QModelIndex spTangentSpace::cast( NifModel * nif, const QModelIndex & iBlock )
 			}
 		}
 
-		nif->set<QByteArray>( iTSpace, "Binary Data", QByteArray( (const char *)tan.data(), tan.count() * sizeof( Vector3 ) ) + QByteArray( (const char *)bin.data(), bin.count() * sizeof( Vector3 ) ) );
+		nif->set<QByteArray>( iTSpace, "Binary Data", QByteArray( (const char *)tan.constData(), tan.count() * sizeof( Vector3 ) ) + QByteArray( (const char *)bin.constData(), bin.count() * sizeof( Vector3 ) ) );
 	} else if ( nif->getUserVersion2() < 130 ) {
 		if ( tspaceFlags == 0 )
 			tspaceFlags = 0x10;
 
 		nif->set<int>( iShape, "TSpace Flag", tspaceFlags );
-		nif->set<int>( iShape, "Num UV Sets", numUVSets );
+		nif->set<int>( iShape, "Num UV Sets", job.numUVSets );
 		QModelIndex iBinorms  = nif->getIndex( iData, "Bitangents" );
 		QModelIndex iTangents = nif->getIndex( iData, "Tangents" );
 		nif->updateArray( iBinorms );
@@ -262,26 +404,144 @@ QModelIndex spTangentSpace::cast( NifModel * nif, const QModelIndex & iBlock )
 		nif->setArray( iTangents, tan );
 	} else if ( nif->getUserVersion2() == 130 ) {
 
-		int numVerts = nif->get<int>( iShape, "Num Vertices" );
+		int numVerts = qMin( nif->get<int>( iShape, "Num Vertices" ), tan.count() );
+
+		static const NifFieldId fTangent( "Tangent" );
+		static const NifFieldId fBitangentX( "Bitangent X" );
+		static const NifFieldId fBitangentY( "Bitangent Y" );
+		static const NifFieldId fBitangentZ( "Bitangent Z" );
+
+		auto first = nif->index( 0, 0, iData );
+		int rTangent = nif->getIndex( first, fTangent ).row();
+		int rBitangentX = nif->getIndex( first, fBitangentX ).row();
+		int rBitangentY = nif->getIndex( first, fBitangentY ).row();
+		int rBitangentZ = nif->getIndex( first, fBitangentZ ).row();
+
+		if ( rTangent < 0 || rBitangentX < 0 || rBitangentY < 0 || rBitangentZ < 0 )
+			return;
+
+		// Pause updates between model/view
+		nif->setEmitChanges( false );
 		for ( int i = 0; i < numVerts; i++ ) {
+			// Unpause updates if last
+			if ( i == numVerts - 1 )
+				nif->setEmitChanges( true );
+
 			auto idx = nif->index( i, 0, iData );
 
-			nif->set<Vector3>( idx, "Tangent", tan[i] );
-			nif->set<float>( idx, "Bitangent X", bin[i][0] );
+			nif->set<Vector3>( nif->index( rTangent, 0, idx ), tan[i] );
+			nif->set<float>( nif->index( rBitangentX, 0, idx ), bin[i][0] );
 
 			auto bitYi = round( ((bin[i][1] + 1.0) / 2.0) * 255.0 );
 			auto bitZi = round( ((bin[i][2] + 1.0) / 2.0) * 255.0 );
-			
-			nif->set<quint8>( idx, "Bitangent Y", bitYi );
-			nif->set<quint8>( idx, "Bitangent Z", bitZi );
+
+			nif->set<quint8>( nif->index( rBitangentY, 0, idx ), bitYi );
+			nif->set<quint8>( nif->index( rBitangentZ, 0, idx ), bitZi );
 		}
 	}
+}
+
+//! Update the tangent spaces of many shapes, calculating them in parallel
+static void updateTangentSpaces( NifModel * nif, const QList<QPersistentModelIndex> & shapes )
+{
+	QVector<TangentSpaceJob> jobs;
+	jobs.reserve( shapes.count() );
+
+	for ( const QPersistentModelIndex & iShape : shapes ) {
+		TangentSpaceJob job;
+
+		if ( iShape.isValid() && readTangentSpace( nif, iShape, job ) )
+			jobs.append( job );
+	}
+
+	TangentSpaceJob * data = jobs.data();
+	Spell::parallelFor( jobs.count(), [data]( int i ) {
+		computeTangentSpace( data[i] );
+	} );
+
+	// Update the model once after all shapes are written
+	bool oldHoldUpdates = nif->holdUpdates( true );
+
+	for ( const TangentSpaceJob & job : jobs )
+		writeTangentSpace( nif, job );
 
-	return iShape;
+	if ( !oldHoldUpdates )
+		nif->holdUpdates( false );
+}
+
+QModelIndex spTangentSpace::cast( NifModel * nif, const QModelIndex & iBlock )
+{
+	TangentSpaceJob job;
+
+	if ( !readTangentSpace( nif, iBlock, job ) )
+		return iBlock;
+
+	computeTangentSpace( job );
+	writeTangentSpace( nif, job );
+
+	return job.iShape;
 }
 
 REGISTER_SPELL( spTangentSpace )
 
+//! Updates the tangent spaces of many shapes, reading and calculating them on a worker thread
+class TangentSpaceTask final : public SpellTask
+{
+public:
+	TangentSpaceTask( const QVector<int> & shapes ) : blocks( shapes ) {}
+
+	void compute( const NifSnapshot & snapshot, SpellProgress & progress ) override final
+	{
+		jobs.resize( blocks.count() );
+		errors.resize( blocks.count() );
+		progress.setMaximum( blocks.count() );
+
+		Spell::parallelFor( blocks.count(), [this, &snapshot, &progress]( int i ) {
+			if ( progress.isCanceled() )
+				return;
+
+			if ( readTangentSpace( snapshot, blocks.at( i ), jobs[i], errors[i] ) )
+				computeTangentSpace( jobs[i] );
+
+			progress.step();
+		} );
+	}
+
+	QModelIndex commit( NifModel * nif ) override final
+	{
+		// Writing may insert blocks, so every shape is found first
+		for ( int i = 0; i < jobs.count(); i++ ) {
+			TangentSpaceJob & job = jobs[i];
+			job.iShape = nif->getBlock( blocks.at( i ) );
+
+			if ( nif->getUserVersion2() < 130 )
+				job.iData = nif->getBlock( nif->getLink( job.iShape, "Data" ) );
+			else
+				job.iData = nif->getIndex( job.iShape, "Vertex Data" );
+		}
+
+		// Update the model once after all shapes are written
+		bool oldHoldUpdates = nif->holdUpdates( true );
+
+		for ( int i = 0; i < jobs.count(); i++ ) {
+			if ( !errors.at( i ).isEmpty() )
+				Message::append( Spell::tr( "Update Tangent Spaces failed on one or more blocks." ), errors.at( i ) );
+			else if ( jobs.at( i ).iShape.isValid() )
+				writeTangentSpace( nif, jobs.at( i ) );
+		}
+
+		if ( !oldHoldUpdates )
+			nif->holdUpdates( false );
+
+		return QModelIndex();
+	}
+
+protected:
+	QVector<int> blocks;
+	QVector<TangentSpaceJob> jobs;
+	QVector<QString> errors;
+};
+
 class spAllTangentSpaces final : public Spell
 {
 public:
@@ -304,24 +564,23 @@ public:
 		return false;
 	}
 
-	QModelIndex cast( NifModel * nif, const QModelIndex & ) override final
+	SpellTaskPtr task( const NifModel * nif, const QModelIndex & ) override final
 	{
-		QList<QPersistentModelIndex> indices;
+		QVector<int> blocks;
 
 		spTangentSpace TSpacer;
 
 		for ( int n = 0; n < nif->getBlockCount(); n++ ) {
-			QModelIndex idx = nif->getBlock( n );
-
-			if ( TSpacer.isApplicable( nif, idx ) )
-				indices << idx;
+			if ( TSpacer.isApplicable( nif, nif->getBlock( n ) ) )
+				blocks << n;
 		}
 
-		for ( const QModelIndex& idx : indices ) {
-			TSpacer.castIfApplicable( nif, idx );
-		}
+		return std::make_shared<TangentSpaceTask>( blocks );
+	}
 
-		return QModelIndex();
+	QModelIndex cast( NifModel * nif, const QModelIndex & index ) override final
+	{
+		return castTask( nif, index );
 	}
 };
 
@@ -341,7 +600,7 @@ public:
 
 	QModelIndex cast( NifModel * nif, const QModelIndex & ) override final
 	{
-		QVector<QModelIndex> blks;
+		QList<QPersistentModelIndex> blks;
 		for ( int l = 0; l < nif->getBlockCount(); l++ ) {
 			QModelIndex idx = nif->getBlock( l, "NiTriShape" );
 			if ( !idx.isValid() )
@@ -365,9 +624,7 @@ public:
 			blks << idx;
 		}
 
-		spTangentSpace update;
-		for ( auto& b : blks )
-			update.cast( nif, b );
+		updateTangentSpaces( nif, blks );
 
 		return QModelIndex();
 	}
@@ -2,22 +2,29 @@
 #include "config.h"
 
 #include "blocks.h"
+#include "message.h"
 #include "nvtristripwrapper.h"
 #include "spellbook.h"
 #include "gl/gltex.h"
+#include "gl/gltexloaders.h"
 #include "widgets/fileselect.h"
 #include "widgets/nifeditors.h"
+#include "widgets/thumbnails.h"
 #include "widgets/uvedit.h"
 
 #include <QButtonGroup>
 #include <QCheckBox>
 #include <QColorDialog>
 #include <QComboBox>
+#include <QDir>
 #include <QFileDialog>
+#include <QFileInfo>
 #include <QGridLayout>
 #include <QLabel>
 #include <QListView>
 #include <QPushButton>
+#include <QSaveFile>
+#include <QSet>
 #include <QSettings>
 #include <QStringListModel>
 
@@ -159,6 +166,7 @@ class spChooseTexture final : public Spell
 public:
 	QString name() const override final { return Spell::tr( "Choose" ); }
 	QString page() const override final { return Spell::tr( "Texture" ); }
+	bool interactive() const override final { return true; }
 	bool instant() const { return true; }
 	QIcon icon() const
 	{
@@ -168,6 +176,11 @@ public:
 		return *tex42_xpm_icon;
 	}
 
+	QStringList applicableBlocks() const override final
+	{
+		return { "NiSourceTexture", "NiImage", "BSShaderNoLightingProperty", "BSShaderTextureSet", "SkyShaderProperty", "TileShaderProperty" };
+	}
+
 	bool isApplicable( const NifModel * nif, const QModelIndex & idx ) override final
 	{
 		QModelIndex iBlock = nif->getBlock( idx );
@@ -227,7 +240,21 @@ public:
 
 
 		// to avoid shortcut resolve bug take *.* as text filter
-		file = QFileDialog::getOpenFileName( qApp->activeWindow(), "Select a texture file", file, "*.*" );
+		QFileDialog dlg( qApp->activeWindow(), "Select a texture file", file, "*.*" );
+		dlg.setFileMode( QFileDialog::ExistingFile );
+
+		// The dialog of the platform cannot show the thumbnails of DDS files
+		dlg.setOption( QFileDialog::DontUseNativeDialog );
+		dlg.setProxyModel( new ThumbnailProxyModel( &dlg ) );
+
+		if ( QListView * view = dlg.findChild<QListView *>( "listView" ) ) {
+			view->setViewMode( QListView::IconMode );
+			view->setIconSize( QSize( ThumbnailCache::Size, ThumbnailCache::Size ) );
+			view->setGridSize( QSize( ThumbnailCache::Size * 2, ThumbnailCache::Size + 32 ) );
+			view->setWordWrap( true );
+		}
+
+		file = ( dlg.exec() == QDialog::Accepted ) ? dlg.selectedFiles().value( 0 ) : QString();
 
 		if ( !file.isEmpty() ) {
 			// save path for future
@@ -259,6 +286,7 @@ class spEditTexCoords final : public Spell
 public:
 	QString name() const override final { return Spell::tr( "Edit UV" ); }
 	QString page() const override final { return Spell::tr( "Texture" ); }
+	bool interactive() const override final { return true; }
 
 	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
 	{
@@ -321,6 +349,7 @@ class spAddBaseMap final : public Spell
 public:
 	QString name() const override final { return Spell::tr( "Add Base Texture" ); }
 	QString page() const override final { return Spell::tr( "Texture" ); }
+	bool interactive() const override final { return true; }
 
 	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
 	{
@@ -342,6 +371,7 @@ class spAddDarkMap final : public Spell
 public:
 	QString name() const override final { return Spell::tr( "Add Dark Map" ); }
 	QString page() const override final { return Spell::tr( "Texture" ); }
+	bool interactive() const override final { return true; }
 
 	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
 	{
@@ -363,6 +393,7 @@ class spAddDetailMap final : public Spell
 public:
 	QString name() const override final { return Spell::tr( "Add Detail Map" ); }
 	QString page() const override final { return Spell::tr( "Texture" ); }
+	bool interactive() const override final { return true; }
 
 	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
 	{
@@ -384,6 +415,7 @@ class spAddGlowMap final : public Spell
 public:
 	QString name() const override final { return Spell::tr( "Add Glow Map" ); }
 	QString page() const override final { return Spell::tr( "Texture" ); }
+	bool interactive() const override final { return true; }
 
 	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
 	{
@@ -405,6 +437,7 @@ class spAddBumpMap final : public Spell
 public:
 	QString name() const override final { return Spell::tr( "Add Bump Map" ); }
 	QString page() const override final { return Spell::tr( "Texture" ); }
+	bool interactive() const override final { return true; }
 
 	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
 	{
@@ -435,6 +468,7 @@ class spAddDecal0Map final : public Spell
 public:
 	QString name() const override final { return Spell::tr( "Add Decal 0 Map" ); }
 	QString page() const override final { return Spell::tr( "Texture" ); }
+	bool interactive() const override final { return true; }
 
 	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
 	{
@@ -456,6 +490,7 @@ class spAddDecal1Map final : public Spell
 public:
 	QString name() const override final { return Spell::tr( "Add Decal 1 Map" ); }
 	QString page() const override final { return Spell::tr( "Texture" ); }
+	bool interactive() const override final { return true; }
 
 	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
 	{
@@ -477,6 +512,7 @@ class spAddDecal2Map final : public Spell
 public:
 	QString name() const override final { return Spell::tr( "Add Decal 2 Map" ); }
 	QString page() const override final { return Spell::tr( "Texture" ); }
+	bool interactive() const override final { return true; }
 
 	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
 	{
@@ -498,6 +534,7 @@ class spAddDecal3Map final : public Spell
 public:
 	QString name() const override final { return Spell::tr( "Add Decal 3 Map" ); }
 	QString page() const override final { return Spell::tr( "Texture" ); }
+	bool interactive() const override final { return true; }
 
 	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
 	{
@@ -521,6 +558,7 @@ class spTextureTemplate final : public Spell
 {
 	QString name() const override final { return Spell::tr( "Export Template" ); }
 	QString page() const override final { return Spell::tr( "Texture" ); }
+	bool interactive() const override final { return true; }
 
 	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
 	{
@@ -708,6 +746,7 @@ class spMultiApplyMode final : public Spell
 public:
 	QString name() const override final { return Spell::tr( "Multi Apply Mode" ); }
 	QString page() const override final { return Spell::tr( "Batch" ); }
+	bool interactive() const override final { return true; }
 
 	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
 	{
@@ -805,6 +844,7 @@ class spTexInfo final : public Spell
 public:
 	QString name() const override final { return Spell::tr( "Info" ); }
 	QString page() const override final { return Spell::tr( "Texture" ); }
+	bool interactive() const override final { return true; }
 
 	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
 	{
@@ -844,6 +884,7 @@ class spExportTexture final : public Spell
 public:
 	QString name() const override final { return Spell::tr( "Export" ); }
 	QString page() const override final { return Spell::tr( "Texture" ); }
+	bool interactive() const override final { return true; }
 
 	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
 	{
@@ -918,6 +959,7 @@ class spEmbedTexture final : public Spell
 public:
 	QString name() const override final { return Spell::tr( "Embed" ); }
 	QString page() const override final { return Spell::tr( "Texture" ); }
+	bool interactive() const override final { return true; }
 
 	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
 	{
@@ -985,6 +1027,250 @@ public:
 
 REGISTER_SPELL( spEmbedTexture )
 
+//! A texture written to a file by spExportAllTextures
+struct TextureExportJob
+{
+	QPersistentModelIndex iSource;
+	TexPixelData pixelData;
+	QString filepath;
+	bool saved = false;
+};
+
+//! Export all packed NiPixelData textures as DDS files
+/*!
+ * The pixel data is copied from the model first; the files are then encoded
+ * and written on all cores, without a GL context. The mipmaps keep the format
+ * they are stored in. Without a GUI, the files are written next to the NIF.
+ */
+class spExportAllTextures final : public Spell
+{
+public:
+	QString name() const override final { return Spell::tr( "Export All Textures" ); }
+	QString page() const override final { return Spell::tr( "Batch" ); }
+	bool interactive() const override final { return true; }
+
+	static bool isEmbedded( const NifModel * nif, const QModelIndex & iBlock )
+	{
+		return nif->isNiBlock( iBlock, "NiSourceTexture" ) && nif->get<int>( iBlock, "Use External" ) == 0
+		       && nif->getBlock( nif->getLink( iBlock, "Pixel Data" ) ).isValid();
+	}
+
+	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
+	{
+		if ( !nif || index.isValid() )
+			return false;
+
+		for ( int n = 0; n < nif->getBlockCount(); n++ ) {
+			if ( isEmbedded( nif, nif->getBlock( n ) ) )
+				return true;
+		}
+
+		return false;
+	}
+
+	QModelIndex cast( NifModel * nif, const QModelIndex & ) override final
+	{
+		QString folder = nif->getFolder();
+
+		if ( Message::hasGui() )
+			folder = QFileDialog::getExistingDirectory( qApp->activeWindow(), Spell::tr( "Export textures to" ), folder );
+
+		if ( folder.isEmpty() )
+			return QModelIndex();
+
+		QVector<TextureExportJob> jobs;
+		QSet<QString> taken;
+
+		for ( int n = 0; n < nif->getBlockCount(); n++ ) {
+			QModelIndex iBlock = nif->getBlock( n );
+
+			if ( !isEmbedded( nif, iBlock ) )
+				continue;
+
+			TextureExportJob job;
+			job.iSource = iBlock;
+
+			if ( !texReadPixelData( nif->getBlock( nif->getLink( iBlock, "Pixel Data" ) ), job.pixelData ) )
+				continue;
+
+			QString file = nif->get<QString>( iBlock, "File Name" );
+
+			if ( file.isEmpty() )
+				file = nif->get<QString>( iBlock, "Name" );
+
+			file = QFileInfo( QDir::fromNativeSeparators( file ) ).completeBaseName();
+
+			if ( file.isEmpty() )
+				file = nif->getFileInfo().completeBaseName();
+
+			// Several textures may come from files of the same name
+			if ( file.isEmpty() || taken.contains( file.toLower() ) )
+				file += QString( "_%1" ).arg( n );
+
+			taken.insert( file.toLower() );
+			job.filepath = QDir( folder ).filePath( file + ".dds" );
+			jobs.append( job );
+		}
+
+		Spell::parallelFor( jobs.count(), [&jobs]( int i ) {
+			TextureExportJob & job = jobs[i];
+			QSaveFile f( job.filepath );
+			QByteArray dds = texEncodeDDS( job.pixelData );
+			job.saved = f.open( QIODevice::WriteOnly ) && f.write( dds ) == dds.size() && f.commit();
+		}, Spell::tr( "Exporting textures" ) );
+
+		bool old = nif->holdUpdates( true );
+
+		for ( const TextureExportJob & job : jobs ) {
+			if ( !job.saved ) {
+				Message::append( Spell::tr( "Some textures could not be exported." ), job.filepath );
+				continue;
+			}
+
+			nif->set<int>( job.iSource, "Use External", 1 );
+			nif->set<QString>( job.iSource, "File Name", TexCache::stripPath( job.filepath, nif->getFolder() ) );
+		}
+
+		if ( !old )
+			nif->holdUpdates( false );
+
+		return QModelIndex();
+	}
+};
+
+REGISTER_SPELL( spExportAllTextures )
+
+//! An external texture read by spEmbedAllTextures
+struct TextureEmbedJob
+{
+	int block;
+	QString file;
+	QString filepath;
+	QByteArray data;
+};
+
+//! Pack all external DDS textures to NiPixelData
+/*!
+ * The files are found and read on all cores, from the folders or the
+ * archives, and copied as they are stored, without a GL context. TGA and BMP
+ * files are read back from GL, so they are left to spEmbedTexture.
+ */
+class spEmbedAllTextures final : public Spell
+{
+public:
+	QString name() const override final { return Spell::tr( "Embed All Textures" ); }
+	QString page() const override final { return Spell::tr( "Batch" ); }
+	bool interactive() const override final { return true; }
+
+	static bool isExternal( const NifModel * nif, const QModelIndex & iBlock )
+	{
+		if ( !( nif->isNiBlock( iBlock, "NiSourceTexture" ) && nif->get<int>( iBlock, "Use External" ) == 1 ) )
+			return false;
+
+		QString file = nif->get<QString>( iBlock, "File Name" );
+
+		return file.endsWith( ".dds", Qt::CaseInsensitive ) || file.endsWith( ".nif", Qt::CaseInsensitive )
+		       || file.endsWith( ".texcache", Qt::CaseInsensitive );
+	}
+
+	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
+	{
+		if ( !nif || index.isValid() )
+			return false;
+
+		if ( !( nif->checkVersion( 0, 0x0A020000 ) || nif->checkVersion( 0x14000004, 0 ) ) )
+			return false;
+
+		for ( int n = 0; n < nif->getBlockCount(); n++ ) {
+			if ( isExternal( nif, nif->getBlock( n ) ) )
+				return true;
+		}
+
+		return false;
+	}
+
+	QModelIndex cast( NifModel * nif, const QModelIndex & ) override final
+	{
+		QVector<TextureEmbedJob> jobs;
+
+		for ( int n = 0; n < nif->getBlockCount(); n++ ) {
+			QModelIndex iBlock = nif->getBlock( n );
+
+			if ( isExternal( nif, iBlock ) ) {
+				TextureEmbedJob job;
+				job.block = n;
+				job.file = nif->get<QString>( iBlock, "File Name" );
+				jobs.append( job );
+			}
+		}
+
+		QString folder = nif->getFolder();
+
+		Spell::parallelFor( jobs.count(), [&jobs, &folder]( int i ) {
+			TextureEmbedJob & job = jobs[i];
+			job.filepath = TexCache::find( job.file, folder, job.data );
+
+			if ( job.data.isEmpty() ) {
+				QFile f( job.filepath );
+
+				if ( f.open( QIODevice::ReadOnly ) )
+					job.data = f.readAll();
+			}
+		}, Spell::tr( "Reading textures" ) );
+
+		bool old = nif->holdUpdates( true );
+
+		// Inserting the pixel data after the source texture moves the blocks behind it
+		for ( int i = jobs.count() - 1; i >= 0; i-- ) {
+			const TextureEmbedJob & job = jobs[i];
+
+			if ( job.data.isEmpty() ) {
+				Message::append( Spell::tr( "Some textures could not be found." ), job.file );
+				continue;
+			}
+
+			nif->insertNiBlock( "NiPixelData", job.block + 1 );
+			QModelIndex iSourceTexture = nif->getBlock( job.block, "NiSourceTexture" );
+			QModelIndex iPixelData = nif->getBlock( job.block + 1, "NiPixelData" );
+
+			bool saved;
+
+			try
+			{
+				saved = texSaveNIF( nif, job.filepath, job.data, iPixelData );
+			}
+			catch ( QString & )
+			{
+				saved = false;
+			}
+
+			if ( !saved ) {
+				nif->removeNiBlock( job.block + 1 );
+				Message::append( Spell::tr( "Some textures could not be embedded." ), job.file );
+				continue;
+			}
+
+			QString file = TexCache::stripPath( job.file, folder );
+			nif->set<int>( iSourceTexture, "Use External", 0 );
+			nif->set<int>( iSourceTexture, "Unknown Byte", 1 );
+			nif->setLink( iSourceTexture, "Pixel Data", job.block + 1 );
+
+			if ( nif->checkVersion( 0x0A010000, 0 ) ) {
+				nif->set<QString>( iSourceTexture, "File Name", file );
+			} else {
+				nif->set<QString>( iSourceTexture, "Name", file );
+			}
+		}
+
+		if ( !old )
+			nif->holdUpdates( false );
+
+		return QModelIndex();
+	}
+};
+
+REGISTER_SPELL( spEmbedAllTextures )
+
 TexFlipDialog::TexFlipDialog( NifModel * nif, QModelIndex & index, QWidget * parent ) : QDialog( parent )
 {
 	this->nif = nif;
@@ -1120,6 +1406,7 @@ class spEditFlipper final : public Spell
 public:
 	QString name() const override final { return Spell::tr( "Edit Flip Controller" ); }
 	QString page() const override final { return Spell::tr( "Texture" ); }
+	bool interactive() const override final { return true; }
 
 	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
 	{
@@ -15,6 +15,7 @@
 #include <QMimeData>
 #include <QPushButton>
 #include <QSettings>
+#include <QStack>
 
 
 /* XPM */
@@ -184,6 +185,212 @@ QModelIndex spApplyTransformation::cast( NifModel * nif, const QModelIndex & ind
 
 REGISTER_SPELL( spApplyTransformation )
 
+//! A block below the branch and the transform it gets
+struct BranchTransform
+{
+	qint32 block;
+	Transform t;
+};
+
+//! The geometry data of shapes whose world transform is applied to their vertices
+struct ApplyTransformJob
+{
+	QPersistentModelIndex iData;
+	Transform t;
+	QVector<Vector3> verts;
+	//! Normals, tangents and bitangents, which are only rotated
+	QVector<QVector<Vector3>> directions;
+	Vector3 center;
+	float radius = 0;
+};
+
+//! The arrays of ApplyTransformJob::directions
+static const QStringList transformDirections = { "Normals", "Tangents", "Bitangents" };
+
+//! Whether two transforms are exactly the same
+static bool sameTransform( const Transform & a, const Transform & b )
+{
+	if ( a.scale != b.scale )
+		return false;
+
+	for ( int i = 0; i < 3; i++ ) {
+		if ( a.translation[i] != b.translation[i] )
+			return false;
+
+		for ( int j = 0; j < 3; j++ ) {
+			if ( a.rotation( i, j ) != b.rotation( i, j ) )
+				return false;
+		}
+	}
+
+	return true;
+}
+
+//! Apply the transforms of a branch to its geometry, see spApplyBranchTransforms
+static void applyBranchTransforms( NifModel * nif, const QList<qint32> & roots )
+{
+	// Find the world transform of every block once, walking the branch without recursion
+	QVector<bool> visited( nif->getBlockCount(), false );
+	QStack<BranchTransform> stack;
+
+	for ( const auto r : roots )
+		stack.push( { r, Transform() } );
+
+	// Blocks with the transform they get, and the shapes of each data block with their world transform
+	QVector<BranchTransform> keep;
+	QHash<qint32, QVector<BranchTransform>> shapesOfData;
+
+	while ( !stack.isEmpty() ) {
+		BranchTransform bt = stack.pop();
+		QModelIndex iBlock = nif->getBlock( bt.block );
+
+		if ( !iBlock.isValid() || visited[bt.block] || !Transform::canConstruct( nif, iBlock ) )
+			continue;
+
+		visited[bt.block] = true;
+
+		Transform world = bt.t * Transform( nif, iBlock );
+		bool animated = nif->getLink( iBlock, "Controller" ) >= 0;
+
+		// Only plain nodes can pass their transform on, collisions and switches depend on it
+		if ( nif->isNiBlock( iBlock, { "NiNode", "BSFadeNode" } ) && !animated
+		     && nif->getLink( iBlock, "Collision Object" ) < 0 )
+		{
+			keep.append( { bt.block, Transform() } );
+
+			for ( const auto lChild : nif->getLinkArray( iBlock, "Children" ) )
+				stack.push( { lChild, world } );
+		} else if ( nif->isNiBlock( iBlock, { "NiTriShape", "NiTriStrips", "BSLODTriShape" } ) && !animated
+		            && nif->getLink( iBlock, "Skin Instance" ) < 0
+		            && nif->getBlock( nif->getLink( iBlock, "Data" ), "NiTriBasedGeomData" ).isValid() )
+		{
+			shapesOfData[nif->getLink( iBlock, "Data" )].append( { bt.block, world } );
+		} else {
+			// The block keeps its world transform, relative to the parents it no longer has
+			keep.append( { bt.block, world } );
+		}
+	}
+
+	QVector<ApplyTransformJob> jobs;
+
+	for ( auto it = shapesOfData.constBegin(); it != shapesOfData.constEnd(); ++it ) {
+		const QVector<BranchTransform> & shapes = it.value();
+
+		// Shared data can only take one transform
+		bool same = true;
+		for ( const BranchTransform & s : shapes )
+			same &= sameTransform( s.t, shapes.first().t );
+
+		if ( !same ) {
+			keep += shapes;
+			continue;
+		}
+
+		for ( const BranchTransform & s : shapes )
+			keep.append( { s.block, Transform() } );
+
+		ApplyTransformJob job;
+		job.iData = nif->getBlock( it.key() );
+		job.t = shapes.first().t;
+		job.verts = nif->getArray<Vector3>( job.iData, "Vertices" );
+
+		for ( const QString & name : transformDirections )
+			job.directions << nif->getArray<Vector3>( job.iData, name );
+
+		job.center = nif->get<Vector3>( job.iData, "Center" );
+		job.radius = nif->get<float>( job.iData, "Radius" );
+		jobs.append( job );
+	}
+
+	Spell::parallelFor( jobs.count(), [&jobs]( int i ) {
+		ApplyTransformJob & job = jobs[i];
+
+		for ( Vector3 & v : job.verts )
+			v = job.t * v;
+
+		for ( QVector<Vector3> & directions : job.directions ) {
+			for ( Vector3 & d : directions )
+				d = job.t.rotation * d;
+		}
+
+		job.center = job.t * job.center;
+		job.radius *= job.t.scale;
+	} );
+
+	bool old = nif->holdUpdates( true );
+
+	for ( const ApplyTransformJob & job : jobs ) {
+		nif->setArray<Vector3>( job.iData, "Vertices", job.verts );
+
+		for ( int d = 0; d < transformDirections.count(); d++ ) {
+			if ( !job.directions[d].isEmpty() )
+				nif->setArray<Vector3>( job.iData, transformDirections[d], job.directions[d] );
+		}
+
+		QModelIndex iCenter = nif->getIndex( job.iData, "Center" );
+
+		if ( iCenter.isValid() ) {
+			nif->set<Vector3>( iCenter, job.center );
+			nif->set<float>( job.iData, "Radius", job.radius );
+		}
+	}
+
+	for ( const BranchTransform & bt : keep )
+		bt.t.writeBack( nif, nif->getBlock( bt.block ) );
+
+	if ( !old )
+		nif->holdUpdates( false );
+}
+
+//! Apply the transforms of a node and all nodes below it to their geometry
+/*!
+ * Unlike spApplyTransformation, which moves the transform of a node to its
+ * children, this clears the transforms of the whole branch at once. Shapes
+ * which cannot take the transform, such as animated or skinned ones or ones
+ * sharing their data with different transforms, keep their world transform.
+ */
+class spApplyBranchTransforms final : public Spell
+{
+public:
+	QString name() const override final { return Spell::tr( "Apply to Branch" ); }
+	QString page() const override final { return Spell::tr( "Transform" ); }
+
+	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
+	{
+		return nif->isNiBlock( index, { "NiNode", "BSFadeNode" } );
+	}
+
+	QModelIndex cast( NifModel * nif, const QModelIndex & index ) override final
+	{
+		QPersistentModelIndex iNode( index );
+		applyBranchTransforms( nif, { nif->getBlockNumber( index ) } );
+		return iNode;
+	}
+};
+
+REGISTER_SPELL( spApplyBranchTransforms )
+
+//! Apply the transforms of all nodes in the file to their geometry, see spApplyBranchTransforms
+class spApplyAllTransforms final : public Spell
+{
+public:
+	QString name() const override final { return Spell::tr( "Apply All Transforms" ); }
+	QString page() const override final { return Spell::tr( "Batch" ); }
+
+	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
+	{
+		return nif && !index.isValid();
+	}
+
+	QModelIndex cast( NifModel * nif, const QModelIndex & ) override final
+	{
+		applyBranchTransforms( nif, nif->getRootLinks() );
+		return QModelIndex();
+	}
+};
+
+REGISTER_SPELL( spApplyAllTransforms )
+
 class spClearTransformation final : public Spell
 {
 public:
@@ -210,6 +417,7 @@ class spCopyTransformation final : public Spell
 public:
 	QString name() const override final { return Spell::tr( "Copy" ); }
 	QString page() const override final { return Spell::tr( "Transform" ); }
+	bool interactive() const override final { return true; }
 
 	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
 	{
@@ -241,6 +449,7 @@ class spPasteTransformation final : public Spell
 public:
 	QString name() const override final { return Spell::tr( "Paste" ); }
 	QString page() const override final { return Spell::tr( "Transform" ); }
+	bool interactive() const override final { return true; }
 
 	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
 	{
@@ -290,6 +499,7 @@ class spEditTransformation final : public Spell
 public:
 	QString name() const override final { return Spell::tr( "Edit" ); }
 	QString page() const override final { return Spell::tr( "Transform" ); }
+	bool interactive() const override final { return true; }
 	bool instant() const { return true; }
 	QIcon icon() const
 	{
@@ -342,6 +552,7 @@ class spScaleVertices final : public Spell
 public:
 	QString name() const override final { return Spell::tr( "Scale Vertices" ); }
 	QString page() const override final { return Spell::tr( "Transform" ); }
+	bool interactive() const override final { return true; }
 
 	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
 	{
@@ -8,6 +8,7 @@ class spApplyTransformation final : public Spell
 public:
 	QString name() const override final { return Spell::tr( "Apply" ); }
 	QString page() const override final { return Spell::tr( "Transform" ); }
+	bool interactive() const override final { return true; }
 
 	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final;
 	QModelIndex cast( NifModel * nif, const QModelIndex & index ) override final;
@@ -0,0 +1,308 @@
+/***** BEGIN LICENSE BLOCK *****
+
+BSD License
+
+Copyright (c) 2005-2015, NIF File Format Library and Tools
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the NIF File Format Library and Tools project may not be
+   used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+***** END LICENCE BLOCK *****/
+
+#include "trace.h"
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QList>
+#include <QMutex>
+#include <QTextStream>
+#include <QThread>
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+
+
+//! \file trace.cpp Trace implementation
+
+//! The number of spans allocated at once by a thread
+#define TRACE_CHUNK_SIZE ( 1 << 14 )
+//! The number of chunks a thread fills per recording at most
+#define TRACE_CHUNKS 64
+
+std::atomic<bool> Trace::recording( false );
+
+//! Bumped by Trace::start(), so that the buffers of the threads reset themselves on their next span
+static std::atomic<int> traceGeneration( 0 );
+//! The time Trace::start() was called, in nanoseconds of the steady clock
+static std::atomic<qint64> traceOrigin( 0 );
+
+//! Nanoseconds of the steady clock
+static qint64 steadyTime()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+//! Nanoseconds since Trace::start()
+static qint64 traceTime()
+{
+	return steadyTime() - traceOrigin.load( std::memory_order_relaxed );
+}
+
+//! A finished span
+struct TraceEvent
+{
+	const char * name;
+	QString detail;
+	qint64 start;
+	qint64 end;
+};
+
+//! The spans of a thread, only written by that thread
+/*!
+ * An event, and the chunk holding it, is written before the count is raised
+ * past it, so that Trace::save() reads up to the count without stopping the
+ * thread. The chunks are kept for the next recordings.
+ */
+struct TraceBuffer
+{
+	int tid;
+	QString name;
+
+	std::unique_ptr<TraceEvent[]> chunks[TRACE_CHUNKS];
+	std::atomic<int> count{ 0 };
+	//! The recording the events belong to
+	std::atomic<int> generation{ -1 };
+	std::atomic<int> dropped{ 0 };
+	//! Set when the thread has exited, the buffer is deleted by the next Trace::start()
+	std::atomic<bool> finished{ false };
+};
+
+//! Serializes registering, saving and deleting buffers, never taken while recording a span
+static QMutex traceMutex;
+static QList<TraceBuffer *> traceBuffers;
+static int traceThreads = 0;
+
+//! Marks the buffer of a thread finished as the thread exits
+struct TraceSlot
+{
+	TraceBuffer * buffer = nullptr;
+
+	~TraceSlot()
+	{
+		if ( buffer )
+			buffer->finished.store( true, std::memory_order_release );
+	}
+};
+
+//! The buffer of the calling thread, registered on its first span
+static TraceBuffer * traceBuffer()
+{
+	static thread_local TraceSlot slot;
+
+	if ( !slot.buffer ) {
+		TraceBuffer * b = new TraceBuffer;
+
+		QThread * thread = QThread::currentThread();
+		QCoreApplication * app = QCoreApplication::instance();
+
+		QMutexLocker lock( &traceMutex );
+
+		b->tid = ++traceThreads;
+
+		if ( app && thread == app->thread() )
+			b->name = "Main";
+		else if ( thread && !thread->objectName().isEmpty() )
+			b->name = QString( "%1 %2" ).arg( thread->objectName() ).arg( b->tid );
+		else
+			b->name = QString( "Thread %1" ).arg( b->tid );
+
+		traceBuffers.append( b );
+		slot.buffer = b;
+	}
+
+	return slot.buffer;
+}
+
+void Trace::start()
+{
+	QMutexLocker lock( &traceMutex );
+
+	for ( auto it = traceBuffers.begin(); it != traceBuffers.end(); ) {
+		if ( (*it)->finished.load( std::memory_order_acquire ) ) {
+			delete *it;
+			it = traceBuffers.erase( it );
+		} else {
+			++it;
+		}
+	}
+
+	traceOrigin.store( steadyTime(), std::memory_order_relaxed );
+	traceGeneration.fetch_add( 1, std::memory_order_release );
+	recording.store( true, std::memory_order_release );
+}
+
+void Trace::stop()
+{
+	recording.store( false, std::memory_order_release );
+}
+
+void Trace::Span::begin( const char * n, const QString & d )
+{
+	name = n;
+	detail = d;
+	generation = traceGeneration.load( std::memory_order_acquire );
+	started = traceTime();
+}
+
+void Trace::Span::end()
+{
+	qint64 ended = traceTime();
+
+	if ( !isRecording() || generation != traceGeneration.load( std::memory_order_acquire ) )
+		return;
+
+	TraceBuffer * b = traceBuffer();
+
+	if ( b->generation.load( std::memory_order_relaxed ) != generation ) {
+		b->count.store( 0, std::memory_order_relaxed );
+		b->dropped.store( 0, std::memory_order_relaxed );
+		b->generation.store( generation, std::memory_order_release );
+	}
+
+	int n = b->count.load( std::memory_order_relaxed );
+	if ( n >= TRACE_CHUNK_SIZE * TRACE_CHUNKS ) {
+		b->dropped.fetch_add( 1, std::memory_order_relaxed );
+		return;
+	}
+
+	std::unique_ptr<TraceEvent[]> & chunk = b->chunks[n / TRACE_CHUNK_SIZE];
+	if ( !chunk )
+		chunk.reset( new TraceEvent[TRACE_CHUNK_SIZE] );
+
+	TraceEvent & e = chunk[n % TRACE_CHUNK_SIZE];
+	e.name = name;
+	e.detail = detail;
+	e.start = started;
+	e.end = ended;
+
+	b->count.store( n + 1, std::memory_order_release );
+}
+
+//! A string as a quoted JSON string
+static QString jsonString( const QString & s )
+{
+	QString out;
+	out.reserve( s.size() + 2 );
+	out += QLatin1Char( '"' );
+
+	for ( QChar c : s ) {
+		if ( c.unicode() < 0x20 ) {
+			out += QString( "\\u%1" ).arg( c.unicode(), 4, 16, QLatin1Char( '0' ) );
+			continue;
+		}
+
+		if ( c == QLatin1Char( '"' ) || c == QLatin1Char( '\\' ) )
+			out += QLatin1Char( '\\' );
+		out += c;
+	}
+
+	out += QLatin1Char( '"' );
+	return out;
+}
+
+//! Nanoseconds as the microseconds of the trace event format
+static QString traceMicroseconds( qint64 ns )
+{
+	return QString::number( double( ns ) / 1000.0, 'f', 3 );
+}
+
+bool Trace::save( const QString & filename )
+{
+	QFile f( filename );
+	if ( !f.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
+		return false;
+
+	QTextStream out( &f );
+	out.setCodec( "UTF-8" );
+
+	QMutexLocker lock( &traceMutex );
+
+	int generation = traceGeneration.load( std::memory_order_acquire );
+	int dropped = 0;
+
+	out << "{\"traceEvents\":[\n";
+
+	bool first = true;
+	for ( TraceBuffer * b : traceBuffers ) {
+		if ( b->generation.load( std::memory_order_acquire ) != generation )
+			continue;
+
+		if ( !first )
+			out << ",\n";
+		first = false;
+
+		out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << b->tid
+		    << ",\"args\":{\"name\":" << jsonString( b->name ) << "}}";
+
+		int count = b->count.load( std::memory_order_acquire );
+		dropped += b->dropped.load( std::memory_order_relaxed );
+
+		for ( int i = 0; i < count; i++ ) {
+			const TraceEvent & e = b->chunks[i / TRACE_CHUNK_SIZE][i % TRACE_CHUNK_SIZE];
+
+			out << ",\n{\"name\":" << jsonString( QString::fromLatin1( e.name ) )
+			    << ",\"cat\":\"nifskope\",\"ph\":\"X\",\"ts\":" << traceMicroseconds( e.start )
+			    << ",\"dur\":" << traceMicroseconds( e.end - e.start )
+			    << ",\"pid\":1,\"tid\":" << b->tid;
+
+			if ( !e.detail.isEmpty() )
+				out << ",\"args\":{\"detail\":" << jsonString( e.detail ) << "}";
+
+			out << "}";
+		}
+	}
+
+	out << "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped\":" << dropped << "}}\n";
+	out.flush();
+
+	return f.error() == QFile::NoError;
+}
+
+Trace::Recording::Recording( const QString & filename ) : file( filename )
+{
+	if ( !file.isEmpty() )
+		start();
+}
+
+Trace::Recording::~Recording()
+{
+	if ( file.isEmpty() )
+		return;
+
+	stop();
+
+	if ( !save( file ) )
+		fprintf( stderr, "Could not write the trace to %s\n", qPrintable( file ) );
+}
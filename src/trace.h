@@ -0,0 +1,127 @@
+/***** BEGIN LICENSE BLOCK *****
+
+BSD License
+
+Copyright (c) 2005-2015, NIF File Format Library and Tools
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the NIF File Format Library and Tools project may not be
+   used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+***** END LICENCE BLOCK *****/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QString>
+
+#include <atomic>
+
+
+//! \file trace.h Trace, TRACE_SPAN()
+
+//! Records spans of work on every thread, saved as a trace for chrome://tracing or ui.perfetto.dev
+/*!
+ * A span is timed by Trace::Span, usually declared by TRACE_SPAN(), and
+ * appended to a buffer of the thread it ran on, so that threads never wait
+ * for each other. While nothing is recorded, a span only reads a flag.
+ *
+ * A thread keeps about a million spans per recording, allocated as they are
+ * needed; the spans ending after its buffer is full are counted as dropped.
+ *
+ * Recorded from the View menu, see NifSkope::on_aRecordTrace_toggled(), or
+ * for a whole run with <tt>--trace file.json</tt>, see Trace::Recording.
+ */
+class Trace final
+{
+public:
+	//! Start recording, dropping the spans recorded before
+	static void start();
+	//! Stop recording, dropping the spans still running
+	static void stop();
+	//! Whether spans are being recorded
+	static bool isRecording() { return recording.load( std::memory_order_relaxed ); }
+
+	//! Write the spans of the last recording in the JSON trace event format
+	static bool save( const QString & filename );
+
+	//! Times the scope it is declared in, if spans are being recorded when it begins
+	class Span final
+	{
+	public:
+		//! \param n	A string literal, kept by its address
+		explicit Span( const char * n )
+		{
+			if ( isRecording() )
+				begin( n, QString() );
+		}
+		//! \param d	Shown with the span, such as the file or the block type it worked on
+		Span( const char * n, const QString & d )
+		{
+			if ( isRecording() )
+				begin( n, d );
+		}
+		~Span()
+		{
+			if ( name )
+				end();
+		}
+
+		Span( const Span & ) = delete;
+		Span & operator=( const Span & ) = delete;
+
+	private:
+		void begin( const char * n, const QString & d );
+		void end();
+
+		const char * name = nullptr;
+		QString detail;
+		qint64 started = 0;
+		int generation = 0;
+	};
+
+	//! Records from its construction until its destruction and then saves the trace, if given a file
+	class Recording final
+	{
+	public:
+		explicit Recording( const QString & filename );
+		~Recording();
+
+		Recording( const Recording & ) = delete;
+		Recording & operator=( const Recording & ) = delete;
+
+	private:
+		QString file;
+	};
+
+private:
+	static std::atomic<bool> recording;
+};
+
+#define TRACE_CONCAT_( a, b ) a##b
+#define TRACE_CONCAT( a, b ) TRACE_CONCAT_( a, b )
+
+//! Time the enclosing scope with a name and optionally a detail, see Trace::Span
+#define TRACE_SPAN( ... ) Trace::Span TRACE_CONCAT( traceSpan, __LINE__ )( __VA_ARGS__ )
+
+#endif
@@ -2,6 +2,7 @@
 #include "ui_settingsdialog.h"
 
 #include "settings.h"
+#include "settingssnapshot.h"
 
 #include <QDebug>
 #include <QListWidget>
@@ -68,6 +69,7 @@ void SettingsDialog::registerPage( QWidget * parent, const QString & text )
 void SettingsDialog::apply()
 {
 	emit saveSettings();
+	SettingsSnapshot::rebuild();
 	emit update3D();
 
 	btnSave->setEnabled( false );
@@ -36,6 +36,8 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "gl/glscene.h"
 #include "gl/glnode.h"
 
+#include <fsengine/fsmanager.h>
+
 #include <QApplication>
 #include <QBuffer>
 #include <QCheckBox>
@@ -108,6 +110,9 @@ public:
 	QLabel * lenLabel;
 	QLineEdit * lenText;
 	QPushButton * refreshBtn;
+
+	QGroupBox * memGroup;
+	QTextEdit * memText;
 };
 
 InspectViewInternal::~InspectViewInternal()
@@ -154,12 +159,14 @@ InspectViewInternal::~InspectViewInternal()
 	if ( lenLabel != 0 )   delete lenLabel;
 	if ( lenText != 0 )    delete lenText;
 	if ( refreshBtn != 0 ) delete refreshBtn;
+	if ( memGroup != 0 )   delete memGroup;
 }
 
 InspectView::InspectView( QWidget * parent, Qt::WindowFlags f )
 	: QDialog( parent, f )
 {
 	nif  = nullptr;
+	scene = nullptr;
 	impl = new InspectViewInternal;
 
 	impl->needUpdate = true;
@@ -294,6 +301,16 @@ InspectView::InspectView( QWidget * parent, Qt::WindowFlags f )
 	impl->refreshBtn->setText( tr( "Refresh" ) );
 	impl->refreshBtn->setFocus();
 
+	impl->memGroup = new QGroupBox( this );
+	impl->memGroup->setTitle( tr( "Memory" ) );
+	impl->memText = new QTextEdit( this );
+	impl->memText->setLineWrapMode( QTextEdit::NoWrap );
+	impl->memText->setReadOnly( true );
+
+	QGridLayout * memGrid = new QGridLayout;
+	impl->memGroup->setLayout( memGrid );
+	memGrid->addWidget( impl->memText );
+
 	QGridLayout * grid = new QGridLayout;
 	this->setLayout( grid );
 	grid->addWidget( impl->nameLabel,   0, 0 );
@@ -312,7 +329,8 @@ InspectView::InspectView( QWidget * parent, Qt::WindowFlags f )
 	grid->addWidget( impl->matGroup,    7, 0, 1, 2, Qt::AlignLeft | Qt::AlignAbsolute );
 	grid->addWidget( impl->lenLabel,    8, 0 );
 	grid->addWidget( impl->lenText,     8, 1 );
-	grid->addWidget( impl->refreshBtn,  9, 1 );
+	grid->addWidget( impl->memGroup,    9, 0, 1, 2 );
+	grid->addWidget( impl->refreshBtn, 10, 1 );
 
 	connect( impl->localCheck, &QCheckBox::stateChanged, this, &InspectView::update );
 	connect( impl->invertCheck, &QCheckBox::stateChanged, this, &InspectView::update );
@@ -376,6 +394,8 @@ void InspectView::update()
 
 	impl->needUpdate = false;
 
+	updateMemory();
+
 	if ( !scene || !nif || !selection.isValid() ) {
 		clear();
 		return;
@@ -427,6 +447,74 @@ void InspectView::update()
 	impl->lenText->setText( QString( "%1" ).Farg( node->localTrans().translation.length() ) );
 }
 
+//! Bytes in KiB, or in MiB from 10 MiB up
+static QString memorySize( qint64 bytes )
+{
+	if ( bytes >= 10 * 1024 * 1024 )
+		return QString( "%1 MB" ).arg( double( bytes ) / ( 1024.0 * 1024.0 ), 0, 'f', 1 );
+
+	return QString( "%1 KB" ).arg( double( bytes ) / 1024.0, 0, 'f', 1 );
+}
+
+void InspectView::updateMemory()
+{
+	if ( !nif ) {
+		impl->memText->setText( QString() );
+		return;
+	}
+
+	QString text;
+	auto row = [&text]( const QString & name, qint64 bytes ) {
+		text += QString( "%1\t%2\n" ).arg( name, memorySize( bytes ) );
+	};
+
+	NifModel::MemoryUsage doc = nif->memoryUsage();
+	qint64 total = doc.total();
+
+	text += tr( "Document (%1 items)" ).arg( doc.items ) + "\n";
+	row( tr( "  Items" ), doc.itemBytes );
+	row( tr( "  Values" ), doc.valueBytes );
+	row( tr( "  Block data" ), doc.sourceBytes );
+	row( tr( "  Caches" ), doc.cacheBytes );
+
+	if ( scene ) {
+		GeometryUsage geometry = scene->memoryUsage();
+		total += geometry.geometry + geometry.transformed + geometry.skin;
+
+		text += tr( "Scene (%1 shapes)" ).arg( geometry.shapes ) + "\n";
+		row( tr( "  Geometry" ), geometry.geometry );
+		row( tr( "  Transformed" ), geometry.transformed );
+		row( tr( "  Skinning" ), geometry.skin );
+		row( tr( "  Buffers (GPU)" ), geometry.buffers );
+		if ( scene->geometryBudget > 0 )
+			row( tr( "  Budget" ), scene->geometryBudget );
+		if ( geometry.paged > 0 )
+			text += QString( "%1\t%2\n" ).arg( tr( "  Paged out" ), tr( "%1 shapes" ).arg( geometry.paged ) );
+
+		if ( scene->textures ) {
+			TexCache::MemoryUsage tex = scene->textures->memoryUsage();
+			total += tex.cpu;
+
+			text += tr( "Textures (%1)" ).arg( tex.textures ) + "\n";
+			row( tr( "  File data" ), tex.cpu );
+			row( tr( "  Video memory (GPU)" ), tex.gpu );
+			row( tr( "  Shared (GPU)" ), tex.shared );
+			if ( tex.budget > 0 )
+				row( tr( "  Budget" ), tex.budget );
+		}
+	}
+
+	// The archive cache is shared by all windows
+	FSManager::CacheStats archives = FSManager::cacheStats();
+	text += tr( "Archives (all windows)" ) + "\n";
+	row( tr( "  Decompressed files" ), qint64( archives.size ) * 1024 );
+
+	text += "\n";
+	row( tr( "System memory of this window" ), total );
+
+	impl->memText->setText( text );
+}
+
 void InspectView::clear()
 {
 	QString empty;
@@ -69,6 +69,8 @@ public slots:
 	void updateTime( float t, float mn, float mx );
 	void update();
 	void copyTransformToMimedata();
+	//! Show the memory held by the document, its scene and its textures
+	void updateMemory();
 
 private:
 	InspectViewInternal * impl;
@@ -37,6 +37,7 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "spellbook.h"
 
 #include <QKeyEvent>
+#include <QTimer>
 
 NifTreeView::NifTreeView( QWidget * parent, Qt::WindowFlags flags ) : QTreeView()
 {
@@ -44,7 +45,19 @@ NifTreeView::NifTreeView( QWidget * parent, Qt::WindowFlags flags ) : QTreeView(
 
 	setParent( parent );
 
+	// Every dataChanged of an edit, such as those of many rows whose conditions a flag toggles,
+	// is collected and the rows are hidden and laid out together
+	conditionTimer = new QTimer( this );
+	conditionTimer->setSingleShot( true );
+	conditionTimer->setInterval( 0 );
+	connect( conditionTimer, &QTimer::timeout, this, &NifTreeView::applyConditions );
+
 	connect( this, &NifTreeView::expanded, this, &NifTreeView::scrollExpand );
+	// Rows below collapsed items are only refreshed once they become visible
+	connect( this, &NifTreeView::expanded, [this]( const QModelIndex & index ) {
+		if ( nif && doRowHiding )
+			updateConditionRecurse( index );
+	} );
 }
 
 NifTreeView::~NifTreeView()
@@ -57,6 +70,7 @@ void NifTreeView::setModel( QAbstractItemModel * model )
 		disconnect( nif, &BaseModel::dataChanged, this, &NifTreeView::updateConditions );
 
 	nif = qobject_cast<BaseModel *>( model );
+	pendingConditions.clear();
 
 	QTreeView::setModel( model );
 
@@ -142,7 +156,37 @@ void NifTreeView::updateConditions( const QModelIndex & topLeft, const QModelInd
 		return;
 
 	Q_UNUSED( bottomRight );
-	updateConditionRecurse( topLeft.parent() );
+
+	QPersistentModelIndex parent = topLeft.parent();
+	if ( parent.isValid() && !pendingConditions.contains( parent ) )
+		pendingConditions.append( parent );
+
+	if ( !conditionTimer->isActive() )
+		conditionTimer->start();
+}
+
+void NifTreeView::applyConditions()
+{
+	QList<QPersistentModelIndex> pending;
+	pending.swap( pendingConditions );
+
+	if ( !nif || !doRowHiding || nif->getState() != BaseModel::Default || pending.isEmpty() )
+		return;
+
+	for ( const QPersistentModelIndex & index : pending ) {
+		// Rows removed since have invalid indices
+		if ( !index.isValid() )
+			continue;
+
+		// The rows below a queued ancestor are updated with it
+		bool queued = false;
+		for ( QModelIndex p = index.parent(); p.isValid() && !queued; p = p.parent() )
+			queued = pending.contains( QPersistentModelIndex( p ) );
+
+		if ( !queued )
+			updateConditionRecurse( index );
+	}
+
 	doItemsLayout();
 }
 
@@ -155,12 +199,17 @@ void NifTreeView::updateConditionRecurse( const QModelIndex & index )
 	if ( !item )
 		return;
 
-	for ( int r = 0; r < model()->rowCount( index ); r++ ) {
-		QModelIndex child = model()->index( r, 0, index );
-		updateConditionRecurse( child );
+	// Skip the rows of collapsed items, such as large arrays, until they are expanded
+	if ( index == rootIndex() || isExpanded( index ) ) {
+		for ( int r = 0; r < model()->rowCount( index ); r++ ) {
+			QModelIndex child = model()->index( r, 0, index );
+			updateConditionRecurse( child );
+		}
 	}
 
-	setRowHidden( index.row(), index.parent(), doRowHiding && !item->condition() );
+	bool hide = doRowHiding && !item->condition();
+	if ( QTreeView::isRowHidden( index.row(), index.parent() ) != hide )
+		setRowHidden( index.row(), index.parent(), hide );
 }
 
 void NifTreeView::keyPressEvent( QKeyEvent * e )
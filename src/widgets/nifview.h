@@ -35,6 +35,10 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <QTreeView> // Inherited
 
+#include <QPersistentModelIndex>
+
+class QTimer;
+
 
 //! Widget for showing a nif file as tree, list, or block details.
 class NifTreeView final : public QTreeView
@@ -76,8 +80,10 @@ public slots:
 	void setRowHiding( bool );
 
 protected slots:
-	//! Updates version conditions (connect to dataChanged)
+	//! Queues the rows of a change for applyConditions() (connect to dataChanged)
 	void updateConditions( const QModelIndex & topLeft, const QModelIndex & bottomRight );
+	//! Updates the version conditions of the queued rows, and lays out the items once
+	void applyConditions();
 	//! Recursively updates version conditions
 	void updateConditionRecurse( const QModelIndex & index );
 	//! Called when the current index changes
@@ -94,6 +100,11 @@ protected:
 
 	bool doRowHiding = true;
 
+	//! The parents of the rows changed since the last applyConditions()
+	QList<QPersistentModelIndex> pendingConditions;
+	//! Runs applyConditions() on the next turn of the event loop
+	QTimer * conditionTimer;
+
 	class BaseModel * nif = nullptr;
 };
 
@@ -0,0 +1,286 @@
+/***** BEGIN LICENSE BLOCK *****
+
+BSD License
+
+Copyright (c) 2005-2015, NIF File Format Library and Tools
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the NIF File Format Library and Tools project may not be
+   used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+***** END LICENCE BLOCK *****/
+
+#include "thumbnails.h"
+
+#include "functionrunnable.h"
+#include "gl/dds/dds_api.h"
+
+#include <fsengine/bsa.h>
+#include <fsengine/fsmanager.h>
+
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QFileSystemModel>
+#include <QPixmap>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QThread>
+
+#include <algorithm>
+#include <cstring>
+
+
+//! \file thumbnails.cpp ThumbnailCache, ThumbnailProxyModel
+
+//! Number of thumbnails kept in memory
+#define THUMBNAIL_CACHE_SIZE 4096
+
+ThumbnailCache::ThumbnailCache( QObject * parent ) : QObject( parent ), images( THUMBNAIL_CACHE_SIZE )
+{
+	// Leave a thread to the loading of files
+	pool.setMaxThreadCount( std::max( 1, QThread::idealThreadCount() - 1 ) );
+}
+
+ThumbnailCache * ThumbnailCache::get()
+{
+	static ThumbnailCache * cache = new ThumbnailCache( qApp );
+	return cache;
+}
+
+QImage ThumbnailCache::thumbnail( const QString & file )
+{
+	if ( QImage * image = images.object( file ) )
+		return *image;
+
+	if ( !failed.contains( file ) && !pending.contains( file ) ) {
+		pending.insert( file );
+		pool.start( new FunctionRunnable( [this, file]() {
+			QImage image = generate( file );
+
+			QMetaObject::invokeMethod( this, "finished", Qt::QueuedConnection,
+				Q_ARG( QString, file ), Q_ARG( QImage, image ) );
+		} ) );
+	}
+
+	return QImage();
+}
+
+void ThumbnailCache::cancel()
+{
+	pool.clear();
+
+	// The runnables which had started still report their files
+	pending.clear();
+}
+
+void ThumbnailCache::finished( const QString & file, const QImage & image )
+{
+	pending.remove( file );
+
+	if ( image.isNull() )
+		failed.insert( file );
+	else
+		images.insert( file, new QImage( image ) );
+
+	emit thumbnailReady( file );
+}
+
+//! The mipmap a thumbnail is decoded from: the largest no bigger than twice the thumbnail, or the smallest
+static int thumbnailMip( quint32 width, quint32 height, quint32 mipmaps )
+{
+	quint32 m = 0;
+	while ( m + 1 < mipmaps && std::max( width >> m, height >> m ) > 2 * ThumbnailCache::Size )
+		m++;
+
+	return int( m );
+}
+
+//! Read the DDS \a file, or only its small mipmaps where the archive can, and its key in the disk cache
+static bool thumbnailSource( const QString & file, QByteArray & data, QCryptographicHash & key )
+{
+	if ( QDir::isAbsolutePath( file ) ) {
+		QFileInfo info( file );
+		key.addData( info.absoluteFilePath().toUtf8() );
+		key.addData( QByteArray::number( info.size() ) + ' ' + QByteArray::number( info.lastModified().toMSecsSinceEpoch() ) );
+
+		QFile f( file );
+		if ( !f.open( QIODevice::ReadOnly ) )
+			return false;
+
+		data = f.readAll();
+		return true;
+	}
+
+	QString path = QDir::fromNativeSeparators( file ).toLower();
+
+	// Held so that the archive stays open if the archives are changed meanwhile
+	std::shared_ptr<FSArchiveHandler> handler = FSManager::findArchive( path );
+	FSArchiveFile * archive = handler ? handler->getArchive() : nullptr;
+	if ( !archive )
+		return false;
+
+	// The entries are named by the hashes the archive finds them by, see BSA::getFile()
+	int slash = path.lastIndexOf( QLatin1Char( '/' ) );
+	quint64 hashes[2] = {
+		BSA::tes4Hash( path.constData(), std::max( slash, 0 ), true ),
+		BSA::tes4Hash( path.constData() + slash + 1, path.length() - slash - 1, false )
+	};
+
+	key.addData( archive->path().toUtf8() );
+	key.addData( QByteArray::number( QFileInfo( archive->path() ).lastModified().toMSecsSinceEpoch() ) );
+	key.addData( reinterpret_cast<const char *>( hashes ), sizeof( hashes ) );
+
+	BSA * bsa = dynamic_cast<BSA *>( archive );
+	const BSA::BSAFile * entry = bsa ? bsa->getFile( path ) : nullptr;
+
+	if ( entry && bsa->mipCount( path ) > 0 ) {
+		int mips = bsa->mipCount( path );
+		int m = thumbnailMip( entry->tex.header.width, entry->tex.header.height, quint32( mips ) );
+
+		return bsa->smallestMipContents( path, mips - m, data );
+	}
+
+	return archive->fileContents( path, data );
+}
+
+QImage ThumbnailCache::generate( const QString & file )
+{
+	if ( !file.endsWith( ".dds", Qt::CaseInsensitive ) )
+		return QImage();
+
+	QByteArray data;
+	QCryptographicHash key( QCryptographicHash::Sha1 );
+
+	if ( !thumbnailSource( file, data, key ) )
+		return QImage();
+
+	QString cacheDir = QStandardPaths::writableLocation( QStandardPaths::CacheLocation );
+	QString cachename;
+
+	if ( !cacheDir.isEmpty() ) {
+		cachename = QDir( cacheDir ).filePath( QString( "thumbnails/%1.png" ).arg( QString( key.result().toHex() ) ) );
+
+		QImage cached( cachename );
+		if ( !cached.isNull() )
+			return cached;
+	}
+
+	if ( data.size() < 128 || strncmp( data.constData(), "DDS ", 4 ) != 0 )
+		return QImage();
+
+	DDSFormat header;
+	memcpy( &header, data.constData() + 4, sizeof( DDSFormat ) );
+
+	quint32 mipmaps = ( header.dwFlags & DDSD_MIPMAPCOUNT ) ? std::max( header.dwMipMapCount, 1U ) : 1;
+	int m = thumbnailMip( header.dwWidth, header.dwHeight, mipmaps );
+
+	// Only reads the memory
+	Image * img = load_dds( const_cast<unsigned char *>( reinterpret_cast<const unsigned char *>( data.constData() ) ), data.size(), 0, m );
+	if ( !img )
+		return QImage();
+
+	QImage image( int( img->width() ), int( img->height() ), QImage::Format_ARGB32 );
+
+	for ( int y = 0; y < image.height(); y++ ) {
+		const Color32 * src = img->scanline( uint( y ) );
+		QRgb * dst = reinterpret_cast<QRgb *>( image.scanLine( y ) );
+
+		for ( int x = 0; x < image.width(); x++ )
+			dst[x] = qRgba( src[x].r, src[x].g, src[x].b, src[x].a );
+	}
+
+	delete img;
+
+	if ( image.isNull() )
+		return image;
+
+	image = image.scaled( Size, Size, Qt::KeepAspectRatio, Qt::SmoothTransformation );
+
+	if ( !cachename.isEmpty() ) {
+		QDir().mkpath( QFileInfo( cachename ).absolutePath() );
+
+		QSaveFile f( cachename );
+		if ( f.open( QIODevice::WriteOnly ) && image.save( &f, "PNG" ) )
+			f.commit();
+	}
+
+	return image;
+}
+
+
+ThumbnailProxyModel::ThumbnailProxyModel( QObject * parent ) : QIdentityProxyModel( parent )
+{
+	connect( ThumbnailCache::get(), &ThumbnailCache::thumbnailReady, this, &ThumbnailProxyModel::thumbnailReady );
+}
+
+ThumbnailProxyModel::~ThumbnailProxyModel()
+{
+	if ( !requested.isEmpty() )
+		ThumbnailCache::get()->cancel();
+}
+
+QVariant ThumbnailProxyModel::data( const QModelIndex & index, int role ) const
+{
+	if ( role != Qt::DecorationRole || index.column() != 0 )
+		return QIdentityProxyModel::data( index, role );
+
+	QString file = QIdentityProxyModel::data( index, QFileSystemModel::FilePathRole ).toString();
+	if ( !file.endsWith( ".dds", Qt::CaseInsensitive ) )
+		return QIdentityProxyModel::data( index, role );
+
+	auto icon = icons.constFind( file );
+	if ( icon != icons.constEnd() )
+		return icon.value().isNull() ? QIdentityProxyModel::data( index, role ) : icon.value();
+
+	QImage image = ThumbnailCache::get()->thumbnail( file );
+	if ( image.isNull() ) {
+		requested.insert( file, QPersistentModelIndex( index ) );
+		return QIdentityProxyModel::data( index, role );
+	}
+
+	return *icons.insert( file, QIcon( QPixmap::fromImage( image ) ) );
+}
+
+void ThumbnailProxyModel::thumbnailReady( const QString & file )
+{
+	if ( !requested.contains( file ) )
+		return;
+
+	QPersistentModelIndex index = requested.take( file );
+
+	// A file which could not be decoded keeps the icon of its type
+	QImage image = ThumbnailCache::get()->thumbnail( file );
+	if ( image.isNull() ) {
+		icons.insert( file, QIcon() );
+		return;
+	}
+
+	icons.insert( file, QIcon( QPixmap::fromImage( image ) ) );
+
+	if ( index.isValid() )
+		emit dataChanged( index, index, { Qt::DecorationRole } );
+}
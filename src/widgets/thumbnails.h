@@ -0,0 +1,130 @@
+/***** BEGIN LICENSE BLOCK *****
+
+BSD License
+
+Copyright (c) 2005-2015, NIF File Format Library and Tools
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the NIF File Format Library and Tools project may not be
+   used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+***** END LICENCE BLOCK *****/
+
+#ifndef THUMBNAILS_H
+#define THUMBNAILS_H
+
+#include <QIdentityProxyModel> // Inherited
+#include <QObject>             // Inherited
+#include <QCache>
+#include <QHash>
+#include <QIcon>
+#include <QImage>
+#include <QPersistentModelIndex>
+#include <QSet>
+#include <QThreadPool>
+
+
+//! \file thumbnails.h ThumbnailCache, ThumbnailProxyModel
+
+//! Small images of DDS textures, decoded in the background and cached on disk
+/*!
+ * A thumbnail is decoded from the largest mipmap no bigger than twice its
+ * size, so that only a small part of a texture is decompressed. Of a Fallout 4
+ * texture in an archive only the chunks holding those mipmaps are read, see
+ * BSA::smallestMipContents().
+ *
+ * Thumbnails are stored as PNG files in the cache folder, named by the path
+ * and modification time of a loose file, or by the path and modification time
+ * of the archive and the native hashes of the file in it.
+ */
+class ThumbnailCache final : public QObject
+{
+	Q_OBJECT
+
+public:
+	//! The width and height thumbnails are scaled into
+	enum { Size = 64 };
+
+	//! Gets the cache shared by all windows
+	static ThumbnailCache * get();
+
+	//! The thumbnail of a texture, or a null image until thumbnailReady() is emitted for it
+	/*!
+	 * \param file	An absolute path of a loose file, or a path relative to the
+	 *          	data folder of a file in the archives of the settings
+	 */
+	QImage thumbnail( const QString & file );
+
+	//! Drop the requests which have not been started, for a view being closed
+	void cancel();
+
+	//! Decode the thumbnail of a texture, on any thread; a null image if it cannot be decoded
+	static QImage generate( const QString & file );
+
+signals:
+	//! The thumbnail of \a file was decoded, or found not to exist
+	void thumbnailReady( const QString & file );
+
+protected slots:
+	void finished( const QString & file, const QImage & image );
+
+protected:
+	ThumbnailCache( QObject * parent = nullptr );
+
+	//! Recently used thumbnails by file
+	QCache<QString, QImage> images;
+	//! Files which could not be decoded
+	QSet<QString> failed;
+	//! Files being decoded
+	QSet<QString> pending;
+
+	QThreadPool pool;
+};
+
+
+//! Shows the thumbnails of ThumbnailCache as the icons of the textures of a QFileSystemModel
+/*!
+ * For the view of a QFileDialog, see QFileDialog::setProxyModel(). Thumbnails
+ * are only requested for the rows a view paints.
+ */
+class ThumbnailProxyModel final : public QIdentityProxyModel
+{
+	Q_OBJECT
+
+public:
+	ThumbnailProxyModel( QObject * parent = nullptr );
+	~ThumbnailProxyModel();
+
+	QVariant data( const QModelIndex & index, int role = Qt::DisplayRole ) const override final;
+
+protected slots:
+	void thumbnailReady( const QString & file );
+
+protected:
+	//! The icons made from the thumbnails
+	mutable QHash<QString, QIcon> icons;
+	//! The rows waiting for their thumbnail
+	mutable QHash<QString, QPersistentModelIndex> requested;
+};
+
+#endif
@@ -51,6 +51,10 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QOpenGLContext>
 #include <QOpenGLFunctions>
 #include <QPushButton>
+#include <QSet>
+
+#include <algorithm> // std::sort
+#include <cmath>
 
 // TODO: Determine the necessity of this
 // Appears to be used solely for gluErrorString
@@ -184,6 +188,9 @@ UVWidget::UVWidget( QWidget * parent )
 
 UVWidget::~UVWidget()
 {
+	// The buffer objects are deleted in the context of the widget
+	makeCurrent();
+
 	delete textures;
 	nif = nullptr;
 }
@@ -413,59 +420,56 @@ void UVWidget::drawTexCoords()
 	glScalef( 1.0f, 1.0f, 1.0f );
 	glTranslatef( -0.5f, -0.5f, 0.0f );
 
-	Color4 nlColor( cfg.wireframe );
-	nlColor.setAlpha( 0.5f );
-	Color4 hlColor( cfg.highlight );
-	hlColor.setAlpha( 0.5f );
+	Color4 nlColor( Color3( cfg.wireframe ) );
+	Color4 hlColor( Color3( cfg.highlight ) );
 
 	glLineWidth( 1.0f );
 	glPointSize( 3.5f );
 
 	glEnable( GL_BLEND );
-	glEnable( GL_DEPTH_TEST );
-	glDepthFunc( GL_LEQUAL );
-	glDepthMask( GL_TRUE );
+	glDisable( GL_DEPTH_TEST );
 
-	float z;
+	// Upload only the coordinates which moved since the last frame
+	if ( allCoordsChanged )
+		texcoordBuffer.bind( texcoords );
+	else
+		texcoordBuffer.bind( texcoords, changedCoords );
 
-	// draw triangle edges
-	for ( int i = 0; i < faces.size(); i++ ) {
-		glBegin( GL_LINE_LOOP );
+	allCoordsChanged = false;
+	changedCoords.clear();
 
-		for ( int j = 0; j < 3; j++ ) {
-			int x = faces[i].tc[j];
+	glVertexPointer( 2, GL_FLOAT, 0, nullptr );
+	texcoordBuffer.release();
 
-			if ( selection.contains( x ) ) {
-				glColor( Color3( hlColor ) );
-				z = 1.0f;
-			} else {
-				glColor( Color3( nlColor ) );
-				z = 0.0f;
-			}
+	QVector<Color4> colors( texcoords.count(), nlColor );
+	QVector<quint32> selected;
+	selected.reserve( selection.count() );
 
-			glVertex( Vector3( texcoords[x], z ) );
+	for ( const auto s : selection ) {
+		if ( s < texcoords.count() ) {
+			colors[s] = hlColor;
+			selected << s;
 		}
-
-		glEnd();
 	}
 
-	// draw points
+	glEnableClientState( GL_COLOR_ARRAY );
+	glColorPointer( 4, GL_FLOAT, 0, colors.constData() );
 
-	glBegin( GL_POINTS );
+	// draw triangle edges
+	edgeBuffer.bind( edges );
+	glDrawElements( GL_LINES, edges.count(), GL_UNSIGNED_INT, nullptr );
+	edgeBuffer.release();
 
-	for ( int i = 0; i < texcoords.size(); i++ ) {
-		if ( selection.contains( i ) ) {
-			glColor( Color3( hlColor ) );
-			z = 1.0f;
-		} else {
-			glColor( Color3( nlColor ) );
-			z = 0.0f;
-		}
+	// draw points, the selected ones again on top of the others
+	glDrawArrays( GL_POINTS, 0, texcoords.count() );
 
-		glVertex( Vector3( texcoords[i], z ) );
-	}
+	glDisableClientState( GL_COLOR_ARRAY );
 
-	glEnd();
+	glColor( hlColor );
+	glDrawElements( GL_POINTS, selected.count(), GL_UNSIGNED_INT, selected.constData() );
+
+	// The texture quads use the client side array again
+	glVertexPointer( 2, GL_SHORT, 0, vertArray );
 
 	glPopMatrix();
 }
@@ -515,14 +519,88 @@ QVector<int> UVWidget::indices( const QPoint & p ) const
 
 QVector<int> UVWidget::indices( const QRegion & region ) const
 {
-	QList<int> hits;
+	QVector<int> hits;
+
+	if ( !gridValid )
+		updateGrid();
+
+	if ( grid.items.isEmpty() || region.isEmpty() )
+		return hits;
 
-	for ( int i = 0; i < texcoords.count(); i++ ) {
-		if ( region.contains( mapFromContents( texcoords[ i ] ) ) )
-			hits << i;
+	// The cells below the region, with a pixel to spare for the rounding of mapFromContents()
+	QRect r = region.boundingRect().adjusted( -1, -1, 1, 1 );
+	Vector2 a = mapToContents( r.topLeft() ) + Vector2( 0.5f, 0.5f );
+	Vector2 b = mapToContents( r.bottomRight() ) + Vector2( 0.5f, 0.5f );
+
+	int minX = qBound( 0, int( std::floor( ( qMin( a[0], b[0] ) - grid.origin[0] ) / grid.cell ) ), grid.cols - 1 );
+	int maxX = qBound( 0, int( std::floor( ( qMax( a[0], b[0] ) - grid.origin[0] ) / grid.cell ) ), grid.cols - 1 );
+	int minY = qBound( 0, int( std::floor( ( qMin( a[1], b[1] ) - grid.origin[1] ) / grid.cell ) ), grid.rows - 1 );
+	int maxY = qBound( 0, int( std::floor( ( qMax( a[1], b[1] ) - grid.origin[1] ) / grid.cell ) ), grid.rows - 1 );
+
+	for ( int y = minY; y <= maxY; y++ ) {
+		for ( int x = minX; x <= maxX; x++ ) {
+			int c = y * grid.cols + x;
+
+			for ( int i = grid.start[c]; i < grid.start[c + 1]; i++ ) {
+				int tc = grid.items[i];
+
+				if ( region.contains( mapFromContents( texcoords[ tc ] ) ) )
+					hits << tc;
+			}
+		}
 	}
 
-	return hits.toVector();
+	// In the order of the coordinates, as clicking cycles through them
+	std::sort( hits.begin(), hits.end() );
+
+	return hits;
+}
+
+void UVWidget::updateGrid() const
+{
+	grid = CoordGrid();
+	gridValid = true;
+
+	if ( texcoords.isEmpty() )
+		return;
+
+	Vector2 min = texcoords[0], max = texcoords[0];
+
+	for ( const Vector2 & tc : texcoords ) {
+		min[0] = qMin( min[0], tc[0] );
+		min[1] = qMin( min[1], tc[1] );
+		max[0] = qMax( max[0], tc[0] );
+		max[1] = qMax( max[1], tc[1] );
+	}
+
+	// About four coordinates per cell if they are spread evenly
+	int side = qMax( 1, int( std::sqrt( texcoords.count() / 4.0 ) ) );
+
+	grid.origin = min;
+	grid.cell = qMax( qMax( max[0] - min[0], max[1] - min[1] ) / side, 1e-6f );
+	grid.cols = qMin( side, int( ( max[0] - min[0] ) / grid.cell ) + 1 );
+	grid.rows = qMin( side, int( ( max[1] - min[1] ) / grid.cell ) + 1 );
+
+	auto cellOf = [this]( const Vector2 & tc ) {
+		int x = qBound( 0, int( ( tc[0] - grid.origin[0] ) / grid.cell ), grid.cols - 1 );
+		int y = qBound( 0, int( ( tc[1] - grid.origin[1] ) / grid.cell ), grid.rows - 1 );
+		return y * grid.cols + x;
+	};
+
+	// Count the coordinates of each cell, then place them
+	grid.start.fill( 0, grid.cols * grid.rows + 1 );
+
+	for ( const Vector2 & tc : texcoords )
+		grid.start[cellOf( tc ) + 1]++;
+
+	for ( int c = 0; c < grid.cols * grid.rows; c++ )
+		grid.start[c + 1] += grid.start[c];
+
+	QVector<int> next = grid.start;
+	grid.items.resize( texcoords.count() );
+
+	for ( int i = 0; i < texcoords.count(); i++ )
+		grid.items[next[cellOf( texcoords[i] )]++] = i;
 }
 
 bool UVWidget::bindTexture( const QString & filename )
@@ -603,6 +681,9 @@ void UVWidget::mousePressEvent( QMouseEvent * e )
 	mousePos = e->pos();
 
 	if ( e->button() == Qt::LeftButton ) {
+		dragging = true;
+		drag++;
+
 		QVector<int> hits = indices( mousePos );
 
 		if ( hits.isEmpty() ) {
@@ -713,6 +794,11 @@ void UVWidget::mouseReleaseEvent( QMouseEvent * e )
 			selectPoly.clear();
 		}
 
+		dragging = false;
+
+		if ( uncommitted )
+			updateNif();
+
 		break;
 	default:
 		break;
@@ -945,9 +1031,20 @@ bool UVWidget::setTexCoords()
 		
 	}
 
+	allCoordsChanged = true;
+	changedCoords.clear();
+	gridValid = false;
+
+	faces.clear();
+	texcoords2faces.clear();
+	edges.clear();
+
 	if ( tris.isEmpty() )
 		return false;
 
+	faces.reserve( tris.count() );
+	edges.reserve( tris.count() * 6 );
+
 	QVectorIterator<Triangle> itri( tris );
 
 	while ( itri.hasNext() ) {
@@ -958,6 +1055,12 @@ bool UVWidget::setTexCoords()
 
 		for ( int i = 0; i < 3; i++ ) {
 			texcoords2faces.insertMulti( t[i], fIdx );
+
+			// Skip the edges of faces using coordinates which do not exist
+			if ( t[i] >= texcoords.count() || t[( i + 1 ) % 3] >= texcoords.count() )
+				continue;
+
+			edges << t[i] << t[( i + 1 ) % 3];
 		}
 	}
 
@@ -970,25 +1073,51 @@ void UVWidget::updateNif()
 		disconnect( nif, &NifModel::dataChanged, this, &UVWidget::nifDataChanged );
 		nif->setState( BaseModel::Processing );
 
+		// The coordinates are reported as one change, so the scene is updated once
+		nif->beginTransaction();
+
 		if ( nif->inherits( iShapeData, "NiTriBasedGeomData" ) ) {
 			nif->setArray<Vector2>( iTexCoords, texcoords );
-		} else if ( nif->inherits( iShape, "BSTriShape" ) ) {
-			int numVerts = 0;
-			if ( !isDataOnSkin )
-				numVerts = nif->get<int>( iShape, "Num Vertices" );
-			else
-				numVerts = nif->get<uint>( iPartBlock, "Data Size" ) / nif->get<uint>( iPartBlock, "Vertex Size" );
+		} else if ( nif->inherits( iShape, "BSTriShape" ) && nif->rowCount( iShapeData ) > 0 ) {
+			// Every vertex has the same fields, the coordinates are written as one channel of the vertex data
+			int row = nif->getIndex( nif->index( 0, 0, iShapeData ), "UV" ).row();
+
+			if ( row >= 0 ) {
+				QVector<HalfVector2> uvs;
+				uvs.reserve( texcoords.count() );
+
+				for ( const Vector2 & tc : texcoords )
+					uvs << HalfVector2( tc );
 
-			for ( int i = 0; i < numVerts; i++ ) {
-				nif->set<HalfVector2>( nif->index( i, 0, iShapeData ), "UV", HalfVector2( texcoords.value( i ) ) );
+				nif->setFieldArray<HalfVector2>( iShapeData, row, uvs );
 			}
 
 			nif->dataChanged( iShape, iShape );
 		}
-		
+
+		nif->endTransaction();
+
 		nif->restoreState();
 		connect( nif, &NifModel::dataChanged, this, &UVWidget::nifDataChanged );
 	}
+
+	uncommitted = false;
+}
+
+void UVWidget::coordsMoved( const QList<int> & moved )
+{
+	for ( const auto tc : moved )
+		changedCoords << tc;
+
+	gridValid = false;
+
+	// While dragging only the widget is updated, the nif is written once the button is released
+	if ( dragging )
+		uncommitted = true;
+	else
+		updateNif();
+
+	updateGL();
 }
 
 void UVWidget::nifDataChanged( const QModelIndex & idx )
@@ -1070,9 +1199,13 @@ void UVWidget::select( int index, bool yes )
 void UVWidget::select( const QRegion & r, bool add )
 {
 	QList<int> selection( add ? this->selection : QList<int>() );
+	QSet<int> selected = selection.toSet();
+
 	for ( const auto s : indices( r ) ) {
-		if ( !selection.contains( s ) )
+		if ( !selected.contains( s ) ) {
+			selected.insert( s );
 			selection.append( s );
+		}
 	}
 	undoStack->push( new UVWSelectCommand( this, selection ) );
 }
@@ -1095,11 +1228,15 @@ void UVWidget::selectAll()
 void UVWidget::selectFaces()
 {
 	QList<int> selection = this->selection;
+	QSet<int> selected = selection.toSet();
+
 	for ( const auto s : QList<int>( selection ) ) {
 		for ( const auto f : texcoords2faces.values( s ) ) {
 			for ( int i = 0; i < 3; i++ ) {
-				if ( !selection.contains( faces[f].tc[i] ) )
+				if ( !selected.contains( faces[f].tc[i] ) ) {
+					selected.insert( faces[f].tc[i] );
 					selection.append( faces[f].tc[i] );
+				}
 			}
 		}
 	}
@@ -1109,17 +1246,15 @@ void UVWidget::selectFaces()
 void UVWidget::selectConnected()
 {
 	QList<int> selection = this->selection;
-	bool more = true;
-
-	while ( more ) {
-		more = false;
-		for ( const auto s : QList<int>( selection ) ) {
-			for ( const auto f :texcoords2faces.values( s ) ) {
-				for ( int i = 0; i < 3; i++ ) {
-					if ( !selection.contains( faces[f].tc[i] ) ) {
-						selection.append( faces[f].tc[i] );
-						more = true;
-					}
+	QSet<int> selected = selection.toSet();
+
+	// Every coordinate added is visited once, spreading over the faces using it
+	for ( int n = 0; n < selection.count(); n++ ) {
+		for ( const auto f : texcoords2faces.values( selection[n] ) ) {
+			for ( int i = 0; i < 3; i++ ) {
+				if ( !selected.contains( faces[f].tc[i] ) ) {
+					selected.insert( faces[f].tc[i] );
+					selection.append( faces[f].tc[i] );
 				}
 			}
 		}
@@ -1131,7 +1266,7 @@ void UVWidget::selectConnected()
 class UVWMoveCommand final : public QUndoCommand
 {
 public:
-	UVWMoveCommand( UVWidget * w, double dx, double dy ) : QUndoCommand(), uvw( w ), move( dx, dy )
+	UVWMoveCommand( UVWidget * w, double dx, double dy ) : QUndoCommand(), uvw( w ), move( dx, dy ), drag( w->dragging ? w->drag : 0 )
 	{
 		setText( "Move" );
 	}
@@ -1143,8 +1278,11 @@ public:
 
 	bool mergeWith( const QUndoCommand * cmd ) override final
 	{
-		if ( cmd->id() == id() ) {
-			move += static_cast<const UVWMoveCommand *>( cmd )->move;
+		// The moves of one drag are undone as one
+		auto other = static_cast<const UVWMoveCommand *>( cmd );
+
+		if ( cmd->id() == id() && drag != 0 && other->drag == drag ) {
+			move += other->move;
 			return true;
 		}
 
@@ -1156,8 +1294,7 @@ public:
 		for ( const auto tc : uvw->selection ) {
 			uvw->texcoords[tc] += move;
 		}
-		uvw->updateNif();
-		uvw->updateGL();
+		uvw->coordsMoved( uvw->selection );
 	}
 
 	void undo() override final
@@ -1165,13 +1302,14 @@ public:
 		for ( const auto tc : uvw->selection ) {
 			uvw->texcoords[tc] -= move;
 		}
-		uvw->updateNif();
-		uvw->updateGL();
+		uvw->coordsMoved( uvw->selection );
 	}
 
 protected:
 	UVWidget * uvw;
 	Vector2 move;
+	//! The drag the move was made in, 0 if it was not dragged
+	int drag;
 };
 
 void UVWidget::moveSelection( double moveX, double moveY )
@@ -1228,8 +1366,7 @@ public:
 			uvw->texcoords[i] += centre;
 		}
 
-		uvw->updateNif();
-		uvw->updateGL();
+		uvw->coordsMoved( uvw->selection );
 	}
 
 	void undo() override final
@@ -1253,8 +1390,7 @@ public:
 			uvw->texcoords[i] += centre;
 		}
 
-		uvw->updateNif();
-		uvw->updateGL();
+		uvw->coordsMoved( uvw->selection );
 	}
 
 protected:
@@ -1419,8 +1555,7 @@ public:
 			uvw->texcoords[i] += centre;
 		}
 
-		uvw->updateNif();
-		uvw->updateGL();
+		uvw->coordsMoved( uvw->selection );
 	}
 
 	void undo() override final
@@ -1448,8 +1583,7 @@ public:
 			uvw->texcoords[i] += centre;
 		}
 
-		uvw->updateNif();
-		uvw->updateGL();
+		uvw->coordsMoved( uvw->selection );
 	}
 
 protected:
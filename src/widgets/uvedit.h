@@ -33,6 +33,8 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef UVEDIT_H
 #define UVEDIT_H
 
+#include "gl/gltools.h"
+
 #include <QGLWidget> // Inherited
 #include <QDialog>   // Inherited
 #include <QModelIndex>
@@ -43,7 +45,6 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 class NifModel;
 class TexCache;
-class Vector2;
 
 class QActionGroup;
 class QCheckBox;
@@ -163,6 +164,42 @@ private:
 	QVector<face> faces;
 	QMap<int, int> texcoords2faces;
 
+	//! The texture coordinates in a buffer object, see drawTexCoords()
+	GLBuffer<Vector2> texcoordBuffer;
+	//! The pairs of texture coordinates joined by the edges of the faces
+	QVector<quint32> edges;
+	GLBuffer<quint32> edgeBuffer{ GL_ELEMENT_ARRAY_BUFFER };
+	//! Texture coordinates moved since they were last uploaded
+	QVector<int> changedCoords;
+	//! Whether all texture coordinates have to be uploaded, after they were read again
+	bool allCoordsChanged = true;
+
+	//! Uniform grid of the texture coordinates, so that picking only tests those near the point or region
+	struct CoordGrid
+	{
+		Vector2 origin;
+		float cell = 1.0f;
+		int cols = 0, rows = 0;
+		//! The coordinates of cell c are items[start[c]] up to items[start[c + 1]], in ascending order
+		QVector<int> start;
+		QVector<int> items;
+	};
+
+	mutable CoordGrid grid;
+	mutable bool gridValid = false;
+
+	//! Sort the texture coordinates into the grid
+	void updateGrid() const;
+	//! Upload and redraw the texture coordinates at \a moved, and write them to the nif unless dragging
+	void coordsMoved( const QList<int> & moved );
+
+	//! Whether the left button is held; moved coordinates are written to the nif on release
+	bool dragging = false;
+	//! Counts the drags, so that the moves of one drag merge into one undo command
+	int drag = 0;
+	//! Whether coordinates moved since they were last written to the nif
+	bool uncommitted = false;
+
 	QSize sHint;
 
 	TexCache * textures;
@@ -182,6 +219,7 @@ private:
 	QPoint mapFromContents( const Vector2 & v ) const;
 	Vector2 mapToContents( const QPoint & p ) const;
 
+	//! Write the texture coordinates to the nif as one change
 	void updateNif();
 
 	NifModel * nif;
@@ -4,13 +4,24 @@
 #include "kfmmodel.h"
 #include "nifmodel.h"
 #include "fileselect.h"
+#include "trace.h"
+
+#include <fsengine/fsengine.h>
 
 #include <QAction>
 #include <QApplication>
+#include <QBuffer>
 #include <QCheckBox>
 #include <QCloseEvent>
 #include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFileDialog>
+#include <QFileInfo>
 #include <QGroupBox>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <QLabel>
 #include <QLayout>
 #include <QLineEdit>
@@ -18,13 +29,19 @@
 #include <QMouseEvent>
 #include <QProgressBar>
 #include <QPushButton>
+#include <QSaveFile>
 #include <QSettings>
 #include <QSpinBox>
 #include <QTextBrowser>
+#include <QTextStream>
+#include <QTimer>
 #include <QToolButton>
-#include <QQueue>
 
 #define NUM_THREADS 2
+//! Files found before they are queued together
+#define SCAN_BATCH 64
+//! Milliseconds between showing the results
+#define FLUSH_INTERVAL 250
 
 
 TestShredder * TestShredder::create()
@@ -61,6 +78,10 @@ TestShredder::TestShredder()
 	chkKfm->setChecked( settings.value( "Check KFM", true ).toBool() );
 	chkKfm->setToolTip( tr( "Check .kfm files" ) );
 
+	chkArchives = new QCheckBox( tr( "Archives" ), this );
+	chkArchives->setChecked( settings.value( "Check Archives", false ).toBool() );
+	chkArchives->setToolTip( tr( "Check the files in the .bsa and .ba2 archives found" ) );
+
 	QAction * aChoose = new QAction( tr( "Block Match" ), this );
 	connect( aChoose, &QAction::triggered, this, &TestShredder::chooseBlock );
 	QToolButton * btChoose = new QToolButton( this );
@@ -89,6 +110,14 @@ TestShredder::TestShredder()
 	label = new QLabel( this );
 	label->setHidden( true );
 
+	scanner = new FileScanner( this, &queue );
+	connect( scanner, &FileScanner::finished, this, &TestShredder::threadFinished );
+
+	// The results are shown in batches, appending each one would hold up the GUI thread
+	flushTimer = new QTimer( this );
+	flushTimer->setInterval( FLUSH_INTERVAL );
+	connect( flushTimer, &QTimer::timeout, this, &TestShredder::flush );
+
 	btRun = new QPushButton( tr( "run" ), this );
 	btRun->setCheckable( true );
 	connect( btRun, &QPushButton::clicked, this, &TestShredder::run );
@@ -96,6 +125,11 @@ TestShredder::TestShredder()
 	QPushButton * btXML = new QPushButton( tr( "Reload XML" ), this );
 	connect( btXML, &QPushButton::clicked, this, &TestShredder::xml );
 
+	btExport = new QPushButton( tr( "Export" ), this );
+	btExport->setToolTip( tr( "Save what was found for each file as CSV or JSON" ) );
+	btExport->setEnabled( false );
+	connect( btExport, &QPushButton::clicked, this, &TestShredder::exportResults );
+
 	QPushButton * btClose = new QPushButton( tr( "Close" ), this );
 	connect( btClose, &QPushButton::clicked, this, &TestShredder::close );
 
@@ -109,6 +143,7 @@ TestShredder::TestShredder()
 	hbox->addWidget( chkNif );
 	hbox->addWidget( chkKf );
 	hbox->addWidget( chkKfm );
+	hbox->addWidget( chkArchives );
 
 	lay->addLayout( hbox = new QHBoxLayout() );
 	hbox->addWidget( btChoose );
@@ -130,6 +165,7 @@ TestShredder::TestShredder()
 	lay->addLayout( hbox = new QHBoxLayout() );
 	hbox->addWidget( btRun );
 	hbox->addWidget( btXML );
+	hbox->addWidget( btExport );
 	hbox->addWidget( btClose );
 
 	renumberThreads( count->value() );
@@ -147,12 +183,15 @@ TestShredder::~TestShredder()
 	settings.setValue( "Check NIF", chkNif->isChecked() );
 	settings.setValue( "Check KF", chkKf->isChecked() );
 	settings.setValue( "Check KFM", chkKfm->isChecked() );
+	settings.setValue( "Check Archives", chkArchives->isChecked() );
 	settings.setValue( "Report Errors Only", repErr->isChecked() );
 	settings.setValue( "Threads", count->value() );
 
 	settings.endGroup();
 
+	scanner->stop();
 	queue.clear();
+	scanner->wait();
 }
 
 void TestShredder::xml()
@@ -168,9 +207,7 @@ void TestShredder::xml()
 void TestShredder::renumberThreads( int num )
 {
 	while ( threads.count() < num ) {
-		TestThread * thread = new TestThread( this, &queue );
-		connect( thread, &TestThread::sigStart, this, &TestShredder::threadStarted );
-		connect( thread, &TestThread::sigReady, text, &QTextBrowser::append );
+		TestThread * thread = new TestThread( this, &queue, scanner, &results );
 		connect( thread, &TestThread::finished, this, &TestShredder::threadFinished );
 		threads.append( thread );
 
@@ -191,16 +228,21 @@ void TestShredder::renumberThreads( int num )
 
 void TestShredder::run()
 {
-	progress->setMaximum( progress->maximum() - queue.count() );
+	scanner->stop();
 	queue.clear();
 
 	if ( !btRun->isChecked() )
 		return;
 
+	scanner->wait();
+
 	for ( TestThread * thread : threads ) {
 		thread->wait();
 	}
 
+	results.clear();
+	btExport->setEnabled( false );
+
 	text->clear();
 	label->setHidden( true );
 
@@ -213,12 +255,16 @@ void TestShredder::run()
 	if ( chkKfm->isChecked() )
 		extensions << "*.kfm";
 
-	queue.init( directory->text(), extensions, recursive->isChecked() );
+	// The files are tested while they are still being found
+	queue.begin();
+	scanner->setup( directory->text(), extensions, recursive->isChecked(), chkArchives->isChecked() );
+	scanner->start();
 
 	time = QDateTime::currentDateTime();
 
-	progress->setRange( 0, queue.count() );
+	progress->setRange( 0, 0 );
 	progress->setValue( 0 );
+	flushTimer->start();
 
 	for ( TestThread * thread : threads ) {
 		thread->verMatch = NifModel::version2number( verMatch->text() );
@@ -228,26 +274,50 @@ void TestShredder::run()
 	}
 }
 
-void TestShredder::threadStarted()
-{
-	progress->setValue( progress->maximum() - queue.count() );
-}
-
 void TestShredder::threadFinished()
 {
-	if ( queue.isEmpty() ) {
+	if ( queue.isEmpty() && !scanner->isRunning() ) {
 		for ( TestThread * thread : threads ) {
 			if ( thread->isRunning() )
 				return;
 		}
 
+		flushTimer->stop();
+		flush();
+
 		btRun->setChecked( false );
 
-		label->setText( tr( "%1 files in %2 seconds" ).arg( progress->maximum() ).arg( time.secsTo( QDateTime::currentDateTime() ) ) );
+		label->setText( tr( "%1 files in %2 seconds" ).arg( results.done() ).arg( time.secsTo( QDateTime::currentDateTime() ) )
+			+ "\n" + results.summary() );
 		label->setVisible( true );
+
+		btExport->setEnabled( results.count() > 0 );
 	}
 }
 
+void TestShredder::exportResults()
+{
+	QString fname = QFileDialog::getSaveFileName( this, tr( "Export Results" ), directory->text(), "CSV (*.csv);;JSON (*.json)" );
+
+	if ( fname.isEmpty() )
+		return;
+
+	if ( !results.exportFile( fname ) )
+		Message::critical( this, tr( "Could not write %1" ).arg( fname ) );
+}
+
+void TestShredder::flush()
+{
+	QStringList batch = results.take();
+
+	if ( !batch.isEmpty() )
+		text->append( batch.join( "<br>" ) );
+
+	// The total is known once all files have been found
+	progress->setRange( 0, queue.total() );
+	progress->setValue( results.done() );
+}
+
 void TestShredder::chooseBlock()
 {
 	QStringList ids = NifModel::allNiBlocks();
@@ -284,6 +354,12 @@ void TestShredder::chooseBlock()
 
 void TestShredder::closeEvent( QCloseEvent * e )
 {
+	if ( scanner->isRunning() ) {
+		e->ignore();
+		scanner->stop();
+		queue.clear();
+	}
+
 	for ( TestThread * thread : threads ) {
 		if ( thread->isRunning() ) {
 			e->ignore();
@@ -293,69 +369,282 @@ void TestShredder::closeEvent( QCloseEvent * e )
 }
 
 /*
- *  File Queue
+ *  File Scanner
  */
 
-QQueue<QString> FileQueue::make( const QString & dname, const QStringList & extensions, bool recursive )
+FileScanner::FileScanner( QObject * o, FileQueue * q )
+	: QThread( o ), queue( q )
+{
+}
+
+FileScanner::~FileScanner()
+{
+	stop();
+	wait();
+}
+
+void FileScanner::setup( const QString & dname, const QStringList & exts, bool recurse, bool withArchives )
+{
+	directory = dname;
+	extensions = exts;
+	recursive = recurse;
+	scanArchives = withArchives;
+	stopped.store( 0 );
+
+	QMutexLocker lock( &archiveMutex );
+	archives.clear();
+}
+
+void FileScanner::run()
 {
-	QQueue<QString> queue;
+	QStringList filters = extensions;
+	if ( scanArchives )
+		filters << "*.bsa" << "*.ba2";
 
-	QDir dir( dname );
+	QDirIterator it( directory, filters, QDir::Files, recursive ? QDirIterator::Subdirectories : QDirIterator::NoIteratorFlags );
 
-	if ( recursive ) {
-		dir.setFilter( QDir::Dirs );
-		for ( const QString& d : dir.entryList() ) {
-			if ( d != "." && d != ".." )
-				queue += make( dir.filePath( d ), extensions, true );
+	QStringList found;
+
+	while ( it.hasNext() && !stopped.load() ) {
+		QString file = it.next();
+
+		if ( scanArchives && ( file.endsWith( ".bsa", Qt::CaseInsensitive ) || file.endsWith( ".ba2", Qt::CaseInsensitive ) ) )
+			scanArchive( file, found );
+		else
+			found << file;
+
+		if ( found.count() >= SCAN_BATCH ) {
+			queue->append( found );
+			found.clear();
 		}
 	}
 
-	dir.setFilter( QDir::Files );
-	dir.setNameFilters( extensions );
-	for ( const QString& f : dir.entryList() ) {
-		queue.enqueue( dir.filePath( f ) );
+	queue->append( found );
+	queue->end();
+}
+
+void FileScanner::scanArchive( const QString & file, QStringList & found )
+{
+	auto handler = FSArchiveHandler::openArchive( file );
+	if ( !handler )
+		return;
+
+	QStringList files;
+	for ( const QString & ext : extensions )
+		files += handler->getArchive()->matchFiles( ext );
+
+	{
+		QMutexLocker lock( &archiveMutex );
+		archives.insert( file, handler );
 	}
 
-	return queue;
+	for ( const QString & f : files )
+		found << file + "/" + f;
 }
 
-void FileQueue::init( const QString & dname, const QStringList & extensions, bool recursive )
+bool FileScanner::archiveContents( const QString & file, QByteArray & data )
 {
-	QQueue<QString> queue = make( dname, extensions, recursive );
+	std::shared_ptr<FSArchiveHandler> handler;
+	QString path;
+
+	{
+		QMutexLocker lock( &archiveMutex );
+
+		for ( auto it = archives.constBegin(); it != archives.constEnd(); ++it ) {
+			if ( file.startsWith( it.key() + "/" ) ) {
+				handler = it.value();
+				path = file.mid( it.key().length() + 1 );
+				break;
+			}
+		}
+	}
 
-	mutex.lock();
-	this->queue = queue;
-	mutex.unlock();
+	return handler && handler->getArchive()->fileContents( path, data );
 }
 
-QString FileQueue::dequeue()
+/*
+ *  Test Results
+ */
+
+void TestResults::add( const QString & result )
 {
 	QMutexLocker lock( &mutex );
+	results << result;
+}
 
-	if ( queue.isEmpty() )
-		return QString();
+QStringList TestResults::take()
+{
+	QMutexLocker lock( &mutex );
+	QStringList taken;
+	taken.swap( results );
+	return taken;
+}
 
-	return queue.dequeue();
+void TestResults::add( const TestRecord & record )
+{
+	QMutexLocker lock( &mutex );
+	records.append( record );
 }
 
-int FileQueue::count()
+int TestResults::count() const
 {
 	QMutexLocker lock( &mutex );
-	return queue.count();
+	return records.count();
 }
 
-void FileQueue::clear()
+void TestResults::clear()
 {
 	QMutexLocker lock( &mutex );
-	queue.clear();
+	results.clear();
+	records.clear();
+	numDone.store( 0 );
+}
+
+QString TestRecord::errorName( ErrorClass error )
+{
+	switch ( error ) {
+	case Warning:
+		return "warning";
+	case LinkError:
+		return "link";
+	case BlockError:
+		return "block";
+	case HeaderError:
+		return "header";
+	default:
+		return QString();
+	}
+}
+
+QString TestResults::summary() const
+{
+	QMutexLocker lock( &mutex );
+
+	if ( records.isEmpty() )
+		return QString();
+
+	int errors[TestRecord::HeaderError + 1] = {};
+	int loaded = 0;
+	qint64 loadTime = 0;
+	const TestRecord * slowest = &records.first();
+
+	for ( const TestRecord & r : records ) {
+		errors[r.error]++;
+		loaded += r.loaded;
+		loadTime += r.loadTime;
+
+		if ( r.loadTime > slowest->loadTime )
+			slowest = &r;
+	}
+
+	return QCoreApplication::translate( "TestShredder", "%1 of %2 loaded; %3 header errors, %4 block errors, %5 link errors, %6 with warnings\n"
+		"average load %7 ms, slowest %8 ms: %9" )
+		.arg( loaded ).arg( records.count() )
+		.arg( errors[TestRecord::HeaderError] ).arg( errors[TestRecord::BlockError] )
+		.arg( errors[TestRecord::LinkError] ).arg( errors[TestRecord::Warning] )
+		.arg( double( loadTime ) / records.count() / 1000.0, 0, 'f', 2 )
+		.arg( double( slowest->loadTime ) / 1000.0, 0, 'f', 2 ).arg( slowest->file );
+}
+
+//! Quote a CSV field if needed
+static QString csvField( QString value )
+{
+	if ( value.contains( ',' ) || value.contains( '"' ) || value.contains( '\n' ) )
+		return "\"" + value.replace( "\"", "\"\"" ) + "\"";
+
+	return value;
+}
+
+bool TestResults::exportFile( const QString & fname ) const
+{
+	QVector<TestRecord> recs;
+
+	{
+		QMutexLocker lock( &mutex );
+		recs = records;
+	}
+
+	QSaveFile f( fname );
+	if ( !f.open( QIODevice::WriteOnly ) )
+		return false;
+
+	if ( fname.endsWith( ".json", Qt::CaseInsensitive ) ) {
+		QJsonArray files;
+		QMap<QString, int> versions, errors, blockTypes;
+		qint64 loadTime = 0;
+
+		for ( const TestRecord & r : recs ) {
+			QJsonObject types;
+			for ( auto it = r.blockTypes.constBegin(); it != r.blockTypes.constEnd(); ++it ) {
+				types.insert( it.key(), it.value() );
+				blockTypes[it.key()] += it.value();
+			}
+
+			QJsonObject file;
+			file.insert( "file", r.file );
+			file.insert( "version", r.version );
+			file.insert( "loaded", r.loaded );
+			file.insert( "loadTime", double( r.loadTime ) / 1000.0 );
+			file.insert( "blockTypes", types );
+			file.insert( "failedBlock", r.failedBlock );
+			file.insert( "error", TestRecord::errorName( r.error ) );
+			file.insert( "messages", r.messages );
+			files.append( file );
+
+			versions[r.version]++;
+			errors[TestRecord::errorName( r.error )]++;
+			loadTime += r.loadTime;
+		}
+
+		auto toObject = []( const QMap<QString, int> & map ) {
+			QJsonObject obj;
+			for ( auto it = map.constBegin(); it != map.constEnd(); ++it )
+				obj.insert( it.key().isEmpty() ? QString( "none" ) : it.key(), it.value() );
+			return obj;
+		};
+
+		QJsonObject summary;
+		summary.insert( "files", recs.count() );
+		summary.insert( "loadTime", double( loadTime ) / 1000.0 );
+		summary.insert( "versions", toObject( versions ) );
+		summary.insert( "errors", toObject( errors ) );
+		summary.insert( "blockTypes", toObject( blockTypes ) );
+
+		QJsonObject root;
+		root.insert( "summary", summary );
+		root.insert( "files", files );
+
+		f.write( QJsonDocument( root ).toJson() );
+	} else {
+		QTextStream out( &f );
+		out << "File,Version,Loaded,Load Time (ms),Blocks,Block Types,Failed Block,Error,Messages\n";
+
+		for ( const TestRecord & r : recs ) {
+			QStringList types;
+			int blocks = 0;
+			for ( auto it = r.blockTypes.constBegin(); it != r.blockTypes.constEnd(); ++it ) {
+				types << QString( "%1:%2" ).arg( it.key() ).arg( it.value() );
+				blocks += it.value();
+			}
+
+			out << csvField( r.file ) << "," << r.version << "," << ( r.loaded ? 1 : 0 ) << ","
+				<< QString::number( double( r.loadTime ) / 1000.0, 'f', 3 ) << "," << blocks << ","
+				<< csvField( types.join( ";" ) ) << "," << csvField( r.failedBlock ) << ","
+				<< TestRecord::errorName( r.error ) << "," << r.messages << "\n";
+		}
+
+		out.flush();
+	}
+
+	return f.commit();
 }
 
 /*
  *  Thread
  */
 
-TestThread::TestThread( QObject * o, FileQueue * q )
-	: QThread( o ), queue( q )
+TestThread::TestThread( QObject * o, FileQueue * q, FileScanner * s, TestResults * r )
+	: QThread( o ), queue( q ), scanner( s ), results( r )
 {
 	reportAll = true;
 }
@@ -364,6 +653,9 @@ TestThread::~TestThread()
 {
 	if ( isRunning() ) {
 		quit.lock();
+		// Stop waiting for files which are still being found
+		requestInterruption();
+		queue->wake();
 		wait();
 		quit.unlock();
 	}
@@ -372,63 +664,104 @@ TestThread::~TestThread()
 void TestThread::run()
 {
 	NifModel nif;
-	KfmModel kfm;
 
 	QString filepath = queue->dequeue();
 
 	while ( !filepath.isEmpty() ) {
-		emit sigStart( filepath );
+		TRACE_SPAN( "TestThread::run", filepath );
 
 		BaseModel * model = &nif;
-		QReadWriteLock * lock = &nif.XMLlock;
+
+		bool kf = ( filepath.endsWith( ".KF", Qt::CaseInsensitive ) || filepath.endsWith( ".KFA", Qt::CaseInsensitive ) );
+
+		// The files of an archive are read whole, so their header is checked after loading
+		QByteArray data;
+		bool inArchive = scanner && scanner->archiveContents( filepath, data );
 
 		if ( filepath.endsWith( ".KFM", Qt::CaseInsensitive ) ) {
-			model = &kfm;
-			lock  = &kfm.XMLlock;
-		}
+			// Only the sequences are checked, against the KF files next to the KFM
+			if ( !inArchive )
+				checkKfm( filepath );
+		} else if ( inArchive || nif.earlyRejection( filepath, blockMatch, verMatch ) ) {
+			bool loaded;
+			QElapsedTimer timer;
+			timer.start();
+
+			if ( inArchive ) {
+				QBuffer buffer( &data );
+				loaded = buffer.open( QIODevice::ReadOnly ) && nif.load( buffer );
+			} else {
+				loaded = model->loadFromFile( filepath );
+			}
 
-		bool kf = ( filepath.endsWith( ".KF", Qt::CaseInsensitive ) || filepath.endsWith( ".KFA", Qt::CaseInsensitive ) );
+			TestRecord record;
+			record.file = filepath;
+			record.version = model->getVersion();
+			record.loaded = loaded;
+			record.loadTime = timer.nsecsElapsed() / 1000;
 
-		{
-			// lock the XML lock
-			QReadLocker lck( lock );
+			QString result = QString( "<a href=\"nif:%1\">%1</a> (%2)" ).arg( filepath, model->getVersion() );
+			QList<TestMessage> messages = model->getMessages();
+			int linkErrors = 0;
 
-			if ( model == &nif && nif.earlyRejection( filepath, blockMatch, verMatch ) ) {
-				bool loaded = model->loadFromFile( filepath );
+			bool blk_match = false;
 
-				QString result = QString( "<a href=\"nif:%1\">%1</a> (%2)" ).arg( filepath, model->getVersion() );
-				QList<TestMessage> messages = model->getMessages();
+			for ( int b = 0; b < nif.getBlockCount(); b++ ) {
+				QString type = nif.getBlockName( nif.getBlock( b ) );
+				record.blockTypes[type]++;
 
-				bool blk_match = false;
+				if ( !loaded )
+					continue;
 
-				if ( loaded && model == &nif )
-					for ( int b = 0; b < nif.getBlockCount(); b++ ) {
-						// In case early rejection failed, such as if this is an older file without the block types in the header
-						// note if any of these blocks types match the specified one.
-						if ( blockMatch.isEmpty() == false && nif.inherits( nif.getBlockName( nif.getBlock( b ) ), blockMatch ) ) {
-							blk_match = true;
-						}
+				// In case early rejection failed, such as if this is an older file without the block types in the header
+				// note if any of these blocks types match the specified one.
+				if ( blockMatch.isEmpty() == false && nif.inherits( type, blockMatch ) ) {
+					blk_match = true;
+				}
 
-						messages += checkLinks( &nif, nif.getBlock( b ), kf );
-					}
+				QList<TestMessage> links = checkLinks( &nif, nif.getBlock( b ), kf );
+				linkErrors += links.count();
+				messages += links;
+			}
 
-				bool rep = reportAll;
+			// The block which failed is the last one added
+			if ( !loaded && nif.getBlockCount() > 0 )
+				record.failedBlock = nif.getBlockName( nif.getBlock( nif.getBlockCount() - 1 ) );
 
-				// Don't show anything if block match is on but the requested type wasn't found & we're in block match mode
-				if ( blockMatch.isEmpty() == true || blk_match == true ) {
-					for ( const TestMessage& msg : messages ) {
-						if ( msg.type() != QtDebugMsg ) {
-							result += "<br>" + msg;
-							rep |= true;
-						}
-					}
+			for ( const TestMessage& msg : messages ) {
+				if ( msg.type() != QtDebugMsg )
+					record.messages++;
+			}
+
+			if ( !loaded )
+				record.error = nif.getBlockCount() > 0 ? TestRecord::BlockError : TestRecord::HeaderError;
+			else if ( linkErrors > 0 )
+				record.error = TestRecord::LinkError;
+			else if ( record.messages > 0 )
+				record.error = TestRecord::Warning;
 
-					if ( rep )
-						emit sigReady( result );
+			bool rep = reportAll;
+
+			bool ver_match = !inArchive || verMatch == 0 || nif.getVersionNumber() == verMatch;
+
+			// Don't show anything if block match is on but the requested type wasn't found & we're in block match mode
+			if ( ver_match && ( blockMatch.isEmpty() == true || blk_match == true ) ) {
+				results->add( record );
+
+				for ( const TestMessage& msg : messages ) {
+					if ( msg.type() != QtDebugMsg ) {
+						result += "<br>" + msg;
+						rep |= true;
+					}
 				}
+
+				if ( rep )
+					results->add( result );
 			}
 		}
 
+		results->fileDone();
+
 		if ( quit.tryLock() )
 			quit.unlock();
 		else
@@ -438,6 +771,53 @@ void TestThread::run()
 	}
 }
 
+void TestThread::checkKfm( const QString & filepath )
+{
+	QElapsedTimer timer;
+	timer.start();
+
+	std::shared_ptr<const KfmIndex> kfm = KfmModel::loadSequenceIndex( filepath );
+
+	TestRecord record;
+	record.file = filepath;
+	record.loaded = bool( kfm );
+	record.loadTime = timer.nsecsElapsed() / 1000;
+
+	if ( !kfm ) {
+		record.error = TestRecord::HeaderError;
+		results->add( record );
+		results->add( QString( "<a href=\"nif:%1\">%1</a><br>%2" ).arg( filepath, tr( "could not be loaded" ) ) );
+		return;
+	}
+
+	record.version = KfmModel::version2string( kfm->version );
+
+	QString result = QString( "<a href=\"nif:%1\">%1</a> (%2)" ).arg( filepath, record.version );
+	QDir dir = QFileInfo( filepath ).dir();
+
+	for ( const KfmIndex::Sequence & seq : kfm->sequences ) {
+		if ( !seq.kf.isEmpty() && !dir.exists( seq.kf ) ) {
+			result += "<br>" + tr( "sequence %1: %2 not found" ).arg( seq.id ).arg( seq.kf );
+			record.messages++;
+		}
+
+		for ( const KfmIndex::Transition & trans : seq.transitions ) {
+			if ( !kfm->sequence( trans.target ) ) {
+				result += "<br>" + tr( "sequence %1: transition to unknown sequence %2" ).arg( seq.id ).arg( trans.target );
+				record.messages++;
+			}
+		}
+	}
+
+	if ( record.messages > 0 )
+		record.error = TestRecord::Warning;
+
+	results->add( record );
+
+	if ( reportAll || record.messages > 0 )
+		results->add( result );
+}
+
 static QString linkId( const NifModel * nif, QModelIndex idx )
 {
 	QString id = QString( "%1 (%2)" ).arg( nif->itemName( idx ), nif->itemTmplt( idx ) );
@@ -1,14 +1,20 @@
 #ifndef SPELL_DEBUG_H
 #define SPELL_DEBUG_H
 
+#include "batchrunner.h"
 #include "message.h"
 
 #include <QThread> // Inherited
 #include <QWidget> // Inherited
+#include <QAtomicInt>
+#include <QHash>
+#include <QMap>
 #include <QMutex>
-#include <QQueue>
 #include <QDateTime>
-#include <QWaitCondition>
+#include <QStringList>
+#include <QVector>
+
+#include <memory>
 
 
 class QCheckBox;
@@ -20,28 +26,108 @@ class QProgressBar;
 class QPushButton;
 class QSpinBox;
 class QTextBrowser;
+class QTimer;
 class QVBoxLayout;
 
 class FileSelector;
-
-class FileQueue final
+class FSArchiveHandler;
+
+//! Finds the files below a directory on its own thread, queueing them while testing starts
+/*!
+ * The files of the archives found are queued too, as the path of the archive
+ * followed by the path in the archive.
+ */
+class FileScanner final : public QThread
 {
 public:
-	FileQueue() {}
+	FileScanner( QObject * o, FileQueue * q );
+	~FileScanner();
+
+	//! Set what to look for; FileQueue::begin() is called before start()
+	void setup( const QString & directory, const QStringList & extensions, bool recursive, bool archives );
+	//! Stop looking for files, those found so far stay queued
+	void stop() { stopped.store( 1 ); }
+
+	//! Read a file of an archive, returning false for a loose file
+	bool archiveContents( const QString & file, QByteArray & data );
+
+protected:
+	void run() override final;
+	//! Queue the files of an archive
+	void scanArchive( const QString & file, QStringList & found );
 
-	QString dequeue();
+	FileQueue * queue;
 
-	bool isEmpty() { return count() == 0; }
-	int count();
+	QString directory;
+	QStringList extensions;
+	bool recursive = true;
+	bool scanArchives = false;
+
+	QAtomicInt stopped;
+
+	//! The archives by path, kept open until the next scan
+	QHash<QString, std::shared_ptr<FSArchiveHandler>> archives;
+	QMutex archiveMutex;
+};
+
+//! What was found testing a file, kept for the statistics and the export of the XML checker
+struct TestRecord
+{
+	//! The most severe problem of a file
+	enum ErrorClass
+	{
+		NoError,
+		Warning,     //!< Messages other than link errors
+		LinkError,   //!< Invalid links or links to the wrong block type
+		BlockError,  //!< The header was read but a block could not be
+		HeaderError  //!< The file could not be opened or its header read
+	};
+
+	QString file;
+	QString version;
+	bool loaded = false;
+	//! Microseconds taken to load the file
+	qint64 loadTime = 0;
+	//! The number of blocks of each type
+	QMap<QString, int> blockTypes;
+	//! The type of the block being read when loading failed
+	QString failedBlock;
+	ErrorClass error = NoError;
+	//! The number of messages reported, other than debug messages
+	int messages = 0;
+
+	static QString errorName( ErrorClass error );
+};
+
+//! The results of the test threads, taken by the widget in batches
+class TestResults final
+{
+public:
+	void add( const QString & result );
+	//! Keep the record of a tested file
+	void add( const TestRecord & record );
+	//! Count a file as tested
+	void fileDone() { numDone.ref(); }
+
+	//! Take the results added since the last call
+	QStringList take();
+	//! The number of files tested
+	int done() const { return numDone.load(); }
+	//! The number of records kept
+	int count() const;
+
+	//! A few lines of statistics on the records
+	QString summary() const;
+	//! Write the records as CSV, or as JSON with the statistics if the file name ends in .json
+	bool exportFile( const QString & fname ) const;
 
-	void init( const QString & directory, const QStringList & extensions, bool recursive );
 	void clear();
 
 protected:
-	QQueue<QString> make( const QString & directory, const QStringList & extensions, bool recursive );
-
-	QMutex mutex;
-	QQueue<QString> queue;
+	mutable QMutex mutex;
+	QStringList results;
+	QVector<TestRecord> records;
+	QAtomicInt numDone;
 };
 
 class TestThread final : public QThread
@@ -49,23 +135,23 @@ class TestThread final : public QThread
 	Q_OBJECT
 
 public:
-	TestThread( QObject * o, FileQueue * q );
+	TestThread( QObject * o, FileQueue * q, FileScanner * s, TestResults * r );
 	~TestThread();
 
 	QString blockMatch;
 	quint32 verMatch;
 	bool reportAll;
 
-signals:
-	void sigStart( const QString & file );
-	void sigReady( const QString & result );
-
 protected:
 	void run() override final;
 
 	QList<TestMessage> checkLinks( const class NifModel * nif, const class QModelIndex & iParent, bool kf );
+	//! Check that the KF files and the transitions of the sequences of a KFM exist
+	void checkKfm( const QString & filepath );
 
 	FileQueue * queue;
+	FileScanner * scanner;
+	TestResults * results;
 
 	QMutex quit;
 };
@@ -86,8 +172,11 @@ protected slots:
 	void run();
 	void xml();
 
-	void threadStarted();
 	void threadFinished();
+	//! Show the results and progress collected since the last call
+	void flush();
+	//! Save the records of the last run
+	void exportResults();
 
 	void renumberThreads( int );
 
@@ -97,7 +186,7 @@ protected:
 	FileSelector * directory;
 	QLineEdit * blockMatch;
 	QCheckBox * recursive;
-	QCheckBox * chkNif, * chkKf, * chkKfm;
+	QCheckBox * chkNif, * chkKf, * chkKfm, * chkArchives;
 	QCheckBox * repErr;
 	QSpinBox * count;
 	QLineEdit * verMatch;
@@ -105,8 +194,12 @@ protected:
 	QProgressBar * progress;
 	QLabel * label;
 	QPushButton * btRun;
+	QPushButton * btExport;
 
 	FileQueue queue;
+	FileScanner * scanner;
+	TestResults results;
+	QTimer * flushTimer;
 
 	QList<TestThread *> threads;
 